@@ -150,6 +150,7 @@ Cam_DoTrace(vec3_t vec1, vec3_t vec2)
 #endif
 
     VectorCopy(vec1, pmove.origin);
+    PM_SetupPhysents();
     return PM_PlayerMove(pmove.origin, vec2);
 }
 
@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "cmd.h"
 #include "common.h"
 #include "console.h"
+#include "net.h"
 #include "pmove.h"
 #include "quakedef.h"
 #include "sys.h"
@@ -39,9 +40,113 @@ NET_GetMessages are read from the demo file.
 
 Whenever cl.time gets past the last received message, another message is
 read from the demo file.
+
+A relay (qwrelay) stream is played back the same way, read into a buffer
+from its socket instead of the file. A message is only taken from it once
+the whole of it is there.
 ==============================================================================
 */
 
+#define CL_RELAY_BUFSIZE 0x10000
+
+static struct {
+    int socket;			// -1 when playing from the demo file
+    qboolean closed;
+    byte buf[CL_RELAY_BUFSIZE];
+    int length;			// buffered, read up to pos
+    int pos;
+} cl_relay = { .socket = -1 };
+
+/*
+====================
+CL_DemoRead
+
+Reads the next part of a message, true if it was all there
+====================
+*/
+static qboolean
+CL_DemoRead(void *data, int length)
+{
+    if (cl_relay.socket < 0)
+	return fread(data, length, 1, cls.demofile) == 1;
+
+    if (cl_relay.length - cl_relay.pos < length)
+	return false;
+    memcpy(data, cl_relay.buf + cl_relay.pos, length);
+    cl_relay.pos += length;
+
+    return true;
+}
+
+static void
+CL_DemoUnread(int length)
+{
+    if (cl_relay.socket < 0)
+	fseek(cls.demofile, ftell(cls.demofile) - length, SEEK_SET);
+    else
+	cl_relay.pos -= length;
+}
+
+/*
+====================
+CL_RelayMessageReady
+
+Reads what the relay has sent and says if a whole message is buffered
+====================
+*/
+static qboolean
+CL_RelayMessageReady(void)
+{
+    const byte *p;
+    int ret, available, length;
+
+    if (cl_relay.pos) {
+	memmove(cl_relay.buf, cl_relay.buf + cl_relay.pos,
+		cl_relay.length - cl_relay.pos);
+	cl_relay.length -= cl_relay.pos;
+	cl_relay.pos = 0;
+    }
+    while (!cl_relay.closed && cl_relay.length < CL_RELAY_BUFSIZE) {
+	ret = NET_StreamRecv(cl_relay.socket, cl_relay.buf + cl_relay.length,
+			     CL_RELAY_BUFSIZE - cl_relay.length);
+	if (ret < 0)
+	    cl_relay.closed = true;
+	if (ret <= 0)
+	    break;
+	cl_relay.length += ret;
+    }
+
+    p = cl_relay.buf;
+    available = cl_relay.length;
+    length = 0;
+    if (available >= 5) {
+	switch (p[4]) {
+	case dem_cmd:
+	    length = 5 + sizeof(usercmd_t) + 12;
+	    break;
+	case dem_read:
+	    if (available >= 9)
+		length = 9 + LittleLong(*(const int *)(p + 5));
+	    break;
+	case dem_set:
+	    length = 5 + 8;
+	    break;
+	default:
+	    length = 5;		// corrupted, let the parsing say so
+	    break;
+	}
+    }
+    if (length && available >= length)
+	return true;
+
+    if (cl_relay.closed) {
+	Con_Printf("Relay stream closed.\n");
+	CL_StopPlayback();
+    }
+
+    return false;
+}
+
 /*
 ==============
 CL_StopPlayback
@@ -55,8 +160,13 @@ CL_StopPlayback(void)
     if (!cls.demoplayback)
 	return;
 
-    fclose(cls.demofile);
-    cls.demofile = NULL;
+    if (cl_relay.socket >= 0) {
+	NET_StreamClose(cl_relay.socket);
+	cl_relay.socket = -1;
+    } else {
+	fclose(cls.demofile);
+	cls.demofile = NULL;
+    }
     cls.state = ca_disconnected;
     cls.demoplayback = false;
 
@@ -64,10 +174,6 @@ CL_StopPlayback(void)
 	CL_FinishTimeDemo();
 }
 
-#define dem_cmd		0
-#define dem_read	1
-#define dem_set		2
-
 /*
 ====================
 CL_WriteDemoCmd
@@ -152,14 +258,17 @@ CL_GetDemoMessage
 qboolean
 CL_GetDemoMessage(void)
 {
-    int r, i, j;
+    int i, j;
     float f;
     float demotime;
     byte c;
     usercmd_t *pcmd;
 
+    if (cl_relay.socket >= 0 && !CL_RelayMessageReady())
+	return 0;
+
     // read the time from the packet
-    fread(&demotime, sizeof(demotime), 1, cls.demofile);
+    CL_DemoRead(&demotime, sizeof(demotime));
     demotime = LittleFloat(demotime);
 
 // decide if it is time to grab the next message
@@ -169,8 +278,7 @@ CL_GetDemoMessage(void)
 	else if (demotime > cls.td_lastframe) {
 	    cls.td_lastframe = demotime;
 	    // rewind back to time
-	    fseek(cls.demofile, ftell(cls.demofile) - sizeof(demotime),
-		  SEEK_SET);
+	    CL_DemoUnread(sizeof(demotime));
 	    return 0;		// allready read this frame's message
 	}
 	if (!cls.td_starttime && cls.state == ca_active) {
@@ -183,13 +291,11 @@ CL_GetDemoMessage(void)
 	    // too far back
 	    realtime = demotime - 1.0;
 	    // rewind back to time
-	    fseek(cls.demofile, ftell(cls.demofile) - sizeof(demotime),
-		  SEEK_SET);
+	    CL_DemoUnread(sizeof(demotime));
 	    return 0;
 	} else if (realtime < demotime) {
 	    // rewind back to time
-	    fseek(cls.demofile, ftell(cls.demofile) - sizeof(demotime),
-		  SEEK_SET);
+	    CL_DemoUnread(sizeof(demotime));
 	    return 0;		// don't need another message yet
 	}
     } else
@@ -199,15 +305,14 @@ CL_GetDemoMessage(void)
 	Host_Error("CL_GetDemoMessage: cls.state != ca_active");
 
     // get the msg type
-    fread(&c, sizeof(c), 1, cls.demofile);
+    CL_DemoRead(&c, sizeof(c));
 
     switch (c) {
     case dem_cmd:
 	// user sent input
 	i = cls.netchan.outgoing_sequence & UPDATE_MASK;
 	pcmd = &cl.frames[i].cmd;
-	r = fread(pcmd, sizeof(*pcmd), 1, cls.demofile);
-	if (r != 1) {
+	if (!CL_DemoRead(pcmd, sizeof(*pcmd))) {
 	    CL_StopPlayback();
 	    return 0;
 	}
@@ -221,29 +326,28 @@ CL_GetDemoMessage(void)
 	cl.frames[i].receivedtime = -1;	// we haven't gotten a reply yet
 	cls.netchan.outgoing_sequence++;
 	for (i = 0; i < 3; i++) {
-	    fread(&f, 4, 1, cls.demofile);
+	    CL_DemoRead(&f, 4);
 	    cl.viewangles[i] = LittleFloat(f);
 	}
 	break;
 
     case dem_read:
 	// get the next message
-	fread(&net_message.cursize, 4, 1, cls.demofile);
+	CL_DemoRead(&net_message.cursize, 4);
 	net_message.cursize = LittleLong(net_message.cursize);
 	//Con_Printf("read: %ld bytes\n", net_message.cursize);
 	if (net_message.cursize > MAX_MSGLEN)
 	    Sys_Error("Demo message > MAX_MSGLEN");
-	r = fread(net_message.data, net_message.cursize, 1, cls.demofile);
-	if (r != 1) {
+	if (!CL_DemoRead(net_message.data, net_message.cursize)) {
 	    CL_StopPlayback();
 	    return 0;
 	}
 	break;
 
     case dem_set:
-	fread(&i, 4, 1, cls.demofile);
+	CL_DemoRead(&i, 4);
 	cls.netchan.outgoing_sequence = LittleLong(i);
-	fread(&i, 4, 1, cls.demofile);
+	CL_DemoRead(&i, 4);
 	cls.netchan.incoming_sequence = LittleLong(i);
 	break;
 
@@ -422,6 +526,7 @@ CL_Record_f(void)
 	Con_Printf("ERROR: couldn't open.\n");
 	return;
     }
+    COM_FlushScanCache();
 
     Con_Printf("recording to %s.\n", name);
     cls.demorecording = true;
@@ -701,6 +806,7 @@ CL_ReRecord_f(void)
 	Con_Printf("ERROR: couldn't open.\n");
 	return;
     }
+    COM_FlushScanCache();
 
     Con_Printf("recording to %s.\n", name);
     cls.demorecording = true;
@@ -751,6 +857,58 @@ CL_PlayDemo_f(void)
     realtime = 0;
 }
 
+/*
+====================
+CL_RelayWatch_f
+
+relaywatch <address:port> [delay]
+====================
+*/
+void
+CL_RelayWatch_f(void)
+{
+    char hello[64];
+    netadr_t addr;
+    float delay;
+    int s, length;
+
+    if (Cmd_Argc() != 2 && Cmd_Argc() != 3) {
+	Con_Printf("relaywatch <address:port> [delay] : "
+		   "watch a server through a relay\n");
+	return;
+    }
+    if (!NET_StringToAdr(Cmd_Argv(1), &addr) || !addr.port) {
+	Con_Printf("Bad relay address %s\n", Cmd_Argv(1));
+	return;
+    }
+    delay = Cmd_Argc() == 3 ? Q_atof(Cmd_Argv(2)) : 0;
+
+    CL_Disconnect();
+
+    s = NET_StreamOpen(addr);
+    if (s < 0) {
+	cls.demonum = -1;	// stop demo loop
+	return;
+    }
+    length = snprintf(hello, sizeof(hello), "QWRELAY WATCH %g\n", delay);
+    if (NET_StreamSend(s, hello, length) != length) {
+	Con_Printf("ERROR: couldn't talk to the relay.\n");
+	NET_StreamClose(s);
+	cls.demonum = -1;
+	return;
+    }
+    Con_Printf("Watching %s, %g seconds behind.\n", NET_AdrToString(addr),
+	       delay);
+
+    cl_relay.socket = s;
+    cl_relay.closed = false;
+    cl_relay.length = cl_relay.pos = 0;
+    cls.demoplayback = true;
+    cls.state = ca_demostart;
+    Netchan_Setup(&cls.netchan, net_from, 0);
+    realtime = 0;
+}
+
 struct stree_root *
 CL_Demo_Arg_f(const char *arg)
 {
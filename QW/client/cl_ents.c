@@ -42,6 +42,24 @@ static struct predicted_player {
     vec3_t origin;		// predicted origin
 } predicted_players[MAX_CLIENTS];
 
+/*
+ * The other players' predicted moves, kept from frame to frame so that
+ * each frame only moves them on by the time since the last one, until the
+ * next update for them arrives. Moving on in steps is what CL_PredictUsercmd
+ * does with long moves anyway. The first phase, without the other players
+ * solid, is kept apart from the one that's drawn, since they clip
+ * differently.
+ */
+typedef struct {
+    int parsecount;		// the update it was predicted from
+    double state_time;
+    int msec;			// how far it's been moved on from there
+    player_state_t state;
+} predictedmove_t;
+
+enum { PREDICT_UNCLIPPED, PREDICT_CLIPPED, PREDICT_PHASES };
+static predictedmove_t predicted_moves[PREDICT_PHASES][MAX_CLIENTS];
+
 typedef struct visedict_info_s {
     int keynum;
     vec3_t origin;
@@ -54,6 +72,26 @@ typedef struct visedict_info_s {
 static visedict_info_t saved_visedicts[MAX_VISEDICTS];
 static int num_saved_visedicts;
 
+/*
+ * With cl_lerpbuffer, the packet entities are drawn as they were a little
+ * before the last packet came in, between the frames either side of then.
+ * That's a mean gap between packets, for there to be one to lerp to, plus
+ * as much as the gaps have been wandering from it.
+ */
+#define LERP_PACKETS		16	// power of two
+#define LERP_JITTER_SCALE	2	// deviations of jitter to ride out
+#define LERP_MAXDELAY		0.2	// never drawn further back than this
+
+typedef struct {
+    int sequence;		// of the frame the entities are in
+    double time;		// realtime they came in
+} lerppacket_t;
+
+static lerppacket_t lerp_packets[LERP_PACKETS];
+static int lerp_numpackets;
+static float lerp_packetgap;	// mean gap between packets
+static float lerp_jitter;	// mean deviation of the gaps from it
+
 //============================================================
 
 float dl_colors[4][4] = {
@@ -167,7 +205,8 @@ Can go from either a baseline or a previous packet_entity
 static void
 CL_ParseDelta(entity_state_t *from, entity_state_t *to, int bits)
 {
-    int i;
+    msgreader_t msg;
+    int length;
 
     // set everything to the state we are delta'ing from
     *to = *from;
@@ -175,48 +214,62 @@ CL_ParseDelta(entity_state_t *from, entity_state_t *to, int bits)
     to->number = bits & 511;
     bits &= ~511;
 
+    MSG_BeginReader(&msg);
     if (bits & U_MOREBITS) {	// read in the low order bits
-	i = MSG_ReadByte();
-	bits |= i;
+	if (!MSG_Need(&msg, 1))
+	    goto badread;
+	bits |= MSG_TakeByte(&msg);
     }
     to->flags = bits;
 
+    // every field is a byte but the coords, check them all at once
+    length = !!(bits & U_MODEL) + !!(bits & U_FRAME) + !!(bits & U_COLORMAP)
+	+ !!(bits & U_SKIN) + !!(bits & U_EFFECTS) + !!(bits & U_ANGLE1)
+	+ !!(bits & U_ANGLE2) + !!(bits & U_ANGLE3)
+	+ 2 * (!!(bits & U_ORIGIN1) + !!(bits & U_ORIGIN2)
+	       + !!(bits & U_ORIGIN3));
+    if (!MSG_Need(&msg, length))
+	goto badread;
+
     if (bits & U_MODEL)
-	to->modelindex = MSG_ReadByte();
+	to->modelindex = MSG_TakeByte(&msg);
 
     if (bits & U_FRAME)
-	to->frame = MSG_ReadByte();
+	to->frame = MSG_TakeByte(&msg);
 
     if (bits & U_COLORMAP)
-	to->colormap = MSG_ReadByte();
+	to->colormap = MSG_TakeByte(&msg);
 
     if (bits & U_SKIN)
-	to->skinnum = MSG_ReadByte();
+	to->skinnum = MSG_TakeByte(&msg);
 
     if (bits & U_EFFECTS)
-	to->effects = MSG_ReadByte();
+	to->effects = MSG_TakeByte(&msg);
 
     if (bits & U_ORIGIN1)
-	to->origin[0] = MSG_ReadCoord();
+	to->origin[0] = MSG_TakeCoord(&msg);
 
     if (bits & U_ANGLE1)
-	to->angles[0] = MSG_ReadAngle();
+	to->angles[0] = MSG_TakeAngle(&msg);
 
     if (bits & U_ORIGIN2)
-	to->origin[1] = MSG_ReadCoord();
+	to->origin[1] = MSG_TakeCoord(&msg);
 
     if (bits & U_ANGLE2)
-	to->angles[1] = MSG_ReadAngle();
+	to->angles[1] = MSG_TakeAngle(&msg);
 
     if (bits & U_ORIGIN3)
-	to->origin[2] = MSG_ReadCoord();
+	to->origin[2] = MSG_TakeCoord(&msg);
 
     if (bits & U_ANGLE3)
-	to->angles[2] = MSG_ReadAngle();
+	to->angles[2] = MSG_TakeAngle(&msg);
 
     if (bits & U_SOLID) {
 	// FIXME
     }
+
+badread:
+    MSG_EndReader(&msg);
 }
 
 
@@ -251,6 +304,35 @@ FlushEntityPacket(void)
     }
 }
 
+/*
+===============
+CL_KeepLerpPacket
+
+Notes when the entities just parsed came in, and how regularly they come
+===============
+*/
+static void
+CL_KeepLerpPacket(void)
+{
+    lerppacket_t *last, *packet;
+    float gap;
+
+    last = &lerp_packets[(lerp_numpackets - 1) & (LERP_PACKETS - 1)];
+    if (lerp_numpackets && last->sequence >= cls.netchan.incoming_sequence)
+	lerp_numpackets = 0;	// a new connection
+    if (lerp_numpackets) {
+	gap = realtime - last->time;
+	if (gap < LERP_MAXDELAY * 2) {
+	    lerp_packetgap += (gap - lerp_packetgap) / 16;
+	    lerp_jitter += (fabs(gap - lerp_packetgap) - lerp_jitter) / 16;
+	}
+    }
+
+    packet = &lerp_packets[lerp_numpackets++ & (LERP_PACKETS - 1)];
+    packet->sequence = cls.netchan.incoming_sequence;
+    packet->time = realtime;
+}
+
 /*
 ==================
 CL_ParsePacketEntities
@@ -379,9 +461,72 @@ CL_ParsePacketEntities(qboolean delta)
 
     }
     newp->num_entities = newindex;
+    CL_KeepLerpPacket();
 }
 
 
+/*
+===============
+CL_LerpPackets
+
+Finds the kept frames either side of the playout time, false if it's past
+the newest or they're gone
+===============
+*/
+static qboolean
+CL_LerpPackets(packet_entities_t **from, packet_entities_t **to, float *frac)
+{
+    const lerppacket_t *packet, *older, *newer;
+    double time;
+    int i, count;
+
+    if (!cl_lerpbuffer.value || cls.timedemo)
+	return false;
+
+    time = realtime - qmin(lerp_packetgap + LERP_JITTER_SCALE * lerp_jitter,
+			   LERP_MAXDELAY);
+    count = qmin(lerp_numpackets, LERP_PACKETS);
+    older = newer = NULL;
+    for (i = 0; i < count; i++) {
+	packet = &lerp_packets[(lerp_numpackets - 1 - i) & (LERP_PACKETS - 1)];
+	if (cls.netchan.incoming_sequence - packet->sequence >= UPDATE_BACKUP)
+	    break;		// the frame has been reused
+	if (packet->time <= time) {
+	    older = packet;
+	    break;
+	}
+	newer = packet;
+    }
+    if (!older || !newer)
+	return false;
+
+    *from = &cl.frames[older->sequence & UPDATE_MASK].packet_entities;
+    *to = &cl.frames[newer->sequence & UPDATE_MASK].packet_entities;
+    *frac = (time - older->time) / (newer->time - older->time);
+
+    return true;
+}
+
+static const entity_state_t *
+CL_FindPacketEntity(const packet_entities_t *pack, int number)
+{
+    int low, high, mid;
+
+    low = 0;
+    high = pack->num_entities - 1;
+    while (low <= high) {
+	mid = (low + high) / 2;
+	if (pack->entities[mid].number == number)
+	    return &pack->entities[mid];
+	if (pack->entities[mid].number < number)
+	    low = mid + 1;
+	else
+	    high = mid - 1;
+    }
+
+    return NULL;
+}
+
 /*
 ===============
 CL_LinkPacketEntities
@@ -392,9 +537,11 @@ static void
 CL_LinkPacketEntities(void)
 {
     entity_t *ent;
-    packet_entities_t *pack;
-    entity_state_t *s1, *s2;
-    float f;
+    packet_entities_t *pack, *lerpfrom, *lerpto;
+    entity_state_t *s1;
+    const entity_state_t *from, *to;
+    float f, lerpfrac;
+    qboolean lerp;
     model_t *model;
     vec3_t old_origin;
     float autorotate;
@@ -408,11 +555,10 @@ CL_LinkPacketEntities(void)
 
     autorotate = anglemod(100 * cl.time);
 
-    f = 0;			// FIXME: no interpolation right now
+    lerp = CL_LerpPackets(&lerpfrom, &lerpto, &lerpfrac);
 
     for (pnum = 0; pnum < pack->num_entities; pnum++) {
 	s1 = &pack->entities[pnum];
-	s2 = s1;		// FIXME: no interpolation right now
 
 	// spawn light flashes, even ones coming from invisible objects
 	if ((s1->effects & (EF_BLUE | EF_RED)) == (EF_BLUE | EF_RED))
@@ -461,6 +607,21 @@ CL_LinkPacketEntities(void)
 	// set frame
 	ent->frame = s1->frame;
 
+	// move it between the frames either side of the playout time
+	from = to = s1;
+	f = 0;
+	if (lerp) {
+	    to = CL_FindPacketEntity(lerpto, s1->number);
+	    if (to)
+		from = CL_FindPacketEntity(lerpfrom, s1->number);
+	    if (!to || !from)
+		from = to = s1;
+	    f = lerpfrac;
+	    for (i = 0; i < 3; i++)
+		if (fabs(to->origin[i] - from->origin[i]) > 100)
+		    from = to;	// a teleport, don't lerp it
+	}
+
 	// rotate binary objects locally
 	if (model->flags & EF_ROTATE) {
 	    ent->angles[0] = 0;
@@ -470,8 +631,8 @@ CL_LinkPacketEntities(void)
 	    float a1, a2;
 
 	    for (i = 0; i < 3; i++) {
-		a1 = s1->angles[i];
-		a2 = s2->angles[i];
+		a1 = to->angles[i];
+		a2 = from->angles[i];
 		if (a1 - a2 > 180)
 		    a1 -= 360;
 		if (a1 - a2 < -180)
@@ -482,8 +643,8 @@ CL_LinkPacketEntities(void)
 
 	// calculate origin
 	for (i = 0; i < 3; i++)
-	    ent->origin[i] = s2->origin[i] +
-		f * (s1->origin[i] - s2->origin[i]);
+	    ent->origin[i] = from->origin[i] +
+		f * (to->origin[i] - from->origin[i]);
 
 	// add automatic particle trails
 	if (!model->flags)
@@ -540,7 +701,7 @@ typedef struct {
     vec3_t angles;
 } projectile_t;
 
-#define	MAX_PROJECTILES	32
+#define	MAX_PROJECTILES	64	// nails and svc_projectiles
 static projectile_t cl_projectiles[MAX_PROJECTILES];
 static int cl_num_projectiles;
 
@@ -554,18 +715,21 @@ CL_ClearProjectiles(void)
 =====================
 CL_ParseProjectiles
 
-Nails are passed as efficient temporary entities
+Nails are passed as efficient temporary entities.
+svc_projectiles sends other models the same way, each with its model index.
 =====================
 */
 void
-CL_ParseProjectiles(void)
+CL_ParseProjectiles(qboolean withmodel)
 {
     int i, c, j;
+    int modelindex;
     byte bits[6];
     projectile_t *pr;
 
     c = MSG_ReadByte();
     for (i = 0; i < c; i++) {
+	modelindex = withmodel ? MSG_ReadByte() : cl_spikeindex;
 	for (j = 0; j < 6; j++)
 	    bits[j] = MSG_ReadByte();
 
@@ -575,7 +739,7 @@ CL_ParseProjectiles(void)
 	pr = &cl_projectiles[cl_num_projectiles];
 	cl_num_projectiles++;
 
-	pr->modelindex = cl_spikeindex;
+	pr->modelindex = modelindex;
 	pr->origin[0] = ((bits[0] + ((bits[1] & 15) << 8)) << 1) - 4096;
 	pr->origin[1] = (((bits[1] >> 4) + (bits[2] << 4)) << 1) - 4096;
 	pr->origin[2] = ((bits[3] + ((bits[4] & 15) << 8)) << 1) - 4096;
@@ -762,6 +926,37 @@ CL_AddFlagModels(entity_t *ent, int team)
     newent->angles[2] -= 45;
 }
 
+/*
+=============
+CL_PredictPlayer
+
+The player's state moved on msec from the update, picking up from where
+the last frame's prediction left off
+=============
+*/
+static const player_state_t *
+CL_PredictPlayer(predictedmove_t *move, player_state_t *state, int msec)
+{
+    usercmd_t cmd;
+
+    if (move->parsecount != cl.parsecount
+	|| move->state_time != state->state_time || msec < move->msec) {
+	move->parsecount = cl.parsecount;
+	move->state_time = state->state_time;
+	move->msec = 0;
+	move->state = *state;
+    }
+
+    if (msec > move->msec) {
+	cmd = state->command;
+	cmd.msec = msec - move->msec;
+	CL_PredictUsercmd(&move->state, &move->state, &cmd, false);
+	move->msec = msec;
+    }
+
+    return &move->state;
+}
+
 /*
 =============
 CL_LinkPlayers
@@ -776,7 +971,7 @@ CL_LinkPlayers(void)
     int j;
     player_info_t *info;
     player_state_t *state;
-    player_state_t exact;
+    const player_state_t *exact;
     double playertime;
     entity_t *ent;
     int msec;
@@ -861,9 +1056,10 @@ CL_LinkPlayers(void)
 
 	    oldphysent = pmove.numphysent;
 	    CL_SetSolidPlayers(j);
-	    CL_PredictUsercmd(state, &exact, &state->command, false);
+	    exact = CL_PredictPlayer(&predicted_moves[PREDICT_CLIPPED][j],
+				     state, msec);
 	    pmove.numphysent = oldphysent;
-	    VectorCopy(exact.origin, ent->origin);
+	    VectorCopy(exact->origin, ent->origin);
 	}
 
 	if (state->effects & EF_FLAG1)
@@ -899,7 +1095,7 @@ CL_SetSolidEntities(void)
     frame = &cl.frames[parsecountmod];
     pak = &frame->packet_entities;
 
-    for (i = 0; i < pak->num_entities; i++) {
+    for (i = 0; i < pak->num_entities && pmove.numphysent < MAX_PHYSENTS; i++) {
 	state = &pak->entities[i];
 
 	if (!state->modelindex)
@@ -932,7 +1128,7 @@ CL_SetUpPlayerPrediction(qboolean dopred)
 {
     int j;
     player_state_t *state;
-    player_state_t exact;
+    const player_state_t *exact;
     double playertime;
     int msec;
     frame_t *frame;
@@ -979,8 +1175,10 @@ CL_SetUpPlayerPrediction(qboolean dopred)
 		state->command.msec = msec;
 		//Con_DPrintf ("predict: %i\n", msec);
 
-		CL_PredictUsercmd(state, &exact, &state->command, false);
-		VectorCopy(exact.origin, pplayer->origin);
+		exact =
+		    CL_PredictPlayer(&predicted_moves[PREDICT_UNCLIPPED][j],
+				     state, msec);
+		VectorCopy(exact->origin, pplayer->origin);
 	    }
 	}
     }
@@ -1020,6 +1218,9 @@ CL_SetSolidPlayers(int playernum)
 	if (pplayer->flags & PF_DEAD)
 	    continue;		// dead players aren't solid
 
+	if (pmove.numphysent == MAX_PHYSENTS)
+	    break;
+
 	pent->model = 0;
 	VectorCopy(pplayer->origin, pent->origin);
 	VectorCopy(player_mins, pent->mins);
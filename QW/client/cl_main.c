@@ -36,6 +36,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "console.h"
 #include "draw.h"
 #include "input.h"
+#include "jobs.h"
 #include "keys.h"
 #include "menu.h"
 #include "model.h"
@@ -73,6 +74,8 @@ cvar_t cl_shownet = { "cl_shownet", "0" };	// can be 0, 1, or 2
 cvar_t cl_sbar = { "cl_sbar", "0", true };
 cvar_t cl_hudswap = { "cl_hudswap", "0", true };
 cvar_t cl_maxfps = { "cl_maxfps", "0", true };
+cvar_t cl_dlwindow = { "cl_dlwindow", "16384", true };	// bytes streamed ahead
+cvar_t cl_httpdownload = { "cl_httpdownload", "1", true };	// use sv_downloadurl
 
 cvar_t lookspring = { "lookspring", "0", true };
 cvar_t lookstrafe = { "lookstrafe", "0", true };
@@ -87,6 +90,7 @@ cvar_t entlatency = { "entlatency", "20" };
 cvar_t cl_predict_players = { "cl_predict_players", "1" };
 cvar_t cl_predict_players2 = { "cl_predict_players2", "1" };
 cvar_t cl_solid_players = { "cl_solid_players", "1" };
+cvar_t cl_lerpbuffer = { "cl_lerpbuffer", "1" };
 
 cvar_t localid = { "localid", "" };
 
@@ -375,6 +379,8 @@ CL_ClearState(void)
 
 // wipe the entire cl structure
     memset(&cl, 0, sizeof(cl));
+    for (i = 0; i < MAX_CLIENTS; i++)
+	cl.players[i].translations = vid.colormap;
 
     SZ_Clear(&cls.netchan.message);
 
@@ -433,6 +439,7 @@ CL_Disconnect(void)
     }
     Cam_Reset();
 
+    CL_HTTPAbort();
     if (cls.download) {
 	fclose(cls.download);
 	cls.download = NULL;
@@ -554,7 +561,7 @@ Sent by server when serverinfo changes
 void
 CL_FullServerinfo_f(void)
 {
-    char *p;
+    const char *p;
     float v;
 
     if (Cmd_Argc() != 2) {
@@ -563,8 +570,9 @@ CL_FullServerinfo_f(void)
     }
 
     strcpy(cl.serverinfo, Cmd_Argv(1));
+    Info_Parse(&cl.serverkeys, cl.serverinfo);
 
-    if ((p = Info_ValueForKey(cl.serverinfo, "*vesion")) && *p) {
+    if ((p = Info_Get(&cl.serverkeys, "*vesion")) && *p) {
 	v = Q_atof(p);
 	if (v) {
 	    if (!server_version)
@@ -808,6 +816,7 @@ CL_ConnectionlessPacket(void)
 	    return;
 	}
 	Netchan_Setup(&cls.netchan, net_from, cls.qport);
+	cls.downloadstream = 0;
 	MSG_WriteChar(&cls.netchan.message, clc_stringcmd);
 	MSG_WriteString(&cls.netchan.message, "new");
 	cls.state = ca_connected;
@@ -990,6 +999,7 @@ CL_Download_f(void)
     strcpy(cls.downloadtempname, cls.downloadname);
     cls.download = fopen(cls.downloadname, "wb");
     cls.downloadtype = dl_single;
+    cls.downloadwindow = 0;
 
     MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
     MSG_WriteStringf(&cls.netchan.message, "download %s\n", Cmd_Argv(1));
@@ -1043,6 +1053,7 @@ CL_Init(void)
     Info_SetValueForKey(cls.userinfo, "bottomcolor", "0", MAX_INFO_STRING);
     Info_SetValueForKey(cls.userinfo, "rate", "2500", MAX_INFO_STRING);
     Info_SetValueForKey(cls.userinfo, "msg", "1", MAX_INFO_STRING);
+    Info_SetValueForKey(cls.userinfo, PROJECTILES_INFOKEY, "1", MAX_INFO_STRING);
     sprintf(st, "TyrQuake-%s", stringify(TYR_VERSION));
     Info_SetValueForStarKey(cls.userinfo, "*ver", st, MAX_INFO_STRING);
 
@@ -1069,6 +1080,8 @@ CL_Init(void)
     Cvar_RegisterVariable(&cl_sbar);
     Cvar_RegisterVariable(&cl_hudswap);
     Cvar_RegisterVariable(&cl_maxfps);
+    Cvar_RegisterVariable(&cl_dlwindow);
+    Cvar_RegisterVariable(&cl_httpdownload);
     Cvar_RegisterVariable(&cl_timeout);
     Cvar_RegisterVariable(&lookspring);
     Cvar_RegisterVariable(&lookstrafe);
@@ -1086,6 +1099,7 @@ CL_Init(void)
     Cvar_RegisterVariable(&cl_predict_players2);
     Cvar_RegisterVariable(&cl_predict_players);
     Cvar_RegisterVariable(&cl_solid_players);
+    Cvar_RegisterVariable(&cl_lerpbuffer);
 
     Cvar_RegisterVariable(&localid);
 
@@ -1121,6 +1135,7 @@ CL_Init(void)
     Cmd_SetCompletion("playdemo", CL_Demo_Arg_f);
     Cmd_AddCommand("timedemo", CL_TimeDemo_f);
     Cmd_SetCompletion("timedemo", CL_Demo_Arg_f);
+    Cmd_AddCommand("relaywatch", CL_RelayWatch_f);
 
     Cmd_AddCommand("skins", Skin_Skins_f);
     Cmd_AddCommand("allskins", Skin_AllSkins_f);
@@ -1302,8 +1317,12 @@ Host_Frame(float time)
     float fps;
 
     /* something bad happened, or the server disconnected */
-    if (setjmp(host_abort))
+    if (setjmp(host_abort)) {
+	Job_EndFrame();
 	return;
+    }
+
+    Frame_Reset();
 
     // decide the simulation time
     realtime += time;
@@ -1332,6 +1351,7 @@ Host_Frame(float time)
 
     // fetch results from server
     CL_ReadPackets();
+    CL_HTTPFrame();
 
     // send intentions now
     // resend a connection request if necessary
@@ -1379,6 +1399,7 @@ Host_Frame(float time)
 	Con_Printf("%3i tot %3i server %3i gfx %3i snd\n",
 		   pass1 + pass2 + pass3, pass1, pass2, pass3);
     }
+    Job_EndFrame();
 
     host_framecount++;
     fps_count++;
@@ -1416,6 +1437,7 @@ Host_Init(quakeparms_t *parms)
     V_Init();
 
     COM_Init();
+    Job_Init();
 
     NET_Init(PORT_CLIENT);
     Netchan_Init();
@@ -1498,4 +1520,5 @@ Host_Shutdown(void)
     IN_Shutdown();
     if (host_basepal)
 	VID_Shutdown();
+    Job_Shutdown();
 }
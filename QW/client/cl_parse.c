@@ -97,8 +97,8 @@ static const char *svc_strings[] = {
     "svc_setinfo",
     "svc_serverinfo",
     "svc_updatepl",
-    "NEW PROTOCOL",
-    "NEW PROTOCOL",
+    "svc_projectiles",
+    "svc_downloadchunk",
     "NEW PROTOCOL",
     "NEW PROTOCOL",
     "NEW PROTOCOL",
@@ -155,6 +155,33 @@ CL_CalcNet(void)
 
 //=============================================================================
 
+/*
+===============
+CL_RequestDownload
+
+Asks the server for cls.downloadname
+===============
+*/
+static void
+CL_RequestDownload(void)
+{
+    MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
+    cls.downloadwindow = qmin((int)cl_dlwindow.value, DOWNLOAD_MAX_WINDOW);
+    if (cls.downloadwindow > 0) {
+	cls.downloadoffset = 0;
+	cls.downloadlost = -1;
+	cls.downloadstream = (cls.downloadstream + 1) & 255;
+	MSG_WriteStringf(&cls.netchan.message, "download %s %d",
+			 cls.downloadname, cls.downloadwindow);
+    } else {
+	cls.downloadwindow = 0;
+	MSG_WriteStringf(&cls.netchan.message, "download %s",
+			 cls.downloadname);
+    }
+}
+
+static qboolean CL_HTTPBegin(void);
+
 /*
 ===============
 CL_CheckOrDownloadFile
@@ -207,14 +234,50 @@ CL_CheckOrDownloadFile(char *filename)
     }
     strcat(cls.downloadtempname, ".tmp");
 
-    MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
-    MSG_WriteStringf(&cls.netchan.message, "download %s", cls.downloadname);
+    if (!CL_HTTPBegin())
+	CL_RequestDownload();
 
     cls.downloadnumber++;
 
     return false;
 }
 
+/*
+ * Once everything is there, what isn't cached yet is read in on the job
+ * threads while the loaders work through the list
+ */
+static void
+CL_PrefetchModels(void)
+{
+    const char *prefetch[MAX_MODELS];
+    int i, count;
+
+    count = 0;
+    for (i = 1; i < MAX_MODELS && cl.model_name[i][0]; i++)
+	if (cl.model_name[i][0] != '*' && Mod_NeedsLoad(cl.model_name[i]))
+	    prefetch[count++] = cl.model_name[i];
+    COM_PrefetchFiles(prefetch, count);
+}
+
+static void
+CL_PrefetchSounds(void)
+{
+    static char paths[MAX_SOUNDS][MAX_QPATH + 6];
+    const char *prefetch[MAX_SOUNDS];
+    int i, count;
+
+    count = 0;
+    for (i = 1; i < MAX_SOUNDS && cl.sound_name[i][0]; i++) {
+	if (!S_SoundNeedsLoad(cl.sound_name[i]))
+	    continue;
+	snprintf(paths[count], sizeof(paths[count]), "sound/%s",
+		 cl.sound_name[i]);
+	prefetch[count] = paths[count];
+	count++;
+    }
+    COM_PrefetchFiles(prefetch, count);
+}
+
 /*
 =================
 Model_NextDownload
@@ -240,6 +303,8 @@ Model_NextDownload(void)
 	    return;		// started a download
     }
 
+    Memory_TracePhase("models");
+    CL_PrefetchModels();
     for (i = 1; i < MAX_MODELS; i++) {
 	if (!cl.model_name[i][0])
 	    break;
@@ -254,14 +319,18 @@ Model_NextDownload(void)
 	    Con_Printf("You may need to download or purchase a %s client "
 		       "pack in order to play on this server.\n\n",
 		       gamedirfile);
+	    COM_ClearPrefetch();
 	    CL_Disconnect();
 	    return;
 	}
     }
+    COM_ClearPrefetch();
 
     // all done
     cl.worldmodel = cl.model_precache[1];
+    Memory_TracePhase("surfaces");
     R_NewMap();
+    Memory_TracePhase("game");
     Hunk_Check();		// make sure nothing is hurt
 
     // done with modellist, request first of static signon messages
@@ -293,11 +362,14 @@ Sound_NextDownload(void)
 	    return;		// started a download
     }
 
+    Memory_TracePhase("sounds");
+    CL_PrefetchSounds();
     for (i = 1; i < MAX_SOUNDS; i++) {
 	if (!cl.sound_name[i][0])
 	    break;
 	cl.sound_precache[i] = S_PrecacheSound(cl.sound_name[i]);
     }
+    COM_ClearPrefetch();
 
     // done with sounds, request models now
     memset(cl.model_precache, 0, sizeof(cl.model_precache));
@@ -335,6 +407,324 @@ CL_RequestNextDownload(void)
     }
 }
 
+/*
+=====================
+CL_OpenDownload
+
+Opens the temp file a download is written to
+=====================
+*/
+static qboolean
+CL_OpenDownload(void)
+{
+    char name[1024];
+
+    if (strncmp(cls.downloadtempname, "skins/", 6))
+	sprintf(name, "%s/%s", com_gamedir, cls.downloadtempname);
+    else
+	sprintf(name, "qw/%s", cls.downloadtempname);
+
+    COM_CreatePath(name);
+
+    cls.download = fopen(name, "wb");
+    if (!cls.download) {
+	Con_Printf("Failed to open %s\n", cls.downloadtempname);
+	return false;
+    }
+
+    return true;
+}
+
+/*
+=====================
+CL_FinishDownload
+
+Moves a completed download to its real name and gets the next one
+=====================
+*/
+static void
+CL_FinishDownload(void)
+{
+    char oldn[MAX_OSPATH];
+    char newn[MAX_OSPATH];
+    int r;
+
+#if 0
+    Con_Printf("100%%\n");
+#endif
+
+    fclose(cls.download);
+
+    // rename the temp file to it's final name
+    if (strcmp(cls.downloadtempname, cls.downloadname)) {
+	if (strncmp(cls.downloadtempname, "skins/", 6)) {
+	    sprintf(oldn, "%s/%s", com_gamedir, cls.downloadtempname);
+	    sprintf(newn, "%s/%s", com_gamedir, cls.downloadname);
+	} else {
+	    sprintf(oldn, "qw/%s", cls.downloadtempname);
+	    sprintf(newn, "qw/%s", cls.downloadname);
+	}
+	r = rename(oldn, newn);
+	if (r)
+	    Con_Printf("failed to rename.\n");
+    }
+
+    cls.download = NULL;
+    COM_FlushScanCache();
+    cls.downloadpercent = 0;
+    cls.downloadwindow = 0;
+
+    // get another file if needed
+
+    CL_RequestNextDownload();
+}
+
+/*
+ * With cl_httpdownload set, files are fetched over plain HTTP from the
+ * server's sv_downloadurl, leaving the game server's bandwidth alone. The
+ * transfer is polled each frame by CL_HTTPFrame, so the connection keeps
+ * going while it runs, and anything that goes wrong falls back to asking
+ * the server for the file.
+ */
+#define CL_HTTP_HEADERSIZE 4096
+#define CL_HTTP_TIMEOUT 10	// seconds without any progress
+
+static struct {
+    int socket;			// -1 when not fetching
+    char request[MAX_OSPATH * 2 + 128];
+    int reqlength;
+    int sent;			// bytes of the request sent so far
+    qboolean body;		// past the response header
+    char header[CL_HTTP_HEADERSIZE];
+    int headerlength;
+    int contentlength;		// -1 if the server didn't say
+    double lastprogress;
+} cl_http = { -1 };
+
+/*
+=====================
+CL_HTTPBegin
+
+Starts fetching cls.downloadname from sv_downloadurl, if it can
+=====================
+*/
+static qboolean
+CL_HTTPBegin(void)
+{
+    const char *url, *path;
+    char host[128];
+    netadr_t addr;
+    int length, s;
+
+    if (!cl_httpdownload.value)
+	return false;
+    url = Info_ValueForKey(cl.serverinfo, "sv_downloadurl");
+    if (!url[0])
+	return false;
+    if (strncmp(url, "http://", 7)) {
+	Con_DPrintf("Can only download from http:// URLs, not %s\n", url);
+	return false;
+    }
+
+    url += 7;
+    path = strchr(url, '/');
+    length = path ? path - url : strlen(url);
+    if (!length || length >= sizeof(host))
+	return false;
+    memcpy(host, url, length);
+    host[length] = 0;
+    if (!path)
+	path = "/";
+    if (!NET_StringToAdr(host, &addr)) {
+	Con_Printf("Couldn't find the download host %s\n", host);
+	return false;
+    }
+    if (!addr.port)
+	addr.port = BigShort(80);
+
+    cl_http.reqlength = snprintf(cl_http.request, sizeof(cl_http.request),
+				 "GET %s%s%s HTTP/1.0\r\nHost: %s\r\n"
+				 "User-Agent: TyrQuake\r\n\r\n", path,
+				 path[strlen(path) - 1] == '/' ? "" : "/",
+				 cls.downloadname, host);
+    if (cl_http.reqlength >= sizeof(cl_http.request))
+	return false;
+
+    s = NET_StreamConnect(addr);
+    if (s < 0)
+	return false;
+
+    cl_http.socket = s;
+    cl_http.sent = 0;
+    cl_http.body = false;
+    cl_http.headerlength = 0;
+    cl_http.contentlength = -1;
+    cl_http.lastprogress = realtime;
+    cls.downloadoffset = 0;
+    cls.downloadpercent = 0;
+
+    return true;
+}
+
+/*
+=====================
+CL_HTTPAbort
+
+Drops any HTTP download, leaving the temp file to the caller
+=====================
+*/
+void
+CL_HTTPAbort(void)
+{
+    if (cl_http.socket < 0)
+	return;
+    NET_StreamClose(cl_http.socket);
+    cl_http.socket = -1;
+}
+
+static void
+CL_HTTPFail(const char *reason)
+{
+    char name[MAX_OSPATH];
+
+    Con_Printf("HTTP download of %s failed: %s\n", cls.downloadname, reason);
+    CL_HTTPAbort();
+
+    if (cls.download) {
+	fclose(cls.download);
+	cls.download = NULL;
+	if (strncmp(cls.downloadtempname, "skins/", 6))
+	    snprintf(name, sizeof(name), "%s/%s", com_gamedir,
+		     cls.downloadtempname);
+	else
+	    snprintf(name, sizeof(name), "qw/%s", cls.downloadtempname);
+	remove(name);
+    }
+    cls.downloadpercent = 0;
+
+    CL_RequestDownload();
+}
+
+/*
+ * Checks the response header once it's all in, opening the file and
+ * writing any of the body that came with it. False if it's been failed.
+ */
+static qboolean
+CL_HTTPParseHeader(void)
+{
+    char *end, *line;
+    int status;
+
+    cl_http.header[cl_http.headerlength] = 0;
+    end = strstr(cl_http.header, "\r\n\r\n");
+    if (!end) {
+	if (cl_http.headerlength == CL_HTTP_HEADERSIZE - 1) {
+	    CL_HTTPFail("response header too long");
+	    return false;
+	}
+	return true;		// wait for the rest
+    }
+    *end = 0;
+
+    if (sscanf(cl_http.header, "HTTP/%*d.%*d %d", &status) != 1) {
+	CL_HTTPFail("not an HTTP response");
+	return false;
+    }
+    if (status != 200) {
+	CL_HTTPFail(va("status %d", status));
+	return false;
+    }
+    for (line = strstr(cl_http.header, "\r\n"); line;
+	 line = strstr(line + 2, "\r\n"))
+	if (!strncasecmp(line + 2, "Content-Length:", 15))
+	    cl_http.contentlength = atoi(line + 17);
+
+    if (!CL_OpenDownload()) {
+	CL_HTTPFail("couldn't open the file");
+	return false;
+    }
+    cl_http.body = true;
+
+    end += 4;
+    cls.downloadoffset = cl_http.header + cl_http.headerlength - end;
+    fwrite(end, 1, cls.downloadoffset, cls.download);
+
+    return true;
+}
+
+/*
+=====================
+CL_HTTPFrame
+
+Moves an HTTP download along, finishing it once the server closes
+=====================
+*/
+void
+CL_HTTPFrame(void)
+{
+    byte buf[8192];
+    int ret;
+
+    if (cl_http.socket < 0)
+	return;
+
+    if (cl_http.sent < cl_http.reqlength) {
+	ret = NET_StreamSend(cl_http.socket, cl_http.request + cl_http.sent,
+			     cl_http.reqlength - cl_http.sent);
+	if (ret < 0) {
+	    CL_HTTPFail("couldn't connect");
+	    return;
+	}
+	if (ret > 0)
+	    cl_http.lastprogress = realtime;
+	cl_http.sent += ret;
+	if (cl_http.sent < cl_http.reqlength)
+	    goto timeout;
+    }
+
+    for (;;) {
+	if (!cl_http.body) {
+	    ret = NET_StreamRecv(cl_http.socket,
+				 cl_http.header + cl_http.headerlength,
+				 CL_HTTP_HEADERSIZE - 1 - cl_http.headerlength);
+	    if (ret > 0) {
+		cl_http.headerlength += ret;
+		if (!CL_HTTPParseHeader())
+		    return;
+	    }
+	} else {
+	    ret = NET_StreamRecv(cl_http.socket, buf, sizeof(buf));
+	    if (ret > 0) {
+		fwrite(buf, 1, ret, cls.download);
+		cls.downloadoffset += ret;
+	    }
+	}
+	if (ret <= 0)
+	    break;
+	cl_http.lastprogress = realtime;
+    }
+    if (cl_http.body && cl_http.contentlength > 0)
+	cls.downloadpercent = (int)((double)cls.downloadoffset * 100 /
+				    cl_http.contentlength);
+
+    if (ret < 0) {
+	if (!cl_http.body)
+	    CL_HTTPFail("connection closed");
+	else if (cl_http.contentlength >= 0
+		 && cls.downloadoffset != cl_http.contentlength)
+	    CL_HTTPFail("connection closed early");
+	else {
+	    CL_HTTPAbort();
+	    CL_FinishDownload();
+	}
+	return;
+    }
+
+  timeout:
+    if (realtime - cl_http.lastprogress > CL_HTTP_TIMEOUT)
+	CL_HTTPFail("timed out");
+}
+
 /*
 =====================
 CL_ParseDownload
@@ -346,8 +736,6 @@ static void
 CL_ParseDownload(void)
 {
     int size, percent;
-    char name[1024];
-    int r;
 
 
     // read the data
@@ -372,17 +760,8 @@ CL_ParseDownload(void)
     }
     // open the file if not opened yet
     if (!cls.download) {
-	if (strncmp(cls.downloadtempname, "skins/", 6))
-	    sprintf(name, "%s/%s", com_gamedir, cls.downloadtempname);
-	else
-	    sprintf(name, "qw/%s", cls.downloadtempname);
-
-	COM_CreatePath(name);
-
-	cls.download = fopen(name, "wb");
-	if (!cls.download) {
+	if (!CL_OpenDownload()) {
 	    msg_readcount += size;
-	    Con_Printf("Failed to open %s\n", cls.downloadtempname);
 	    CL_RequestNextDownload();
 	    return;
 	}
@@ -406,35 +785,77 @@ CL_ParseDownload(void)
 	MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
 	MSG_WriteString(&cls.netchan.message, "nextdl");
     } else {
-	char oldn[MAX_OSPATH];
-	char newn[MAX_OSPATH];
+	CL_FinishDownload();
+    }
+}
 
-#if 0
-	Con_Printf("100%%\n");
-#endif
+/*
+=====================
+CL_ParseDownloadChunk
 
-	fclose(cls.download);
+A chunk of a streamed download. Chunks are written in order; one that
+arrives ahead of the next expected has the rest sent again. Progress is
+acknowledged whenever nothing else is waiting to go out reliably.
+=====================
+*/
+static void
+CL_ParseDownloadChunk(void)
+{
+    int stream, total, offset, size;
+    const byte *data;
 
-	// rename the temp file to it's final name
-	if (strcmp(cls.downloadtempname, cls.downloadname)) {
-	    if (strncmp(cls.downloadtempname, "skins/", 6)) {
-		sprintf(oldn, "%s/%s", com_gamedir, cls.downloadtempname);
-		sprintf(newn, "%s/%s", com_gamedir, cls.downloadname);
-	    } else {
-		sprintf(oldn, "qw/%s", cls.downloadtempname);
-		sprintf(newn, "qw/%s", cls.downloadname);
-	    }
-	    r = rename(oldn, newn);
-	    if (r)
-		Con_Printf("failed to rename.\n");
-	}
+    stream = MSG_ReadByte();
+    total = MSG_ReadLong();
+    offset = MSG_ReadLong();
+    size = MSG_ReadShort();
+    if (msg_badread || size < 0 || msg_readcount + size > net_message.cursize)
+	Host_EndGame("%s: bad chunk", __func__);
+    data = net_message.data + msg_readcount;
+    msg_readcount += size;
 
-	cls.download = NULL;
-	cls.downloadpercent = 0;
+    if (cls.demoplayback)
+	return;
 
-	// get another file if needed
+    // left over from an earlier stream, or sent again after a loss
+    if (!cls.downloadwindow || stream != cls.downloadstream)
+	return;
+    if (offset < cls.downloadoffset || cls.downloadoffset >= total)
+	return;
 
+    if (offset > cls.downloadoffset) {
+	if (cls.downloadlost != cls.downloadoffset) {
+	    MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
+	    MSG_WriteStringf(&cls.netchan.message, "nextdl %d lost",
+			     cls.downloadoffset);
+	    cls.downloadlost = cls.downloadoffset;
+	}
+	return;
+    }
+
+    if (!cls.download && !CL_OpenDownload()) {
+	// tell the server we're done with it
+	MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
+	MSG_WriteStringf(&cls.netchan.message, "nextdl %d", total);
+	cls.downloadwindow = 0;
 	CL_RequestNextDownload();
+	return;
+    }
+
+    fwrite(data, 1, size, cls.download);
+    cls.downloadoffset += size;
+    cls.downloadpercent = (int)((double)cls.downloadoffset * 100 / total);
+
+    if (cls.downloadoffset >= total) {
+	MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
+	MSG_WriteStringf(&cls.netchan.message, "nextdl %d", total);
+	CL_FinishDownload();
+	return;
+    }
+
+    if (!cls.netchan.message.cursize) {
+	MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
+	MSG_WriteStringf(&cls.netchan.message, "nextdl %d",
+			 cls.downloadoffset);
     }
 }
 
@@ -883,9 +1304,7 @@ CL_NewTranslation
 static void
 CL_NewTranslation(int slot)
 {
-   int i, j;
    int top, bottom;
-   byte *dest, *source;
    player_info_t *player;
    char *skin;
 
@@ -905,32 +1324,13 @@ CL_NewTranslation(int slot)
       player->_topcolor = player->topcolor;
       player->_bottomcolor = player->bottomcolor;
 
-      dest = player->translations;
-      source = vid.colormap;
-      memcpy(dest, vid.colormap, sizeof(player->translations));
       top = player->topcolor;
       if (top > 13 || top < 0)
          top = 13;
-      top *= 16;
       bottom = player->bottomcolor;
       if (bottom > 13 || bottom < 0)
          bottom = 13;
-      bottom *= 16;
-
-      for (i = 0; i < VID_GRADES; i++, dest += 256, source += 256) {
-         /* the artists made some backwards ranges.  sigh. */
-         if (top < 128)
-            memcpy(dest + TOP_RANGE, source + top, 16);
-         else
-            for (j = 0; j < 16; j++)
-               dest[TOP_RANGE + j] = source[top + 15 - j];
-
-         if (bottom < 128)
-            memcpy(dest + BOTTOM_RANGE, source + bottom, 16);
-         else
-            for (j = 0; j < 16; j++)
-               dest[BOTTOM_RANGE + j] = source[bottom + 15 - j];
-      }
+      player->translations = R_TranslationTable(top * 16, bottom * 16);
    }
 }
 
@@ -942,15 +1342,13 @@ CL_ProcessUserinfo
 static void
 CL_ProcessUserInfo(int slot, player_info_t * player)
 {
-    char *name;
+    Info_Parse(&player->userkeys, player->userinfo);
+    snprintf(player->name, sizeof(player->name), "%s",
+	     Info_Get(&player->userkeys, "name"));
 
-    name = Info_ValueForKey(player->userinfo, "name");
-    snprintf(player->name, sizeof(player->name), "%s", name);
-
-    player->topcolor = atoi(Info_ValueForKey(player->userinfo, "topcolor"));
-    player->bottomcolor =
-	atoi(Info_ValueForKey(player->userinfo, "bottomcolor"));
-    if (Info_ValueForKey(player->userinfo, "*spectator")[0])
+    player->topcolor = atoi(Info_Get(&player->userkeys, "topcolor"));
+    player->bottomcolor = atoi(Info_Get(&player->userkeys, "bottomcolor"));
+    if (Info_Get(&player->userkeys, "*spectator")[0])
 	player->spectator = true;
     else
 	player->spectator = false;
@@ -1031,6 +1429,7 @@ CL_ServerInfo(void)
     Con_DPrintf("SERVERINFO: %s=%s\n", key, value);
 
     Info_SetValueForKey(cl.serverinfo, key, value, MAX_SERVERINFO_STRING);
+    Info_Parse(&cl.serverkeys, cl.serverinfo);
 }
 
 /*
@@ -1326,12 +1725,20 @@ CL_ParseServerMessage(void)
 	    CL_ParseDownload();
 	    break;
 
+	case svc_downloadchunk:
+	    CL_ParseDownloadChunk();
+	    break;
+
 	case svc_playerinfo:
 	    CL_ParsePlayerinfo();
 	    break;
 
 	case svc_nails:
-	    CL_ParseProjectiles();
+	    CL_ParseProjectiles(false);
+	    break;
+
+	case svc_projectiles:
+	    CL_ParseProjectiles(true);
 	    break;
 
 	case svc_chokecount:	// some preceding packets were choked
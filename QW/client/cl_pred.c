@@ -35,6 +35,23 @@ extern frame_t *view_frame;
 cvar_t cl_nopred = { "cl_nopred", "0" };
 cvar_t cl_pushlatency = { "pushlatency", "-999" };
 
+/*
+ * The predicted states of the commands the server hasn't acknowledged yet,
+ * kept from one frame to the next. While the server agrees with the state
+ * predicted for each command it acknowledges and nothing solid near the
+ * predicted path has changed, the cached states stand and only the commands
+ * past the last one cached go through PlayerMove.
+ */
+#define PRED_MARGIN 32		// to the player's box, covers steps and ground checks
+
+static player_state_t pred_states[UPDATE_BACKUP];
+static int pred_first;		// the acknowledged sequence they follow on from
+static int pred_last;		// the last sequence cached, pred_first if none
+static qboolean pred_dead;
+static qboolean pred_spectator;
+static physent_t pred_physents[MAX_PHYSENTS];
+static int pred_numphysent;
+
 
 /*
 =================
@@ -118,6 +135,154 @@ CL_PredictUsercmd(player_state_t *from, player_state_t *to, usercmd_t *u,
 
 
 
+/*
+ * Compare at the precision the server sends the player's state with
+ */
+static qboolean
+CL_PredictionConfirmed(const player_state_t *server,
+		       const player_state_t *predicted)
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+	if ((int)(predicted->origin[i] * 8) != (int)(server->origin[i] * 8))
+	    return false;
+	if ((int)predicted->velocity[i] != (int)server->velocity[i])
+	    return false;
+    }
+
+    return true;
+}
+
+static qboolean
+CL_SamePhysent(physent_t *a, physent_t *b)
+{
+    if (a->model != b->model || !VectorCompare(a->origin, b->origin))
+	return false;
+    if (a->model)
+	return true;
+
+    return VectorCompare(a->mins, b->mins) && VectorCompare(a->maxs, b->maxs);
+}
+
+static qboolean
+CL_PhysentTouches(const physent_t *pent, const vec3_t mins, const vec3_t maxs)
+{
+    const float *pmins = pent->model ? pent->model->mins : pent->mins;
+    const float *pmaxs = pent->model ? pent->model->maxs : pent->maxs;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+	if (pent->origin[i] + pmins[i] > maxs[i])
+	    return false;
+	if (pent->origin[i] + pmaxs[i] < mins[i])
+	    return false;
+    }
+
+    return true;
+}
+
+/*
+ * True if anything solid that differs from the physents the cached states
+ * were predicted against could reach the box they move through
+ */
+static qboolean
+CL_PhysentsChanged(const vec3_t mins, const vec3_t maxs)
+{
+    physent_t *pent, *cached;
+    int i, count;
+
+    count = qmax(pmove.numphysent, pred_numphysent);
+    for (i = 0; i < count; i++) {
+	pent = i < pmove.numphysent ? &pmove.physents[i] : NULL;
+	cached = i < pred_numphysent ? &pred_physents[i] : NULL;
+	if (pent && cached && CL_SamePhysent(pent, cached))
+	    continue;
+	if (!i)
+	    return true;	// a new world
+	if (pent && CL_PhysentTouches(pent, mins, maxs))
+	    return true;
+	if (cached && CL_PhysentTouches(cached, mins, maxs))
+	    return true;
+    }
+
+    return false;
+}
+
+/*
+==============
+CL_CachedPrediction
+
+Returns the last sequence whose cached prediction still holds, the
+acknowledged one if there are none.
+==============
+*/
+static int
+CL_CachedPrediction(const player_state_t *acked)
+{
+    int base, last, seq, i;
+    qboolean dead;
+    vec3_t mins, maxs;
+
+    base = cls.netchan.incoming_sequence;
+    last = pred_last;
+    dead = cl.stats[STAT_HEALTH] <= 0;
+
+    if (dead != pred_dead || cl.spectator != pred_spectator)
+	last = base;
+    else if (pred_first > base || last <= base)
+	last = base;
+    else if (base != pred_first &&
+	     !CL_PredictionConfirmed(acked, &pred_states[base & UPDATE_MASK]))
+	last = base;
+    else {
+	VectorCopy(acked->origin, mins);
+	VectorCopy(acked->origin, maxs);
+	for (seq = base + 1; seq <= last; seq++) {
+	    const float *origin = pred_states[seq & UPDATE_MASK].origin;
+
+	    for (i = 0; i < 3; i++) {
+		mins[i] = qmin(mins[i], origin[i]);
+		maxs[i] = qmax(maxs[i], origin[i]);
+	    }
+	}
+	for (i = 0; i < 3; i++) {
+	    mins[i] += player_mins[i] - PRED_MARGIN;
+	    maxs[i] += player_maxs[i] + PRED_MARGIN;
+	}
+	if (CL_PhysentsChanged(mins, maxs))
+	    last = base;
+    }
+
+    pred_first = base;
+    pred_last = last;
+    pred_dead = dead;
+    pred_spectator = cl.spectator;
+    memcpy(pred_physents, pmove.physents,
+	   pmove.numphysent * sizeof(pmove.physents[0]));
+    pred_numphysent = pmove.numphysent;
+
+    return last;
+}
+
+/*
+ * Sets what CL_PredictUsercmd would have from a cached state
+ */
+static void
+CL_SetPredicted(player_state_t *to, const player_state_t *predicted,
+		const player_state_t *from)
+{
+    to->waterjumptime = predicted->waterjumptime;
+    to->oldbuttons = predicted->oldbuttons;
+    VectorCopy(predicted->origin, to->origin);
+    VectorCopy(predicted->viewangles, to->viewangles);
+    VectorCopy(predicted->velocity, to->velocity);
+    to->onground = predicted->onground;
+
+    to->weaponframe = from->weaponframe;
+}
+
+
 /*
 ==============
 CL_PredictMove
@@ -126,9 +291,10 @@ CL_PredictMove
 void
 CL_PredictMove(void)
 {
-    int i;
+    int i, seq, cached;
     float f;
     frame_t *from, *to = NULL;
+    player_state_t *state;
     int oldphysent;
 
     if (cl_pushlatency.value > 0)
@@ -178,12 +344,24 @@ CL_PredictMove(void)
 
 //      to = &cl.frames[cls.netchan.incoming_sequence & UPDATE_MASK];
 
+    cached = CL_CachedPrediction(&from->playerstate[cl.playernum]);
+
     for (i = 1; i < UPDATE_BACKUP - 1 && cls.netchan.incoming_sequence + i <
 	 cls.netchan.outgoing_sequence; i++) {
-	to = &cl.frames[(cls.netchan.incoming_sequence + i) & UPDATE_MASK];
-	CL_PredictUsercmd(&from->playerstate[cl.playernum]
-			  , &to->playerstate[cl.playernum], &to->cmd,
-			  cl.spectator);
+	seq = cls.netchan.incoming_sequence + i;
+	to = &cl.frames[seq & UPDATE_MASK];
+	state = &pred_states[seq & UPDATE_MASK];
+	if (seq <= cached) {
+	    CL_SetPredicted(&to->playerstate[cl.playernum], state,
+			    &from->playerstate[cl.playernum]);
+	    onground = state->onground;
+	} else {
+	    CL_PredictUsercmd(&from->playerstate[cl.playernum]
+			      , &to->playerstate[cl.playernum], &to->cmd,
+			      cl.spectator);
+	    *state = to->playerstate[cl.playernum];
+	    pred_last = seq;
+	}
 	if (to->senttime >= cl.time)
 	    break;
 	from = to;
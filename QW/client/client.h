@@ -85,6 +85,7 @@ typedef struct {
 typedef struct player_info_s {
     int userid;
     char userinfo[MAX_INFO_STRING];
+    infokeys_t userkeys;	// parsed from userinfo
 
     // scoreboard information
     char name[MAX_SCOREBOARDNAME];
@@ -100,7 +101,7 @@ typedef struct player_info_s {
     byte _bottomcolor;
 
     int spectator;
-    byte translations[VID_GRADES * 256];
+    byte *translations;		// shared, from R_TranslationTable
     skin_t *skin;
 } player_info_t;
 
@@ -179,6 +180,10 @@ typedef struct {
     int downloadnumber;
     dltype_t downloadtype;
     int downloadpercent;
+    int downloadwindow;		// streaming: window asked for, 0 if not
+    int downloadoffset;		// streaming: bytes written so far
+    int downloadlost;		// streaming: offset reported lost, or -1
+    int downloadstream;		// streams asked for on this connection
 
 // demo loop control
     int demonum;		// -1 = don't play demos
@@ -209,6 +214,7 @@ typedef struct {
     int servercount;		// server identification for prespawns
 
     char serverinfo[MAX_SERVERINFO_STRING];
+    infokeys_t serverkeys;	// parsed from serverinfo
 
     int parsecount;		// server message counter
     int validsequence;		// this is the sequence number of the last good
@@ -294,6 +300,8 @@ typedef struct {
 // cvars
 //
 extern cvar_t cl_warncmd;
+extern cvar_t cl_dlwindow;
+extern cvar_t cl_httpdownload;
 extern cvar_t cl_upspeed;
 extern cvar_t cl_forwardspeed;
 extern cvar_t cl_backspeed;
@@ -325,6 +333,7 @@ extern cvar_t name;
 extern cvar_t cl_predict_players;
 extern cvar_t cl_predict_players2;
 extern cvar_t cl_solid_players;
+extern cvar_t cl_lerpbuffer;
 
 extern int cl_spikeindex, cl_playerindex, cl_flagindex;
 extern int parsecountmod;
@@ -425,6 +434,7 @@ void CL_ReRecord_f(void);
 
 void CL_PlayDemo_f(void);
 void CL_TimeDemo_f(void);
+void CL_RelayWatch_f(void);
 struct stree_root *CL_Demo_Arg_f(const char *arg);
 
 //
@@ -436,6 +446,8 @@ extern int packet_latency[NET_TIMINGS];
 int CL_CalcNet(void);
 void CL_ParseServerMessage(void);
 qboolean CL_CheckOrDownloadFile(char *filename);
+void CL_HTTPFrame(void);
+void CL_HTTPAbort(void);
 qboolean CL_IsUploading(void);
 void CL_NextUpload(void);
 void CL_StartUpload(byte *data, int size);
@@ -448,7 +460,7 @@ void V_StartPitchDrift(void);
 void V_StopPitchDrift(void);
 
 void V_RenderView(void);
-void V_UpdatePalette(void);
+qboolean V_UpdatePalette(void);
 void V_Register(void);
 void V_ParseDamage(void);
 void V_SetContentsColor(int contents);
@@ -467,7 +479,7 @@ void CL_SetSolidPlayers(int playernum);
 void CL_SetUpPlayerPrediction(qboolean dopred);
 void CL_EmitEntities(void);
 void CL_ClearProjectiles(void);
-void CL_ParseProjectiles(void);
+void CL_ParseProjectiles(qboolean withmodel);
 void CL_ParsePacketEntities(qboolean delta);
 void CL_SetSolidEntities(void);
 void CL_ParsePlayerinfo(void);
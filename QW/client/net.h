@@ -51,12 +51,28 @@ void NET_Shutdown(void);
 qboolean NET_GetPacket(void);
 void NET_SendPacket(int length, void *data, netadr_t to);
 
+/*
+ * Packets sent between these go out together at NET_EndBatch, which the
+ * server does once per frame. NET_Shutdown ends any batch still open.
+ */
+void NET_BeginBatch(void);
+void NET_EndBatch(void);
+
 qboolean NET_CompareAdr(netadr_t a, netadr_t b);
 qboolean NET_CompareBaseAdr(netadr_t a, netadr_t b);
 const char *NET_AdrToString(netadr_t a);
 const char *NET_BaseAdrToString(netadr_t a);
 qboolean NET_StringToAdr(const char *s, netadr_t *a);
 
+/*
+ * TCP streams, for the spectator relay and HTTP downloads
+ */
+int NET_StreamOpen(netadr_t to);
+int NET_StreamConnect(netadr_t to);	/* doesn't wait for the connection */
+int NET_StreamSend(int s, const void *data, int length);
+int NET_StreamRecv(int s, void *data, int length);
+void NET_StreamClose(int s);
+
 /* ======================================================================== */
 
 /* total = oldtotal*OLD_AVG + new*(1-OLD_AVG) */
@@ -77,6 +93,8 @@ typedef struct {
 
     int drop_count;		/* dropped packets, cleared each level */
     int good_count;		/* cleared each level */
+    unsigned bytes_in;		/* totals, for the server's metrics */
+    unsigned bytes_out;
 
     netadr_t remote_address;
     int qport;
@@ -101,6 +101,7 @@ void Pmove_Init(void);
 int PM_HullPointContents(hull_t *hull, int num, vec3_t p);
 
 int PM_PointContents(vec3_t point);
+void PM_SetupPhysents(void);
 qboolean PM_TestPlayerPosition(vec3_t point);
 pmtrace_t PM_PlayerMove(vec3_t start, vec3_t stop);
 
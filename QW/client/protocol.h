@@ -134,6 +134,19 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define svc_setinfo		51	// setinfo on a client
 #define svc_serverinfo		52	// serverinfo
 #define svc_updatepl		53	// [byte] [byte]
+#define svc_projectiles		54	// [byte] num [byte model [48 bits] xyzpy]
+#define svc_downloadchunk	55	// [byte] stream [long] total [long] offset
+					// [short] size [size bytes]
+
+// userinfo key set by clients that understand svc_projectiles
+#define PROJECTILES_INFOKEY	"proj"
+
+// "download <file> <window>" asks for the file to be streamed as unreliable
+// svc_downloadchunks, at most window bytes past what the client has
+// acknowledged with "nextdl <offset>"; "nextdl <offset> lost" has the
+// stream sent again from there. Servers that don't stream ignore the
+// window and answer with svc_download as usual.
+#define DOWNLOAD_MAX_WINDOW	65536
 
 
 //==============================================
@@ -269,6 +282,7 @@ typedef struct {
 } entity_state_t;
 
 #define	MAX_PACKET_ENTITIES 64	/* doesn't count nails */
+#define	MAX_PACKET_ENTNUM 512	/* entity numbers are sent in 9 bits */
 typedef struct {
     int num_entities;
     entity_state_t entities[MAX_PACKET_ENTITIES];
@@ -282,4 +296,9 @@ typedef struct usercmd_s {
     byte impulse;
 } usercmd_t;
 
+// demo blocks, each after the float time it was recorded at
+#define dem_cmd		0	// usercmd_t, then the float viewangles
+#define dem_read	1	// [long] length, then the packet with its header
+#define dem_set		2	// [long] outgoing, [long] incoming sequence
+
 #endif /* PROTOCOL_H */
@@ -426,7 +426,7 @@ Sbar_SortTeams(void)
 // request new ping times every two second
     scoreboardteams = 0;
 
-    teamplay = atoi(Info_ValueForKey(cl.serverinfo, "teamplay"));
+    teamplay = atoi(Info_Get(&cl.serverkeys, "teamplay"));
     if (!teamplay)
 	return;
 
@@ -444,7 +444,7 @@ Sbar_SortTeams(void)
 
 	// find his team in the list
 	t[16] = 0;
-	strncpy(t, Info_ValueForKey(s->userinfo, "team"), 16);
+	strncpy(t, Info_Get(&s->userkeys, "team"), 16);
 	if (!t[0])
 	    continue;		// not on team
 	for (j = 0; j < scoreboardteams; j++)
@@ -823,7 +823,7 @@ Sbar_Draw(void)
    // main screen deathmatch rankings
    // if we're dead show team scores in team games
    if (cl.stats[STAT_HEALTH] <= 0 && !cl.spectator)
-      if (atoi(Info_ValueForKey(cl.serverinfo, "teamplay")) > 0 &&
+      if (atoi(Info_Get(&cl.serverkeys, "teamplay")) > 0 &&
             !sb_showscores)
          Sbar_TeamOverlay();
       else
@@ -892,7 +892,7 @@ Sbar_TeamOverlay(void)
     int plow, phigh, pavg;
 
 // request new ping times every two second
-    teamplay = atoi(Info_ValueForKey(cl.serverinfo, "teamplay"));
+    teamplay = atoi(Info_Get(&cl.serverkeys, "teamplay"));
 
     if (!teamplay) {
 	Sbar_DeathmatchOverlay(0);
@@ -952,8 +952,8 @@ Sbar_TeamOverlay(void)
 	sprintf(num, "%5i", tm->players);
 	Draw_String(x + 104 + 88, y, num);
 
-	if (!strncmp(Info_ValueForKey(cl.players[cl.playernum].userinfo,
-				      "team"), tm->team, 16)) {
+	if (!strncmp(Info_Get(&cl.players[cl.playernum].userkeys,
+			      "team"), tm->team, 16)) {
 	    Draw_Character(x + 104 - 8, y, 16);
 	    Draw_Character(x + 104 + 32, y, 17);
 	}
@@ -997,7 +997,7 @@ Sbar_DeathmatchOverlay(int start)
 	MSG_WriteString(&cls.netchan.message, "pings");
     }
 
-    teamplay = atoi(Info_ValueForKey(cl.serverinfo, "teamplay"));
+    teamplay = atoi(Info_Get(&cl.serverkeys, "teamplay"));
 
     scr_copyeverything = 1;
     scr_fullupdate = 0;
@@ -1101,7 +1101,7 @@ Sbar_DeathmatchOverlay(int start)
 	// team
 	if (teamplay) {
 	    team[4] = 0;
-	    strncpy(team, Info_ValueForKey(s->userinfo, "team"), 4);
+	    strncpy(team, Info_Get(&s->userkeys, "team"), 4);
 	    Draw_String(x + 152, y, team);
 	}
 	// draw name
@@ -1143,7 +1143,7 @@ Sbar_MiniDeathmatchOverlay(void)
     if (vid.width < 512 || !sb_lines)
 	return;			// not enuff room
 
-    teamplay = atoi(Info_ValueForKey(cl.serverinfo, "teamplay"));
+    teamplay = atoi(Info_Get(&cl.serverkeys, "teamplay"));
 
     scr_copyeverything = 1;
     scr_fullupdate = 0;
@@ -1207,7 +1207,7 @@ Sbar_MiniDeathmatchOverlay(void)
 	// team
 	if (teamplay) {
 	    team[4] = 0;
-	    strncpy(team, Info_ValueForKey(s->userinfo, "team"), 4);
+	    strncpy(team, Info_Get(&s->userkeys, "team"), 4);
 	    Draw_String(x + 48, y, team);
 	}
 	// draw name
@@ -1245,8 +1245,8 @@ Sbar_MiniDeathmatchOverlay(void)
 	sprintf(num, "%5i", tm->frags);
 	Draw_String(x + 40, y, num);
 
-	if (!strncmp(Info_ValueForKey(cl.players[cl.playernum].userinfo,
-				      "team"), tm->team, 16)) {
+	if (!strncmp(Info_Get(&cl.players[cl.playernum].userkeys,
+			      "team"), tm->team, 16)) {
 	    Draw_Character(x - 8, y, 16);
 	    Draw_Character(x + 32, y, 17);
 	}
@@ -1269,7 +1269,7 @@ Sbar_IntermissionOverlay(void)
     scr_copyeverything = 1;
     scr_fullupdate = 0;
 
-    if (atoi(Info_ValueForKey(cl.serverinfo, "teamplay")) > 0
+    if (atoi(Info_Get(&cl.serverkeys, "teamplay")) > 0
 	&& !sb_showscores)
 	Sbar_TeamOverlay();
     else
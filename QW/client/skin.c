@@ -53,7 +53,7 @@ Skin_Find(player_info_t * sc)
 
     skinname = allskins;
     if (!skinname[0]) {
-	skinname = Info_ValueForKey(sc->userinfo, "skin");
+	skinname = Info_Get(&sc->userkeys, "skin");
 	if (!skinname || !skinname[0])
 	    skinname = baseskin.string;
     }
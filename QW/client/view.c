@@ -497,7 +497,7 @@ void V_DropCShift (cshift_t *cs, float droprate)
 V_UpdatePalette
 =============
 */
-void
+qboolean
 V_UpdatePalette(void)
 {
     int i, j;
@@ -529,7 +529,7 @@ V_UpdatePalette(void)
 
     force = V_CheckGamma();
     if (!new && !force)
-	return;
+	return false;
 
     basepal = host_basepal;
     newpal = pal;
@@ -556,6 +556,8 @@ V_UpdatePalette(void)
     }
 
     VID_ShiftPalette(pal);
+
+    return true;
 }
 
 /*
@@ -863,14 +865,13 @@ DropPunchAngle(void)
 
 /*
 ==================
-V_RenderView
+V_UpdateView
 
-The player's clipping box goes from (-16 -16 -24) to (16 16 32) from
-the entity origin, so any view position inside that will be valid
+Everything V_RenderView does to the view over time, without drawing it
 ==================
 */
 void
-V_RenderView(void)
+V_UpdateView(void)
 {
    //      if (cl.simangles[ROLL])
    //              Sys_Error ("cl.simangles[ROLL]");       // DEBUG
@@ -888,6 +889,22 @@ V_RenderView(void)
    } else {
       V_CalcRefdef();
    }
+}
+
+/*
+==================
+V_RenderView
+
+The player's clipping box goes from (-16 -16 -24) to (16 16 32) from
+the entity origin, so any view position inside that will be valid
+==================
+*/
+void
+V_RenderView(void)
+{
+   V_UpdateView();
+   if (cls.state != ca_active)
+      return;
 
    R_RenderView();
 
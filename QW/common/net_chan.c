@@ -295,6 +295,7 @@ Netchan_Transmit(netchan_t *chan, int length, byte *data)
     i = chan->outgoing_sequence & (MAX_LATENT - 1);
     chan->outgoing_size[i] = send.cursize;
     chan->outgoing_time[i] = realtime;
+    chan->bytes_out += send.cursize;
 
 #ifndef SERVERONLY
     /* ZOID - no input in demo playback mode */
@@ -434,6 +435,7 @@ Netchan_Process(netchan_t *chan)
     chan->frame_rate = chan->frame_rate * OLD_AVG
 	+ (realtime - chan->last_received) * (1.0 - OLD_AVG);
     chan->good_count += 1;
+    chan->bytes_in += net_message.cursize;
 
     chan->last_received = realtime;
 
@@ -18,6 +18,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE		/* recvmmsg, sendmmsg */
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -43,6 +47,36 @@ int net_socket;
 #define	MAX_UDP_PACKET	8192
 static byte net_message_buffer[MAX_UDP_PACKET];
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0		/* where missing, SIGPIPE has to be ignored */
+#endif
+
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define HAVE_MMSG
+#endif
+
+/*
+ * Packets are received NET_BATCH at a time and handed out one by one.
+ * Between NET_BeginBatch and NET_EndBatch, sent packets are queued and
+ * go out together when the queue fills or the batch ends. Without
+ * recvmmsg/sendmmsg, the batch is read and written a packet at a time.
+ */
+#define NET_BATCH	32
+
+typedef struct {
+    struct sockaddr_in addr;
+    int length;
+    byte data[MAX_UDP_PACKET];
+} netpacket_t;
+
+static netpacket_t net_recvqueue[NET_BATCH];
+static int net_numrecv;		/* packets read by the last batch */
+static int net_nextrecv;	/* next one to hand out */
+
+static netpacket_t net_sendqueue[NET_BATCH];
+static int net_numsend;
+static qboolean net_batching;
+
 
 static void
 NetadrToSockadr(netadr_t *a, struct sockaddr_in *s)
@@ -141,50 +175,172 @@ NET_StringToAdr(const char *s, netadr_t *a)
 }
 
 
+/*
+ * Prints the error of a failed socket call, unless the socket simply had
+ * nothing more to give or take for now
+ */
+static void
+NET_CheckError(const char *func)
+{
+    if (errno == EWOULDBLOCK)
+	return;
+    if (errno == ECONNREFUSED)
+	return;
+    Sys_Printf("%s: %s\n", func, strerror(errno));
+}
+
+/*
+ * Fills the receive queue with as many packets as are waiting, up to
+ * NET_BATCH. Returns how many were read.
+ */
+static int
+NET_ReadBatch(void)
+{
+    netpacket_t *packet;
+    int count;
+#ifdef HAVE_MMSG
+    struct mmsghdr msgs[NET_BATCH];
+    struct iovec iov[NET_BATCH];
+    int i;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < NET_BATCH; i++) {
+	packet = &net_recvqueue[i];
+	iov[i].iov_base = packet->data;
+	iov[i].iov_len = sizeof(packet->data);
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+	msgs[i].msg_hdr.msg_name = &packet->addr;
+	msgs[i].msg_hdr.msg_namelen = sizeof(packet->addr);
+    }
+
+    count = recvmmsg(net_socket, msgs, NET_BATCH, MSG_DONTWAIT, NULL);
+    if (count == -1) {
+	NET_CheckError(__func__);
+	return 0;
+    }
+    for (i = 0; i < count; i++)
+	net_recvqueue[i].length = msgs[i].msg_len;
+#else
+    socklen_t fromlen;
+    int ret;
+
+    for (count = 0; count < NET_BATCH; count++) {
+	packet = &net_recvqueue[count];
+	fromlen = sizeof(packet->addr);
+	ret = recvfrom(net_socket, packet->data, sizeof(packet->data), 0,
+		       (struct sockaddr *)&packet->addr, &fromlen);
+	if (ret == -1) {
+	    NET_CheckError(__func__);
+	    break;
+	}
+	packet->length = ret;
+    }
+#endif
+
+    return count;
+}
+
 qboolean
 NET_GetPacket(void)
 {
-    int ret;
-    struct sockaddr_in from;
-    socklen_t fromlen;
+    netpacket_t *packet;
 
-    fromlen = sizeof(from);
-    ret =
-	recvfrom(net_socket, net_message_buffer, sizeof(net_message_buffer),
-		 0, (struct sockaddr *)&from, &fromlen);
-    if (ret == -1) {
-	if (errno == EWOULDBLOCK)
-	    return false;
-	if (errno == ECONNREFUSED)
+    if (net_nextrecv == net_numrecv) {
+	net_nextrecv = 0;
+	net_numrecv = NET_ReadBatch();
+	if (!net_numrecv)
 	    return false;
-	Sys_Printf("%s: %s\n", __func__, strerror(errno));
-	return false;
     }
 
-    net_message.cursize = ret;
-    SockadrToNetadr(&from, &net_from);
+    packet = &net_recvqueue[net_nextrecv++];
+    memcpy(net_message_buffer, packet->data, packet->length);
+    net_message.cursize = packet->length;
+    SockadrToNetadr(&packet->addr, &net_from);
 
-    return ret;
+    return packet->length;
 }
 
+/*
+ * Sends everything in the send queue
+ */
+static void
+NET_FlushSends(void)
+{
+    netpacket_t *packet;
+    int sent;
+#ifdef HAVE_MMSG
+    struct mmsghdr msgs[NET_BATCH];
+    struct iovec iov[NET_BATCH];
+    int i, ret;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < net_numsend; i++) {
+	packet = &net_sendqueue[i];
+	iov[i].iov_base = packet->data;
+	iov[i].iov_len = packet->length;
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+	msgs[i].msg_hdr.msg_name = &packet->addr;
+	msgs[i].msg_hdr.msg_namelen = sizeof(packet->addr);
+    }
+
+    /* sendmmsg stops at the first packet that fails; skip over it */
+    sent = 0;
+    while (sent < net_numsend) {
+	ret = sendmmsg(net_socket, msgs + sent, net_numsend - sent, 0);
+	if (ret <= 0) {
+	    NET_CheckError(__func__);
+	    ret = 1;
+	}
+	sent += ret;
+    }
+#else
+    for (sent = 0; sent < net_numsend; sent++) {
+	packet = &net_sendqueue[sent];
+	if (sendto(net_socket, packet->data, packet->length, 0,
+		   (struct sockaddr *)&packet->addr,
+		   sizeof(packet->addr)) == -1)
+	    NET_CheckError(__func__);
+    }
+#endif
+
+    net_numsend = 0;
+}
 
 void
 NET_SendPacket(int length, void *data, netadr_t to)
 {
-    int ret;
+    netpacket_t *packet;
     struct sockaddr_in addr;
 
-    NetadrToSockadr(&to, &addr);
-
-    ret = sendto(net_socket, data, length, 0, (struct sockaddr *)&addr,
-		 sizeof(addr));
-    if (ret == -1) {
-	if (errno == EWOULDBLOCK)
-	    return;
-	if (errno == ECONNREFUSED)
-	    return;
-	Sys_Printf("%s: %s\n", __func__, strerror(errno));
+    if (!net_batching || length > MAX_UDP_PACKET) {
+	NetadrToSockadr(&to, &addr);
+	if (sendto(net_socket, data, length, 0, (struct sockaddr *)&addr,
+		   sizeof(addr)) == -1)
+	    NET_CheckError(__func__);
+	return;
     }
+
+    if (net_numsend == NET_BATCH)
+	NET_FlushSends();
+    packet = &net_sendqueue[net_numsend++];
+    NetadrToSockadr(&to, &packet->addr);
+    memcpy(packet->data, data, length);
+    packet->length = length;
+}
+
+void
+NET_BeginBatch(void)
+{
+    net_batching = true;
+}
+
+void
+NET_EndBatch(void)
+{
+    NET_FlushSends();
+    net_batching = false;
 }
 
 
@@ -220,6 +376,111 @@ UDP_OpenSocket(int port)
     return newsocket;
 }
 
+/*
+ * ====================
+ * NET_StreamOpen
+ *
+ * Connects a TCP stream, waiting for it, and leaves it non-blocking.
+ * Returns the socket or -1.
+ * ====================
+ */
+int
+NET_StreamOpen(netadr_t to)
+{
+    struct sockaddr_in address;
+    int s, _true = 1;
+
+    s = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == -1) {
+	Con_Printf("%s: socket: %s\n", __func__, strerror(errno));
+	return -1;
+    }
+    NetadrToSockadr(&to, &address);
+    if (connect(s, (struct sockaddr *)&address, sizeof(address)) == -1) {
+	Con_Printf("Couldn't connect to %s: %s\n", NET_AdrToString(to),
+		   strerror(errno));
+	close(s);
+	return -1;
+    }
+    if (ioctl(s, FIONBIO, &_true) == -1) {
+	Con_Printf("%s: ioctl FIONBIO: %s\n", __func__, strerror(errno));
+	close(s);
+	return -1;
+    }
+
+    return s;
+}
+
+/*
+ * ====================
+ * NET_StreamConnect
+ *
+ * Starts connecting a non-blocking TCP stream without waiting for it;
+ * until it's up, sends and receives move nothing. Returns the socket or -1.
+ * ====================
+ */
+int
+NET_StreamConnect(netadr_t to)
+{
+    struct sockaddr_in address;
+    int s, _true = 1;
+
+    s = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == -1) {
+	Con_Printf("%s: socket: %s\n", __func__, strerror(errno));
+	return -1;
+    }
+    if (ioctl(s, FIONBIO, &_true) == -1) {
+	Con_Printf("%s: ioctl FIONBIO: %s\n", __func__, strerror(errno));
+	close(s);
+	return -1;
+    }
+    NetadrToSockadr(&to, &address);
+    if (connect(s, (struct sockaddr *)&address, sizeof(address)) == -1
+	&& errno != EINPROGRESS) {
+	Con_Printf("Couldn't connect to %s: %s\n", NET_AdrToString(to),
+		   strerror(errno));
+	close(s);
+	return -1;
+    }
+
+    return s;
+}
+
+/*
+ * Both return how much was moved, 0 when the stream can't take or give any
+ * more for now, or -1 once it's gone
+ */
+int
+NET_StreamSend(int s, const void *data, int length)
+{
+    int ret;
+
+    ret = send(s, data, length, MSG_NOSIGNAL);
+    if (ret == -1 && (errno == EWOULDBLOCK || errno == EINTR))
+	return 0;
+
+    return ret;
+}
+
+int
+NET_StreamRecv(int s, void *data, int length)
+{
+    int ret;
+
+    ret = recv(s, data, length, 0);
+    if (ret == -1 && (errno == EWOULDBLOCK || errno == EINTR))
+	return 0;
+
+    return ret > 0 ? ret : -1;
+}
+
+void
+NET_StreamClose(int s)
+{
+    close(s);
+}
+
 void
 NET_GetLocalAddress(void)
 {
@@ -275,5 +536,6 @@ NET_Init(int port)
 void
 NET_Shutdown(void)
 {
+    NET_EndBatch();
     close(net_socket);
 }
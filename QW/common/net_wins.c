@@ -238,6 +238,115 @@ UDP_OpenSocket(int port)
     return newsocket;
 }
 
+/*
+ * ====================
+ * NET_StreamOpen
+ *
+ * Connects a TCP stream, waiting for it, and leaves it non-blocking.
+ * Returns the socket or -1.
+ * ====================
+ */
+int
+NET_StreamOpen(netadr_t to)
+{
+    struct sockaddr_in address;
+    u_long _true = 1;
+    SOCKET s;
+
+    s = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET) {
+	Con_Printf("%s: socket: %i\n", __func__, WSAGetLastError());
+	return -1;
+    }
+    NetadrToSockadr(&to, &address);
+    if (connect(s, (struct sockaddr *)&address, sizeof(address)) == -1) {
+	Con_Printf("Couldn't connect to %s: %i\n", NET_AdrToString(to),
+		   WSAGetLastError());
+	closesocket(s);
+	return -1;
+    }
+    if (ioctlsocket(s, FIONBIO, &_true) == -1) {
+	Con_Printf("%s: ioctl FIONBIO: %i\n", __func__, WSAGetLastError());
+	closesocket(s);
+	return -1;
+    }
+
+    return (int)s;
+}
+
+/*
+ * ====================
+ * NET_StreamConnect
+ *
+ * Starts connecting a non-blocking TCP stream without waiting for it;
+ * until it's up, sends and receives move nothing. Returns the socket or -1.
+ * ====================
+ */
+int
+NET_StreamConnect(netadr_t to)
+{
+    struct sockaddr_in address;
+    u_long _true = 1;
+    SOCKET s;
+
+    s = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET) {
+	Con_Printf("%s: socket: %i\n", __func__, WSAGetLastError());
+	return -1;
+    }
+    if (ioctlsocket(s, FIONBIO, &_true) == -1) {
+	Con_Printf("%s: ioctl FIONBIO: %i\n", __func__, WSAGetLastError());
+	closesocket(s);
+	return -1;
+    }
+    NetadrToSockadr(&to, &address);
+    if (connect(s, (struct sockaddr *)&address, sizeof(address)) == -1
+	&& WSAGetLastError() != WSAEWOULDBLOCK) {
+	Con_Printf("Couldn't connect to %s: %i\n", NET_AdrToString(to),
+		   WSAGetLastError());
+	closesocket(s);
+	return -1;
+    }
+
+    return (int)s;
+}
+
+/*
+ * Both return how much was moved, 0 when the stream can't take or give any
+ * more for now, or -1 once it's gone
+ */
+int
+NET_StreamSend(int s, const void *data, int length)
+{
+    int ret;
+
+    ret = send(s, data, length, 0);
+    if (ret == -1 && (WSAGetLastError() == WSAEWOULDBLOCK
+		      || WSAGetLastError() == WSAENOTCONN))
+	return 0;		// full, or still connecting
+
+    return ret;
+}
+
+int
+NET_StreamRecv(int s, void *data, int length)
+{
+    int ret;
+
+    ret = recv(s, data, length, 0);
+    if (ret == -1 && (WSAGetLastError() == WSAEWOULDBLOCK
+		      || WSAGetLastError() == WSAENOTCONN))
+	return 0;		// empty, or still connecting
+
+    return ret > 0 ? ret : -1;
+}
+
+void
+NET_StreamClose(int s)
+{
+    closesocket(s);
+}
+
 void
 NET_GetLocalAddress(void)
 {
@@ -297,6 +406,19 @@ NET_Init(int port)
  * NET_Shutdown
  * ====================
  */
+/*
+ * Winsock has no batched sends, packets just go out as they are sent
+ */
+void
+NET_BeginBatch(void)
+{
+}
+
+void
+NET_EndBatch(void)
+{
+}
+
 void
 NET_Shutdown(void)
 {
@@ -834,6 +834,7 @@ PlayerMove(void)
 {
     frametime = pmove.cmd.msec * 0.001;
     pmove.numtouch = 0;
+    PM_SetupPhysents();
 
     AngleVectors(pmove.angles, forward, right, up);
 
@@ -37,8 +37,20 @@ extern vec3_t player_maxs;
 
 static hull_t box_hull;
 static mclipnode_t box_clipnodes[6];
+static mhullnode_t box_hullnodes[6];
 static mplane_t box_planes[6];
 
+/*
+ * The box each physent can stop a player's origin in, by the player hull
+ * it's clipped against. Traces and position tests pass over the physents
+ * whose box they don't reach; the world (physent 0) is always tested.
+ */
+#define PHYSENT_EPSILON 2	// slack for bevels and DIST_EPSILON
+
+static vec3_t physent_mins[MAX_PHYSENTS];
+static vec3_t physent_maxs[MAX_PHYSENTS];
+static int physent_numbounds;
+
 /*
 ===================
 PM_InitBoxHull
@@ -73,6 +85,8 @@ PM_InitBoxHull(void)
 	box_planes[i].normal[i >> 1] = 1;
     }
 
+    box_hull.hullnodes = box_hullnodes;
+    Mod_PackHullNodes(box_hullnodes, box_clipnodes, 6, box_planes);
 }
 
 
@@ -93,6 +107,12 @@ PM_HullForBox(vec3_t mins, vec3_t maxs)
     box_planes[3].dist = mins[1];
     box_planes[4].dist = maxs[2];
     box_planes[5].dist = mins[2];
+    box_hullnodes[0].dist = maxs[0];
+    box_hullnodes[1].dist = mins[0];
+    box_hullnodes[2].dist = maxs[1];
+    box_hullnodes[3].dist = mins[1];
+    box_hullnodes[4].dist = maxs[2];
+    box_hullnodes[5].dist = mins[2];
 
     return &box_hull;
 }
@@ -108,20 +128,14 @@ int
 PM_HullPointContents(hull_t *hull, int num, vec3_t p)
 {
     float d;
-    mclipnode_t *node;
-    mplane_t *plane;
+    const mhullnode_t *node;
 
     while (num >= 0) {
 	if (num < hull->firstclipnode || num > hull->lastclipnode)
 	    Sys_Error("PM_HullPointContents: bad node number");
 
-	node = hull->clipnodes + num;
-	plane = hull->planes + node->planenum;
-
-	if (plane->type < 3)
-	    d = p[plane->type] - plane->dist;
-	else
-	    d = DotProduct(plane->normal, p) - plane->dist;
+	node = hull->hullnodes + num;
+	d = Mod_HullNodeDist(hull, node, p);
 	if (d < 0)
 	    num = node->children[1];
 	else
@@ -170,8 +184,8 @@ qboolean
 PM_RecursiveHullCheck(hull_t *hull, int num, float p1f, float p2f,
 		      vec3_t p1, vec3_t p2, pmtrace_t * trace)
 {
-    mclipnode_t *node;
-    mplane_t *plane;
+    const mhullnode_t *node;
+    const mplane_t *plane;
     float t1, t2;
     float frac;
     int child, i;
@@ -198,16 +212,9 @@ PM_RecursiveHullCheck(hull_t *hull, int num, float p1f, float p2f,
 //
 // find the point distances
 //
-    node = hull->clipnodes + num;
-    plane = hull->planes + node->planenum;
-
-    if (plane->type < 3) {
-	t1 = p1[plane->type] - plane->dist;
-	t2 = p2[plane->type] - plane->dist;
-    } else {
-	t1 = DotProduct(plane->normal, p1) - plane->dist;
-	t2 = DotProduct(plane->normal, p2) - plane->dist;
-    }
+    node = hull->hullnodes + num;
+    t1 = Mod_HullNodeDist(hull, node, p1);
+    t2 = Mod_HullNodeDist(hull, node, p2);
 
 #if 1
     if (t1 >= 0 && t2 >= 0) {
@@ -268,12 +275,13 @@ PM_RecursiveHullCheck(hull_t *hull, int num, float p1f, float p2f,
 //==================
 // the other side of the node is solid, this is the impact point
 //==================
+    plane = hull->planes + HULLNODE_PLANE(node);
     if (!side) {
 	VectorCopy(plane->normal, trace->plane.normal);
-	trace->plane.dist = plane->dist;
+	trace->plane.dist = node->dist;
     } else {
 	VectorSubtract(vec3_origin, plane->normal, trace->plane.normal);
-	trace->plane.dist = -plane->dist;
+	trace->plane.dist = -node->dist;
     }
 
     /* shouldn't really happen, but does occasionally */
@@ -297,6 +305,338 @@ PM_RecursiveHullCheck(hull_t *hull, int num, float p1f, float p2f,
 }
 
 
+/*
+==================
+PM_HullCheck
+
+PM_RecursiveHullCheck without the recursion. Only the nodes the line
+crosses go on the stack, holding what the far side and the impact need,
+so the traces come out bit for bit the same. Past HULL_STACK crossings
+the rest is done recursively.
+==================
+*/
+#define	HULL_STACK	64
+
+typedef struct {
+    const mhullnode_t *node;
+    int side;
+    float frac;
+    float p1f, p2f, midf;
+    vec3_t p1, p2, mid;
+} hullframe_t;
+
+static qboolean
+PM_HullCheck(hull_t *hull, int num, float p1f, float p2f,
+	     vec3_t p1, vec3_t p2, pmtrace_t *trace)
+{
+    hullframe_t stack[HULL_STACK], *frame;
+    const mhullnode_t *node;
+    const mplane_t *plane;
+    vec3_t start, end;
+    float t1, t2;
+    float frac;
+    int i, depth;
+
+    VectorCopy(p1, start);
+    VectorCopy(p2, end);
+    depth = 0;
+
+    for (;;) {
+	/* go down the near side, keeping the nodes crossed on the way */
+	while (num >= 0) {
+	    if (num < hull->firstclipnode || num > hull->lastclipnode)
+		Sys_Error("PM_HullCheck: bad node number");
+
+	    node = hull->hullnodes + num;
+	    t1 = Mod_HullNodeDist(hull, node, start);
+	    t2 = Mod_HullNodeDist(hull, node, end);
+	    if (t1 >= 0 && t2 >= 0) {
+		num = node->children[0];
+		continue;
+	    }
+	    if (t1 < 0 && t2 < 0) {
+		num = node->children[1];
+		continue;
+	    }
+
+	    if (depth == HULL_STACK) {
+		if (!PM_RecursiveHullCheck(hull, num, p1f, p2f, start, end,
+					   trace))
+		    return false;
+		break;
+	    }
+
+	    /* put the crosspoint DIST_EPSILON pixels on the near side */
+	    if (t1 < 0)
+		frac = (t1 + DIST_EPSILON) / (t1 - t2);
+	    else
+		frac = (t1 - DIST_EPSILON) / (t1 - t2);
+	    if (frac < 0)
+		frac = 0;
+	    if (frac > 1)
+		frac = 1;
+
+	    frame = &stack[depth++];
+	    frame->node = node;
+	    frame->side = (t1 < 0);
+	    frame->frac = frac;
+	    frame->p1f = p1f;
+	    frame->p2f = p2f;
+	    frame->midf = p1f + (p2f - p1f) * frac;
+	    VectorCopy(start, frame->p1);
+	    VectorCopy(end, frame->p2);
+	    for (i = 0; i < 3; i++)
+		frame->mid[i] = start[i] + frac * (end[i] - start[i]);
+
+	    /* move up to the node */
+	    num = node->children[frame->side];
+	    p2f = frame->midf;
+	    VectorCopy(frame->mid, end);
+	}
+
+	/* check for empty */
+	if (num < 0) {
+	    if (num != CONTENTS_SOLID) {
+		trace->allsolid = false;
+		if (num == CONTENTS_EMPTY)
+		    trace->inopen = true;
+		else
+		    trace->inwater = true;
+	    } else
+		trace->startsolid = true;
+	}
+
+	/* the near side of the last node crossed is done */
+	if (!depth)
+	    return true;
+	frame = &stack[--depth];
+
+	num = frame->node->children[frame->side ^ 1];
+	if (PM_HullPointContents(hull, num, frame->mid) != CONTENTS_SOLID) {
+	    /* go past the node */
+	    p1f = frame->midf;
+	    p2f = frame->p2f;
+	    VectorCopy(frame->mid, start);
+	    VectorCopy(frame->p2, end);
+	    continue;
+	}
+
+	if (trace->allsolid)
+	    return false;	// never got out of the solid area
+
+	/* the other side of the node is solid, this is the impact point */
+	plane = hull->planes + HULLNODE_PLANE(frame->node);
+	if (!frame->side) {
+	    VectorCopy(plane->normal, trace->plane.normal);
+	    trace->plane.dist = frame->node->dist;
+	} else {
+	    VectorSubtract(vec3_origin, plane->normal, trace->plane.normal);
+	    trace->plane.dist = -frame->node->dist;
+	}
+
+	/* shouldn't really happen, but does occasionally */
+	frac = frame->frac;
+	while (PM_HullPointContents(hull, hull->firstclipnode, frame->mid)
+	       == CONTENTS_SOLID) {
+	    frac -= 0.1;
+	    if (frac < 0) {
+		trace->fraction = frame->midf;
+		VectorCopy(frame->mid, trace->endpos);
+		Con_DPrintf("backup past 0\n");
+		return false;
+	    }
+	    frame->midf = frame->p1f + (frame->p2f - frame->p1f) * frac;
+	    for (i = 0; i < 3; i++)
+		frame->mid[i] = frame->p1[i]
+		    + frac * (frame->p2[i] - frame->p1[i]);
+	}
+
+	trace->fraction = frame->midf;
+	VectorCopy(frame->mid, trace->endpos);
+
+	return false;
+    }
+}
+
+/*
+ * The box hull is a chain: node k is on one of the box's faces, in the
+ * order PM_InitBoxHull gives them, and has EMPTY on the outside with the
+ * next node, or SOLID after the last one, on the inside.
+ */
+#define BOX_OUTSIDE(k, t)	(((k) & 1) ? (t) < 0 : (t) >= 0)
+
+static int
+PM_BoxPointContents(const vec3_t mins, const vec3_t maxs, int k,
+		    const vec3_t p)
+{
+    int axis;
+    float dist;
+
+    for (; k < 6; k++) {
+	axis = k >> 1;
+	dist = (k & 1) ? mins[axis] : maxs[axis];
+	if (BOX_OUTSIDE(k, p[axis] - dist))
+	    return CONTENTS_EMPTY;
+    }
+
+    return CONTENTS_SOLID;
+}
+
+/*
+==================
+PM_BoxCheck
+
+PM_HullCheck through the hull PM_HullForBox would make, without making
+it. A line crossing a face on the way down the chain either starts
+outside it and carries on from the crossing, or starts inside it and
+carries on to the crossing, so there is only ever the one line to follow.
+The sums are the hull trace's, in its order, so the results match it.
+==================
+*/
+static void
+PM_BoxCheck(const vec3_t mins, const vec3_t maxs, const vec3_t p1,
+	    const vec3_t p2, pmtrace_t *trace)
+{
+    vec3_t start, end, mid;
+    float t1, t2, frac, dist;
+    float p1f, p2f, midf;
+    qboolean open_after;
+    int i, k, axis, side;
+
+    VectorCopy(p1, start);
+    VectorCopy(p2, end);
+    p1f = 0;
+    p2f = 1;
+    open_after = false;
+
+    for (k = 0; k < 6; k++) {
+	axis = k >> 1;
+	dist = (k & 1) ? mins[axis] : maxs[axis];
+	t1 = start[axis] - dist;
+	t2 = end[axis] - dist;
+	if ((t1 >= 0 && t2 >= 0) || (t1 < 0 && t2 < 0)) {
+	    if (BOX_OUTSIDE(k, t1))
+		break;
+	    continue;
+	}
+
+	/* put the crosspoint DIST_EPSILON pixels on the near side */
+	if (t1 < 0)
+	    frac = (t1 + DIST_EPSILON) / (t1 - t2);
+	else
+	    frac = (t1 - DIST_EPSILON) / (t1 - t2);
+	if (frac < 0)
+	    frac = 0;
+	if (frac > 1)
+	    frac = 1;
+
+	midf = p1f + (p2f - p1f) * frac;
+	for (i = 0; i < 3; i++)
+	    mid[i] = start[i] + frac * (end[i] - start[i]);
+	side = (t1 < 0);
+
+	if (side != (k & 1)) {
+	    /* starts inside the face: the rest of the chain up to it */
+	    VectorCopy(mid, end);
+	    p2f = midf;
+	    open_after = true;
+	    continue;
+	}
+
+	/* starts outside the face, in the open */
+	trace->allsolid = false;
+	trace->inopen = true;
+	if (PM_BoxPointContents(mins, maxs, k + 1, mid) != CONTENTS_SOLID) {
+	    VectorCopy(mid, start);
+	    p1f = midf;
+	    continue;
+	}
+
+	/* the other side of the face is solid, this is the impact point */
+	for (i = 0; i < 3; i++)
+	    trace->plane.normal[i] = 0;
+	trace->plane.normal[axis] = side ? -1 : 1;
+	trace->plane.dist = side ? -dist : dist;
+
+	/* shouldn't really happen, but does occasionally */
+	while (PM_BoxPointContents(mins, maxs, 0, mid) == CONTENTS_SOLID) {
+	    frac -= 0.1;
+	    if (frac < 0) {
+		trace->fraction = midf;
+		VectorCopy(mid, trace->endpos);
+		Con_DPrintf("backup past 0\n");
+		return;
+	    }
+	    midf = p1f + (p2f - p1f) * frac;
+	    for (i = 0; i < 3; i++)
+		mid[i] = start[i] + frac * (end[i] - start[i]);
+	}
+
+	trace->fraction = midf;
+	VectorCopy(mid, trace->endpos);
+	return;
+    }
+
+    if (k == 6) {
+	trace->startsolid = true;
+    } else {
+	trace->allsolid = false;
+	trace->inopen = true;
+    }
+    if (open_after) {
+	trace->allsolid = false;
+	trace->inopen = true;
+    }
+}
+
+
+/*
+================
+PM_SetupPhysents
+
+Finds the boxes of the current pmove.physents, to be called whenever
+they have been changed and before they are traced against.
+================
+*/
+void
+PM_SetupPhysents(void)
+{
+    int i, j;
+    physent_t *pe;
+    const float *mins, *maxs;
+
+    for (i = 0; i < pmove.numphysent; i++) {
+	pe = &pmove.physents[i];
+	mins = pe->model ? pe->model->mins : pe->mins;
+	maxs = pe->model ? pe->model->maxs : pe->maxs;
+	for (j = 0; j < 3; j++) {
+	    physent_mins[i][j] = pe->origin[j] + mins[j] - player_maxs[j]
+		- PHYSENT_EPSILON;
+	    physent_maxs[i][j] = pe->origin[j] + maxs[j] - player_mins[j]
+		+ PHYSENT_EPSILON;
+	}
+    }
+    physent_numbounds = pmove.numphysent;
+}
+
+/*
+ * True if the box can't be reached by a physent other than the world
+ */
+static qboolean
+PM_PhysentOutside(int i, const vec3_t mins, const vec3_t maxs)
+{
+    int j;
+
+    if (!i || i >= physent_numbounds)
+	return false;
+
+    for (j = 0; j < 3; j++)
+	if (physent_mins[i][j] > maxs[j] || physent_maxs[i][j] < mins[j])
+	    return true;
+
+    return false;
+}
+
 /*
 ================
 PM_TestPlayerPosition
@@ -313,18 +653,21 @@ PM_TestPlayerPosition(vec3_t pos)
     hull_t *hull;
 
     for (i = 0; i < pmove.numphysent; i++) {
+	if (PM_PhysentOutside(i, pos, pos))
+	    continue;
 	pe = &pmove.physents[i];
-	// get the clipping hull
-	if (pe->model)
-	    hull = &pmove.physents[i].model->hulls[1];
-	else {
+	VectorSubtract(pos, pe->origin, test);
+
+	// get the clipping hull, boxes are tested directly
+	if (!pe->model) {
 	    VectorSubtract(pe->mins, player_maxs, mins);
 	    VectorSubtract(pe->maxs, player_mins, maxs);
-	    hull = PM_HullForBox(mins, maxs);
+	    if (PM_BoxPointContents(mins, maxs, 0, test) == CONTENTS_SOLID)
+		return false;
+	    continue;
 	}
 
-	VectorSubtract(pos, pe->origin, test);
-
+	hull = &pmove.physents[i].model->hulls[1];
 	if (PM_HullPointContents(hull, hull->firstclipnode, test) ==
 	    CONTENTS_SOLID)
 	    return false;
@@ -348,6 +691,7 @@ PM_PlayerMove(vec3_t start, vec3_t end)
     int i;
     physent_t *pe;
     vec3_t mins, maxs;
+    vec3_t movemins, movemaxs;
 
 // fill in a default trace
     memset(&total, 0, sizeof(pmtrace_t));
@@ -355,15 +699,22 @@ PM_PlayerMove(vec3_t start, vec3_t end)
     total.ent = -1;
     VectorCopy(end, total.endpos);
 
+    for (i = 0; i < 3; i++) {
+	movemins[i] = qmin(start[i], end[i]);
+	movemaxs[i] = qmax(start[i], end[i]);
+    }
+
     for (i = 0; i < pmove.numphysent; i++) {
+	if (PM_PhysentOutside(i, movemins, movemaxs))
+	    continue;
 	pe = &pmove.physents[i];
-	// get the clipping hull
+	// get the clipping hull, boxes are traced directly
 	if (pe->model)
 	    hull = &pmove.physents[i].model->hulls[1];
 	else {
 	    VectorSubtract(pe->mins, player_maxs, mins);
 	    VectorSubtract(pe->maxs, player_mins, maxs);
-	    hull = PM_HullForBox(mins, maxs);
+	    hull = NULL;
 	}
 
 	// PM_HullForEntity (ent, mins, maxs, offset);
@@ -380,8 +731,11 @@ PM_PlayerMove(vec3_t start, vec3_t end)
 	VectorCopy(end, trace.endpos);
 
 	// trace a line through the apropriate clipping hull
-	PM_RecursiveHullCheck(hull, hull->firstclipnode, 0, 1, start_l,
-			      end_l, &trace);
+	if (hull)
+	    PM_HullCheck(hull, hull->firstclipnode, 0, 1, start_l, end_l,
+			 &trace);
+	else
+	    PM_BoxCheck(mins, maxs, start_l, end_l, &trace);
 
 	if (trace.allsolid)
 	    trace.startsolid = true;
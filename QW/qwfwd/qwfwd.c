@@ -41,38 +41,111 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  *	2 of the License, or (at your option) any later version.
  *
  */
+
+/*
+ * Each client address gets its own socket connected to the remote server,
+ * so the server sees every client as a separate peer. Peers are found by
+ * a hash of the client's address, and are dropped after -timeout seconds
+ * without traffic.
+ *
+ * With -threads n, n workers each bind their own socket to the port with
+ * SO_REUSEPORT and run independently; the kernel keeps sending a client's
+ * packets to the same socket, so a peer only ever lives in one worker.
+ * Packets are read and the replies to clients sent in batches, with
+ * recvmmsg/sendmmsg where available. -stats n prints the traffic of each
+ * worker every n seconds.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE		/* recvmmsg, sendmmsg */
+#endif
+
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <time.h>
 
 #ifdef _WIN32
-#include <winsock.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define poll WSAPoll
+#define close closesocket
+typedef int socklen_t;
 #else
 #include <sys/time.h>
 #include <sys/socket.h>
-#include <sys/wait.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
 #include <unistd.h>
-#include <syslog.h>
+#endif
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#define HAVE_EPOLL
+#ifdef MSG_WAITFORONE
+#define HAVE_MMSG
+#endif
 #endif
 
-int host_port;			// port we are listening on
+#define MAX_WORKERS	16
+#define MAX_PACKET	8192
+#define PEER_HASH	4096	/* buckets, must be a power of two */
+#define BATCH		32	/* packets read or sent at once */
 
 typedef struct peer {
     time_t last;
-    struct sockaddr_in sin;
-    struct sockaddr_in dest;
+    struct sockaddr_in sin;	// the client
     int s;			// connected socket to remote
-    struct peer *next;
+    int slot;			// in the worker's poll set
+    struct peer *next;		// in the hash bucket
 } peer_t;
 
-peer_t *peers;
+typedef struct {
+    unsigned long packets;
+    unsigned long bytes;
+} traffic_t;
+
+typedef struct {
+    struct sockaddr_in addr;
+    int length;
+    char data[MAX_PACKET];
+} packet_t;
+
+typedef struct {
+    int num;
+    int s;			// listening socket
+    peer_t *peers[PEER_HASH];
+    int numpeers;
+
+#ifdef HAVE_EPOLL
+    int epfd;
+#else
+    struct pollfd *fds;		// fds[0] is the listening socket
+    peer_t **fdpeers;
+    int numfds, maxfds;
+#endif
+
+    packet_t incoming[BATCH];	// read from the clients
+    packet_t replies[BATCH];	// waiting to be sent to them
+    int numreplies;
+
+    traffic_t fromclients, toclients;
+    int added, expired;
+} worker_t;
+
+static int host_port;		// port we are listening on
+static struct sockaddr_in remote;
+static int peer_timeout = 300;
+static int stats_interval;
+
+static worker_t *workers[MAX_WORKERS];
+static int numworkers = 1;
 
 /*
 ====================
@@ -101,176 +174,608 @@ NET_Init(void)
 #endif
 }
 
+static int
+SetNonBlocking(int s)
+{
+#ifdef _WIN32
+    u_long _true = 1;
 
+    return ioctlsocket(s, FIONBIO, &_true);
+#else
+    return fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+#endif
+}
 
-int
-connectsock(char *host, char *service, char *protocol)
+static const char *
+PeerName(const peer_t *p, char *buf, int size)
+{
+    char ip[INET_ADDRSTRLEN];
+
+    inet_ntop(AF_INET, (void *)&p->sin.sin_addr, ip, sizeof(ip));
+    snprintf(buf, size, "%s:%d", ip, (int)ntohs(p->sin.sin_port));
+
+    return buf;
+}
+
+/*
+====================
+ResolveRemote
+
+Map the host and service to the address every peer connects to
+====================
+*/
+static void
+ResolveRemote(const char *host, const char *service)
 {
     struct hostent *phe;
     struct servent *pse;
-    struct protoent *ppe;
-    struct sockaddr_in sin;
-    int s, type;
 
-    memset(&sin, 0, sizeof(sin));
-    sin.sin_family = AF_INET;
+    memset(&remote, 0, sizeof(remote));
+    remote.sin_family = AF_INET;
 
 /* Map service name to port number */
-    if (pse = getservbyname(service, protocol))
-	sin.sin_port = pse->s_port;
-    else if ((sin.sin_port = htons((u_short) atoi(service))) == 0) {
+    if ((pse = getservbyname(service, "udp")) != NULL)
+	remote.sin_port = pse->s_port;
+    else if ((remote.sin_port = htons((u_short) atoi(service))) == 0) {
 	fprintf(stderr, "udpred: can't get \"%s\" service entry\n", service);
 	exit(2);
     }
 
 /* Map host name to IP address, allowing for dotted decimal */
-    if (phe = gethostbyname(host))
-	memcpy((char *)&sin.sin_addr, phe->h_addr, phe->h_length);
-    else if ((sin.sin_addr.s_addr = inet_addr(host)) == INADDR_NONE) {
+    if ((phe = gethostbyname(host)) != NULL)
+	memcpy((char *)&remote.sin_addr, phe->h_addr, phe->h_length);
+    else if ((remote.sin_addr.s_addr = inet_addr(host)) == INADDR_NONE) {
 	fprintf(stderr, "udpred: can't get \"%s\" host entry\n", host);
 	exit(2);
     }
+}
 
-/* Map protocol name to protocol number */
-    if ((ppe = getprotobyname(protocol)) == 0) {
-	fprintf(stderr, "udpred: can't get \"%s\" protocol entry\n",
-		protocol);
-	exit(2);
-    }
+/*
+====================
+connectsock
 
-/* Use protocol to choose a socket type */
-    if (strcmp(protocol, "udp") == 0)
-	type = SOCK_DGRAM;
-    else
-	type = SOCK_STREAM;
+Returns a non-blocking socket connected to the remote, or -1
+====================
+*/
+static int
+connectsock(void)
+{
+    int s;
 
-/* Allocate a socket */
-    s = socket(PF_INET, type, ppe->p_proto);
+    s = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (s < 0) {
 	fprintf(stderr, "udpred: can't create socket: %s\n",
-		sys_errlist[errno]);
-	exit(2);
+		strerror(errno));
+	return -1;
     }
-
-/* Connect the socket */
-    if (connect(s, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
-	fprintf(stderr, "udpred: can't connect to %s.%s: %s\n", host,
-		service, sys_errlist[errno]);
-	exit(2);
+    if (connect(s, (struct sockaddr *)&remote, sizeof(remote)) < 0
+	|| SetNonBlocking(s) < 0) {
+	fprintf(stderr, "udpred: can't connect to the remote: %s\n",
+		strerror(errno));
+	close(s);
+	return -1;
     }
+
     return s;
 }
 
-int
-main(int argc, char *argv[])
+/*
+===============================================================================
+
+				POLL SETS
+
+A worker waits on its listening socket and the sockets of all its peers.
+
+===============================================================================
+*/
+
+static void
+Worker_InitPoll(worker_t *w)
+{
+#ifdef HAVE_EPOLL
+    struct epoll_event event;
+
+    w->epfd = epoll_create(1024);
+    if (w->epfd < 0) {
+	perror("epoll_create");
+	exit(1);
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->s, &event) < 0) {
+	perror("epoll_ctl");
+	exit(1);
+    }
+#else
+    w->maxfds = 64;
+    w->fds = malloc(w->maxfds * sizeof(*w->fds));
+    w->fdpeers = malloc(w->maxfds * sizeof(*w->fdpeers));
+    if (!w->fds || !w->fdpeers) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    w->fds[0].fd = w->s;
+    w->fds[0].events = POLLIN;
+    w->fdpeers[0] = NULL;
+    w->numfds = 1;
+#endif
+}
+
+static int
+Worker_Watch(worker_t *w, peer_t *p)
+{
+#ifdef HAVE_EPOLL
+    struct epoll_event event;
+
+    event.events = EPOLLIN;
+    event.data.ptr = p;
+    return epoll_ctl(w->epfd, EPOLL_CTL_ADD, p->s, &event);
+#else
+    if (w->numfds == w->maxfds) {
+	struct pollfd *fds;
+	peer_t **fdpeers;
+
+	fds = realloc(w->fds, 2 * w->maxfds * sizeof(*fds));
+	if (!fds)
+	    return -1;
+	w->fds = fds;
+	fdpeers = realloc(w->fdpeers, 2 * w->maxfds * sizeof(*fdpeers));
+	if (!fdpeers)
+	    return -1;
+	w->fdpeers = fdpeers;
+	w->maxfds *= 2;
+    }
+    p->slot = w->numfds++;
+    w->fds[p->slot].fd = p->s;
+    w->fds[p->slot].events = POLLIN;
+    w->fds[p->slot].revents = 0;
+    w->fdpeers[p->slot] = p;
+    return 0;
+#endif
+}
+
+static void
+Worker_Unwatch(worker_t *w, peer_t *p)
+{
+#ifdef HAVE_EPOLL
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, p->s, NULL);
+#else
+    /* move the last one into the hole */
+    w->numfds--;
+    if (p->slot != w->numfds) {
+	w->fds[p->slot] = w->fds[w->numfds];
+	w->fdpeers[p->slot] = w->fdpeers[w->numfds];
+	w->fdpeers[p->slot]->slot = p->slot;
+    }
+#endif
+}
+
+/*
+ * Waits up to timeout milliseconds and fills in which sockets are ready,
+ * NULL standing for the listening socket. Returns how many are.
+ */
+static int
+Worker_Wait(worker_t *w, peer_t **ready, int maxready, int timeout)
+{
+    int i, count;
+#ifdef HAVE_EPOLL
+    struct epoll_event events[BATCH];
+
+    if (maxready > BATCH)
+	maxready = BATCH;
+    count = epoll_wait(w->epfd, events, maxready, timeout);
+    for (i = 0; i < count; i++)
+	ready[i] = events[i].data.ptr;
+#else
+    int numready;
+
+    count = poll(w->fds, w->numfds, timeout);
+    numready = 0;
+    for (i = 0; i < w->numfds && numready < count && numready < maxready;
+	 i++)
+	if (w->fds[i].revents)
+	    ready[numready++] = w->fdpeers[i];
+    count = numready;
+#endif
+
+    return count < 0 ? 0 : count;
+}
+
+/*
+===============================================================================
+
+				PEERS
+
+===============================================================================
+*/
+
+static unsigned
+PeerHash(const struct sockaddr_in *sin)
+{
+    unsigned hash;
+
+    hash = sin->sin_addr.s_addr * 2654435761u;
+    hash ^= sin->sin_port * 40503u;
+    return (hash ^ (hash >> 16)) & (PEER_HASH - 1);
+}
+
+static peer_t *
+FindPeer(worker_t *w, const struct sockaddr_in *sin)
 {
-    fd_set rfds;
-    struct timeval tv;
-    int retval;
-    int i1;
-    char buffer[4095];
-    struct sockaddr_in fsin;
-    int alen;
     peer_t *p;
-    int s;
-    struct sockaddr_in address;
 
-    if (argc < 3) {
-	printf("Usage:  %s <port> <remote server> <remote server port>\n",
-	       argv[0]);
-	return 1;
+    for (p = w->peers[PeerHash(sin)]; p; p = p->next)
+	if (p->sin.sin_addr.s_addr == sin->sin_addr.s_addr
+	    && p->sin.sin_port == sin->sin_port)
+	    return p;
+
+    return NULL;
+}
+
+static peer_t *
+AddPeer(worker_t *w, const struct sockaddr_in *sin)
+{
+    unsigned hash;
+    char name[32];
+    peer_t *p;
+
+    p = malloc(sizeof(*p));
+    if (!p)
+	return NULL;
+    p->sin = *sin;
+    p->s = connectsock();
+    if (p->s < 0) {
+	free(p);
+	return NULL;
+    }
+    if (Worker_Watch(w, p) < 0) {
+	close(p->s);
+	free(p);
+	return NULL;
     }
 
-    NET_Init();
+    hash = PeerHash(sin);
+    p->next = w->peers[hash];
+    w->peers[hash] = p;
+    w->numpeers++;
+    w->added++;
+
+    printf("peer %s added\n", PeerName(p, name, sizeof(name)));
+
+    return p;
+}
 
-    if ((s = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+/*
+====================
+ExpirePeers
+
+Removes the peers that have been quiet for longer than the timeout
+====================
+*/
+static void
+ExpirePeers(worker_t *w, time_t now)
+{
+    peer_t **link, *p;
+    char name[32];
+    int i;
+
+    for (i = 0; i < PEER_HASH; i++) {
+	link = &w->peers[i];
+	while ((p = *link) != NULL) {
+	    if (now - p->last <= peer_timeout) {
+		link = &p->next;
+		continue;
+	    }
+	    printf("peer %s removed (timeout)\n",
+		   PeerName(p, name, sizeof(name)));
+	    *link = p->next;
+	    Worker_Unwatch(w, p);
+	    close(p->s);
+	    free(p);
+	    w->numpeers--;
+	    w->expired++;
+	}
+    }
+}
+
+/*
+===============================================================================
+
+				PACKETS
+
+===============================================================================
+*/
+
+/*
+ * Reads up to BATCH packets waiting on the listening socket
+ */
+static int
+ReadClientPackets(worker_t *w)
+{
+    packet_t *packet;
+    int count;
+#ifdef HAVE_MMSG
+    struct mmsghdr msgs[BATCH];
+    struct iovec iov[BATCH];
+    int i;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < BATCH; i++) {
+	packet = &w->incoming[i];
+	iov[i].iov_base = packet->data;
+	iov[i].iov_len = sizeof(packet->data);
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+	msgs[i].msg_hdr.msg_name = &packet->addr;
+	msgs[i].msg_hdr.msg_namelen = sizeof(packet->addr);
+    }
+    count = recvmmsg(w->s, msgs, BATCH, MSG_DONTWAIT, NULL);
+    if (count < 0)
+	return 0;
+    for (i = 0; i < count; i++)
+	w->incoming[i].length = msgs[i].msg_len;
+#else
+    socklen_t alen;
+    int ret;
+
+    for (count = 0; count < BATCH; count++) {
+	packet = &w->incoming[count];
+	alen = sizeof(packet->addr);
+	ret = recvfrom(w->s, packet->data, sizeof(packet->data), 0,
+		       (struct sockaddr *)&packet->addr, &alen);
+	if (ret < 0)
+	    break;
+	packet->length = ret;
+    }
+#endif
+
+    return count;
+}
+
+/*
+ * Sends the queued replies to the clients
+ */
+static void
+FlushReplies(worker_t *w)
+{
+    packet_t *packet;
+    int sent;
+#ifdef HAVE_MMSG
+    struct mmsghdr msgs[BATCH];
+    struct iovec iov[BATCH];
+    int i, ret;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < w->numreplies; i++) {
+	packet = &w->replies[i];
+	iov[i].iov_base = packet->data;
+	iov[i].iov_len = packet->length;
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+	msgs[i].msg_hdr.msg_name = &packet->addr;
+	msgs[i].msg_hdr.msg_namelen = sizeof(packet->addr);
+    }
+
+    /* sendmmsg stops at the first packet that fails; skip over it */
+    sent = 0;
+    while (sent < w->numreplies) {
+	ret = sendmmsg(w->s, msgs + sent, w->numreplies - sent, 0);
+	sent += ret > 0 ? ret : 1;
+    }
+#else
+    for (sent = 0; sent < w->numreplies; sent++) {
+	packet = &w->replies[sent];
+	sendto(w->s, packet->data, packet->length, 0,
+	       (struct sockaddr *)&packet->addr, sizeof(packet->addr));
+    }
+#endif
+
+    w->numreplies = 0;
+}
+
+static void
+ForwardFromClients(worker_t *w, time_t now)
+{
+    packet_t *packet;
+    peer_t *p;
+    int i, count;
+
+    count = ReadClientPackets(w);
+    for (i = 0; i < count; i++) {
+	packet = &w->incoming[i];
+	if (packet->length <= 0)
+	    continue;
+
+	p = FindPeer(w, &packet->addr);
+	if (!p)
+	    p = AddPeer(w, &packet->addr);
+	if (!p)
+	    continue;
+	send(p->s, packet->data, packet->length, 0);
+	p->last = now;
+
+	w->fromclients.packets++;
+	w->fromclients.bytes += packet->length;
+    }
+}
+
+static void
+ForwardToClient(worker_t *w, peer_t *p, time_t now)
+{
+    packet_t *packet;
+    int i, ret;
+
+    for (i = 0; i < BATCH; i++) {
+	if (w->numreplies == BATCH)
+	    FlushReplies(w);
+	packet = &w->replies[w->numreplies];
+	ret = recv(p->s, packet->data, sizeof(packet->data), 0);
+	if (ret <= 0)
+	    break;
+	packet->length = ret;
+	packet->addr = p->sin;
+	w->numreplies++;
+	p->last = now;
+
+	w->toclients.packets++;
+	w->toclients.bytes += ret;
+    }
+}
+
+static void
+PrintStats(worker_t *w, int seconds)
+{
+    printf("worker %d: %d peers (+%d -%d), "
+	   "in %lu packets %lu bytes/s, out %lu packets %lu bytes/s\n",
+	   w->num, w->numpeers, w->added, w->expired,
+	   w->fromclients.packets / seconds, w->fromclients.bytes / seconds,
+	   w->toclients.packets / seconds, w->toclients.bytes / seconds);
+    fflush(stdout);
+
+    memset(&w->fromclients, 0, sizeof(w->fromclients));
+    memset(&w->toclients, 0, sizeof(w->toclients));
+    w->added = w->expired = 0;
+}
+
+/*
+====================
+Worker_Run
+====================
+*/
+static void *
+Worker_Run(void *arg)
+{
+    worker_t *w = arg;
+    peer_t *ready[BATCH];
+    time_t now, lastsweep, laststats;
+    int i, count;
+
+    lastsweep = laststats = time(NULL);
+    while (1) {
+	/* wake up at least once a second to expire peers */
+	count = Worker_Wait(w, ready, BATCH, 1000);
+	now = time(NULL);
+	for (i = 0; i < count; i++) {
+	    if (!ready[i])
+		ForwardFromClients(w, now);
+	    else
+		ForwardToClient(w, ready[i], now);
+	}
+	FlushReplies(w);
+
+	if (now != lastsweep) {
+	    ExpirePeers(w, now);
+	    lastsweep = now;
+	}
+	if (stats_interval && now - laststats >= stats_interval) {
+	    PrintStats(w, (int)(now - laststats));
+	    laststats = now;
+	}
+    }
+
+    return NULL;
+}
+
+static worker_t *
+Worker_Create(int num)
+{
+    struct sockaddr_in address;
+    worker_t *w;
+    int _true = 1;
+
+    w = calloc(1, sizeof(*w));
+    if (!w) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    w->num = num;
+
+    if ((w->s = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
 	perror("socket");
-	return 1;
+	exit(1);
+    }
+#ifdef SO_REUSEPORT
+    if (numworkers > 1
+	&& setsockopt(w->s, SOL_SOCKET, SO_REUSEPORT, (void *)&_true,
+		      sizeof(_true)) == -1) {
+	perror("SO_REUSEPORT");
+	exit(1);
+    }
+#endif
+    if (SetNonBlocking(w->s) < 0) {
+	perror("non-blocking");
+	exit(1);
     }
 
+    memset(&address, 0, sizeof(address));
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons((unsigned short)atoi(argv[1]));
-    if (bind(s, (void *)&address, sizeof(address)) == -1)
+    address.sin_port = htons((unsigned short)host_port);
+    if (bind(w->s, (void *)&address, sizeof(address)) == -1) {
 	perror("bind");
+	exit(1);
+    }
 
-    while (1) {
-	FD_ZERO(&rfds);
-	FD_SET(s, &rfds);
-	i1 = s;
-	for (p = peers; p; p = p->next) {
-	    FD_SET(p->s, &rfds);
-	    if (p->s >= i1)
-		i1 = p->s + 1;
-	}
-	/* Wait up to two minutes. */
-	tv.tv_sec = 2;
-	tv.tv_usec = 0;
-	retval = select(i1, &rfds, (fd_set *)0, (fd_set *)0, &tv);
-	if (retval > 0) {
-	    if (FD_ISSET(s, &rfds)) {
-		alen = sizeof(fsin);
-		i1 = recvfrom(s, buffer, 4096, 0, (struct sockaddr *)&fsin,
-			      &alen);
-		if (i1 > 0) {
-		    for (p = peers; p; p = p->next)
-			if (memcmp
-			    (&p->sin.sin_addr, &fsin.sin_addr,
-			     sizeof(p->sin.sin_addr)) == 0
-			    && memcmp(&p->sin.sin_port, &fsin.sin_port,
-				      sizeof(p->sin.sin_port)) == 0) {
-			    send(p->s, buffer, i1, 0);
-			    time(&p->last);
-			    break;
-			}
-		    if (p == NULL) {	// new peer
-			printf("peer %s:%d added", inet_ntoa(fsin.sin_addr),
-			       (int)ntohs(fsin.sin_port));
-			p = malloc(sizeof *p);
-			p->sin = fsin;
-			p->s = connectsock(argv[2], argv[3], "udp");
-			p->next = peers;
-			peers = p;
-			send(p->s, buffer, i1, 0);
-			time(&p->last);
-		    }
-		}
-	    }
-	    for (p = peers; p; p = p->next)
-		if (FD_ISSET(p->s, &rfds)) {
-		    i1 = recv(p->s, buffer, 4096, 0);
-		    if (i1 > 0) {
-			time(&p->last);
-			sendto(s, buffer, i1, 0, (struct sockaddr *)&p->sin,
-			       sizeof(p->sin));
-		    }
-		}
-	} else {
-	    peer_t *pp;
-
-	    pp = NULL;
-	    p = peers;
-	    while (p) {
-		if (time(NULL) - p->last > 300) {
-		    if (!pp && !p->next) {
-			printf("peer %s:%d removed (timeout)",
-			       inet_ntoa(p->sin.sin_addr),
-			       (int)ntohs(p->sin.sin_port));
-			free(p);
-			p = pp = NULL;
-			continue;
-		    }
-		    pp->next = p->next;
-		    printf("peer %s:%d removed (timeout)",
-			   inet_ntoa(p->sin.sin_addr),
-			   (int)ntohs(p->sin.sin_port));
-		    free(p);
-		    p = pp->next;
-		} else {
-		    pp = p;
-		    p = p->next;
-		}
-	    }
+    Worker_InitPoll(w);
+
+    return w;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int i;
+
+    if (argc < 4) {
+	printf("Usage:  %s <port> <remote server> <remote server port>"
+	       " [-threads n] [-timeout secs] [-stats secs]\n", argv[0]);
+	return 1;
+    }
+
+    for (i = 4; i < argc - 1; i += 2) {
+	if (!strcmp(argv[i], "-threads"))
+	    numworkers = atoi(argv[i + 1]);
+	else if (!strcmp(argv[i], "-timeout"))
+	    peer_timeout = atoi(argv[i + 1]);
+	else if (!strcmp(argv[i], "-stats"))
+	    stats_interval = atoi(argv[i + 1]);
+	else
+	    break;
+    }
+    if (i != argc) {
+	fprintf(stderr, "Unknown option %s\n", argv[i]);
+	return 1;
+    }
+#if defined(_WIN32) || !defined(SO_REUSEPORT)
+    numworkers = 1;
+#endif
+    if (numworkers < 1)
+	numworkers = 1;
+    if (numworkers > MAX_WORKERS)
+	numworkers = MAX_WORKERS;
+
+    NET_Init();
+#ifdef SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    host_port = atoi(argv[1]);
+    ResolveRemote(argv[2], argv[3]);
+
+    for (i = 0; i < numworkers; i++)
+	workers[i] = Worker_Create(i);
+
+#ifndef _WIN32
+    for (i = 1; i < numworkers; i++) {
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, Worker_Run, workers[i])) {
+	    fprintf(stderr, "Couldn't start worker %d\n", i);
+	    return 1;
 	}
     }
+#endif
+    Worker_Run(workers[0]);
+
+    return 0;
 }
@@ -0,0 +1,1442 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+/*
+ * qwload - plays a server with many synthetic clients to find its capacity
+ *
+ * syntax:
+ *
+ * qwload [-clients n] [-step n] [-steptime secs] [-fps n] [-rate bytes]
+ *        [-demo file.qwd] [-mapcheck n] [-maxping ms] [-maxloss percent]
+ *        [-maxchoke percent] host[:port] ...
+ *
+ * Every -steptime seconds another -step clients connect, dealt out across
+ * the servers given, up to -clients in all. Each one goes through the
+ * signon like a real client and then sends -fps moves a second with the
+ * userinfo rate set to -rate. The moves wander about at random, or are
+ * replayed from the dem_cmd blocks of a client demo, each client starting
+ * at a different point in it.
+ *
+ * At the end of each step it prints a line for the clients in the game:
+ * the median and 95th percentile of the round trip from a move to the
+ * first packet acknowledging it, packet loss and choke, what each client
+ * took in, and the 95th percentile gap between packets, which grows when
+ * the server falls behind. A step is over the limit when any of those
+ * is past its -max or clients failed to get in. Once all the clients are
+ * in and measured it reports the most players per server that stayed
+ * inside the limits.
+ *
+ * The servers should run with sv_mapcheck 0, or be given the map's
+ * checksum with -mapcheck, as the clients don't have the maps.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define poll WSAPoll
+#define close closesocket
+typedef int socklen_t;
+#else
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#define MAX_BOTS	1024
+#define MAX_SERVERS	64
+#define MAX_MSGLEN	1450	/* biggest packet a server sends */
+#define MAX_RELIABLE	512	/* only string commands go reliably */
+#define UPDATE_BACKUP	64	/* the moves are kept this far back */
+#define UPDATE_MASK	(UPDATE_BACKUP - 1)
+#define RESEND_TIME	1.0	/* between connection attempts */
+#define MAX_TRIES	10
+#define TIMEOUT		10.0	/* without a packet from the server */
+#define MAX_SAMPLES	262144	/* pings or gaps per step */
+
+#define PROTOCOL_VERSION 28
+#define PORT_SERVER	27500
+
+/* See the client's protocol.h */
+#define S2C_CHALLENGE	'c'
+#define S2C_CONNECTION	'j'
+#define A2C_PRINT	'n'
+
+#define svc_nop			1
+#define svc_disconnect		2
+#define svc_updatestat		3
+#define svc_sound		6
+#define svc_print		8
+#define svc_stufftext		9
+#define svc_setangle		10
+#define svc_serverdata		11
+#define svc_lightstyle		12
+#define svc_updatefrags		14
+#define svc_stopsound		16
+#define svc_damage		19
+#define svc_spawnstatic		20
+#define svc_spawnbaseline	22
+#define svc_temp_entity		23
+#define svc_setpause		24
+#define svc_centerprint		26
+#define svc_killedmonster	27
+#define svc_foundsecret		28
+#define svc_spawnstaticsound	29
+#define svc_intermission	30
+#define svc_finale		31
+#define svc_cdtrack		32
+#define svc_sellscreen		33
+#define svc_smallkick		34
+#define svc_bigkick		35
+#define svc_updateping		36
+#define svc_updateentertime	37
+#define svc_updatestatlong	38
+#define svc_muzzleflash		39
+#define svc_updateuserinfo	40
+#define svc_download		41
+#define svc_playerinfo		42
+#define svc_nails		43
+#define svc_chokecount		44
+#define svc_modellist		45
+#define svc_soundlist		46
+#define svc_packetentities	47
+#define svc_deltapacketentities	48
+#define svc_maxspeed		49
+#define svc_entgravity		50
+#define svc_setinfo		51
+#define svc_serverinfo		52
+#define svc_updatepl		53
+#define svc_projectiles		54
+#define svc_downloadchunk	55
+
+#define clc_move		3
+#define clc_stringcmd		4
+#define clc_delta		5
+
+#define PF_MSEC		(1 << 0)
+#define PF_COMMAND	(1 << 1)
+#define PF_VELOCITY1	(1 << 2)
+#define PF_MODEL	(1 << 5)
+#define PF_SKINNUM	(1 << 6)
+#define PF_EFFECTS	(1 << 7)
+#define PF_WEAPONFRAME	(1 << 8)
+
+#define CM_ANGLE1	(1 << 0)
+#define CM_ANGLE3	(1 << 1)
+#define CM_FORWARD	(1 << 2)
+#define CM_SIDE		(1 << 3)
+#define CM_UP		(1 << 4)
+#define CM_BUTTONS	(1 << 5)
+#define CM_IMPULSE	(1 << 6)
+#define CM_ANGLE2	(1 << 7)
+
+#define U_ORIGIN1	(1 << 9)
+#define U_ORIGIN2	(1 << 10)
+#define U_ORIGIN3	(1 << 11)
+#define U_ANGLE2	(1 << 12)
+#define U_FRAME		(1 << 13)
+#define U_REMOVE	(1 << 14)
+#define U_MOREBITS	(1 << 15)
+#define U_ANGLE1	(1 << 0)
+#define U_ANGLE3	(1 << 1)
+#define U_MODEL		(1 << 2)
+#define U_COLORMAP	(1 << 3)
+#define U_SKIN		(1 << 4)
+#define U_EFFECTS	(1 << 5)
+
+#define SND_VOLUME	(1 << 15)
+#define SND_ATTENUATION	(1 << 14)
+
+#define TE_GUNSHOT	2
+#define TE_LIGHTNING1	5
+#define TE_LIGHTNING2	6
+#define TE_LIGHTNING3	9
+#define TE_BLOOD	12
+#define TE_LIGHTNINGBLOOD 13
+
+#define dem_cmd		0
+#define dem_read	1
+#define dem_set		2
+
+typedef struct {
+    unsigned char msec;
+    float angles[3];
+    short forwardmove, sidemove, upmove;
+    unsigned char buttons;
+    unsigned char impulse;
+} usercmd_t;
+
+typedef enum {
+    BOT_CHALLENGE,		/* asking for a challenge */
+    BOT_CONNECT,		/* sent the connect */
+    BOT_SIGNON,			/* connected, working through the signon */
+    BOT_ACTIVE,			/* in the game */
+    BOT_GONE,			/* refused, dropped or timed out */
+} botstate_t;
+
+typedef struct {
+    int s;
+    int server;
+    botstate_t state;
+    double nextsend;		/* the next move, or connection attempt */
+    double lastrecv;
+    int tries;
+    int qport;
+    int challenge;
+    int servercount;
+
+    /* the netchan, see QW/common/net_chan.c */
+    unsigned outgoing;
+    unsigned incoming;
+    unsigned incoming_acknowledged;
+    int incoming_reliable_acknowledged;
+    int incoming_reliable_sequence;
+    int reliable_sequence;
+    unsigned last_reliable;
+    unsigned char reliable[MAX_RELIABLE];
+    int reliablelen;
+    unsigned char message[MAX_RELIABLE];
+    int messagelen;
+
+    unsigned validsequence;	/* has packet entities to delta from */
+    double senttime[UPDATE_BACKUP];
+    usercmd_t cmds[UPDATE_BACKUP];
+
+    /* making up the moves */
+    unsigned random;
+    float yaw, turn;
+    int democmd;
+} bot_t;
+
+static struct sockaddr_in servers[MAX_SERVERS];
+static int numservers;
+
+static int maxbots = 32;
+static int stepbots = 4;
+static double steptime = 10;
+static int fps = 72;
+static int rate = 10000;
+static int mapcheck;
+static double maxping = 200;
+static double maxloss = 1;
+static double maxchoke = 5;
+
+static bot_t bots[MAX_BOTS];
+static int numbots;
+
+static usercmd_t *democmds;
+static int numdemocmds;
+
+/* Measured over the current step, for the clients in the game */
+static float pings[MAX_SAMPLES];
+static int numpings;
+static float gaps[MAX_SAMPLES];
+static int numgaps;
+static long received, dropped, choked, bytesin;
+static int refused;
+
+static volatile int quitting;
+
+static const unsigned char chktbl[1024 + 4] = {
+    0x78, 0xd2, 0x94, 0xe3, 0x41, 0xec, 0xd6, 0xd5, 0xcb, 0xfc, 0xdb, 0x8a, 0x4b, 0xcc, 0x85, 0x01,
+    0x23, 0xd2, 0xe5, 0xf2, 0x29, 0xa7, 0x45, 0x94, 0x4a, 0x62, 0xe3, 0xa5, 0x6f, 0x3f, 0xe1, 0x7a,
+    0x64, 0xed, 0x5c, 0x99, 0x29, 0x87, 0xa8, 0x78, 0x59, 0x0d, 0xaa, 0x0f, 0x25, 0x0a, 0x5c, 0x58,
+    0xfb, 0x00, 0xa7, 0xa8, 0x8a, 0x1d, 0x86, 0x80, 0xc5, 0x1f, 0xd2, 0x28, 0x69, 0x71, 0x58, 0xc3,
+    0x51, 0x90, 0xe1, 0xf8, 0x6a, 0xf3, 0x8f, 0xb0, 0x68, 0xdf, 0x95, 0x40, 0x5c, 0xe4, 0x24, 0x6b,
+    0x29, 0x19, 0x71, 0x3f, 0x42, 0x63, 0x6c, 0x48, 0xe7, 0xad, 0xa8, 0x4b, 0x91, 0x8f, 0x42, 0x36,
+    0x34, 0xe7, 0x32, 0x55, 0x59, 0x2d, 0x36, 0x38, 0x38, 0x59, 0x9b, 0x08, 0x16, 0x4d, 0x8d, 0xf8,
+    0x0a, 0xa4, 0x52, 0x01, 0xbb, 0x52, 0xa9, 0xfd, 0x40, 0x18, 0x97, 0x37, 0xff, 0xc9, 0x82, 0x27,
+    0xb2, 0x64, 0x60, 0xce, 0x00, 0xd9, 0x04, 0xf0, 0x9e, 0x99, 0xbd, 0xce, 0x8f, 0x90, 0x4a, 0xdd,
+    0xe1, 0xec, 0x19, 0x14, 0xb1, 0xfb, 0xca, 0x1e, 0x98, 0x0f, 0xd4, 0xcb, 0x80, 0xd6, 0x05, 0x63,
+    0xfd, 0xa0, 0x74, 0xa6, 0x86, 0xf6, 0x19, 0x98, 0x76, 0x27, 0x68, 0xf7, 0xe9, 0x09, 0x9a, 0xf2,
+    0x2e, 0x42, 0xe1, 0xbe, 0x64, 0x48, 0x2a, 0x74, 0x30, 0xbb, 0x07, 0xcc, 0x1f, 0xd4, 0x91, 0x9d,
+    0xac, 0x55, 0x53, 0x25, 0xb9, 0x64, 0xf7, 0x58, 0x4c, 0x34, 0x16, 0xbc, 0xf6, 0x12, 0x2b, 0x65,
+    0x68, 0x25, 0x2e, 0x29, 0x1f, 0xbb, 0xb9, 0xee, 0x6d, 0x0c, 0x8e, 0xbb, 0xd2, 0x5f, 0x1d, 0x8f,
+    0xc1, 0x39, 0xf9, 0x8d, 0xc0, 0x39, 0x75, 0xcf, 0x25, 0x17, 0xbe, 0x96, 0xaf, 0x98, 0x9f, 0x5f,
+    0x65, 0x15, 0xc4, 0x62, 0xf8, 0x55, 0xfc, 0xab, 0x54, 0xcf, 0xdc, 0x14, 0x06, 0xc8, 0xfc, 0x42,
+    0xd3, 0xf0, 0xad, 0x10, 0x08, 0xcd, 0xd4, 0x11, 0xbb, 0xca, 0x67, 0xc6, 0x48, 0x5f, 0x9d, 0x59,
+    0xe3, 0xe8, 0x53, 0x67, 0x27, 0x2d, 0x34, 0x9e, 0x9e, 0x24, 0x29, 0xdb, 0x69, 0x99, 0x86, 0xf9,
+    0x20, 0xb5, 0xbb, 0x5b, 0xb0, 0xf9, 0xc3, 0x67, 0xad, 0x1c, 0x9c, 0xf7, 0xcc, 0xef, 0xce, 0x69,
+    0xe0, 0x26, 0x8f, 0x79, 0xbd, 0xca, 0x10, 0x17, 0xda, 0xa9, 0x88, 0x57, 0x9b, 0x15, 0x24, 0xba,
+    0x84, 0xd0, 0xeb, 0x4d, 0x14, 0xf5, 0xfc, 0xe6, 0x51, 0x6c, 0x6f, 0x64, 0x6b, 0x73, 0xec, 0x85,
+    0xf1, 0x6f, 0xe1, 0x67, 0x25, 0x10, 0x77, 0x32, 0x9e, 0x85, 0x6e, 0x69, 0xb1, 0x83, 0x00, 0xe4,
+    0x13, 0xa4, 0x45, 0x34, 0x3b, 0x40, 0xff, 0x41, 0x82, 0x89, 0x79, 0x57, 0xfd, 0xd2, 0x8e, 0xe8,
+    0xfc, 0x1d, 0x19, 0x21, 0x12, 0x00, 0xd7, 0x66, 0xe5, 0xc7, 0x10, 0x1d, 0xcb, 0x75, 0xe8, 0xfa,
+    0xb6, 0xee, 0x7b, 0x2f, 0x1a, 0x25, 0x24, 0xb9, 0x9f, 0x1d, 0x78, 0xfb, 0x84, 0xd0, 0x17, 0x05,
+    0x71, 0xb3, 0xc8, 0x18, 0xff, 0x62, 0xee, 0xed, 0x53, 0xab, 0x78, 0xd3, 0x65, 0x2d, 0xbb, 0xc7,
+    0xc1, 0xe7, 0x70, 0xa2, 0x43, 0x2c, 0x7c, 0xc7, 0x16, 0x04, 0xd2, 0x45, 0xd5, 0x6b, 0x6c, 0x7a,
+    0x5e, 0xa1, 0x50, 0x2e, 0x31, 0x5b, 0xcc, 0xe8, 0x65, 0x8b, 0x16, 0x85, 0xbf, 0x82, 0x83, 0xfb,
+    0xde, 0x9f, 0x36, 0x48, 0x32, 0x79, 0xd6, 0x9b, 0xfb, 0x52, 0x45, 0xbf, 0x43, 0xf7, 0x0b, 0x0b,
+    0x19, 0x19, 0x31, 0xc3, 0x85, 0xec, 0x1d, 0x8c, 0x20, 0xf0, 0x3a, 0xfa, 0x80, 0x4d, 0x2c, 0x7d,
+    0xac, 0x60, 0x09, 0xc0, 0x40, 0xee, 0xb9, 0xeb, 0x13, 0x5b, 0xe8, 0x2b, 0xb1, 0x20, 0xf0, 0xce,
+    0x4c, 0xbd, 0xc6, 0x04, 0x86, 0x70, 0xc6, 0x33, 0xc3, 0x15, 0x0f, 0x65, 0x19, 0xfd, 0xc2, 0xd3,
+
+// map checksum goes here
+    0x00, 0x00, 0x00, 0x00
+};
+
+static double
+Sys_DoubleTime(void)
+{
+#ifdef _WIN32
+    return GetTickCount() / 1000.0;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
+/*
+====================
+NET_Init
+====================
+*/
+static void
+NET_Init(void)
+{
+#ifdef _WIN32
+    static WSADATA winsockdata;
+
+    if (WSAStartup(MAKEWORD(2, 1), &winsockdata)) {
+	fprintf(stderr, "Winsock initialization failed.");
+	exit(1);
+    }
+#endif
+}
+
+static int
+SetNonBlocking(int s)
+{
+#ifdef _WIN32
+    u_long _true = 1;
+
+    return ioctlsocket(s, FIONBIO, &_true);
+#else
+    return fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+#endif
+}
+
+static int
+ParseAddress(const char *name, struct sockaddr_in *adr)
+{
+    char host[256];
+    struct hostent *h;
+    const char *colon;
+    int port = PORT_SERVER;
+
+    snprintf(host, sizeof(host), "%s", name);
+    colon = strchr(name, ':');
+    if (colon && colon - name < (int)sizeof(host)) {
+	host[colon - name] = 0;
+	port = atoi(colon + 1);
+    }
+
+    memset(adr, 0, sizeof(*adr));
+    adr->sin_family = AF_INET;
+    adr->sin_port = htons((unsigned short)port);
+    adr->sin_addr.s_addr = inet_addr(host);
+    if (adr->sin_addr.s_addr == INADDR_NONE) {
+	h = gethostbyname(host);
+	if (!h)
+	    return 0;
+	memcpy(&adr->sin_addr, h->h_addr_list[0], sizeof(adr->sin_addr));
+    }
+
+    return 1;
+}
+
+/*
+ * CRC_Block and COM_BlockSequenceCRCByte, which the server checks each
+ * move against
+ */
+static unsigned short
+CRC_Block(const unsigned char *data, int length)
+{
+    unsigned short crc = 0xffff;
+    int i;
+
+    while (length--) {
+	crc ^= *data++ << 8;
+	for (i = 0; i < 8; i++)
+	    crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    return crc;
+}
+
+static unsigned char
+SequenceCRCByte(const unsigned char *base, int length, int sequence)
+{
+    unsigned char chkb[60 + 4];
+    const unsigned char *p = chktbl + (sequence % (sizeof(chktbl) - 8));
+
+    if (length > 60)
+	length = 60;
+    memcpy(chkb, base, length);
+
+    chkb[length] = (sequence & 0xff) ^ p[0];
+    chkb[length + 1] = p[1];
+    chkb[length + 2] = ((sequence >> 8) & 0xff) ^ p[2];
+    chkb[length + 3] = p[3];
+
+    return CRC_Block(chkb, length + 4) & 0xff;
+}
+
+static float
+LittleFloatAt(const unsigned char *p)
+{
+    union {
+	unsigned u;
+	float f;
+    } v;
+
+    v.u = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+    return v.f;
+}
+
+static int
+SortFloats(const void *a, const void *b)
+{
+    float fa = *(const float *)a, fb = *(const float *)b;
+
+    return fa < fb ? -1 : fa > fb;
+}
+
+/* The value a fraction of the way up the samples, sorting them */
+static double
+Percentile(float *samples, int count, double fraction)
+{
+    if (!count)
+	return 0;
+    qsort(samples, count, sizeof(*samples), SortFloats);
+    return samples[(int)((count - 1) * fraction)];
+}
+
+/*
+===============================================================================
+
+				MESSAGES
+
+===============================================================================
+*/
+
+typedef struct {
+    const unsigned char *data;
+    int length;
+    int pos;
+    int bad;			/* read past the end */
+} msg_t;
+
+typedef struct {
+    unsigned char *data;
+    int maxsize;
+    int cursize;
+} buf_t;
+
+static int
+ReadByte(msg_t *msg)
+{
+    if (msg->pos + 1 > msg->length) {
+	msg->bad = 1;
+	return -1;
+    }
+    return msg->data[msg->pos++];
+}
+
+static int
+ReadShort(msg_t *msg)
+{
+    int c;
+
+    if (msg->pos + 2 > msg->length) {
+	msg->bad = 1;
+	return -1;
+    }
+    c = (short)(msg->data[msg->pos] | (msg->data[msg->pos + 1] << 8));
+    msg->pos += 2;
+
+    return c;
+}
+
+static int
+ReadLong(msg_t *msg)
+{
+    const unsigned char *p = msg->data + msg->pos;
+
+    if (msg->pos + 4 > msg->length) {
+	msg->bad = 1;
+	return -1;
+    }
+    msg->pos += 4;
+
+    return (int)(p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24));
+}
+
+static const char *
+ReadString(msg_t *msg)
+{
+    static char string[2048];
+    int c, len = 0;
+
+    while ((c = ReadByte(msg)) > 0)
+	if (len < (int)sizeof(string) - 1)
+	    string[len++] = c;
+    string[len] = 0;
+
+    return string;
+}
+
+static void
+Skip(msg_t *msg, int count)
+{
+    if (count < 0 || msg->pos + count > msg->length) {
+	msg->bad = 1;
+	return;
+    }
+    msg->pos += count;
+}
+
+static void
+WriteByte(buf_t *buf, int c)
+{
+    if (buf->cursize < buf->maxsize)
+	buf->data[buf->cursize++] = c;
+}
+
+static void
+WriteShort(buf_t *buf, int c)
+{
+    WriteByte(buf, c & 0xff);
+    WriteByte(buf, (c >> 8) & 0xff);
+}
+
+static void
+WriteLong(buf_t *buf, unsigned c)
+{
+    WriteShort(buf, c & 0xffff);
+    WriteShort(buf, c >> 16);
+}
+
+static void
+WriteAngle16(buf_t *buf, float f)
+{
+    WriteShort(buf, (int)(f * 65536 / 360) & 65535);
+}
+
+static void
+WriteDeltaUsercmd(buf_t *buf, const usercmd_t *from, const usercmd_t *cmd)
+{
+    int bits = 0;
+
+    if (cmd->angles[0] != from->angles[0])
+	bits |= CM_ANGLE1;
+    if (cmd->angles[1] != from->angles[1])
+	bits |= CM_ANGLE2;
+    if (cmd->angles[2] != from->angles[2])
+	bits |= CM_ANGLE3;
+    if (cmd->forwardmove != from->forwardmove)
+	bits |= CM_FORWARD;
+    if (cmd->sidemove != from->sidemove)
+	bits |= CM_SIDE;
+    if (cmd->upmove != from->upmove)
+	bits |= CM_UP;
+    if (cmd->buttons != from->buttons)
+	bits |= CM_BUTTONS;
+    if (cmd->impulse != from->impulse)
+	bits |= CM_IMPULSE;
+
+    WriteByte(buf, bits);
+    if (bits & CM_ANGLE1)
+	WriteAngle16(buf, cmd->angles[0]);
+    if (bits & CM_ANGLE2)
+	WriteAngle16(buf, cmd->angles[1]);
+    if (bits & CM_ANGLE3)
+	WriteAngle16(buf, cmd->angles[2]);
+    if (bits & CM_FORWARD)
+	WriteShort(buf, cmd->forwardmove);
+    if (bits & CM_SIDE)
+	WriteShort(buf, cmd->sidemove);
+    if (bits & CM_UP)
+	WriteShort(buf, cmd->upmove);
+    if (bits & CM_BUTTONS)
+	WriteByte(buf, cmd->buttons);
+    if (bits & CM_IMPULSE)
+	WriteByte(buf, cmd->impulse);
+    WriteByte(buf, cmd->msec);
+}
+
+/*
+===============================================================================
+
+				THE CLIENTS
+
+===============================================================================
+*/
+
+static void
+SendPacket(bot_t *bot, const void *data, int length)
+{
+    sendto(bot->s, data, length, 0, (struct sockaddr *)&servers[bot->server],
+	   sizeof(servers[bot->server]));
+}
+
+static void
+SendOutOfBand(bot_t *bot, const char *text)
+{
+    char packet[MAX_RELIABLE + 4];
+    int length;
+
+    length = snprintf(packet, sizeof(packet), "\xff\xff\xff\xff%s", text);
+    if (length >= (int)sizeof(packet))
+	length = sizeof(packet) - 1;
+    SendPacket(bot, packet, length);
+}
+
+static void
+SendConnect(bot_t *bot)
+{
+    char text[MAX_RELIABLE];
+
+    if (bot->state == BOT_CHALLENGE) {
+	SendOutOfBand(bot, "getchallenge\n");
+	return;
+    }
+    snprintf(text, sizeof(text), "connect %d %d %d "
+	     "\"\\name\\load%d\\rate\\%d\\topcolor\\%d\\bottomcolor\\%d"
+	     "\\msg\\1\\noaim\\1\\spectator\\0\"\n", PROTOCOL_VERSION,
+	     bot->qport, bot->challenge, (int)(bot - bots), rate,
+	     (int)(bot - bots) % 14, (int)(bot - bots) / 14 % 14);
+    SendOutOfBand(bot, text);
+}
+
+static void
+Drop(bot_t *bot, const char *reason)
+{
+    if (bot->state != BOT_ACTIVE)
+	refused++;
+    bot->state = BOT_GONE;
+    if (reason)
+	printf("load%d: %s\n", (int)(bot - bots), reason);
+}
+
+/* Queues a string command to go reliably */
+static void
+StringCmd(bot_t *bot, const char *text)
+{
+    int length = strlen(text) + 1;
+
+    if (bot->messagelen + 1 + length > MAX_RELIABLE) {
+	Drop(bot, "reliable message overflow");
+	return;
+    }
+    bot->message[bot->messagelen++] = clc_stringcmd;
+    memcpy(bot->message + bot->messagelen, text, length);
+    bot->messagelen += length;
+}
+
+/*
+ * Netchan_Transmit: the reliable part goes first, resent until the server
+ * acknowledges it, then the unreliable data
+ */
+static void
+Transmit(bot_t *bot, const unsigned char *data, int length, double now)
+{
+    unsigned char packet[MAX_MSGLEN];
+    buf_t send = { packet, sizeof(packet), 0 };
+    int send_reliable;
+
+    send_reliable = bot->incoming_acknowledged > bot->last_reliable
+	&& bot->incoming_reliable_acknowledged != bot->reliable_sequence;
+    if (!bot->reliablelen && bot->messagelen) {
+	memcpy(bot->reliable, bot->message, bot->messagelen);
+	bot->reliablelen = bot->messagelen;
+	bot->messagelen = 0;
+	bot->reliable_sequence ^= 1;
+	send_reliable = 1;
+    }
+
+    WriteLong(&send, bot->outgoing | ((unsigned)send_reliable << 31));
+    WriteLong(&send, bot->incoming
+	      | ((unsigned)bot->incoming_reliable_sequence << 31));
+    WriteShort(&send, bot->qport);
+    bot->senttime[bot->outgoing & UPDATE_MASK] = now;
+    bot->outgoing++;
+
+    if (send_reliable) {
+	memcpy(packet + send.cursize, bot->reliable, bot->reliablelen);
+	send.cursize += bot->reliablelen;
+	bot->last_reliable = bot->outgoing;
+    }
+    if (send.maxsize - send.cursize >= length) {
+	memcpy(packet + send.cursize, data, length);
+	send.cursize += length;
+    }
+
+    SendPacket(bot, packet, send.cursize);
+}
+
+/* The next move, made up or from the demo */
+static void
+NextCmd(bot_t *bot, usercmd_t *cmd, double frametime)
+{
+    if (numdemocmds) {
+	*cmd = democmds[bot->democmd];
+	bot->democmd = (bot->democmd + 1) % numdemocmds;
+    } else {
+	/* wander: run about, turning now and then, jumping and firing */
+	bot->random = bot->random * 1103515245 + 12345;
+	if ((bot->random >> 16) % 100 < 2)
+	    bot->turn = (float)((int)((bot->random >> 8) % 361) - 180);
+	bot->yaw += bot->turn * frametime;
+	bot->yaw -= 360 * floor(bot->yaw / 360);
+
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->angles[1] = bot->yaw;
+	cmd->forwardmove = 400;
+	cmd->sidemove = (bot->random >> 20) & 1 ? 350 : -350;
+	if ((bot->random >> 12) % 100 < 5)
+	    cmd->buttons |= 2;
+	if ((bot->random >> 4) % 100 < 20)
+	    cmd->buttons |= 1;
+    }
+    cmd->msec = frametime * 1000 > 250 ? 250 : frametime * 1000;
+}
+
+/* CL_SendCmd: the move along with the two before it */
+static void
+SendMove(bot_t *bot, double now)
+{
+    static const usercmd_t nullcmd;
+    unsigned char data[128];
+    buf_t buf = { data, sizeof(data), 0 };
+    int checksumindex;
+    unsigned seq = bot->outgoing;	/* the packet's sequence */
+
+    NextCmd(bot, &bot->cmds[seq & UPDATE_MASK], 1.0 / fps);
+
+    WriteByte(&buf, clc_move);
+    checksumindex = buf.cursize;
+    WriteByte(&buf, 0);
+    WriteByte(&buf, 0);		/* lossage */
+    WriteDeltaUsercmd(&buf, &nullcmd, &bot->cmds[(seq - 2) & UPDATE_MASK]);
+    WriteDeltaUsercmd(&buf, &bot->cmds[(seq - 2) & UPDATE_MASK],
+		      &bot->cmds[(seq - 1) & UPDATE_MASK]);
+    WriteDeltaUsercmd(&buf, &bot->cmds[(seq - 1) & UPDATE_MASK],
+		      &bot->cmds[seq & UPDATE_MASK]);
+    data[checksumindex] = SequenceCRCByte(data + checksumindex + 1,
+					  buf.cursize - checksumindex - 1, seq);
+
+    if (bot->validsequence && seq - bot->validsequence >= UPDATE_BACKUP - 1)
+	bot->validsequence = 0;
+    if (bot->validsequence && bot->state == BOT_ACTIVE) {
+	WriteByte(&buf, clc_delta);
+	WriteByte(&buf, bot->validsequence & 255);
+    }
+
+    Transmit(bot, data, buf.cursize, now);
+}
+
+/* Runs the commands the server stuffs, as far as the signon needs */
+static void
+StuffText(bot_t *bot, const char *text)
+{
+    char line[MAX_RELIABLE], begin[32];
+    const char *end;
+    int length;
+
+    while (*text) {
+	end = strchr(text, '\n');
+	length = end ? end - text : (int)strlen(text);
+	if (length >= (int)sizeof(line))
+	    length = sizeof(line) - 1;
+	memcpy(line, text, length);
+	line[length] = 0;
+	text += end ? end - text + 1 : length;
+
+	if (!strncmp(line, "cmd ", 4) && strncmp(line + 4, "snap", 4))
+	    StringCmd(bot, line + 4);
+	else if (!strcmp(line, "skins")) {
+	    snprintf(begin, sizeof(begin), "begin %d", bot->servercount);
+	    StringCmd(bot, begin);
+	    bot->state = BOT_ACTIVE;
+	} else if (!strcmp(line, "reconnect")) {
+	    bot->state = BOT_SIGNON;
+	    StringCmd(bot, "new");
+	} else if (!strcmp(line, "changing"))
+	    bot->state = BOT_SIGNON;
+    }
+}
+
+/* Asks for the next part of a list, or moves on to the next stage */
+static void
+ParseList(bot_t *bot, msg_t *msg, const char *list, const char *next)
+{
+    char cmd[64];
+    int n;
+
+    ReadByte(msg);
+    while (ReadString(msg)[0] && !msg->bad)
+	;
+    n = ReadByte(msg);
+    if (n > 0)
+	snprintf(cmd, sizeof(cmd), "%s %d %d", list, bot->servercount, n);
+    else if (!strcmp(next, "prespawn"))
+	snprintf(cmd, sizeof(cmd), "prespawn %d 0 %d", bot->servercount,
+		 mapcheck);
+    else
+	snprintf(cmd, sizeof(cmd), "%s %d 0", next, bot->servercount);
+    StringCmd(bot, cmd);
+}
+
+static void
+SkipPacketEntities(msg_t *msg)
+{
+    int word, bits;
+
+    while (!msg->bad) {
+	word = ReadShort(msg) & 0xffff;
+	if (!word || msg->bad)
+	    break;
+	if (word & U_REMOVE)
+	    continue;
+	bits = word & ~511;
+	if (bits & U_MOREBITS)
+	    bits |= ReadByte(msg);
+	Skip(msg, !!(bits & U_MODEL) + !!(bits & U_FRAME)
+	     + !!(bits & U_COLORMAP) + !!(bits & U_SKIN)
+	     + !!(bits & U_EFFECTS) + !!(bits & U_ANGLE1)
+	     + !!(bits & U_ANGLE2) + !!(bits & U_ANGLE3)
+	     + 2 * (!!(bits & U_ORIGIN1) + !!(bits & U_ORIGIN2)
+		    + !!(bits & U_ORIGIN3)));
+    }
+}
+
+static void
+SkipPlayerinfo(msg_t *msg)
+{
+    int flags, bits, i;
+
+    ReadByte(msg);
+    flags = ReadShort(msg);
+    Skip(msg, 6 + 1);		/* origin, frame */
+    if (flags & PF_MSEC)
+	ReadByte(msg);
+    if (flags & PF_COMMAND) {
+	bits = ReadByte(msg);
+	Skip(msg, 2 * (!!(bits & CM_ANGLE1) + !!(bits & CM_ANGLE2)
+		       + !!(bits & CM_ANGLE3) + !!(bits & CM_FORWARD)
+		       + !!(bits & CM_SIDE) + !!(bits & CM_UP))
+	     + !!(bits & CM_BUTTONS) + !!(bits & CM_IMPULSE) + 1);
+    }
+    for (i = 0; i < 3; i++)
+	if (flags & (PF_VELOCITY1 << i))
+	    Skip(msg, 2);
+    Skip(msg, !!(flags & PF_MODEL) + !!(flags & PF_SKINNUM)
+	 + !!(flags & PF_EFFECTS) + !!(flags & PF_WEAPONFRAME));
+}
+
+static void
+SkipTempEntity(msg_t *msg)
+{
+    switch (ReadByte(msg)) {
+    case TE_GUNSHOT:
+    case TE_BLOOD:
+	Skip(msg, 1 + 6);
+	break;
+    case TE_LIGHTNING1:
+    case TE_LIGHTNING2:
+    case TE_LIGHTNING3:
+	Skip(msg, 2 + 12);
+	break;
+    default:
+	Skip(msg, 6);
+	break;
+    }
+}
+
+/*
+ * CL_ParseServerMessage, keeping only what the signon and the measuring
+ * need. Returns 0 if the message doesn't make sense.
+ */
+static int
+ParseMessage(bot_t *bot, msg_t *msg)
+{
+    char text[64];
+    int cmd, i;
+
+    while (1) {
+	if (msg->bad)
+	    return 0;
+	cmd = ReadByte(msg);
+	if (cmd == -1)
+	    return 1;
+
+	switch (cmd) {
+	case svc_nop:
+	case svc_killedmonster:
+	case svc_foundsecret:
+	case svc_sellscreen:
+	case svc_smallkick:
+	case svc_bigkick:
+	    break;
+	case svc_disconnect:
+	    Drop(bot, "disconnected by the server");
+	    return 1;
+	case svc_print:
+	    ReadByte(msg);
+	    /* fall through */
+	case svc_centerprint:
+	case svc_finale:
+	    ReadString(msg);
+	    break;
+	case svc_stufftext:
+	    StuffText(bot, ReadString(msg));
+	    break;
+	case svc_serverdata:
+	    ReadLong(msg);	/* protocol */
+	    bot->servercount = ReadLong(msg);
+	    ReadString(msg);	/* gamedir */
+	    ReadByte(msg);	/* playernum */
+	    ReadString(msg);	/* levelname */
+	    Skip(msg, 10 * 4);	/* movevars */
+	    bot->state = BOT_SIGNON;
+	    bot->validsequence = 0;
+	    snprintf(text, sizeof(text), "soundlist %d 0", bot->servercount);
+	    StringCmd(bot, text);
+	    break;
+	case svc_soundlist:
+	    ParseList(bot, msg, "soundlist", "modellist");
+	    break;
+	case svc_modellist:
+	    ParseList(bot, msg, "modellist", "prespawn");
+	    break;
+	case svc_setangle:
+	    Skip(msg, 3);
+	    break;
+	case svc_lightstyle:
+	    ReadByte(msg);
+	    ReadString(msg);
+	    break;
+	case svc_sound:
+	    i = ReadShort(msg);
+	    Skip(msg, !!(i & SND_VOLUME) + !!(i & SND_ATTENUATION) + 1 + 6);
+	    break;
+	case svc_stopsound:
+	case svc_muzzleflash:
+	    Skip(msg, 2);
+	    break;
+	case svc_updatefrags:
+	case svc_updateping:
+	    Skip(msg, 3);
+	    break;
+	case svc_updatepl:
+	case svc_updatestat:
+	    Skip(msg, 2);
+	    break;
+	case svc_updateentertime:
+	case svc_updatestatlong:
+	    Skip(msg, 5);
+	    break;
+	case svc_damage:
+	    Skip(msg, 2 + 6);
+	    break;
+	case svc_spawnbaseline:
+	    Skip(msg, 2 + 13);
+	    break;
+	case svc_spawnstatic:
+	    Skip(msg, 13);
+	    break;
+	case svc_spawnstaticsound:
+	case svc_intermission:
+	    Skip(msg, 9);
+	    break;
+	case svc_temp_entity:
+	    SkipTempEntity(msg);
+	    break;
+	case svc_cdtrack:
+	case svc_setpause:
+	    Skip(msg, 1);
+	    break;
+	case svc_maxspeed:
+	case svc_entgravity:
+	    Skip(msg, 4);
+	    break;
+	case svc_updateuserinfo:
+	    Skip(msg, 5);
+	    ReadString(msg);
+	    break;
+	case svc_setinfo:
+	    ReadByte(msg);
+	    /* fall through */
+	case svc_serverinfo:
+	    ReadString(msg);
+	    ReadString(msg);
+	    break;
+	case svc_download:
+	    i = ReadShort(msg);
+	    ReadByte(msg);
+	    if (i > 0)
+		Skip(msg, i);
+	    break;
+	case svc_downloadchunk:
+	    Skip(msg, 9);
+	    Skip(msg, ReadShort(msg));
+	    break;
+	case svc_playerinfo:
+	    SkipPlayerinfo(msg);
+	    break;
+	case svc_nails:
+	    Skip(msg, 6 * ReadByte(msg));
+	    break;
+	case svc_projectiles:
+	    Skip(msg, 7 * ReadByte(msg));
+	    break;
+	case svc_chokecount:
+	    i = ReadByte(msg);
+	    if (bot->state == BOT_ACTIVE && i > 0)
+		choked += i;
+	    break;
+	case svc_packetentities:
+	case svc_deltapacketentities:
+	    if (cmd == svc_deltapacketentities)
+		ReadByte(msg);
+	    SkipPacketEntities(msg);
+	    bot->validsequence = bot->incoming;
+	    break;
+	default:
+	    return 0;
+	}
+    }
+}
+
+/* An out of band reply to the connection attempts */
+static void
+ConnectionlessPacket(bot_t *bot, const unsigned char *data, int length,
+		     double now)
+{
+    char text[MAX_MSGLEN], *message;
+
+    if (length < 5)
+	return;
+    memcpy(text, data + 4, length - 4);
+    text[length - 4] = 0;
+
+    if (text[0] == S2C_CHALLENGE && bot->state == BOT_CHALLENGE) {
+	bot->challenge = atoi(text + 1);
+	bot->state = BOT_CONNECT;
+	bot->tries = 0;
+	SendConnect(bot);
+	bot->nextsend = now + RESEND_TIME;
+    } else if (text[0] == S2C_CONNECTION && bot->state == BOT_CONNECT) {
+	bot->state = BOT_SIGNON;
+	bot->lastrecv = now;
+	StringCmd(bot, "new");
+	bot->nextsend = now;
+    } else if (text[0] == A2C_PRINT && bot->state == BOT_CONNECT) {
+	message = text + 1 + (text[1] == '\n');
+	message[strcspn(message, "\n")] = 0;
+	Drop(bot, message);
+    }
+}
+
+/* Netchan_Process, then the message */
+static void
+ReadPacket(bot_t *bot, const unsigned char *data, int length, double now)
+{
+    msg_t msg = { data, length, 0, 0 };
+    unsigned sequence, sequence_ack;
+    int reliable_message, reliable_ack;
+
+    if (length >= 4 && data[0] == 0xff && data[1] == 0xff && data[2] == 0xff
+	&& data[3] == 0xff) {
+	ConnectionlessPacket(bot, data, length, now);
+	return;
+    }
+    if (bot->state < BOT_SIGNON || length < 8)
+	return;
+
+    sequence = ReadLong(&msg);
+    sequence_ack = ReadLong(&msg);
+    reliable_message = sequence >> 31;
+    reliable_ack = sequence_ack >> 31;
+    sequence &= ~(1U << 31);
+    sequence_ack &= ~(1U << 31);
+
+    if (sequence <= bot->incoming)
+	return;			/* out of order or duplicated */
+
+    if (bot->state == BOT_ACTIVE) {
+	if (bot->incoming)
+	    dropped += sequence - (bot->incoming + 1);
+	received++;
+	bytesin += length;
+	if (bot->lastrecv && numgaps < MAX_SAMPLES)
+	    gaps[numgaps++] = (now - bot->lastrecv) * 1000;
+	if (bot->senttime[sequence_ack & UPDATE_MASK] > 0
+	    && sequence_ack > bot->incoming_acknowledged
+	    && numpings < MAX_SAMPLES) {
+	    pings[numpings++] =
+		(now - bot->senttime[sequence_ack & UPDATE_MASK]) * 1000;
+	    bot->senttime[sequence_ack & UPDATE_MASK] = 0;
+	}
+    }
+    bot->lastrecv = now;
+
+    if (reliable_ack == bot->reliable_sequence)
+	bot->reliablelen = 0;	/* it got through */
+    bot->incoming = sequence;
+    bot->incoming_acknowledged = sequence_ack;
+    bot->incoming_reliable_acknowledged = reliable_ack;
+    if (reliable_message)
+	bot->incoming_reliable_sequence ^= 1;
+
+    if (!ParseMessage(bot, &msg))
+	Drop(bot, "bad server message");
+}
+
+static void
+StartBot(double now)
+{
+    bot_t *bot = &bots[numbots];
+    struct sockaddr_in address;
+
+    memset(bot, 0, sizeof(*bot));
+    bot->s = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    if (bot->s == -1
+	|| bind(bot->s, (struct sockaddr *)&address, sizeof(address)) == -1
+	|| SetNonBlocking(bot->s) < 0) {
+	perror("socket");
+	exit(1);
+    }
+
+    bot->server = numbots % numservers;
+    bot->state = BOT_CHALLENGE;
+    bot->qport = (numbots * 2654435761U >> 16) & 0xffff;
+    bot->random = numbots * 2654435761U + 1;
+    bot->yaw = (numbots * 37) % 360;
+    if (numdemocmds)
+	bot->democmd = (int)((long)numdemocmds * numbots / maxbots);
+    bot->nextsend = now;
+    numbots++;
+}
+
+static void
+RunBot(bot_t *bot, double now)
+{
+    if (bot->state == BOT_GONE)
+	return;
+
+    if (bot->state >= BOT_SIGNON && now - bot->lastrecv > TIMEOUT) {
+	Drop(bot, "timed out");
+	return;
+    }
+    if (now < bot->nextsend)
+	return;
+
+    if (bot->state < BOT_SIGNON) {
+	if (++bot->tries > MAX_TRIES) {
+	    Drop(bot, "no answer from the server");
+	    return;
+	}
+	SendConnect(bot);
+	bot->nextsend = now + RESEND_TIME;
+	return;
+    }
+
+    SendMove(bot, now);
+    bot->nextsend += 1.0 / fps;
+    if (bot->nextsend < now)
+	bot->nextsend = now;
+}
+
+/* Sends "drop" a few times over, like the client's disconnect */
+static void
+Disconnect(bot_t *bot, double now)
+{
+    static const unsigned char drop[] = { clc_stringcmd, 'd', 'r', 'o', 'p', 0 };
+    int i;
+
+    if (bot->state < BOT_SIGNON || bot->state == BOT_GONE)
+	return;
+    for (i = 0; i < 3; i++)
+	Transmit(bot, drop, sizeof(drop), now);
+}
+
+/*
+===============================================================================
+
+				MEASURING
+
+===============================================================================
+*/
+
+static int
+LoadDemo(const char *name)
+{
+    unsigned char *data;
+    long length, pos;
+    FILE *f;
+    int type, size;
+
+    f = fopen(name, "rb");
+    if (!f)
+	return 0;
+    fseek(f, 0, SEEK_END);
+    length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(length > 0 ? length : 1);
+    if (!data || fread(data, 1, length, f) != (size_t)length) {
+	fclose(f);
+	free(data);
+	return 0;
+    }
+    fclose(f);
+
+    /* each block is the float time it was recorded at, then the type */
+    democmds = malloc(sizeof(*democmds) * (length / 41 + 1));
+    if (!democmds)
+	return 0;
+    for (pos = 0; pos + 5 <= length;) {
+	type = data[pos + 4];
+	pos += 5;
+	if (type == dem_cmd) {
+	    usercmd_t *cmd = &democmds[numdemocmds++];
+	    const unsigned char *p = data + pos;
+
+	    if (pos + 36 > length)
+		break;
+	    cmd->msec = p[0];
+	    cmd->angles[0] = LittleFloatAt(p + 4);
+	    cmd->angles[1] = LittleFloatAt(p + 8);
+	    cmd->angles[2] = LittleFloatAt(p + 12);
+	    cmd->forwardmove = (short)(p[16] | (p[17] << 8));
+	    cmd->sidemove = (short)(p[18] | (p[19] << 8));
+	    cmd->upmove = (short)(p[20] | (p[21] << 8));
+	    cmd->buttons = p[22];
+	    cmd->impulse = p[23];
+	    pos += 24 + 12;	/* the cmd and the view angles */
+	} else if (type == dem_read) {
+	    if (pos + 4 > length)
+		break;
+	    size = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16)
+		| ((unsigned)data[pos + 3] << 24);
+	    if (size < 0)
+		break;
+	    pos += 4 + size;
+	} else if (type == dem_set)
+	    pos += 8;
+	else
+	    break;
+    }
+    free(data);
+
+    return numdemocmds;
+}
+
+/*
+ * Prints what was measured over the step. Returns the players per server
+ * it measured if they were all inside the limits, otherwise -1.
+ */
+static int
+ReportStep(double elapsed)
+{
+    double ping50, ping95, gap95, loss, choke, kbytes;
+    int i, active = 0, ok;
+
+    for (i = 0; i < numbots; i++)
+	if (bots[i].state == BOT_ACTIVE)
+	    active++;
+
+    ping50 = Percentile(pings, numpings, 0.5);
+    ping95 = Percentile(pings, numpings, 0.95);
+    gap95 = Percentile(gaps, numgaps, 0.95);
+    loss = received + dropped ? 100.0 * dropped / (received + dropped) : 0;
+    choke = received + choked ? 100.0 * choked / (received + choked) : 0;
+    kbytes = active && elapsed > 0 ? bytesin / 1024.0 / active / elapsed : 0;
+
+    ok = active == numbots && !refused && ping95 <= maxping
+	&& loss <= maxloss && choke <= maxchoke;
+    printf("%7d %7d %7.1f %7.1f %6.2f %6.2f %8.2f %7.1f  %s\n",
+	   numbots, active, ping50, ping95, loss, choke, kbytes, gap95,
+	   ok ? "ok" : "over");
+    fflush(stdout);
+
+    numpings = numgaps = 0;
+    received = dropped = choked = bytesin = 0;
+
+    return ok ? active / numservers : -1;
+}
+
+static void
+Quit(int sig)
+{
+    (void)sig;
+    quitting = 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static struct pollfd fds[MAX_BOTS];
+    static unsigned char packet[MAX_MSGLEN + 64];
+    double now, stepstart, wait;
+    int i, length, sustained = 0, players, laststep = 0;
+    const char *demo = NULL;
+
+    for (i = 1; i < argc - 1 && argv[i][0] == '-'; i += 2) {
+	if (!strcmp(argv[i], "-clients"))
+	    maxbots = atoi(argv[i + 1]);
+	else if (!strcmp(argv[i], "-step"))
+	    stepbots = atoi(argv[i + 1]);
+	else if (!strcmp(argv[i], "-steptime"))
+	    steptime = atof(argv[i + 1]);
+	else if (!strcmp(argv[i], "-fps"))
+	    fps = atoi(argv[i + 1]);
+	else if (!strcmp(argv[i], "-rate"))
+	    rate = atoi(argv[i + 1]);
+	else if (!strcmp(argv[i], "-demo"))
+	    demo = argv[i + 1];
+	else if (!strcmp(argv[i], "-mapcheck"))
+	    mapcheck = atoi(argv[i + 1]);
+	else if (!strcmp(argv[i], "-maxping"))
+	    maxping = atof(argv[i + 1]);
+	else if (!strcmp(argv[i], "-maxloss"))
+	    maxloss = atof(argv[i + 1]);
+	else if (!strcmp(argv[i], "-maxchoke"))
+	    maxchoke = atof(argv[i + 1]);
+	else {
+	    fprintf(stderr, "Unknown option %s\n", argv[i]);
+	    return 1;
+	}
+    }
+    if (i == argc) {
+	printf("Usage:  %s [-clients n] [-step n] [-steptime secs] [-fps n]"
+	       " [-rate bytes]\n"
+	       "        [-demo file.qwd] [-mapcheck n] [-maxping ms]"
+	       " [-maxloss percent]\n"
+	       "        [-maxchoke percent] host[:port] ...\n", argv[0]);
+	return 1;
+    }
+
+    NET_Init();
+    for (; i < argc && numservers < MAX_SERVERS; i++) {
+	if (!ParseAddress(argv[i], &servers[numservers])) {
+	    fprintf(stderr, "Bad server address %s\n", argv[i]);
+	    return 1;
+	}
+	numservers++;
+    }
+    if (demo && !LoadDemo(demo)) {
+	fprintf(stderr, "No moves in %s\n", demo);
+	return 1;
+    }
+    if (maxbots > MAX_BOTS)
+	maxbots = MAX_BOTS;
+    if (maxbots < 1)
+	maxbots = 1;
+    if (stepbots < 1)
+	stepbots = 1;
+    if (fps < 1)
+	fps = 1;
+    if (steptime < 1)
+	steptime = 1;
+
+    signal(SIGINT, Quit);
+#ifdef SIGTERM
+    signal(SIGTERM, Quit);
+#endif
+
+    printf("%d client%s on %d server%s, %d more every %g seconds,"
+	   " %d moves a second at rate %d\n",
+	   maxbots, maxbots == 1 ? "" : "s", numservers,
+	   numservers == 1 ? "" : "s", stepbots, steptime, fps, rate);
+    printf("clients  active  ping50  ping95  loss%%  choke%%  kB/s/cl"
+	   "   gap95\n");
+
+    now = stepstart = Sys_DoubleTime();
+    while (numbots < stepbots && numbots < maxbots)
+	StartBot(now);
+
+    while (!quitting) {
+	wait = 0.01;
+	for (i = 0; i < numbots; i++) {
+	    fds[i].fd = bots[i].s;
+	    fds[i].events = POLLIN;
+	    fds[i].revents = 0;
+	    if (bots[i].state != BOT_GONE && bots[i].nextsend - now < wait)
+		wait = bots[i].nextsend - now;
+	}
+	poll(fds, numbots, wait > 0 ? (int)(wait * 1000) : 0);
+	now = Sys_DoubleTime();
+
+	for (i = 0; i < numbots; i++) {
+	    if (!(fds[i].revents & POLLIN))
+		continue;
+	    while ((length = recv(bots[i].s, (void *)packet, sizeof(packet),
+				  0)) > 0)
+		if (bots[i].state != BOT_GONE)
+		    ReadPacket(&bots[i], packet, length, now);
+	}
+	for (i = 0; i < numbots; i++)
+	    RunBot(&bots[i], now);
+
+	if (now - stepstart < steptime)
+	    continue;
+
+	players = ReportStep(now - stepstart);
+	if (players > sustained)
+	    sustained = players;
+	refused = 0;
+	stepstart = now;
+	if (laststep)
+	    break;
+	for (i = 0; i < stepbots && numbots < maxbots; i++)
+	    StartBot(now);
+	laststep = numbots == maxbots;
+    }
+
+    printf("sustained %d player%s per server at %d moves a second,"
+	   " rate %d\n", sustained, sustained == 1 ? "" : "s", fps, rate);
+
+    now = Sys_DoubleTime();
+    for (i = 0; i < numbots; i++) {
+	Disconnect(&bots[i], now);
+	close(bots[i].s);
+    }
+
+    return 0;
+}
@@ -0,0 +1,755 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+/*
+ * qwrelay - fans a server's spectator stream out to any number of watchers
+ *
+ * syntax:
+ *
+ * qwrelay sourceport watchport [-maxdelay secs] [-backlog kbytes]
+ *
+ * The server connects to the source port with "relay <host:port>" and
+ * sends "QWRELAY SOURCE\n", then the same blocks it writes to a server
+ * demo. Watchers connect to the watch port and send "QWRELAY WATCH delay\n"
+ * (the client's "relaywatch host:port [delay]"), then get the stream as it
+ * was delay seconds ago.
+ *
+ * A watcher starts at a signon. The server repeats the signon every so
+ * often, leading it with an svc_nop, so a watcher can join soon after it
+ * connects; a watcher that already has the signon for the map is only sent
+ * the sequence reset that ends it. The stream is kept for -maxdelay seconds
+ * back from the last signon before then. A watcher that can't take the
+ * stream as fast as it comes and falls -backlog behind, or behind what is
+ * kept, is dropped; it never holds up the source or the other watchers.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define poll WSAPoll
+#define close closesocket
+typedef int socklen_t;
+#else
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define MAX_WATCHERS	1024
+#define MAX_PENDING	64	/* connections yet to say what they are */
+#define MAX_LINE	64
+#define MAX_BLOCK	8192	/* biggest block a source may send */
+#define LINE_TIMEOUT	10	/* seconds to send the first line in */
+
+/* The demo blocks, see the client's protocol.h */
+#define dem_cmd		0
+#define dem_read	1
+#define dem_set		2
+
+#define svc_nop		1
+#define svc_serverdata	11
+
+typedef enum {
+    BLOCK_NORMAL,
+    BLOCK_SIGNON,		/* starts a signon every watcher needs */
+    BLOCK_REPEAT,		/* starts a repeat of the signon */
+    BLOCK_REPEATBODY,		/* packet within a repeat, up to the dem_set */
+} blockkind_t;
+
+typedef struct {
+    double time;		/* when it came in */
+    blockkind_t kind;
+    int spawncount;		/* of the signon it starts */
+    int length;
+    unsigned char *data;
+} block_t;
+
+typedef struct {
+    int s;
+    int sourceport;		/* came in on it, may be the source */
+    double connected;
+    char line[MAX_LINE];
+    int linelen;
+} pending_t;
+
+typedef struct {
+    int s;
+    char name[32];
+    double delay;
+    long next;			/* block number, -1 until started */
+    int spawncount;		/* of the last signon sent */
+    int skipping;		/* through a repeat it already has */
+    unsigned char *buf;		/* queued to send, up to backlog bytes */
+    int head, tail;
+} watcher_t;
+
+static int sourceport, watchport;
+static double maxdelay = 30;
+static int backlog = 512 * 1024;
+
+/* The stream, block numbers firstblock up to firstblock + numblocks */
+static block_t *blocks;
+static int maxblocks;
+static int blockstart;		/* ring index of firstblock */
+static long firstblock;
+static int numblocks;
+
+/* The source and its half read block */
+static int source = -1;
+static unsigned char sourcebuf[MAX_BLOCK * 2];
+static int sourcelen;
+static int sourcerepeat;	/* in a repeated signon */
+
+static pending_t pending[MAX_PENDING];
+static int numpending;
+static watcher_t *watchers[MAX_WATCHERS];
+static int numwatchers;
+
+static double
+Sys_DoubleTime(void)
+{
+#ifdef _WIN32
+    return GetTickCount() / 1000.0;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
+/*
+====================
+NET_Init
+====================
+*/
+static void
+NET_Init(void)
+{
+#ifdef _WIN32
+    static WSADATA winsockdata;
+
+    if (WSAStartup(MAKEWORD(2, 1), &winsockdata)) {
+	fprintf(stderr, "Winsock initialization failed.");
+	exit(1);
+    }
+#endif
+}
+
+static int
+SetNonBlocking(int s)
+{
+#ifdef _WIN32
+    u_long _true = 1;
+
+    return ioctlsocket(s, FIONBIO, &_true);
+#else
+    return fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+#endif
+}
+
+static int
+WouldBlock(void)
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR;
+#endif
+}
+
+static int
+ListenOn(int port)
+{
+    struct sockaddr_in address;
+    int s, _true = 1;
+
+    if ((s = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) == -1) {
+	perror("socket");
+	exit(1);
+    }
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (void *)&_true, sizeof(_true));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons((unsigned short)port);
+    if (bind(s, (void *)&address, sizeof(address)) == -1
+	|| listen(s, 16) == -1 || SetNonBlocking(s) < 0) {
+	perror("bind");
+	exit(1);
+    }
+
+    return s;
+}
+
+static long
+LittleLongAt(const unsigned char *p)
+{
+    return (long)(int)(p[0] | (p[1] << 8) | (p[2] << 16)
+		       | ((unsigned)p[3] << 24));
+}
+
+/*
+===============================================================================
+
+				THE STREAM
+
+===============================================================================
+*/
+
+static block_t *
+Block(long num)
+{
+    return &blocks[(blockstart + (int)(num - firstblock)) % maxblocks];
+}
+
+static void
+FreeBlocks(int count)
+{
+    while (count-- > 0 && numblocks) {
+	free(blocks[blockstart].data);
+	blockstart = (blockstart + 1) % maxblocks;
+	firstblock++;
+	numblocks--;
+    }
+}
+
+static void
+AddBlock(const unsigned char *data, int length, blockkind_t kind,
+	 int spawncount, double now)
+{
+    block_t *block;
+    int i;
+
+    if (numblocks == maxblocks) {
+	block_t *grown;
+	int count = maxblocks ? maxblocks * 2 : 1024;
+
+	grown = malloc(count * sizeof(*grown));
+	if (!grown) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(1);
+	}
+	for (i = 0; i < numblocks; i++)
+	    grown[i] = blocks[(blockstart + i) % maxblocks];
+	free(blocks);
+	blocks = grown;
+	maxblocks = count;
+	blockstart = 0;
+    }
+
+    block = &blocks[(blockstart + numblocks) % maxblocks];
+    block->data = malloc(length);
+    if (!block->data) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    memcpy(block->data, data, length);
+    block->length = length;
+    block->time = now;
+    block->kind = kind;
+    block->spawncount = spawncount;
+    numblocks++;
+}
+
+/*
+====================
+LatestSignon
+
+The last signon to come in before the time, or -1
+====================
+*/
+static long
+LatestSignon(double time)
+{
+    long num;
+    block_t *block;
+
+    for (num = firstblock + numblocks - 1; num >= firstblock; num--) {
+	block = Block(num);
+	if (block->time > time)
+	    continue;
+	if (block->kind == BLOCK_SIGNON || block->kind == BLOCK_REPEAT)
+	    return num;
+    }
+
+    return -1;
+}
+
+/*
+====================
+TrimStream
+
+Keeps the stream back to the last signon a watcher with the longest delay
+could start from
+====================
+*/
+static void
+TrimStream(double now)
+{
+    long keep = LatestSignon(now - maxdelay);
+
+    if (keep > firstblock)
+	FreeBlocks((int)(keep - firstblock));
+}
+
+/*
+====================
+ParseSource
+
+Splits what the source sent into blocks. Returns -1 if it's not a stream.
+====================
+*/
+static int
+ParseSource(double now)
+{
+    const unsigned char *p, *payload;
+    int pos, length, nop, spawncount;
+    blockkind_t kind;
+
+    pos = 0;
+    while (sourcelen - pos >= 5) {
+	p = sourcebuf + pos;
+	length = 0;
+	switch (p[4]) {
+	case dem_cmd:
+	    length = 5 + 24 + 12;	/* usercmd_t, then the view angles */
+	    break;
+	case dem_read:
+	    if (sourcelen - pos < 9)
+		goto partial;
+	    length = LittleLongAt(p + 5);
+	    if (length < 8 || length > MAX_BLOCK - 9)
+		return -1;
+	    length += 9;
+	    break;
+	case dem_set:
+	    length = 5 + 8;
+	    break;
+	default:
+	    return -1;
+	}
+	if (sourcelen - pos < length)
+	    break;
+
+	kind = BLOCK_NORMAL;
+	spawncount = 0;
+	if (p[4] == dem_read && length >= 9 + 8 + 1) {
+	    payload = p + 9 + 8;	/* past the netchan header */
+	    nop = payload[0] == svc_nop;
+	    if (payload[nop] == svc_serverdata && length >= 9 + 8 + nop + 9) {
+		kind = nop ? BLOCK_REPEAT : BLOCK_SIGNON;
+		spawncount = (int)LittleLongAt(payload + nop + 5);
+		sourcerepeat = nop;
+	    } else if (sourcerepeat)
+		kind = BLOCK_REPEATBODY;
+	} else if (p[4] == dem_set)
+	    sourcerepeat = 0;
+
+	AddBlock(p, length, kind, spawncount, now);
+	pos += length;
+    }
+
+  partial:
+    memmove(sourcebuf, sourcebuf + pos, sourcelen - pos);
+    sourcelen -= pos;
+
+    return 0;
+}
+
+/*
+===============================================================================
+
+				WATCHERS
+
+===============================================================================
+*/
+
+static void
+DropWatcher(int i, const char *reason)
+{
+    watcher_t *w = watchers[i];
+
+    printf("%s %s\n", w->name, reason);
+    fflush(stdout);
+    close(w->s);
+    free(w->buf);
+    free(w);
+    watchers[i] = watchers[--numwatchers];
+}
+
+static void
+DropAllWatchers(const char *reason)
+{
+    while (numwatchers)
+	DropWatcher(numwatchers - 1, reason);
+}
+
+/*
+====================
+QueueBlocks
+
+Queues the blocks the watcher is due, as far as there's room for them
+====================
+*/
+static void
+QueueBlocks(watcher_t *w, double now)
+{
+    block_t *block;
+
+    if (w->next < 0) {
+	w->next = LatestSignon(now - w->delay);
+	if (w->next < 0)
+	    return;
+    }
+
+    while (w->next < firstblock + numblocks) {
+	block = Block(w->next);
+	if (block->time > now - w->delay)
+	    break;
+	if (backlog - w->head < block->length) {
+	    if (w->tail) {
+		memmove(w->buf, w->buf + w->tail, w->head - w->tail);
+		w->head -= w->tail;
+		w->tail = 0;
+	    }
+	    if (backlog - w->head < block->length)
+		break;
+	}
+
+	if (block->kind == BLOCK_SIGNON
+	    || (block->kind == BLOCK_REPEAT
+		&& block->spawncount != w->spawncount)) {
+	    w->spawncount = block->spawncount;
+	    w->skipping = 0;
+	} else if (block->kind == BLOCK_REPEAT)
+	    w->skipping = 1;
+	else if (block->kind == BLOCK_NORMAL && block->data[4] == dem_set)
+	    w->skipping = 0;
+
+	if (!w->skipping || block->data[4] != dem_read) {
+	    memcpy(w->buf + w->head, block->data, block->length);
+	    w->head += block->length;
+	}
+	w->next++;
+    }
+}
+
+static int
+SendWatcher(watcher_t *w)
+{
+    int ret;
+
+    while (w->tail < w->head) {
+	ret = send(w->s, (void *)(w->buf + w->tail), w->head - w->tail,
+		   MSG_NOSIGNAL);
+	if (ret < 0)
+	    return WouldBlock() ? 0 : -1;
+	w->tail += ret;
+    }
+    w->head = w->tail = 0;
+
+    return 0;
+}
+
+static void
+RunWatchers(double now)
+{
+    watcher_t *w;
+    int i;
+
+    for (i = numwatchers - 1; i >= 0; i--) {
+	w = watchers[i];
+	if (w->next >= 0 && w->next < firstblock) {
+	    DropWatcher(i, "fell behind, dropped");
+	    continue;
+	}
+	QueueBlocks(w, now);
+	if (SendWatcher(w) < 0)
+	    DropWatcher(i, "disconnected");
+    }
+}
+
+/*
+====================
+AddWatcher
+
+"QWRELAY WATCH delay"
+====================
+*/
+static void
+AddWatcher(int s, const char *line, const char *name)
+{
+    watcher_t *w;
+    double delay;
+
+    delay = atof(line + 14);
+    if (delay < 0)
+	delay = 0;
+    if (delay > maxdelay)
+	delay = maxdelay;
+
+    w = calloc(1, sizeof(*w));
+    if (!w || !(w->buf = malloc(backlog)) || numwatchers == MAX_WATCHERS) {
+	fprintf(stderr, "No room for %s\n", name);
+	if (w)
+	    free(w->buf);
+	free(w);
+	close(s);
+	return;
+    }
+    w->s = s;
+    snprintf(w->name, sizeof(w->name), "%s", name);
+    w->delay = delay;
+    w->next = -1;
+    w->spawncount = -1;
+    watchers[numwatchers++] = w;
+
+    printf("%s watching, %.1fs behind\n", name, delay);
+    fflush(stdout);
+}
+
+/*
+===============================================================================
+
+				CONNECTIONS
+
+===============================================================================
+*/
+
+static void
+Accept(int listener, int sourceport)
+{
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    int s;
+
+    fromlen = sizeof(from);
+    s = accept(listener, (struct sockaddr *)&from, &fromlen);
+    if (s < 0)
+	return;
+    if (numpending == MAX_PENDING || SetNonBlocking(s) < 0) {
+	close(s);
+	return;
+    }
+    memset(&pending[numpending], 0, sizeof(pending[numpending]));
+    pending[numpending].s = s;
+    pending[numpending].sourceport = sourceport;
+    pending[numpending].connected = Sys_DoubleTime();
+    numpending++;
+}
+
+static void
+DropPending(int i)
+{
+    pending[i] = pending[--numpending];
+}
+
+/*
+====================
+ReadLine
+
+Reads what's there of the first line, one byte at a time so nothing past
+it is taken from the stream. Returns 1 with the line, 0 for more to come
+or -1 to drop it.
+====================
+*/
+static int
+ReadLine(pending_t *p)
+{
+    char c;
+    int ret;
+
+    while (p->linelen < MAX_LINE - 1) {
+	ret = recv(p->s, &c, 1, 0);
+	if (ret == 0)
+	    return -1;
+	if (ret < 0)
+	    return WouldBlock() ? 0 : -1;
+	if (c == '\n') {
+	    p->line[p->linelen] = 0;
+	    return 1;
+	}
+	p->line[p->linelen++] = c;
+    }
+
+    return -1;
+}
+
+static void
+ReadPending(int i, double now)
+{
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    pending_t *p = &pending[i];
+    char name[32];
+    int ret, s;
+
+    ret = ReadLine(p);
+    if (!ret && now - p->connected < LINE_TIMEOUT)
+	return;
+
+    s = p->s;
+    fromlen = sizeof(from);
+    if (getpeername(s, (struct sockaddr *)&from, &fromlen) == 0)
+	snprintf(name, sizeof(name), "%s:%d", inet_ntoa(from.sin_addr),
+		 (int)ntohs(from.sin_port));
+    else
+	snprintf(name, sizeof(name), "?");
+
+    if (ret > 0 && p->line[0] && p->line[strlen(p->line) - 1] == '\r')
+	p->line[strlen(p->line) - 1] = 0;
+
+    if (ret > 0 && p->sourceport && !strcmp(p->line, "QWRELAY SOURCE")) {
+	// a new source starts a new stream, with its own sequences
+	if (source >= 0)
+	    close(source);
+	DropAllWatchers("source replaced, dropped");
+	FreeBlocks(numblocks);
+	source = s;
+	sourcelen = 0;
+	sourcerepeat = 0;
+	printf("%s is the source\n", name);
+	fflush(stdout);
+    } else if (ret > 0 && !p->sourceport
+	       && !strncmp(p->line, "QWRELAY WATCH", 13)
+	       && (!p->line[13] || p->line[13] == ' ')) {
+	AddWatcher(s, p->line, name);
+    } else {
+	close(s);
+    }
+    DropPending(i);
+}
+
+static void
+ReadSource(double now)
+{
+    int ret;
+
+    while (1) {
+	ret = recv(source, (void *)(sourcebuf + sourcelen),
+		   sizeof(sourcebuf) - sourcelen, 0);
+	if (ret < 0 && WouldBlock())
+	    return;
+	if (ret <= 0) {
+	    printf("Source disconnected\n");
+	    break;
+	}
+	sourcelen += ret;
+	if (ParseSource(now) < 0) {
+	    printf("Source sent a bad block, dropped\n");
+	    break;
+	}
+    }
+    fflush(stdout);
+    close(source);
+    source = -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static struct pollfd fds[2 + 1 + MAX_PENDING];
+    int sourcelistener, watchlistener;
+    int i, numfds;
+    double now;
+
+    if (argc < 3) {
+	printf("Usage:  %s <source port> <watch port>"
+	       " [-maxdelay secs] [-backlog kbytes]\n", argv[0]);
+	return 1;
+    }
+
+    for (i = 3; i < argc - 1; i += 2) {
+	if (!strcmp(argv[i], "-maxdelay"))
+	    maxdelay = atof(argv[i + 1]);
+	else if (!strcmp(argv[i], "-backlog"))
+	    backlog = atoi(argv[i + 1]) * 1024;
+	else
+	    break;
+    }
+    if (i != argc) {
+	fprintf(stderr, "Unknown option %s\n", argv[i]);
+	return 1;
+    }
+    if (maxdelay < 0)
+	maxdelay = 0;
+    if (backlog < 2 * MAX_BLOCK)
+	backlog = 2 * MAX_BLOCK;
+
+    NET_Init();
+#ifdef SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    sourceport = atoi(argv[1]);
+    watchport = atoi(argv[2]);
+    sourcelistener = ListenOn(sourceport);
+    watchlistener = ListenOn(watchport);
+
+    while (1) {
+	fds[0].fd = sourcelistener;
+	fds[0].events = POLLIN;
+	fds[1].fd = watchlistener;
+	fds[1].events = POLLIN;
+	fds[2].fd = source;
+	fds[2].events = POLLIN;
+	numfds = source >= 0 ? 3 : 2;
+	for (i = 0; i < numpending; i++) {
+	    fds[numfds].fd = pending[i].s;
+	    fds[numfds++].events = POLLIN;
+	}
+
+	/* the watchers' sends are retried here too, as the delays run out */
+	poll(fds, numfds, 20);
+	now = Sys_DoubleTime();
+
+	if (fds[0].revents & POLLIN)
+	    Accept(sourcelistener, 1);
+	if (fds[1].revents & POLLIN)
+	    Accept(watchlistener, 0);
+	if (source >= 0 && fds[2].revents)
+	    ReadSource(now);
+	for (i = numpending - 1; i >= 0; i--)
+	    ReadPending(i, now);
+
+	TrimStream(now);
+	RunWatchers(now);
+    }
+
+    return 0;
+}
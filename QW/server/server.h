@@ -64,6 +64,8 @@ typedef struct {
     struct model_s *worldmodel;
     const char *model_precache[MAX_MODELS];	// NULL terminated
     const char *sound_precache[MAX_SOUNDS];	// NULL terminated
+    precachehash_t model_hash;	// by name into model_precache
+    precachehash_t sound_hash;	// and sound_precache
     const char *lightstyles[MAX_LIGHTSTYLES];
     struct model_s *models[MAX_MODELS];
 
@@ -137,6 +139,7 @@ typedef struct client_s {
 
     int userid;			// identifying number
     char userinfo[MAX_INFO_STRING];	// infostring
+    infokeys_t userkeys;	// parsed from userinfo by SV_ExtractFromUserinfo
 
     usercmd_t lastcmd;		// for filling in big drops and partial predictions
     double localtime;		// of last message
@@ -174,10 +177,16 @@ typedef struct client_s {
 
 
     client_frame_t frames[UPDATE_BACKUP];	// updates can be deltad from here
+    int entsent[MAX_PACKET_ENTNUM];	// outgoing_sequence each was last sent on
 
     FILE *download;		// file being downloaded
     int downloadsize;		// total bytes
     int downloadcount;		// bytes sent
+    long downloadbase;		// file position of the first byte
+    int downloadwindow;		// streaming: bytes sent ahead of the ack
+    int downloadacked;		// streaming: bytes the client has
+    double downloadacktime;	// streaming: realtime of the last ack
+    int downloadstream;		// streaming: downloads streamed so far
 
     int spec_track;		// entnum of player tracking
 
@@ -186,6 +195,12 @@ typedef struct client_s {
     double lockedtill;
 
     qboolean upgradewarn;	// did we warn him?
+    qboolean projectiles;	// understands svc_projectiles
+
+    // leaf of the edict's origin, kept for multicasts until it moves
+    vec3_t leaf_origin;
+    int leaf_spawncount;	// svs.spawncount the leaf was found in
+    mleaf_t *leaf;
 
     FILE *upload;
     char uploadfn[MAX_QPATH];
@@ -194,6 +209,7 @@ typedef struct client_s {
 
 //===== NETWORK ============
     int chokecount;
+    int chokes;			// total since connecting, for the metrics
     int delta_sequence;		// -1 = no compression
     netchan_t netchan;
 } client_t;
@@ -329,6 +345,12 @@ extern cvar_t sv_airaccelerate;
 extern cvar_t sv_wateraccelerate;
 extern cvar_t sv_friction;
 extern cvar_t sv_waterfriction;
+extern cvar_t sv_threads;
+extern cvar_t sv_entpriority;
+extern cvar_t sv_antilag;
+extern cvar_t sv_antilag_max;
+extern cvar_t sv_phscache;
+extern cvar_t sv_projectiles;
 
 extern cvar_t sv_mintic, sv_maxtic;
 extern cvar_t sv_maxspeed;
@@ -363,11 +385,14 @@ extern char localmodels[MAX_MODELS][5];	// inline model names for precache
 extern char localinfo[MAX_LOCALINFO_STRING + 1];
 
 extern int host_hunklevel;
-extern FILE *sv_logfile;
-extern FILE *sv_fraglogfile;
+typedef struct svlog_s svlog_t;
+
+extern svlog_t *sv_logfile;
+extern svlog_t *sv_fraglogfile;
 
 extern int sv_nailmodel;
 extern int sv_supernailmodel;
+extern byte sv_projectilemodels[MAX_MODELS];
 extern int sv_playermodel;
 
 extern vec3_t player_mins;
@@ -419,6 +444,7 @@ void SV_FlushSignon(void);
 qboolean SV_RunThink(edict_t *ent);
 void SV_ProgStartFrame(void);
 void SV_Physics(void);
+double SV_PhysicsTimeout(void);
 void SV_CheckVelocity(edict_t *ent);
 void SV_AddGravity(edict_t *ent, float scale);
 void SV_Physics_Toss(edict_t *ent);
@@ -451,6 +477,8 @@ void SV_BroadcastCommand(const char *fmt, ...)
     __attribute__((format(printf,1,2)));
 void SV_SendMessagesToAll(void);
 void SV_FindModelNumbers(void);
+qboolean SV_SendDownloadChunk(client_t *client);
+void SV_ClientStats(const client_t *client, int *stats);
 
 //
 // sv_user.c
@@ -458,16 +486,55 @@ void SV_FindModelNumbers(void);
 void SV_ExecuteClientMessage(client_t *cl);
 void SV_UserInit(void);
 void SV_TogglePause(const char *msg);
+void SV_AntilagRecord(void);
 
 //
 // sv_ccmds.c
 //
 void SV_Status_f(void);
 
+//
+// sv_log.c
+//
+svlog_t *SV_LogOpen(FILE *file);
+void SV_LogWrite(svlog_t *log, const char *text);
+void SV_LogClose(svlog_t *log);
+void SV_LogShutdown(void);
+
+//
+// sv_metrics.c
+//
+typedef enum {
+    SVM_READ,			// packets, console commands and cvar checks
+    SVM_PHYSICS,
+    SVM_PROGS,			// QuakeC, wherever in the frame it ran
+    SVM_SEND,
+    SVM_IDLE,			// waiting for packets between frames
+    SVM_NUMSTAGES
+} svmstage_t;
+
+void SV_MetricsInit(void);
+void SV_MetricsShutdown(void);
+void SV_MetricsBeginFrame(void);
+void SV_MetricsMark(svmstage_t stage);
+void SV_MetricsTick(double interval);
+void SV_MetricsEndFrame(void);
+int SV_MetricsPrint(char *buf, int size);
+
+//
+// sv_demo.c
+//
+void SV_DemoInit(void);
+void SV_DemoFrame(void);
+void SV_DemoStop(void);
+sizebuf_t *SV_DemoReliable(int maxsize);
+sizebuf_t *SV_DemoDatagram(void);
+
 //
 // sv_ents.c
 //
-void SV_WriteEntitiesToClient(client_t *client, sizebuf_t *msg);
+const char *SV_WriteEntitiesToClient(client_t *client, const leafbits_t *pvs,
+				     sizebuf_t *msg);
 
 //
 // sv_nchan.c
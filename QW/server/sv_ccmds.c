@@ -100,17 +100,20 @@ void
 SV_Logfile_f(void)
 {
     char name[MAX_OSPATH];
+    FILE *f;
 
     if (sv_logfile) {
 	Con_Printf("File logging off.\n");
-	fclose(sv_logfile);
+	SV_LogClose(sv_logfile);
 	sv_logfile = NULL;
 	return;
     }
 
     sprintf(name, "%s/qconsole.log", com_gamedir);
     Con_Printf("Logging text to %s.\n", name);
-    sv_logfile = fopen(name, "w");
+    f = fopen(name, "w");
+    if (f)
+	sv_logfile = SV_LogOpen(f);
     if (!sv_logfile)
 	Con_Printf("failed.\n");
 }
@@ -125,29 +128,30 @@ void
 SV_Fraglogfile_f(void)
 {
     char name[MAX_OSPATH];
+    FILE *f;
     int i;
 
     if (sv_fraglogfile) {
 	Con_Printf("Frag file logging off.\n");
-	fclose(sv_fraglogfile);
+	SV_LogClose(sv_fraglogfile);
 	sv_fraglogfile = NULL;
 	return;
     }
     // find an unused name
+    f = NULL;
     for (i = 0; i < 1000; i++) {
 	sprintf(name, "%s/frag_%i.log", com_gamedir, i);
-	sv_fraglogfile = fopen(name, "r");
-	if (!sv_fraglogfile) {	// can't read it, so create this one
-	    sv_fraglogfile = fopen(name, "w");
-	    if (!sv_fraglogfile)
+	f = fopen(name, "r");
+	if (!f) {		// can't read it, so create this one
+	    f = fopen(name, "w");
+	    if (!f)
 		i = 1000;	// give error
 	    break;
 	}
-	fclose(sv_fraglogfile);
+	fclose(f);
     }
-    if (i == 1000) {
+    if (i == 1000 || !(sv_fraglogfile = SV_LogOpen(f))) {
 	Con_Printf("Can't open any logfiles.\n");
-	sv_fraglogfile = NULL;
 	return;
     }
 
@@ -0,0 +1,799 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_demo.c -- server side demo recording
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "console.h"
+#include "net.h"
+#include "pmove.h"
+#include "qwsvdef.h"
+#include "server.h"
+#include "sys.h"
+
+/*
+ * The server records a .qwd any client can play back, seen by a spectator
+ * that sees the whole map rather than one player's PVS. A frame is built
+ * once, at most sv_demofps times a second, however many players there are.
+ * The broadcast reliables and datagrams are kept as they're sent to the
+ * clients, and the players and entities are encoded with the same code as
+ * a client's datagram.
+ *
+ * The client can't delta demo frames on playback, so every frame is a full
+ * packetentities and is still bound by MAX_PACKET_ENTITIES. The spectator
+ * has a slot of its own, left empty of userinfo, which follows a player
+ * around.
+ *
+ * A client demo keeps each reply in step with the move it acknowledges, so
+ * every packet is written with its sequence and acknowledge the same, and
+ * followed by the move for the next one for the client to predict from.
+ *
+ * The same stream can go to a relay (qwrelay) over TCP, which fans it out
+ * to the spectators, so they cost the server nothing. Spectators join the
+ * relay at a signon, so one is repeated every sv_relaykeyframe seconds. A
+ * repeated signon leads with an svc_nop for the relay to tell it from one
+ * everyone needs, and leaves the messages since the last frame to follow
+ * it. The relay is dropped rather than waited on if it falls behind.
+ */
+#define SV_DEMO_CHUNKS	32		// reliable packets kept between frames
+#define SV_DEMO_CHUNKSIZE (MAX_MSGLEN - 8)
+#define SV_RELAY_BUFSIZE 0x100000	// queued for the relay
+
+static cvar_t sv_demofps = { "sv_demofps", "30" };
+static cvar_t sv_relaykeyframe = { "sv_relaykeyframe", "10" };
+
+typedef struct {
+    FILE *file;
+    char name[MAX_OSPATH];
+    int relay;			// socket, -1 for none
+    netadr_t relayaddr;
+    qboolean filestarted;	// a sink takes the stream from a signon on
+    qboolean relaystarted;
+    qboolean fileskip;		// a repeated signon the file already has
+
+    int spawncount;		// the map the signon was written for
+    qboolean resync;		// lost a reliable, send the signon again
+    qboolean keyframe;		// repeat the signon on the next frame
+    double lastkeyframe;
+    qboolean allstats;		// send every stat on the next frame
+    int playernum;		// the spectator's slot
+    int track;			// slot followed, -1 for none
+    double lasttime;
+    int sequence;		// of the last packet written
+    int stats[MAX_CL_STATS];
+
+    /* broadcast messages since the last frame */
+    sizebuf_t reliable[SV_DEMO_CHUNKS];
+    byte reliable_buf[SV_DEMO_CHUNKS][SV_DEMO_CHUNKSIZE];
+    int numreliable;
+    sizebuf_t datagram;
+    byte datagram_buf[MAX_DATAGRAM];
+
+    client_t client;		// the spectator, for the entity encoding
+    sizebuf_t out;		// what the frame writes to the sinks
+    byte out_buf[(SV_DEMO_CHUNKS + 2) * (MAX_MSGLEN + 64)];
+
+    byte relay_buf[SV_RELAY_BUFSIZE];
+    int relayhead;		// queued up to here, sent up to relaytail
+    int relaytail;
+} svdemo_t;
+
+static svdemo_t sv_demo = { .relay = -1 };
+
+static qboolean
+SV_DemoActive(void)
+{
+    return sv_demo.file || sv_demo.relay >= 0;
+}
+
+static void
+SV_RelayClose(const char *reason)
+{
+    if (sv_demo.relay < 0)
+	return;
+
+    NET_StreamClose(sv_demo.relay);
+    sv_demo.relay = -1;
+    Con_Printf("Relay %s %s\n", NET_AdrToString(sv_demo.relayaddr), reason);
+}
+
+/*
+====================
+SV_RelaySend
+
+Sends what the relay will take of the queue without waiting
+====================
+*/
+static void
+SV_RelaySend(void)
+{
+    int ret;
+
+    while (sv_demo.relay >= 0 && sv_demo.relaytail < sv_demo.relayhead) {
+	ret = NET_StreamSend(sv_demo.relay,
+			     sv_demo.relay_buf + sv_demo.relaytail,
+			     sv_demo.relayhead - sv_demo.relaytail);
+	if (ret < 0)
+	    SV_RelayClose("lost");
+	if (ret <= 0)
+	    break;
+	sv_demo.relaytail += ret;
+    }
+    if (sv_demo.relaytail == sv_demo.relayhead)
+	sv_demo.relayhead = sv_demo.relaytail = 0;
+}
+
+static void
+SV_RelayQueue(const void *data, int length)
+{
+    if (sv_demo.relayhead + length > SV_RELAY_BUFSIZE) {
+	memmove(sv_demo.relay_buf, sv_demo.relay_buf + sv_demo.relaytail,
+		sv_demo.relayhead - sv_demo.relaytail);
+	sv_demo.relayhead -= sv_demo.relaytail;
+	sv_demo.relaytail = 0;
+    }
+    if (sv_demo.relayhead + length > SV_RELAY_BUFSIZE) {
+	SV_RelayClose("fell behind, dropped");
+	return;
+    }
+    memcpy(sv_demo.relay_buf + sv_demo.relayhead, data, length);
+    sv_demo.relayhead += length;
+    SV_RelaySend();
+}
+
+static void
+SV_DemoFlush(void)
+{
+    if (sv_demo.out.cursize) {
+	if (sv_demo.file && sv_demo.filestarted && !sv_demo.fileskip)
+	    fwrite(sv_demo.out.data, 1, sv_demo.out.cursize, sv_demo.file);
+	if (sv_demo.relay >= 0 && sv_demo.relaystarted)
+	    SV_RelayQueue(sv_demo.out.data, sv_demo.out.cursize);
+    }
+    SZ_Clear(&sv_demo.out);
+}
+
+/*
+====================
+SV_DemoWriteRead
+
+Queues one packet for the file, behind its time and the netchan header
+====================
+*/
+static void
+SV_DemoWriteRead(const sizebuf_t *msg)
+{
+    sizebuf_t *out = &sv_demo.out;
+
+    if (out->cursize + msg->cursize + 64 > out->maxsize)
+	SV_DemoFlush();
+
+    sv_demo.sequence++;
+    MSG_WriteFloat(out, realtime);
+    MSG_WriteByte(out, dem_read);
+    MSG_WriteLong(out, msg->cursize + 8);
+    MSG_WriteLong(out, sv_demo.sequence);
+    MSG_WriteLong(out, sv_demo.sequence);
+    SZ_Write(out, msg->data, msg->cursize);
+}
+
+/*
+====================
+SV_DemoWriteCmd
+
+Queues the move the next packet will acknowledge, looking the way the
+followed player is
+====================
+*/
+static void
+SV_DemoWriteCmd(void)
+{
+    sizebuf_t *out = &sv_demo.out;
+    const float *angles = vec3_origin;
+    usercmd_t cmd;
+    int i;
+
+    if (sv_demo.track >= 0)
+	angles = svs.clients[sv_demo.track].edict->v.v_angle;
+
+    memset(&cmd, 0, sizeof(cmd));
+    for (i = 0; i < 3; i++)
+	cmd.angles[i] = LittleFloat(angles[i]);
+
+    MSG_WriteFloat(out, realtime);
+    MSG_WriteByte(out, dem_cmd);
+    SZ_Write(out, &cmd, sizeof(cmd));
+    for (i = 0; i < 3; i++)
+	MSG_WriteFloat(out, angles[i]);
+}
+
+static void
+SV_DemoWritePacket(const sizebuf_t *msg)
+{
+    SV_DemoWriteRead(msg);
+    SV_DemoWriteCmd();
+}
+
+static void
+SV_DemoClearMessages(void)
+{
+    int i;
+
+    for (i = 0; i < SV_DEMO_CHUNKS; i++)
+	SZ_Clear(&sv_demo.reliable[i]);
+    sv_demo.numreliable = 1;
+    SZ_Clear(&sv_demo.datagram);
+}
+
+/*
+====================
+SV_DemoWriteList
+
+The soundlist or modellist, split over as many packets as it takes
+====================
+*/
+static void
+SV_DemoWriteList(sizebuf_t *msg, int svc, const char **list)
+{
+    const char **s;
+    int n;
+
+    n = 0;
+    s = list + 1;
+    do {
+	MSG_WriteByte(msg, svc);
+	MSG_WriteByte(msg, n);
+	for (; *s && msg->cursize < (MAX_MSGLEN / 2); s++, n++)
+	    MSG_WriteString(msg, *s);
+	MSG_WriteByte(msg, 0);
+	MSG_WriteByte(msg, *s ? n : 0);
+	SV_DemoWriteRead(msg);
+	SZ_Clear(msg);
+    } while (*s);
+}
+
+/*
+====================
+SV_DemoWriteSignon
+
+Everything a client is sent as it connects, as the spectator. Written at
+the start of the demo, on each new map and when the demo has to catch up
+with reliables it had no room for, or repeated for a sink to start from.
+====================
+*/
+static void
+SV_DemoWriteSignon(qboolean repeat)
+{
+    sizebuf_t msg;
+    byte msg_buf[MAX_MSGLEN];
+    const char *gamedir;
+    int i;
+
+    // anything before belongs to the sinks that already had a signon
+    SV_DemoFlush();
+    sv_demo.fileskip = repeat && sv_demo.filestarted;
+    sv_demo.filestarted = sv_demo.file != NULL;
+    sv_demo.relaystarted = sv_demo.relay >= 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.data = msg_buf;
+    msg.maxsize = sizeof(msg_buf);
+
+    gamedir = Info_ValueForKey(svs.info, "*gamedir");
+    if (!gamedir[0])
+	gamedir = "qw";
+
+    if (repeat)
+	MSG_WriteByte(&msg, svc_nop);
+    MSG_WriteByte(&msg, svc_serverdata);
+    MSG_WriteLong(&msg, PROTOCOL_VERSION);
+    MSG_WriteLong(&msg, svs.spawncount);
+    MSG_WriteString(&msg, gamedir);
+    MSG_WriteByte(&msg, sv_demo.playernum | 128);
+    MSG_WriteString(&msg, PR_GetString(sv.edicts->v.message));
+    MSG_WriteFloat(&msg, movevars.gravity);
+    MSG_WriteFloat(&msg, movevars.stopspeed);
+    MSG_WriteFloat(&msg, movevars.maxspeed);
+    MSG_WriteFloat(&msg, movevars.spectatormaxspeed);
+    MSG_WriteFloat(&msg, movevars.accelerate);
+    MSG_WriteFloat(&msg, movevars.airaccelerate);
+    MSG_WriteFloat(&msg, movevars.wateraccelerate);
+    MSG_WriteFloat(&msg, movevars.friction);
+    MSG_WriteFloat(&msg, movevars.waterfriction);
+    MSG_WriteFloat(&msg, movevars.entgravity);
+    MSG_WriteByte(&msg, svc_cdtrack);
+    MSG_WriteByte(&msg, sv.edicts->v.sounds);
+    MSG_WriteByte(&msg, svc_stufftext);
+    MSG_WriteStringf(&msg, "fullserverinfo \"%s\"\n", svs.info);
+    SV_DemoWriteRead(&msg);
+    SZ_Clear(&msg);
+
+    SV_DemoWriteList(&msg, svc_soundlist, sv.sound_precache);
+    SV_DemoWriteList(&msg, svc_modellist, sv.model_precache);
+
+    // the statics and baselines
+    for (i = 0; i < sv.num_signon_buffers; i++) {
+	SZ_Write(&msg, sv.signon_buffers[i], sv.signon_buffer_size[i]);
+	SV_DemoWriteRead(&msg);
+	SZ_Clear(&msg);
+    }
+
+    MSG_WriteByte(&msg, svc_stufftext);
+    MSG_WriteStringf(&msg, "cmd spawn %i 0\n", svs.spawncount);
+    SV_DemoWriteRead(&msg);
+    SZ_Clear(&msg);
+
+    for (i = 0; i < MAX_CLIENTS; i++) {
+	if (msg.cursize > MAX_MSGLEN / 2) {
+	    SV_DemoWriteRead(&msg);
+	    SZ_Clear(&msg);
+	}
+	SV_FullClientUpdate(&svs.clients[i], &msg);
+    }
+    SV_DemoWriteRead(&msg);
+    SZ_Clear(&msg);
+
+    for (i = 0; i < MAX_LIGHTSTYLES; i++) {
+	if (msg.cursize > MAX_MSGLEN / 2) {
+	    SV_DemoWriteRead(&msg);
+	    SZ_Clear(&msg);
+	}
+	MSG_WriteByte(&msg, svc_lightstyle);
+	MSG_WriteByte(&msg, (char)i);
+	MSG_WriteString(&msg, sv.lightstyles[i]);
+    }
+
+    MSG_WriteByte(&msg, svc_updatestatlong);
+    MSG_WriteByte(&msg, STAT_TOTALSECRETS);
+    MSG_WriteLong(&msg, pr_global_struct->total_secrets);
+    MSG_WriteByte(&msg, svc_updatestatlong);
+    MSG_WriteByte(&msg, STAT_TOTALMONSTERS);
+    MSG_WriteLong(&msg, pr_global_struct->total_monsters);
+    MSG_WriteByte(&msg, svc_updatestatlong);
+    MSG_WriteByte(&msg, STAT_SECRETS);
+    MSG_WriteLong(&msg, pr_global_struct->found_secrets);
+    MSG_WriteByte(&msg, svc_updatestatlong);
+    MSG_WriteByte(&msg, STAT_MONSTERS);
+    MSG_WriteLong(&msg, pr_global_struct->killed_monsters);
+    if (sv.paused) {
+	MSG_WriteByte(&msg, svc_setpause);
+	MSG_WriteByte(&msg, sv.paused);
+    }
+    MSG_WriteByte(&msg, svc_stufftext);
+    MSG_WriteString(&msg, "skins\n");
+    SV_DemoWriteRead(&msg);
+
+    // the next packet follows on from here
+    MSG_WriteFloat(&sv_demo.out, realtime);
+    MSG_WriteByte(&sv_demo.out, dem_set);
+    MSG_WriteLong(&sv_demo.out, sv_demo.sequence + 1);
+    MSG_WriteLong(&sv_demo.out, sv_demo.sequence);
+    SV_DemoWriteCmd();
+    SV_DemoFlush();
+    sv_demo.fileskip = false;
+
+    sv_demo.allstats = true;
+    sv_demo.keyframe = false;
+    sv_demo.lastkeyframe = realtime;
+    if (repeat)
+	return;
+
+    SV_DemoClearMessages();
+    sv_demo.spawncount = svs.spawncount;
+    sv_demo.resync = false;
+}
+
+/*
+====================
+SV_DemoReliable
+
+A reliable message for the demo, with room for maxsize bytes, or NULL when
+not recording
+====================
+*/
+sizebuf_t *
+SV_DemoReliable(int maxsize)
+{
+    sizebuf_t *msg;
+
+    if (!SV_DemoActive() || sv_demo.resync)
+	return NULL;
+
+    msg = &sv_demo.reliable[sv_demo.numreliable - 1];
+    if (msg->cursize + maxsize <= msg->maxsize)
+	return msg;
+    if (sv_demo.numreliable == SV_DEMO_CHUNKS || maxsize > msg->maxsize) {
+	sv_demo.resync = true;
+	return NULL;
+    }
+
+    return &sv_demo.reliable[sv_demo.numreliable++];
+}
+
+/*
+====================
+SV_DemoDatagram
+
+Unreliable messages for the demo, or NULL when not recording
+====================
+*/
+sizebuf_t *
+SV_DemoDatagram(void)
+{
+    if (!SV_DemoActive() || sv_demo.resync)
+	return NULL;
+
+    return &sv_demo.datagram;
+}
+
+/*
+====================
+SV_DemoTrack
+
+Keeps following the same player while it stays in the game
+====================
+*/
+static void
+SV_DemoTrack(void)
+{
+    client_t *cl;
+    int i;
+
+    if (sv_demo.track >= 0) {
+	cl = &svs.clients[sv_demo.track];
+	if (cl->state == cs_spawned && !cl->spectator)
+	    return;
+    }
+
+    sv_demo.track = -1;
+    for (i = 0, cl = svs.clients; i < MAX_CLIENTS; i++, cl++) {
+	if (cl->state == cs_spawned && !cl->spectator) {
+	    sv_demo.track = i;
+	    return;
+	}
+    }
+}
+
+/*
+====================
+SV_DemoWriteStats
+
+Sends the followed player's stats as they change
+====================
+*/
+static void
+SV_DemoWriteStats(sizebuf_t *msg)
+{
+    int stats[MAX_CL_STATS];
+    int i;
+
+    SV_ClientStats(&sv_demo.client, stats);
+    for (i = 0; i < MAX_CL_STATS; i++) {
+	if (stats[i] == sv_demo.stats[i] && !sv_demo.allstats)
+	    continue;
+	sv_demo.stats[i] = stats[i];
+	if (stats[i] >= 0 && stats[i] <= 255) {
+	    MSG_WriteByte(msg, svc_updatestat);
+	    MSG_WriteByte(msg, i);
+	    MSG_WriteByte(msg, stats[i]);
+	} else {
+	    MSG_WriteByte(msg, svc_updatestatlong);
+	    MSG_WriteByte(msg, i);
+	    MSG_WriteLong(msg, stats[i]);
+	}
+    }
+    sv_demo.allstats = false;
+}
+
+/*
+====================
+SV_DemoWriteCamera
+
+The spectator's own player info, at the eye of the player it follows
+====================
+*/
+static void
+SV_DemoWriteCamera(sizebuf_t *msg)
+{
+    const edict_t *ent;
+    int i, pflags;
+
+    if (sv_demo.track < 0)
+	return;
+
+    ent = svs.clients[sv_demo.track].edict;
+    pflags = 0;
+    for (i = 0; i < 3; i++)
+	if (ent->v.velocity[i])
+	    pflags |= PF_VELOCITY1 << i;
+
+    MSG_WriteByte(msg, svc_playerinfo);
+    MSG_WriteByte(msg, sv_demo.playernum);
+    MSG_WriteShort(msg, pflags);
+    for (i = 0; i < 3; i++)
+	MSG_WriteCoord(msg, ent->v.origin[i]);
+    MSG_WriteByte(msg, 0);
+    for (i = 0; i < 3; i++)
+	if (pflags & (PF_VELOCITY1 << i))
+	    MSG_WriteShort(msg, ent->v.velocity[i]);
+}
+
+/*
+====================
+SV_DemoFrame
+
+Called at the end of each server frame to write out a demo frame when
+one is due
+====================
+*/
+void
+SV_DemoFrame(void)
+{
+    client_t *client = &sv_demo.client;
+    sizebuf_t msg;
+    byte msg_buf[MAX_MSGLEN];
+    const char *error;
+    int i, last;
+
+    SV_RelaySend();
+    if (!SV_DemoActive() || sv.state != ss_active)
+	return;
+
+    if (sv_demo.spawncount != svs.spawncount || sv_demo.resync) {
+	SV_DemoTrack();
+	SV_DemoWriteSignon(false);
+	SV_DemoFlush();
+	sv_demo.lasttime = realtime;
+	return;
+    }
+    if (sv_demofps.value > 0 && realtime - sv_demo.lasttime <
+	1.0 / sv_demofps.value)
+	return;
+    sv_demo.lasttime = realtime;
+
+    SV_DemoTrack();
+    if (sv_demo.relay >= 0 && sv_relaykeyframe.value > 0 &&
+	realtime - sv_demo.lastkeyframe >= sv_relaykeyframe.value)
+	sv_demo.keyframe = true;
+    if (sv_demo.keyframe)
+	SV_DemoWriteSignon(true);
+
+    client->edict = sv.edicts;
+    client->spec_track = sv_demo.track + 1;
+
+    // reliables that won't fit with the frame go out on their own first
+    last = sv_demo.numreliable - 1;
+    for (i = 0; i < last; i++)
+	SV_DemoWritePacket(&sv_demo.reliable[i]);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.data = msg_buf;
+    msg.maxsize = sizeof(msg_buf);
+    msg.allowoverflow = true;
+
+    SZ_Write(&msg, sv_demo.reliable[last].data, sv_demo.reliable[last].cursize);
+    SV_DemoWriteStats(&msg);
+    client->netchan.incoming_sequence = sv_demo.sequence + 1;
+    error = SV_WriteEntitiesToClient(client, sv.pvs[0], &msg);
+    if (error)
+	SV_Error("%s", error);
+    SV_DemoWriteCamera(&msg);
+    if (!sv_demo.datagram.overflowed &&
+	msg.cursize + sv_demo.datagram.cursize <= msg.maxsize)
+	SZ_Write(&msg, sv_demo.datagram.data, sv_demo.datagram.cursize);
+
+    if (msg.overflowed) {
+	// the entities are lost, but the reliables mustn't be
+	SZ_Clear(&msg);
+	SZ_Write(&msg, sv_demo.reliable[last].data,
+		 sv_demo.reliable[last].cursize);
+	sv_demo.allstats = true;
+	SV_DemoWriteStats(&msg);
+	sv_demo.resync = msg.overflowed;
+	Con_DPrintf("demo frame overflowed, entities dropped\n");
+    }
+    SV_DemoWritePacket(&msg);
+    SV_DemoFlush();
+    SV_DemoClearMessages();
+}
+
+/*
+====================
+SV_DemoStart
+
+Takes on the spectator slot and starts the stream, or has a sink join the
+stream already going at its next signon
+====================
+*/
+static qboolean
+SV_DemoStart(void)
+{
+    int i;
+
+    if (SV_DemoActive()) {
+	sv_demo.keyframe = true;
+	return true;
+    }
+
+    // the spectator takes the last slot to be given out
+    for (i = MAX_CLIENTS - 1; i >= 0; i--)
+	if (svs.clients[i].state == cs_free)
+	    break;
+    if (i < 0) {
+	Con_Printf("No free slot for the demo spectator.\n");
+	return false;
+    }
+
+    sv_demo.playernum = i;
+    sv_demo.track = -1;
+    sv_demo.sequence = 0;
+    sv_demo.spawncount = -1;	// the signon goes out on the next frame
+    SV_DemoClearMessages();
+
+    return true;
+}
+
+/*
+====================
+SV_DemoStop
+====================
+*/
+void
+SV_DemoStop(void)
+{
+    if (!sv_demo.file)
+	return;
+
+    SV_DemoFlush();
+    fclose(sv_demo.file);
+    sv_demo.file = NULL;
+    Con_Printf("Completed demo %s\n", sv_demo.name);
+}
+
+static void
+SV_DemoStop_f(void)
+{
+    if (!sv_demo.file) {
+	Con_Printf("Not recording a demo.\n");
+	return;
+    }
+    SV_DemoStop();
+}
+
+/*
+====================
+SV_DemoRecord_f
+
+record <demoname>
+====================
+*/
+static void
+SV_DemoRecord_f(void)
+{
+    char name[MAX_OSPATH];
+    FILE *f;
+
+    if (Cmd_Argc() != 2) {
+	Con_Printf("record <demoname>\n");
+	return;
+    }
+    if (sv.state != ss_active) {
+	Con_Printf("Not running a map.\n");
+	return;
+    }
+    if (strstr(Cmd_Argv(1), "..")) {
+	Con_Printf("Relative pathnames are not allowed.\n");
+	return;
+    }
+    if (snprintf(name, sizeof(name) - 4, "%s/%s", com_gamedir, Cmd_Argv(1))
+	>= sizeof(name) - 4) {
+	Con_Printf("Demo name too long.\n");
+	return;
+    }
+    COM_DefaultExtension(name, ".qwd");
+
+    SV_DemoStop();
+    if (!SV_DemoStart())
+	return;
+    f = fopen(name, "wb");
+    if (!f) {
+	Con_Printf("ERROR: couldn't open %s.\n", name);
+	return;
+    }
+    sv_demo.file = f;
+    sv_demo.filestarted = false;
+    snprintf(sv_demo.name, sizeof(sv_demo.name), "%s", name);
+    Con_Printf("Recording to %s.\n", name);
+    SV_DemoFrame();
+}
+
+/*
+====================
+SV_Relay_f
+
+relay <address:port> sends the demo stream to a relay, relay alone stops
+====================
+*/
+static void
+SV_Relay_f(void)
+{
+    static const char hello[] = "QWRELAY SOURCE\n";
+    netadr_t addr;
+    int s;
+
+    if (Cmd_Argc() == 1 && sv_demo.relay >= 0) {
+	SV_RelayClose("closed");
+	return;
+    }
+    if (Cmd_Argc() != 2) {
+	Con_Printf("relay <address:port> : stream to a spectator relay\n");
+	return;
+    }
+    if (sv.state != ss_active) {
+	Con_Printf("Not running a map.\n");
+	return;
+    }
+    if (!NET_StringToAdr(Cmd_Argv(1), &addr) || !addr.port) {
+	Con_Printf("Bad relay address %s\n", Cmd_Argv(1));
+	return;
+    }
+
+    SV_RelayClose("closed");
+    if (!SV_DemoStart())
+	return;
+    s = NET_StreamOpen(addr);
+    if (s < 0)
+	return;
+    sv_demo.relay = s;
+    sv_demo.relayaddr = addr;
+    sv_demo.relaystarted = false;
+    sv_demo.relayhead = sv_demo.relaytail = 0;
+    SV_RelayQueue(hello, sizeof(hello) - 1);
+    Con_Printf("Relaying to %s\n", NET_AdrToString(addr));
+    SV_DemoFrame();
+}
+
+void
+SV_DemoInit(void)
+{
+    int i;
+
+    for (i = 0; i < SV_DEMO_CHUNKS; i++) {
+	sv_demo.reliable[i].data = sv_demo.reliable_buf[i];
+	sv_demo.reliable[i].maxsize = sizeof(sv_demo.reliable_buf[i]);
+    }
+    sv_demo.datagram.data = sv_demo.datagram_buf;
+    sv_demo.datagram.maxsize = sizeof(sv_demo.datagram_buf);
+    sv_demo.datagram.allowoverflow = true;
+    sv_demo.out.data = sv_demo.out_buf;
+    sv_demo.out.maxsize = sizeof(sv_demo.out_buf);
+
+    // a spectator that sees everything through the world entity
+    sv_demo.client.spectator = true;
+    sv_demo.client.delta_sequence = -1;
+
+    Cvar_RegisterVariable(&sv_demofps);
+    Cvar_RegisterVariable(&sv_relaykeyframe);
+    Cmd_AddCommand("record", SV_DemoRecord_f);
+    Cmd_AddCommand("stop", SV_DemoStop_f);
+    Cmd_AddCommand("relay", SV_Relay_f);
+}
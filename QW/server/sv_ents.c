@@ -19,6 +19,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "bspfile.h"
+#include "jobs.h"
 #include "model.h"
 #include "qwsvdef.h"
 #include "server.h"
@@ -26,60 +27,109 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 // because there can be a lot of nails, there is a special
 // network protocol for them
+// (per thread, clients' packets can be built on several at once)
 #define	MAX_NAILS	32
-edict_t *nails[MAX_NAILS];
-int numnails;
+static THREAD_LOCAL edict_t *nails[MAX_NAILS];
+static THREAD_LOCAL int numnails;
+
+// the models in sv_projectiles go the same way, with their model index,
+// to clients that understand svc_projectiles
+#define	MAX_PROJECTILES	32
+static THREAD_LOCAL edict_t *projectiles[MAX_PROJECTILES];
+static THREAD_LOCAL int numprojectiles;
 
 qboolean
-SV_AddNailUpdate(edict_t *ent)
+SV_AddNailUpdate(client_t *client, edict_t *ent)
 {
-    if (ent->v.modelindex != sv_nailmodel
-	&& ent->v.modelindex != sv_supernailmodel)
-	return false;
-    if (numnails == MAX_NAILS)
+    if (ent->v.modelindex == sv_nailmodel
+	|| ent->v.modelindex == sv_supernailmodel) {
+	if (numnails == MAX_NAILS)
+	    return true;
+	nails[numnails] = ent;
+	numnails++;
 	return true;
-    nails[numnails] = ent;
-    numnails++;
+    }
+
+    // the compact update only has room for the position and facing
+    if (!client->projectiles || !sv_projectilemodels[(int)ent->v.modelindex])
+	return false;
+    if (ent->v.frame || ent->v.skin || ent->v.effects)
+	return false;
+    if (numprojectiles == MAX_PROJECTILES)
+	return false;		// send the rest as packet entities
+    projectiles[numprojectiles] = ent;
+    numprojectiles++;
     return true;
 }
 
-void
-SV_EmitNailUpdate(sizebuf_t *msg)
+static void
+SV_WriteNailBits(sizebuf_t *msg, const edict_t *ent)
 {
     byte bits[6];		// [48 bits] xyzpy 12 12 12 4 8
-    int n, i;
-    edict_t *ent;
     int x, y, z, p, yaw;
+    int i;
 
-    if (!numnails)
-	return;
-
-    MSG_WriteByte(msg, svc_nails);
-    MSG_WriteByte(msg, numnails);
-
-    for (n = 0; n < numnails; n++) {
-	ent = nails[n];
-	x = (int)(ent->v.origin[0] + 4096) >> 1;
-	y = (int)(ent->v.origin[1] + 4096) >> 1;
-	z = (int)(ent->v.origin[2] + 4096) >> 1;
-	p = (int)(16 * ent->v.angles[0] / 360) & 15;
-	yaw = (int)(256 * ent->v.angles[1] / 360) & 255;
-
-	bits[0] = x;
-	bits[1] = (x >> 8) | (y << 4);
-	bits[2] = (y >> 4);
-	bits[3] = z;
-	bits[4] = (z >> 8) | (p << 4);
-	bits[5] = yaw;
-
-	for (i = 0; i < 6; i++)
-	    MSG_WriteByte(msg, bits[i]);
+    x = (int)(ent->v.origin[0] + 4096) >> 1;
+    y = (int)(ent->v.origin[1] + 4096) >> 1;
+    z = (int)(ent->v.origin[2] + 4096) >> 1;
+    p = (int)(16 * ent->v.angles[0] / 360) & 15;
+    yaw = (int)(256 * ent->v.angles[1] / 360) & 255;
+
+    bits[0] = x;
+    bits[1] = (x >> 8) | (y << 4);
+    bits[2] = (y >> 4);
+    bits[3] = z;
+    bits[4] = (z >> 8) | (p << 4);
+    bits[5] = yaw;
+
+    for (i = 0; i < 6; i++)
+	MSG_WriteByte(msg, bits[i]);
+}
+
+void
+SV_EmitNailUpdate(sizebuf_t *msg)
+{
+    int n;
+
+    if (numnails) {
+	MSG_WriteByte(msg, svc_nails);
+	MSG_WriteByte(msg, numnails);
+	for (n = 0; n < numnails; n++)
+	    SV_WriteNailBits(msg, nails[n]);
+    }
+
+    if (numprojectiles) {
+	MSG_WriteByte(msg, svc_projectiles);
+	MSG_WriteByte(msg, numprojectiles);
+	for (n = 0; n < numprojectiles; n++) {
+	    MSG_WriteByte(msg, projectiles[n]->v.modelindex);
+	    SV_WriteNailBits(msg, projectiles[n]);
+	}
     }
 }
 
 //=============================================================================
 
 
+/*
+ * The values as MSG_WriteCoord and MSG_WriteAngle put them on the wire.
+ * Fields are compared by these, so a change the client can't see costs
+ * nothing and one it can see is never dropped.
+ */
+static inline int
+SV_WireCoord(float f)
+{
+    return (int)(f * (1 << 3));
+}
+
+static inline int
+SV_WireAngle(float f)
+{
+    return (int)floorf((f * 256 / 360) + 0.5f) & 255;
+}
+
+#define SV_MAXDELTA 17	// number and bits, then every field
+
 /*
 ==================
 SV_WriteDelta
@@ -94,24 +144,23 @@ SV_WriteDelta(entity_state_t *from, entity_state_t *to, sizebuf_t *msg,
 {
     int bits;
     int i;
-    float miss;
+    byte *p;
 
 // send an update
     bits = 0;
 
     for (i = 0; i < 3; i++) {
-	miss = to->origin[i] - from->origin[i];
-	if (miss < -0.1 || miss > 0.1)
+	if (SV_WireCoord(to->origin[i]) != SV_WireCoord(from->origin[i]))
 	    bits |= U_ORIGIN1 << i;
     }
 
-    if (to->angles[0] != from->angles[0])
+    if (SV_WireAngle(to->angles[0]) != SV_WireAngle(from->angles[0]))
 	bits |= U_ANGLE1;
 
-    if (to->angles[1] != from->angles[1])
+    if (SV_WireAngle(to->angles[1]) != SV_WireAngle(from->angles[1]))
 	bits |= U_ANGLE2;
 
-    if (to->angles[2] != from->angles[2])
+    if (SV_WireAngle(to->angles[2]) != SV_WireAngle(from->angles[2]))
 	bits |= U_ANGLE3;
 
     if (to->colormap != from->colormap)
@@ -140,7 +189,7 @@ SV_WriteDelta(entity_state_t *from, entity_state_t *to, sizebuf_t *msg,
     //
     if (!to->number)
 	SV_Error("Unset entity number");
-    if (to->number >= 512)
+    if (to->number >= MAX_PACKET_ENTNUM)
 	SV_Error("Entity number >= 512");
 
     if (!bits && !force)
@@ -148,32 +197,34 @@ SV_WriteDelta(entity_state_t *from, entity_state_t *to, sizebuf_t *msg,
     i = to->number | (bits & ~511);
     if (i & U_REMOVE)
 	Sys_Error("%s: U_REMOVE", __func__);
-    MSG_WriteShort(msg, i);
+    p = SZ_Reserve(msg, SV_MAXDELTA);
+    p = MSG_PutShort(p, i);
 
     if (bits & U_MOREBITS)
-	MSG_WriteByte(msg, bits & 255);
+	p = MSG_PutByte(p, bits & 255);
     if (bits & U_MODEL)
-	MSG_WriteByte(msg, to->modelindex);
+	p = MSG_PutByte(p, to->modelindex);
     if (bits & U_FRAME)
-	MSG_WriteByte(msg, to->frame);
+	p = MSG_PutByte(p, to->frame);
     if (bits & U_COLORMAP)
-	MSG_WriteByte(msg, to->colormap);
+	p = MSG_PutByte(p, to->colormap);
     if (bits & U_SKIN)
-	MSG_WriteByte(msg, to->skinnum);
+	p = MSG_PutByte(p, to->skinnum);
     if (bits & U_EFFECTS)
-	MSG_WriteByte(msg, to->effects);
+	p = MSG_PutByte(p, to->effects);
     if (bits & U_ORIGIN1)
-	MSG_WriteCoord(msg, to->origin[0]);
+	p = MSG_PutCoord(p, to->origin[0]);
     if (bits & U_ANGLE1)
-	MSG_WriteAngle(msg, to->angles[0]);
+	p = MSG_PutAngle(p, to->angles[0]);
     if (bits & U_ORIGIN2)
-	MSG_WriteCoord(msg, to->origin[1]);
+	p = MSG_PutCoord(p, to->origin[1]);
     if (bits & U_ANGLE2)
-	MSG_WriteAngle(msg, to->angles[1]);
+	p = MSG_PutAngle(p, to->angles[1]);
     if (bits & U_ORIGIN3)
-	MSG_WriteCoord(msg, to->origin[2]);
+	p = MSG_PutCoord(p, to->origin[2]);
     if (bits & U_ANGLE3)
-	MSG_WriteAngle(msg, to->angles[2]);
+	p = MSG_PutAngle(p, to->angles[2]);
+    SZ_Commit(msg, p);
 }
 
 /*
@@ -363,35 +414,91 @@ SV_WritePlayersToClient(client_t *client, edict_t *clent,
 }
 
 
+/*
+ * When more entities are visible than fit in a packet, sv_entpriority
+ * picks the ones to send rather than taking the lowest numbered. Nearer
+ * entities score higher, and each packet an entity is left out of adds
+ * to its score, so the far ones still get through every few packets
+ * instead of never. Distance is to the middle of the bounds, as brush
+ * models keep their origin at the world's.
+ */
+typedef struct {
+    float score;
+    int number;
+} entcandidate_t;
+
+static int
+SV_CompareCandidates(const void *a, const void *b)
+{
+    const entcandidate_t *ca = a, *cb = b;
+
+    if (ca->score != cb->score)
+	return ca->score < cb->score ? 1 : -1;
+    return ca->number - cb->number;
+}
+
+static int
+SV_CompareNumbers(const void *a, const void *b)
+{
+    return ((const entcandidate_t *)a)->number -
+	((const entcandidate_t *)b)->number;
+}
+
+static void
+SV_PrioritizeEntities(const client_t *client, entcandidate_t *cands,
+		      int count)
+{
+    const edict_t *clent = client->edict;
+    const edict_t *ent;
+    vec3_t org, mid;
+    int i, e, age;
+
+    VectorAdd(clent->v.origin, clent->v.view_ofs, org);
+    for (i = 0; i < count; i++) {
+	e = cands[i].number;
+	ent = EDICT_NUM(e);
+	age = e < MAX_PACKET_ENTNUM ? client->netchan.outgoing_sequence
+	    - client->entsent[e] : 1;
+	age = qclamp(age, 1, UPDATE_BACKUP);
+	VectorAdd(ent->v.absmin, ent->v.absmax, mid);
+	VectorMA(org, -0.5f, mid, mid);
+	cands[i].score = age / (64.0f + Length(mid));
+    }
+
+    // best MAX_PACKET_ENTITIES first, then back in order for the delta
+    qsort(cands, count, sizeof(*cands), SV_CompareCandidates);
+    qsort(cands, MAX_PACKET_ENTITIES, sizeof(*cands), SV_CompareNumbers);
+}
+
 /*
 =============
 SV_WriteEntitiesToClient
 
 Encodes the current state of the world as
 a svc_packetentities messages and possibly
-a svc_nails message and
+a svc_nails message, a svc_projectiles message and
 svc_playerinfo messages
+
+Pvs is the client's fat PVS. Only reads the world and writes to the
+client's own frame, so clients can be done on worker threads at the same
+time. Returns NULL, or an error for the caller to raise.
 =============
 */
-void
-SV_WriteEntitiesToClient(client_t *client, sizebuf_t *msg)
+const char *
+SV_WriteEntitiesToClient(client_t *client, const leafbits_t *pvs,
+			 sizebuf_t *msg)
 {
-    int e, i;
-    const leafbits_t *pvs;
-    vec3_t org;
+    int e, i, count;
     edict_t *ent;
     packet_entities_t *pack;
     edict_t *clent;
     client_frame_t *frame;
     entity_state_t *state;
+    entcandidate_t cands[MAX_EDICTS];
 
     // this is the frame we are creating
     frame = &client->frames[client->netchan.incoming_sequence & UPDATE_MASK];
-
-    // find the client's PVS
     clent = client->edict;
-    VectorAdd(clent->v.origin, clent->v.view_ofs, org);
-    pvs = Mod_FatPVS(sv.worldmodel, org);
 
     // send over the players in the PVS
     SV_WritePlayersToClient(client, clent, pvs, msg);
@@ -401,7 +508,9 @@ SV_WriteEntitiesToClient(client_t *client, sizebuf_t *msg)
     pack->num_entities = 0;
 
     numnails = 0;
+    numprojectiles = 0;
 
+    count = 0;
     for (e = MAX_CLIENTS + 1, ent = EDICT_NUM(e); e < sv.num_edicts;
 	 e++, ent = NEXT_EDICT(ent)) {
 	// ignore ents without visible models
@@ -416,12 +525,27 @@ SV_WriteEntitiesToClient(client_t *client, sizebuf_t *msg)
 	if (i == ent->num_leafs)
 	    continue;		// not visible
 
-	if (SV_AddNailUpdate(ent))
+	if (SV_AddNailUpdate(client, ent))
 	    continue;		// added to the special update list
 
 	// add to the packetentities
-	if (pack->num_entities == MAX_PACKET_ENTITIES)
+	if (count == MAX_PACKET_ENTITIES && !sv_entpriority.value)
 	    continue;		// all full
+	cands[count++].number = e;
+    }
+    if (count > MAX_PACKET_ENTITIES) {
+	SV_PrioritizeEntities(client, cands, count);
+	count = MAX_PACKET_ENTITIES;
+    }
+
+    for (i = 0; i < count; i++) {
+	e = cands[i].number;
+	ent = EDICT_NUM(e);
+
+	// SV_WriteDelta would SV_Error on it, not safe off the main thread
+	if (e >= MAX_PACKET_ENTNUM)
+	    return "Entity number >= 512";
+	client->entsent[e] = client->netchan.outgoing_sequence;
 
 	state = &pack->entities[pack->num_entities];
 	pack->num_entities++;
@@ -444,4 +568,6 @@ SV_WriteEntitiesToClient(client_t *client, sizebuf_t *msg)
 
     // now add the specialized nail update
     SV_EmitNailUpdate(msg);
+
+    return NULL;
 }
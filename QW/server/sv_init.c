@@ -20,9 +20,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "console.h"
 #include "crc.h"
+#include "jobs.h"
 #include "model.h"
 #include "qwsvdef.h"
 #include "server.h"
+#include "sys.h"
 #include "world.h"
 
 server_static_t svs;		// persistant server info
@@ -46,10 +48,8 @@ SV_ModelIndex(const char *name)
     if (!name || !name[0])
 	return 0;
 
-    for (i = 0; i < MAX_MODELS && sv.model_precache[i]; i++)
-	if (!strcmp(sv.model_precache[i], name))
-	    return i;
-    if (i == MAX_MODELS || !sv.model_precache[i])
+    i = PR_FindPrecache(&sv.model_hash, sv.model_precache, name);
+    if (i < 0)
 	SV_Error("SV_ModelIndex: model %s not precached", name);
     return i;
 }
@@ -177,6 +177,139 @@ SV_SaveSpawnparms(void)
     }
 }
 
+/*
+ * The PHS of a map is saved in the game directory as maps/<map>.phs, so it
+ * only has to be built the first time the map is run. The rows are stored
+ * as they are in memory, so the file is only used by a build with the same
+ * leafbits layout and byte order, on a map with the same checksums.
+ */
+#define PHS_CACHE_ID	(('S' << 24) + ('H' << 16) + ('P' << 8) + 'Q')
+#define PHS_CACHE_VERSION 1
+#define PHS_BYTE_ORDER	0x01020304
+
+typedef struct {
+    int id;
+    int version;
+    int byteorder;
+    unsigned checksum;
+    unsigned checksum2;
+    int numleafs;
+    int leafmem;
+} phscache_t;
+
+/* Rows ORed together between progress reports */
+#define PHS_PROGRESS_ROWS 1024
+
+static job_t sv_phs_jobs[JOB_MAX_SPLIT(MAX_JOB_THREADS)];
+
+static void
+SV_PHSCacheHeader(phscache_t *header, int leafmem)
+{
+    header->id = PHS_CACHE_ID;
+    header->version = PHS_CACHE_VERSION;
+    header->byteorder = PHS_BYTE_ORDER;
+    header->checksum = sv.worldmodel->checksum;
+    header->checksum2 = sv.worldmodel->checksum2;
+    header->numleafs = sv.worldmodel->numleafs;
+    header->leafmem = leafmem;
+}
+
+/*
+================
+SV_LoadPHSCache
+
+Reads the PHS rows from the cache file, if it matches the current map
+================
+*/
+static qboolean
+SV_LoadPHSCache(int leafmem)
+{
+    phscache_t header, check;
+    char name[MAX_OSPATH];
+    qboolean ok;
+    FILE *f;
+
+    snprintf(name, sizeof(name), "%s/maps/%s.phs", com_gamedir, sv.name);
+    f = fopen(name, "rb");
+    if (!f)
+	return false;
+
+    SV_PHSCacheHeader(&check, leafmem);
+    ok = fread(&header, sizeof(header), 1, f) == 1
+	&& !memcmp(&header, &check, sizeof(header))
+	&& fread(sv.phs[0], leafmem, sv.worldmodel->numleafs, f)
+	== sv.worldmodel->numleafs;
+    fclose(f);
+
+    return ok;
+}
+
+/*
+================
+SV_SavePHSCache
+================
+*/
+static void
+SV_SavePHSCache(int leafmem)
+{
+    phscache_t header;
+    char name[MAX_OSPATH];
+    qboolean ok;
+    FILE *f;
+
+    snprintf(name, sizeof(name), "%s/maps/%s.phs", com_gamedir, sv.name);
+    COM_CreatePath(name);
+    f = fopen(name, "wb");
+    if (!f) {
+	Con_Printf("Couldn't write %s\n", name);
+	return;
+    }
+
+    SV_PHSCacheHeader(&header, leafmem);
+    ok = fwrite(&header, sizeof(header), 1, f) == 1
+	&& fwrite(sv.phs[0], leafmem, sv.worldmodel->numleafs, f)
+	== sv.worldmodel->numleafs;
+    if (fclose(f) || !ok) {
+	Con_Printf("Couldn't write %s\n", name);
+	remove(name);
+    }
+}
+
+/*
+================
+SV_BuildPHSRows
+
+OR each visible pvs row into the phs. Only reads sv.pvs and each job writes
+its own rows, so the rows can be built on any thread.
+================
+*/
+static const char *
+SV_BuildPHSRows(void *data, int start, int end)
+{
+    int numleafs = sv.worldmodel->numleafs;
+    int leafmem = *(const int *)data;
+    int i, leafnum;
+    leafbits_t *pvs, *phs;
+    leafblock_t check;
+
+    for (i = start; i < end; i++) {
+	pvs = sv.pvs[i];
+	phs = sv.phs[i];
+	memcpy(phs, pvs, leafmem);
+	if (!i)
+	    continue;
+
+	foreach_leafbit(pvs, leafnum, check) {
+	    /* index is +1 because pvs is 1 based */
+	    if (leafnum + 1 >= numleafs)
+		continue;
+	    Mod_AddLeafBits(phs, sv.pvs[leafnum + 1]);
+	}
+    }
+
+    return NULL;
+}
+
 /*
 ================
 SV_CalcPHS
@@ -189,13 +322,11 @@ void
 SV_CalcPHS(void)
 {
     int numleafs, leafmem;
-    int i, leafnum;
+    int i, row, rows, numjobs;
     int vcount, hcount;
     const leafbits_t *leafbits;
-    leafbits_t *pvs, *phs;
-    leafblock_t check;
-
-    Con_Printf("Building PHS...\n");
+    leafbits_t *pvs;
+    double start, report;
 
     numleafs = sv.worldmodel->numleafs;
     leafmem = Mod_LeafbitsSize(sv.worldmodel->numleafs);
@@ -211,6 +342,7 @@ SV_CalcPHS(void)
 	sv.phs[i] = (leafbits_t *)((byte *)sv.phs + offset);
     }
 
+    /* Mod_LeafPVS caches its rows, so this has to stay on this thread */
     vcount = 0;
     for (i = 0; i < numleafs; i++) {
 	pvs = sv.pvs[i];
@@ -222,27 +354,43 @@ SV_CalcPHS(void)
 	vcount += Mod_CountLeafBits(pvs);
     }
 
-    hcount = 0;
-    for (i = 0; i < numleafs; i++) {
-	pvs = sv.pvs[i];
-	phs = sv.phs[i];
-	memcpy(phs, pvs, leafmem);
-	if (!i)
-	    continue;
-
-	foreach_leafbit(pvs, leafnum, check) {
-	    /*
-	     * OR each visible pvs row into the phs
-	     * index is +1 because pvs is 1 based
-	     */
-	    if (leafnum + 1 >= numleafs)
-		continue;
-	    leafbits = sv.pvs[leafnum + 1];
-	    Mod_AddLeafBits(phs, leafbits);
+    if (sv_phscache.value && SV_LoadPHSCache(leafmem)) {
+	Con_Printf("Loaded PHS from maps/%s.phs\n", sv.name);
+    } else {
+	Con_Printf("Building PHS...\n");
+
+	/*
+	 * Rows are built a section at a time across the job threads, with
+	 * the progress reported in between on slow builds.
+	 */
+	start = report = Sys_DoubleTime();
+	for (row = 0; row < numleafs; row += rows) {
+	    rows = qmin(numleafs - row, PHS_PROGRESS_ROWS);
+	    numjobs = Job_Split(sv_phs_jobs, 0,
+				sizeof(sv_phs_jobs) / sizeof(job_t),
+				SV_BuildPHSRows, &leafmem, rows, 16);
+	    for (i = 0; i < numjobs; i++) {
+		sv_phs_jobs[i].start += row;
+		sv_phs_jobs[i].end += row;
+	    }
+	    Job_RunBatch(sv_phs_jobs, numjobs);
+
+	    if (Sys_DoubleTime() - report > 1.0) {
+		report = Sys_DoubleTime();
+		Con_Printf("  %i%% of %i leafs\n",
+			   (row + rows) * 100 / numleafs, numleafs);
+	    }
 	}
-	hcount += Mod_CountLeafBits(phs);
+	Con_DPrintf("PHS built in %.2f seconds\n", Sys_DoubleTime() - start);
+
+	if (sv_phscache.value)
+	    SV_SavePHSCache(leafmem);
     }
 
+    hcount = 0;
+    for (i = 1; i < numleafs; i++)
+	hcount += Mod_CountLeafBits(sv.phs[i]);
+
     Con_Printf("Average leafs visible / hearable / total: %i / %i / %i\n",
 	       vcount / numleafs, hcount / numleafs, numleafs);
 }
@@ -312,6 +460,7 @@ SV_SpawnServer(const char *server)
 
     // load progs to get entity field count
     // which determines how big each edict is
+    Memory_TracePhase("progs");
     PR_LoadProgs();
 
     // allocate edicts
@@ -319,6 +468,7 @@ SV_SpawnServer(const char *server)
 
     // leave slots at start for clients only
     sv.num_edicts = MAX_CLIENTS + 1;
+    ED_ResetEdicts();
     for (i = 0; i < MAX_CLIENTS; i++) {
 	ent = EDICT_NUM(i + 1);
 	svs.clients[i].edict = ent;
@@ -330,6 +480,7 @@ SV_SpawnServer(const char *server)
 
     strcpy(sv.name, server);
     sprintf(sv.modelname, "maps/%s.bsp", server);
+    Memory_TracePhase("models");
     sv.worldmodel = Mod_ForName(sv.modelname, true);
     SV_CalcPHS();
 
@@ -338,13 +489,13 @@ SV_SpawnServer(const char *server)
     //
     SV_ClearWorld();
 
-    sv.sound_precache[0] = pr_strings;
+    PR_AddPrecache(&sv.sound_hash, sv.sound_precache, 0, pr_strings);
 
-    sv.model_precache[0] = pr_strings;
-    sv.model_precache[1] = sv.modelname;
+    PR_AddPrecache(&sv.model_hash, sv.model_precache, 0, pr_strings);
+    PR_AddPrecache(&sv.model_hash, sv.model_precache, 1, sv.modelname);
     sv.models[1] = sv.worldmodel;
     for (i = 1; i < sv.worldmodel->numsubmodels; i++) {
-	sv.model_precache[1 + i] = localmodels[i];
+	PR_AddPrecache(&sv.model_hash, sv.model_precache, 1 + i, localmodels[i]);
 	sv.models[i + 1] = Mod_ForName(localmodels[i], false);
     }
 
@@ -375,6 +526,7 @@ SV_SpawnServer(const char *server)
     SV_ProgStartFrame();
 
     // load and spawn all other entities
+    Memory_TracePhase("entities");
     ED_LoadFromFile(sv.worldmodel->entities);
 
     // look up some model indexes for specialized message compression
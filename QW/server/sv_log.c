@@ -0,0 +1,300 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_log.c -- the console and frag logs, written out away from the frame
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_THREADS
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+
+#include "console.h"
+#include "qwsvdef.h"
+#include "server.h"
+#include "sys.h"
+
+/*
+ * With threads, each log queues its text in a ring that one writer thread
+ * drains, so a slow disk only ever holds up the writer. The frame only
+ * takes the lock to copy text in; when the ring is full the text is
+ * counted as dropped rather than waited on.
+ */
+#define SV_LOG_BUFSIZE	262144	// power of two
+#define SV_LOG_FLUSH	1.0	// seconds between flushes while busy
+
+struct svlog_s {
+    FILE *file;
+#ifdef HAVE_THREADS
+    char buf[SV_LOG_BUFSIZE];
+    unsigned head;		// bytes queued, the writer is at tail
+    unsigned tail;
+    int dropped;		// bytes lost to a full ring since the last write
+    qboolean closing;		// close once it's drained
+    qboolean dirty;		// written since the last flush
+    struct svlog_s *next;
+#endif
+};
+
+svlog_t *sv_logfile;
+svlog_t *sv_fraglogfile;
+
+#ifdef HAVE_THREADS
+static pthread_mutex_t sv_loglock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sv_logwake = PTHREAD_COND_INITIALIZER;
+static pthread_t sv_logthread;
+static qboolean sv_logrunning;
+
+/* All protected by sv_loglock */
+static svlog_t *sv_logs;
+static qboolean sv_logquit;
+
+/*
+ * Copies text into the ring, called with the lock held and the space free
+ */
+static void
+SV_LogQueue(svlog_t *log, const char *text, int len)
+{
+    int start, first;
+
+    start = log->head & (SV_LOG_BUFSIZE - 1);
+    first = qmin(len, SV_LOG_BUFSIZE - start);
+    memcpy(log->buf + start, text, first);
+    memcpy(log->buf, text + first, len - first);
+    log->head += len;
+}
+
+/*
+ * Writes out what's queued in one log. Called and returns with the lock
+ * held, but drops it around the file I/O.
+ */
+static qboolean
+SV_LogDrain(svlog_t *log)
+{
+    int start, len;
+
+    if (log->head == log->tail)
+	return false;
+
+    start = log->tail & (SV_LOG_BUFSIZE - 1);
+    len = qmin(log->head - log->tail, (unsigned)(SV_LOG_BUFSIZE - start));
+    pthread_mutex_unlock(&sv_loglock);
+    fwrite(log->buf + start, 1, len, log->file);
+    pthread_mutex_lock(&sv_loglock);
+    log->tail += len;
+    log->dirty = true;
+
+    return true;
+}
+
+static void *
+SV_LogThread(void *arg)
+{
+    svlog_t *log, **prev;
+    double lastflush;
+    struct timespec deadline;
+    struct timeval now;
+    qboolean busy;
+
+    lastflush = Sys_DoubleTime();
+    pthread_mutex_lock(&sv_loglock);
+    while (1) {
+	busy = false;
+	for (log = sv_logs; log; log = log->next)
+	    busy |= SV_LogDrain(log);
+
+	/* close the drained logs that were let go */
+	prev = &sv_logs;
+	while ((log = *prev)) {
+	    if (log->head != log->tail || !(log->closing || sv_logquit)) {
+		prev = &log->next;
+		continue;
+	    }
+	    *prev = log->next;
+	    pthread_mutex_unlock(&sv_loglock);
+	    fclose(log->file);
+	    free(log);
+	    pthread_mutex_lock(&sv_loglock);
+	}
+
+	if (sv_logquit && !sv_logs)
+	    break;
+
+	/* flush now and then, however busy, and when it goes quiet */
+	if (!busy || Sys_DoubleTime() - lastflush > SV_LOG_FLUSH) {
+	    for (log = sv_logs; log; log = log->next) {
+		if (!log->dirty)
+		    continue;
+		log->dirty = false;
+		pthread_mutex_unlock(&sv_loglock);
+		fflush(log->file);
+		pthread_mutex_lock(&sv_loglock);
+	    }
+	    lastflush = Sys_DoubleTime();
+	}
+	if (busy)
+	    continue;
+
+	gettimeofday(&now, NULL);
+	deadline.tv_sec = now.tv_sec + (time_t)SV_LOG_FLUSH;
+	deadline.tv_nsec = now.tv_usec * 1000;
+	while (!sv_logquit) {
+	    for (log = sv_logs; log; log = log->next)
+		if (log->head != log->tail || log->closing)
+		    break;
+	    if (log)
+		break;
+	    if (pthread_cond_timedwait(&sv_logwake, &sv_loglock, &deadline)
+		== ETIMEDOUT)
+		break;
+	}
+    }
+    pthread_mutex_unlock(&sv_loglock);
+
+    return NULL;
+}
+#endif /* HAVE_THREADS */
+
+/*
+================
+SV_LogOpen
+
+Takes over an open file to log to
+================
+*/
+svlog_t *
+SV_LogOpen(FILE *file)
+{
+    svlog_t *log;
+
+    log = calloc(1, sizeof(*log));
+    if (!log) {
+	fclose(file);
+	return NULL;
+    }
+    log->file = file;
+
+#ifdef HAVE_THREADS
+    if (!sv_logrunning) {
+	sv_logquit = false;
+	if (!pthread_create(&sv_logthread, NULL, SV_LogThread, NULL))
+	    sv_logrunning = true;
+	else
+	    Con_Printf("Couldn't start the log writer, logging directly\n");
+    }
+    if (sv_logrunning) {
+	pthread_mutex_lock(&sv_loglock);
+	log->next = sv_logs;
+	sv_logs = log;
+	pthread_mutex_unlock(&sv_loglock);
+    }
+#endif
+
+    return log;
+}
+
+/*
+================
+SV_LogWrite
+
+Never waits on the disk; with the ring full the text is dropped and a
+note of how much is left in the log when there's room again
+================
+*/
+void
+SV_LogWrite(svlog_t *log, const char *text)
+{
+#ifdef HAVE_THREADS
+    char note[64];
+    int len, notelen;
+
+    if (sv_logrunning) {
+	len = strlen(text);
+	pthread_mutex_lock(&sv_loglock);
+	notelen = 0;
+	if (log->dropped)
+	    notelen = snprintf(note, sizeof(note), "...%d bytes dropped...\n",
+			       log->dropped);
+	if (notelen + len <= SV_LOG_BUFSIZE - (log->head - log->tail)) {
+	    if (notelen)
+		SV_LogQueue(log, note, notelen);
+	    SV_LogQueue(log, text, len);
+	    log->dropped = 0;
+	    pthread_cond_signal(&sv_logwake);
+	} else
+	    log->dropped += len;
+	pthread_mutex_unlock(&sv_loglock);
+	return;
+    }
+#endif
+
+    fputs(text, log->file);
+}
+
+/*
+================
+SV_LogClose
+
+The writer closes the file once what's queued is out, so this doesn't
+wait for it either
+================
+*/
+void
+SV_LogClose(svlog_t *log)
+{
+#ifdef HAVE_THREADS
+    if (sv_logrunning) {
+	pthread_mutex_lock(&sv_loglock);
+	log->closing = true;
+	pthread_cond_signal(&sv_logwake);
+	pthread_mutex_unlock(&sv_loglock);
+	return;
+    }
+#endif
+
+    fclose(log->file);
+    free(log);
+}
+
+/*
+================
+SV_LogShutdown
+
+Waits for the writer to get everything out and close the files
+================
+*/
+void
+SV_LogShutdown(void)
+{
+#ifdef HAVE_THREADS
+    if (!sv_logrunning)
+	return;
+
+    pthread_mutex_lock(&sv_loglock);
+    sv_logquit = true;
+    pthread_cond_signal(&sv_logwake);
+    pthread_mutex_unlock(&sv_loglock);
+    pthread_join(sv_logthread, NULL);
+    sv_logrunning = false;
+#endif
+}
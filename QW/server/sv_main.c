@@ -20,12 +20,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "cmd.h"
 #include "console.h"
+#include "jobs.h"
 #include "model.h"
 #include "net.h"
 #include "pmove.h"
 #include "qwsvdef.h"
 #include "server.h"
 #include "sys.h"
+#include "world.h"
 #include "zone.h"
 
 quakeparms_t host_parms;
@@ -55,6 +57,8 @@ static cvar_t password = { "password", "" };	// for entering the game
 static cvar_t spectator_password = { "spectator_password", "" }; // for entering as a spectator
 
 cvar_t allow_download = { "allow_download", "1" };
+// base URL clients can fetch the same files from over HTTP instead
+static cvar_t sv_downloadurl = { "sv_downloadurl", "", false, true };
 cvar_t allow_download_skins = { "allow_download_skins", "1" };
 cvar_t allow_download_models = { "allow_download_models", "1" };
 cvar_t allow_download_sounds = { "allow_download_sounds", "1" };
@@ -62,6 +66,18 @@ cvar_t allow_download_maps = { "allow_download_maps", "1" };
 
 cvar_t sv_highchars = { "sv_highchars", "1" };
 cvar_t sv_phs = { "sv_phs", "1" };
+cvar_t sv_phscache = { "sv_phscache", "1" };	// keep each map's PHS in maps/<map>.phs
+
+// models sent compactly to clients that can take them; they lose their
+// frame, skin, roll and trails, so only list plain projectiles
+cvar_t sv_projectiles = { "sv_projectiles", "" };
+cvar_t sv_threads = { "sv_threads", "1" };	// build clients' packets in parallel
+cvar_t sv_entpriority = { "sv_entpriority", "1" };	// choose ents when too many
+cvar_t sv_antilag = { "sv_antilag", "0" };	// rewind players for tracelines
+cvar_t sv_antilag_max = { "sv_antilag_max", "0.3" };	// furthest rewind, secs
+static cvar_t sv_statuscache = { "sv_statuscache", "1" };	// secs to reuse status
+static cvar_t sv_queryrate = { "sv_queryrate", "10" };	// connectionless/sec per ip
+static cvar_t sv_queryburst = { "sv_queryburst", "20" };	// and how many at once
 cvar_t pausable = { "pausable", "1" };
 
 //
@@ -79,8 +95,6 @@ cvar_t watervis = { "watervis", "0", false, true };
 
 cvar_t hostname = { "hostname", "unnamed", false, true };
 
-FILE *sv_logfile;
-FILE *sv_fraglogfile;
 
 static void Master_Heartbeat(void);
 static void Master_Shutdown(void);
@@ -105,14 +119,18 @@ SV_Shutdown(void)
 {
     Master_Shutdown();
     if (sv_logfile) {
-	fclose(sv_logfile);
+	SV_LogClose(sv_logfile);
 	sv_logfile = NULL;
     }
     if (sv_fraglogfile) {
-	fclose(sv_fraglogfile);
-	sv_logfile = NULL;
+	SV_LogClose(sv_fraglogfile);
+	sv_fraglogfile = NULL;
     }
+    SV_DemoStop();
+    SV_MetricsShutdown();
+    SV_LogShutdown();
     NET_Shutdown();
+    Job_Shutdown();
 }
 
 /*
@@ -229,6 +247,7 @@ SV_DropClient(client_t *drop)
     drop->edict->v.frags = 0;
     drop->name[0] = 0;
     memset(drop->userinfo, 0, sizeof(drop->userinfo));
+    memset(&drop->userkeys, 0, sizeof(drop->userkeys));
 
 // send notification to all remaining clients
     SV_FullClientUpdate(drop, &sv.reliable_datagram);
@@ -340,6 +359,51 @@ CONNECTIONLESS COMMANDS
 ==============================================================================
 */
 
+/*
+ * The last status reply, sent again as it is while the serverinfo and the
+ * player list are the same and it's less than sv_statuscache seconds old.
+ * Pings, skins and times on the server catch up when it expires.
+ */
+#define STATUS_MAXSIZE 8000
+
+static struct {
+    char packet[STATUS_MAXSIZE];	// the out of band print, ready to send
+    int length;
+    double built;
+    char info[MAX_SERVERINFO_STRING];
+    unsigned players;
+} sv_status;
+
+static qboolean
+SV_StatusListed(const client_t *cl)
+{
+    return (cl->state == cs_connected || cl->state == cs_spawned)
+	&& !cl->spectator;
+}
+
+/* Tells apart the player lists the reply shows */
+static unsigned
+SV_StatusPlayers(void)
+{
+    const client_t *cl;
+    const char *name;
+    unsigned hash;
+    int i;
+
+    hash = 2166136261u;
+    for (i = 0, cl = svs.clients; i < MAX_CLIENTS; i++, cl++) {
+	if (!SV_StatusListed(cl))
+	    continue;
+	hash = (hash ^ i) * 16777619u;
+	hash = (hash ^ cl->userid) * 16777619u;
+	hash = (hash ^ cl->old_frags) * 16777619u;
+	for (name = cl->name; *name; name++)
+	    hash = (hash ^ (byte)*name) * 16777619u;
+    }
+
+    return hash;
+}
+
 /*
 ================
 SVC_Status
@@ -351,31 +415,49 @@ This message can be up to around 5k with worst case string lengths.
 static void
 SVC_Status(void)
 {
-    int i;
+    int i, len;
     client_t *cl;
     int ping;
     int top, bottom;
+    unsigned players;
+    char *text;
 
-    Cmd_TokenizeString("status");
-    SV_BeginRedirect(RD_PACKET);
-    Con_Printf("%s\n", svs.info);
-    for (i = 0; i < MAX_CLIENTS; i++) {
-	cl = &svs.clients[i];
-	if ((cl->state == cs_connected || cl->state == cs_spawned)
-	    && !cl->spectator) {
-	    top = atoi(Info_ValueForKey(cl->userinfo, "topcolor"));
-	    bottom = atoi(Info_ValueForKey(cl->userinfo, "bottomcolor"));
-	    top = (top < 0) ? 0 : ((top > 13) ? 13 : top);
-	    bottom = (bottom < 0) ? 0 : ((bottom > 13) ? 13 : bottom);
-	    ping = SV_CalcPing(cl);
-	    Con_Printf("%i %i %i %i \"%s\" \"%s\" %i %i\n", cl->userid,
-		       cl->old_frags,
-		       (int)(realtime - cl->connection_started) / 60, ping,
-		       cl->name, Info_ValueForKey(cl->userinfo, "skin"),
-		       top, bottom);
-	}
+    players = SV_StatusPlayers();
+    if (sv_status.length && realtime - sv_status.built < sv_statuscache.value
+	&& sv_status.players == players && !strcmp(sv_status.info, svs.info)) {
+	NET_SendPacket(sv_status.length, sv_status.packet, net_from);
+	return;
     }
-    SV_EndRedirect();
+
+    text = sv_status.packet + 5;
+    len = sizeof(sv_status.packet) - 5;
+    i = snprintf(text, len, "%s\n", svs.info);
+    for (cl = svs.clients; cl < svs.clients + MAX_CLIENTS && i < len; cl++) {
+	if (!SV_StatusListed(cl))
+	    continue;
+	top = atoi(Info_Get(&cl->userkeys, "topcolor"));
+	bottom = atoi(Info_Get(&cl->userkeys, "bottomcolor"));
+	top = (top < 0) ? 0 : ((top > 13) ? 13 : top);
+	bottom = (bottom < 0) ? 0 : ((bottom > 13) ? 13 : bottom);
+	ping = SV_CalcPing(cl);
+	i += snprintf(text + i, len - i, "%i %i %i %i \"%s\" \"%s\" %i %i\n",
+		      cl->userid, cl->old_frags,
+		      (int)(realtime - cl->connection_started) / 60, ping,
+		      cl->name, Info_Get(&cl->userkeys, "skin"),
+		      top, bottom);
+    }
+
+    sv_status.packet[0] = 0xff;
+    sv_status.packet[1] = 0xff;
+    sv_status.packet[2] = 0xff;
+    sv_status.packet[3] = 0xff;
+    sv_status.packet[4] = A2C_PRINT;
+    sv_status.length = 5 + strlen(text) + 1;
+    sv_status.built = realtime;
+    sv_status.players = players;
+    snprintf(sv_status.info, sizeof(sv_status.info), "%s", svs.info);
+
+    NET_SendPacket(sv_status.length, sv_status.packet, net_from);
 }
 
 /*
@@ -407,6 +489,28 @@ SV_CheckLog(void)
 
 }
 
+/*
+================
+SVC_Metrics
+
+Responds with the last window of frame timings and client bandwidth
+================
+*/
+static void
+SVC_Metrics(void)
+{
+    static char packet[MAX_CLIENTS * 160 + 512];
+    int len;
+
+    packet[0] = 0xff;
+    packet[1] = 0xff;
+    packet[2] = 0xff;
+    packet[3] = 0xff;
+    packet[4] = A2C_PRINT;
+    len = SV_MetricsPrint(packet + 5, sizeof(packet) - 5);
+    NET_SendPacket(5 + len + 1, packet, net_from);
+}
+
 /*
 ================
 SVC_Log
@@ -504,6 +608,71 @@ SVC_GetChallenge(void)
 			   svs.challenges[i].challenge);
 }
 
+/*
+ * The client slots chained by the address and qport they connected with.
+ * Being outside the client_t, the links survive it being copied over when
+ * a slot is reused; a slot is rehashed by the connect that sets it up.
+ */
+#define CLIENT_HASHSIZE 64	/* a power of two */
+
+static int sv_clientchains[CLIENT_HASHSIZE];	/* 1 + first slot, or 0 */
+static int sv_clientnext[MAX_CLIENTS];		/* 1 + next slot, or 0 */
+static int sv_clientbucket[MAX_CLIENTS];	/* 1 + chain of the slot, or 0 */
+
+static int
+SV_ClientBucket(const netadr_t *adr, int qport)
+{
+    unsigned hash = adr->ip.l * 2654435761U ^ qport * 40503U;
+
+    return (hash >> 16) & (CLIENT_HASHSIZE - 1);
+}
+
+static void
+SV_HashClient(int slot, const netadr_t *adr, int qport)
+{
+    int *link, bucket;
+
+    /* take it off the chain of its last connection */
+    if (sv_clientbucket[slot]) {
+	link = &sv_clientchains[sv_clientbucket[slot] - 1];
+	while (*link != slot + 1)
+	    link = &sv_clientnext[*link - 1];
+	*link = sv_clientnext[slot];
+    }
+
+    bucket = SV_ClientBucket(adr, qport);
+    sv_clientnext[slot] = sv_clientchains[bucket];
+    sv_clientchains[bucket] = slot + 1;
+    sv_clientbucket[slot] = bucket + 1;
+}
+
+/*
+ * The connected client the packet is from, the lowest numbered one if
+ * more than one matches, as the scan of the slots found
+ */
+static client_t *
+SV_FindClient(const netadr_t *adr, int qport)
+{
+    client_t *cl, *found;
+    int slot;
+
+    found = NULL;
+    slot = sv_clientchains[SV_ClientBucket(adr, qport)];
+    for (; slot; slot = sv_clientnext[slot - 1]) {
+	cl = &svs.clients[slot - 1];
+	if (cl->state == cs_free)
+	    continue;
+	if (!NET_CompareBaseAdr(*adr, cl->netchan.remote_address))
+	    continue;
+	if (cl->netchan.qport != qport)
+	    continue;
+	if (!found || cl < found)
+	    found = cl;
+    }
+
+    return found;
+}
+
 /*
 ==================
 SVC_DirectConnect
@@ -679,6 +848,7 @@ SVC_DirectConnect(void)
     edictnum = (newcl - svs.clients) + 1;
 
     Netchan_Setup(&newcl->netchan, adr, qport);
+    SV_HashClient(newcl - svs.clients, &adr, qport);
 
     newcl->state = cs_connected;
 
@@ -761,6 +931,48 @@ SVC_RemoteCommand(void)
 }
 
 
+/*
+ * A token bucket for each source of connectionless packets, sv_queryrate
+ * tokens a second up to sv_queryburst, one taken by each packet. Sources
+ * share the table by their address hash; a newcomer takes over the slot
+ * of whoever was there with a full bucket.
+ */
+#define QUERY_SOURCES 1024	/* a power of two */
+
+static struct {
+    unsigned ip;
+    float tokens;
+    double time;
+} sv_querysources[QUERY_SOURCES];
+
+static qboolean
+SV_QueryAllowed(const netadr_t *adr)
+{
+    unsigned slot = (adr->ip.l * 2654435761U >> 16) & (QUERY_SOURCES - 1);
+    float burst = sv_queryburst.value;
+
+    if (sv_queryrate.value <= 0)
+	return true;
+
+    if (sv_querysources[slot].ip != adr->ip.l
+	|| sv_querysources[slot].time > realtime) {
+	sv_querysources[slot].ip = adr->ip.l;
+	sv_querysources[slot].tokens = burst;
+    } else {
+	sv_querysources[slot].tokens += (realtime - sv_querysources[slot].time)
+	    * sv_queryrate.value;
+	if (sv_querysources[slot].tokens > burst)
+	    sv_querysources[slot].tokens = burst;
+    }
+    sv_querysources[slot].time = realtime;
+
+    if (sv_querysources[slot].tokens < 1)
+	return false;
+    sv_querysources[slot].tokens -= 1;
+
+    return true;
+}
+
 /*
 =================
 SV_ConnectionlessPacket
@@ -777,6 +989,9 @@ SV_ConnectionlessPacket(void)
     const char *cmdstring;
     const char *cmd;
 
+    if (!SV_QueryAllowed(&net_from))
+	return;			// flooding, drop it without a word
+
     MSG_BeginReading();
     MSG_ReadLong();		// skip the -1 marker
 
@@ -794,6 +1009,8 @@ SV_ConnectionlessPacket(void)
 	SVC_Status();
     else if (!strcmp(cmd, "log"))
 	SVC_Log();
+    else if (!strcmp(cmd, "metrics"))
+	SVC_Metrics();
     else if (!strcmp(cmd, "connect"))
 	SVC_DirectConnect();
     else if (!strcmp(cmd, "getchallenge"))
@@ -858,6 +1075,18 @@ typedef struct {
 static ipfilter_t ipfilters[MAX_IPFILTERS];
 static int numipfilters;
 
+/*
+ * What the filters cover as sorted, disjoint ranges of addresses in host
+ * order, so a packet is checked with one binary search over them
+ */
+typedef struct {
+    unsigned low;
+    unsigned high;
+} iprange_t;
+
+static iprange_t ipranges[MAX_IPFILTERS];
+static int numipranges;
+
 static cvar_t filterban = { "filterban", "1" };
 
 /*
@@ -926,6 +1155,64 @@ StringToFilter(const char *in, ipfilter_t *f)
     return false;
 }
 
+static unsigned
+FilterHostLong(const byte *b)
+{
+    return (unsigned)b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+}
+
+static int
+CompareRanges(const void *a, const void *b)
+{
+    unsigned la = ((const iprange_t *)a)->low;
+    unsigned lb = ((const iprange_t *)b)->low;
+
+    return la < lb ? -1 : la > lb;
+}
+
+/*
+=================
+SV_UpdateIPRanges
+
+Rebuilds the ranges after a change to the filters
+=================
+*/
+static void
+SV_UpdateIPRanges(void)
+{
+    const ipfilter_t *f;
+    iprange_t *range;
+    unsigned addr, mask;
+    int i;
+
+    numipranges = 0;
+    for (i = 0, f = ipfilters; i < numipfilters; i++, f++) {
+	if (f->addr.l == 0xffffffff)
+	    continue;		// free spot
+	addr = FilterHostLong(f->addr.b);
+	mask = FilterHostLong(f->mask.b);
+	if (addr & ~mask)
+	    continue;		// bits outside the mask, matches nothing
+	ipranges[numipranges].low = addr;
+	ipranges[numipranges].high = addr | ~mask;
+	numipranges++;
+    }
+    if (!numipranges)
+	return;
+
+    qsort(ipranges, numipranges, sizeof(ipranges[0]), CompareRanges);
+    range = ipranges;
+    for (i = 1; i < numipranges; i++) {
+	if (ipranges[i].low <= range->high) {
+	    if (ipranges[i].high > range->high)
+		range->high = ipranges[i].high;
+	} else {
+	    *++range = ipranges[i];
+	}
+    }
+    numipranges = range - ipranges + 1;
+}
+
 /*
 =================
 SV_AddIP_f
@@ -949,6 +1236,7 @@ SV_AddIP_f(void)
 
     if (!StringToFilter(Cmd_Argv(1), &ipfilters[i]))
 	ipfilters[i].addr.l = 0xffffffff;
+    SV_UpdateIPRanges();
 }
 
 /*
@@ -970,6 +1258,7 @@ SV_RemoveIP_f(void)
 	    for (j = i + 1; j < numipfilters; j++)
 		ipfilters[j - 1] = ipfilters[j];
 	    numipfilters--;
+	    SV_UpdateIPRanges();
 	    Con_Printf("Removed.\n");
 	    return;
 	}
@@ -1056,19 +1345,23 @@ SV_FilterPacket
 static qboolean
 SV_FilterPacket(void)
 {
-    int i;
+    int low, high, mid;
     unsigned in;
 
-    /* FIXME - be smarter about this */
-    in  = net_from.ip.b[0] << 24;
-    in |= net_from.ip.b[1] << 16;
-    in |= net_from.ip.b[2] << 8;
-    in |= net_from.ip.b[3];
-    in = BigLong(in);
+    in = FilterHostLong(net_from.ip.b);
 
-    for (i = 0; i < numipfilters; i++)
-	if ((in & ipfilters[i].mask.l) == ipfilters[i].addr.l)
-	    return filterban.value;
+    /* find the last range starting at or below the address */
+    low = 0;
+    high = numipranges;
+    while (low < high) {
+	mid = (low + high) / 2;
+	if (ipranges[mid].low <= in)
+	    low = mid + 1;
+	else
+	    high = mid;
+    }
+    if (low && in <= ipranges[low - 1].high)
+	return filterban.value;
 
     return !filterban.value;
 }
@@ -1083,7 +1376,6 @@ SV_ReadPackets
 static void
 SV_ReadPackets(void)
 {
-    int i;
     client_t *cl;
     int qport;
 
@@ -1105,13 +1397,8 @@ SV_ReadPackets(void)
 	qport = MSG_ReadShort() & 0xffff;
 
 	// check for packets from connected clients
-	for (i = 0, cl = svs.clients; i < MAX_CLIENTS; i++, cl++) {
-	    if (cl->state == cs_free)
-		continue;
-	    if (!NET_CompareBaseAdr(net_from, cl->netchan.remote_address))
-		continue;
-	    if (cl->netchan.qport != qport)
-		continue;
+	cl = SV_FindClient(&net_from, qport);
+	if (cl) {
 	    if (cl->netchan.remote_address.port != net_from.port) {
 		Con_DPrintf("SV_ReadPackets: fixing up a translated port\n");
 		cl->netchan.remote_address.port = net_from.port;
@@ -1123,11 +1410,8 @@ SV_ReadPackets(void)
 		if (cl->state != cs_zombie)
 		    SV_ExecuteClientMessage(cl);
 	    }
-	    break;
-	}
-
-	if (i != MAX_CLIENTS)
 	    continue;
+	}
 
 	// packet is not from a known client
 	//      Con_Printf ("%s:sequenced packet without connection\n"
@@ -1243,6 +1527,7 @@ SV_Frame(float time)
 
     start = Sys_DoubleTime();
     svs.stats.idle += start - end;
+    SV_MetricsBeginFrame();
 
 // keep the random time dependent
     rand();
@@ -1252,6 +1537,9 @@ SV_Frame(float time)
 	realtime += time;
 	sv.time += time;
     }
+// queue up this frame's packets to send them together
+    NET_BeginBatch();
+
 // check timeouts
     SV_CheckTimeouts();
 
@@ -1261,6 +1549,7 @@ SV_Frame(float time)
 // move autonomous things around if enough time has passed
     if (!sv.paused)
 	SV_Physics();
+    SV_MetricsMark(SVM_PHYSICS);
 
 // get packets
     SV_ReadPackets();
@@ -1272,13 +1561,20 @@ SV_Frame(float time)
     Cbuf_Execute();
 
     SV_CheckVars();
+    SV_MetricsMark(SVM_READ);
 
 // send messages back to the clients that had packets read this frame
+    SV_AntilagRecord();
     SV_SendClientMessages();
 
 // send a heartbeat to the master if needed
     Master_Heartbeat();
 
+    NET_EndBatch();
+    Job_EndFrame();
+    SV_MetricsMark(SVM_SEND);
+    SV_MetricsEndFrame();
+
 // collect timing statistics
     end = Sys_DoubleTime();
     svs.stats.active += end - start;
@@ -1305,6 +1601,8 @@ SV_InitLocal(void)
 
     SV_InitOperatorCommands();
     SV_UserInit();
+    SV_DemoInit();
+    SV_MetricsInit();
 
     Cvar_RegisterVariable(&rcon_password);
     Cvar_RegisterVariable(&password);
@@ -1340,9 +1638,15 @@ SV_InitLocal(void)
 
     Cvar_RegisterVariable(&sv_aim);
 
+    SV_WorldInit();
+
     Cvar_RegisterVariable(&filterban);
+    Cvar_RegisterVariable(&sv_statuscache);
+    Cvar_RegisterVariable(&sv_queryrate);
+    Cvar_RegisterVariable(&sv_queryburst);
 
     Cvar_RegisterVariable(&allow_download);
+    Cvar_RegisterVariable(&sv_downloadurl);
     Cvar_RegisterVariable(&allow_download_skins);
     Cvar_RegisterVariable(&allow_download_models);
     Cvar_RegisterVariable(&allow_download_sounds);
@@ -1351,6 +1655,12 @@ SV_InitLocal(void)
     Cvar_RegisterVariable(&sv_highchars);
 
     Cvar_RegisterVariable(&sv_phs);
+    Cvar_RegisterVariable(&sv_phscache);
+    Cvar_RegisterVariable(&sv_projectiles);
+    Cvar_RegisterVariable(&sv_threads);
+    Cvar_RegisterVariable(&sv_entpriority);
+    Cvar_RegisterVariable(&sv_antilag);
+    Cvar_RegisterVariable(&sv_antilag_max);
 
     Cvar_RegisterVariable(&pausable);
 
@@ -1465,6 +1775,7 @@ void
 SV_ExtractFromUserinfo(client_t *cl)
 {
     char *val, *p, *q;
+    const char *value;
     int i;
     client_t *client;
     int dupc = 1;
@@ -1530,6 +1841,7 @@ SV_ExtractFromUserinfo(client_t *cl)
 	} else
 	    break;
     }
+    Info_Parse(&cl->userkeys, cl->userinfo);
 
     if (strncmp(val, cl->name, strlen(cl->name))) {
 	if (!sv.paused) {
@@ -1555,9 +1867,9 @@ SV_ExtractFromUserinfo(client_t *cl)
     strncpy(cl->name, val, sizeof(cl->name) - 1);
 
     // rate command
-    val = Info_ValueForKey(cl->userinfo, "rate");
-    if (strlen(val)) {
-	i = atoi(val);
+    value = Info_Get(&cl->userkeys, "rate");
+    if (strlen(value)) {
+	i = atoi(value);
 	if (i < 500)
 	    i = 500;
 	if (i > 10000)
@@ -1565,11 +1877,13 @@ SV_ExtractFromUserinfo(client_t *cl)
 	cl->netchan.rate = 1.0 / i;
     }
     // msg command
-    val = Info_ValueForKey(cl->userinfo, "msg");
-    if (strlen(val)) {
-	cl->messagelevel = atoi(val);
+    value = Info_Get(&cl->userkeys, "msg");
+    if (strlen(value)) {
+	cl->messagelevel = atoi(value);
     }
 
+    value = Info_Get(&cl->userkeys, PROJECTILES_INFOKEY);
+    cl->projectiles = atoi(value) != 0;
 }
 
 
@@ -1634,6 +1948,7 @@ SV_Init(quakeparms_t *parms)
     Cmd_Init();
 
     COM_Init();
+    Job_Init();
 
     PR_Init();
     Mod_Init(&SV_Model_Loader);
@@ -0,0 +1,361 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_metrics.c -- frame timings and client bandwidth for monitoring
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "cvar.h"
+#include "progs.h"
+#include "qwsvdef.h"
+#include "server.h"
+#include "sys.h"
+
+/*
+ * Each frame is split into stages by SV_MetricsMark, which charges the
+ * time since the previous mark to a stage, less whatever of it the progs
+ * ran for. The frames are summed over windows of sv_metricsinterval
+ * seconds; the last complete window is what "metrics" reports, and is
+ * appended to sv_metricsfile (relative to the game directory) if set.
+ * A frame whose active stages take longer than sv_metricsoverrun
+ * milliseconds counts as an overrun. The time between physics frames is
+ * kept too, to show how evenly the ticks are paced.
+ */
+static cvar_t sv_metricsfile = { "sv_metricsfile", "" };
+static cvar_t sv_metricsinterval = { "sv_metricsinterval", "10" };
+static cvar_t sv_metricsoverrun = { "sv_metricsoverrun", "20" };
+
+static const char *const sv_stagenames[SVM_NUMSTAGES] = {
+    "read", "physics", "progs", "send", "idle"
+};
+
+typedef struct {
+    double total[SVM_NUMSTAGES];
+    double max[SVM_NUMSTAGES];
+    double maxactive;
+    int frames;
+    int overruns;
+    int ticks;
+    double ticktotal;		// between physics frames
+    double tickmin;
+    double tickmax;
+    double start;
+    double length;		// seconds the window covered
+} svmwindow_t;
+
+// a client's totals at the start of the window, and its last window's rates
+typedef struct {
+    int userid;			// whose totals they are
+    unsigned bytes_in;
+    unsigned bytes_out;
+    int chokes;
+    int drops;
+    int packets;
+
+    int in;			// bytes a second
+    int out;
+    int choked;
+    float loss;			// percent of packets
+} svmclient_t;
+
+static svmwindow_t sv_window;
+static svmwindow_t sv_latched;
+static svmclient_t sv_clientmetrics[MAX_CLIENTS];
+
+static double sv_frame[SVM_NUMSTAGES];
+static double sv_lastmark;
+static double sv_lastprogs;
+static double sv_lastend;
+
+static svlog_t *sv_metricslog;
+static char sv_metricsname[MAX_OSPATH];
+
+/*
+ * Takes the clients' counters at the end of a window, working out their
+ * rates over it. A slot that changed hands starts again from zero.
+ */
+static void
+SV_MetricsLatchClients(double length)
+{
+    client_t *cl;
+    svmclient_t *m;
+    int i, packets;
+
+    for (i = 0, cl = svs.clients; i < MAX_CLIENTS; i++, cl++) {
+	m = &sv_clientmetrics[i];
+	if (cl->state == cs_free) {
+	    m->userid = 0;
+	    continue;
+	}
+	if (m->userid != cl->userid) {
+	    memset(m, 0, sizeof(*m));
+	    m->userid = cl->userid;
+	}
+	packets = cl->netchan.drop_count + cl->netchan.good_count
+	    - m->drops - m->packets;
+	m->in = (cl->netchan.bytes_in - m->bytes_in) / length;
+	m->out = (cl->netchan.bytes_out - m->bytes_out) / length;
+	m->choked = cl->chokes - m->chokes;
+	m->loss = packets > 0
+	    ? 100.0f * (cl->netchan.drop_count - m->drops) / packets : 0;
+
+	m->bytes_in = cl->netchan.bytes_in;
+	m->bytes_out = cl->netchan.bytes_out;
+	m->chokes = cl->chokes;
+	m->drops = cl->netchan.drop_count;
+	m->packets = cl->netchan.good_count;
+    }
+}
+
+/*
+ * Follows sv_metricsfile, opening the new file to append to when it
+ * changes.
+ */
+static void
+SV_MetricsCheckFile(void)
+{
+    char name[MAX_OSPATH];
+    FILE *f;
+
+    if (!strcmp(sv_metricsfile.string, sv_metricsname))
+	return;
+
+    if (sv_metricslog) {
+	SV_LogClose(sv_metricslog);
+	sv_metricslog = NULL;
+    }
+    snprintf(sv_metricsname, sizeof(sv_metricsname), "%s",
+	     sv_metricsfile.string);
+    if (!sv_metricsname[0])
+	return;
+
+    snprintf(name, sizeof(name), "%s/%s", com_gamedir, sv_metricsname);
+    f = fopen(name, "a");
+    if (f)
+	sv_metricslog = SV_LogOpen(f);
+    if (!sv_metricslog)
+	Con_Printf("Couldn't open metrics file %s.\n", name);
+}
+
+static void
+SV_MetricsLatch(double now)
+{
+    static char text[MAX_CLIENTS * 160 + 512];
+
+    sv_window.length = now - sv_window.start;
+    sv_latched = sv_window;
+    SV_MetricsLatchClients(sv_window.length);
+
+    memset(&sv_window, 0, sizeof(sv_window));
+    sv_window.start = now;
+
+    SV_MetricsCheckFile();
+    if (sv_metricslog) {
+	SV_MetricsPrint(text, sizeof(text));
+	SV_LogWrite(sv_metricslog, text);
+    }
+}
+
+/*
+================
+SV_MetricsPrint
+
+Puts the last window's report in buf: a line for the server and one for
+each client, as key=value pairs in milliseconds and bytes a second.
+Returns the length written.
+================
+*/
+int
+SV_MetricsPrint(char *buf, int size)
+{
+    const svmwindow_t *w = &sv_latched;
+    const svmclient_t *m;
+    client_t *cl;
+    int i, len, frames, clients;
+
+    frames = w->frames ? w->frames : 1;
+    clients = 0;
+    for (i = 0, cl = svs.clients; i < MAX_CLIENTS; i++, cl++)
+	if (cl->state != cs_free)
+	    clients++;
+
+    len = snprintf(buf, size, "server time=%lu window=%.1f frames=%i "
+		   "overruns=%i maxframe=%.2f ticks=%i tick=%.2f/%.2f/%.2f",
+		   (unsigned long)time(NULL), w->length, w->frames,
+		   w->overruns, 1000 * w->maxactive, w->ticks,
+		   1000 * w->tickmin,
+		   w->ticks ? 1000 * w->ticktotal / w->ticks : 0.0,
+		   1000 * w->tickmax);
+    for (i = 0; i < SVM_NUMSTAGES && len < size; i++)
+	len += snprintf(buf + len, size - len, " %s=%.3f/%.2f",
+			sv_stagenames[i], 1000 * w->total[i] / frames,
+			1000 * w->max[i]);
+    if (len < size)
+	len += snprintf(buf + len, size - len, " clients=%i\n", clients);
+
+    for (i = 0, cl = svs.clients; i < MAX_CLIENTS && len < size; i++, cl++) {
+	if (cl->state == cs_free)
+	    continue;
+	m = &sv_clientmetrics[i];
+	if (m->userid != cl->userid)
+	    m = NULL;		// joined during the window
+	len += snprintf(buf + len, size - len, "client slot=%i userid=%i "
+			"name=\"%s\" state=%s ping=%i in=%i out=%i choke=%i "
+			"loss=%.1f backlog=%i backbufs=%i\n", i, cl->userid,
+			cl->name, cl->state == cs_spawned ? "spawned" :
+			cl->state == cs_connected ? "connecting" : "zombie",
+			cl->state == cs_spawned ? SV_CalcPing(cl) : 0,
+			m ? m->in : 0, m ? m->out : 0, m ? m->choked : 0,
+			m ? m->loss : 0.0f,
+			cl->netchan.message.cursize + cl->netchan.reliable_length,
+			cl->num_backbuf);
+    }
+
+    return qmin(len, size - 1);
+}
+
+static void
+SV_Metrics_f(void)
+{
+    static char text[MAX_CLIENTS * 160 + 512];
+
+    if (!sv_latched.length) {
+	Con_Printf("No metrics yet, the first window ends in %i seconds.\n",
+		   (int)(sv_window.start + sv_metricsinterval.value
+			 - Sys_DoubleTime()) + 1);
+	return;
+    }
+    SV_MetricsPrint(text, sizeof(text));
+    Con_Printf("%s", text);
+}
+
+/*
+================
+SV_MetricsBeginFrame
+
+Starts timing a frame, counting the time since the last one as idle
+================
+*/
+void
+SV_MetricsBeginFrame(void)
+{
+    int i;
+
+    sv_lastmark = Sys_DoubleTime();
+    sv_lastprogs = pr_exectime;
+    for (i = 0; i < SVM_NUMSTAGES; i++)
+	sv_frame[i] = 0;
+    if (sv_lastend)
+	sv_frame[SVM_IDLE] = sv_lastmark - sv_lastend;
+}
+
+/*
+================
+SV_MetricsMark
+
+Charges the frame's time since the last mark to the stage
+================
+*/
+void
+SV_MetricsMark(svmstage_t stage)
+{
+    double now, progs;
+
+    now = Sys_DoubleTime();
+    progs = pr_exectime - sv_lastprogs;
+    sv_frame[stage] += now - sv_lastmark - progs;
+    sv_frame[SVM_PROGS] += progs;
+    sv_lastmark = now;
+    sv_lastprogs = pr_exectime;
+}
+
+/*
+================
+SV_MetricsTick
+
+Counts a physics frame run 'interval' seconds after the last
+================
+*/
+void
+SV_MetricsTick(double interval)
+{
+    if (!sv_window.ticks || sv_window.tickmin > interval)
+	sv_window.tickmin = interval;
+    if (sv_window.tickmax < interval)
+	sv_window.tickmax = interval;
+    sv_window.ticktotal += interval;
+    sv_window.ticks++;
+}
+
+/*
+================
+SV_MetricsEndFrame
+
+Adds the frame to the window, finishing the window once it's long enough
+================
+*/
+void
+SV_MetricsEndFrame(void)
+{
+    double active;
+    int i;
+
+    active = 0;
+    for (i = 0; i < SVM_NUMSTAGES; i++) {
+	sv_window.total[i] += sv_frame[i];
+	if (sv_window.max[i] < sv_frame[i])
+	    sv_window.max[i] = sv_frame[i];
+	if (i != SVM_IDLE)
+	    active += sv_frame[i];
+    }
+    if (sv_window.maxactive < active)
+	sv_window.maxactive = active;
+    if (active * 1000 > sv_metricsoverrun.value)
+	sv_window.overruns++;
+    sv_window.frames++;
+
+    sv_lastend = sv_lastmark;
+    if (sv_lastend - sv_window.start >= qmax(sv_metricsinterval.value, 1))
+	SV_MetricsLatch(sv_lastend);
+}
+
+void
+SV_MetricsInit(void)
+{
+    Cvar_RegisterVariable(&sv_metricsfile);
+    Cvar_RegisterVariable(&sv_metricsinterval);
+    Cvar_RegisterVariable(&sv_metricsoverrun);
+    Cmd_AddCommand("metrics", SV_Metrics_f);
+
+    sv_window.start = Sys_DoubleTime();
+}
+
+void
+SV_MetricsShutdown(void)
+{
+    if (sv_metricslog) {
+	SV_LogClose(sv_metricslog);
+	sv_metricslog = NULL;
+    }
+}
@@ -427,17 +427,22 @@ SV_Push
 qboolean
 SV_Push(edict_t *pusher, vec3_t move)
 {
-    int i, e;
+    int i, n, numcheck;
     edict_t *check, *block;
     vec3_t mins, maxs;
     vec3_t pushorig;
+    vec3_t areamins, areamaxs;
     int num_moved;
     edict_t *moved_edict[MAX_EDICTS];
     vec3_t moved_from[MAX_EDICTS];
+    int checknums[MAX_EDICTS * 2 + 1];
 
     for (i = 0; i < 3; i++) {
 	mins[i] = pusher->v.absmin[i] + move[i];
 	maxs[i] = pusher->v.absmax[i] + move[i];
+	/* riders touch the start box, anything else pushed the end one */
+	areamins[i] = qmin(mins[i], pusher->v.absmin[i]);
+	areamaxs[i] = qmax(maxs[i], pusher->v.absmax[i]);
     }
 
     VectorCopy(pusher->v.origin, pushorig);
@@ -449,8 +454,9 @@ SV_Push(edict_t *pusher, vec3_t move)
 
 // see if any solid entities are inside the final position
     num_moved = 0;
-    check = NEXT_EDICT(sv.edicts);
-    for (e = 1; e < sv.num_edicts; e++, check = NEXT_EDICT(check)) {
+    numcheck = SV_BoxEdicts(areamins, areamaxs, checknums);
+    for (n = 0; n < numcheck; n++) {
+	check = EDICT_NUM(checknums[n]);
 	if (check->free)
 	    continue;
 	if (check->v.movetype == MOVETYPE_PUSH
@@ -872,20 +878,51 @@ SV_Physics
 
 ================
 */
+static double sv_physics_time;	// realtime of the last physics frame
+
+/*
+================
+SV_PhysicsTimeout
+
+Seconds of realtime, as of the last SV_Frame, until SV_Physics will run a
+frame again, or -1 if it won't while paused or nobody is on the server
+================
+*/
+double
+SV_PhysicsTimeout(void)
+{
+    double timeout;
+    int i;
+
+    if (sv.state != ss_active || sv.paused)
+	return -1;
+    for (i = 0; i < MAX_CLIENTS; i++)
+	if (svs.clients[i].state == cs_spawned)
+	    break;
+    if (i == MAX_CLIENTS)
+	return -1;
+
+    timeout = sv_mintic.value - (realtime - sv_physics_time);
+    return timeout > 0 ? timeout : 0;
+}
+
 void
 SV_Physics(void)
 {
     int i;
     edict_t *ent;
-    static double old_time;
+    double old_time = sv_physics_time;
 
 // don't bother running a frame if sys_ticrate seconds haven't passed
     host_frametime = realtime - old_time;
     if (host_frametime < sv_mintic.value)
 	return;
+    // the first frame after the server has been idle is no tick to time
     if (host_frametime > sv_maxtic.value)
 	host_frametime = sv_maxtic.value;
-    old_time = realtime;
+    else
+	SV_MetricsTick(host_frametime);
+    sv_physics_time = realtime;
 
     pr_global_struct->frametime = host_frametime;
 
@@ -19,6 +19,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // sv_send.c
 
+#include <stdlib.h>
+
+#include "jobs.h"
 #include "model.h"
 #include "qwsvdef.h"
 #include "server.h"
@@ -122,7 +125,7 @@ Con_Printf(const char *fmt, ...)
 
     Sys_Printf("%s", msg);	// also echo to debugging console
     if (sv_logfile)
-	fprintf(sv_logfile, "%s", msg);
+	SV_LogWrite(sv_logfile, msg);
 }
 
 /*
@@ -200,6 +203,8 @@ SV_BroadcastPrintf(int level, const char *fmt, ...)
 {
     va_list argptr;
     char string[MAX_PRINTMSG];
+    byte buf[MAX_PRINTMSG + 2];
+    sizebuf_t msg, *demo;
     client_t *cl;
     int i;
 
@@ -209,14 +214,29 @@ SV_BroadcastPrintf(int level, const char *fmt, ...)
 
     Sys_Printf("%s", string);	// print to the console
 
+    /* put the message together once, each client gets a copy */
+    msg.allowoverflow = false;
+    msg.overflowed = false;
+    msg.data = buf;
+    msg.maxsize = sizeof(buf);
+    msg.cursize = 0;
+    MSG_WriteByte(&msg, svc_print);
+    MSG_WriteByte(&msg, level);
+    MSG_WriteString(&msg, string);
+
     for (i = 0, cl = svs.clients; i < MAX_CLIENTS; i++, cl++) {
 	if (level < cl->messagelevel)
 	    continue;
 	if (!cl->state)
 	    continue;
 
-	SV_PrintToClient(cl, level, string);
+	ClientReliableCheckBlock(cl, msg.cursize);
+	ClientReliableWrite_SZ(cl, msg.data, msg.cursize);
     }
+
+    demo = SV_DemoReliable(msg.cursize);
+    if (demo)
+	SZ_Write(demo, msg.data, msg.cursize);
 }
 
 /*
@@ -243,6 +263,29 @@ SV_BroadcastCommand(const char *fmt, ...)
 }
 
 
+/*
+=================
+SV_ClientLeaf
+
+The leaf the client's edict is in. Multicasts come in bursts between the
+client's moves, so the leaf is only looked up again once it has moved.
+=================
+*/
+static mleaf_t *
+SV_ClientLeaf(client_t *client)
+{
+    float *origin = client->edict->v.origin;
+
+    if (client->leaf_spawncount != svs.spawncount
+	|| !VectorCompare(origin, client->leaf_origin)) {
+	client->leaf = Mod_PointInLeaf(sv.worldmodel, origin);
+	client->leaf_spawncount = svs.spawncount;
+	VectorCopy(origin, client->leaf_origin);
+    }
+
+    return client->leaf;
+}
+
 /*
 =================
 SV_Multicast
@@ -261,6 +304,7 @@ SV_Multicast(vec3_t origin, int to)
     client_t *client;
     const leafbits_t *mask;
     mleaf_t *leaf;
+    sizebuf_t *demo;
     int leafnum;
     int j;
     qboolean reliable;
@@ -310,7 +354,7 @@ SV_Multicast(vec3_t origin, int to)
 		goto inrange;
 	}
 
-	leaf = Mod_PointInLeaf(sv.worldmodel, client->edict->v.origin);
+	leaf = SV_ClientLeaf(client);
 	if (leaf) {
 	    // -1 is because pvs rows are 1 based, not 0 based like leafs
 	    leafnum = leaf - sv.worldmodel->leafs - 1;
@@ -330,6 +374,14 @@ SV_Multicast(vec3_t origin, int to)
 		     sv.multicast.cursize);
     }
 
+    // the demo sees everything
+    if (reliable)
+	demo = SV_DemoReliable(sv.multicast.cursize);
+    else
+	demo = SV_DemoDatagram();
+    if (demo)
+	SZ_Write(demo, sv.multicast.data, sv.multicast.cursize);
+
     SZ_Clear(&sv.multicast);
 }
 
@@ -370,12 +422,8 @@ SV_StartSound(edict_t *entity, int channel, const char *sample, int volume,
 	SV_Error("SV_StartSound: channel = %i", channel);
 
 // find precache number for sound
-    for (sound_num = 1; sound_num < MAX_SOUNDS
-	 && sv.sound_precache[sound_num]; sound_num++)
-	if (!strcmp(sample, sv.sound_precache[sound_num]))
-	    break;
-
-    if (sound_num == MAX_SOUNDS || !sv.sound_precache[sound_num]) {
+    sound_num = PR_FindPrecache(&sv.sound_hash, sv.sound_precache, sample);
+    if (sound_num < 1) {
 	Con_Printf("SV_StartSound: %s not precacheed\n", sample);
 	return;
     }
@@ -437,15 +485,18 @@ FRAME UPDATES
 */
 
 int sv_nailmodel, sv_supernailmodel, sv_playermodel;
+byte sv_projectilemodels[MAX_MODELS];	// listed in sv_projectiles
 
 void
 SV_FindModelNumbers(void)
 {
+    const char *list;
     int i;
 
     sv_nailmodel = -1;
     sv_supernailmodel = -1;
     sv_playermodel = -1;
+    memset(sv_projectilemodels, 0, sizeof(sv_projectilemodels));
 
     for (i = 0; i < MAX_MODELS; i++) {
 	if (!sv.model_precache[i])
@@ -456,6 +507,14 @@ SV_FindModelNumbers(void)
 	    sv_supernailmodel = i;
 	if (!strcmp(sv.model_precache[i], "progs/player.mdl"))
 	    sv_playermodel = i;
+
+	list = sv_projectiles.string;
+	while ((list = COM_Parse(list)) != NULL) {
+	    if (!strcmp(sv.model_precache[i], com_token)) {
+		sv_projectilemodels[i] = 1;
+		break;
+	    }
+	}
     }
 }
 
@@ -506,21 +565,18 @@ SV_WriteClientdataToMessage(client_t *client, sizebuf_t *msg)
 
 /*
 =======================
-SV_UpdateClientStats
+SV_ClientStats
 
-Performs a delta update of the stats array.  This should only be performed
-when a reliable message can be delivered this frame.
+The stats array as the client should see it
 =======================
 */
-static void
-SV_UpdateClientStats(client_t *client)
+void
+SV_ClientStats(const client_t *client, int *stats)
 {
     edict_t *ent;
-    int stats[MAX_CL_STATS];
-    int i;
 
     ent = client->edict;
-    memset(stats, 0, sizeof(stats));
+    memset(stats, 0, MAX_CL_STATS * sizeof(stats[0]));
 
     // if we are a spectator and we are tracking a player, we get his stats
     // so our status bar reflects his
@@ -540,7 +596,23 @@ SV_UpdateClientStats(client_t *client)
     // stuff the sigil bits into the high bits of items for sbar
     stats[STAT_ITEMS] =
 	(int)ent->v.items | ((int)pr_global_struct->serverflags << 28);
+}
 
+/*
+=======================
+SV_UpdateClientStats
+
+Performs a delta update of the stats array.  This should only be performed
+when a reliable message can be delivered this frame.
+=======================
+*/
+static void
+SV_UpdateClientStats(client_t *client)
+{
+    int stats[MAX_CL_STATS];
+    int i;
+
+    SV_ClientStats(client, stats);
     for (i = 0; i < MAX_CL_STATS; i++)
 	if (stats[i] != client->stats[i]) {
 	    client->stats[i] = stats[i];
@@ -556,51 +628,133 @@ SV_UpdateClientStats(client_t *client)
 	}
 }
 
+/*
+ * A spawned client's datagram is built in two halves. The part that only
+ * reads the world (client data, players and entities in the PVS, the
+ * multicast datagram) is built for every client at once as a batch of
+ * jobs, each into its own buffer. Anything that prints, writes to the
+ * reliable stream or sends is done after, one client at a time.
+ */
+typedef struct {
+    client_t *client;
+    leafbits_t *pvs;		// worked out on the main thread
+    sizebuf_t msg;
+    byte buf[MAX_DATAGRAM];
+    qboolean datagram_overflowed;
+    const char *error;
+} clientdatagram_t;
+
+static clientdatagram_t sv_datagrams[MAX_CLIENTS];
+static byte *sv_datagram_pvs;	// MAX_CLIENTS leafbits for the map
+static size_t sv_datagram_pvssize;
+
+static job_t sv_datagram_jobs[JOB_MAX_SPLIT(MAX_JOB_THREADS)];
+
+static const char *
+SV_BuildClientDatagrams(void *data, int start, int end)
+{
+    clientdatagram_t *datagram;
+    client_t *client;
+    int i;
+
+    for (i = start; i < end; i++) {
+	datagram = &((clientdatagram_t *)data)[i];
+	client = datagram->client;
+
+	datagram->msg.data = datagram->buf;
+	datagram->msg.maxsize = sizeof(datagram->buf);
+	datagram->msg.cursize = 0;
+	datagram->msg.allowoverflow = true;
+	datagram->msg.overflowed = false;
+
+	// add the client specific data to the datagram
+	SV_WriteClientdataToMessage(client, &datagram->msg);
+
+	// send over all the objects that are in the PVS
+	// this will include clients, a packetentities, and
+	// possibly a nails update
+	datagram->error = SV_WriteEntitiesToClient(client, datagram->pvs,
+						   &datagram->msg);
+	if (datagram->error)
+	    continue;
+
+	// copy the accumulated multicast datagram
+	// for this client out to the message
+	datagram->datagram_overflowed = client->datagram.overflowed;
+	if (!client->datagram.overflowed)
+	    SZ_Write(&datagram->msg, client->datagram.data,
+		     client->datagram.cursize);
+	SZ_Clear(&client->datagram);
+    }
+
+    return NULL;
+}
+
 /*
 =======================
-SV_SendClientDatagram
+SV_SendClientDatagrams
 =======================
 */
-static qboolean
-SV_SendClientDatagram(client_t *client)
+static void
+SV_SendClientDatagrams(int count)
 {
-    byte buf[MAX_DATAGRAM];
-    sizebuf_t msg;
+    clientdatagram_t *datagram;
+    client_t *client;
+    edict_t *clent;
+    vec3_t org;
+    size_t size;
+    int i, numjobs;
 
-    msg.data = buf;
-    msg.maxsize = sizeof(buf);
-    msg.cursize = 0;
-    msg.allowoverflow = true;
-    msg.overflowed = false;
+    if (!count)
+	return;
 
-    // add the client specific data to the datagram
-    SV_WriteClientdataToMessage(client, &msg);
+    // Mod_FatPVS works in a shared buffer, so each client gets a copy
+    size = Mod_LeafbitsSize(sv.worldmodel->numleafs);
+    if (size > sv_datagram_pvssize) {
+	free(sv_datagram_pvs);
+	sv_datagram_pvs = malloc(MAX_CLIENTS * size);
+	if (!sv_datagram_pvs)
+	    SV_Error("%s: couldn't allocate the PVS copies", __func__);
+	sv_datagram_pvssize = size;
+    }
+    for (i = 0; i < count; i++) {
+	datagram = &sv_datagrams[i];
+	clent = datagram->client->edict;
+	VectorAdd(clent->v.origin, clent->v.view_ofs, org);
+	datagram->pvs = (leafbits_t *)(sv_datagram_pvs + i * size);
+	memcpy(datagram->pvs, Mod_FatPVS(sv.worldmodel, org), size);
+    }
+
+    if (sv_threads.value && count > 1) {
+	numjobs = Job_Split(sv_datagram_jobs, 0,
+			    sizeof(sv_datagram_jobs) / sizeof(job_t),
+			    SV_BuildClientDatagrams, sv_datagrams, count, 1);
+	Job_RunBatch(sv_datagram_jobs, numjobs);
+    } else {
+	SV_BuildClientDatagrams(sv_datagrams, 0, count);
+    }
 
-    // send over all the objects that are in the PVS
-    // this will include clients, a packetentities, and
-    // possibly a nails update
-    SV_WriteEntitiesToClient(client, &msg);
+    for (i = 0; i < count; i++) {
+	datagram = &sv_datagrams[i];
+	client = datagram->client;
+	if (datagram->error)
+	    SV_Error("%s", datagram->error);
 
-    // copy the accumulated multicast datagram
-    // for this client out to the message
-    if (client->datagram.overflowed)
-	Con_Printf("WARNING: datagram overflowed for %s\n", client->name);
-    else
-	SZ_Write(&msg, client->datagram.data, client->datagram.cursize);
-    SZ_Clear(&client->datagram);
+	if (datagram->datagram_overflowed)
+	    Con_Printf("WARNING: datagram overflowed for %s\n", client->name);
 
-    // send deltas over reliable stream
-    if (Netchan_CanReliable(&client->netchan))
-	SV_UpdateClientStats(client);
+	// send deltas over reliable stream
+	if (Netchan_CanReliable(&client->netchan))
+	    SV_UpdateClientStats(client);
 
-    if (msg.overflowed) {
-	Con_Printf("WARNING: msg overflowed for %s\n", client->name);
-	SZ_Clear(&msg);
+	if (datagram->msg.overflowed) {
+	    Con_Printf("WARNING: msg overflowed for %s\n", client->name);
+	    SZ_Clear(&datagram->msg);
+	}
+	// send the datagram
+	Netchan_Transmit(&client->netchan, datagram->msg.cursize,
+			 datagram->buf);
     }
-    // send the datagram
-    Netchan_Transmit(&client->netchan, msg.cursize, buf);
-
-    return true;
 }
 
 /*
@@ -615,6 +769,13 @@ SV_UpdateToReliableMessages(void)
     client_t *client;
     eval_t *val;
     edict_t *ent;
+    sizebuf_t frags, *demo;
+    byte buf[4];
+
+    frags.allowoverflow = false;
+    frags.overflowed = false;
+    frags.data = buf;
+    frags.maxsize = sizeof(buf);
 
 // check for changes to be sent over the reliable streams to all clients
     for (i = 0, host_client = svs.clients; i < MAX_CLIENTS;
@@ -626,27 +787,32 @@ SV_UpdateToReliableMessages(void)
 	    SV_FullClientUpdate(host_client, &sv.reliable_datagram);
 	}
 	if (host_client->old_frags != host_client->edict->v.frags) {
+	    frags.cursize = 0;
+	    MSG_WriteByte(&frags, svc_updatefrags);
+	    MSG_WriteByte(&frags, i);
+	    MSG_WriteShort(&frags, host_client->edict->v.frags);
 	    for (j = 0, client = svs.clients; j < MAX_CLIENTS; j++, client++) {
 		if (client->state < cs_connected)
 		    continue;
-		ClientReliableWrite_Begin(client, svc_updatefrags, 4);
-		ClientReliableWrite_Byte(client, i);
-		ClientReliableWrite_Short(client,
-					  host_client->edict->v.frags);
+		ClientReliableCheckBlock(client, frags.cursize);
+		ClientReliableWrite_SZ(client, frags.data, frags.cursize);
 	    }
+	    demo = SV_DemoReliable(frags.cursize);
+	    if (demo)
+		SZ_Write(demo, frags.data, frags.cursize);
 
 	    host_client->old_frags = host_client->edict->v.frags;
 	}
 	// maxspeed/entgravity changes
 	ent = host_client->edict;
 
-	val = GetEdictFieldValue(ent, "gravity");
+	val = ED_EXTFIELD(ent, EXTFIELD_GRAVITY);
 	if (val && host_client->entgravity != val->_float) {
 	    host_client->entgravity = val->_float;
 	    ClientReliableWrite_Begin(host_client, svc_entgravity, 5);
 	    ClientReliableWrite_Float(host_client, host_client->entgravity);
 	}
-	val = GetEdictFieldValue(ent, "maxspeed");
+	val = ED_EXTFIELD(ent, EXTFIELD_MAXSPEED);
 	if (val && host_client->maxspeed != val->_float) {
 	    host_client->maxspeed = val->_float;
 	    ClientReliableWrite_Begin(host_client, svc_maxspeed, 5);
@@ -672,6 +838,14 @@ SV_UpdateToReliableMessages(void)
 	SZ_Write(&client->datagram, sv.datagram.data, sv.datagram.cursize);
     }
 
+    demo = SV_DemoReliable(sv.reliable_datagram.cursize);
+    if (demo)
+	SZ_Write(demo, sv.reliable_datagram.data,
+		 sv.reliable_datagram.cursize);
+    demo = SV_DemoDatagram();
+    if (demo)
+	SZ_Write(demo, sv.datagram.data, sv.datagram.cursize);
+
     SZ_Clear(&sv.reliable_datagram);
     SZ_Clear(&sv.datagram);
 }
@@ -685,12 +859,14 @@ SV_SendClientMessages
 void
 SV_SendClientMessages(void)
 {
-    int i, j;
+    int i, j, numdatagrams;
     client_t *c;
 
 // update frags, names, etc
     SV_UpdateToReliableMessages();
 
+    numdatagrams = 0;
+
 // build individual updates
     for (i = 0, c = svs.clients; i < MAX_CLIENTS; i++, c++) {
 	if (!c->state)
@@ -749,15 +925,20 @@ SV_SendClientMessages(void)
 	c->send_message = false;	// try putting this after choke?
 	if (!sv.paused && !Netchan_CanPacket(&c->netchan)) {
 	    c->chokecount++;
+	    c->chokes++;
 	    continue;		// bandwidth choke
 	}
 
 	if (c->state == cs_spawned)
-	    SV_SendClientDatagram(c);
-	else
+	    sv_datagrams[numdatagrams++].client = c;
+	else if (!SV_SendDownloadChunk(c))
 	    Netchan_Transmit(&c->netchan, 0, NULL);	// just update reliable
 
     }
+
+    SV_SendClientDatagrams(numdatagrams);
+
+    SV_DemoFrame();
 }
 
 
@@ -348,11 +348,11 @@ SV_Spawn_f(void)
     ent->v.netname = PR_SetString(host_client->name);
 
     host_client->entgravity = 1.0;
-    val = GetEdictFieldValue(ent, "gravity");
+    val = ED_EXTFIELD(ent, EXTFIELD_GRAVITY);
     if (val)
 	val->_float = 1.0;
     host_client->maxspeed = sv_maxspeed.value;
-    val = GetEdictFieldValue(ent, "maxspeed");
+    val = ED_EXTFIELD(ent, EXTFIELD_MAXSPEED);
     if (val)
 	val->_float = sv_maxspeed.value;
 
@@ -470,8 +470,8 @@ SV_Begin_f(void)
 
     //check he's not cheating
 
-    pmodel = atoi(Info_ValueForKey(host_client->userinfo, "pmodel"));
-    emodel = atoi(Info_ValueForKey(host_client->userinfo, "emodel"));
+    pmodel = atoi(Info_Get(&host_client->userkeys, "pmodel"));
+    emodel = atoi(Info_Get(&host_client->userkeys, "emodel"));
 
     if (pmodel != sv.model_player_checksum || emodel != sv.eyes_player_checksum)
 	SV_BroadcastPrintf(PRINT_HIGH, "%s WARNING: non standard player/eyes "
@@ -500,6 +500,101 @@ SV_Begin_f(void)
 
 //=============================================================================
 
+/*
+ * Streamed chunks go out unreliably, after whatever reliable data the
+ * packet carries; this much room is kept for the chunk header.
+ */
+#define DOWNLOAD_CHUNK_HEADER	12
+#define DOWNLOAD_TIMEOUT	1.0	// resend from the ack after this long
+
+/*
+==================
+SV_AckDownload
+
+The client has the first 'offset' bytes of a streamed download. If it saw
+a later chunk arrive first, what follows 'offset' was lost and the stream
+goes back to it.
+==================
+*/
+static void
+SV_AckDownload(client_t *client, int offset, qboolean lost)
+{
+    if (offset < client->downloadacked || offset > client->downloadsize)
+	return;
+
+    if (offset == client->downloadsize) {
+	fclose(client->download);
+	client->download = NULL;
+	client->downloadwindow = 0;
+	return;
+    }
+
+    if (lost && client->downloadcount > offset)
+	client->downloadcount = offset;
+    client->downloadacked = offset;
+    client->downloadacktime = realtime;
+}
+
+/*
+==================
+SV_SendDownloadChunk
+
+Sends the next chunk of a streamed download as the client's packet for
+this frame, if the window has room. Returns false if there was nothing to
+send.
+==================
+*/
+qboolean
+SV_SendDownloadChunk(client_t *client)
+{
+    byte buffer[MAX_MSGLEN];
+    sizebuf_t msg;
+    netchan_t *chan = &client->netchan;
+    int space, r;
+
+    if (!client->download || !client->downloadwindow)
+	return false;
+
+    // nothing heard for a while, start again from what the client has
+    if (realtime - client->downloadacktime > DOWNLOAD_TIMEOUT) {
+	client->downloadcount = client->downloadacked;
+	client->downloadacktime = realtime;
+    }
+
+    r = client->downloadsize - client->downloadcount;
+    if (r > client->downloadacked + client->downloadwindow
+	- client->downloadcount)
+	r = client->downloadacked + client->downloadwindow
+	    - client->downloadcount;
+    space = MAX_MSGLEN - qmax(chan->reliable_length, chan->message.cursize)
+	- DOWNLOAD_CHUNK_HEADER;
+    if (r > space)
+	r = space;
+    if (r <= 0)
+	return false;
+
+    if (fseek(client->download, client->downloadbase + client->downloadcount,
+	      SEEK_SET))
+	return false;
+    memset(&msg, 0, sizeof(msg));
+    msg.data = buffer;
+    msg.maxsize = sizeof(buffer);
+    MSG_WriteByte(&msg, svc_downloadchunk);
+    MSG_WriteByte(&msg, client->downloadstream);
+    MSG_WriteLong(&msg, client->downloadsize);
+    MSG_WriteLong(&msg, client->downloadcount);
+    r = fread(msg.data + msg.cursize + 2, 1, r, client->download);
+    if (r <= 0)
+	return false;
+    MSG_WriteShort(&msg, r);
+    msg.cursize += r;
+
+    Netchan_Transmit(chan, msg.cursize, msg.data);
+    client->downloadcount += r;
+
+    return true;
+}
+
 /*
 ==================
 SV_NextDownload_f
@@ -508,17 +603,36 @@ SV_NextDownload_f
 void
 SV_NextDownload_f(void)
 {
-    byte buffer[1024];
-    int r;
+    byte buffer[MAX_MSGLEN];
+    int r, chunk;
     int percent;
     int size;
 
     if (!host_client->download)
 	return;
 
+    if (host_client->downloadwindow) {
+	SV_AckDownload(host_client, atoi(Cmd_Argv(1)), Cmd_Argc() > 2);
+	return;
+    }
+
+    /*
+     * Each chunk takes a round trip, so before the client is in the game
+     * it gets as much as still fits in the reliable message. Once spawned,
+     * smaller chunks leave room in its packets for the game.
+     */
+    chunk = 768;
+    if (host_client->state != cs_spawned && !host_client->num_backbuf) {
+	sizebuf_t *message = &host_client->netchan.message;
+	int space = message->maxsize - message->cursize - 7;
+
+	if (space > chunk)
+	    chunk = qmin(space, (int)sizeof(buffer));
+    }
+
     r = host_client->downloadsize - host_client->downloadcount;
-    if (r > 768)
-	r = 768;
+    if (r > chunk)
+	r = chunk;
     r = fread(buffer, 1, r, host_client->download);
     ClientReliableWrite_Begin(host_client, svc_download, 6 + r);
     ClientReliableWrite_Short(host_client, r);
@@ -638,6 +752,14 @@ void
 SV_BeginDownload_f(void)
 {
     char name[MAX_OSPATH], *p;
+    int window = 0;
+
+    // the client counts its stream requests the same way, so it can tell
+    // chunks of an earlier stream apart
+    if (Cmd_Argc() > 2) {
+	window = atoi(Cmd_Argv(2));
+	host_client->downloadstream = (host_client->downloadstream + 1) & 255;
+    }
 
     /* Lowercase name (needed for casesen file systems) */
     snprintf(name, sizeof(name), "%s", Cmd_Argv(1));
@@ -673,6 +795,7 @@ SV_BeginDownload_f(void)
 
     host_client->downloadsize = COM_FOpenFile(name, &host_client->download);
     host_client->downloadcount = 0;
+    host_client->downloadwindow = 0;
 
     if (!host_client->download
 	// special check for maps, if it came from a pak file, don't allow
@@ -690,7 +813,17 @@ SV_BeginDownload_f(void)
 	return;
     }
 
-    SV_NextDownload_f();
+    // stream it if asked to, and the client's packets aren't busy with
+    // the game
+    if (window && host_client->state != cs_spawned)
+	host_client->downloadwindow = qmin(window, DOWNLOAD_MAX_WINDOW);
+    if (host_client->downloadwindow) {
+	host_client->downloadbase = ftell(host_client->download);
+	host_client->downloadacked = 0;
+	host_client->downloadacktime = realtime;
+    } else {
+	SV_NextDownload_f();
+    }
     Sys_Printf("Uploading %s to %s\n", name, host_client->name);
 }
 
@@ -709,13 +842,14 @@ SV_Say(qboolean team)
     size_t len, space;
     const char *p;
     char text[2048];
-    char t1[32], *t2;
+    char t1[32];
+    const char *t2;
 
     if (Cmd_Argc() < 2)
 	return;
 
     if (team) {
-	strncpy(t1, Info_ValueForKey(host_client->userinfo, "team"), 31);
+	strncpy(t1, Info_Get(&host_client->userkeys, "team"), 31);
 	t1[31] = 0;
     }
 
@@ -783,7 +917,7 @@ SV_Say(qboolean team)
 		if (!client->spectator)
 		    continue;
 	    } else {
-		t2 = Info_ValueForKey(client->userinfo, "team");
+		t2 = Info_Get(&client->userkeys, "team");
 		if (strcmp(t1, t2) || client->spectator)
 		    continue;	// on different teams
 	    }
@@ -1061,7 +1195,7 @@ SV_SetInfo_f(void)
     if (Cmd_Argv(1)[0] == '*')
 	return;			// don't set priveledged values
 
-    strcpy(oldval, Info_ValueForKey(host_client->userinfo, Cmd_Argv(1)));
+    strcpy(oldval, Info_Get(&host_client->userkeys, Cmd_Argv(1)));
 
     Info_SetValueForKey(host_client->userinfo, Cmd_Argv(1), Cmd_Argv(2),
 			MAX_INFO_STRING);
@@ -1082,7 +1216,7 @@ SV_SetInfo_f(void)
     MSG_WriteByte(&sv.reliable_datagram, i);
     MSG_WriteString(&sv.reliable_datagram, Cmd_Argv(1));
     MSG_WriteString(&sv.reliable_datagram,
-		    Info_ValueForKey(host_client->userinfo, Cmd_Argv(1)));
+		    Info_Get(&host_client->userkeys, Cmd_Argv(1)));
 }
 
 /*
@@ -1454,6 +1588,210 @@ SV_PostRunCmd(void)
 }
 
 
+/*
+===============================================================================
+
+LAG COMPENSATION
+
+The origin of every spawned player is recorded each time packets go out, so
+the traces a client's commands fire can be made against the players where
+that client last saw them. Nothing is moved or relinked: only tracelines run
+while the commands are executed see the rewound origins.
+
+===============================================================================
+*/
+
+#define ANTILAG_HISTORY 64	// must be a power of two
+#define ANTILAG_INTERVAL 0.01	// don't record more often than this
+#define ANTILAG_TELEPORT 64	// moved further than this between samples
+
+static struct {
+    double time[ANTILAG_HISTORY];
+    unsigned present[ANTILAG_HISTORY];	// bit per client recorded
+    float origin[ANTILAG_HISTORY][3][MAX_CLIENTS];
+    int count;
+    int spawncount;
+} antilag;
+
+static client_t *antilag_client;	// running commands for, or NULL
+static double antilag_time;
+static qboolean antilag_ready;
+static unsigned antilag_rewound;
+static vec3_t antilag_origins[MAX_CLIENTS];
+
+/*
+===========
+SV_AntilagRecord
+
+Called just before the clients' messages are sent
+===========
+*/
+void
+SV_AntilagRecord(void)
+{
+    client_t *cl;
+    edict_t *ent;
+    unsigned present;
+    int i, slot;
+
+    if (antilag.spawncount != svs.spawncount) {
+	antilag.count = 0;
+	antilag.spawncount = svs.spawncount;
+    }
+    if (!sv_antilag.value)
+	return;
+    if (antilag.count) {
+	slot = (antilag.count - 1) & (ANTILAG_HISTORY - 1);
+	if (realtime - antilag.time[slot] < ANTILAG_INTERVAL)
+	    return;
+    }
+
+    slot = antilag.count++ & (ANTILAG_HISTORY - 1);
+    present = 0;
+    for (i = 0, cl = svs.clients; i < MAX_CLIENTS; i++, cl++) {
+	if (cl->state != cs_spawned || cl->spectator)
+	    continue;
+	ent = cl->edict;
+	antilag.origin[slot][0][i] = ent->v.origin[0];
+	antilag.origin[slot][1][i] = ent->v.origin[1];
+	antilag.origin[slot][2][i] = ent->v.origin[2];
+	present |= 1u << i;
+    }
+    antilag.time[slot] = realtime;
+    antilag.present[slot] = present;
+}
+
+/*
+===========
+SV_AntilagBegin
+
+The commands about to be run were made while the client was looking at the
+last frame it acknowledged, so that's the moment the other players are
+rewound to, as far back as sv_antilag_max allows.
+===========
+*/
+static void
+SV_AntilagBegin(client_t *cl)
+{
+    const client_frame_t *frame;
+    double time;
+
+    if (!sv_antilag.value || cl->spectator || !antilag.count)
+	return;
+
+    frame = &cl->frames[cl->netchan.incoming_acknowledged & UPDATE_MASK];
+    time = frame->senttime;
+    if (time > realtime)
+	return;
+    if (time < realtime - sv_antilag_max.value)
+	time = realtime - sv_antilag_max.value;
+
+    antilag_client = cl;
+    antilag_time = time;
+    antilag_ready = false;
+}
+
+static void
+SV_AntilagEnd(void)
+{
+    antilag_client = NULL;
+}
+
+/*
+===========
+SV_AntilagRewind
+
+Finds the origins the other players had at antilag_time, interpolated
+between the two samples either side of it. Done the first time a trace
+wants them, so commands that fire nothing cost nothing.
+===========
+*/
+static void
+SV_AntilagRewind(void)
+{
+    int i, j, count, before, after, self;
+    unsigned rewound;
+    float frac, delta;
+    const float *from, *to;
+
+    antilag_ready = true;
+    antilag_rewound = 0;
+
+    count = qmin(antilag.count, ANTILAG_HISTORY);
+    for (i = 1; i <= count; i++) {
+	if (antilag.time[(antilag.count - i) & (ANTILAG_HISTORY - 1)] <= antilag_time)
+	    break;
+    }
+    if (i > count)
+	return;			// older than the history goes
+    before = (antilag.count - i) & (ANTILAG_HISTORY - 1);
+    after = i > 1 ? (antilag.count - i + 1) & (ANTILAG_HISTORY - 1) : before;
+
+    rewound = antilag.present[before] & antilag.present[after];
+    self = antilag_client - svs.clients;
+    rewound &= ~(1u << self);
+    for (i = 0; i < MAX_CLIENTS; i++) {
+	if (svs.clients[i].state != cs_spawned || svs.clients[i].spectator)
+	    rewound &= ~(1u << i);
+    }
+    if (!rewound)
+	return;
+
+    if (after == before)
+	frac = 0;
+    else
+	frac = (antilag_time - antilag.time[before]) /
+	    (antilag.time[after] - antilag.time[before]);
+
+    for (j = 0; j < 3; j++) {
+	from = antilag.origin[before][j];
+	to = antilag.origin[after][j];
+	for (i = 0; i < MAX_CLIENTS; i++)
+	    antilag_origins[i][j] = from[i] + frac * (to[i] - from[i]);
+    }
+
+    // don't drag a player who teleported across the map between samples
+    for (i = 0; i < MAX_CLIENTS; i++) {
+	if (!(rewound & (1u << i)))
+	    continue;
+	for (j = 0; j < 3; j++) {
+	    delta = antilag.origin[after][j][i] - antilag.origin[before][j][i];
+	    if (delta > ANTILAG_TELEPORT || delta < -ANTILAG_TELEPORT)
+		break;
+	}
+	if (j == 3)
+	    continue;
+	from = frac < 0.5 ? antilag.origin[before][0] : antilag.origin[after][0];
+	for (j = 0; j < 3; j++)
+	    antilag_origins[i][j] = from[j * MAX_CLIENTS + i];
+    }
+
+    antilag_rewound = rewound;
+}
+
+/*
+===========
+SV_AntilagTraceline
+
+A traceline from QuakeC, against the other players where the client whose
+commands are running saw them
+===========
+*/
+trace_t
+SV_AntilagTraceline(vec3_t start, vec3_t end, int type, edict_t *passedict)
+{
+    if (!antilag_client || type == MOVE_NOMONSTERS)
+	return SV_Move(start, vec3_origin, vec3_origin, end, type, passedict);
+
+    if (!antilag_ready)
+	SV_AntilagRewind();
+    if (!antilag_rewound)
+	return SV_Move(start, vec3_origin, vec3_origin, end, type, passedict);
+
+    return SV_MoveRewound(start, vec3_origin, vec3_origin, end, type,
+			  passedict, antilag_rewound, antilag_origins);
+}
+
 /*
 ===================
 SV_ExecuteClientMessage
@@ -1557,6 +1895,7 @@ SV_ExecuteClientMessage(client_t *cl)
 	    }
 
 	    if (!sv.paused) {
+		SV_AntilagBegin(cl);
 		SV_PreRunCmd();
 
 		if (net_drop < 20) {
@@ -1572,6 +1911,7 @@ SV_ExecuteClientMessage(client_t *cl)
 		SV_RunCmd(&newcmd);
 
 		SV_PostRunCmd();
+		SV_AntilagEnd();
 	    }
 
 	    cl->lastcmd = newcmd;
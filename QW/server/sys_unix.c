@@ -17,9 +17,14 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
+#ifdef __linux__
+#define _GNU_SOURCE		/* sched_setaffinity */
+#include <sched.h>
+#endif
 #include <sys/types.h>
 
 #include "common.h"
+#include "console.h"
 #include "cvar.h"
 #include "qwsvdef.h"
 #include "server.h"
@@ -29,6 +34,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <unistd.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <time.h>
 
 // FIXME - header hacks
 extern int net_socket;
@@ -36,6 +42,18 @@ extern int net_socket;
 static cvar_t sys_nostdout = { "sys_nostdout", "0" };
 static cvar_t sys_extrasleep = { "sys_extrasleep", "0" };
 
+/*
+ * select() only wakes us to within the scheduler's granularity, so physics
+ * frames land late by a varying amount. With sys_spintime set, the wait
+ * for a physics frame sleeps until that many milliseconds before it's due
+ * and then polls the socket until it is, which keeps the frames evenly
+ * spaced at the cost of the time spent spinning. sys_affinity pins the
+ * server to one CPU (-1 leaves it to the scheduler), so it isn't moved
+ * between cores and their caches in the middle of a frame.
+ */
+static cvar_t sys_spintime = { "sys_spintime", "0" };
+static cvar_t sys_affinity = { "sys_affinity", "-1" };
+
 static qboolean stdin_ready;
 
 /*
@@ -89,18 +107,30 @@ Sys_DoubleTime
 double
 Sys_DoubleTime(void)
 {
-    struct timeval tp;
-    struct timezone tzp;
-    static int secbase;
+#ifdef CLOCK_MONOTONIC
+    /* not moved by changes to the time of day */
+    struct timespec ts;
+    static time_t secbase;
+
+    if (!clock_gettime(CLOCK_MONOTONIC, &ts)) {
+	if (!secbase)
+	    secbase = ts.tv_sec - 1;
+	return (ts.tv_sec - secbase) + ts.tv_nsec / 1000000000.0;
+    }
+#endif
+    {
+	struct timeval tp;
+	static int secbase;
 
-    gettimeofday(&tp, &tzp);
+	gettimeofday(&tp, NULL);
 
-    if (!secbase) {
-	secbase = tp.tv_sec;
-	return tp.tv_usec / 1000000.0;
-    }
+	if (!secbase) {
+	    secbase = tp.tv_sec;
+	    return tp.tv_usec / 1000000.0;
+	}
 
-    return (tp.tv_sec - secbase) + tp.tv_usec / 1000000.0;
+	return (tp.tv_sec - secbase) + tp.tv_usec / 1000000.0;
+    }
 }
 
 /*
@@ -204,11 +234,92 @@ Quake calls this so the system can register variables before host_hunklevel
 is marked
 =============
 */
+static void
+Sys_Affinity_f(cvar_t *var)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    int cpu = var->value;
+
+    CPU_ZERO(&set);
+    if (cpu < 0) {
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	    CPU_SET(cpu, &set);
+    } else if (cpu < CPU_SETSIZE) {
+	CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+	Con_Printf("Couldn't set the CPU affinity: %s\n", strerror(errno));
+#else
+    if (var->value >= 0)
+	Con_Printf("%s isn't supported here\n", var->name);
+#endif
+}
+
 void
 Sys_Init(void)
 {
     Cvar_RegisterVariable(&sys_nostdout);
     Cvar_RegisterVariable(&sys_extrasleep);
+    Cvar_RegisterVariable(&sys_spintime);
+    Cvar_RegisterVariable(&sys_affinity);
+    Cvar_SetCallback(&sys_affinity, Sys_Affinity_f);
+}
+
+/*
+=============
+Sys_WaitForFrame
+
+Waits for a packet, a line on the console or the deadline (if there is one,
+and at most a second otherwise), spinning out the last sys_spintime
+milliseconds before a deadline
+=============
+*/
+static void
+Sys_WaitForFrame(double deadline)
+{
+    struct timeval timeout;
+    fd_set fdset;
+    double now, wait, spin;
+
+    spin = qmax(sys_spintime.value, 0) / 1000;
+    for (;;) {
+	FD_ZERO(&fdset);
+	if (do_stdin)
+	    FD_SET(0, &fdset);
+	FD_SET(net_socket, &fdset);
+
+	now = Sys_DoubleTime();
+	if (deadline < 0) {
+	    wait = 1;
+	} else {
+	    wait = deadline - now;
+	    if (wait <= 0)
+		return;
+	    wait = wait > spin ? wait - spin : 0;
+	}
+	if (wait >= 1) {
+	    timeout.tv_sec = 1;
+	    timeout.tv_usec = 0;
+	} else {
+	    timeout.tv_sec = 0;
+	    timeout.tv_usec = wait * 1000000;
+	}
+
+	switch (select(net_socket + 1, &fdset, NULL, NULL, &timeout)) {
+	case -1:
+	    if (errno == EINTR)
+		continue;
+	    return;
+	case 0:
+	    if (deadline < 0)
+		return;
+	    continue;		// the spin, or the rest of the sleep
+	default:
+	    stdin_ready = FD_ISSET(0, &fdset);
+	    return;
+	}
+    }
 }
 
 /*
@@ -219,10 +330,8 @@ main
 int
 main(int argc, const char *argv[])
 {
-    double time, oldtime, newtime;
+    double time, oldtime, newtime, wait;
     quakeparms_t parms;
-    fd_set fdset;
-    struct timeval timeout;
     int j;
 
     memset(&parms, 0, sizeof(parms));
@@ -236,7 +345,7 @@ main(int argc, const char *argv[])
     j = COM_CheckParm("-mem");
     if (j)
 	parms.memsize = (int)(Q_atof(com_argv[j + 1]) * 1024 * 1024);
-    if ((parms.membase = malloc(parms.memsize)) == NULL)
+    if ((parms.membase = Memory_Reserve(parms.memsize)) == NULL)
 	Sys_Error("Can't allocate %d", parms.memsize);
 
     parms.basedir = stringify(QBASEDIR);
@@ -258,18 +367,14 @@ main(int argc, const char *argv[])
     oldtime = Sys_DoubleTime() - 0.1;
     while (1) {
 	// select on the net socket and stdin
-	// the only reason we have a timeout at all is so that if the last
-	// connected client times out, the message would not otherwise
-	// be printed until the next event.
-	FD_ZERO(&fdset);
-	if (do_stdin)
-	    FD_SET(0, &fdset);
-	FD_SET(net_socket, &fdset);
-	timeout.tv_sec = 1;
-	timeout.tv_usec = 0;
-	if (select(net_socket + 1, &fdset, NULL, NULL, &timeout) == -1)
-	    continue;
-	stdin_ready = FD_ISSET(0, &fdset);
+	// packets are handled as soon as they arrive; the deadline wakes us
+	// for the next physics frame while anyone is playing, so the world
+	// doesn't wait on their packets to move. Otherwise it is only so
+	// that if the last connected client times out, the message would
+	// not be printed until the next event.
+	stdin_ready = false;
+	wait = SV_PhysicsTimeout();
+	Sys_WaitForFrame(wait >= 0 ? oldtime + wait : -1);
 
 	// find time passed since last cycle
 	newtime = Sys_DoubleTime();
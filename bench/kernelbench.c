@@ -0,0 +1,764 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// kernelbench.c -- times the software renderer's inner loops on their own
+
+/*
+ * Built with "make kernelbench". The span, surface block, polyset and
+ * palette conversion kernels are compiled in here along with the rest of
+ * their source files, so that the static SIMD variants and the per thread
+ * block state can be reached, and are run over synthetic inputs: a sloped
+ * textured plane cut into spans of random lengths, random textures and
+ * light blocks, and a random frame.
+ *
+ * Each kernel reports nanoseconds per pixel for every variant built in.
+ * The first variant is the C reference; the others' output must match it
+ * byte for byte, and a kernel with only the one variant prints a CRC of
+ * its output so it can be compared between builds. The exit status is 1
+ * if any variant didn't match.
+ *
+ *   kernelbench [-width w] [-height h] [-time seconds] [-seed n] [kernel...]
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc.c"
+#include "d_vars.c"
+#include "d_scan.c"
+#include "d_polyse.c"
+#include "mathlib.c"
+#include "r_surf.c"
+#include "vid_convert.c"
+
+#if defined(__SSE2__)
+#define BENCH_SIMD "sse2"
+#else
+#define BENCH_SIMD "neon"
+#endif
+
+/*
+ * ============================================================================
+ * What the kernels' files expect the rest of the engine to provide
+ * ============================================================================
+ */
+
+client_state_t cl;
+dlight_t cl_dlights[MAX_DLIGHTS];
+viddef_t vid;
+refdef_t r_refdef;
+vrect_t scr_vrect;
+int screenwidth;
+int r_pixbytes = 1;
+int r_framecount;
+cvar_t r_fullbright = { "r_fullbright", "0" };
+int coloredlights;
+unsigned d_8to24table[256];
+byte palmap2[64][64][64];
+
+int intsintable[TURB_TABLE_SIZE];
+int sintable[TURB_TABLE_SIZE];
+THREAD_LOCAL surfcache_t *pcurrentcache;
+
+int ubasestep, errorterm, erroradjustup, erroradjustdown;
+short *zspantable[MAXHEIGHT];
+int d_scantable[MAXHEIGHT];
+void *acolormap;
+vec3_t lightcolor;
+affinetridesc_t r_affinetridesc;
+
+bool
+Sys_Error(const char *error, ...)
+{
+    va_list argptr;
+
+    va_start(argptr, error);
+    vfprintf(stderr, error, argptr);
+    va_end(argptr);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/* Everything here runs on the one thread */
+int
+Job_Split(job_t *jobs, int numjobs, int maxjobs, jobfunc_t func, void *data,
+	  int count, int grain)
+{
+    if (numjobs < maxjobs && count > 0) {
+	jobs[numjobs].func = func;
+	jobs[numjobs].data = data;
+	jobs[numjobs].start = 0;
+	jobs[numjobs].end = count;
+	numjobs++;
+    }
+    return numjobs;
+}
+
+const char *
+Job_RunBatch(job_t *jobs, int numjobs)
+{
+    const char *error = NULL;
+    int i;
+
+    for (i = 0; i < numjobs; i++) {
+	jobs[i].error = jobs[i].func(jobs[i].data, jobs[i].start, jobs[i].end);
+	if (jobs[i].error && !error)
+	    error = jobs[i].error;
+    }
+    return error;
+}
+
+/*
+ * ============================================================================
+ * Inputs
+ * ============================================================================
+ */
+
+#define BENCH_SURFSIZE	128	// texels across a lit surface at mip 0
+#define BENCH_SKINSIZE	512
+
+static int bench_width = 640;
+static int bench_height = 480;
+static double bench_time = 0.25;	// seconds timed per variant
+static unsigned bench_seed = 1;
+
+static byte *bench_view;		// the frame, bench_width wide
+static short *bench_zbuffer;
+static byte *bench_texture;		// a surface cache block as big as the view
+static byte *bench_frame;		// a random frame to convert
+static uint16_t *bench_out16;
+static uint32_t *bench_out32;
+static byte bench_colormap[256 * VID_GRADES];
+static surfcache_t bench_cache;
+
+static espan_t *bench_spans;
+static int bench_spanpixels;
+
+static byte bench_surftexels[BENCH_SURFSIZE * BENCH_SURFSIZE];
+static byte bench_surface[BENCH_SURFSIZE * BENCH_SURFSIZE];
+static int bench_lights[(BENCH_SURFSIZE / 16 + 1) * (BENCH_SURFSIZE / 16 + 1) * 3];
+
+static byte bench_skin[BENCH_SKINSIZE * BENCH_SKINSIZE];
+static spanpackage_t *bench_packages;
+static int bench_polypixels;
+
+static unsigned
+Bench_Random(void)
+{
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return bench_seed >> 8;
+}
+
+static void
+Bench_RandomBytes(byte *buf, int size, int limit)
+{
+    int i;
+
+    for (i = 0; i < size; i++)
+	buf[i] = Bench_Random() % limit;
+}
+
+static void *
+Bench_Alloc(size_t size)
+{
+    void *mem = calloc(1, size);
+
+    if (!mem)
+	Sys_Error("Out of memory allocating %lu bytes", (unsigned long)size);
+    return mem;
+}
+
+/*
+ * A plane sloping away up the view, 1/z going from 0.5 at the top to 0.25
+ * at the bottom and the texture coordinates being the screen coordinates
+ * scaled down by up to half. Each row is cut into spans of 1 to 72 pixels,
+ * as the edge list would leave them.
+ */
+static void
+Bench_MakeSpans(void)
+{
+    int u, v, count, numspans;
+    espan_t *span;
+
+    d_ziorigin = 0.5f;
+    d_zistepu = 0;
+    d_zistepv = -0.25f / bench_height;
+    d_sdivzorigin = 0;
+    d_sdivzstepu = 0.25f;
+    d_sdivzstepv = 0;
+    d_tdivzorigin = 0;
+    d_tdivzstepu = 0;
+    d_tdivzstepv = 0.25f;
+    sadjust = tadjust = 0;
+    bbextents = (bench_width << 16) - 1;
+    bbextentt = (bench_height << 16) - 1;
+
+    cacheblock = bench_texture;
+    cachewidth = bench_width;
+    bench_cache.mipscale = 1.0f;
+    pcurrentcache = &bench_cache;
+
+    bench_spans = Bench_Alloc(bench_width * bench_height * sizeof(espan_t));
+    numspans = 0;
+    for (v = 0; v < bench_height; v++) {
+	for (u = 0; u < bench_width; u += count) {
+	    count = 1 + Bench_Random() % 72;
+	    if (count > bench_width - u)
+		count = bench_width - u;
+	    span = &bench_spans[numspans++];
+	    span->u = u;
+	    span->v = v;
+	    span->count = count;
+	    span->pnext = span + 1;
+	}
+    }
+    bench_spans[numspans - 1].pnext = NULL;
+    bench_spanpixels = bench_width * bench_height;
+}
+
+/*
+ * A row of the view for each span package, stepping half a texel across
+ * the skin a pixel and going hotter and nearer along it
+ */
+static void
+Bench_MakePolySpans(void)
+{
+    spanpackage_t *package;
+    int v, rows;
+
+    rows = bench_height < BENCH_SKINSIZE / 2 ? bench_height : BENCH_SKINSIZE / 2;
+    bench_packages = Bench_Alloc((rows + 1) * sizeof(spanpackage_t));
+    bench_polypixels = 0;
+    for (v = 0; v < rows; v++) {
+	package = &bench_packages[v];
+	package->pdest = bench_view + v * bench_width;
+	package->pz = bench_zbuffer + v * bench_width;
+	package->count = -bench_width;
+	package->ptex = bench_skin + v * BENCH_SKINSIZE;
+	package->sfrac = 0;
+	package->tfrac = 0;
+	package->light = Bench_Random() & 0x1fff;
+	package->zi = (v + 1) << 16;
+	bench_polypixels += bench_width;
+    }
+    bench_packages[rows].count = -999999;
+
+    r_affinetridesc.skinwidth = BENCH_SKINSIZE;
+    a_ststepxwhole = 0;
+    a_sstepxfrac = 0x8000 * (BENCH_SKINSIZE / 2) / bench_width;
+    a_tstepxfrac = 0x2000;
+    r_lstepx = 0x1000 / bench_width;
+    r_zistepx = 0x100;
+}
+
+static void
+Bench_Init(void)
+{
+    int i, r, g, b;
+
+    bench_view = Bench_Alloc(bench_width * bench_height);
+    bench_zbuffer = Bench_Alloc(bench_width * bench_height * sizeof(short));
+    bench_texture = Bench_Alloc(bench_width * bench_height);
+    bench_frame = Bench_Alloc(bench_width * bench_height);
+    bench_out16 = Bench_Alloc(bench_width * bench_height * sizeof(uint16_t));
+    bench_out32 = Bench_Alloc(bench_width * bench_height * sizeof(uint32_t));
+
+    Bench_RandomBytes(bench_texture, bench_width * bench_height, 256);
+    Bench_RandomBytes(bench_frame, bench_width * bench_height, 256);
+    Bench_RandomBytes(bench_colormap, sizeof(bench_colormap), 256);
+    Bench_RandomBytes(bench_surftexels, sizeof(bench_surftexels), 256);
+    Bench_RandomBytes(bench_skin, sizeof(bench_skin), 256);
+    for (i = 0; i < (int)(sizeof(bench_lights) / sizeof(bench_lights[0])); i++)
+	bench_lights[i] = Bench_Random() & 0x3fff;
+
+    for (i = 0; i < 256; i++) {
+	r = Bench_Random() & 0xff;
+	g = Bench_Random() & 0xff;
+	b = Bench_Random() & 0xff;
+	d_8to24table[i] = r | (g << 8) | (b << 16);
+	d_8to16table[i] = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+	d_8to32table[i] = (r << 16) | (g << 8) | b;
+    }
+    VID_UpdateConvertTables();
+    Bench_RandomBytes(&palmap2[0][0][0], sizeof(palmap2), 256);
+    host_fullbrights = 224;
+
+    for (i = 0; i < TURB_TABLE_SIZE; ++i) {
+	sintable[i] = TURB_SURF_AMP
+	    + sin(i * 3.14159 * 2 / TURB_CYCLE) * TURB_SURF_AMP;
+	intsintable[i] = TURB_SCREEN_AMP
+	    + sin(i * 3.14159 * 2 / TURB_CYCLE) * TURB_SCREEN_AMP;
+    }
+    cl.time = 1.0;
+
+    vid.colormap = bench_colormap;
+    vid.width = vid.rowbytes = bench_width;
+    vid.height = bench_height;
+    acolormap = bench_colormap;
+    d_viewbuffer = bench_view;
+    d_pzbuffer = bench_zbuffer;
+    d_zwidth = bench_width;
+    screenwidth = bench_width;
+
+    Bench_MakeSpans();
+    Bench_MakePolySpans();
+}
+
+/*
+ * ============================================================================
+ * Kernels
+ * ============================================================================
+ */
+
+static void
+Bench_ClearView(void)
+{
+    memset(bench_view, 0, bench_width * bench_height);
+    memset(bench_zbuffer, 0, bench_width * bench_height * sizeof(short));
+}
+
+static void Bench_Spans8(void) { D_DrawSpans8(bench_spans); }
+static void Bench_Spans16(void) { D_DrawSpans16(bench_spans); }
+static void Bench_Spans16Qb(void) { D_DrawSpans16Qb(bench_spans); }
+static void Bench_Spans16QbDither(void) { D_DrawSpans16QbDither(bench_spans); }
+static void Bench_ZSpans(void) { D_DrawZSpansScalar(bench_spans); }
+static void Bench_Turbulent(void) { Turbulent8(bench_spans); }
+static void Bench_PolySpans8(void) { D_PolysetDrawSpans8(bench_packages); }
+
+static void
+Bench_PolySetup(void)
+{
+    Bench_ClearView();
+    d_aspancount = 0;
+    d_countextrastep = 0;
+    ubasestep = 0;
+    errorterm = -1;
+    erroradjustup = 0;
+    erroradjustdown = 1;
+}
+
+#ifdef D_SIMD_SPANS
+static void Bench_Spans16QbSIMD(void) { D_DrawSpans16QbSIMD(bench_spans); }
+static void Bench_Spans16QbDitherSIMD(void) { D_DrawSpans16QbDitherSIMD(bench_spans); }
+static void Bench_ZSpansSIMD(void) { D_DrawZSpansSIMD(bench_spans); }
+#endif
+
+/*
+ * Lays the block state out as R_DrawSurface would for a square surface
+ * with no lightmap building, then draws the blocks with 'drawer'.
+ */
+static void
+Bench_DrawSurface(int mip, qboolean rgb, void (*drawer)(void))
+{
+    int u, size, lightwidth;
+    byte *dest;
+
+    size = BENCH_SURFSIZE >> mip;
+    lightwidth = BENCH_SURFSIZE / 16 + 1;
+
+    surfrowbytes = size;
+    r_source = bench_surftexels;
+    blocksize = 16 >> mip;
+    blockdivshift = 4 - mip;
+    blockdivmask = (1 << blockdivshift) - 1;
+    r_lightwidth = lightwidth;
+    r_numhblocks = size >> blockdivshift;
+    r_numvblocks = size >> blockdivshift;
+    sourcetstep = size;
+    r_stepback = size * size;
+    r_sourcemax = r_source + size * size;
+    memcpy(blocklights, bench_lights, sizeof(bench_lights));
+
+    dest = bench_surface;
+    for (u = 0; u < r_numhblocks; u++) {
+	r_lightptr = blocklights + (rgb ? u * 3 : u);
+	prowdestbase = dest;
+	pbasesource = r_source + u * blocksize;
+	drawer();
+	dest += blocksize;
+    }
+}
+
+static void
+Bench_ClearSurface(void)
+{
+    memset(bench_surface, 0, sizeof(bench_surface));
+}
+
+static int bench_surfpixels[4] = {
+    BENCH_SURFSIZE * BENCH_SURFSIZE,
+    BENCH_SURFSIZE * BENCH_SURFSIZE / 4,
+    BENCH_SURFSIZE * BENCH_SURFSIZE / 16,
+    BENCH_SURFSIZE * BENCH_SURFSIZE / 64
+};
+
+static void Bench_Block8_0(void) { Bench_DrawSurface(0, false, R_DrawSurfaceBlock8_mip0); }
+static void Bench_Block8_1(void) { Bench_DrawSurface(1, false, R_DrawSurfaceBlock8_mip1); }
+static void Bench_Block8_2(void) { Bench_DrawSurface(2, false, R_DrawSurfaceBlock8_mip2); }
+static void Bench_Block8_3(void) { Bench_DrawSurface(3, false, R_DrawSurfaceBlock8_mip3); }
+static void Bench_BlockRGB_0(void) { Bench_DrawSurface(0, true, R_DrawSurfaceBlockRGB_mip0); }
+static void Bench_BlockRGB_1(void) { Bench_DrawSurface(1, true, R_DrawSurfaceBlockRGB_mip1); }
+static void Bench_BlockRGB_2(void) { Bench_DrawSurface(2, true, R_DrawSurfaceBlockRGB_mip2); }
+static void Bench_BlockRGB_3(void) { Bench_DrawSurface(3, true, R_DrawSurfaceBlockRGB_mip3); }
+
+#ifdef SURF_SIMD
+static void Bench_Block8_0SIMD(void) { Bench_DrawSurface(0, false, R_DrawSurfaceBlock8_mip0_SIMD); }
+static void Bench_Block8_1SIMD(void) { Bench_DrawSurface(1, false, R_DrawSurfaceBlock8_mip1_SIMD); }
+#endif
+
+static void
+Bench_ClearConvert(void)
+{
+    memset(bench_out16, 0, bench_width * bench_height * sizeof(uint16_t));
+    memset(bench_out32, 0, bench_width * bench_height * sizeof(uint32_t));
+}
+
+static void
+Bench_Convert(void)
+{
+    int v;
+
+    for (v = 0; v < bench_height; v++)
+	VID_ConvertSpanScalar(bench_frame + v * bench_width,
+			      bench_out16 + v * bench_width, bench_width);
+}
+
+#ifdef VID_NEON_TBL
+static void
+Bench_ConvertNEON(void)
+{
+    int v;
+
+    for (v = 0; v < bench_height; v++)
+	VID_ConvertSpan(bench_frame + v * bench_width,
+			bench_out16 + v * bench_width, bench_width);
+}
+#endif
+
+static void
+Bench_Convert32(void)
+{
+    int v;
+
+    for (v = 0; v < bench_height; v++)
+	VID_ConvertSpan32(bench_frame + v * bench_width,
+			  bench_out32 + v * bench_width, bench_width);
+}
+
+/*
+ * ============================================================================
+ * Timing and checking
+ * ============================================================================
+ */
+
+#define MAX_VARIANTS 2
+#define MAX_OUTPUTS 2
+
+typedef struct {
+    const char *isa;
+    void (*run)(void);
+} variant_t;
+
+typedef struct {
+    void **buf;
+    int size;			// bytes, worked out by Bench_OutputSize
+} output_t;
+
+typedef struct {
+    const char *name;
+    void (*setup)(void);	// clears the outputs and resets any state
+    const int *pixels;		// per run
+    output_t outputs[MAX_OUTPUTS];
+    variant_t variants[MAX_VARIANTS];
+} kernel_t;
+
+#define VIEW_OUTPUT { (void **)&bench_view, 1 }
+#define ZBUFFER_OUTPUT { (void **)&bench_zbuffer, 2 }
+#define SURFACE_OUTPUT { (void **)&bench_surfacep, 0 }
+#define OUT16_OUTPUT { (void **)&bench_out16, 2 }
+#define OUT32_OUTPUT { (void **)&bench_out32, 4 }
+
+static byte *bench_surfacep = bench_surface;
+static int bench_framepixels;
+
+static kernel_t bench_kernels[] = {
+    { "spans8", Bench_ClearView, &bench_spanpixels, { VIEW_OUTPUT },
+      { { "c", Bench_Spans8 } } },
+    { "spans16", Bench_ClearView, &bench_spanpixels, { VIEW_OUTPUT },
+      { { "c", Bench_Spans16 } } },
+    { "spans16qb", Bench_ClearView, &bench_spanpixels, { VIEW_OUTPUT },
+      { { "c", Bench_Spans16Qb },
+#ifdef D_SIMD_SPANS
+	{ BENCH_SIMD, Bench_Spans16QbSIMD },
+#endif
+      } },
+    { "spans16qbdither", Bench_ClearView, &bench_spanpixels, { VIEW_OUTPUT },
+      { { "c", Bench_Spans16QbDither },
+#ifdef D_SIMD_SPANS
+	{ BENCH_SIMD, Bench_Spans16QbDitherSIMD },
+#endif
+      } },
+    { "zspans", Bench_ClearView, &bench_spanpixels, { ZBUFFER_OUTPUT },
+      { { "c", Bench_ZSpans },
+#ifdef D_SIMD_SPANS
+	{ BENCH_SIMD, Bench_ZSpansSIMD },
+#endif
+      } },
+    { "turbulent8", Bench_ClearView, &bench_spanpixels, { VIEW_OUTPUT },
+      { { "c", Bench_Turbulent } } },
+    { "block8_mip0", Bench_ClearSurface, &bench_surfpixels[0], { SURFACE_OUTPUT },
+      { { "c", Bench_Block8_0 },
+#ifdef SURF_SIMD
+	{ BENCH_SIMD, Bench_Block8_0SIMD },
+#endif
+      } },
+    { "block8_mip1", Bench_ClearSurface, &bench_surfpixels[1], { SURFACE_OUTPUT },
+      { { "c", Bench_Block8_1 },
+#ifdef SURF_SIMD
+	{ BENCH_SIMD, Bench_Block8_1SIMD },
+#endif
+      } },
+    { "block8_mip2", Bench_ClearSurface, &bench_surfpixels[2], { SURFACE_OUTPUT },
+      { { "c", Bench_Block8_2 } } },
+    { "block8_mip3", Bench_ClearSurface, &bench_surfpixels[3], { SURFACE_OUTPUT },
+      { { "c", Bench_Block8_3 } } },
+    { "blockrgb_mip0", Bench_ClearSurface, &bench_surfpixels[0], { SURFACE_OUTPUT },
+      { { "c", Bench_BlockRGB_0 } } },
+    { "blockrgb_mip1", Bench_ClearSurface, &bench_surfpixels[1], { SURFACE_OUTPUT },
+      { { "c", Bench_BlockRGB_1 } } },
+    { "blockrgb_mip2", Bench_ClearSurface, &bench_surfpixels[2], { SURFACE_OUTPUT },
+      { { "c", Bench_BlockRGB_2 } } },
+    { "blockrgb_mip3", Bench_ClearSurface, &bench_surfpixels[3], { SURFACE_OUTPUT },
+      { { "c", Bench_BlockRGB_3 } } },
+    { "polyspans8", Bench_PolySetup, &bench_polypixels,
+      { VIEW_OUTPUT, ZBUFFER_OUTPUT },
+      { { "c", Bench_PolySpans8 } } },
+    { "convert16", Bench_ClearConvert, &bench_framepixels, { OUT16_OUTPUT },
+      { { "c", Bench_Convert },
+#ifdef VID_NEON_TBL
+	{ "neon", Bench_ConvertNEON },
+#endif
+      } },
+    { "convert32", Bench_ClearConvert, &bench_framepixels, { OUT32_OUTPUT },
+      { { "c", Bench_Convert32 } } },
+};
+
+#define NUM_KERNELS ((int)(sizeof(bench_kernels) / sizeof(bench_kernels[0])))
+
+static double
+Bench_Time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* The outputs' sizes in bytes; an element size of 0 means the surface */
+static int
+Bench_OutputSize(const output_t *output)
+{
+    if (!output->size)
+	return sizeof(bench_surface);
+    return bench_width * bench_height * output->size;
+}
+
+/*
+ * Runs the variant enough times to fill bench_time, best of three, and
+ * returns the nanoseconds per pixel
+ */
+static double
+Bench_TimeVariant(const kernel_t *kernel, const variant_t *variant)
+{
+    double start, elapsed, best;
+    int i, trial, runs;
+
+    kernel->setup();
+    start = Bench_Time();
+    variant->run();
+    elapsed = Bench_Time() - start;
+
+    runs = elapsed > 0 ? (int)(bench_time / 3 / elapsed) : 1000;
+    if (runs < 1)
+	runs = 1;
+
+    best = 0;
+    for (trial = 0; trial < 3; trial++) {
+	start = Bench_Time();
+	for (i = 0; i < runs; i++)
+	    variant->run();
+	elapsed = Bench_Time() - start;
+	if (!trial || elapsed < best)
+	    best = elapsed;
+    }
+
+    return best * 1e9 / ((double)runs * *kernel->pixels);
+}
+
+/* Runs the variant once from a clean setup, leaving its output in place */
+static void
+Bench_RunOnce(const kernel_t *kernel, const variant_t *variant)
+{
+    kernel->setup();
+    variant->run();
+}
+
+static unsigned short
+Bench_OutputCRC(const kernel_t *kernel)
+{
+    unsigned short crc;
+    const output_t *output;
+    int i, j, size;
+    const byte *data;
+
+    CRC_Init(&crc);
+    for (i = 0; i < MAX_OUTPUTS && kernel->outputs[i].buf; i++) {
+	output = &kernel->outputs[i];
+	data = *output->buf;
+	size = Bench_OutputSize(output);
+	for (j = 0; j < size; j++)
+	    CRC_ProcessByte(&crc, data[j]);
+    }
+    return crc;
+}
+
+/* Returns false if a variant's output differs from the reference's */
+static qboolean
+Bench_Kernel(const kernel_t *kernel)
+{
+    byte *reference[MAX_OUTPUTS];
+    const variant_t *variant;
+    const output_t *output;
+    int i, v, size, numvariants;
+    qboolean matched = true;
+    char check[32];
+    double ns;
+
+    numvariants = 0;
+    while (numvariants < MAX_VARIANTS && kernel->variants[numvariants].run)
+	numvariants++;
+
+    Bench_RunOnce(kernel, &kernel->variants[0]);
+    for (i = 0; i < MAX_OUTPUTS && kernel->outputs[i].buf; i++) {
+	output = &kernel->outputs[i];
+	size = Bench_OutputSize(output);
+	reference[i] = Bench_Alloc(size);
+	memcpy(reference[i], *output->buf, size);
+    }
+    if (numvariants == 1)
+	snprintf(check, sizeof(check), "crc %04x", Bench_OutputCRC(kernel));
+    else
+	snprintf(check, sizeof(check), "reference");
+
+    for (v = 0; v < numvariants; v++) {
+	variant = &kernel->variants[v];
+	if (v) {
+	    Bench_RunOnce(kernel, variant);
+	    snprintf(check, sizeof(check), "ok");
+	    for (i = 0; i < MAX_OUTPUTS && kernel->outputs[i].buf; i++) {
+		output = &kernel->outputs[i];
+		if (memcmp(reference[i], *output->buf,
+			   Bench_OutputSize(output))) {
+		    snprintf(check, sizeof(check), "MISMATCH");
+		    matched = false;
+		}
+	    }
+	}
+	ns = Bench_TimeVariant(kernel, variant);
+	printf("%-16s %-5s %9.3f %9.1f  %s\n", kernel->name, variant->isa,
+	       ns, 1000 / ns, check);
+    }
+
+    for (i = 0; i < MAX_OUTPUTS && kernel->outputs[i].buf; i++)
+	free(reference[i]);
+
+    return matched;
+}
+
+static void
+Bench_Usage(void)
+{
+    int i;
+
+    fprintf(stderr, "usage: kernelbench [-width w] [-height h] "
+	    "[-time seconds] [-seed n] [kernel...]\nkernels:");
+    for (i = 0; i < NUM_KERNELS; i++)
+	fprintf(stderr, " %s", bench_kernels[i].name);
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *names[NUM_KERNELS];
+    int i, j, numnames;
+    qboolean matched = true;
+
+    numnames = 0;
+    for (i = 1; i < argc; i++) {
+	if (argv[i][0] == '-' && i + 1 < argc) {
+	    if (!strcmp(argv[i], "-width"))
+		bench_width = atoi(argv[++i]);
+	    else if (!strcmp(argv[i], "-height"))
+		bench_height = atoi(argv[++i]);
+	    else if (!strcmp(argv[i], "-time"))
+		bench_time = atof(argv[++i]);
+	    else if (!strcmp(argv[i], "-seed"))
+		bench_seed = strtoul(argv[++i], NULL, 0);
+	    else
+		Bench_Usage();
+	} else if (argv[i][0] == '-' || numnames == NUM_KERNELS) {
+	    Bench_Usage();
+	} else {
+	    for (j = 0; j < NUM_KERNELS; j++)
+		if (!strcmp(argv[i], bench_kernels[j].name))
+		    break;
+	    if (j == NUM_KERNELS)
+		Bench_Usage();
+	    names[numnames++] = argv[i];
+	}
+    }
+    if (bench_width < 16 || bench_width > MAXWIDTH
+	|| bench_height < 16 || bench_height > MAXHEIGHT)
+	Sys_Error("The view must be from 16x16 to %ix%i", MAXWIDTH, MAXHEIGHT);
+
+    printf("%ix%i view, seed %u\n", bench_width, bench_height, bench_seed);
+    Bench_Init();
+    bench_framepixels = bench_width * bench_height;
+
+    printf("%-16s %-5s %9s %9s  %s\n", "kernel", "isa", "ns/pixel",
+	   "Mpixel/s", "check");
+    for (i = 0; i < NUM_KERNELS; i++) {
+	if (numnames) {
+	    for (j = 0; j < numnames; j++)
+		if (!strcmp(names[j], bench_kernels[i].name))
+		    break;
+	    if (j == numnames)
+		continue;
+	}
+	if (!Bench_Kernel(&bench_kernels[i]))
+	    matched = false;
+    }
+
+    return matched ? 0 : 1;
+}
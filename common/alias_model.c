@@ -18,15 +18,19 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#include <stdio.h>
 #include <string.h>
 
 #include "common.h"
 #include "crc.h"
+#include "cvar.h"
 #include "model.h"
 #include "sys.h"
 
 #include "r_local.h"
 
+cvar_t mod_aliascache = { "mod_aliascache", "1", true };
+
 static aliashdr_t *pheader;
 
 /* FIXME - get rid of these static limits by doing two passes? */
@@ -226,6 +230,143 @@ Mod_LoadAllSkins(const model_loader_t *loader, const model_t *loadmodel,
    return pskintype;
 }
 
+/*
+===============================================================================
+
+ALIAS MODEL CACHE
+
+The loaded alias model is relocatable, all offsets from the header, so it
+is saved just as it went into the cache along with the model_t fields the
+loader fills in. It's keyed by the size and CRC of the MDL it came from
+and the loader's layout. Like the sound cache it's in native byte order,
+only for reading back on the machine that wrote it.
+
+===============================================================================
+*/
+
+#define ALIASCACHE_IDENT	(('C' << 24) + ('L' << 16) + ('D' << 8) + 'M')
+#define ALIASCACHE_VERSION	1
+
+typedef struct {
+   int ident;
+   int version;
+   int filesize;	// of the source mdl
+   int crc;		// of the source mdl
+   int variant;		// the loader's skin and mesh layout
+   int pad;		// bytes ahead of the aliashdr_t
+   int total;		// including the pad
+   int flags;
+   int synctype;
+   int numframes;
+} aliascache_t;
+
+static qboolean
+Mod_AliasCachePath(const model_t *mod, char *path, int size)
+{
+   return snprintf(path, size, "%s/modelcache/%s", com_savedir, mod->name) < size;
+}
+
+static int
+Mod_AliasCacheVariant(const model_loader_t *loader)
+{
+   return loader->CacheVariant ? loader->CacheVariant() : 0;
+}
+
+static void
+Mod_WriteCachedAlias(const model_loader_t *loader, const model_t *mod,
+		     const byte *container, int pad, int total, int crc)
+{
+   char path[MAX_OSPATH];
+   aliascache_t header;
+   FILE *f;
+
+   if (!Mod_AliasCachePath(mod, path, sizeof(path)))
+      return;
+   COM_CreatePath(path);
+   f = fopen(path, "wb");
+   if (!f)
+      return;
+
+   header.ident = ALIASCACHE_IDENT;
+   header.version = ALIASCACHE_VERSION;
+   header.filesize = com_filesize;
+   header.crc = crc;
+   header.variant = Mod_AliasCacheVariant(loader);
+   header.pad = pad;
+   header.total = total;
+   header.flags = mod->flags;
+   header.synctype = mod->synctype;
+   header.numframes = mod->numframes;
+
+   if (fwrite(&header, sizeof(header), 1, f) != 1
+       || fwrite(container, 1, total, f) != (size_t)total)
+   {
+      fclose(f);
+      remove(path);
+      return;
+   }
+   fclose(f);
+}
+
+/*
+ * Reads the model straight into the cache if it was saved from the same
+ * file by the same loader.
+ */
+static qboolean
+Mod_LoadCachedAlias(const model_loader_t *loader, model_t *mod, int crc,
+		    const char *loadname)
+{
+   char path[MAX_OSPATH];
+   aliascache_t header;
+   qboolean loaded;
+   long length;
+   FILE *f;
+
+   if (!Mod_AliasCachePath(mod, path, sizeof(path)))
+      return false;
+   f = fopen(path, "rb");
+   if (!f)
+      return false;
+
+   loaded = false;
+   if (fseek(f, 0, SEEK_END) || (length = ftell(f)) < 0 || fseek(f, 0, SEEK_SET))
+      goto out;
+   if (fread(&header, sizeof(header), 1, f) != 1)
+      goto out;
+   if (header.ident != ALIASCACHE_IDENT || header.version != ALIASCACHE_VERSION)
+      goto out;
+   if (header.filesize != com_filesize || header.crc != crc)
+      goto out;
+   if (header.variant != Mod_AliasCacheVariant(loader)
+       || header.pad != loader->Aliashdr_Padding())
+      goto out;
+   if (header.total <= header.pad + (int)sizeof(aliashdr_t)
+       || length != (long)sizeof(header) + header.total)
+      goto out;
+
+   Cache_AllocPadded(&mod->cache, header.pad, header.total - header.pad, loadname);
+   if (!mod->cache.data)
+      goto out;
+   if (fread((byte *)mod->cache.data - header.pad, 1, header.total, f)
+       != (size_t)header.total)
+   {
+      Cache_Free(&mod->cache);
+      goto out;
+   }
+
+   mod->flags = header.flags;
+   mod->synctype = (synctype_t)header.synctype;
+   mod->numframes = header.numframes;
+   mod->type = mod_alias;
+   mod->mins[0] = mod->mins[1] = mod->mins[2] = -16;
+   mod->maxs[0] = mod->maxs[1] = mod->maxs[2] = 16;
+   loaded = true;
+
+ out:
+   fclose(f);
+   return loaded;
+}
+
 /*
 =================
 Mod_LoadAliasModel
@@ -248,6 +389,10 @@ Mod_LoadAliasModel(const model_loader_t *loader, model_t *mod, void *buffer,
    daliasskintype_t *pskintype;
    int start, end, total;
    float *intervals;
+   uint16_t crc = 0;
+
+   if (mod_aliascache.value)
+      crc = CRC_Block(buffer, com_filesize);
 
 #ifdef QW_HACK
    const char *crcmodel = NULL;
@@ -258,7 +403,8 @@ Mod_LoadAliasModel(const model_loader_t *loader, model_t *mod, void *buffer,
 
    if (crcmodel)
    {
-      uint16_t crc = CRC_Block(buffer, com_filesize);
+      if (!mod_aliascache.value)
+         crc = CRC_Block(buffer, com_filesize);
       Info_SetValueForKey(cls.userinfo, crcmodel, va("%d", (int)crc),
             MAX_INFO_STRING);
 
@@ -271,6 +417,9 @@ Mod_LoadAliasModel(const model_loader_t *loader, model_t *mod, void *buffer,
    }
 #endif
 
+   if (mod_aliascache.value && Mod_LoadCachedAlias(loader, mod, crc, loadname))
+      return;
+
    start = Hunk_LowMark();
 
    pinmodel = (mdl_t *)buffer;
@@ -453,6 +602,8 @@ Mod_LoadAliasModel(const model_loader_t *loader, model_t *mod, void *buffer,
       return;
 
    memcpy((byte *)mod->cache.data - pad, container, total);
+   if (mod_aliascache.value)
+      Mod_WriteCachedAlias(loader, mod, container, pad, total, crc);
 
    Hunk_FreeToLowMark(start);
 }
@@ -22,6 +22,10 @@
  *
  */
 
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif
+
 #include "quakedef.h"
 #include "console.h"
 #include "common.h"
@@ -80,6 +84,195 @@ static music_handler_t *music_handlers = NULL;
 
 static snd_stream_t *bgmstream = NULL;
 
+#ifdef HAVE_THREADS
+/*
+ * Streams are decoded on a thread of their own into a single producer,
+ * single consumer ring, so the frame only has to copy out PCM that's
+ * ready. The worker owns the stream (reads and rewinds) until it's joined
+ * in BGM_StopDecoder; the main thread owns everything else, pause and
+ * volume included. The mutex is only for the worker to sleep on when the
+ * ring is full, the samples themselves are passed without locking.
+ */
+#define BGM_RING_SIZE	0x40000	/* must be a power of two */
+#define BGM_READ_SIZE	16384
+
+typedef enum {
+	DECODE_RUNNING,
+	DECODE_EOF,		/* the stream ended without looping */
+	DECODE_READERROR,
+	DECODE_SEEKERROR
+} decodestate_t;
+
+static struct {
+	qboolean	running;
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	wake;
+	qboolean	quit;		/* protected by lock */
+	int		state;		/* decodestate_t, set by the worker */
+	int		error;		/* the codec's error code */
+	unsigned	head;		/* bytes written, by the worker */
+	unsigned	tail;		/* bytes read, by the main thread */
+	byte		ring[BGM_RING_SIZE];
+} bgm_decoder = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER
+};
+
+/* Bytes free in the ring, as far as the worker knows */
+static int BGM_DecoderRoom (unsigned head)
+{
+	return BGM_RING_SIZE - (head - __atomic_load_n(&bgm_decoder.tail, __ATOMIC_ACQUIRE));
+}
+
+static void *BGM_DecodeThread (void *stream)
+{
+	byte	raw[BGM_READ_SIZE];
+	int	framesize, res, offset, count;
+	unsigned	head;
+
+	framesize = ((snd_stream_t *)stream)->info.width * ((snd_stream_t *)stream)->info.channels;
+	head = bgm_decoder.head;
+	for (;;)
+	{
+		if (BGM_DecoderRoom(head) < BGM_READ_SIZE)
+		{
+			pthread_mutex_lock(&bgm_decoder.lock);
+			while (!bgm_decoder.quit && BGM_DecoderRoom(head) < BGM_READ_SIZE)
+				pthread_cond_wait(&bgm_decoder.wake, &bgm_decoder.lock);
+			pthread_mutex_unlock(&bgm_decoder.lock);
+		}
+		if (__atomic_load_n(&bgm_decoder.quit, __ATOMIC_ACQUIRE))
+			break;
+
+		res = S_CodecReadStream((snd_stream_t *)stream,
+					BGM_READ_SIZE - BGM_READ_SIZE % framesize, raw);
+		if (res > 0)
+		{
+			offset = head & (BGM_RING_SIZE - 1);
+			count = qmin(res, BGM_RING_SIZE - offset);
+			memcpy(bgm_decoder.ring + offset, raw, count);
+			memcpy(bgm_decoder.ring, raw + count, res - count);
+			head += res;
+			__atomic_store_n(&bgm_decoder.head, head, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		if (res == 0 && bgmloop)
+		{
+			res = S_CodecRewindStream((snd_stream_t *)stream);
+			if (res == 0)
+				continue;
+			bgm_decoder.error = res;
+			res = DECODE_SEEKERROR;
+		}
+		else if (res == 0)
+			res = DECODE_EOF;
+		else
+		{
+			bgm_decoder.error = res;
+			res = DECODE_READERROR;
+		}
+		/* after the last head store, so the main thread sees it all */
+		__atomic_store_n(&bgm_decoder.state, res, __ATOMIC_RELEASE);
+		break;
+	}
+
+	return NULL;
+}
+
+static void BGM_StartDecoder (void)
+{
+	bgm_decoder.quit = false;
+	bgm_decoder.state = DECODE_RUNNING;
+	bgm_decoder.head = bgm_decoder.tail = 0;
+	if (pthread_create(&bgm_decoder.thread, NULL, BGM_DecodeThread, bgmstream))
+	{
+		Con_DPrintf("%s: unable to start decoder thread\n", __func__);
+		return;
+	}
+	bgm_decoder.running = true;
+}
+
+static void BGM_StopDecoder (void)
+{
+	if (!bgm_decoder.running)
+		return;
+
+	pthread_mutex_lock(&bgm_decoder.lock);
+	__atomic_store_n(&bgm_decoder.quit, true, __ATOMIC_RELEASE);
+	pthread_cond_signal(&bgm_decoder.wake);
+	pthread_mutex_unlock(&bgm_decoder.lock);
+	pthread_join(bgm_decoder.thread, NULL);
+	bgm_decoder.running = false;
+}
+
+/*
+ * The threaded BGM_UpdateStream: feeds S_RawSamples from the ring,
+ * stopping the music once the worker has finished and the ring is empty.
+ */
+static void BGM_UpdateDecoded (void)
+{
+	int	bufferSamples;
+	int	fileSamples;
+	int	fileBytes;
+	int	framesize, offset, count, state;
+	unsigned	head, tail;
+	byte	raw[BGM_READ_SIZE];
+
+	framesize = bgmstream->info.width * bgmstream->info.channels;
+	tail = bgm_decoder.tail;
+
+	while (s_rawend < paintedtime + MAX_RAW_SAMPLES)
+	{
+		bufferSamples = MAX_RAW_SAMPLES - (s_rawend - paintedtime);
+
+		/* decide how much data needs to be copied from the ring */
+		fileSamples = bufferSamples * bgmstream->info.rate / shm->speed;
+		if (!fileSamples)
+			break;
+		fileBytes = qmin(fileSamples * framesize, (int) sizeof(raw));
+
+		/* the state first: once the worker has stopped, head is final */
+		state = __atomic_load_n(&bgm_decoder.state, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&bgm_decoder.head, __ATOMIC_ACQUIRE);
+		fileBytes = qmin(fileBytes, (int)(head - tail));
+		fileBytes -= fileBytes % framesize;
+		if (!fileBytes)
+		{
+			if (state == DECODE_RUNNING)
+				break;	/* the rest isn't decoded yet */
+			if (state == DECODE_SEEKERROR)
+				Con_Printf("Stream seek error (%i), stopping.\n", bgm_decoder.error);
+			else if (state == DECODE_READERROR)
+				Con_Printf("Stream read error (%i), stopping.\n", bgm_decoder.error);
+			BGM_Stop();
+			return;
+		}
+
+		offset = tail & (BGM_RING_SIZE - 1);
+		count = qmin(fileBytes, BGM_RING_SIZE - offset);
+		memcpy(raw, bgm_decoder.ring + offset, count);
+		memcpy(raw + count, bgm_decoder.ring, fileBytes - count);
+		tail += fileBytes;
+
+		S_RawSamples(fileBytes / framesize, bgmstream->info.rate,
+						bgmstream->info.width,
+						bgmstream->info.channels,
+						raw, bgmvolume.value);
+	}
+
+	if (tail != bgm_decoder.tail)
+	{
+		/* the worker only sleeps on a full ring; let it know there's room */
+		pthread_mutex_lock(&bgm_decoder.lock);
+		__atomic_store_n(&bgm_decoder.tail, tail, __ATOMIC_RELEASE);
+		pthread_cond_signal(&bgm_decoder.wake);
+		pthread_mutex_unlock(&bgm_decoder.lock);
+	}
+}
+#endif /* HAVE_THREADS */
+
 static void BGM_Play_f (void)
 {
 	if (Cmd_Argc() == 2)
@@ -186,6 +379,13 @@ void BGM_Shutdown (void)
 	music_handlers = NULL;
 }
 
+static void BGM_StartStream (void)
+{
+#ifdef HAVE_THREADS
+	BGM_StartDecoder();
+#endif
+}
+
 static void BGM_Play_noext (const char *filename, unsigned int allowed_types)
 {
 	char tmp[MAX_QPATH];
@@ -214,7 +414,10 @@ static void BGM_Play_noext (const char *filename, unsigned int allowed_types)
 		case BGM_STREAMER:
 			bgmstream = S_CodecOpenStreamType(tmp, handler->type);
 			if (bgmstream)
+			{
+				BGM_StartStream();
 				return;		/* success */
+			}
 			break;
 		case BGM_NONE:
 		default:
@@ -272,7 +475,10 @@ void BGM_Play (const char *filename)
 	case BGM_STREAMER:
 		bgmstream = S_CodecOpenStreamType(tmp, handler->type);
 		if (bgmstream)
+		{
+			BGM_StartStream();
 			return;		/* success */
+		}
 		break;
 	case BGM_NONE:
 	default:
@@ -332,6 +538,8 @@ void BGM_PlayCDtrack (byte track, qboolean looping)
 		bgmstream = S_CodecOpenStreamType(tmp, type);
 		if (! bgmstream)
 			Con_Printf("Couldn't handle music file %s\n", tmp);
+		else
+			BGM_StartStream();
 	}
 }
 
@@ -339,6 +547,9 @@ void BGM_Stop (void)
 {
 	if (bgmstream)
 	{
+#ifdef HAVE_THREADS
+		BGM_StopDecoder();
+#endif
 		bgmstream->status = STREAM_NONE;
 		S_CodecCloseStream(bgmstream);
 		bgmstream = NULL;
@@ -383,6 +594,14 @@ static void BGM_UpdateStream (void)
 	if (s_rawend < paintedtime)
 		s_rawend = paintedtime;
 
+#ifdef HAVE_THREADS
+	if (bgm_decoder.running)
+	{
+		BGM_UpdateDecoded();
+		return;
+	}
+#endif
+
 	while (s_rawend < paintedtime + MAX_RAW_SAMPLES)
 	{
 		bufferSamples = MAX_RAW_SAMPLES - (s_rawend - paintedtime);
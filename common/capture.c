@@ -0,0 +1,370 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// capture.c -- rendering a demo offline to video and sound files
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "client.h"
+#include "common.h"
+#include "console.h"
+#include "cvar.h"
+#include "jobs.h"
+#include "quakedef.h"
+#include "sound.h"
+#include "sys.h"
+#include "vid.h"
+#include "vid_convert.h"
+
+/*
+ * The picture goes out as YUV4MPEG2 with full resolution colour, which
+ * most encoders read as it is, and the sound as 16 bit stereo WAV. Each
+ * frame is copied out of vid.buffer with the palette it was drawn with
+ * into one of a few slots, and then converted (in bands of rows) and
+ * written while the next frames are made. The writes are chained so the
+ * frames go out in order.
+ */
+#define CAPTURE_SLOTS 4
+#define CAPTURE_MAXJOBS JOB_MAX_SPLIT(MAX_JOB_THREADS)
+#define CAPTURE_MINROWS 16
+
+static cvar_t capture_fps = { "capture_fps", "60", true };
+
+typedef struct {
+   byte *pixels;		/* the frame, rows packed */
+   byte *yuv;			/* converted to Y, U and V planes */
+   short *audio;
+   int audioframes;
+   byte table[256][3];		/* the palette in YUV */
+   job_t convert[CAPTURE_MAXJOBS];
+   job_t write;
+   jobgroup_t converting;
+   jobgroup_t writing;
+   qboolean used;
+} captureslot_t;
+
+static struct {
+   qboolean active;
+   FILE *video;
+   FILE *audio;
+   char name[MAX_OSPATH];
+   int width, height;
+   int fps;
+   int maxaudio;		/* stereo pairs of sound a frame can have */
+   int frames;
+   unsigned audiobytes;
+   double start;
+   captureslot_t slots[CAPTURE_SLOTS];
+} capture;
+
+static void Capture_PutLong(byte *p, int value)
+{
+   p[0] = value & 0xff;
+   p[1] = (value >> 8) & 0xff;
+   p[2] = (value >> 16) & 0xff;
+   p[3] = (value >> 24) & 0xff;
+}
+
+/* The header of a WAV file holding 'bytes' of sound */
+static void Capture_WAVHeader(byte *header, int rate, unsigned bytes)
+{
+   memcpy(header, "RIFF", 4);
+   Capture_PutLong(header + 4, 36 + bytes);
+   memcpy(header + 8, "WAVEfmt ", 8);
+   Capture_PutLong(header + 16, 16);
+   Capture_PutLong(header + 20, 1 | (2 << 16));	/* PCM, stereo */
+   Capture_PutLong(header + 24, rate);
+   Capture_PutLong(header + 28, rate * 4);
+   Capture_PutLong(header + 32, 4 | (16 << 16));	/* 16 bit pairs */
+   memcpy(header + 36, "data", 4);
+   Capture_PutLong(header + 40, bytes);
+}
+
+static const char *Capture_ConvertRows(void *data, int start, int end)
+{
+   captureslot_t *slot = (captureslot_t*)data;
+   int planesize = capture.width * capture.height;
+   const byte *in;
+   byte *y, *u, *v;
+   int i;
+
+   in = slot->pixels + start * capture.width;
+   y = slot->yuv + start * capture.width;
+   u = y + planesize;
+   v = u + planesize;
+   for (i = (end - start) * capture.width; i > 0; i--, in++)
+   {
+      *y++ = slot->table[*in][0];
+      *u++ = slot->table[*in][1];
+      *v++ = slot->table[*in][2];
+   }
+
+   return NULL;
+}
+
+static const char *Capture_WriteFrame(void *data, int start, int end)
+{
+   captureslot_t *slot = (captureslot_t*)data;
+   size_t length = (size_t)capture.width * capture.height * 3;
+   size_t frames = slot->audioframes;
+
+   Job_Wait(&slot->converting);
+   if (fputs("FRAME\n", capture.video) < 0
+         || fwrite(slot->yuv, 1, length, capture.video) != length)
+      return "couldn't write the picture";
+   if (frames && fwrite(slot->audio, 4, frames, capture.audio) != frames)
+      return "couldn't write the sound";
+
+   return NULL;
+}
+
+/*
+ * Waits for the slot's last frame to be written out. False if it
+ * couldn't be.
+ */
+static qboolean Capture_WaitSlot(captureslot_t *slot)
+{
+   if (!slot->used)
+      return true;
+
+   Job_Wait(&slot->writing);
+   slot->used = false;
+   if (slot->write.error)
+   {
+      Con_Printf("Capture: %s\n", slot->write.error);
+      return false;
+   }
+
+   return true;
+}
+
+static void Capture_FreeSlots(void)
+{
+   captureslot_t *slot;
+   int i;
+
+   for (i = 0, slot = capture.slots; i < CAPTURE_SLOTS; i++, slot++)
+   {
+      free(slot->pixels);
+      free(slot->yuv);
+      free(slot->audio);
+      memset(slot, 0, sizeof(*slot));
+   }
+}
+
+/*
+================
+Capture_Start
+================
+*/
+qboolean Capture_Start(const char *name)
+{
+   char videopath[MAX_OSPATH], audiopath[MAX_OSPATH];
+   byte header[44];
+   captureslot_t *slot;
+   int i, rate;
+
+   if (capture.active)
+      Capture_Stop();
+
+   capture.width = vid.width;
+   capture.height = vid.height;
+   capture.fps = (int)capture_fps.value;
+   if (capture.fps < CAPTURE_MINFPS)
+      capture.fps = CAPTURE_MINFPS;
+   rate = shm ? shm->speed : 0;
+   capture.maxaudio = rate / capture.fps + 1;
+
+   for (i = 0, slot = capture.slots; i < CAPTURE_SLOTS; i++, slot++)
+   {
+      slot->pixels = (byte*)malloc(capture.width * capture.height);
+      slot->yuv = (byte*)malloc(capture.width * capture.height * 3);
+      slot->audio = (short*)malloc(capture.maxaudio * 4);
+      if (!slot->pixels || !slot->yuv || !slot->audio)
+      {
+         Capture_FreeSlots();
+         Con_Printf("Capture: not enough memory\n");
+         return false;
+      }
+   }
+
+   snprintf(capture.name, sizeof(capture.name), "%s", name);
+   COM_StripExtension(capture.name);
+   if (snprintf(videopath, sizeof(videopath), "%s/%s.y4m", com_gamedir,
+            capture.name) >= (int)sizeof(videopath)
+         || snprintf(audiopath, sizeof(audiopath), "%s/%s.wav", com_gamedir,
+            capture.name) >= (int)sizeof(audiopath))
+   {
+      Capture_FreeSlots();
+      Con_Printf("Capture: %s/%s is too long a name\n", com_gamedir,
+            capture.name);
+      return false;
+   }
+   capture.video = fopen(videopath, "wb");
+   capture.audio = fopen(audiopath, "wb");
+   if (!capture.video || !capture.audio)
+   {
+      if (capture.video)
+         fclose(capture.video);
+      if (capture.audio)
+         fclose(capture.audio);
+      Capture_FreeSlots();
+      Con_Printf("Capture: couldn't open %s/%s\n", com_gamedir, capture.name);
+      return false;
+   }
+
+   fprintf(capture.video, "YUV4MPEG2 W%d H%d F%d:1 Ip A0:0 C444\n",
+         capture.width, capture.height, capture.fps);
+   Capture_WAVHeader(header, rate, 0);
+   fwrite(header, 1, sizeof(header), capture.audio);
+
+   capture.frames = 0;
+   capture.audiobytes = 0;
+   capture.start = Sys_DoubleTime();
+   capture.active = true;
+
+   return true;
+}
+
+/*
+================
+Capture_Stop
+
+Finishes writing the frames out and closes the files
+================
+*/
+void Capture_Stop(void)
+{
+   byte header[44];
+   double elapsed;
+   int i;
+
+   if (!capture.active)
+      return;
+   capture.active = false;
+
+   for (i = 0; i < CAPTURE_SLOTS; i++)
+      Capture_WaitSlot(&capture.slots[i]);
+
+   Capture_WAVHeader(header, shm ? shm->speed : 0, capture.audiobytes);
+   if (!fseek(capture.audio, 0, SEEK_SET))
+      fwrite(header, 1, sizeof(header), capture.audio);
+   fclose(capture.audio);
+   fclose(capture.video);
+   Capture_FreeSlots();
+
+   elapsed = Sys_DoubleTime() - capture.start;
+   Con_Printf("Captured %i frames (%.1f seconds) to %s in %.1f seconds\n",
+         capture.frames, (double)capture.frames / capture.fps, capture.name,
+         elapsed);
+}
+
+qboolean Capture_Active(void)
+{
+   return capture.active;
+}
+
+double Capture_FrameTime(void)
+{
+   return 1.0 / capture.fps;
+}
+
+/*
+================
+Capture_Frame
+================
+*/
+void Capture_Frame(const short *samples, int frames)
+{
+   captureslot_t *slot, *last;
+   const uint32_t *palette;
+   int i, r, g, b, numjobs;
+
+   if (!capture.active)
+      return;
+   if (!cls.demoplayback)
+   {
+      Capture_Stop();
+      return;
+   }
+   if ((int)vid.width != capture.width || (int)vid.height != capture.height)
+   {
+      Con_Printf("Capture: the screen size changed\n");
+      Capture_Stop();
+      return;
+   }
+
+   slot = &capture.slots[capture.frames % CAPTURE_SLOTS];
+   last = &capture.slots[(capture.frames + CAPTURE_SLOTS - 1) % CAPTURE_SLOTS];
+   if (!Capture_WaitSlot(slot))
+   {
+      Capture_Stop();
+      return;
+   }
+
+   for (i = 0; i < capture.height; i++)
+      memcpy(slot->pixels + i * capture.width, vid.buffer + i * vid.rowbytes,
+            capture.width);
+
+   /* BT.601, studio range */
+   palette = d_8to32table;
+   for (i = 0; i < 256; i++)
+   {
+      r = (palette[i] >> 16) & 0xff;
+      g = (palette[i] >> 8) & 0xff;
+      b = palette[i] & 0xff;
+      slot->table[i][0] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+      slot->table[i][1] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+      slot->table[i][2] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+   }
+
+   if (frames > capture.maxaudio)
+      frames = capture.maxaudio;
+   for (i = 0; i < frames * 2; i++)
+      slot->audio[i] = LittleShort(samples[i]);
+   slot->audioframes = frames;
+   capture.audiobytes += frames * 4;
+
+   numjobs = Job_Split(slot->convert, 0, CAPTURE_MAXJOBS, Capture_ConvertRows,
+         slot, capture.height, CAPTURE_MINROWS);
+   Job_Submit(slot->convert, numjobs, &slot->converting, NULL);
+
+   slot->write.func = Capture_WriteFrame;
+   slot->write.data = slot;
+   slot->write.start = 0;
+   slot->write.end = 1;
+   Job_Submit(&slot->write, 1, &slot->writing,
+         last->used ? &last->writing : NULL);
+   slot->used = true;
+
+   capture.frames++;
+}
+
+void Capture_Init(void)
+{
+   Cvar_RegisterVariable(&capture_fps);
+}
+
+void Capture_Shutdown(void)
+{
+   Capture_Stop();
+}
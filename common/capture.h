@@ -0,0 +1,51 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "qtypes.h"
+
+/* capture.c -- rendering a demo offline to video and sound files */
+
+/*
+ * "capturedemo <demo> [<name>]" plays the demo back at capture_fps frames
+ * of game time each, however long they take to make, writing the picture
+ * to <name>.y4m and the sound to <name>.wav in the game directory. The
+ * driver runs the frames, as many as it can in the time of one of its own,
+ * and hands each one's sound over with Capture_Frame. The picture and
+ * sound are converted and written out on the job threads.
+ */
+#define CAPTURE_MINFPS 10
+
+void Capture_Init(void);
+void Capture_Shutdown(void);
+
+/* Opens the files; the capture lasts until the demo playing ends */
+qboolean Capture_Start(const char *name);
+void Capture_Stop(void);
+
+qboolean Capture_Active(void);
+double Capture_FrameTime(void);
+
+/* Takes vid.buffer and the frame's 'frames' stereo pairs of sound */
+void Capture_Frame(const short *samples, int frames);
+
+#endif /* CAPTURE_H */
@@ -18,17 +18,33 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
 #include "client.h"
 #include "cmd.h"
+#include "common.h"
 #include "console.h"
+#include "cvar.h"
 #include "host.h"
 #include "net.h"
+#include "prof.h"
 #include "protocol.h"
 #include "quakedef.h"
+#include "sbar.h"
 #include "sys.h"
 #include "zone.h"
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 static void CL_FinishTimeDemo(void);
+static void CL_BenchmarkFrame(void);
+static void CL_ClearKeyframes(void);
+static void CL_CheckKeyframe(void);
 
 /*
 ==============================================================================
@@ -43,6 +59,200 @@ read from the demo file.
 ==============================================================================
 */
 
+/*
+ * Demo file I/O. With zlib a demo can be gzip compressed: recorded so
+ * when cl_democompress is set, detected from the magic when played. Each
+ * message is flushed as a whole, so a crash loses no more than the frame
+ * being written. Offsets are always into the uncompressed demo.
+ */
+#ifdef HAVE_ZLIB
+cvar_t cl_democompress = { "cl_democompress", "0", true };
+
+typedef struct {
+    z_stream stream;
+    qboolean writing;
+    long start;			// of the compressed data in the file
+    long offset;		// into the uncompressed demo
+    qboolean ended;		// read to the end of the stream
+    byte buffer[16384];
+} demozip_t;
+
+static demozip_t *demo_zip;	// the demo file is compressed
+
+static qboolean
+CL_DemoZipOpen(qboolean writing)
+{
+    int err;
+
+    demo_zip = calloc(1, sizeof(*demo_zip));
+    if (!demo_zip)
+	return false;
+
+    demo_zip->writing = writing;
+    demo_zip->start = ftell(cls.demofile);
+    if (writing) {
+	err = deflateInit2(&demo_zip->stream, Z_DEFAULT_COMPRESSION,
+			   Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+	demo_zip->stream.next_out = demo_zip->buffer;
+	demo_zip->stream.avail_out = sizeof(demo_zip->buffer);
+    } else
+	err = inflateInit2(&demo_zip->stream, 15 + 16);
+    if (err != Z_OK) {
+	free(demo_zip);
+	demo_zip = NULL;
+	return false;
+    }
+
+    return true;
+}
+
+/*
+ * Runs deflate over what's been given it, writing out the full buffers
+ */
+static void
+CL_DemoZipDeflate(int flush)
+{
+    z_stream *stream = &demo_zip->stream;
+    qboolean full;
+
+    while (1) {
+	deflate(stream, flush);
+	full = !stream->avail_out;
+	if (full || flush != Z_NO_FLUSH) {
+	    fwrite(demo_zip->buffer, 1,
+		   sizeof(demo_zip->buffer) - stream->avail_out,
+		   cls.demofile);
+	    stream->next_out = demo_zip->buffer;
+	    stream->avail_out = sizeof(demo_zip->buffer);
+	}
+	if (!full && !stream->avail_in)
+	    break;
+    }
+}
+
+static int
+CL_DemoZipRead(void *buf, int size)
+{
+    z_stream *stream = &demo_zip->stream;
+    int err;
+
+    stream->next_out = buf;
+    stream->avail_out = size;
+    while (stream->avail_out && !demo_zip->ended) {
+	if (!stream->avail_in) {
+	    stream->next_in = demo_zip->buffer;
+	    stream->avail_in = fread(demo_zip->buffer, 1,
+				     sizeof(demo_zip->buffer), cls.demofile);
+	    if (!stream->avail_in)
+		break;
+	}
+	err = inflate(stream, Z_NO_FLUSH);
+	if (err == Z_STREAM_END || (err != Z_OK && err != Z_BUF_ERROR))
+	    demo_zip->ended = true;
+    }
+    size -= stream->avail_out;
+    demo_zip->offset += size;
+
+    return size;
+}
+
+static void
+CL_DemoZipClose(void)
+{
+    if (demo_zip->writing) {
+	CL_DemoZipDeflate(Z_FINISH);
+	deflateEnd(&demo_zip->stream);
+    } else
+	inflateEnd(&demo_zip->stream);
+    free(demo_zip);
+    demo_zip = NULL;
+}
+#endif /* HAVE_ZLIB */
+
+/* Returns the bytes read */
+static int
+CL_DemoRead(void *buf, int size)
+{
+#ifdef HAVE_ZLIB
+    if (demo_zip)
+	return CL_DemoZipRead(buf, size);
+#endif
+    return fread(buf, 1, size, cls.demofile);
+}
+
+static void
+CL_DemoWrite(const void *buf, int size)
+{
+#ifdef HAVE_ZLIB
+    if (demo_zip) {
+	demo_zip->stream.next_in = (Bytef *)buf;
+	demo_zip->stream.avail_in = size;
+	CL_DemoZipDeflate(Z_NO_FLUSH);
+	return;
+    }
+#endif
+    fwrite(buf, 1, size, cls.demofile);
+}
+
+static void
+CL_DemoFlush(void)
+{
+#ifdef HAVE_ZLIB
+    if (demo_zip)
+	CL_DemoZipDeflate(Z_SYNC_FLUSH);
+#endif
+    fflush(cls.demofile);
+}
+
+static long
+CL_DemoTell(void)
+{
+#ifdef HAVE_ZLIB
+    if (demo_zip)
+	return demo_zip->offset;
+#endif
+    return ftell(cls.demofile);
+}
+
+/*
+ * A compressed demo can only be read forward, so going back starts the
+ * stream over
+ */
+static void
+CL_DemoSeek(long offset)
+{
+#ifdef HAVE_ZLIB
+    byte skip[1024];
+
+    if (demo_zip) {
+	if (offset < demo_zip->offset) {
+	    fseek(cls.demofile, demo_zip->start, SEEK_SET);
+	    inflateReset(&demo_zip->stream);
+	    demo_zip->stream.avail_in = 0;
+	    demo_zip->offset = 0;
+	    demo_zip->ended = false;
+	}
+	while (demo_zip->offset < offset)
+	    if (!CL_DemoZipRead(skip, qmin(offset - demo_zip->offset,
+					   (long)sizeof(skip))))
+		break;
+	return;
+    }
+#endif
+    fseek(cls.demofile, offset, SEEK_SET);
+}
+
+static void
+CL_DemoClose(void)
+{
+#ifdef HAVE_ZLIB
+    if (demo_zip)
+	CL_DemoZipClose();
+#endif
+    fclose(cls.demofile);
+    cls.demofile = NULL;
+}
+
 /*
 ==============
 CL_StopPlayback
@@ -56,10 +266,12 @@ CL_StopPlayback(void)
     if (!cls.demoplayback)
 	return;
 
-    fclose(cls.demofile);
+    CL_DemoClose();
     cls.demoplayback = false;
-    cls.demofile = NULL;
+    cls.demoseeking = false;
+    cls.demobatch = false;
     cls.state = ca_disconnected;
+    CL_ClearKeyframes();
 
     if (cls.timedemo)
 	CL_FinishTimeDemo();
@@ -76,23 +288,56 @@ static void
 CL_WriteDemoMessage(void)
 {
    int i;
-#ifdef MSB_FIRST
    int len;
    float f;
 
    len = LittleLong(net_message.cursize);
-   fwrite(&len, 4, 1, cls.demofile);
+   CL_DemoWrite(&len, 4);
    for (i = 0; i < 3; i++) {
       f = LittleFloat(cl.viewangles[i]);
-      fwrite(&f, 4, 1, cls.demofile);
+      CL_DemoWrite(&f, 4);
    }
-#else
-   fwrite (&net_message.cursize, 4, 1, cls.demofile);
-   for (i = 0 ; i < 3 ; i++)
-      fwrite (&cl.viewangles[i], 4, 1, cls.demofile);
-#endif
-   fwrite(net_message.data, net_message.cursize, 1, cls.demofile);
-   fflush(cls.demofile);
+   CL_DemoWrite(net_message.data, net_message.cursize);
+   CL_DemoFlush();
+}
+
+/*
+====================
+CL_ReadDemoMessage
+
+Reads the next message of the demo being played into net_message
+====================
+*/
+static int
+CL_ReadDemoMessage(void)
+{
+   int i, len;
+   float f;
+
+   CL_CheckKeyframe();
+
+   // get the next message
+   if (CL_DemoRead(&len, 4) != 4) {
+      CL_StopPlayback();
+      return 0;
+   }
+   net_message.cursize = LittleLong(len);
+   VectorCopy(cl.mviewangles[0], cl.mviewangles[1]);
+
+   for (i = 0; i < 3; i++) {
+      CL_DemoRead(&f, 4);
+      cl.mviewangles[0][i] = LittleFloat(f);
+   }
+
+   if (net_message.cursize > MAX_MSGLEN)
+      Sys_Error("Demo message > MAX_MSGLEN");
+   if (CL_DemoRead(net_message.data, net_message.cursize)
+         != net_message.cursize) {
+      CL_StopPlayback();
+      return 0;
+   }
+
+   return 1;
 }
 
 /*
@@ -106,14 +351,9 @@ int
 CL_GetMessage(void)
 {
    int r;
-#ifdef MSB_FIRST
-   float f;
-#endif
 
    if (cls.demoplayback)
    {
-      int i;
-
       // decide if it is time to grab the next message
       // allways grab until fully connected
       if (cls.state == ca_active)
@@ -128,7 +368,9 @@ CL_GetMessage(void)
             // if this is the second frame, grab the real td_starttime
             // so the bogus time on the first frame doesn't count
             if (host_framecount == cls.td_startframe + 1)
-               cls.td_starttime = realtime;
+               cls.td_starttime = Sys_DoubleTime();
+            else if (host_framecount > cls.td_startframe + 1)
+               CL_BenchmarkFrame();
          }
          else if (cl.time <= cl.mtime[0])
          {
@@ -136,31 +378,7 @@ CL_GetMessage(void)
             return 0;
          }
       }
-      // get the next message
-      fread(&net_message.cursize, 4, 1, cls.demofile);
-      VectorCopy(cl.mviewangles[0], cl.mviewangles[1]);
-
-      for (i = 0; i < 3; i++)
-#ifdef MSB_FIRST
-      {
-         fread(&f, 4, 1, cls.demofile);
-         cl.mviewangles[0][i] = LittleFloat(f);
-      }
-
-      net_message.cursize = LittleLong(net_message.cursize);
-#else
-      r = fread (&cl.mviewangles[0][i], 4, 1, cls.demofile);
-#endif
-
-      if (net_message.cursize > MAX_MSGLEN)
-         Sys_Error("Demo message > MAX_MSGLEN");
-      r = fread(net_message.data, net_message.cursize, 1, cls.demofile);
-      if (r != 1) {
-         CL_StopPlayback();
-         return 0;
-      }
-
-      return 1;
+      return CL_ReadDemoMessage();
    }
 
    while (1)
@@ -207,8 +425,7 @@ CL_Stop_f(void)
     CL_WriteDemoMessage();
 
 // finish up
-    fclose(cls.demofile);
-    cls.demofile = NULL;
+    CL_DemoClose();
     cls.demorecording = false;
     Con_Printf("Completed demo\n");
 }
@@ -225,6 +442,7 @@ CL_Record_f(void)
 {
     int c;
     char name[MAX_OSPATH];
+    char header[16];
     int track;
 
     if (cmd_source != src_command)
@@ -266,6 +484,11 @@ CL_Record_f(void)
 // open the demo file
 //
     COM_DefaultExtension(name, ".dem");
+#ifdef HAVE_ZLIB
+    if (cl_democompress.value && !COM_CheckExtension(name, ".gz")
+	&& strlen(name) + 3 < sizeof(name))
+	strcat(name, ".gz");
+#endif
 
     Con_Printf("recording to %s.\n", name);
     cls.demofile = fopen(name, "wb");
@@ -273,9 +496,18 @@ CL_Record_f(void)
 	Con_Printf("ERROR: couldn't open.\n");
 	return;
     }
+    COM_FlushScanCache();
+#ifdef HAVE_ZLIB
+    if (COM_CheckExtension(name, ".gz") && !CL_DemoZipOpen(true)) {
+	Con_Printf("ERROR: couldn't start compressing.\n");
+	CL_DemoClose();
+	return;
+    }
+#endif
 
     cls.forcetrack = track;
-    fprintf(cls.demofile, "%i\n", cls.forcetrack);
+    snprintf(header, sizeof(header), "%i\n", cls.forcetrack);
+    CL_DemoWrite(header, strlen(header));
 
     cls.demorecording = true;
 }
@@ -283,49 +515,60 @@ CL_Record_f(void)
 
 /*
 ====================
-CL_PlayDemo_f
+CL_OpenDemo
 
-play [demoname]
+Starts the playback of a demo, once disconnected
 ====================
 */
-void
-CL_PlayDemo_f(void)
+static qboolean
+CL_OpenDemo(const char *demoname)
 {
     char name[256];
-    int c;
+    char c;
     qboolean neg = false;
-
-    if (cmd_source != src_command)
-	return;
-
-    if (Cmd_Argc() != 2) {
-	Con_Printf("play <demoname> : plays a demo\n");
-	return;
-    }
-//
-// disconnect from server
-//
-    CL_Disconnect();
+#ifdef HAVE_ZLIB
+    byte magic[2];
+    long start;
+#endif
 
 //
 // open the demo file
 //
-    strcpy(name, Cmd_Argv(1));
+    snprintf(name, sizeof(name) - 4, "%s", demoname);
     COM_DefaultExtension(name, ".dem");
+    COM_FOpenFile(name, &cls.demofile);
+#ifdef HAVE_ZLIB
+    if (!cls.demofile && !COM_CheckExtension(name, ".gz")) {
+	strcat(name, ".gz");
+	COM_FOpenFile(name, &cls.demofile);
+    }
+#endif
 
     Con_Printf("Playing demo from %s.\n", name);
-    COM_FOpenFile(name, &cls.demofile);
     if (!cls.demofile) {
 	Con_Printf("ERROR: couldn't open.\n");
-	cls.demonum = -1;	// stop demo loop
-	return;
+	return false;
     }
 
+#ifdef HAVE_ZLIB
+    start = ftell(cls.demofile);
+    if (fread(magic, 1, 2, cls.demofile) == 2
+	&& magic[0] == 0x1f && magic[1] == 0x8b) {
+	fseek(cls.demofile, start, SEEK_SET);
+	if (!CL_DemoZipOpen(false)) {
+	    Con_Printf("ERROR: couldn't start decompressing.\n");
+	    CL_DemoClose();
+	    return false;
+	}
+    } else
+	fseek(cls.demofile, start, SEEK_SET);
+#endif
+
     cls.demoplayback = true;
     cls.state = ca_connected;
     cls.forcetrack = 0;
 
-    while ((c = getc(cls.demofile)) != '\n')
+    while (CL_DemoRead(&c, 1) == 1 && c != '\n')
 	if (c == '-')
 	    neg = true;
 	else
@@ -333,6 +576,34 @@ CL_PlayDemo_f(void)
 
     if (neg)
 	cls.forcetrack = -cls.forcetrack;
+
+    return true;
+}
+
+/*
+====================
+CL_PlayDemo_f
+
+play [demoname]
+====================
+*/
+void
+CL_PlayDemo_f(void)
+{
+    if (cmd_source != src_command)
+	return;
+
+    if (Cmd_Argc() != 2) {
+	Con_Printf("play <demoname> : plays a demo\n");
+	return;
+    }
+//
+// disconnect from server
+//
+    CL_Disconnect();
+
+    if (!CL_OpenDemo(Cmd_Argv(1)))
+	cls.demonum = -1;	// stop demo loop
 }
 
 struct stree_root *
@@ -350,11 +621,752 @@ CL_Demo_Arg_f(const char *arg)
     root->stack = NULL;
 	STree_AllocInit();
 	COM_ScanDir(root, "", arg, ".dem", true);
+#ifdef HAVE_ZLIB
+	COM_ScanDir(root, "", arg, ".gz", true);	// plays as .dem
+#endif
     }
 
     return root;
 }
 
+/*
+==============================================================================
+
+SEEKING
+
+Each frame of a demo carries the full state of the entities in view,
+relative to the baselines from the signon, so playback can pick up from any
+message once the rest of the client state - the stats, lightstyles,
+scoreboard and so on, which the server only sends when they change - is in
+place. A keyframe keeps that state every few seconds as the demo is played,
+with the offset of the message following it, and seeking goes back to the
+last keyframe before the time and reads forward from there without waiting
+on the frames. The keyframes are for the current map only.
+==============================================================================
+*/
+
+#define DEMO_KEYFRAME_INTERVAL 10	// seconds of demo between keyframes
+
+typedef struct {
+    char name[MAX_SCOREBOARDNAME];
+    int frags;
+    byte topcolor;
+    byte bottomcolor;
+} demoplayer_t;
+
+typedef struct {
+    long offset;		// of the next message in the demo file
+    double mtime[2];
+    vec3_t mviewangles;
+    int stats[MAX_CL_STATS];
+    int viewentity;
+    int intermission;
+    int completed_time;
+    lightstyle_t lightstyles[MAX_LIGHTSTYLES];
+    demoplayer_t players[MAX_SCOREBOARD];
+} demokeyframe_t;
+
+static demokeyframe_t *demo_keyframes;
+static int demo_numkeyframes;
+static int demo_maxkeyframes;
+
+static void
+CL_ClearKeyframes(void)
+{
+    free(demo_keyframes);
+    demo_keyframes = NULL;
+    demo_numkeyframes = 0;
+    demo_maxkeyframes = 0;
+}
+
+/*
+ * Called before each message is read, takes a keyframe if it's time for
+ * one. Once signed on the first is taken straight away, so there's always
+ * one at the start of the map to go back to.
+ */
+static void
+CL_CheckKeyframe(void)
+{
+    demokeyframe_t *keyframe;
+    long offset;
+    int i;
+
+    if (cls.signon != SIGNONS) {
+	demo_numkeyframes = 0;	// a new map is on its way
+	return;
+    }
+    if (cls.timedemo || cls.demobatch)
+	return;
+
+    offset = CL_DemoTell();
+    if (demo_numkeyframes) {
+	keyframe = &demo_keyframes[demo_numkeyframes - 1];
+	if (offset <= keyframe->offset)
+	    return;		// been here before
+	if (cl.mtime[0] - keyframe->mtime[0] < DEMO_KEYFRAME_INTERVAL)
+	    return;
+    }
+
+    if (demo_numkeyframes == demo_maxkeyframes) {
+	demo_maxkeyframes = qmax(demo_maxkeyframes * 2, 64);
+	keyframe = realloc(demo_keyframes,
+			   demo_maxkeyframes * sizeof(*keyframe));
+	if (!keyframe) {
+	    demo_maxkeyframes = demo_numkeyframes;
+	    return;		// seeking will have to read further
+	}
+	demo_keyframes = keyframe;
+    }
+
+    keyframe = &demo_keyframes[demo_numkeyframes++];
+    keyframe->offset = offset;
+    keyframe->mtime[0] = cl.mtime[0];
+    keyframe->mtime[1] = cl.mtime[1];
+    VectorCopy(cl.mviewangles[0], keyframe->mviewangles);
+    memcpy(keyframe->stats, cl.stats, sizeof(keyframe->stats));
+    keyframe->viewentity = cl.viewentity;
+    keyframe->intermission = cl.intermission;
+    keyframe->completed_time = cl.completed_time;
+    memcpy(keyframe->lightstyles, cl_lightstyle,
+	   sizeof(keyframe->lightstyles));
+    for (i = 0; i < cl.maxclients && i < MAX_SCOREBOARD; i++) {
+	demoplayer_t *player = &keyframe->players[i];
+
+	memcpy(player->name, cl.players[i].name, sizeof(player->name));
+	player->frags = cl.players[i].frags;
+	player->topcolor = cl.players[i].topcolor;
+	player->bottomcolor = cl.players[i].bottomcolor;
+    }
+}
+
+static void
+CL_RestoreKeyframe(const demokeyframe_t *keyframe)
+{
+    int i;
+
+    CL_DemoSeek(keyframe->offset);
+    cl.mtime[0] = keyframe->mtime[0];
+    cl.mtime[1] = keyframe->mtime[1];
+    VectorCopy(keyframe->mviewangles, cl.mviewangles[0]);
+    VectorCopy(keyframe->mviewangles, cl.mviewangles[1]);
+    memcpy(cl.stats, keyframe->stats, sizeof(cl.stats));
+    cl.viewentity = keyframe->viewentity;
+    cl.intermission = keyframe->intermission;
+    cl.completed_time = keyframe->completed_time;
+    memcpy(cl_lightstyle, keyframe->lightstyles, sizeof(cl_lightstyle));
+    for (i = 0; i < cl.maxclients && i < MAX_SCOREBOARD; i++) {
+	const demoplayer_t *player = &keyframe->players[i];
+
+	memcpy(cl.players[i].name, player->name, sizeof(player->name));
+	cl.players[i].frags = player->frags;
+	cl.players[i].topcolor = player->topcolor;
+	cl.players[i].bottomcolor = player->bottomcolor;
+	CL_NewTranslation(i);
+    }
+    Sbar_Changed();
+    vid.recalc_refdef = true;
+}
+
+/*
+====================
+CL_DemoSeek_f
+
+demoseek [+|-]<time>
+
+Times are the server's for the map, as in the messages, or with a sign
+relative to where the demo is now.
+====================
+*/
+void
+CL_DemoSeek_f(void)
+{
+    const demokeyframe_t *keyframe;
+    const char *arg;
+    double target;
+    int i;
+
+    if (!cls.demoplayback || cls.signon != SIGNONS) {
+	Con_Printf("Not playing a demo.\n");
+	return;
+    }
+    if (cls.timedemo) {
+	Con_Printf("Can't seek in a timedemo.\n");
+	return;
+    }
+    if (Cmd_Argc() != 2) {
+	Con_Printf("demoseek [+|-]<time> : at %.1f", cl.mtime[0]);
+	if (demo_numkeyframes)
+	    Con_Printf(", seen %.1f to %.1f", demo_keyframes[0].mtime[0],
+		       demo_keyframes[demo_numkeyframes - 1].mtime[0]);
+	Con_Printf("\n");
+	return;
+    }
+
+    arg = Cmd_Argv(1);
+    target = atof(arg);
+    if (arg[0] == '+' || arg[0] == '-')
+	target += cl.mtime[0];
+
+    /* go back to the last keyframe before the target if it's nearer */
+    for (i = demo_numkeyframes - 1; i > 0; i--)
+	if (demo_keyframes[i].mtime[0] <= target)
+	    break;
+    if (demo_numkeyframes) {
+	keyframe = &demo_keyframes[i];
+	if (target < cl.mtime[0] || keyframe->mtime[0] > cl.mtime[0])
+	    CL_RestoreKeyframe(keyframe);
+    }
+
+    /* then read forward, without the sounds */
+    cls.demoseeking = true;
+    while (cl.mtime[0] < target) {
+	if (!CL_ReadDemoMessage())
+	    break;
+	CL_ParseServerMessage();
+	if (!cls.demoplayback || cls.signon != SIGNONS)
+	    break;
+    }
+    cls.demoseeking = false;
+
+    cl.time = cl.oldtime = cl.mtime[0];
+}
+
+/*
+==============================================================================
+
+BATCH PARSING
+
+demoparse reads a list of demos straight through, parsing each message for
+the client state but never rendering a frame or starting a sound, and
+writes what happened to a file as JSON lines: one object per event, with
+the demo, the server time and the kind of event.
+==============================================================================
+*/
+
+#define DEMO_PARSE_INTERVAL 1	// seconds between player positions
+
+/*
+ * For the player names, which can hold anything
+ */
+static void
+CL_WriteJSONString(FILE *f, const char *s)
+{
+    const unsigned char *c;
+
+    fputc('"', f);
+    for (c = (const unsigned char *)s; *c; c++) {
+	if (*c == '"' || *c == '\\')
+	    fprintf(f, "\\%c", *c);
+	else if (*c < ' ' || *c >= 127)
+	    fprintf(f, "\\u%04x", *c);
+	else
+	    fputc(*c, f);
+    }
+    fputc('"', f);
+}
+
+static void
+CL_WriteDemoEvent(FILE *f, const char *demo, const char *event)
+{
+    fprintf(f, "{\"demo\":");
+    CL_WriteJSONString(f, demo);
+    fprintf(f, ",\"time\":%.3f,\"event\":\"%s\"", cl.mtime[0], event);
+}
+
+static void
+CL_WritePlayerEvent(FILE *f, const char *demo, const char *event, int i)
+{
+    CL_WriteDemoEvent(f, demo, event);
+    fprintf(f, ",\"player\":");
+    CL_WriteJSONString(f, cl.players[i].name);
+}
+
+/*
+ * Reads the demo being played to the end, writing its events
+ */
+static void
+CL_ParseDemo(FILE *f, const char *demo)
+{
+    int frags[MAX_SCOREBOARD];
+    double nextpos = 0;
+    qboolean newmap = true;
+    const entity_t *ent;
+    int i;
+
+    cls.demobatch = true;
+    cls.demoseeking = true;	// no sounds
+    while (cls.demoplayback) {
+	if (!CL_ReadDemoMessage())
+	    break;
+	CL_ParseServerMessage();
+	SZ_Clear(&cls.message);
+	if (!cls.demoplayback)
+	    break;
+
+	if (cls.signon != SIGNONS) {
+	    newmap = true;
+	    continue;
+	}
+	if (newmap) {
+	    newmap = false;
+	    nextpos = 0;
+	    CL_WriteDemoEvent(f, demo, "map");
+	    fprintf(f, ",\"map\":");
+	    CL_WriteJSONString(f, cl.mapname);
+	    fprintf(f, "}\n");
+	    for (i = 0; i < cl.maxclients && i < MAX_SCOREBOARD; i++)
+		frags[i] = cl.players[i].frags;
+	}
+
+	for (i = 0; i < cl.maxclients && i < MAX_SCOREBOARD; i++) {
+	    if (cl.players[i].frags == frags[i])
+		continue;
+	    CL_WritePlayerEvent(f, demo, "frags", i);
+	    fprintf(f, ",\"frags\":%d,\"change\":%d}\n", cl.players[i].frags,
+		    cl.players[i].frags - frags[i]);
+	    frags[i] = cl.players[i].frags;
+	}
+
+	if (cl.mtime[0] < nextpos)
+	    continue;
+	nextpos = cl.mtime[0] + DEMO_PARSE_INTERVAL;
+	for (i = 0; i < cl.maxclients && i < MAX_SCOREBOARD; i++) {
+	    ent = &cl_entities[i + 1];
+	    if (!cl.players[i].name[0] || ent->msgtime != cl.mtime[0])
+		continue;	// not in the game, or not in view
+	    CL_WritePlayerEvent(f, demo, "position", i);
+	    fprintf(f, ",\"origin\":[%.1f,%.1f,%.1f]}\n", ent->msg_origins[0][0],
+		    ent->msg_origins[0][1], ent->msg_origins[0][2]);
+	}
+    }
+    CL_StopPlayback();
+}
+
+/*
+====================
+CL_DemoParse_f
+
+demoparse <output> <demo> [<demo> ...]
+====================
+*/
+void
+CL_DemoParse_f(void)
+{
+    char name[MAX_OSPATH];
+    char *demos, *demo;
+    int i, count;
+    size_t size;
+    FILE *f;
+
+    if (cmd_source != src_command)
+	return;
+
+    if (Cmd_Argc() < 3) {
+	Con_Printf("demoparse <output> <demo> [<demo> ...] : "
+		   "write the events in demos\n");
+	return;
+    }
+    if (strstr(Cmd_Argv(1), "..")) {
+	Con_Printf("Relative pathnames are not allowed.\n");
+	return;
+    }
+    if (snprintf(name, sizeof(name) - 6, "%s/%s", com_savedir,
+		 Cmd_Argv(1)) >= sizeof(name) - 6) {
+	Con_Printf("Filename too long.\n");
+	return;
+    }
+    COM_DefaultExtension(name, ".jsonl");
+
+    /* the parsing can run commands, so keep the names */
+    count = Cmd_Argc() - 2;
+    for (i = 0, size = 0; i < count; i++)
+	size += strlen(Cmd_Argv(i + 2)) + 1;
+    demos = malloc(size);
+    if (!demos) {
+	Con_Printf("Not enough memory for the demo list.\n");
+	return;
+    }
+    for (i = 0, demo = demos; i < count; i++, demo += strlen(demo) + 1)
+	strcpy(demo, Cmd_Argv(i + 2));
+
+    f = fopen(name, "w");
+    if (!f) {
+	Con_Printf("ERROR: couldn't open %s.\n", name);
+	free(demos);
+	return;
+    }
+
+    CL_Disconnect();
+    cls.demonum = -1;		// stop demo loop
+    for (i = 0, demo = demos; i < count; i++, demo += strlen(demo) + 1)
+	if (CL_OpenDemo(demo))
+	    CL_ParseDemo(f, demo);
+
+    fclose(f);
+    free(demos);
+    Con_Printf("Wrote the events of %d demos to %s\n", count, name);
+}
+
+/*
+==============================================================================
+
+BENCHMARK
+
+A benchmark plays a list of demos back to back as timedemos, the whole list
+benchmark_warmup times without recording anything and then benchmark_passes
+times recording the time of each frame. The frame times come from the
+profiler, which is forced on meanwhile, so they measure the work done for
+the frame rather than the (possibly fixed) host frame time.
+
+==============================================================================
+*/
+
+cvar_t benchmark_warmup = { "benchmark_warmup", "1" };
+cvar_t benchmark_passes = { "benchmark_passes", "1" };
+cvar_t benchmark_output = { "benchmark_output", "benchmark" };
+
+#define MAX_BENCH_RUNS 64
+
+typedef struct {
+    int demo;
+    int pass;		/* counting from 1, warm-up passes excluded */
+    int firstframe;
+    int numframes;
+} benchrun_t;
+
+static struct {
+    qboolean active;
+    qboolean recording;	/* the demo playing is being recorded */
+    int numdemos;
+    char demos[MAX_DEMOS][MAX_DEMONAME];
+    int warmup;
+    int passes;
+    int demo;		/* playing now */
+    int pass;		/* playing now, the first 'warmup' are warm-ups */
+    int numruns;
+    benchrun_t runs[MAX_BENCH_RUNS];
+    int numframes;
+    int maxframes;
+    float *frametime;	/* whole host frame, in ms */
+    float *rendertime;	/* SCR_UpdateScreen, in ms */
+} bench;
+
+qboolean
+CL_Benchmarking(void)
+{
+    return bench.active;
+}
+
+/*
+ * Called as each frame of a timedemo is read, so the frame recorded last
+ * is the one before it
+ */
+static void
+CL_BenchmarkFrame(void)
+{
+    const float *times;
+    float *frametime, *rendertime;
+    int maxframes;
+
+    if (!bench.recording)
+	return;
+    times = Prof_LastFrame();
+    if (!times)
+	return;
+
+    if (bench.numframes == bench.maxframes) {
+	maxframes = bench.maxframes ? bench.maxframes * 2 : 4096;
+	frametime = realloc(bench.frametime, maxframes * sizeof(float));
+	if (frametime)
+	    bench.frametime = frametime;
+	rendertime = realloc(bench.rendertime, maxframes * sizeof(float));
+	if (rendertime)
+	    bench.rendertime = rendertime;
+	if (!frametime || !rendertime)
+	    return;
+	bench.maxframes = maxframes;
+    }
+
+    bench.frametime[bench.numframes] = times[PROF_FRAME] * 1000;
+    bench.rendertime[bench.numframes] = times[PROF_RENDER] * 1000;
+    bench.numframes++;
+}
+
+static void
+CL_StopBenchmark(void)
+{
+    if (!bench.active)
+	return;
+
+    bench.active = false;
+    bench.recording = false;
+    Prof_Force(false);
+}
+
+/*
+ * Summaries of the frame and render times of runs [first, first + count)
+ */
+static void
+CL_SummarizeRuns(int first, int count, profsummary_t *frame,
+		 profsummary_t *render)
+{
+    const benchrun_t *run;
+    float *times;
+    int i, numframes;
+
+    numframes = 0;
+    for (i = first; i < first + count; i++)
+	numframes += bench.runs[i].numframes;
+
+    times = malloc((numframes ? numframes : 1) * sizeof(float));
+    numframes = 0;
+    for (i = first; times && i < first + count; i++) {
+	run = &bench.runs[i];
+	memcpy(times + numframes, bench.frametime + run->firstframe,
+	       run->numframes * sizeof(float));
+	numframes += run->numframes;
+    }
+    Prof_Summarize(times, numframes, frame);
+
+    numframes = 0;
+    for (i = first; times && i < first + count; i++) {
+	run = &bench.runs[i];
+	memcpy(times + numframes, bench.rendertime + run->firstframe,
+	       run->numframes * sizeof(float));
+	numframes += run->numframes;
+    }
+    Prof_Summarize(times, numframes, render);
+
+    free(times);
+}
+
+static void
+CL_PrintBenchmarkLine(const char *name, const profsummary_t *frame,
+		      const profsummary_t *render)
+{
+    Con_Printf("%-12s %6d %7.1f %6.2f %6.2f %6.2f %6.2f %6.2f %6.2f\n",
+	       name, frame->count, frame->mean ? 1000 / frame->mean : 0,
+	       frame->min, frame->mean, frame->p99, frame->max,
+	       render->mean, render->p99);
+}
+
+static void
+CL_WriteBenchmarkSummary(FILE *f, const char *name, int pass,
+			 const profsummary_t *frame,
+			 const profsummary_t *render)
+{
+    const profsummary_t *summary;
+    int i;
+
+    fprintf(f, "{\"demo\":\"%s\",", name);
+    if (pass)
+	fprintf(f, "\"pass\":%d,", pass);
+    fprintf(f, "\"frames\":%d,\"fps\":%.2f", frame->count,
+	    frame->mean ? 1000 / frame->mean : 0);
+    for (i = 0; i < 2; i++) {
+	summary = i ? render : frame;
+	fprintf(f, ",\"%s\":{\"min\":%.3f,\"avg\":%.3f,\"p50\":%.3f,"
+		"\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+		i ? "render_ms" : "frame_ms", summary->min, summary->mean,
+		summary->p50, summary->p90, summary->p99, summary->max);
+    }
+    fprintf(f, "}");
+}
+
+/*
+ * Opens the benchmark_output file with the given extension in the save
+ * directory
+ */
+static FILE *
+CL_OpenBenchmarkFile(const char *extension)
+{
+    char name[MAX_OSPATH];
+    FILE *f;
+
+    if (strstr(benchmark_output.string, "..")) {
+	Con_Printf("Relative pathnames are not allowed.\n");
+	return NULL;
+    }
+    if (snprintf(name, sizeof(name), "%s/%s%s", com_savedir,
+		 benchmark_output.string, extension) >= sizeof(name)) {
+	Con_Printf("Filename too long.\n");
+	return NULL;
+    }
+    f = fopen(name, "w");
+    if (!f) {
+	Con_Printf("ERROR: couldn't open %s.\n", name);
+	return NULL;
+    }
+    Con_Printf("Writing %s...\n", name);
+
+    return f;
+}
+
+/*
+====================
+CL_BenchmarkReport
+
+Prints the results of each run and of all of them together, and writes them
+out as JSON. The time of every frame recorded goes into a CSV file.
+====================
+*/
+static void
+CL_BenchmarkReport(void)
+{
+    profsummary_t frame, render;
+    const benchrun_t *run;
+    int i, j;
+    FILE *f;
+
+    if (!bench.numruns)
+	return;
+
+    Con_Printf("benchmark, times in ms\n");
+    Con_Printf("demo         frames     fps    min    avg    99%%    max"
+	       " render  r99%%\n");
+    for (i = 0; i < bench.numruns; i++) {
+	CL_SummarizeRuns(i, 1, &frame, &render);
+	CL_PrintBenchmarkLine(bench.demos[bench.runs[i].demo], &frame,
+			      &render);
+    }
+    CL_SummarizeRuns(0, bench.numruns, &frame, &render);
+    CL_PrintBenchmarkLine("total", &frame, &render);
+
+    if (!benchmark_output.string[0])
+	return;
+
+    f = CL_OpenBenchmarkFile(".json");
+    if (f) {
+	fprintf(f, "{\"warmup\":%d,\"passes\":%d,\"runs\":[",
+		bench.warmup, bench.passes);
+	for (i = 0; i < bench.numruns; i++) {
+	    run = &bench.runs[i];
+	    CL_SummarizeRuns(i, 1, &frame, &render);
+	    fprintf(f, i ? ",\n" : "\n");
+	    CL_WriteBenchmarkSummary(f, bench.demos[run->demo], run->pass,
+				     &frame, &render);
+	}
+	fprintf(f, "\n],\"total\":");
+	CL_SummarizeRuns(0, bench.numruns, &frame, &render);
+	CL_WriteBenchmarkSummary(f, "total", 0, &frame, &render);
+	fprintf(f, "}\n");
+	fclose(f);
+    }
+
+    f = CL_OpenBenchmarkFile(".csv");
+    if (f) {
+	fprintf(f, "demo,pass,frame,frame_ms,render_ms\n");
+	for (i = 0; i < bench.numruns; i++) {
+	    run = &bench.runs[i];
+	    for (j = 0; j < run->numframes; j++)
+		fprintf(f, "%s,%d,%d,%.3f,%.3f\n", bench.demos[run->demo],
+			run->pass, j, bench.frametime[run->firstframe + j],
+			bench.rendertime[run->firstframe + j]);
+	}
+	fclose(f);
+    }
+}
+
+/*
+ * Called as each timedemo of the benchmark ends, to start the next one
+ */
+static void
+CL_BenchmarkNextDemo(void)
+{
+    benchrun_t *run;
+    char str[MAX_DEMONAME + 16];
+
+    if (bench.recording) {
+	run = &bench.runs[bench.numruns++];
+	run->numframes = bench.numframes - run->firstframe;
+	bench.recording = false;
+    }
+
+    if (++bench.demo == bench.numdemos) {
+	bench.demo = 0;
+	bench.pass++;
+    }
+    if (bench.pass == bench.warmup + bench.passes) {
+	CL_StopBenchmark();
+	CL_BenchmarkReport();
+	return;
+    }
+
+    snprintf(str, sizeof(str), "timedemo %s\n", bench.demos[bench.demo]);
+    Cbuf_InsertText(str);
+}
+
+/*
+ * Called as each timedemo of the benchmark starts
+ */
+static void
+CL_BenchmarkStartDemo(void)
+{
+    benchrun_t *run;
+
+    if (bench.pass < bench.warmup)
+	return;
+
+    run = &bench.runs[bench.numruns];
+    run->demo = bench.demo;
+    run->pass = bench.pass - bench.warmup + 1;
+    run->firstframe = bench.numframes;
+    run->numframes = 0;
+    bench.recording = true;
+}
+
+/*
+====================
+CL_Benchmark_f
+
+benchmark [demoname ...]
+====================
+*/
+void
+CL_Benchmark_f(void)
+{
+    int i, numdemos;
+    char str[MAX_DEMONAME + 16];
+
+    if (cmd_source != src_command)
+	return;
+
+    if (Cmd_Argc() > MAX_DEMOS + 1) {
+	Con_Printf("benchmark [demoname ...] : times up to %d demos, "
+		   "or the startdemos list\n", MAX_DEMOS);
+	return;
+    }
+
+    CL_StopBenchmark();
+    numdemos = 0;
+    if (Cmd_Argc() > 1) {
+	for (i = 1; i < Cmd_Argc(); i++)
+	    snprintf(bench.demos[numdemos++], MAX_DEMONAME, "%s", Cmd_Argv(i));
+    } else {
+	for (i = 0; i < MAX_DEMOS && cls.demos[i][0]; i++)
+	    snprintf(bench.demos[numdemos++], MAX_DEMONAME, "%s", cls.demos[i]);
+    }
+    if (!numdemos) {
+	Con_Printf("No demos listed with startdemos\n");
+	return;
+    }
+
+    bench.numdemos = numdemos;
+    bench.warmup = qmax(0, (int)benchmark_warmup.value);
+    bench.passes = qclamp((int)benchmark_passes.value, 1,
+			  MAX_BENCH_RUNS / numdemos);
+    bench.demo = 0;
+    bench.pass = 0;
+    bench.numruns = 0;
+    bench.numframes = 0;
+    bench.active = true;
+    Prof_Force(true);
+
+    cls.demonum = -1;		// stop demo loop
+    snprintf(str, sizeof(str), "timedemo %s\n", bench.demos[0]);
+    Cbuf_InsertText(str);
+}
+
 /*
 ====================
 CL_FinishTimeDemo
@@ -370,11 +1382,14 @@ static void CL_FinishTimeDemo(void)
 
 // the first frame didn't count
     frames = (host_framecount - cls.td_startframe) - 1;
-    time = realtime - cls.td_starttime;
+    time = Sys_DoubleTime() - cls.td_starttime;
     if (!time)
 	time = 1;
     Con_Printf("%i frames %5.1f seconds %5.1f fps\n", frames, time,
 	       frames / time);
+
+    if (bench.active)
+	CL_BenchmarkNextDemo();
 }
 
 /*
@@ -396,6 +1411,13 @@ CL_TimeDemo_f(void)
     }
 
     CL_PlayDemo_f();
+    if (!cls.demoplayback) {
+	if (bench.active) {
+	    Con_Printf("Benchmark aborted.\n");
+	    CL_StopBenchmark();
+	}
+	return;
+    }
 
 // cls.td_starttime will be grabbed at the second frame of the demo, so
 // all the loading time doesn't get counted
@@ -403,4 +1425,35 @@ CL_TimeDemo_f(void)
     cls.timedemo = true;
     cls.td_startframe = host_framecount;
     cls.td_lastframe = -1;	// get a new message this frame
+
+    if (bench.active)
+	CL_BenchmarkStartDemo();
+}
+
+/*
+====================
+CL_CaptureDemo_f
+
+capturedemo <demoname> [<filename>]
+====================
+*/
+void
+CL_CaptureDemo_f(void)
+{
+    if (cmd_source != src_command)
+	return;
+
+    if (Cmd_Argc() != 2 && Cmd_Argc() != 3) {
+	Con_Printf("capturedemo <demoname> [<filename>] : "
+		   "renders a demo to video\n");
+	return;
+    }
+
+    // the capture ends with the demo, not the demo loop
+    cls.demonum = -1;
+    CL_Disconnect();
+    if (!CL_OpenDemo(Cmd_Argv(1)))
+	return;
+    if (!Capture_Start(Cmd_Argv(Cmd_Argc() - 1)))
+	CL_StopPlayback();
 }
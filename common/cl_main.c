@@ -47,6 +47,7 @@ cvar_t cl_color = { "_cl_color", "0", true };
 
 cvar_t cl_shownet = { "cl_shownet", "0" };	// can be 0, 1, or 2
 cvar_t cl_nolerp = { "cl_nolerp", "0" };
+cvar_t cl_lerpbuffer = { "cl_lerpbuffer", "1" };
 
 cvar_t lookspring = { "lookspring", "0", true };
 cvar_t lookstrafe = { "lookstrafe", "0", true };
@@ -456,6 +457,122 @@ float CL_LerpPoint(void)
 }
 
 
+/*
+ * With cl_lerpbuffer, the other entities are drawn from their snapshots as
+ * they were a little before the last message: a mean gap between messages,
+ * for there to be one to lerp to, plus as much as the messages' arrival has
+ * been wandering from their timestamps. That clock runs at the frame rate,
+ * only eased towards where it should be over a second or so, so a late or
+ * bunched up message doesn't show.
+ */
+#define LERP_JITTER_SCALE	2	// deviations of jitter to ride out
+#define LERP_MAXDELAY		0.2	// never drawn further back than this
+#define LERP_MAXDRIFT		0.1	// most it runs fast or slow by
+#define LERP_MAXERROR		0.25	// jump rather than nudge this far
+
+/*
+===============
+CL_MessageArrived
+
+Measures how far each message's arrival is off its timestamp, from the
+gap to the last one
+===============
+*/
+void CL_MessageArrived(void)
+{
+   float gap = cl.mtime[0] - cl.mtime[1];
+   float deviation;
+
+   if (cl.lastarrival && gap > 0 && gap < LERP_MAXERROR)
+   {
+      deviation = fabs(realtime - cl.lastarrival - gap);
+      cl.messagegap += (gap - cl.messagegap) / 16;
+      cl.jitter += (qmin(deviation, LERP_MAXDELAY) - cl.jitter) / 16;
+   }
+   cl.lastarrival = realtime;
+}
+
+static qboolean CL_LerpBuffered(void)
+{
+   return cl_lerpbuffer.value && !cl_nolerp.value && !cls.timedemo &&
+      !sv.active;
+}
+
+/*
+===============
+CL_AdvanceLerpTime
+===============
+*/
+static void CL_AdvanceLerpTime(void)
+{
+   float delay, drift;
+   double error;
+
+   delay = qmin(cl.messagegap + LERP_JITTER_SCALE * cl.jitter,
+         LERP_MAXDELAY);
+   if (!cl.paused)
+      cl.lerptime += host_frametime;
+
+   /* where the server is by now, if the last message was on time */
+   error = cl.mtime[0] + (realtime - cl.lastarrival) - delay - cl.lerptime;
+   if (fabs(error) > LERP_MAXERROR)
+      cl.lerptime += error;
+   else
+   {
+      drift = LERP_MAXDRIFT * host_frametime;
+      cl.lerptime += qclamp(error * host_frametime, -drift, drift);
+   }
+   if (cl.lerptime > cl.mtime[0])
+      cl.lerptime = cl.mtime[0];
+}
+
+/*
+===============
+CL_LerpSnapshots
+
+Places the entity between the snapshots either side of cl.lerptime, or at
+the nearest end of them
+===============
+*/
+static void CL_LerpSnapshots(entity_t *ent)
+{
+   const entitysnapshot_t *from, *to;
+   int i, j, oldest;
+   float f, d;
+
+   oldest = qmax(ent->numsnapshots - ENTITY_SNAPSHOTS, 0);
+   to = &ent->snapshots[(ent->numsnapshots - 1) & (ENTITY_SNAPSHOTS - 1)];
+   from = to;
+   for (i = ent->numsnapshots - 2; i >= oldest; i--)
+   {
+      from = &ent->snapshots[i & (ENTITY_SNAPSHOTS - 1)];
+      if (from->time <= cl.lerptime)
+         break;
+      to = from;
+   }
+
+   f = 1;
+   if (to->time > from->time && cl.lerptime < to->time)
+      f = qmax(cl.lerptime - from->time, 0) / (to->time - from->time);
+   for (j = 0; j < 3; j++)
+   {
+      d = to->origin[j] - from->origin[j];
+      if (d > 100 || d < -100)
+         f = f < 1 ? 0 : 1;	/* a teleport, stay until it's due */
+   }
+
+   for (j = 0; j < 3; j++)
+   {
+      ent->origin[j] = from->origin[j] + f * (to->origin[j] - from->origin[j]);
+      d = to->angles[j] - from->angles[j];
+      if (d > 180)
+         d -= 360;
+      else if (d < -180)
+         d += 360;
+      ent->angles[j] = from->angles[j] + f * d;
+   }
+}
+
 /*
 ===============
 CL_RelinkEntities
@@ -470,9 +587,13 @@ void CL_RelinkEntities(void)
    float bobjrotate;
    vec3_t oldorg;
    dlight_t *dl;
+   qboolean buffered;
 
    /* determine partial update time */
    frac = CL_LerpPoint();
+   buffered = CL_LerpBuffered();
+   if (buffered)
+      CL_AdvanceLerpTime();
 
    cl_numvisedicts = 0;
 
@@ -532,6 +653,8 @@ void CL_RelinkEntities(void)
          VectorCopy(ent->msg_origins[0], ent->origin);
          VectorCopy(ent->msg_angles[0], ent->angles);
       }
+      else if (buffered && i != cl.viewentity && ent->numsnapshots)
+         CL_LerpSnapshots(ent);
       else
       {
          f = frac;
@@ -764,6 +887,7 @@ void CL_Init(void)
    Cvar_RegisterVariable(&cl_anglespeedkey);
    Cvar_RegisterVariable(&cl_shownet);
    Cvar_RegisterVariable(&cl_nolerp);
+   Cvar_RegisterVariable(&cl_lerpbuffer);
    Cvar_RegisterVariable(&lookspring);
    Cvar_RegisterVariable(&lookstrafe);
    Cvar_RegisterVariable(&sensitivity);
@@ -773,14 +897,27 @@ void CL_Init(void)
    Cvar_RegisterVariable(&m_forward);
    Cvar_RegisterVariable(&m_side);
 
+   Cvar_RegisterVariable(&benchmark_warmup);
+   Cvar_RegisterVariable(&benchmark_passes);
+   Cvar_RegisterVariable(&benchmark_output);
+#ifdef HAVE_ZLIB
+   Cvar_RegisterVariable(&cl_democompress);
+#endif
+
    Cmd_AddCommand("entities", CL_PrintEntities_f);
    Cmd_AddCommand("disconnect", CL_Disconnect_f);
    Cmd_AddCommand("record", CL_Record_f);
    Cmd_AddCommand("stop", CL_Stop_f);
    Cmd_AddCommand("playdemo", CL_PlayDemo_f);
    Cmd_SetCompletion("playdemo", CL_Demo_Arg_f);
+   Cmd_AddCommand("demoseek", CL_DemoSeek_f);
+   Cmd_AddCommand("demoparse", CL_DemoParse_f);
    Cmd_AddCommand("timedemo", CL_TimeDemo_f);
    Cmd_SetCompletion("timedemo", CL_Demo_Arg_f);
+   Cmd_AddCommand("capturedemo", CL_CaptureDemo_f);
+   Cmd_SetCompletion("capturedemo", CL_Demo_Arg_f);
+   Cmd_AddCommand("benchmark", CL_Benchmark_f);
+   Cmd_SetCompletion("benchmark", CL_Demo_Arg_f);
 
    Cmd_AddCommand("mcache", Mod_Print);
 }
@@ -0,0 +1,212 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// cl_null.c -- the client, renderer, sound and menus, left out of the
+// dedicated server
+
+#include <math.h>
+
+#include "capture.h"
+#include "cdaudio.h"
+#include "client.h"
+#include "cvar.h"
+#include "draw.h"
+#include "host.h"
+#include "input.h"
+#include "keys.h"
+#include "mathlib.h"
+#include "menu.h"
+#include "model.h"
+#include "quakedef.h"
+#include "render.h"
+#include "sbar.h"
+#include "screen.h"
+#include "server.h"
+#include "sound.h"
+#include "bgmusic.h"
+#include "vid.h"
+#include "view.h"
+
+/*
+ * The host only calls into the client when it isn't dedicated, and the
+ * server only looks at the client's state to print or save it, so all of
+ * it is left empty. The models are the exception: the server sizes
+ * entities by their alias models, so those are loaded, only without
+ * their skins and meshes.
+ */
+
+client_static_t cls;
+client_state_t cl;
+entity_t cl_entities[MAX_EDICTS];
+lightstyle_t cl_lightstyle[MAX_LIGHTSTYLES];
+dlight_t cl_dlights[MAX_DLIGHTS];
+float dl_colors[4][4];
+kbutton_t in_mlook;
+cvar_t cl_name = { "_cl_name", "player", true };
+cvar_t cl_color = { "_cl_color", "0", true };
+
+viddef_t vid;
+float scr_centertime_off;
+int clearnotify;
+qboolean scr_disabled_for_loading;
+int host_fullbrights;
+
+qboolean m_return_onerror;
+char m_return_reason[32];
+
+void CL_Init(void) { }
+void CL_EstablishConnection(const char *host) { }
+void CL_Disconnect(void) { }
+void CL_NextDemo(void) { }
+void CL_StopPlayback(void) { }
+void CL_SendCmd(void) { }
+int CL_ReadFromServer(void) { return 0; }
+void CL_RunParticles(void) { }
+void CL_ClearTEnts(void) { }
+void CL_NewTranslation(int slot) { }
+
+void CL_Disconnect_f(void)
+{
+   if (sv.active)
+      Host_ShutdownServer(false);
+}
+
+void Capture_Init(void) { }
+void Capture_Shutdown(void) { }
+void Chase_Init(void) { }
+void Sbar_Init(void) { }
+void IN_Init(void) { }
+void IN_Shutdown(void) { }
+void IN_Commands(void) { }
+
+void M_Init(void) { }
+void M_Keydown(int key) { }
+void M_ToggleMenu_f(void) { }
+void M_Menu_Quit_f(void) { }
+void M_ReturnOnError(void) { }
+
+void VID_Init(unsigned char *palette) { }
+void VID_Shutdown(void) { }
+void Draw_Init(void) { }
+void Draw_Character(int x, int y, int num) { }
+void Draw_OverlayCharacter(byte *overlay, int x, int y, int num) { }
+void Draw_Overlay(int y, int height, const byte *overlay) { }
+void Draw_ConsoleBackground(int lines) { }
+void Draw_BeginDisc(void) { }
+void Draw_EndDisc(void) { }
+void SCR_Init(void) { }
+void SCR_UpdateScreen(void) { }
+void SCR_BeginLoadingPlaque(void) { }
+void SCR_EndLoadingPlaque(void) { }
+void SCR_CopyRows(int y, int height) { }
+
+void R_Init(void) { }
+void R_InitSky(struct texture_s *mt) { }
+void D_FlushCaches(void) { }
+int R_ParticleStateSize(void) { return 0; }
+void R_SaveParticles(struct sizebuf_s *buf) { }
+qboolean R_LoadParticles(struct sizebuf_s *buf) { return true; }
+
+void S_Init(void) { }
+void S_Shutdown(void) { }
+void S_LocalSound(const char *s) { }
+int S_ChannelStateSize(void) { return 0; }
+void S_SaveChannels(struct sizebuf_s *buf) { }
+qboolean S_LoadChannels(struct sizebuf_s *buf) { return true; }
+qboolean BGM_Init(void) { return true; }
+void BGM_Shutdown(void) { }
+int CDAudio_Init(void) { return -1; }
+void CDAudio_Shutdown(void) { }
+
+/* Missing textures still need something to point at */
+static texture_t r_notexture;
+texture_t *r_notexture_mip;
+
+void R_InitTextures(void)
+{
+   r_notexture_mip = &r_notexture;
+}
+
+/*
+ * The server rolls the player's view for strafing, with the client's
+ * defaults since there's nobody here to change them
+ */
+static cvar_t cl_rollspeed = { "cl_rollspeed", "200" };
+static cvar_t cl_rollangle = { "cl_rollangle", "2.0" };
+
+void V_Init(void)
+{
+   Cvar_RegisterVariable(&cl_rollspeed);
+   Cvar_RegisterVariable(&cl_rollangle);
+}
+
+float V_CalcRoll(vec3_t angles, vec3_t velocity)
+{
+   vec3_t forward, right, up;
+   float side, sign;
+
+   AngleVectors(angles, forward, right, up);
+   side = DotProduct(velocity, right);
+   sign = side < 0 ? -1 : 1;
+   side = fabs(side);
+
+   if (side < cl_rollspeed.value)
+      side = side * cl_rollangle.value / cl_rollspeed.value;
+   else
+      side = cl_rollangle.value;
+
+   return side * sign;
+}
+
+/*
+ * Alias models keep their frame bounds but no skins or meshes, and
+ * sprites no pixels
+ */
+static int SV_Aliashdr_Padding(void) { return 0; }
+
+static void *SV_LoadSkinData(const char *name, aliashdr_t *hdr, int skins,
+      byte **skindata)
+{
+   return hdr;
+}
+
+static void SV_LoadMeshData(const model_t *model, aliashdr_t *hdr,
+      const mtriangle_t *triangles, const stvert_t *stverts,
+      const trivertx_t **poseverts)
+{
+}
+
+/* Nothing like the layouts the renderers save */
+static int SV_CacheVariant(void) { return -1; }
+
+static model_loader_t SV_Model_Loader = {
+   SV_Aliashdr_Padding,
+   SV_LoadSkinData,
+   SV_LoadMeshData,
+   SV_CacheVariant
+};
+
+const model_loader_t *R_ModelLoader(void)
+{
+   return &SV_Model_Loader;
+}
+
+int R_SpriteDataSize(int numpixels) { return 0; }
+void R_SpriteDataStore(mspriteframe_t *frame, const char *modelname,
+      int framenum, byte *pixels) { }
@@ -188,8 +188,9 @@ CL_ParseStartSoundPacket(void)
    for (i = 0; i < 3; i++)
       pos[i] = MSG_ReadCoord();
 
-   S_StartSound(ent, channel, cl.sound_precache[sound_num], pos,
-         volume / 255.0, attenuation);
+   if (!cls.demoseeking)
+      S_StartSound(ent, channel, cl.sound_precache[sound_num], pos,
+            volume / 255.0, attenuation);
 }
 
 /*
@@ -262,7 +263,9 @@ CL_ParseServerInfo(void)
     char *level;
     const char *mapname;
     int i, maxlen;
-    int nummodels, numsounds;
+    int nummodels, numsounds, numprefetch;
+    const char **prefetch;
+    char *soundpaths;
     char **model_precache = malloc(sizeof(char*) * MAX_MODELS);
     char **sound_precache = malloc(sizeof(char*) * MAX_SOUNDS);
     for (i = 0; i < MAX_MODELS; i++)
@@ -292,6 +295,8 @@ CL_ParseServerInfo(void)
        return;
     }
     cl.players = (player_info_t*)Hunk_AllocName(cl.maxclients * sizeof(*cl.players), "players");
+    for (i = 0; i < cl.maxclients; i++)
+       cl.players[i].translations = vid.colormap;
 
     /* parse gametype */
     cl.gametype = MSG_ReadByte();
@@ -351,7 +356,30 @@ CL_ParseServerInfo(void)
     snprintf(cl.mapname, sizeof(cl.mapname), "%s", mapname);
     COM_StripExtension(cl.mapname);
 
+    /* read in what isn't cached on the job threads while the loaders wait */
+    prefetch = malloc(sizeof(*prefetch) * (nummodels + numsounds));
+    soundpaths = malloc(numsounds * (MAX_QPATH + 6));
+    if (prefetch && soundpaths)
+    {
+       numprefetch = 0;
+       for (i = 1; i < nummodels; i++)
+          if (Mod_NeedsLoad(model_precache[i]))
+             prefetch[numprefetch++] = model_precache[i];
+       for (i = 1; i < numsounds; i++)
+       {
+          if (!S_SoundNeedsLoad(sound_precache[i]))
+             continue;
+          snprintf(soundpaths + i * (MAX_QPATH + 6), MAX_QPATH + 6,
+                "sound/%s", sound_precache[i]);
+          prefetch[numprefetch++] = soundpaths + i * (MAX_QPATH + 6);
+       }
+       COM_PrefetchFiles(prefetch, numprefetch);
+    }
+    free(prefetch);
+    free(soundpaths);
+
     /* now we try to load everything else until a cache allocation fails */
+    Memory_TracePhase("models");
 
     for (i = 1; i < nummodels; i++)
     {
@@ -359,11 +387,13 @@ CL_ParseServerInfo(void)
        if (cl.model_precache[i] == NULL)
        {
           Con_Printf("Model %s not found\n", model_precache[i]);
+          COM_ClearPrefetch();
           return;
        }
        CL_KeepaliveMessage();
     }
 
+    Memory_TracePhase("sounds");
     S_BeginPrecaching();
     for (i = 1; i < numsounds; i++)
     {
@@ -371,12 +401,15 @@ CL_ParseServerInfo(void)
        CL_KeepaliveMessage();
     }
     S_EndPrecaching();
+    COM_ClearPrefetch();
 
 
     /* local state */
     cl_entities[0].model = cl.worldmodel = cl.model_precache[1];
 
+    Memory_TracePhase("surfaces");
     R_NewMap();
+    Memory_TracePhase("game");
 
     /* make sure nothing is hurt */
     Hunk_Check();		
@@ -438,6 +471,57 @@ static int CL_ReadModelFrame(unsigned int bits)
    return 0; /* should never happen */
 }
 
+/*
+ * The bytes that follow the bits of an entity update
+ */
+static int CL_UpdateLength(unsigned int bits)
+{
+   int length = (bits & U_LONGENTITY) ? 2 : 1;
+
+   if (bits & U_MODEL)
+   {
+      if (cl.protocol == PROTOCOL_VERSION_BJP
+            || cl.protocol == PROTOCOL_VERSION_BJP2
+            || cl.protocol == PROTOCOL_VERSION_BJP3)
+         length += 2;
+      else
+         length++;
+   }
+   if (bits & U_FRAME)
+      length++;
+   if (bits & U_COLORMAP)
+      length++;
+   if (bits & U_SKIN)
+      length++;
+   if (bits & U_EFFECTS)
+      length++;
+   if (bits & U_ORIGIN1)
+      length += 2;
+   if (bits & U_ANGLE1)
+      length++;
+   if (bits & U_ORIGIN2)
+      length += 2;
+   if (bits & U_ANGLE2)
+      length++;
+   if (bits & U_ORIGIN3)
+      length += 2;
+   if (bits & U_ANGLE3)
+      length++;
+   if (cl.protocol == PROTOCOL_VERSION_FITZ)
+   {
+      if (bits & U_FITZ_ALPHA)
+         length++;
+      if (bits & U_FITZ_FRAME2)
+         length++;
+      if (bits & U_FITZ_MODEL2)
+         length++;
+      if (bits & U_FITZ_LERPFINISH)
+         length++;
+   }
+
+   return length;
+}
+
 /*
 ==================
 CL_ParseUpdate
@@ -456,7 +540,9 @@ CL_ParseUpdate(unsigned int bits)
    int modnum;
    qboolean forcelink;
    entity_t *ent;
+   entitysnapshot_t *snapshot;
    int num;
+   msgreader_t msg;
 
    if (cls.state == ca_firstupdate) {
       // first update is the final signon stage
@@ -464,22 +550,30 @@ CL_ParseUpdate(unsigned int bits)
       CL_SignonReply();
    }
 
+   /* the bits say how long the rest is, so it's checked all at once */
+   MSG_BeginReader(&msg);
    if (bits & U_MOREBITS) {
-      i = MSG_ReadByte();
-      bits |= (i << 8);
+      if (!MSG_Need(&msg, 1))
+         goto badread;
+      bits |= MSG_TakeByte(&msg) << 8;
    }
 
    if (cl.protocol == PROTOCOL_VERSION_FITZ) {
+      if (!MSG_Need(&msg, !!(bits & U_FITZ_EXTEND1) + !!(bits & U_FITZ_EXTEND2)))
+         goto badread;
       if (bits & U_FITZ_EXTEND1)
-         bits |= MSG_ReadByte() << 16;
+         bits |= MSG_TakeByte(&msg) << 16;
       if (bits & U_FITZ_EXTEND2)
-         bits |= MSG_ReadByte() << 24;
+         bits |= MSG_TakeByte(&msg) << 24;
    }
 
+   if (!MSG_Need(&msg, CL_UpdateLength(bits)))
+      goto badread;
+
    if (bits & U_LONGENTITY)
-      num = MSG_ReadShort();
+      num = MSG_TakeShort(&msg);
    else
-      num = MSG_ReadByte();
+      num = MSG_TakeByte(&msg);
 
    ent = CL_EntityNum(num);
 
@@ -491,14 +585,19 @@ CL_ParseUpdate(unsigned int bits)
    ent->msgtime = cl.mtime[0];
 
    if (bits & U_MODEL) {
-      modnum = CL_ReadModelIndex(0);
+      if (cl.protocol == PROTOCOL_VERSION_BJP
+            || cl.protocol == PROTOCOL_VERSION_BJP2
+            || cl.protocol == PROTOCOL_VERSION_BJP3)
+         modnum = MSG_TakeShort(&msg);
+      else
+         modnum = MSG_TakeByte(&msg);
       if (modnum >= max_models(cl.protocol))
          Host_Error("CL_ParseModel: bad modnum");
    } else
       modnum = ent->baseline.modelindex;
 
    if (bits & U_FRAME)
-      ent->frame = MSG_ReadByte();
+      ent->frame = MSG_TakeByte(&msg);
    else
       ent->frame = ent->baseline.frame;
 
@@ -513,7 +612,7 @@ CL_ParseUpdate(unsigned int bits)
    }
 
    if (bits & U_COLORMAP)
-      i = MSG_ReadByte();
+      i = MSG_TakeByte(&msg);
    else
       i = ent->baseline.colormap;
    if (!i)
@@ -525,12 +624,12 @@ CL_ParseUpdate(unsigned int bits)
    }
 
    if (bits & U_SKIN)
-      ent->skinnum = MSG_ReadByte();
+      ent->skinnum = MSG_TakeByte(&msg);
    else
       ent->skinnum = ent->baseline.skinnum;
 
    if (bits & U_EFFECTS)
-      ent->effects = MSG_ReadByte();
+      ent->effects = MSG_TakeByte(&msg);
    else
       ent->effects = ent->baseline.effects;
 
@@ -539,29 +638,29 @@ CL_ParseUpdate(unsigned int bits)
    VectorCopy(ent->msg_angles[0], ent->msg_angles[1]);
 
    if (bits & U_ORIGIN1)
-      ent->msg_origins[0][0] = MSG_ReadCoord();
+      ent->msg_origins[0][0] = MSG_TakeCoord(&msg);
    else
       ent->msg_origins[0][0] = ent->baseline.origin[0];
    if (bits & U_ANGLE1)
-      ent->msg_angles[0][0] = MSG_ReadAngle();
+      ent->msg_angles[0][0] = MSG_TakeAngle(&msg);
    else
       ent->msg_angles[0][0] = ent->baseline.angles[0];
 
    if (bits & U_ORIGIN2)
-      ent->msg_origins[0][1] = MSG_ReadCoord();
+      ent->msg_origins[0][1] = MSG_TakeCoord(&msg);
    else
       ent->msg_origins[0][1] = ent->baseline.origin[1];
    if (bits & U_ANGLE2)
-      ent->msg_angles[0][1] = MSG_ReadAngle();
+      ent->msg_angles[0][1] = MSG_TakeAngle(&msg);
    else
       ent->msg_angles[0][1] = ent->baseline.angles[1];
 
    if (bits & U_ORIGIN3)
-      ent->msg_origins[0][2] = MSG_ReadCoord();
+      ent->msg_origins[0][2] = MSG_TakeCoord(&msg);
    else
       ent->msg_origins[0][2] = ent->baseline.origin[2];
    if (bits & U_ANGLE3)
-      ent->msg_angles[0][2] = MSG_ReadAngle();
+      ent->msg_angles[0][2] = MSG_TakeAngle(&msg);
    else
       ent->msg_angles[0][2] = ent->baseline.angles[2];
 
@@ -570,16 +669,17 @@ CL_ParseUpdate(unsigned int bits)
          // FIXME - TODO (called U_STEP in FQ)
       }
       if (bits & U_FITZ_ALPHA) {
-         MSG_ReadByte(); // FIXME - TODO
+         MSG_TakeByte(&msg); // FIXME - TODO
       }
       if (bits & U_FITZ_FRAME2)
-         ent->frame = (ent->frame & 0xFF) | (MSG_ReadByte() << 8);
+         ent->frame = (ent->frame & 0xFF) | (MSG_TakeByte(&msg) << 8);
       if (bits & U_FITZ_MODEL2)
-         modnum = (modnum & 0xFF)| (MSG_ReadByte() << 8);
+         modnum = (modnum & 0xFF)| (MSG_TakeByte(&msg) << 8);
       if (bits & U_FITZ_LERPFINISH) {
-         MSG_ReadByte(); // FIXME - TODO
+         MSG_TakeByte(&msg); // FIXME - TODO
       }
    }
+   MSG_EndReader(&msg);
 
    model = cl.model_precache[modnum];
    if (model != ent->model) {
@@ -629,6 +729,22 @@ CL_ParseUpdate(unsigned int bits)
       VectorCopy(ent->msg_angles[0], ent->angles);
       ent->forcelink = true;
    }
+
+   /* keep the update, starting over where it can't be lerped from */
+   if (ent->forcelink)
+      ent->numsnapshots = 0;
+   if (ent->numsnapshots
+       && ent->snapshots[(ent->numsnapshots - 1) & (ENTITY_SNAPSHOTS - 1)].time
+       == cl.mtime[0])
+      ent->numsnapshots--;
+   snapshot = &ent->snapshots[ent->numsnapshots++ & (ENTITY_SNAPSHOTS - 1)];
+   snapshot->time = cl.mtime[0];
+   VectorCopy(ent->msg_origins[0], snapshot->origin);
+   VectorCopy(ent->msg_angles[0], snapshot->angles);
+   return;
+
+badread:
+   MSG_EndReader(&msg);
 }
 
 /*
@@ -797,31 +913,13 @@ CL_NewTranslation
 void
 CL_NewTranslation(int slot)
 {
-   int i, j;
-   int top, bottom;
-   byte *dest, *source;
+   player_info_t *player;
 
    if (slot > cl.maxclients)
       Sys_Error("%s: slot > cl.maxclients", __func__);
-   dest = cl.players[slot].translations;
-   source = vid.colormap;
-   memcpy(dest, vid.colormap, sizeof(cl.players[slot].translations));
-   top = cl.players[slot].topcolor;
-   bottom = cl.players[slot].bottomcolor;
-
-   for (i = 0; i < VID_GRADES; i++, dest += 256, source += 256) {
-      if (top < 128)		// the artists made some backwards ranges.  sigh.
-         memcpy(dest + TOP_RANGE, source + top, 16);
-      else
-         for (j = 0; j < 16; j++)
-            dest[TOP_RANGE + j] = source[top + 15 - j];
-
-      if (bottom < 128)
-         memcpy(dest + BOTTOM_RANGE, source + bottom, 16);
-      else
-         for (j = 0; j < 16; j++)
-            dest[BOTTOM_RANGE + j] = source[bottom + 15 - j];
-   }
+   player = &cl.players[slot];
+   player->translations = R_TranslationTable(player->topcolor,
+         player->bottomcolor);
 }
 
 /*
@@ -991,6 +1089,7 @@ CL_ParseServerMessage(void)
          case svc_time:
             cl.mtime[1] = cl.mtime[0];
             cl.mtime[0] = MSG_ReadFloat();
+            CL_MessageArrived();
             break;
 
          case svc_clientdata:
@@ -1006,6 +1105,10 @@ CL_ParseServerMessage(void)
             break;
 
          case svc_disconnect:
+            if (cls.demobatch) {
+               CL_StopPlayback();	// on to the next in the list
+               return;
+            }
             Host_EndGame("Server disconnected\n");
 
          case svc_print:
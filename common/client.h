@@ -63,7 +63,7 @@ typedef struct player_info_s {
     int frags;
     byte topcolor;
     byte bottomcolor;
-    byte translations[VID_GRADES * 256];
+    byte *translations;		// shared, from R_TranslationTable
 } player_info_t;
 
 typedef struct {
@@ -114,11 +114,13 @@ typedef struct {
     qboolean demorecording;
     qboolean demoplayback;
     qboolean timedemo;
+    qboolean demoseeking;	// reading ahead to a demoseek time
+    qboolean demobatch;		// demoparse, the demo ends at a disconnect
     int forcetrack;		// -1 = use normal cd track
     FILE *demofile;
     int td_lastframe;		// to meter out one message a frame
     int td_startframe;		// host_framecount at start
-    float td_starttime;		// realtime at second frame of timedemo
+    double td_starttime;	// Sys_DoubleTime at second frame of timedemo
 
 // connection information
     int signon;			// 0 to SIGNONS
@@ -186,6 +188,11 @@ typedef struct {
     double oldtime;		// previous cl.time, time-oldtime is used
     // to decay light values and smooth step ups
 
+    double lerptime;		// the other entities are drawn as of this
+    double lastarrival;		// realtime the last svc_time came in
+    float messagegap;		// mean gap between server messages
+    float jitter;		// mean deviation of their arrival from it
+
     float last_received_message;	// (realtime) for net trouble icon
 
 //
@@ -239,6 +246,7 @@ extern cvar_t cl_autofire;
 
 extern cvar_t cl_shownet;
 extern cvar_t cl_nolerp;
+extern cvar_t cl_lerpbuffer;
 
 extern cvar_t cl_pitchdriftspeed;
 extern cvar_t lookspring;
@@ -250,6 +258,13 @@ extern cvar_t m_yaw;
 extern cvar_t m_forward;
 extern cvar_t m_side;
 
+extern cvar_t benchmark_warmup;
+extern cvar_t benchmark_passes;
+extern cvar_t benchmark_output;
+#ifdef HAVE_ZLIB
+extern cvar_t cl_democompress;
+#endif
+
 
 #define	MAX_TEMP_ENTITIES	64	// lightning bolts, etc
 #define	MAX_STATIC_ENTITIES	1024	// torches, etc
@@ -287,6 +302,7 @@ enum {
 extern float dl_colors[4][4]; /* Use enums to reference the colors */
 
 void CL_DecayLights(void);
+void CL_MessageArrived(void);
 void CL_RunParticles(void);
 
 void CL_Init(void);
@@ -343,13 +359,19 @@ void CL_Stop_f(void);
 void CL_Record_f(void);
 
 void CL_TimeDemo_f(void);
+void CL_CaptureDemo_f(void);
+void CL_Benchmark_f(void);
+qboolean CL_Benchmarking(void);
 void CL_PlayDemo_f(void);
+void CL_DemoSeek_f(void);
+void CL_DemoParse_f(void);
 struct stree_root *CL_Demo_Arg_f(const char *arg);
 
 //
 // cl_parse.c
 //
 void CL_ParseServerMessage(void);
+void CL_NewTranslation(int slot);
 
 //
 // view.c
@@ -358,7 +380,7 @@ void V_StartPitchDrift(void);
 void V_StopPitchDrift(void);
 
 void V_RenderView(void);
-void V_UpdatePalette(void);
+qboolean V_UpdatePalette(void);
 void V_Register(void);
 void V_ParseDamage(void);
 void V_SetContentsColor(int contents);
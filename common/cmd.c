@@ -50,6 +50,7 @@ typedef struct cmdalias_s {
 
 #define cmdalias_entry(ptr) container_of(ptr, struct cmdalias_s, stree)
 static DECLARE_STREE_ROOT(cmdalias_tree);
+static struct stree_hash cmdalias_hash;
 
 static qboolean cmd_wait;
 
@@ -80,10 +81,33 @@ Cmd_Wait_f(void)
 =============================================================================
 */
 
-static sizebuf_t cmd_text;
-#ifdef QW_HACK
-static byte cmd_text_buf[8192];
-#endif
+/*
+ * The command text is a ring, so inserting ahead of what's queued writes
+ * into the space behind the head rather than moving everything along.
+ */
+typedef struct {
+    char data[8192];		/* size must be a power of two */
+    int head;			/* start of the next command */
+    int cursize;		/* bytes queued from head */
+} cmdtext_t;
+
+static cmdtext_t cmd_text;
+
+#define CBUF_MASK (sizeof(cmd_text.data) - 1)
+
+/*
+ * Copies len bytes into the ring starting pos bytes from its start
+ */
+static void
+Cbuf_Write(int pos, const char *text, int len)
+{
+    int first;
+
+    pos &= CBUF_MASK;
+    first = qmin(len, (int)sizeof(cmd_text.data) - pos);
+    memcpy(cmd_text.data + pos, text, first);
+    memcpy(cmd_text.data, text + first, len - first);
+}
 
 /*
 ============
@@ -93,14 +117,8 @@ Cbuf_Init
 void
 Cbuf_Init(void)
 {
-#ifdef NQ_HACK
-    SZ_Alloc(&cmd_text, 8192);
-#endif
-#ifdef QW_HACK
-    cmd_text.data = cmd_text_buf;
-    cmd_text.maxsize = sizeof(cmd_text_buf);
+    cmd_text.head = 0;
     cmd_text.cursize = 0;
-#endif
 }
 
 
@@ -114,19 +132,18 @@ Adds command text at the end of the buffer
 void
 Cbuf_AddText(const char *fmt, ...)
 {
+    static char buf[sizeof(cmd_text.data)];
     va_list ap;
-    int len, maxlen;
-    char *buf;
+    int len;
 
-    buf = (char *)cmd_text.data + cmd_text.cursize;
-    maxlen = cmd_text.maxsize - cmd_text.cursize;
     va_start(ap, fmt);
-    len = vsnprintf(buf, maxlen, fmt, ap);
+    len = vsnprintf(buf, sizeof(cmd_text.data) - cmd_text.cursize, fmt, ap);
     va_end(ap);
 
-    if (cmd_text.cursize + len < cmd_text.maxsize)
+    if (len >= 0 && cmd_text.cursize + len < (int)sizeof(cmd_text.data)) {
+	Cbuf_Write(cmd_text.head + cmd_text.cursize, buf, len);
 	cmd_text.cursize += len;
-    else
+    } else
 	Con_Printf("%s: overflow\n", __func__);
 }
 
@@ -146,13 +163,12 @@ Cbuf_InsertText(const char *text)
 
     len = strlen(text);
     if (cmd_text.cursize) {
-	if (cmd_text.cursize + len + 1 > cmd_text.maxsize)
+	if (cmd_text.cursize + len + 1 > (int)sizeof(cmd_text.data))
 	    Sys_Error("%s: overflow", __func__);
 
-	/* move any commands still remaining in the exec buffer */
-	memmove(cmd_text.data + len + 1, cmd_text.data, cmd_text.cursize);
-	memcpy(cmd_text.data, text, len);
-	cmd_text.data[len] = '\n';
+	cmd_text.head = (cmd_text.head - len - 1) & CBUF_MASK;
+	Cbuf_Write(cmd_text.head, text, len);
+	cmd_text.data[(cmd_text.head + len) & CBUF_MASK] = '\n';
 	cmd_text.cursize += len + 1;
     } else {
 	Cbuf_AddText("%s\n", text);
@@ -171,38 +187,38 @@ void Cbuf_Execute(void)
 
    while (cmd_text.cursize)
    {
-      /* find a \n or ; line break */
-      char *text = (char *)cmd_text.data;
+      /*
+       * find a \n or ; line break, copying the line out as we go, since
+       * commands (exec, alias) can insert text over where it was
+       */
       int quotes = 0;
       int maxlen = qmin(cmd_text.cursize, (int)sizeof(line));
 
       for (len = 0; len < maxlen; len++)
       {
-         if (text[len] == '"')
+         char c = cmd_text.data[(cmd_text.head + len) & CBUF_MASK];
+
+         if (c == '"')
             quotes++;
-         if (!(quotes & 1) && text[len] == ';')
+         if (!(quotes & 1) && c == ';')
             break;		/* don't break if inside a quoted string */
-         if (text[len] == '\n')
+         if (c == '\n')
             break;
+         line[len] = c;
       }
       if (len == sizeof(line)) {
          Con_Printf("%s: command truncated\n", __func__);
          len--;
       }
-      memcpy(line, text, len);
       line[len] = 0;
 
-      /*
-       * delete the text from the command buffer and move remaining commands
-       * down this is necessary because commands (exec, alias) can insert
-       * data at the beginning of the text buffer
-       */
+      /* take the text and its terminating character off the buffer */
       if (len == cmd_text.cursize)
          cmd_text.cursize = 0;
       else {
-         len++; /* skip the terminating character */
+         len++;
+         cmd_text.head = (cmd_text.head + len) & CBUF_MASK;
          cmd_text.cursize -= len;
-         memmove(text, text + len, cmd_text.cursize);
       }
 
       /* execute the command line */
@@ -364,7 +380,7 @@ Cmd_Alias_Find(const char *name)
     struct cmdalias_s *ret = NULL;
     struct stree_node *n;
 
-    n = STree_Find(&cmdalias_tree, name);
+    n = STree_HashFind(&cmdalias_hash, name);
     if (n)
 	ret = cmdalias_entry(n);
 
@@ -407,6 +423,7 @@ Cmd_Alias_f(void)
 	strcpy(a->name, s);
 	a->stree.string = a->name;
 	STree_Insert(&cmdalias_tree, &a->stree);
+	STree_HashInsert(&cmdalias_hash, &a->stree);
     }
 
 // copy the rest of the command line
@@ -450,6 +467,7 @@ typedef struct cmd_function_s {
 
 #define cmd_entry(ptr) container_of(ptr, struct cmd_function_s, stree)
 static DECLARE_STREE_ROOT(cmd_tree);
+static struct stree_hash cmd_hash;
 
 #define	MAX_ARGS		80
 static int cmd_argc;
@@ -535,12 +553,23 @@ Parses the given string into command line tokens.
 void
 Cmd_TokenizeString(const char *text)
 {
-    int i;
-    char *arg;
-
-// clear the args from the last string
-    for (i = 0; i < cmd_argc; i++)
-	Z_Free(cmd_argv[i]);
+    static char argstatic[2048];
+    static char *argbuf = argstatic;
+    static int argbufsize = sizeof(argstatic);
+    int needed, argused, len;
+
+    /*
+     * No token is longer than the text it was parsed from, so the text
+     * plus a terminator per argument bounds the space the tokens need
+     */
+    needed = strlen(text) + MAX_ARGS;
+    if (needed > argbufsize) {
+	if (argbuf != argstatic)
+	    Z_Free(argbuf);
+	argbufsize = needed;
+	argbuf = (char *)Z_Malloc(argbufsize);
+    }
+    argused = 0;
 
     cmd_argc = 0;
     cmd_args = NULL;
@@ -566,10 +595,11 @@ Cmd_TokenizeString(const char *text)
 	if (!text)
 	    return;
 
-	if (cmd_argc < MAX_ARGS) {
-	    arg = (char*)Z_Malloc(strlen(com_token) + 1);
-	    strcpy(arg, com_token);
-	    cmd_argv[cmd_argc] = arg;
+	len = strlen(com_token) + 1;
+	if (cmd_argc < MAX_ARGS && argused + len <= argbufsize) {
+	    memcpy(argbuf + argused, com_token, len);
+	    cmd_argv[cmd_argc] = argbuf + argused;
+	    argused += len;
 	    cmd_argc++;
 	}
     }
@@ -581,7 +611,7 @@ Cmd_FindCommand(const char *name)
     struct cmd_function_s *ret = NULL;
     struct stree_node *n;
 
-    n = STree_Find(&cmd_tree, name);
+    n = STree_HashFind(&cmd_hash, name);
     if (n)
 	ret = cmd_entry(n);
 
@@ -619,6 +649,7 @@ Cmd_AddCommand(const char *cmd_name, xcommand_t function)
     cmd->completion = NULL;
     cmd->stree.string = cmd->name;
     STree_Insert(&cmd_tree, &cmd->stree);
+    STree_HashInsert(&cmd_hash, &cmd->stree);
 }
 
 void
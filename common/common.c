@@ -28,6 +28,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <string.h>
 #include <sys/types.h>
 #include <errno.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #ifdef NQ_HACK
 #include "quakedef.h"
@@ -48,6 +54,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "console.h"
 #include "crc.h"
 #include "draw.h"
+#include "jobs.h"
+#include "namehash.h"
 #include "net.h"
 #include "shell.h"
 #include "sys.h"
@@ -285,72 +293,6 @@ float Q_atof(const char *str)
    return val * sign;
 }
 
-/*
-============================================================================
-
-					BYTE ORDER FUNCTIONS
-
-============================================================================
-*/
-
-qboolean bigendien;
-
-short (*BigShort) (short l);
-short (*LittleShort) (short l);
-int (*BigLong) (int l);
-int (*LittleLong) (int l);
-float (*BigFloat) (float l);
-float (*LittleFloat) (float l);
-
-short ShortSwap(short l)
-{
-   byte b1 = l & 255;
-   byte b2 = (l >> 8) & 255;
-
-   return (b1 << 8) + b2;
-}
-
-short ShortNoSwap(short l)
-{
-   return l;
-}
-
-int LongSwap(int l)
-{
-   byte b1 = l & 255;
-   byte b2 = (l >> 8) & 255;
-   byte b3 = (l >> 16) & 255;
-   byte b4 = (l >> 24) & 255;
-
-   return ((int)b1 << 24) + ((int)b2 << 16) + ((int)b3 << 8) + b4;
-}
-
-int
-LongNoSwap(int l)
-{
-    return l;
-}
-
-float FloatSwap(float f)
-{
-   union {
-      float f;
-      byte b[4];
-   } dat1, dat2;
-
-   dat1.f = f;
-   dat2.b[0] = dat1.b[3];
-   dat2.b[1] = dat1.b[2];
-   dat2.b[2] = dat1.b[1];
-   dat2.b[3] = dat1.b[0];
-   return dat2.f;
-}
-
-float FloatNoSwap(float f)
-{
-   return f;
-}
-
 /*
 ==============================================================================
 
@@ -534,6 +476,19 @@ void MSG_BeginReading(void)
    msg_badread = false;
 }
 
+void MSG_BeginReader(msgreader_t *msg)
+{
+   MSG_InitReader(msg, &net_message);
+   msg->readcount = msg_readcount;
+   msg->badread = msg_badread;
+}
+
+void MSG_EndReader(const msgreader_t *msg)
+{
+   msg_readcount = msg->readcount;
+   msg_badread = msg->badread;
+}
+
 #ifdef QW_HACK
 int MSG_GetReadCount(void)
 {
@@ -808,6 +763,15 @@ static void *SZ_GetSpace(sizebuf_t *buf, int length)
    return data;
 }
 
+byte *SZ_Reserve(sizebuf_t *buf, int maxlength)
+{
+   byte *data = (byte*)SZ_GetSpace(buf, maxlength);
+
+   buf->cursize -= maxlength;
+
+   return data;
+}
+
 void SZ_Write(sizebuf_t *buf, const void *data, int length)
 {
    memcpy(SZ_GetSpace(buf, length), data, length);
@@ -1163,27 +1127,11 @@ COM_Init
 
 void COM_Init(void)
 {
+   // catch a build for the wrong byte order
    swaptest.b[0] = 1;
    swaptest.b[1] = 0;
-
-   // set the byte swapping variables in a portable manner
-   if (swaptest.s == 1) {
-      bigendien = false;
-      BigShort = ShortSwap;
-      LittleShort = ShortNoSwap;
-      BigLong = LongSwap;
-      LittleLong = LongNoSwap;
-      BigFloat = FloatSwap;
-      LittleFloat = FloatNoSwap;
-   } else {
-      bigendien = true;
-      BigShort = ShortNoSwap;
-      LittleShort = ShortSwap;
-      BigLong = LongNoSwap;
-      LittleLong = LongSwap;
-      BigFloat = FloatNoSwap;
-      LittleFloat = FloatSwap;
-   }
+   if ((swaptest.s == 1) == bigendien)
+      Sys_Error("%s: built for the wrong byte order", __func__);
 
    Cvar_RegisterVariable(&registered);
 #ifdef NQ_HACK
@@ -1236,13 +1184,28 @@ int com_filesize;
 typedef struct {
     char name[MAX_QPATH];
     int filepos, filelen;
+    int packedlen;		// bytes in the pack, less than filelen if deflated
+    int deflated;
+    int namenext;		// next file in the same name hash chain, or -1
+    int dirnext;		// next file in the same directory chain, or -1
 } packfile_t;
 
+/*
+ * Each pack keeps two chained hash indexes over its directory: one on the
+ * exact file name for COM_FOpenFile/COM_FileExists and one on the
+ * (case-insensitive) directory part of the name for COM_ScanDirPak.
+ */
+#define PACK_HASH_SIZE 1024
+
 typedef struct pack_s
 {
     char filename[MAX_OSPATH];
     int numfiles;
     packfile_t *files;
+    int namehash[PACK_HASH_SIZE];
+    int dirhash[PACK_HASH_SIZE];
+    byte *mapbase;		// whole pak mapped copy-on-write, or NULL
+    size_t mapsize;
 } pack_t;
 
 // on disk
@@ -1277,6 +1240,89 @@ static searchpath_t *com_searchpaths;
 static searchpath_t *com_base_searchpaths;	// without gamedirs
 #endif
 
+// -mmap: map each pak once and serve COM_MapFile straight from it
+static qboolean com_mmap_packs;
+
+/*
+================
+COM_PackHash
+
+Hash the first len characters of a pack file name (or the whole name if
+len is negative). Directory hashes are case-insensitive to match the
+strncasecmp comparison done by COM_ScanDirPak.
+================
+*/
+static unsigned COM_PackHash(const char *name, int len, qboolean nocase)
+{
+   unsigned hash = 2166136261u;
+   unsigned char c;
+
+   while (len-- && (c = *name++))
+   {
+      if (nocase)
+         c = tolower(c);
+      hash = (hash ^ c) * 16777619u;
+   }
+
+   return hash & (PACK_HASH_SIZE - 1);
+}
+
+/*
+================
+COM_PackDirLength
+
+Length of the directory part of a pack file name, excluding the
+trailing slash. Files in the root of the pack have a zero length.
+================
+*/
+static int COM_PackDirLength(const char *name)
+{
+   const char *slash = strrchr(name, '/');
+
+   return slash ? slash - name : 0;
+}
+
+static void COM_HashPackFiles(pack_t *pack)
+{
+   int i, bucket;
+   packfile_t *file;
+
+   for (i = 0; i < PACK_HASH_SIZE; i++)
+   {
+      pack->namehash[i] = -1;
+      pack->dirhash[i] = -1;
+   }
+
+   /*
+    * Insert in reverse so each chain runs in directory order; the first
+    * entry of a duplicated name keeps winning as it did with the linear
+    * search.
+    */
+   for (i = pack->numfiles - 1; i >= 0; i--)
+   {
+      file = &pack->files[i];
+
+      bucket = COM_PackHash(file->name, -1, false);
+      file->namenext = pack->namehash[bucket];
+      pack->namehash[bucket] = i;
+
+      bucket = COM_PackHash(file->name, COM_PackDirLength(file->name), true);
+      file->dirnext = pack->dirhash[bucket];
+      pack->dirhash[bucket] = i;
+   }
+}
+
+static packfile_t *COM_FindPackFile(pack_t *pak, const char *filename)
+{
+   int i = pak->namehash[COM_PackHash(filename, -1, false)];
+
+   for (; i >= 0; i = pak->files[i].namenext)
+      if (!strcmp(pak->files[i].name, filename))
+         return &pak->files[i];
+
+   return NULL;
+}
+
 /*
 ================
 COM_filelength
@@ -1309,6 +1355,97 @@ error:
    return -1;
 }
 
+#ifdef HAVE_ZLIB
+#define INFLATE_CHUNK (64 * 1024)
+
+/*
+ * Inflates a deflated pack entry, from the pak's mapping if it has one or
+ * else read in chunks, into 'out' or, without it, onto the end of
+ * 'outfile'. Only uses malloc and stdio, so it's safe on the job threads.
+ */
+static qboolean COM_InflatePackFile(const pack_t *pack,
+      const packfile_t *file, byte *out, FILE *outfile)
+{
+   z_stream stream;
+   FILE *in = NULL;
+   byte *inbuf = NULL, *outbuf = NULL;
+   int remaining, count, ret;
+   qboolean ok = false;
+
+   memset(&stream, 0, sizeof(stream));
+   if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+      return false;
+
+   remaining = file->packedlen;
+   if (pack->mapbase
+         && (size_t)file->filepos + file->packedlen <= pack->mapsize)
+   {
+      stream.next_in = (Bytef *)pack->mapbase + file->filepos;
+      stream.avail_in = file->packedlen;
+      remaining = 0;
+   }
+   else
+   {
+      in = fopen(pack->filename, "rb");
+      inbuf = (byte*)malloc(INFLATE_CHUNK);
+      if (!in || !inbuf || fseek(in, file->filepos, SEEK_SET))
+         goto done;
+   }
+   if (out)
+   {
+      stream.next_out = out;
+      stream.avail_out = file->filelen;
+   }
+   else if (!(outbuf = (byte*)malloc(INFLATE_CHUNK)))
+      goto done;
+
+   for (;;)
+   {
+      if (!stream.avail_in && remaining)
+      {
+         count = qmin(remaining, INFLATE_CHUNK);
+         if (fread(inbuf, 1, count, in) != (size_t)count)
+            goto done;
+         remaining -= count;
+         stream.next_in = inbuf;
+         stream.avail_in = count;
+      }
+      if (outbuf)
+      {
+         stream.next_out = outbuf;
+         stream.avail_out = INFLATE_CHUNK;
+      }
+      ret = inflate(&stream, Z_NO_FLUSH);
+      if (outbuf)
+      {
+         count = INFLATE_CHUNK - stream.avail_out;
+         if (fwrite(outbuf, 1, count, outfile) != (size_t)count)
+            goto done;
+      }
+      if (ret == Z_STREAM_END)
+         break;
+      if (ret != Z_OK)
+         goto done;	// damaged, or longer or shorter than it says
+   }
+   ok = stream.total_out == (uLong)file->filelen;
+
+done:
+   inflateEnd(&stream);
+   if (in)
+      fclose(in);
+   free(inbuf);
+   free(outbuf);
+
+   return ok;
+}
+#else
+static qboolean COM_InflatePackFile(const pack_t *pack,
+      const packfile_t *file, byte *out, FILE *outfile)
+{
+   return false;	// deflated entries are left out when loading
+}
+#endif
+
 /*
 ============
 COM_Path_f
@@ -1358,6 +1495,7 @@ void COM_WriteFile(const char *filename, const void *data, int len)
    }
    fwrite(data, 1, len, f);
    fclose(f);
+   COM_FlushScanCache();
 }
 
 
@@ -1390,25 +1528,17 @@ void COM_CreatePath(const char *path)
 
 /*
 ===========
-COM_FOpenFile
+COM_FindFile
 
-Finds the file in the search path.
-Sets com_filesize
-If the requested file is inside a packfile, a new FILE * will be opened
-into the file.
+Finds where the file would be opened from, the first place in the search
+path that has it: a pak and its entry, or the path of a file in the
+directory tree. Touches no globals, so it's safe from any thread.
 ===========
 */
-int file_from_pak; // global indicating file came from pack file
-
-int COM_FOpenFile(const char *filename, FILE **file)
+static searchpath_t *COM_FindFile(const char *filename, packfile_t **pakfile,
+      char *path, int pathsize)
 {
    searchpath_t *search;
-   char path[MAX_OSPATH];
-   pack_t *pak;
-   int i;
-   int findtime;
-
-   file_from_pak = 0;
 
    // search through the path, one element at a time
    for (search = com_searchpaths; search; search = search->next)
@@ -1416,20 +1546,10 @@ int COM_FOpenFile(const char *filename, FILE **file)
       // is the element a pak file?
       if (search->pack)
       {
-         // look through all the pak file elements
-         pak = search->pack;
-         for (i = 0; i < pak->numfiles; i++)
-            if (!strcmp(pak->files[i].name, filename))
-            {	// found it!
-               // open a new file on the pakfile
-               *file = fopen(pak->filename, "rb");
-               if (!*file)
-                  Sys_Error("Couldn't reopen %s", pak->filename);
-               fseek(*file, pak->files[i].filepos, SEEK_SET);
-               com_filesize = pak->files[i].filelen;
-               file_from_pak = 1;
-               return com_filesize;
-            }
+         // look up the name in the pak directory index
+         *pakfile = COM_FindPackFile(search->pack, filename);
+         if (*pakfile)
+            return search;	// found it!
       } else {
          // check a file in the directory tree
          if (!static_registered)
@@ -1438,22 +1558,83 @@ int COM_FOpenFile(const char *filename, FILE **file)
             if (strchr(filename, '/') || strchr(filename, '\\'))
                continue;
          }
-         snprintf(path, sizeof(path), "%s/%s", search->filename, filename);
-         findtime = Sys_FileTime(path);
-         if (findtime == -1)
+         snprintf(path, pathsize, "%s/%s", search->filename, filename);
+         if (Sys_FileTime(path) == -1)
             continue;
 
-         *file = fopen(path, "rb");
-         com_filesize = COM_filelength(*file);
-         return com_filesize;
+         *pakfile = NULL;
+         return search;
       }
    }
 
-   Sys_Printf("FindFile: can't find %s\n", filename);
-   *file = NULL;
-   com_filesize = -1;
+   return NULL;
+}
 
-   return -1;
+/*
+===========
+COM_FOpenFile
+
+Finds the file in the search path.
+Sets com_filesize
+If the requested file is inside a packfile, a new FILE * will be opened
+into the file.
+===========
+*/
+int file_from_pak; // global indicating file came from pack file
+
+static int COM_FOpenFound(const char *filename, searchpath_t *search,
+      packfile_t *pakfile, const char *path, FILE **file)
+{
+   FILE *inflated;
+
+   file_from_pak = 0;
+
+   if (!search)
+   {
+      Sys_Printf("FindFile: can't find %s\n", filename);
+      *file = NULL;
+      com_filesize = -1;
+
+      return -1;
+   }
+
+   if (pakfile)
+   {
+      // open a new file on the pakfile
+      *file = fopen(search->pack->filename, "rb");
+      if (!*file)
+         Sys_Error("Couldn't reopen %s", search->pack->filename);
+      fseek(*file, pakfile->filepos, SEEK_SET);
+      com_filesize = pakfile->filelen;
+      file_from_pak = 1;
+      if (pakfile->deflated)
+      {
+         // the caller wants a file it can seek around in
+         inflated = tmpfile();
+         if (!inflated || !COM_InflatePackFile(search->pack, pakfile, NULL,
+                  inflated))
+            Sys_Error("Couldn't inflate %s from %s", filename,
+                  search->pack->filename);
+         fclose(*file);
+         rewind(inflated);
+         *file = inflated;
+      }
+      return com_filesize;
+   }
+
+   *file = fopen(path, "rb");
+   com_filesize = COM_filelength(*file);
+   return com_filesize;
+}
+
+int COM_FOpenFile(const char *filename, FILE **file)
+{
+   searchpath_t *search;
+   char path[MAX_OSPATH];
+   packfile_t *pakfile;
+
+   search = COM_FindFile(filename, &pakfile, path, sizeof(path));
+   return COM_FOpenFound(filename, search, pakfile, path, file);
 }
 
 /*
@@ -1467,8 +1648,7 @@ qboolean COM_FileExists (const char *filename)
 {
    searchpath_t *search;
    char path[MAX_OSPATH];
-   pack_t *pak;
-   int i;
+   packfile_t *pakfile;
    int findtime;
 
    file_from_pak = 0;
@@ -1479,15 +1659,14 @@ qboolean COM_FileExists (const char *filename)
       // is the element a pak file?
       if (search->pack)
       {
-         // look through all the pak file elements
-         pak = search->pack;
-         for (i = 0; i < pak->numfiles; i++)
-            if (!strcmp(pak->files[i].name, filename))
-            {	// found it!
-               com_filesize = pak->files[i].filelen;
-               file_from_pak = 1;
-               return true;
-            }
+         // look up the name in the pak directory index
+         pakfile = COM_FindPackFile(search->pack, filename);
+         if (pakfile)
+         {	// found it!
+            com_filesize = pakfile->filelen;
+            file_from_pak = 1;
+            return true;
+         }
       } else {
          // check a file in the directory tree
          if (!static_registered)
@@ -1511,80 +1690,298 @@ qboolean COM_FileExists (const char *filename)
    return false;
 }
 
-static void COM_ScanDirDir(struct stree_root *root, struct RDIR *dir, const char *pfx,
-      const char *ext, qboolean stripext)
+/*
+===========
+COM_MapFile
+
+Finds the file in the search path. If the first match lives in a memory
+mapped pak, a pointer straight into the mapping is returned and
+com_filesize is set; no copy is made. The mapping is read-only and
+shared by every later load of the same file, so callers must not modify
+the data. Unlike the COM_Load* functions the data is NOT zero
+terminated. The pointer stays valid until the pak is closed.
+
+Returns NULL when the file is missing or not in a mapped pak, in which
+case the caller should fall back to one of the COM_Load* functions.
+===========
+*/
+const void *COM_MapFile(const char *filename, unsigned long *length)
 {
-   char *fname;
-   int pfx_len = pfx ? strlen(pfx) : 0;
-   int ext_len = ext ? strlen(ext) : 0;
+   searchpath_t *search;
+   char path[MAX_OSPATH];
+   packfile_t *pakfile;
+
+   if (!com_mmap_packs)
+      return NULL;
+
+   for (search = com_searchpaths; search; search = search->next)
+   {
+      if (search->pack)
+      {
+         pakfile = COM_FindPackFile(search->pack, filename);
+         if (!pakfile)
+            continue;
+         if (!search->pack->mapbase || pakfile->deflated)
+            return NULL;
+         if ((size_t)pakfile->filepos + pakfile->filelen > search->pack->mapsize)
+            return NULL;
+
+         com_filesize = pakfile->filelen;
+         file_from_pak = 1;
+         if (length)
+            *length = com_filesize;
+
+         return search->pack->mapbase + pakfile->filepos;
+      }
+
+      // a loose file in a directory overrides the paks below it
+      if (!static_registered && (strchr(filename, '/') || strchr(filename, '\\')))
+         continue;
+      if (snprintf(path, sizeof(path), "%s/%s", search->filename, filename)
+          >= sizeof(path))
+         continue;
+      if (Sys_FileTime(path) != -1)
+         return NULL;
+   }
+
+   return NULL;
+}
+
+#ifdef HAVE_MMAP
+static void COM_MapPackFile(pack_t *pack, FILE *packhandle, int packsize)
+{
+   void *base;
+
+   if (packsize <= 0)
+      return;
+
+   base = mmap(NULL, packsize, PROT_READ, MAP_PRIVATE,
+         fileno(packhandle), 0);
+   if (base == MAP_FAILED)
+   {
+      Con_Printf("Couldn't map %s, reading it normally\n", pack->filename);
+      return;
+   }
+
+   pack->mapbase = (byte *)base;
+   pack->mapsize = packsize;
+}
+
+#ifdef QW_HACK
+static void COM_UnmapPackFile(pack_t *pack)
+{
+   if (pack->mapbase)
+      munmap(pack->mapbase, pack->mapsize);
+   pack->mapbase = NULL;
+   pack->mapsize = 0;
+}
+#endif
+#else
+static void COM_MapPackFile(pack_t *pack, FILE *packhandle, int packsize) { }
+#ifdef QW_HACK
+static void COM_UnmapPackFile(pack_t *pack) { }
+#endif
+#endif
+
+/*
+ * The names found by COM_ScanDir, kept for each directory and extension
+ * until the search path changes, so completing a name only has to look
+ * through the cached list for the prefix instead of going through every
+ * pak and directory again.
+ */
+#define SCAN_CACHE_SIZE 8
+
+typedef struct {
+   char path[MAX_QPATH];
+   char ext[16];
+   qboolean stripext;
+   int generation;	// of the search path it was scanned from, 0 if unused
+   int count;
+   int *offsets;	// into strings, then sorted and without repeats
+   char *strings;
+   int stringsize;
+   int maxcount, maxstrings;
+} scancache_t;
+
+static scancache_t com_scancache[SCAN_CACHE_SIZE];
+static int com_scancachenext;
+static int com_searchgeneration = 1;	// changes with the search path
+
+/*
+ * Called when the search path changes or a file is written into it
+ */
+void COM_FlushScanCache(void)
+{
+   com_searchgeneration++;
+}
+
+static void COM_ScanAdd(scancache_t *cache, const char *name, int len)
+{
+   if (cache->count == cache->maxcount)
+   {
+      cache->maxcount = qmax(cache->maxcount * 2, 256);
+      cache->offsets = realloc(cache->offsets,
+            cache->maxcount * sizeof(cache->offsets[0]));
+   }
+   if (cache->stringsize + len + 1 > cache->maxstrings)
+   {
+      cache->maxstrings = qmax(cache->maxstrings * 2,
+            qmax(cache->stringsize + len + 1, 4096));
+      cache->strings = realloc(cache->strings, cache->maxstrings);
+   }
+   if (!cache->offsets || !cache->strings)
+      Sys_Error("%s: out of memory", __func__);
+
+   cache->offsets[cache->count++] = cache->stringsize;
+   memcpy(cache->strings + cache->stringsize, name, len);
+   cache->strings[cache->stringsize + len] = '\0';
+   cache->stringsize += len + 1;
+}
+
+static void COM_ScanDirDir(scancache_t *cache, struct RDIR *dir)
+{
+   const char *ext = cache->ext[0] ? cache->ext : NULL;
+   int ext_len = strlen(cache->ext);
 
    while (retro_readdir(dir))
    {
-      if ((!pfx || !strncasecmp(retro_dirent_get_name(dir), pfx, pfx_len)) &&
-            (!ext || COM_CheckExtension(retro_dirent_get_name(dir), ext)))
+      const char *name = retro_dirent_get_name(dir);
+
+      if (!ext || COM_CheckExtension(name, ext))
       {
-         int len = strlen(retro_dirent_get_name(dir));
-         if (ext && stripext)
+         int len = strlen(name);
+         if (ext && cache->stripext)
             len -= ext_len;
-         fname = (char*)Z_Malloc(len + 1);
-         if (fname)
-         {
-            strncpy(fname, retro_dirent_get_name(dir), len);
-            fname[len] = '\0';
-            STree_InsertAlloc(root, fname, true);
-            Z_Free(fname);
-         }
+         COM_ScanAdd(cache, name, len);
       }
    }
 }
 
-static void COM_ScanDirPak(struct stree_root *root, pack_t *pak, const char *path,
-      const char *pfx, const char *ext, qboolean stripext)
+static void COM_ScanDirPak(scancache_t *cache, pack_t *pak)
 {
    int i, len;
-   char *fname;
-   int path_len = path ? strlen(path) : 0;
-   int pfx_len  = pfx  ? strlen(pfx) : 0;
-   int ext_len  = ext  ? strlen(ext) : 0;
+   const char *path = cache->path;
+   int path_len = strlen(path);
+   int ext_len  = strlen(cache->ext);
 
-   for (i = 0; i < pak->numfiles; i++)
+   /* Only visit the files whose directory hashes the same as path */
+   i = pak->dirhash[COM_PackHash(path, path_len, true)];
+   for (; i >= 0; i = pak->files[i].dirnext)
    {
-      /* Check the path prefix */
+      /* Check the path prefix, don't match sub-directories */
       char *pak_f = pak->files[i].name;
 
-      if (path && path_len)
+      if (COM_PackDirLength(pak_f) != path_len)
+         continue;
+      if (path_len)
       {
          if (strncasecmp(pak_f, path, path_len))
             continue;
-         if (pak_f[path_len] != '/')
-            continue;
          pak_f += path_len + 1;
       }
 
-      /* Don't match sub-directories */
-      if (strchr(pak_f, '/'))
-         continue;
-
-      /* Check the prefix and extension, if set */
-      if (pfx && pfx_len && strncasecmp(pak_f, pfx, pfx_len))
-         continue;
-      if (ext && ext_len && !COM_CheckExtension(pak_f, ext))
+      /* Check the extension, if set */
+      if (ext_len && !COM_CheckExtension(pak_f, cache->ext))
          continue;
 
       /* Ok, we have a match. Add it */
       len = strlen(pak_f);
-      if (ext && stripext)
+      if (ext_len && cache->stripext)
          len -= ext_len;
-      fname = (char*)Z_Malloc(len + 1);
+      COM_ScanAdd(cache, pak_f, len);
+   }
+}
 
-      if (fname)
+static const char *com_scanstrings;
+
+/*
+ * Case-insensitive, as the string trees are, with the first found first
+ */
+static int COM_ScanCompare(const void *a, const void *b)
+{
+   int oa = *(const int *)a, ob = *(const int *)b;
+   int cmp = strcasecmp(com_scanstrings + oa, com_scanstrings + ob);
+
+   return cmp ? cmp : oa - ob;
+}
+
+static void COM_ScanCache(scancache_t *cache)
+{
+   searchpath_t *search;
+   char fullpath[MAX_OSPATH];
+   struct RDIR *dir;
+   int i, count;
+
+   cache->count = 0;
+   cache->stringsize = 0;
+   for (search = com_searchpaths; search; search = search->next)
+   {
+      if (search->pack)
+         COM_ScanDirPak(cache, search->pack);
+      else
       {
-         strncpy(fname, pak_f, len);
-         fname[len] = '\0';
-         STree_InsertAlloc(root, fname, true);
-         Z_Free(fname);
+         /* a directory with a path this long can't be opened anyway */
+         if (snprintf(fullpath, sizeof(fullpath), "%s/%s", search->filename,
+                  cache->path) >= (int)sizeof(fullpath))
+            continue;
+         dir = retro_opendir(fullpath);
+
+         if (dir)
+         {
+            COM_ScanDirDir(cache, dir);
+            retro_closedir(dir);
+         }
+      }
+   }
+
+   /* sort, keeping the first of any names the same but for case */
+   com_scanstrings = cache->strings;
+   if (cache->count)
+      qsort(cache->offsets, cache->count, sizeof(cache->offsets[0]),
+            COM_ScanCompare);
+   for (i = count = 0; i < cache->count; i++)
+   {
+      if (count && !strcasecmp(cache->strings + cache->offsets[i],
+               cache->strings + cache->offsets[count - 1]))
+         continue;
+      cache->offsets[count++] = cache->offsets[i];
+   }
+   cache->count = count;
+   cache->generation = com_searchgeneration;
+}
+
+static scancache_t *COM_FindScanCache(const char *path, const char *ext,
+      qboolean stripext)
+{
+   scancache_t *cache;
+   int i;
+
+   if (!path)
+      path = "";
+   if (!ext)
+      ext = "";
+   if (strlen(path) >= MAX_QPATH || strlen(ext) >= sizeof(cache->ext))
+      return NULL;
+
+   for (i = 0; i < SCAN_CACHE_SIZE; i++)
+   {
+      cache = &com_scancache[i];
+      if (cache->generation && !strcmp(cache->path, path)
+            && !strcmp(cache->ext, ext) && cache->stripext == stripext)
+      {
+         if (cache->generation != com_searchgeneration)
+            COM_ScanCache(cache);
+         return cache;
       }
    }
+
+   cache = &com_scancache[com_scancachenext++ % SCAN_CACHE_SIZE];
+   strcpy(cache->path, path);
+   strcpy(cache->ext, ext);
+   cache->stripext = stripext;
+   COM_ScanCache(cache);
+
+   return cache;
 }
 
 /*
@@ -1599,27 +1996,279 @@ Caller MUST have already called STree_AllocInit()
 void COM_ScanDir(struct stree_root *root, const char *path, const char *pfx,
       const char *ext, qboolean stripext)
 {
-   searchpath_t *search;
-   char fullpath[MAX_OSPATH];
-   struct RDIR *dir;
+   scancache_t *cache;
+   int pfx_len = pfx ? strlen(pfx) : 0;
+   int lo, hi, mid;
 
-   for (search = com_searchpaths; search; search = search->next)
+   cache = COM_FindScanCache(path, ext, stripext);
+   if (!cache)
+      return;
+
+   /* the names with the prefix are together in the sorted list */
+   lo = 0;
+   hi = cache->count;
+   while (lo < hi)
    {
-      if (search->pack)
-         COM_ScanDirPak(root, search->pack, path, pfx, ext, stripext);
+      mid = (lo + hi) / 2;
+      if (strncasecmp(cache->strings + cache->offsets[mid], pfx ? pfx : "",
+               pfx_len) < 0)
+         lo = mid + 1;
       else
+         hi = mid;
+   }
+   for (; lo < cache->count; lo++)
+   {
+      const char *name = cache->strings + cache->offsets[lo];
+
+      if (pfx_len && strncasecmp(name, pfx, pfx_len))
+         break;
+      STree_InsertAlloc(root, name, true);
+   }
+}
+
+/*
+=============================================================================
+
+PREFETCHING
+
+A batch of files known to be wanted soon, read in on the job threads in
+one go, so the reads overlap instead of each waiting on the last. The
+batch is put in the order the files lie on disk and cut into runs, each
+read front to back by one job. The next COM_LoadFile of each file hands
+over its copy instead of reading it, waiting only for its own run if that
+hasn't finished yet, so the first files can be parsed while the rest are
+still being read; loading anything else doesn't wait.
+
+=============================================================================
+*/
+
+#define PREFETCH_MAXSIZE	(64 * 1024 * 1024)	// read ahead at once
+#define MAX_PREFETCH_JOBS	JOB_MAX_SPLIT(MAX_JOB_THREADS)
+
+typedef struct {
+   char name[MAX_QPATH];
+   char path[MAX_OSPATH];	// the pak, or the file itself
+   long offset;
+   int length;
+   const pack_t *pack;		// and the entry, if it has to be inflated
+   const packfile_t *deflated;
+   qboolean frompak;
+   qboolean taken;		// asked for since
+   int run;			// the job reading it
+   byte *data;			// NULL once handed over or if unreadable
+} prefetch_t;
+
+static prefetch_t *com_prefetch;
+static int com_numprefetch;
+static job_t com_prefetchjobs[MAX_PREFETCH_JOBS];
+static jobgroup_t com_prefetchruns[MAX_PREFETCH_JOBS];
+static int com_numprefetchruns;
+
+static const char *COM_ReadPrefetch(void *data, int start, int end)
+{
+   prefetch_t *file;
+   const char *path = NULL;
+   FILE *f = NULL;
+   long pos = -1;
+   int i;
+
+   for (i = start; i < end; i++)
+   {
+      file = (prefetch_t*)data + i;
+      if (file->deflated)
       {
-         snprintf(fullpath, MAX_OSPATH, "%s/%s", search->filename, path);
-         fullpath[MAX_OSPATH - 1] = '\0';
-         dir = retro_opendir(fullpath);
+         if (COM_InflatePackFile(file->pack, file->deflated, file->data, NULL))
+            file->data[file->length] = 0;
+         else
+         {
+            free(file->data);
+            file->data = NULL;
+         }
+         continue;
+      }
 
-         if (dir)
+      // files next to each other in a pak are read on from the last
+      if (!path || strcmp(path, file->path))
+      {
+         if (f)
+            fclose(f);
+         f = fopen(file->path, "rb");
+         path = file->path;
+         pos = -1;
+      }
+      if (f && (pos == file->offset || fseek(f, file->offset, SEEK_SET) == 0)
+          && fread(file->data, 1, file->length, f) == (size_t)file->length)
+      {
+         file->data[file->length] = 0;
+         pos = file->offset + file->length;
+      }
+      else
+      {
+         free(file->data);
+         file->data = NULL;
+         pos = -1;
+      }
+   }
+   if (f)
+      fclose(f);
+
+   return NULL;
+}
+
+// by file, then by where they are in it
+static int COM_ComparePrefetch(const void *a, const void *b)
+{
+   const prefetch_t *fa = (const prefetch_t*)a, *fb = (const prefetch_t*)b;
+   int cmp = strcmp(fa->path, fb->path);
+
+   if (cmp)
+      return cmp;
+   return fa->offset < fb->offset ? -1 : fa->offset > fb->offset;
+}
+
+/*
+============
+COM_PrefetchFiles
+
+Starts reading in the named files that aren't in a memory mapped pak, as
+many as fit in PREFETCH_MAXSIZE, and returns without waiting. Anything
+read in before and not asked for since is let go.
+============
+*/
+void COM_PrefetchFiles(const char **names, int count)
+{
+   searchpath_t *search;
+   packfile_t *pakfile;
+   prefetch_t *file;
+   FILE *f;
+   int i, j, numjobs, total;
+
+   COM_ClearPrefetch();
+   if (count <= 0)
+      return;
+   com_prefetch = (prefetch_t*)calloc(count, sizeof(*com_prefetch));
+   if (!com_prefetch)
+      return;
+
+   total = 0;
+   for (i = 0; i < count; i++)
+   {
+      file = &com_prefetch[com_numprefetch];
+      memset(file, 0, sizeof(*file));
+      if (snprintf(file->name, sizeof(file->name), "%s", names[i])
+          >= sizeof(file->name))
+         continue;
+      search = COM_FindFile(names[i], &pakfile, file->path, sizeof(file->path));
+      if (!search)
+         continue;
+      if (pakfile)
+      {
+         // COM_MapFile will hand out the mapping without a read
+         if (search->pack->mapbase && !pakfile->deflated
+               && (size_t)pakfile->filepos + pakfile->filelen
+               <= search->pack->mapsize)
+            continue;
+         snprintf(file->path, sizeof(file->path), "%s", search->pack->filename);
+         file->offset = pakfile->filepos;
+         file->length = pakfile->filelen;
+         file->frompak = true;
+         if (pakfile->deflated)
          {
-            COM_ScanDirDir(root, dir, pfx, ext, stripext);
-            retro_closedir(dir);
+            file->pack = search->pack;
+            file->deflated = pakfile;
          }
       }
+      else
+      {
+         f = fopen(file->path, "rb");
+         if (!f)
+            continue;
+         file->length = COM_filelength(f);
+         fclose(f);
+      }
+      if (file->length < 0 || file->length > PREFETCH_MAXSIZE - total)
+         continue;
+      file->data = (byte*)malloc(file->length + 1);
+      if (!file->data)
+         continue;
+      total += file->length;
+      com_numprefetch++;
+   }
+
+   if (com_numprefetch > 1)
+      qsort(com_prefetch, com_numprefetch, sizeof(*com_prefetch),
+            COM_ComparePrefetch);
+   numjobs = Job_Split(com_prefetchjobs, 0, MAX_PREFETCH_JOBS,
+         COM_ReadPrefetch, com_prefetch, com_numprefetch, 1);
+   for (i = 0; i < numjobs; i++)
+   {
+      for (j = com_prefetchjobs[i].start; j < com_prefetchjobs[i].end; j++)
+         com_prefetch[j].run = i;
+      Job_Submit(&com_prefetchjobs[i], 1, &com_prefetchruns[i], NULL);
+   }
+   com_numprefetchruns = numjobs;
+}
+
+void COM_ClearPrefetch(void)
+{
+   int i;
+
+   for (i = 0; i < com_numprefetchruns; i++)
+      Job_Wait(&com_prefetchruns[i]);
+   com_numprefetchruns = 0;
+   for (i = 0; i < com_numprefetch; i++)
+      free(com_prefetch[i].data);
+   free(com_prefetch);
+   com_prefetch = NULL;
+   com_numprefetch = 0;
+}
+
+/*
+============
+COM_Prefetching
+
+True when the file is being or has been prefetched and not asked for yet
+============
+*/
+qboolean COM_Prefetching(const char *name)
+{
+   int i;
+
+   for (i = 0; i < com_numprefetch; i++)
+      if (!com_prefetch[i].taken && !strcmp(com_prefetch[i].name, name))
+         return true;
+
+   return false;
+}
+
+/*
+ * Hands over the file's prefetched copy, for the caller to free
+ */
+static byte *COM_TakePrefetch(const char *path, int *length)
+{
+   prefetch_t *file;
+   byte *data;
+   int i;
+
+   for (i = 0; i < com_numprefetch; i++)
+   {
+      file = &com_prefetch[i];
+      if (strcmp(file->name, path))
+         continue;
+      Job_Wait(&com_prefetchruns[file->run]);
+      file->taken = true;
+      if (!file->data)
+         continue;
+
+      data = file->data;
+      file->data = NULL;
+      *length = file->length;
+      file_from_pak = file->frompak;
+
+      return data;
    }
+
+   return NULL;
 }
 
 /*
@@ -1637,12 +2286,35 @@ static int loadsize;
 
 static void *COM_LoadFile(const char *path, int usehunk, unsigned long *length)
 {
-   FILE *f;
+   FILE *f = NULL;
    char base[32];
+   char found[MAX_OSPATH];
    byte *buf = NULL;			// quiet compiler warning
-   int len = com_filesize = COM_FOpenFile(path, &f);  // look for it in the filesystem or pack files
-   if (!f)
-      return NULL;
+   byte *prefetched;
+   searchpath_t *search = NULL;
+   packfile_t *pakfile = NULL;
+   int len;
+
+   prefetched = COM_TakePrefetch(path, &len);
+   if (prefetched)
+      com_filesize = len;
+   else
+   {
+      // look for it in the filesystem or pack files
+      search = COM_FindFile(path, &pakfile, found, sizeof(found));
+      if (search && pakfile && pakfile->deflated)
+      {
+         // inflated straight into the buffer below
+         len = com_filesize = pakfile->filelen;
+         file_from_pak = 1;
+      }
+      else
+      {
+         len = com_filesize = COM_FOpenFound(path, search, pakfile, found, &f);
+         if (!f)
+            return NULL;
+      }
+   }
 
    if (length)
       *length = len;
@@ -1670,13 +2342,25 @@ static void *COM_LoadFile(const char *path, int usehunk, unsigned long *length)
    if (!buf)
       Sys_Error("%s: not enough space for %s", __func__, path);
 
+   if (prefetched)
+   {
+      memcpy(buf, prefetched, len + 1);
+      free(prefetched);
+      return buf;
+   }
+
    buf[len] = 0;
 
 #ifndef SERVERONLY
    Draw_BeginDisc();
 #endif
-   fread(buf, 1, len, f);
-   fclose(f);
+   if (f)
+   {
+      fread(buf, 1, len, f);
+      fclose(f);
+   }
+   else if (!COM_InflatePackFile(search->pack, pakfile, buf, NULL))
+      Sys_Error("Couldn't inflate %s from %s", path, search->pack->filename);
 #ifndef SERVERONLY
    Draw_EndDisc();
 #endif
@@ -1732,12 +2416,14 @@ static pack_t *COM_LoadPackFile(const char *packfile)
    int numpackfiles;
    pack_t *pack;
    FILE *packhandle;
+   int packsize;
    unsigned short crc;
    dpackfile_t *info = malloc(MAX_FILES_IN_PACK * sizeof(dpackfile_t));
 
    if (!info)
       goto error;
-   if (COM_FileOpenRead(packfile, &packhandle) == -1)
+   packsize = COM_FileOpenRead(packfile, &packhandle);
+   if (packsize == -1)
       goto error;
 
    fread(&header, 1, sizeof(header), packhandle);
@@ -1792,6 +2478,8 @@ static pack_t *COM_LoadPackFile(const char *packfile)
       newfiles[i].filepos = (info[i].filepos);
       newfiles[i].filelen = (info[i].filelen);
 #endif
+      newfiles[i].packedlen = newfiles[i].filelen;
+      newfiles[i].deflated = false;
    }
 
 #ifdef NQ_HACK
@@ -1807,6 +2495,12 @@ static pack_t *COM_LoadPackFile(const char *packfile)
    strcpy(pack->filename, packfile);
    pack->numfiles = numpackfiles;
    pack->files    = newfiles;
+   pack->mapbase  = NULL;
+   pack->mapsize  = 0;
+   COM_HashPackFiles(pack);
+   if (com_mmap_packs)
+      COM_MapPackFile(pack, packhandle, packsize);
+   fclose(packhandle);
 
    free(info);
 
@@ -1820,13 +2514,284 @@ error:
    return NULL;
 }
 
+/*
+ * Zip archives (pk3) are read into the same directory as paks, so they
+ * are searched and mapped just the same. Stored entries are served like a
+ * pak's; deflated ones are inflated as they're read. Only the end record
+ * and the central directory are read when the archive is added, plus the
+ * local headers, which come from the mapping with -mmap.
+ */
+#define ZIP_END_SIZE		22
+#define ZIP_MAX_COMMENT		0xffff
+#define ZIP_CENTRAL_SIZE	46
+#define ZIP_LOCAL_SIZE		30
+#define ZIP_END_MAGIC		0x06054b50
+#define ZIP_CENTRAL_MAGIC	0x02014b50
+#define ZIP_LOCAL_MAGIC		0x04034b50
+#define ZIP_STORED		0
+#define ZIP_DEFLATED		8
+
+static unsigned COM_ZipShort(const byte *p)
+{
+   return p[0] | (p[1] << 8);
+}
+
+static unsigned COM_ZipLong(const byte *p)
+{
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+/*
+ * Reads the central directory, checking the entries are all there. Returns
+ * it, to be freed, with the number of entries, or NULL.
+ */
+static byte *COM_ReadZipDirectory(FILE *f, int size, int *count,
+      unsigned *dirsize)
+{
+   byte *buf, *p, *end;
+   unsigned dirofs;
+   int tail, i;
+
+   // the end record is last, but for a comment of up to 64k
+   tail = qmin(size, ZIP_END_SIZE + ZIP_MAX_COMMENT);
+   if (tail < ZIP_END_SIZE)
+      return NULL;
+   buf = (byte*)malloc(tail);
+   if (!buf || fseek(f, size - tail, SEEK_SET)
+         || fread(buf, 1, tail, f) != (size_t)tail)
+      goto error;
+   for (p = buf + tail - ZIP_END_SIZE; p >= buf; p--)
+      if (COM_ZipLong(p) == ZIP_END_MAGIC)
+         break;
+   if (p < buf)
+      goto error;
+
+   *count = COM_ZipShort(p + 10);
+   *dirsize = COM_ZipLong(p + 12);
+   dirofs = COM_ZipLong(p + 16);
+   free(buf);
+   if (dirofs > (unsigned)size || *dirsize > (unsigned)size - dirofs)
+      return NULL;	// including zip64, which isn't supported
+
+   buf = (byte*)malloc(*dirsize + 1);
+   if (!buf || fseek(f, dirofs, SEEK_SET)
+         || fread(buf, 1, *dirsize, f) != *dirsize)
+      goto error;
+
+   end = buf + *dirsize;
+   for (i = 0, p = buf; i < *count; i++)
+   {
+      if (end - p < ZIP_CENTRAL_SIZE || COM_ZipLong(p) != ZIP_CENTRAL_MAGIC)
+         goto error;
+      p += ZIP_CENTRAL_SIZE + COM_ZipShort(p + 28) + COM_ZipShort(p + 30)
+         + COM_ZipShort(p + 32);
+      if (p > end)
+         goto error;
+   }
+
+   return buf;
+
+error:
+   free(buf);
+   return NULL;
+}
+
+/*
+=================
+COM_LoadZipFile
+
+Takes an explicit path to a pk3 file. Loads its directory, leaving out
+what can't be read: directories, encrypted entries and, without zlib,
+deflated ones.
+=================
+*/
+static pack_t *COM_LoadZipFile(const char *zipfile)
+{
+   FILE *ziphandle;
+   byte *directory, *p;
+   byte localbuf[ZIP_LOCAL_SIZE];
+   const byte *local;
+   packfile_t *newfiles, *file;
+   pack_t *pack;
+   unsigned dirsize, method, namelen;
+   int zipsize, count, numfiles, skipped, i, datapos;
+
+   zipsize = COM_FileOpenRead(zipfile, &ziphandle);
+   if (zipsize == -1)
+      return NULL;
+   directory = COM_ReadZipDirectory(ziphandle, zipsize, &count, &dirsize);
+   if (!directory)
+   {
+      fclose(ziphandle);
+      Con_Printf("%s is not a zip file, or is damaged\n", zipfile);
+      return NULL;
+   }
+   com_modified = true;
+
+#ifdef NQ_HACK
+   newfiles = (packfile_t*)Hunk_AllocName(qmax(count, 1) * sizeof(packfile_t), "packfile");
+#endif
+#ifdef QW_HACK
+   newfiles = Z_Malloc(qmax(count, 1) * sizeof(packfile_t));
+#endif
+
+   numfiles = skipped = 0;
+   for (i = 0, p = directory; i < count; i++)
+   {
+      method = COM_ZipShort(p + 10);
+      namelen = COM_ZipShort(p + 28);
+      file = &newfiles[numfiles];
+      file->filepos = COM_ZipLong(p + 42);	// of the local header, for now
+      file->packedlen = COM_ZipLong(p + 20);
+      file->filelen = COM_ZipLong(p + 24);
+      file->deflated = method == ZIP_DEFLATED;
+
+      if (namelen && p[ZIP_CENTRAL_SIZE + namelen - 1] == '/')
+         ;	// a directory
+      else if (!namelen || namelen >= MAX_QPATH || (COM_ZipShort(p + 8) & 1)
+            || file->filepos < 0 || file->packedlen < 0 || file->filelen < 0)
+         skipped++;
+#ifdef HAVE_ZLIB
+      else if (method != ZIP_STORED && method != ZIP_DEFLATED)
+#else
+      else if (method != ZIP_STORED)
+#endif
+         skipped++;
+      else if (method == ZIP_STORED && file->packedlen != file->filelen)
+         skipped++;
+      else
+      {
+         memcpy(file->name, p + ZIP_CENTRAL_SIZE, namelen);
+         file->name[namelen] = 0;
+         numfiles++;
+      }
+      p += ZIP_CENTRAL_SIZE + namelen + COM_ZipShort(p + 30)
+         + COM_ZipShort(p + 32);
+   }
+   free(directory);
+
+#ifdef NQ_HACK
+   pack = (pack_t*)Hunk_Alloc(sizeof(pack_t));
+#endif
+#ifdef QW_HACK
+   pack = Z_Malloc(sizeof(pack_t));
+#endif
+
+   strcpy(pack->filename, zipfile);
+   pack->files    = newfiles;
+   pack->mapbase  = NULL;
+   pack->mapsize  = 0;
+   if (com_mmap_packs)
+      COM_MapPackFile(pack, ziphandle, zipsize);
+
+   // find where each entry's data starts, after its local header
+   count = numfiles;
+   for (i = numfiles = 0; i < count; i++)
+   {
+      file = &newfiles[i];
+      if (file->filepos > zipsize - ZIP_LOCAL_SIZE)
+         local = NULL;
+      else if (pack->mapbase)
+         local = pack->mapbase + file->filepos;
+      else if (!fseek(ziphandle, file->filepos, SEEK_SET)
+            && fread(localbuf, 1, ZIP_LOCAL_SIZE, ziphandle) == ZIP_LOCAL_SIZE)
+         local = localbuf;
+      else
+         local = NULL;
+
+      if (local && COM_ZipLong(local) == ZIP_LOCAL_MAGIC)
+      {
+         datapos = file->filepos + ZIP_LOCAL_SIZE + COM_ZipShort(local + 26)
+            + COM_ZipShort(local + 28);
+         if (file->packedlen <= zipsize - datapos)
+         {
+            file->filepos = datapos;
+            newfiles[numfiles++] = *file;
+            continue;
+         }
+      }
+      skipped++;
+   }
+   fclose(ziphandle);
+
+   pack->numfiles = numfiles;
+   COM_HashPackFiles(pack);
+
+   if (skipped)
+      Con_Printf("%s: left out %i files that can't be read\n", zipfile,
+            skipped);
+   Con_Printf("Added packfile %s (%i files)\n", zipfile, numfiles);
+   Sys_Printf("Added packfile %s (%i files)\n", zipfile, numfiles);
+   return pack;
+}
+
+static int COM_CompareNames(const void *a, const void *b)
+{
+   return strcasecmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/*
+ * Adds the game directory's pk3 files in alphabetical order, each coming
+ * before the ones before it in the search path, as the paks do.
+ */
+static void COM_AddZipFiles(qboolean zone)
+{
+   searchpath_t *search;
+   struct RDIR *dir;
+   char **names = NULL;
+   char zipfile[MAX_OSPATH];
+   const char *name;
+   pack_t *pak;
+   int i, count = 0, maxcount = 0;
+
+   dir = retro_opendir(com_gamedir);
+   if (!dir)
+      return;
+   while (retro_readdir(dir))
+   {
+      name = retro_dirent_get_name(dir);
+      if (!COM_CheckExtension(name, ".pk3"))
+         continue;
+      if (count == maxcount)
+      {
+         maxcount = qmax(maxcount * 2, 16);
+         names = realloc(names, maxcount * sizeof(names[0]));
+         if (!names)
+            Sys_Error("%s: out of memory", __func__);
+      }
+      names[count] = strdup(name);
+      if (!names[count])
+         Sys_Error("%s: out of memory", __func__);
+      count++;
+   }
+   retro_closedir(dir);
+
+   if (count)
+      qsort(names, count, sizeof(names[0]), COM_CompareNames);
+   for (i = 0; i < count; i++)
+   {
+      snprintf(zipfile, sizeof(zipfile), "%s/%s", com_gamedir, names[i]);
+      free(names[i]);
+      pak = COM_LoadZipFile(zipfile);
+      if (!pak)
+         continue;
+      if (zone)
+         search = Z_Malloc(sizeof(searchpath_t));
+      else
+         search = (searchpath_t*)Hunk_Alloc(sizeof(searchpath_t));
+      search->pack = pak;
+      search->next = com_searchpaths;
+      com_searchpaths = search;
+   }
+   free(names);
+}
 
 /*
 ================
 COM_AddGameDirectory
 
 Sets com_gamedir, adds the directory to the head of the path,
-then loads and adds pak1.pak pak2.pak ...
+then loads and adds pak1.pak pak2.pak ... and any pk3 files
 ================
 */
 static void COM_AddGameDirectory(const char *base, const char *dir)
@@ -1885,6 +2850,8 @@ static void COM_AddGameDirectory(const char *base, const char *dir)
       search->next = com_searchpaths;
       com_searchpaths = search;
    }
+   COM_AddZipFiles(false);
+   COM_FlushScanCache();
 }
 
 /*
@@ -1920,11 +2887,15 @@ void COM_Gamedir(const char *dir)
       return;			// still the same
    strcpy(gamedirfile, dir);
 
+   // the prefetch jobs may be reading from the paks
+   COM_ClearPrefetch();
+
    // free up any current game dir info
    while (com_searchpaths != com_base_searchpaths)
    {
       if (com_searchpaths->pack)
       {
+         COM_UnmapPackFile(com_searchpaths->pack);
          Z_Free(com_searchpaths->pack->files);
          Z_Free(com_searchpaths->pack);
       }
@@ -1932,6 +2903,7 @@ void COM_Gamedir(const char *dir)
       Z_Free(com_searchpaths);
       com_searchpaths = next;
    }
+   COM_FlushScanCache();
 
    // flush all data, so it will be forced to reload
    Cache_Flush();
@@ -1959,6 +2931,8 @@ void COM_Gamedir(const char *dir)
       search->next = com_searchpaths;
       com_searchpaths = search;
    }
+   COM_AddZipFiles(true);
+   COM_FlushScanCache();
 }
 #endif
 
@@ -1977,6 +2951,13 @@ static void COM_InitFilesystem(void)
 
    // Set save directory
    strcpy(com_savedir, host_parms.savedir);
+
+   // -mmap
+   // Map pak files into memory instead of reading from them on demand.
+   // Big endian loaders swap the lumps in place, so they always get a copy.
+#if defined(HAVE_MMAP) && !defined(MSB_FIRST)
+   com_mmap_packs = COM_CheckParm("-mmap") ? true : false;
+#endif
    
    // -basedir <path>
    // Overrides the system supplied base directory (under id1)
@@ -2041,6 +3022,7 @@ static void COM_InitFilesystem(void)
          search->next = com_searchpaths;
          com_searchpaths = search;
       }
+      COM_FlushScanCache();
    }
 #endif
 #ifdef QW_HACK
@@ -2311,6 +3293,85 @@ void Info_SetValueForKey(char *infostring, const char *key, const char *value,
    Info_SetValueForStarKey(infostring, key, value, maxsize);
 }
 
+static int Info_FindKey(const infokeys_t *keys, const char *key, unsigned hash)
+{
+   int i;
+
+   for (i = keys->chains[hash & (sizeof(keys->chains) - 1)] - 1; i >= 0;
+         i = keys->next[i] - 1)
+   {
+      if (!strcmp(keys->text + keys->keys[i], key))
+         return i;
+   }
+
+   return -1;
+}
+
+/*
+===============
+Info_Parse
+
+Reads the pairs the way Info_ValueForKey would find them, so the first
+of repeated keys is the one kept
+===============
+*/
+void Info_Parse(infokeys_t *keys, const char *infostring)
+{
+   char *text = keys->text;
+   char *end = keys->text + sizeof(keys->text);
+   unsigned hash;
+   int key;
+
+   keys->numkeys = 0;
+   memset(keys->chains, 0, sizeof(keys->chains));
+
+   while (keys->numkeys < MAX_INFO_KEYS && end - text > 2)
+   {
+      key = text - keys->text;
+      infostring = Info_ReadKey(infostring, text, end - text);
+      if (*infostring != '\\')
+         break;
+      infostring++;
+      text += strlen(text) + 1;
+
+      infostring = Info_ReadString(infostring, text, end - text);
+      if (*infostring && *infostring != '\\')
+         break;
+      text += strlen(text) + 1;
+
+      hash = NameHash_String(keys->text + key);
+      if (Info_FindKey(keys, keys->text + key, hash) < 0)
+      {
+         keys->keys[keys->numkeys] = key;
+         keys->next[keys->numkeys] = keys->chains[hash & (sizeof(keys->chains) - 1)];
+         keys->chains[hash & (sizeof(keys->chains) - 1)] = ++keys->numkeys;
+      }
+
+      if (!*infostring)
+         break;
+      infostring++;
+   }
+}
+
+/*
+===============
+Info_Get
+
+The value of the key, or an empty string
+===============
+*/
+const char *Info_Get(const infokeys_t *keys, const char *key)
+{
+   int i = Info_FindKey(keys, key, NameHash_String(key));
+   const char *s;
+
+   if (i < 0)
+      return "";
+   s = keys->text + keys->keys[i];
+
+   return s + strlen(s) + 1;
+}
+
 void Info_Print(const char *infostring)
 {
    char key[MAX_INFO_STRING];
@@ -22,8 +22,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "qtypes.h"
 #include "shell.h"
@@ -96,14 +98,90 @@ void InsertLinkAfter(link_t *l, link_t *after);
 
 //============================================================================
 
-extern qboolean bigendien;
+/*
+ * The byte order is known when building (MSB_FIRST for big endian ones),
+ * so the conversions that do nothing inline away to nothing.
+ */
+#ifdef MSB_FIRST
+#define bigendien true
+#else
+#define bigendien false
+#endif
+
+static inline short
+ShortSwap(short l)
+{
+    return ((l & 255) << 8) | ((l >> 8) & 255);
+}
+
+static inline int
+LongSwap(int l)
+{
+    return ((unsigned)l << 24) | ((l & 0xff00) << 8) | ((l >> 8) & 0xff00)
+	| ((unsigned)l >> 24);
+}
+
+static inline float
+FloatSwap(float f)
+{
+    union {
+	float f;
+	int l;
+    } dat;
+
+    dat.f = f;
+    dat.l = LongSwap(dat.l);
+    return dat.f;
+}
+
+#ifdef MSB_FIRST
+static inline short BigShort(short l) { return l; }
+static inline short LittleShort(short l) { return ShortSwap(l); }
+static inline int BigLong(int l) { return l; }
+static inline int LittleLong(int l) { return LongSwap(l); }
+static inline float BigFloat(float l) { return l; }
+static inline float LittleFloat(float l) { return FloatSwap(l); }
+#else
+static inline short BigShort(short l) { return ShortSwap(l); }
+static inline short LittleShort(short l) { return l; }
+static inline int BigLong(int l) { return LongSwap(l); }
+static inline int LittleLong(int l) { return l; }
+static inline float BigFloat(float l) { return FloatSwap(l); }
+static inline float LittleFloat(float l) { return l; }
+#endif
+
+/*
+ * Whole arrays of little endian shorts or longs (or floats, as longs) to
+ * host order; out may be in. Just a copy where there's nothing to swap,
+ * and a plain loop the compiler can vectorise where there is.
+ */
+static inline void
+COM_LittleShorts(short *out, const short *in, int count)
+{
+#ifdef MSB_FIRST
+    int i;
+
+    for (i = 0; i < count; i++)
+	out[i] = ShortSwap(in[i]);
+#else
+    if (out != in)
+	memcpy(out, in, count * sizeof(*out));
+#endif
+}
 
-extern short (*BigShort) (short l);
-extern short (*LittleShort) (short l);
-extern int (*BigLong) (int l);
-extern int (*LittleLong) (int l);
-extern float (*BigFloat) (float l);
-extern float (*LittleFloat) (float l);
+static inline void
+COM_LittleLongs(int *out, const int *in, int count)
+{
+#ifdef MSB_FIRST
+    int i;
+
+    for (i = 0; i < count; i++)
+	out[i] = LongSwap(in[i]);
+#else
+    if (out != in)
+	memcpy(out, in, count * sizeof(*out));
+#endif
+}
 
 //============================================================================
 
@@ -130,6 +208,54 @@ void MSG_WriteDeltaUsercmd(sizebuf_t *sb, const struct usercmd_s *from,
 void MSG_WriteControlHeader(sizebuf_t *sb);
 #endif
 
+/*
+ * For records with a known most they can take, reserve that much once and
+ * write the fields through the returned cursor, then commit the cursor to
+ * keep what was written:
+ *
+ *	p = SZ_Reserve(msg, 1 + 2 * 3);
+ *	p = MSG_PutByte(p, bits);
+ *	...
+ *	SZ_Commit(msg, p);
+ *
+ * The reserve overflows the buffer as SZ_Write would have; nothing else
+ * may be written to it before the commit.
+ */
+byte *SZ_Reserve(sizebuf_t *buf, int maxlength);
+
+static inline void
+SZ_Commit(sizebuf_t *buf, byte *cursor)
+{
+    buf->cursize = cursor - buf->data;
+}
+
+static inline byte *
+MSG_PutByte(byte *p, int c)
+{
+    *p++ = c;
+    return p;
+}
+
+static inline byte *
+MSG_PutShort(byte *p, int c)
+{
+    *p++ = c & 0xff;
+    *p++ = c >> 8;
+    return p;
+}
+
+static inline byte *
+MSG_PutCoord(byte *p, float f)
+{
+    return MSG_PutShort(p, (int)(f * (1 << 3)));
+}
+
+static inline byte *
+MSG_PutAngle(byte *p, float f)
+{
+    return MSG_PutByte(p, (int)floorf((f * 256 / 360) + 0.5f) & 255);
+}
+
 extern int msg_readcount;
 extern qboolean msg_badread;	// set if a read goes beyond end of message
 
@@ -157,6 +283,80 @@ void MSG_ReadDeltaUsercmd(const struct usercmd_s *from, struct usercmd_s *cmd);
 int MSG_ReadControlHeader(void);
 #endif
 
+/*
+ * A reader of its own for parsing records of a known length: check the
+ * whole record is there once with MSG_Need, then take its fields without
+ * further checks. Nothing is shared, so it can read any buffer on any
+ * thread; MSG_BeginReader and MSG_EndReader take over and hand back
+ * where MSG_Read* have got to in net_message.
+ *
+ *	if (!MSG_Need(&msg, 1 + 2 * 3))
+ *	    return;
+ *	bits = MSG_TakeByte(&msg);
+ *	...
+ */
+typedef struct {
+    const byte *data;
+    int cursize;
+    int readcount;
+    qboolean badread;	// set when a record wasn't all there
+} msgreader_t;
+
+void MSG_BeginReader(msgreader_t *msg);
+void MSG_EndReader(const msgreader_t *msg);
+
+static inline void
+MSG_InitReader(msgreader_t *msg, const sizebuf_t *buf)
+{
+    msg->data = buf->data;
+    msg->cursize = buf->cursize;
+    msg->readcount = 0;
+    msg->badread = false;
+}
+
+static inline qboolean
+MSG_Need(msgreader_t *msg, int length)
+{
+    if (msg->readcount + length > msg->cursize) {
+	msg->badread = true;
+	return false;
+    }
+    return true;
+}
+
+static inline int
+MSG_TakeByte(msgreader_t *msg)
+{
+    return msg->data[msg->readcount++];
+}
+
+static inline int
+MSG_TakeChar(msgreader_t *msg)
+{
+    return (signed char)msg->data[msg->readcount++];
+}
+
+static inline int
+MSG_TakeShort(msgreader_t *msg)
+{
+    const byte *p = msg->data + msg->readcount;
+
+    msg->readcount += 2;
+    return (short)(p[0] + (p[1] << 8));
+}
+
+static inline float
+MSG_TakeCoord(msgreader_t *msg)
+{
+    return MSG_TakeShort(msg) * (1.0 / (1 << 3));
+}
+
+static inline float
+MSG_TakeAngle(msgreader_t *msg)
+{
+    return MSG_TakeChar(msg) * (360.0 / 256);
+}
+
 //============================================================================
 
 int Q_atoi(const char *str);
@@ -204,16 +404,21 @@ extern int file_from_pak; // global indicating that file came from a pak
 
 void COM_WriteFile(const char *filename, const void *data, int len);
 int COM_FOpenFile(const char *filename, FILE **file);
+const void *COM_MapFile(const char *filename, unsigned long *length);
 void COM_ScanDir(struct stree_root *root, const char *path,
 		 const char *pfx, const char *ext, qboolean stripext);
+void COM_FlushScanCache(void);
 
 void *COM_LoadStackFile(const char *path, void *buffer, int bufsize,
 			unsigned long *length);
 void *COM_LoadTempFile(const char *path);
 void *COM_LoadHunkFile(const char *path);
 void COM_LoadCacheFile(const char *path, struct cache_user_s *cu);
-#ifdef QW_HACK
+void COM_PrefetchFiles(const char **names, int count);
+void COM_ClearPrefetch(void);
+qboolean COM_Prefetching(const char *name);
 void COM_CreatePath(const char *path);
+#ifdef QW_HACK
 void COM_Gamedir(const char *dir);
 #endif
 
@@ -230,6 +435,23 @@ void Info_SetValueForStarKey(char *infostring, const char *key,
 			     const char *value, int maxsize);
 void Info_Print(const char *infostring);
 
+/*
+ * An infostring taken apart once so keys are found by hash; the string
+ * stays what's sent and saved, parse it again whenever it's changed.
+ * All zeroes is an empty one.
+ */
+#define MAX_INFO_KEYS 64
+typedef struct {
+    int numkeys;
+    short keys[MAX_INFO_KEYS];	/* key offsets in text, the value follows */
+    byte next[MAX_INFO_KEYS];	/* 1 + the next key on the chain, or 0 */
+    byte chains[32];		/* 1 + the first key on the chain, or 0 */
+    char text[MAX_SERVERINFO_STRING + 1];
+} infokeys_t;
+
+void Info_Parse(infokeys_t *keys, const char *infostring);
+const char *Info_Get(const infokeys_t *keys, const char *key);
+
 unsigned Com_BlockChecksum(const void *buffer, int length);
 void Com_BlockFullChecksum(const void *buffer, int len,
 			   unsigned char outbuf[16]);
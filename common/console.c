@@ -21,12 +21,18 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include <string.h>
 
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif
+
 #include "client.h"
 #include "cmd.h"
 #include "console.h"
 #include "draw.h"
+#include "jobs.h"
 #include "keys.h"
 #include "quakedef.h"
+#include "r_shared.h"
 #include "screen.h"
 #include "sys.h"
 #include "zone.h"
@@ -36,20 +42,38 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "sound.h"
 #endif
 
-#define CON_TEXTSIZE 16384
+#define CON_TEXTSIZE	65536	// power of two
+#define CON_LINES	4096	// power of two
+#define CON_MAXLINE	1024	// longer lines carry on in the next
 #define	NUM_CON_TIMES 4
 
+#define CON_CHAR(offset) (con->text[(offset) & (CON_TEXTSIZE - 1)])
+#define CON_LINE(line) (&con->lines[(line) & (CON_LINES - 1)])
+
 console_t *con;			// point to current console
 static console_t con_main;
 
 int con_ormask = 0;
 qboolean con_forcedup;
-int con_totallines;		// total lines in console scrollback
 int con_notifylines;		// scan lines to clear for notify lines
 
 static int con_linewidth;	// characters across screen
+
+#ifdef HAVE_THREADS
+static pthread_t con_mainthread;
+#endif
 static int con_vislines;
 
+/*
+ * What a thread prints while it defers its prints is kept here until the
+ * main thread flushes it. Only one thread may defer at a time.
+ */
+static THREAD_LOCAL qboolean con_defer;
+static char con_deferred[MAX_PRINTMSG * 8];
+static int con_deferredlen;
+
+static void Con_PrintMessage(const char *msg);
+
 int
 Con_GetWidth(void)
 {
@@ -59,8 +83,10 @@ Con_GetWidth(void)
 static float con_cursorspeed = 4;
 static cvar_t con_notifytime = { "con_notifytime", "3" };	//seconds
 
-static float con_times[NUM_CON_TIMES];	// realtime time the line was generated
-					// for transparent notify lines
+static qboolean con_newline = true;	// start a line before the next character
+static qboolean con_cr;			// and start it over the current one
+
+static int con_rowstarts[CON_MAXLINE + 1];
 
 static qboolean debuglog;
 
@@ -95,7 +121,12 @@ Con_Clear_f
 void
 Con_Clear_f(void)
 {
-    memset(con_main.text, ' ', CON_TEXTSIZE);
+    conline_t *line = CON_LINE(con_main.current);
+
+    line->start = con_main.head;
+    line->length = 0;
+    con_main.first = con_main.current;
+    con_main.backscroll = false;
 }
 
 
@@ -110,7 +141,7 @@ Con_ClearNotify(void)
     int i;
 
     for (i = 0; i < NUM_CON_TIMES; i++)
-	con_times[i] = 0;
+	CON_LINE(con->current - i)->time = 0;
 }
 
 
@@ -140,75 +171,120 @@ Con_MessageMode2_f(void)
 
 /*
 ================
-Con_Resize
+Con_CheckResize
 
+Lines are wrapped as they're drawn, so only the width needs to change
 ================
 */
-static void Con_Resize(console_t * c)
+void
+Con_CheckResize(void)
 {
-   int width;
-   char tbuf[CON_TEXTSIZE];
-
-   width = (vid.width >> 3) - 2;
+    int width;
 
-   if (width == con_linewidth)
-      return;
-
-   if (width < 1)		// video hasn't been initialized yet
-   {
-      width = 38;
-      con_linewidth = width;
-      con_totallines = CON_TEXTSIZE / con_linewidth;
-      memset(c->text, ' ', CON_TEXTSIZE);
-   }
-   else
-   {
-      int i, j, numlines, numchars;
-      int oldwidth = con_linewidth;
-      int oldtotallines = con_totallines;
+    width = (vid.width >> 3) - 2;
+    if (width < 1)		// video hasn't been initialized yet
+	width = 38;
+    if (width == con_linewidth)
+	return;
 
-      con_linewidth  = width;
-      con_totallines = CON_TEXTSIZE / con_linewidth;
-      numlines = oldtotallines;
+    con_linewidth = width;
+    Con_ClearNotify();
+}
 
-      if (con_totallines < numlines)
-         numlines = con_totallines;
+/*
+ * Whether a line is still in the scrollback
+ */
+static qboolean
+Con_LineValid(int line)
+{
+    if (line < con->first || line > con->current
+	|| line <= con->current - CON_LINES)
+	return false;
 
-      numchars = oldwidth;
+    return con->head - CON_LINE(line)->start <= CON_TEXTSIZE;
+}
 
-      if (con_linewidth < numchars)
-         numchars = con_linewidth;
+static int
+Con_OldestLine(void)
+{
+    int line;
 
-      memcpy(tbuf, c->text, CON_TEXTSIZE);
-      memset(c->text, ' ', CON_TEXTSIZE);
+    line = qmax(con->first, con->current - CON_LINES + 1);
+    while (line < con->current && !Con_LineValid(line))
+	line++;
 
-      for (i = 0; i < numlines; i++)
-      {
-         for (j = 0; j < numchars; j++)
-         {
-            c->text[(con_totallines - 1 - i) * con_linewidth + j] =
-               tbuf[((c->current - i + oldtotallines) %
-                     oldtotallines) * oldwidth + j];
-         }
-      }
-      Con_ClearNotify();
-   }
+    return line;
+}
 
-   c->current = con_totallines - 1;
-   c->display = c->current;
+static qboolean
+Con_WordBreak(int c)
+{
+    return (c & 0x7f) <= ' ';
 }
 
 /*
 ================
-Con_CheckResize
+Con_WrapLine
 
-If the line width has changed, reformat the buffer.
+Wraps a line to the console width the way it would have been as it was
+printed. Fills in the offset in the line each row starts at, for as many
+as rowstarts has room for, and returns the number of rows (at least one).
 ================
 */
-void
-Con_CheckResize(void)
+static int
+Con_WrapLine(int num, int *rowstarts, int maxrows)
+{
+    const conline_t *line = CON_LINE(num);
+    int rows, x, i, wordend;
+
+    if (maxrows > 0)
+	rowstarts[0] = 0;
+    rows = 1;
+    x = 0;
+    wordend = 0;
+    for (i = 0; i < line->length; i++) {
+	// word wrap, on what's left of the word
+	if (i >= wordend) {
+	    for (wordend = i; wordend < line->length; wordend++)
+		if (Con_WordBreak(CON_CHAR(line->start + wordend)))
+		    break;
+	}
+	if (x && wordend - i < con_linewidth && x + wordend - i > con_linewidth) {
+	    if (rows < maxrows)
+		rowstarts[rows] = i;
+	    rows++;
+	    x = 0;
+	}
+
+	if (++x >= con_linewidth && i + 1 < line->length) {
+	    if (rows < maxrows)
+		rowstarts[rows] = i + 1;
+	    rows++;
+	    x = 0;
+	}
+    }
+
+    return rows;
+}
+
+static int
+Con_LineRows(int line)
 {
-    Con_Resize(&con_main);
+    return Con_WrapLine(line, NULL, 0);
+}
+
+/*
+ * Wraps a line into con_rowstarts, with the end of the last row after them
+ */
+static int
+Con_WrapRows(int line)
+{
+    int rows;
+
+    rows = Con_WrapLine(line, con_rowstarts, CON_MAXLINE);
+    con_rowstarts[rows] = CON_LINE(line)->length;
+
+    return rows;
 }
 
 /*
@@ -216,15 +292,28 @@ Con_CheckResize(void)
 Con_Linefeed
 ===============
 */
-void
+static void
 Con_Linefeed(void)
 {
-    con->x = 0;
-    if (con->display == con->current)
-	con->display++;
-    con->current++;
-    memset(&con->text[(con->current % con_totallines) * con_linewidth]
-	   , ' ', con_linewidth);
+    conline_t *line;
+    int rows, keep;
+
+    if (con_cr) {
+	// only the last row is printed over
+	rows = Con_WrapRows(con->current);
+	keep = con_rowstarts[rows - 1];
+	if (keep) {
+	    CON_LINE(con->current)->length = keep;
+	    con->current++;
+	}
+	con_cr = false;
+    } else
+	con->current++;
+
+    line = CON_LINE(con->current);
+    line->start = con->head;
+    line->length = 0;
+    line->time = realtime;	// mark time for transparent overlay
 }
 
 /*
@@ -239,9 +328,7 @@ If no console is visible, the notify window will pop up.
 void
 Con_Print(const char *txt)
 {
-    int y;
-    int c, l;
-    static int cr;
+    int c;
     int mask;
 
     if (txt[0] == 1 || txt[0] == 2) {
@@ -254,52 +341,147 @@ Con_Print(const char *txt)
     } else
 	mask = 0;
 
-    while ((c = *txt)) {
-	// count word length
-	for (l = 0; l < con_linewidth; l++)
-	    if (txt[l] <= ' ')
-		break;
-
-	// word wrap
-	if (l != con_linewidth && (con->x + l > con_linewidth))
-	    con->x = 0;
-
-	txt++;
-
-	if (cr) {
-	    con->current--;
-	    cr = false;
-	}
-
-
-	if (!con->x) {
+    while ((c = *txt++)) {
+	if (con_newline) {
 	    Con_Linefeed();
-	    // mark time for transparent overlay
-	    if (con->current >= 0)
-		con_times[con->current % NUM_CON_TIMES] = realtime;
+	    con_newline = false;
 	}
 
 	switch (c) {
 	case '\n':
-	    con->x = 0;
+	    con_newline = true;
 	    break;
 
 	case '\r':
-	    con->x = 0;
-	    cr = 1;
+	    con_newline = true;
+	    con_cr = true;
 	    break;
 
 	default:		// display character and advance
-	    y = con->current % con_totallines;
-	    con->text[y * con_linewidth + con->x] = c | mask | con_ormask;
-	    con->x++;
-	    if (con->x >= con_linewidth)
-		con->x = 0;
+	    if (CON_LINE(con->current)->length == CON_MAXLINE)
+		Con_Linefeed();
+	    CON_CHAR(con->head++) = c | mask | con_ormask;
+	    CON_LINE(con->current)->length++;
 	    break;
 	}
     }
 }
 
+/*
+================
+Con_Scroll
+
+Moves the bottom of the console up by a number of rows, or down if
+negative. Reaching the last row follows the output again.
+================
+*/
+void
+Con_Scroll(int rows)
+{
+    int line, row, numrows;
+
+    if (!con->backscroll || !Con_LineValid(con->display)) {
+	con->display = con->backscroll ? Con_OldestLine() : con->current;
+	con->displayrow = con->backscroll ? 0 : Con_LineRows(con->display) - 1;
+    }
+
+    line = con->display;
+    numrows = Con_LineRows(line);
+    row = qmin(con->displayrow, numrows - 1);
+    for (; rows > 0; rows--) {
+	if (row) {
+	    row--;
+	} else if (Con_LineValid(line - 1)) {
+	    line--;
+	    numrows = Con_LineRows(line);
+	    row = numrows - 1;
+	} else
+	    break;
+    }
+    for (; rows < 0; rows++) {
+	if (row < numrows - 1) {
+	    row++;
+	} else if (line < con->current) {
+	    line++;
+	    numrows = Con_LineRows(line);
+	    row = 0;
+	} else
+	    break;
+    }
+
+    con->display = line;
+    con->displayrow = row;
+    con->backscroll = line != con->current || row < numrows - 1;
+}
+
+void
+Con_ScrollHome(void)
+{
+    con->display = Con_OldestLine();
+    con->displayrow = 0;
+    con->backscroll = true;
+    Con_Scroll(-9);
+}
+
+void
+Con_ScrollEnd(void)
+{
+    con->backscroll = false;
+}
+
+/*
+================
+Con_Dump_f
+
+Writes the scrollback out to a text file
+================
+*/
+static void
+Con_Dump_f(void)
+{
+    char name[MAX_OSPATH];
+    const conline_t *line;
+    int i, j, c;
+    FILE *f;
+
+    if (Cmd_Argc() != 2) {
+	Con_Printf("condump <filename> : write out the console scrollback\n");
+	return;
+    }
+    if (strstr(Cmd_Argv(1), "..")) {
+	Con_Printf("Relative pathnames are not allowed.\n");
+	return;
+    }
+    if (snprintf(name, sizeof(name) - 4, "%s/%s", com_savedir,
+		 Cmd_Argv(1)) >= sizeof(name) - 4) {
+	Con_Printf("Filename too long.\n");
+	return;
+    }
+    COM_DefaultExtension(name, ".txt");
+    f = fopen(name, "w");
+    if (!f) {
+	Con_Printf("ERROR: couldn't open %s.\n", name);
+	return;
+    }
+
+    for (i = Con_OldestLine(); i <= con->current; i++) {
+	line = CON_LINE(i);
+	for (j = 0; j < line->length; j++) {
+	    c = CON_CHAR(line->start + j) & 0x7f;
+	    if (c >= 0x12 && c <= 0x1b)
+		c += '0' - 0x12;	// the numbers
+	    else if (c == 0x10 || c == 0x11)
+		c = c == 0x10 ? '[' : ']';
+	    else if (c < ' ')
+		c = '.';
+	    fputc(c, f);
+	}
+	fputc('\n', f);
+    }
+    fclose(f);
+    Con_Printf("Dumped console text to %s.\n", name);
+}
+
 
 /*
 ================
@@ -312,6 +494,7 @@ void Con_Printf(const char *fmt, ...)
 {
    va_list argptr;
    char msg[MAX_PRINTMSG];
+   int len;
 
    va_start(argptr, fmt);
    vsnprintf(msg, sizeof(msg), fmt, argptr);
@@ -320,6 +503,60 @@ void Con_Printf(const char *fmt, ...)
    /* also echo to debugging console */
    Sys_Printf("%s", msg);	// also echo to debugging console
 
+   if (con_defer)
+   {
+      len = strlen(msg);
+      if (con_deferredlen + len < sizeof(con_deferred))
+      {
+         memcpy(con_deferred + con_deferredlen, msg, len);
+         con_deferredlen += len;
+      }
+      return;
+   }
+
+#ifdef HAVE_THREADS
+   /* codec errors from the music decoder thread stop here */
+   if (con_initialized && !pthread_equal(pthread_self(), con_mainthread))
+      return;
+#endif
+
+   Con_PrintMessage(msg);
+}
+
+/*
+================
+Con_DeferPrints
+
+Keeps what this thread prints from the console until Con_FlushDeferred
+================
+*/
+void
+Con_DeferPrints(qboolean defer)
+{
+   con_defer = defer;
+}
+
+/*
+================
+Con_FlushDeferred
+
+Prints what was deferred, from the main thread
+================
+*/
+void
+Con_FlushDeferred(void)
+{
+   if (!con_deferredlen)
+      return;
+
+   con_deferred[con_deferredlen] = 0;
+   con_deferredlen = 0;
+   Con_PrintMessage(con_deferred);
+}
+
+static void
+Con_PrintMessage(const char *msg)
+{
    /* log all messages to file */
    if (debuglog)
       Sys_DebugLog(va("%s/qconsole.log", com_savedir), "%s", msg);
@@ -443,6 +680,52 @@ Con_DrawInput(void)
 }
 
 
+/*
+ * The notify lines as a grid of characters, -1 where there's nothing. The
+ * characters are only drawn into the overlay again when the grid changes,
+ * each frame just puts the overlay over the view.
+ */
+#define NOTIFY_ROWS	(NUM_CON_TIMES + 1)	// with the chat prompt
+#define NOTIFY_COLUMNS	(MAXWIDTH >> 3)
+
+static short con_notifygrid[NOTIFY_ROWS][NOTIFY_COLUMNS];
+static short con_notifydrawn[NOTIFY_ROWS][NOTIFY_COLUMNS];
+static int con_notifydrawnrows;
+static int con_notifydrawnwidth, con_notifydrawnheight;
+static byte con_notifyoverlay[NOTIFY_ROWS * 8 * MAXWIDTH];
+
+static void
+Con_NotifyCharacter(int row, int column, int num)
+{
+   if (column < NOTIFY_COLUMNS)
+      con_notifygrid[row][column] = num & 255;
+}
+
+static void
+Con_NotifyString(int row, int column, const char *str)
+{
+   while (*str)
+      Con_NotifyCharacter(row, column++, *str++);
+}
+
+static void
+Con_DrawNotifyOverlay(int rows)
+{
+   int row, column;
+
+   memset(con_notifyoverlay, 0, rows * 8 * vid.width);
+   for (row = 0; row < rows; row++)
+      for (column = 0; column < NOTIFY_COLUMNS; column++)
+         if (con_notifygrid[row][column] >= 0)
+            Draw_OverlayCharacter(con_notifyoverlay, column << 3, row << 3,
+                  con_notifygrid[row][column]);
+
+   memcpy(con_notifydrawn, con_notifygrid, rows * sizeof(con_notifygrid[0]));
+   con_notifydrawnrows = rows;
+   con_notifydrawnwidth = vid.width;
+   con_notifydrawnheight = vid.height;
+}
+
 /*
 ================
 Con_DrawNotify
@@ -453,30 +736,43 @@ Draws the last few lines of output transparently over the game top
 void Con_DrawNotify(void)
 {
    int i, x;
-   char *text;
+   const conline_t *line;
+   int lines[NUM_CON_TIMES], starts[NUM_CON_TIMES], ends[NUM_CON_TIMES];
+   int numrows, n, r;
    float time;
    char *s;
-   int v = 0;
+   int row = 0;
+   int v;
 
-   for (i = con->current - NUM_CON_TIMES + 1; i <= con->current; i++)
+   /* the last few rows, newest first */
+   numrows = 0;
+   for (i = con->current; numrows < NUM_CON_TIMES && Con_LineValid(i); i--)
    {
-      if (i < 0)
-         continue;
-      time = con_times[i % NUM_CON_TIMES];
+      n = Con_WrapRows(i);
+      for (r = n - 1; r >= 0 && numrows < NUM_CON_TIMES; r--, numrows++)
+      {
+         lines[numrows] = i;
+         starts[numrows] = con_rowstarts[r];
+         ends[numrows] = con_rowstarts[r + 1];
+      }
+   }
+
+   while (numrows--)
+   {
+      line = CON_LINE(lines[numrows]);
+      time = line->time;
       if (time == 0)
          continue;
       time = realtime - time;
       if (time > con_notifytime.value)
          continue;
-      text = con->text + (i % con_totallines) * con_linewidth;
-
-      clearnotify = 0;
-      scr_copytop = 1;
 
-      for (x = 0; x < con_linewidth; x++)
-         Draw_Character((x + 1) << 3, v, text[x]);
+      memset(con_notifygrid[row], 0xff, sizeof(con_notifygrid[row]));
+      for (x = starts[numrows]; x < ends[numrows]; x++)
+         Con_NotifyCharacter(row, x - starts[numrows] + 1,
+               CON_CHAR(line->start + x));
 
-      v += 8;
+      row++;
    }
 
 
@@ -484,17 +780,15 @@ void Con_DrawNotify(void)
    {
       int skip;
 
-      clearnotify = 0;
-      scr_copytop = 1;
-
+      memset(con_notifygrid[row], 0xff, sizeof(con_notifygrid[row]));
       if (chat_team)
       {
-         Draw_String(8, v, "say_team:");
+         Con_NotifyString(row, 1, "say_team:");
          skip = 11;
       }
       else
       {
-         Draw_String(8, v, "say:");
+         Con_NotifyString(row, 1, "say:");
          skip = 6;
       }
 
@@ -506,14 +800,27 @@ void Con_DrawNotify(void)
       x = 0;
       while (s[x])
       {
-         Draw_Character((x + skip) << 3, v, s[x]);
+         Con_NotifyCharacter(row, x + skip, s[x]);
          x++;
       }
-      Draw_Character((x + skip) << 3, v,
+      Con_NotifyCharacter(row, x + skip,
             10 + ((int)(realtime * con_cursorspeed) & 1));
-      v += 8;
+      row++;
    }
 
+   if (!row)
+      return;
+
+   if (row != con_notifydrawnrows || vid.width != con_notifydrawnwidth
+         || vid.height != con_notifydrawnheight
+         || memcmp(con_notifygrid, con_notifydrawn, row * sizeof(con_notifygrid[0])))
+      Con_DrawNotifyOverlay(row);
+
+   v = row << 3;
+   Draw_Overlay(0, v, con_notifyoverlay);
+   clearnotify = 0;
+   SCR_CopyRows(0, v);
+
    if (v > con_notifylines)
       con_notifylines = v;
 }
@@ -586,8 +893,8 @@ void Con_DrawConsole(int lines)
 {
    int i, x, y;
    int rows;
-   char *text;
-   int row;
+   int line, numrows, row;
+   unsigned start;
 
    if (lines <= 0)
       return;
@@ -601,24 +908,37 @@ void Con_DrawConsole(int lines)
    y = lines - 30;
 
    // draw from the bottom up
-   if (con->display != con->current) {
+   if (con->backscroll) {
       // draw arrows to show the buffer is backscrolled
       for (x = 0; x < con_linewidth; x += 4)
          Draw_Character((x + 1) << 3, y, '^');
       y -= 8;
       rows--;
+
+      if (!Con_LineValid(con->display)) {
+         con->display = Con_OldestLine();
+         con->displayrow = 0;
+      }
+      line = con->display;
+      numrows = Con_WrapRows(line);
+      row = qmin(con->displayrow, numrows - 1);
+   } else {
+      line = con->current;
+      numrows = Con_WrapRows(line);
+      row = numrows - 1;
    }
 
-   row = con->display;
    for (i = 0; i < rows; i++, y -= 8, row--) {
-      if (row < 0)
-         break;
-      if (con->current - row >= con_totallines)
-         break;		// past scrollback wrap point
-
-      text = con->text + (row % con_totallines) * con_linewidth;
-      for (x = 0; x < con_linewidth; x++)
-         Draw_Character((x + 1) << 3, y, text[x]);
+      if (row < 0) {
+         if (!Con_LineValid(--line))
+            break;
+         numrows = Con_WrapRows(line);
+         row = numrows - 1;
+      }
+
+      start = CON_LINE(line)->start + con_rowstarts[row];
+      for (x = 0; x < con_rowstarts[row + 1] - con_rowstarts[row]; x++)
+         Draw_Character((x + 1) << 3, y, CON_CHAR(start + x));
    }
 
    // draw the download bar, if needed
@@ -788,8 +1108,13 @@ void
 Con_Init(void)
 {
     debuglog = COM_CheckParm("-condebug");
+#ifdef HAVE_THREADS
+    con_mainthread = pthread_self();
+#endif
 
     con_main.text = (char*)Hunk_AllocName(CON_TEXTSIZE, "conmain");
+    con_main.lines = (conline_t*)Hunk_AllocName(CON_LINES * sizeof(conline_t),
+						  "conlines");
 
     con = &con_main;
     con_linewidth = -1;
@@ -804,6 +1129,7 @@ Con_Init(void)
     Cmd_AddCommand("messagemode", Con_MessageMode_f);
     Cmd_AddCommand("messagemode2", Con_MessageMode2_f);
     Cmd_AddCommand("clear", Con_Clear_f);
+    Cmd_AddCommand("condump", Con_Dump_f);
     Cmd_AddCommand("maplist", Con_Maplist_f);
 
     con_initialized = true;
@@ -27,17 +27,31 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 //
 // console
 //
+
+/*
+ * The scrollback keeps each line once, as it was printed, and wraps it to
+ * the console width when it's drawn
+ */
+typedef struct {
+    unsigned start;		// offset of its first character in the text
+    int length;
+    float time;			// realtime the line was started, for the notify lines
+} conline_t;
+
 typedef struct {
-    char *text;			// Text buffer
+    char *text;			// ring of the characters of the lines
+    conline_t *lines;		// ring of the lines
+    unsigned head;		// offset in text for the next character
+    int first;			// oldest line to show, after a clear
     int current;		// line where next message will be printed
-    int x;			// offset in current line for next print
     int display;		// bottom of console displays this line
+    int displayrow;		// and this row of it, when backscrolled
+    qboolean backscroll;
 } console_t;
 
 extern console_t *con;
 
 extern int con_ormask;
-extern int con_totallines;
 extern int con_notifylines;	// scan lines to clear for notify lines
 
 extern qboolean con_forcedup;
@@ -50,11 +64,19 @@ void Con_DrawConsole(int lines);
 void Con_Print(const char *txt);
 void Con_Printf(const char *fmt, ...);
 void Con_DPrintf(const char *fmt, ...);
+
+/* For a thread running in step with the main one, like the server frame */
+void Con_DeferPrints(qboolean defer);
+void Con_FlushDeferred(void);
+
 void Con_SafePrintf(const char *fmt, ...);
 void Con_Clear_f(void);
 void Con_DrawNotify(void);
 void Con_ClearNotify(void);
 void Con_ToggleConsole_f(void);
+void Con_Scroll(int rows);	// rows back, or forward if negative
+void Con_ScrollHome(void);
+void Con_ScrollEnd(void);
 void Con_ShowList(const char **list, int cnt, int maxlen);
 void Con_ShowTree(struct stree_root *root);
 
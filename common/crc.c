@@ -82,12 +82,43 @@ CRC_Value(unsigned short crcvalue)
     return crcvalue ^ CRC_XOR_VALUE;
 }
 
+/*
+ * For CRC_Block, eight bytes at a time: crcslices[k][n] is the CRC of the
+ * byte n followed by k zero bytes, so the CRCs of the eight bytes from
+ * their places in the group can be combined with xors alone.
+ */
+static unsigned short crcslices[8][256];
+static qboolean crcslices_built;
+
+static void
+CRC_BuildSlices(void)
+{
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+	crcslices[0][i] = crctable[i];
+	for (k = 1; k < 8; k++)
+	    crcslices[k][i] = (crcslices[k - 1][i] << 8)
+		^ crctable[crcslices[k - 1][i] >> 8];
+    }
+    crcslices_built = true;
+}
+
 unsigned short
 CRC_Block(const byte *start, int count)
 {
     unsigned short crc;
 
+    if (!crcslices_built)
+	CRC_BuildSlices();
+
     CRC_Init(&crc);
+    for (; count >= 8; count -= 8, start += 8)
+	crc = crcslices[7][start[0] ^ (crc >> 8)]
+	    ^ crcslices[6][start[1] ^ (crc & 0xff)]
+	    ^ crcslices[5][start[2]] ^ crcslices[4][start[3]]
+	    ^ crcslices[3][start[4]] ^ crcslices[2][start[5]]
+	    ^ crcslices[1][start[6]] ^ crcslices[0][start[7]];
     while (count--)
 	crc = (crc << 8) ^ crctable[(crc >> 8) ^ *start++];
 
@@ -23,7 +23,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "common.h"
 #include "console.h"
 #include "cvar.h"
+#include "jobs.h"
 #include "shell.h"
+#include "sys.h"
 #include "zone.h"
 
 #ifdef NQ_HACK
@@ -43,9 +45,23 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #endif
 
 static const char *cvar_null_string = "";
+unsigned cvar_changes;
+
+/*
+ * What a thread sets while it defers its sets is kept here, as the name and
+ * value one after the other, until the main thread flushes it. The value
+ * strings are only ever replaced on the main thread. Only one thread may
+ * defer at a time.
+ */
+static THREAD_LOCAL qboolean cvar_defer;
+static char cvar_deferred[MAX_PRINTMSG * 4];
+static int cvar_deferredlen;
+
+static void Cvar_DeferSet(cvar_t *var, const char *value);
 
 #define cvar_entry(ptr) container_of(ptr, struct cvar_s, stree)
 DECLARE_STREE_ROOT(cvar_tree);
+static struct stree_hash cvar_hash;
 
 /*
 ============
@@ -58,13 +74,33 @@ Cvar_FindVar(const char *var_name)
     struct cvar_s *ret = NULL;
     struct stree_node *n;
 
-    n = STree_Find(&cvar_tree, var_name);
+    n = STree_HashFind(&cvar_hash, var_name);
     if (n)
 	ret = cvar_entry(n);
 
     return ret;
 }
 
+/*
+ * The value the deferring thread last set for var_name, or NULL
+ */
+static const char *
+Cvar_DeferredValue(const char *var_name)
+{
+    const char *name, *value = NULL;
+    int pos = 0;
+
+    while (pos < cvar_deferredlen) {
+	name = cvar_deferred + pos;
+	pos += strlen(name) + 1;
+	if (!strcmp(name, var_name))
+	    value = cvar_deferred + pos;
+	pos += strlen(cvar_deferred + pos) + 1;
+    }
+
+    return value;
+}
+
 /*
  * Return a string tree with all possible argument completions of the given
  * buffer for the given cvar.
@@ -153,12 +189,7 @@ Cvar_VariableValue
 float
 Cvar_VariableValue(const char *var_name)
 {
-    cvar_t *var;
-
-    var = Cvar_FindVar(var_name);
-    if (!var)
-	return 0;
-    return Q_atof(var->string);
+    return Q_atof(Cvar_VariableString(var_name));
 }
 
 
@@ -171,10 +202,16 @@ const char *
 Cvar_VariableString(const char *var_name)
 {
     cvar_t *var;
+    const char *value;
 
     var = Cvar_FindVar(var_name);
     if (!var)
 	return cvar_null_string;
+    if (cvar_defer) {
+	value = Cvar_DeferredValue(var->name);
+	if (value)
+	    return value;
+    }
     return var->string;
 }
 
@@ -203,6 +240,11 @@ Cvar_Set(const char *var_name, const char *value)
 	return;
     }
 
+    if (cvar_defer) {
+	Cvar_DeferSet(var, value);
+	return;
+    }
+
     changed = strcmp(var->string, value);
 
     /* Check for developer-only cvar */
@@ -230,12 +272,19 @@ Cvar_Set(const char *var_name, const char *value)
 #endif
 #endif
 
+    /* only the value may have been changed directly */
+    if (!changed) {
+	var->value = Q_atof(var->string);
+	return;
+    }
+
     Z_Free(var->string);	// free the old value string
 
     newstring = (char*)Z_Malloc(strlen(value) + 1);
     strcpy(newstring, value);
     var->string = newstring;
     var->value = Q_atof(var->string);
+    cvar_changes++;
 
 #ifdef NQ_HACK
     if (var->server && changed) {
@@ -257,6 +306,66 @@ Cvar_Set(const char *var_name, const char *value)
 #endif
 }
 
+/*
+============
+Cvar_DeferSet
+============
+*/
+static void
+Cvar_DeferSet(cvar_t *var, const char *value)
+{
+    int namelen = strlen(var->name) + 1;
+    int valuelen = strlen(value) + 1;
+
+    if (cvar_deferredlen + namelen + valuelen > sizeof(cvar_deferred)) {
+	Con_Printf("Cvar_Set: too many sets at once, %s not set\n",
+		   var->name);
+	return;
+    }
+    memcpy(cvar_deferred + cvar_deferredlen, var->name, namelen);
+    cvar_deferredlen += namelen;
+    memcpy(cvar_deferred + cvar_deferredlen, value, valuelen);
+    cvar_deferredlen += valuelen;
+}
+
+/*
+============
+Cvar_DeferSets
+
+Keeps what this thread sets from the variables until Cvar_FlushDeferred.
+It reads back what it set through Cvar_VariableString, but the cvar_t
+itself keeps the old value until then.
+============
+*/
+void
+Cvar_DeferSets(qboolean defer)
+{
+    cvar_defer = defer;
+}
+
+/*
+============
+Cvar_FlushDeferred
+
+Makes the deferred sets, in order, from the main thread
+============
+*/
+void
+Cvar_FlushDeferred(void)
+{
+    const char *name, *value;
+    int pos = 0;
+
+    while (pos < cvar_deferredlen) {
+	name = cvar_deferred + pos;
+	pos += strlen(name) + 1;
+	value = cvar_deferred + pos;
+	pos += strlen(value) + 1;
+	Cvar_Set(name, value);
+    }
+    cvar_deferredlen = 0;
+}
+
 /*
 ============
 Cvar_SetValue
@@ -300,6 +409,7 @@ void Cvar_RegisterVariable(cvar_t *variable)
 
    variable->stree.string = variable->name;
    STree_Insert(&cvar_tree, &variable->stree);
+   STree_HashInsert(&cvar_hash, &variable->stree);
 
    // copy the value off, because future sets will Z_Free it
    strncpy(value, variable->string, 511);
@@ -116,6 +116,13 @@ void Cvar_SetCallback(cvar_t *var, cvar_callback func);
 /* equivelant to "<name> <variable>" typed at the console */
 void Cvar_Set(const char *var_name, const char *value);
 
+/* For a thread running in step with the main one, like the server frame */
+void Cvar_DeferSets(qboolean defer);
+void Cvar_FlushDeferred(void);
+
+/* bumped whenever Cvar_Set changes a value */
+extern unsigned cvar_changes;
+
 /* expands value to a string and calls Cvar_Set */
 void Cvar_SetValue(const char *var_name, float value);
 
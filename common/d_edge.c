@@ -19,7 +19,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // d_edge.c
 
+#include "cvar.h"
 #include "d_local.h"
+#include "jobs.h"
 #include "quakedef.h"
 #include "r_local.h"
 
@@ -66,12 +68,12 @@ D_DrawSolidSurface
 
 // FIXME: clean this up
 
-static void D_DrawSolidSurface(surf_t *surf, int color)
+static void D_DrawSolidSurface(espan_t *spans, int color)
 {
    espan_t *span;
    int pix = (color << 24) | (color << 16) | (color << 8) | color;
 
-   for (span = surf->spans; span; span = span->pnext)
+   for (span = spans; span; span = span->pnext)
    {
       byte *pdest = (byte *)d_viewbuffer + screenwidth * span->v;
       int u = span->u;
@@ -143,12 +145,251 @@ static void D_CalcGradients(msurface_t *pface)
 }
 
 
+/*
+ * With d_threads set, D_DrawSurfaces only does the setup for each surface:
+ * the gradients, building the cached surface and so on. What it would have
+ * drawn is saved in a batch, and the batch is drawn by splitting the screen
+ * into bands of scanlines, each drawn by one job. Spans of different
+ * surfaces never overlap, so the bands can be drawn in any order.
+ */
+cvar_t d_threads = { "d_threads", "1", true };
+
+typedef enum {
+   DRAW_SPANS,
+   DRAW_TURB,
+   DRAW_SKY,
+   DRAW_BACKGROUND
+} drawtype_t;
+
+typedef struct {
+   drawtype_t type;
+   espan_t *spans;
+   int color;
+
+   float d_sdivzstepu, d_tdivzstepu, d_zistepu;
+   float d_sdivzstepv, d_tdivzstepv, d_zistepv;
+   float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+   fixed16_t sadjust, tadjust, bbextents, bbextentt;
+   pixel_t *cacheblock;
+   int cachewidth;
+   surfcache_t *cache;
+} batchsurf_t;
+
+#define MAX_BATCH_SURFS 256
+#define MAX_BATCH_JOBS JOB_MAX_SPLIT(MAX_JOB_THREADS)
+#define BAND_SPANS 256	/* spans copied at a time for drawing a band */
+#define MIN_BAND_LINES 8
+
+static batchsurf_t d_batch[MAX_BATCH_SURFS];
+static int d_batchsize;
+static job_t d_batchjobs[MAX_BATCH_JOBS];
+
+int d_drawbatch = 1;
+THREAD_LOCAL surfcache_t *pcurrentcache;
+
+/*
+ * The per thread drawing state the span drawers work from
+ */
+static void D_SaveDrawState(batchsurf_t *ds)
+{
+   ds->d_sdivzstepu = d_sdivzstepu;
+   ds->d_tdivzstepu = d_tdivzstepu;
+   ds->d_zistepu = d_zistepu;
+   ds->d_sdivzstepv = d_sdivzstepv;
+   ds->d_tdivzstepv = d_tdivzstepv;
+   ds->d_zistepv = d_zistepv;
+   ds->d_sdivzorigin = d_sdivzorigin;
+   ds->d_tdivzorigin = d_tdivzorigin;
+   ds->d_ziorigin = d_ziorigin;
+   ds->sadjust = sadjust;
+   ds->tadjust = tadjust;
+   ds->bbextents = bbextents;
+   ds->bbextentt = bbextentt;
+   ds->cacheblock = cacheblock;
+   ds->cachewidth = cachewidth;
+   ds->cache = pcurrentcache;
+}
+
+static void D_LoadDrawState(const batchsurf_t *ds)
+{
+   d_sdivzstepu = ds->d_sdivzstepu;
+   d_tdivzstepu = ds->d_tdivzstepu;
+   d_zistepu = ds->d_zistepu;
+   d_sdivzstepv = ds->d_sdivzstepv;
+   d_tdivzstepv = ds->d_tdivzstepv;
+   d_zistepv = ds->d_zistepv;
+   d_sdivzorigin = ds->d_sdivzorigin;
+   d_tdivzorigin = ds->d_tdivzorigin;
+   d_ziorigin = ds->d_ziorigin;
+   sadjust = ds->sadjust;
+   tadjust = ds->tadjust;
+   bbextents = ds->bbextents;
+   bbextentt = ds->bbextentt;
+   cacheblock = ds->cacheblock;
+   cachewidth = ds->cachewidth;
+   pcurrentcache = ds->cache;
+}
+
+static void D_DrawSpansType(drawtype_t type, espan_t *spans, int color)
+{
+   switch (type) {
+   case DRAW_SPANS:
+      D_DrawSpans(spans);
+      break;
+   case DRAW_TURB:
+      Turbulent8(spans);
+      break;
+   case DRAW_SKY:
+      D_DrawSkyScans8(spans);
+      break;
+   case DRAW_BACKGROUND:
+      D_DrawSolidSurface(spans, color);
+      break;
+   }
+   D_DrawZSpans(spans);
+}
+
+/*
+ * Draw the lines [start, end) of the view for every surface in the batch
+ */
+static const char *D_DrawBand(void *data, int start, int end)
+{
+   const batchsurf_t *ds;
+   espan_t spans[BAND_SPANS];
+   const espan_t *span;
+   int i, count;
+
+   start += r_refdef.vrect.y;
+   end += r_refdef.vrect.y;
+
+   for (i = 0, ds = d_batch; i < d_batchsize; i++, ds++) {
+      D_LoadDrawState(ds);
+
+      count = 0;
+      for (span = ds->spans; span; span = span->pnext) {
+         if (span->v < start || span->v >= end)
+            continue;
+         spans[count] = *span;
+         spans[count].pnext = NULL;
+         if (count)
+            spans[count - 1].pnext = &spans[count];
+         if (++count == BAND_SPANS) {
+            D_DrawSpansType(ds->type, spans, ds->color);
+            count = 0;
+         }
+      }
+      if (count)
+         D_DrawSpansType(ds->type, spans, ds->color);
+   }
+
+   return NULL;
+}
+
+/*
+==============
+D_DrawBatch
+
+Draw the saved surfaces. Also called by the surface cache allocator before
+it reuses a surface that hasn't been drawn yet.
+==============
+*/
+void D_DrawBatch(void)
+{
+   vec3_t save_vpn, save_vright, save_vup;
+   batchsurf_t save_state;
+   int numjobs, lines;
+
+   D_BuildSurfaces();
+   if (!d_batchsize)
+      return;
+
+   /*
+    * This thread draws part of the batch too; keep whatever it was in the
+    * middle of setting up.
+    */
+   D_SaveDrawState(&save_state);
+
+   /* Sky uses the view vectors, which may be rotated for a brush model */
+   VectorCopy(vpn, save_vpn);
+   VectorCopy(vright, save_vright);
+   VectorCopy(vup, save_vup);
+   VectorCopy(base_vpn, vpn);
+   VectorCopy(base_vright, vright);
+   VectorCopy(base_vup, vup);
+
+   lines = r_refdef.vrectbottom - r_refdef.vrect.y;
+   numjobs = Job_Split(d_batchjobs, 0, MAX_BATCH_JOBS, D_DrawBand, NULL,
+         lines, MIN_BAND_LINES);
+   Job_RunBatch(d_batchjobs, numjobs);
+
+   VectorCopy(save_vpn, vpn);
+   VectorCopy(save_vright, vright);
+   VectorCopy(save_vup, vup);
+   D_LoadDrawState(&save_state);
+
+   d_batchsize = 0;
+   d_drawbatch++;
+}
+
+static void D_AddToBatch(drawtype_t type, espan_t *spans, int color)
+{
+   batchsurf_t *ds = &d_batch[d_batchsize++];
+
+   D_SaveDrawState(ds);
+   ds->type = type;
+   ds->spans = spans;
+   ds->color = color;
+   if (type == DRAW_SPANS)
+      pcurrentcache->drawbatch = d_drawbatch;
+   else
+      ds->cache = NULL;
+
+   if (d_batchsize == MAX_BATCH_SURFS)
+      D_DrawBatch();
+}
+
+static void D_DrawSurfaceSpans(qboolean batch, drawtype_t type,
+      espan_t *spans, int color)
+{
+   if (batch)
+      D_AddToBatch(type, spans, color);
+   else
+      D_DrawSpansType(type, spans, color);
+}
+
+/*
+ * Find the cached surfaces D_DrawSurfaces is going to need and get them
+ * built on the worker threads first.
+ */
+static void D_QueueSurfaces(void)
+{
+   surf_t *s;
+   msurface_t *pface;
+   const entity_t *e;
+   int miplevel;
+
+   for (s = &surfaces[1]; s < surface_p; s++)
+   {
+      if (!s->spans)
+         continue;
+      if (s->flags & (SURF_DRAWSKY | SURF_DRAWBACKGROUND | SURF_DRAWTURB))
+         continue;
+
+      e = s->insubmodel ? s->entity : &r_worldentity;
+      pface = (msurface_t*)s->data;
+      miplevel = D_MipLevelForScale(s->nearzi * scale_for_mip
+            * pface->texinfo->mipadjust);
+      D_QueueSurface(e, pface, miplevel);
+   }
+
+   D_BuildSurfaces();
+}
+
 /*
 ==============
 D_DrawSurfaces
 ==============
 */
-surfcache_t *pcurrentcache;
 void D_DrawSurfaces(void)
 {
    surf_t *s;
@@ -156,6 +397,10 @@ void D_DrawSurfaces(void)
    vec3_t world_transformed_modelorg;
    vec3_t local_modelorg;
    const entity_t *e = &r_worldentity;
+   qboolean batch = d_threads.value && Job_NumThreads();
+
+   if (batch)
+      D_QueueSurfaces();
 
    TransformVector(modelorg, transformed_modelorg);
    VectorCopy(transformed_modelorg, world_transformed_modelorg);
@@ -173,8 +418,8 @@ void D_DrawSurfaces(void)
 
       if (s->flags & SURF_DRAWSKY)
       {
-         D_DrawSkyScans8(s->spans);
-         D_DrawZSpans(s->spans);
+         D_SetSkyFrame();
+         D_DrawSurfaceSpans(batch, DRAW_SKY, s->spans, 0);
       }
       else if (s->flags & SURF_DRAWBACKGROUND)
       {
@@ -184,8 +429,8 @@ void D_DrawSurfaces(void)
          d_zistepv = 0;
          d_ziorigin = -0.9;
 
-         D_DrawSolidSurface(s, (int)r_clearcolor.value & 0xFF);
-         D_DrawZSpans(s->spans);
+         D_DrawSurfaceSpans(batch, DRAW_BACKGROUND, s->spans,
+               (int)r_clearcolor.value & 0xFF);
       }
       else if (s->flags & SURF_DRAWTURB)
       {
@@ -209,8 +454,7 @@ void D_DrawSurfaces(void)
          }
 
          D_CalcGradients(pface);
-         Turbulent8(s->spans);
-         D_DrawZSpans(s->spans);
+         D_DrawSurfaceSpans(batch, DRAW_TURB, s->spans, 0);
 
          if (s->insubmodel)
          {
@@ -255,8 +499,7 @@ void D_DrawSurfaces(void)
          cachewidth = pcurrentcache->width;
 
          D_CalcGradients(pface);
-         D_DrawSpans(s->spans);
-         D_DrawZSpans(s->spans);
+         D_DrawSurfaceSpans(batch, DRAW_SPANS, s->spans, 0);
 
          if (s->insubmodel)
          {
@@ -274,4 +517,86 @@ void D_DrawSurfaces(void)
          }
       }
    }
+
+   D_DrawBatch();
+}
+
+/*
+ * Entities hidden behind the world are skipped with a coarse test against
+ * the farthest z of each D_OCCLUDE_TILE square of the view, worked out the
+ * first time a tile is tested in a frame. Entities only ever bring the z
+ * buffer nearer, so a tile's far z stays a safe bound for the rest of the
+ * frame.
+ */
+#define D_OCCLUDE_SHIFT 4
+#define D_OCCLUDE_TILE (1 << D_OCCLUDE_SHIFT)
+#define D_OCCLUDE_COLS ((MAXWIDTH >> D_OCCLUDE_SHIFT) + 1)
+#define D_OCCLUDE_ROWS ((MAXHEIGHT >> D_OCCLUDE_SHIFT) + 1)
+
+static short d_tilefar[D_OCCLUDE_ROWS][D_OCCLUDE_COLS];
+static int d_tileframe[D_OCCLUDE_ROWS][D_OCCLUDE_COLS];
+
+static int D_TileFar(int col, int row)
+{
+   int x, y, x0, y0, x1, y1, far;
+   const short *pz;
+
+   if (d_tileframe[row][col] == r_framecount)
+      return d_tilefar[row][col];
+
+   /* only the part of the tile inside the view was drawn this frame */
+   x0 = qmax(col << D_OCCLUDE_SHIFT, r_refdef.vrect.x);
+   y0 = qmax(row << D_OCCLUDE_SHIFT, r_refdef.vrect.y);
+   x1 = qmin((col << D_OCCLUDE_SHIFT) + D_OCCLUDE_TILE,
+         r_refdef.vrect.x + r_refdef.vrect.width);
+   y1 = qmin((row << D_OCCLUDE_SHIFT) + D_OCCLUDE_TILE,
+         r_refdef.vrect.y + r_refdef.vrect.height);
+
+   far = 0x7fff;
+   for (y = y0; y < y1; y++)
+   {
+      pz = d_pzbuffer + d_zwidth * y;
+      for (x = x0; x < x1; x++)
+         if (pz[x] < far)
+            far = pz[x];
+   }
+
+   d_tilefar[row][col] = far;
+   d_tileframe[row][col] = r_framecount;
+
+   return far;
+}
+
+/*
+=============
+D_Occluded
+
+True if everything already in the z buffer over the screen rectangle is
+nearer than nearzi, the 1/z of the nearest point of what would be drawn
+there
+=============
+*/
+qboolean D_Occluded(float left, float top, float right, float bottom,
+      float nearzi)
+{
+   int x0, y0, x1, y1, col, row, z;
+
+   /* a pixel's grace around the edges and a little in z for rounding */
+   x0 = qmax((int)left - 1, r_refdef.vrect.x);
+   y0 = qmax((int)top - 1, r_refdef.vrect.y);
+   x1 = qmin((int)right + 1, r_refdef.vrect.x + r_refdef.vrect.width - 1);
+   y1 = qmin((int)bottom + 1, r_refdef.vrect.y + r_refdef.vrect.height - 1);
+   if (x0 > x1 || y0 > y1)
+      return false;
+
+   if (nearzi * 0x8000 >= 0x7fff - 2)
+      return false;
+   z = (int)(nearzi * 0x8000) + 2;
+
+   for (row = y0 >> D_OCCLUDE_SHIFT; row <= y1 >> D_OCCLUDE_SHIFT; row++)
+      for (col = x0 >> D_OCCLUDE_SHIFT; col <= x1 >> D_OCCLUDE_SHIFT; col++)
+         if (D_TileFar(col, row) <= z)
+            return false;
+
+   return true;
 }
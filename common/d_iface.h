@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define D_IFACE_H
 
 #include "cvar.h"
+#include "jobs.h"
 #include "mathlib.h"
 #include "model.h"
 #include "qtypes.h"
@@ -46,18 +47,23 @@ typedef enum {
     pt_blob, pt_blob2
 } ptype_t;
 
-// !!! if this is changed, it must be changed in d_ifacea.h too !!!
-typedef struct particle_s {
+/*
+ * Particles are kept as a structure of arrays, one array per field, with
+ * the live particles packed into [0, numparticles) so they can be worked on
+ * several at a time.
+ */
+typedef struct {
+    int numparticles;
+    int maxparticles;
 // driver-usable fields
-    vec3_t org;
-    float color;
+    float *org[3];
+    byte *color;
 // drivers never touch the following fields
-    struct particle_s *next;
-    vec3_t vel;
-    float ramp;
-    float die;
-    ptype_t type;
-} particle_t;
+    float *vel[3];
+    float *ramp;
+    float *die;
+    byte *type;			// ptype_t
+} particles_t;
 
 #define PARTICLE_Z_CLIP	8.0
 
@@ -128,7 +134,7 @@ void D_BeginDirectRect(int x, int y, const byte *pbitmap, int width,
 void D_EndDirectRect(int x, int y, int width, int height);
 void D_PolysetDraw(void);
 void D_PolysetDrawFinalVerts(finalvert_t *fv, int numverts);
-void D_DrawParticle(particle_t *pparticle);
+void D_DrawParticles(const particles_t *pparticles);
 void D_DrawSprite(void);
 void D_DrawSurfaces(void);
 void D_EndParticles(void);
@@ -137,6 +143,13 @@ void D_ViewChanged(void);
 void D_SetupFrame(void);
 void D_StartParticles(void);
 void D_TurnZOn(void);
+
+/*
+ * Once the world is drawn, true if a screen rectangle whose nearest point
+ * is at nearzi would be entirely behind what's already there
+ */
+qboolean D_Occluded(float left, float top, float right, float bottom,
+		    float nearzi);
 void D_WarpScreen(void);
 
 void D_FillRect(vrect_t *vrect, int color);
@@ -178,7 +191,7 @@ typedef struct {
     int surfheight;		// in mipmapped texels
 } drawsurf_t;
 
-extern drawsurf_t r_drawsurf;
+extern THREAD_LOCAL drawsurf_t r_drawsurf;
 
 void R_DrawSurface(void);
 
@@ -198,7 +211,8 @@ void R_DrawSurface(void);
 extern float skyspeed, skyspeed2;
 extern float skytime;
 
-extern int c_surf;
+extern int c_surf, c_surfcached, c_surfevicted;
+extern int c_dlightsurfs, c_dlightmarked;
 extern vrect_t scr_vrect;
 
 extern byte *r_warpbuffer;
@@ -29,6 +29,7 @@ static cvar_t d_mipcap = { "d_mipcap", "0" };
 static cvar_t d_mipscale = { "d_mipscale", "1", true };
 
 cvar_t dither_filter = { "dither_filter", "0", true };
+static cvar_t d_simd = { "d_simd", "1", true };
 
 surfcache_t *d_initial_rover;
 qboolean d_roverwrapped;
@@ -38,6 +39,7 @@ float d_scalemip[NUM_MIPS - 1];
 static float basemip[NUM_MIPS - 1] = { 1.0, 0.5 * 0.8, 0.25 * 0.8 };
 
 void (*D_DrawSpans)(espan_t *pspan);
+void (*D_DrawZSpans)(espan_t *pspan) = D_DrawZSpansScalar;
 
 /*
 ===============
@@ -54,6 +56,11 @@ D_Init(void)
     Cvar_RegisterVariable(&d_mipcap);
     Cvar_RegisterVariable(&d_mipscale);
     Cvar_RegisterVariable(&dither_filter);
+    Cvar_RegisterVariable(&d_simd);
+    Cvar_RegisterVariable(&d_threads);
+    Cvar_RegisterVariable(&d_halfspace);
+    Cvar_RegisterVariable(&d_skycomposite);
+    D_InitSurfCache();
 
     r_recursiveaffinetriangles = true;
     r_pixbytes = 1;
@@ -126,6 +133,18 @@ D_SetupFrame(void)
       D_DrawSpans = D_DrawSpans16QbDither;
    else
       D_DrawSpans = D_DrawSpans16Qb;
+   D_DrawZSpans = D_DrawZSpansScalar;
+
+#ifdef D_SIMD_SPANS
+   if (d_simd.value)
+   {
+      if (D_DrawSpans == D_DrawSpans16QbDither)
+         D_DrawSpans = D_DrawSpans16QbDitherSIMD;
+      else
+         D_DrawSpans = D_DrawSpans16QbSIMD;
+      D_DrawZSpans = D_DrawZSpansSIMD;
+   }
+#endif
 }
 
 
@@ -24,6 +24,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // d_local.h:  private rasterization driver defs
 
 #include "bspfile.h"
+#include "cvar.h"
+#include "jobs.h"
 #include "r_shared.h"
 
 //
@@ -44,11 +46,14 @@ typedef struct surfcache_s {
     struct surfcache_s **owner;	// NULL is an empty chunk of memory
     int lightadj[MAXLIGHTMAPS];	// checked for strobe flush
     int dlight;
+    unsigned dlightbits[(MAX_DLIGHTS + 31) >> 5];	// the lights built with
     int size;			// including header
     unsigned width;
     unsigned height;		// DEBUG only needed for debug
     float mipscale;
     struct texture_s *texture;	// checked for animating textures
+    int drawbatch;		// d_drawbatch while waiting to be drawn
+    int buildframe;		// r_framecount when last built
     byte data[4];		// width*height elements
 } surfcache_t;
 
@@ -63,12 +68,12 @@ extern qboolean d_roverwrapped;
 extern surfcache_t *sc_rover;
 extern surfcache_t *d_initial_rover;
 
-extern float d_sdivzstepu, d_tdivzstepu, d_zistepu;
-extern float d_sdivzstepv, d_tdivzstepv, d_zistepv;
-extern float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+extern THREAD_LOCAL float d_sdivzstepu, d_tdivzstepu, d_zistepu;
+extern THREAD_LOCAL float d_sdivzstepv, d_tdivzstepv, d_zistepv;
+extern THREAD_LOCAL float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
 
-extern fixed16_t sadjust, tadjust;
-extern fixed16_t bbextents, bbextentt;
+extern THREAD_LOCAL fixed16_t sadjust, tadjust;
+extern THREAD_LOCAL fixed16_t bbextents, bbextentt;
 
 void D_DrawSpans8(espan_t *pspans);
 void D_DrawSpans16(espan_t *pspans);
@@ -77,18 +82,61 @@ extern void (*D_DrawSpans)(espan_t *pspan);
 void D_DrawSpans16Qb(espan_t *pspans);
 void D_DrawSpans16QbDither(espan_t *pspans);
 
-void D_DrawZSpans(espan_t *pspans);
+void D_DrawZSpansScalar(espan_t *pspans);
+extern void (*D_DrawZSpans)(espan_t *pspan);
+
+/*
+ * SIMD versions of the span drawers, used unless d_simd is 0. They give the
+ * same results as the scalar ones.
+ */
+#if (defined(__SSE2__) || defined(__ARM_NEON)) && !defined(MSB_FIRST)
+#define D_SIMD_SPANS
+void D_DrawSpans16QbSIMD(espan_t *pspans);
+void D_DrawSpans16QbDitherSIMD(espan_t *pspans);
+void D_DrawZSpansSIMD(espan_t *pspans);
+#endif
 void Turbulent8(espan_t *pspan);
 void D_SpriteDrawSpans(sspan_t * pspan);
 
 void D_DrawSkyScans8(espan_t *pspan);
 void D_DrawSkyScans16(espan_t *pspan);
 
+/*
+ * With d_skycomposite, the two sky layers are laid together once a frame,
+ * by D_SetSkyFrame before the first sky span is drawn (on the main thread),
+ * and sky spans take a single lookup into that.
+ */
+extern cvar_t d_skycomposite;
+void D_SetSkyFrame(void);
+
 void R_ShowSubDiv(void);
 extern void (*prealspandrawer) (void);
 surfcache_t *D_CacheSurface(const entity_t *e, msurface_t *surface,
 			    int miplevel);
 
+/*
+ * With d_threads, surfaces are drawn in batches by the worker threads. A
+ * cached surface whose drawbatch matches d_drawbatch is still waiting to be
+ * drawn, and the batch must be drawn before its memory can be reused.
+ */
+extern cvar_t d_threads;
+extern int d_drawbatch;
+void D_DrawBatch(void);
+
+/*
+ * Queue up a surface for D_CacheSurface to find ready built, then build the
+ * queue on the worker threads. Queued surfaces also count as waiting to be
+ * drawn, and D_DrawBatch builds them first.
+ */
+void D_QueueSurface(const entity_t *e, msurface_t *surface, int miplevel);
+void D_BuildSurfaces(void);
+
+/*
+ * Draw the small triangles of alias models with the half-space rasterizer,
+ * and distant models without the recursive subdivision.
+ */
+extern cvar_t d_halfspace;
+
 extern short *d_pzbuffer;
 extern unsigned int d_zrowbytes, d_zwidth;
 
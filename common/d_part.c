@@ -22,6 +22,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "d_local.h"
 
+#if defined(D_SIMD_SPANS) && defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(D_SIMD_SPANS)
+#include <arm_neon.h>
+#endif
+
 
 /*
 ==============
@@ -47,40 +53,19 @@ void D_StartParticles(void)
 
 /*
 ==============
-D_DrawParticle
+D_DrawParticlePixels
+
+Draws the square for a particle projected to (u, v).
 ==============
 */
-void D_DrawParticle(particle_t *pparticle)
+static void D_DrawParticlePixels(int u, int v, int izi, byte color)
 {
-   vec3_t local, transformed;
-   float zi;
    byte *pdest;
    short *pz;
-   int i, izi, pix, count, u, v;
-
-   /* transform point */
-   VectorSubtract(pparticle->org, r_origin, local);
-
-   transformed[0] = DotProduct(local, r_pright);
-   transformed[1] = DotProduct(local, r_pup);
-   transformed[2] = DotProduct(local, r_ppn);
-
-   if (transformed[2] < PARTICLE_Z_CLIP)
-      return;
-
-   /* project the point
-    * FIXME: preadjust xcenter and ycenter */
-   zi = 1.0 / transformed[2];
-   u = (int)(xcenter + zi * transformed[0] + 0.5);
-   v = (int)(ycenter - zi * transformed[1] + 0.5);
-
-   if ((v > d_vrectbottom_particle) ||
-         (u > d_vrectright_particle) || (v < d_vrecty) || (u < d_vrectx))
-      return;
+   int i, pix, count;
 
    pz = d_pzbuffer + (d_zwidth * v) + u;
    pdest = d_viewbuffer + d_scantable[v] + u;
-   izi = (int)(zi * 0x8000);
 
    pix = izi >> d_pix_shift;
 
@@ -99,7 +84,7 @@ void D_DrawParticle(particle_t *pparticle)
             if (pz[0] <= izi)
             {
                pz[0] = izi;
-               pdest[0] = pparticle->color;
+               pdest[0] = color;
             }
          }
          break;
@@ -112,13 +97,13 @@ void D_DrawParticle(particle_t *pparticle)
             if (pz[0] <= izi)
             {
                pz[0] = izi;
-               pdest[0] = pparticle->color;
+               pdest[0] = color;
             }
 
             if (pz[1] <= izi)
             {
                pz[1] = izi;
-               pdest[1] = pparticle->color;
+               pdest[1] = color;
             }
          }
          break;
@@ -131,19 +116,19 @@ void D_DrawParticle(particle_t *pparticle)
             if (pz[0] <= izi)
             {
                pz[0] = izi;
-               pdest[0] = pparticle->color;
+               pdest[0] = color;
             }
 
             if (pz[1] <= izi)
             {
                pz[1] = izi;
-               pdest[1] = pparticle->color;
+               pdest[1] = color;
             }
 
             if (pz[2] <= izi)
             {
                pz[2] = izi;
-               pdest[2] = pparticle->color;
+               pdest[2] = color;
             }
          }
          break;
@@ -156,25 +141,25 @@ void D_DrawParticle(particle_t *pparticle)
             if (pz[0] <= izi)
             {
                pz[0] = izi;
-               pdest[0] = pparticle->color;
+               pdest[0] = color;
             }
 
             if (pz[1] <= izi)
             {
                pz[1] = izi;
-               pdest[1] = pparticle->color;
+               pdest[1] = color;
             }
 
             if (pz[2] <= izi)
             {
                pz[2] = izi;
-               pdest[2] = pparticle->color;
+               pdest[2] = color;
             }
 
             if (pz[3] <= izi)
             {
                pz[3] = izi;
-               pdest[3] = pparticle->color;
+               pdest[3] = color;
             }
          }
          break;
@@ -189,10 +174,146 @@ void D_DrawParticle(particle_t *pparticle)
                if (pz[i] <= izi)
                {
                   pz[i] = izi;
-                  pdest[i] = pparticle->color;
+                  pdest[i] = color;
                }
             }
          }
          break;
    }
 }
+
+
+/*
+==============
+D_DrawParticle
+==============
+*/
+static void D_DrawParticle(const particles_t *pparticles, int i)
+{
+   vec3_t local, transformed;
+   float zi;
+   int j, u, v;
+
+   /* transform point */
+   for (j = 0; j < 3; j++)
+      local[j] = pparticles->org[j][i] - r_origin[j];
+
+   transformed[0] = DotProduct(local, r_pright);
+   transformed[1] = DotProduct(local, r_pup);
+   transformed[2] = DotProduct(local, r_ppn);
+
+   if (transformed[2] < PARTICLE_Z_CLIP)
+      return;
+
+   /* project the point
+    * FIXME: preadjust xcenter and ycenter */
+   zi = 1.0 / transformed[2];
+   u = (int)(xcenter + zi * transformed[0] + 0.5);
+   v = (int)(ycenter - zi * transformed[1] + 0.5);
+
+   if ((v > d_vrectbottom_particle) ||
+         (u > d_vrectright_particle) || (v < d_vrecty) || (u < d_vrectx))
+      return;
+
+   D_DrawParticlePixels(u, v, (int)(zi * 0x8000), pparticles->color[i]);
+}
+
+#ifdef D_SIMD_SPANS
+/*
+==============
+D_DrawParticles4
+
+Same as D_DrawParticle for particles i to i + 3; they are transformed and
+projected together and only the pixels are drawn one at a time.
+==============
+*/
+static void D_DrawParticles4(const particles_t *pparticles, int i)
+{
+   float z[4], zi[4];
+   int u[4], v[4], izi[4];
+   int j;
+#ifdef __SSE2__
+   __m128 local[3], tx, ty, tz, vzi;
+
+   for (j = 0; j < 3; j++)
+      local[j] = _mm_sub_ps(_mm_loadu_ps(pparticles->org[j] + i),
+            _mm_set1_ps(r_origin[j]));
+
+#define DOT4(v) \
+   _mm_add_ps(_mm_add_ps(_mm_mul_ps(local[0], _mm_set1_ps(v[0])), \
+            _mm_mul_ps(local[1], _mm_set1_ps(v[1]))), \
+         _mm_mul_ps(local[2], _mm_set1_ps(v[2])))
+   tx = DOT4(r_pright);
+   ty = DOT4(r_pup);
+   tz = DOT4(r_ppn);
+#undef DOT4
+
+   /* particles behind the clip plane are skipped below */
+   _mm_storeu_ps(z, tz);
+   vzi = _mm_div_ps(_mm_set1_ps(1.0f), tz);
+   _mm_storeu_ps(zi, vzi);
+
+   _mm_storeu_si128((__m128i *)u, _mm_cvttps_epi32(_mm_add_ps(_mm_add_ps(
+                  _mm_set1_ps(xcenter), _mm_mul_ps(vzi, tx)),
+               _mm_set1_ps(0.5f))));
+   _mm_storeu_si128((__m128i *)v, _mm_cvttps_epi32(_mm_add_ps(_mm_sub_ps(
+                  _mm_set1_ps(ycenter), _mm_mul_ps(vzi, ty)),
+               _mm_set1_ps(0.5f))));
+   _mm_storeu_si128((__m128i *)izi,
+         _mm_cvttps_epi32(_mm_mul_ps(vzi, _mm_set1_ps(0x8000))));
+#else
+   float32x4_t local[3], tx, ty, tz, vzi;
+
+   for (j = 0; j < 3; j++)
+      local[j] = vsubq_f32(vld1q_f32(pparticles->org[j] + i),
+            vdupq_n_f32(r_origin[j]));
+
+#define DOT4(v) \
+   vaddq_f32(vaddq_f32(vmulq_n_f32(local[0], v[0]), \
+            vmulq_n_f32(local[1], v[1])), vmulq_n_f32(local[2], v[2]))
+   tx = DOT4(r_pright);
+   ty = DOT4(r_pup);
+   tz = DOT4(r_ppn);
+#undef DOT4
+
+   /* NEON only has a reciprocal estimate, so divide one at a time */
+   vst1q_f32(z, tz);
+   for (j = 0; j < 4; j++)
+      zi[j] = 1.0 / z[j];
+   vzi = vld1q_f32(zi);
+
+   vst1q_s32(u, vcvtq_s32_f32(vaddq_f32(vaddq_f32(vdupq_n_f32(xcenter),
+                  vmulq_f32(vzi, tx)), vdupq_n_f32(0.5f))));
+   vst1q_s32(v, vcvtq_s32_f32(vaddq_f32(vsubq_f32(vdupq_n_f32(ycenter),
+                  vmulq_f32(vzi, ty)), vdupq_n_f32(0.5f))));
+   vst1q_s32(izi, vcvtq_s32_f32(vmulq_n_f32(vzi, 0x8000)));
+#endif
+
+   for (j = 0; j < 4; j++) {
+      if (z[j] < PARTICLE_Z_CLIP)
+         continue;
+      if ((v[j] > d_vrectbottom_particle) ||
+            (u[j] > d_vrectright_particle) ||
+            (v[j] < d_vrecty) || (u[j] < d_vrectx))
+         continue;
+      D_DrawParticlePixels(u[j], v[j], izi[j], pparticles->color[i + j]);
+   }
+}
+#endif
+
+/*
+==============
+D_DrawParticles
+==============
+*/
+void D_DrawParticles(const particles_t *pparticles)
+{
+   int i = 0;
+
+#ifdef D_SIMD_SPANS
+   for (; i + 4 <= pparticles->numparticles; i += 4)
+      D_DrawParticles4(pparticles, i);
+#endif
+   for (; i < pparticles->numparticles; i++)
+      D_DrawParticle(pparticles, i);
+}
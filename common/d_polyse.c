@@ -24,6 +24,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "r_local.h"
 #include "d_local.h"
 
+#if defined(D_SIMD_SPANS) && defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(D_SIMD_SPANS)
+#include <arm_neon.h>
+#endif
+
 // TODO: put in span spilling to shrink list size
 // !!! if this is changed, it must be changed in d_polysa.s too !!!
 #define DPS_MAXSPANS MAXHEIGHT+1
@@ -112,8 +118,13 @@ void D_PolysetScanLeftEdge(int height);
 
 static void D_DrawSubdiv(void);
 static void D_DrawNonSubdiv(void);
+static void D_DrawHalfSpace(void);
 static void D_PolysetRecursiveTriangle(int *p1, int *p2, int *p3);
 
+extern int coloredlights;
+
+cvar_t d_halfspace = { "d_halfspace", "1", true };
+
 /*
 ================
 D_PolysetDraw
@@ -128,12 +139,19 @@ D_PolysetDraw(void)
    a_spans = (spanpackage_t *)
       (((long)&spans[0] + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
 
-   if (r_affinetridesc.drawtype)
+   if (d_halfspace.value && !coloredlights)
+      D_DrawHalfSpace();
+   else if (r_affinetridesc.drawtype)
       D_DrawSubdiv();
    else
       D_DrawNonSubdiv();
 }
 
+/*
+ * Left from the Hexen II renderer; the translucent span drawers they call
+ * (D_DrawSubdivT*) and the blend tables aren't part of this tree, and
+ * nothing Quake draws with the software renderer is translucent.
+ */
 #ifdef HEXEN2
 void D_PolysetDrawT3 (void)
 {
@@ -287,6 +305,62 @@ static void D_DrawSubdiv(void)
 }
 
 
+/*
+================
+D_PolysetLoadTriangle
+
+Copy the vertices of a triangle to r_p0, r_p1 and r_p2, with the seam fixup
+applied. Returns false if the triangle faces away from the viewer.
+================
+*/
+static qboolean D_PolysetLoadTriangle(const finalvert_t *pfv,
+      const mtriangle_t *ptri)
+{
+   const finalvert_t *index0 = pfv + ptri->vertindex[0];
+   const finalvert_t *index1 = pfv + ptri->vertindex[1];
+   const finalvert_t *index2 = pfv + ptri->vertindex[2];
+
+   d_xdenom = (index0->v[1] - index1->v[1]) *
+      (index0->v[0] - index2->v[0]) -
+      (index0->v[0] - index1->v[0]) * (index0->v[1] - index2->v[1]);
+
+   if (d_xdenom >= 0)
+      return false;
+
+   r_p0[0] = index0->v[0];	// u
+   r_p0[1] = index0->v[1];	// v
+   r_p0[2] = index0->v[2];	// s
+   r_p0[3] = index0->v[3];	// t
+   r_p0[4] = index0->v[4];	// light
+   r_p0[5] = index0->v[5];	// iz
+
+   r_p1[0] = index1->v[0];
+   r_p1[1] = index1->v[1];
+   r_p1[2] = index1->v[2];
+   r_p1[3] = index1->v[3];
+   r_p1[4] = index1->v[4];
+   r_p1[5] = index1->v[5];
+
+   r_p2[0] = index2->v[0];
+   r_p2[1] = index2->v[1];
+   r_p2[2] = index2->v[2];
+   r_p2[3] = index2->v[3];
+   r_p2[4] = index2->v[4];
+   r_p2[5] = index2->v[5];
+
+   if (!ptri->facesfront) {
+      if (index0->flags & ALIAS_ONSEAM)
+         r_p0[2] += r_affinetridesc.seamfixupX16;
+      if (index1->flags & ALIAS_ONSEAM)
+         r_p1[2] += r_affinetridesc.seamfixupX16;
+      if (index2->flags & ALIAS_ONSEAM)
+         r_p2[2] += r_affinetridesc.seamfixupX16;
+   }
+
+   return true;
+}
+
+
 /*
 ================
 D_DrawNonSubdiv
@@ -304,47 +378,8 @@ static void D_DrawNonSubdiv(void)
 
    for (i = 0; i < lnumtriangles; i++, ptri++)
    {
-      finalvert_t *index0 = pfv + ptri->vertindex[0];
-      finalvert_t *index1 = pfv + ptri->vertindex[1];
-      finalvert_t *index2 = pfv + ptri->vertindex[2];
-
-      d_xdenom = (index0->v[1] - index1->v[1]) *
-         (index0->v[0] - index2->v[0]) -
-         (index0->v[0] - index1->v[0]) * (index0->v[1] - index2->v[1]);
-
-      if (d_xdenom >= 0) {
+      if (!D_PolysetLoadTriangle(pfv, ptri))
          continue;
-      }
-
-      r_p0[0] = index0->v[0];	// u
-      r_p0[1] = index0->v[1];	// v
-      r_p0[2] = index0->v[2];	// s
-      r_p0[3] = index0->v[3];	// t
-      r_p0[4] = index0->v[4];	// light
-      r_p0[5] = index0->v[5];	// iz
-
-      r_p1[0] = index1->v[0];
-      r_p1[1] = index1->v[1];
-      r_p1[2] = index1->v[2];
-      r_p1[3] = index1->v[3];
-      r_p1[4] = index1->v[4];
-      r_p1[5] = index1->v[5];
-
-      r_p2[0] = index2->v[0];
-      r_p2[1] = index2->v[1];
-      r_p2[2] = index2->v[2];
-      r_p2[3] = index2->v[3];
-      r_p2[4] = index2->v[4];
-      r_p2[5] = index2->v[5];
-
-      if (!ptri->facesfront) {
-         if (index0->flags & ALIAS_ONSEAM)
-            r_p0[2] += r_affinetridesc.seamfixupX16;
-         if (index1->flags & ALIAS_ONSEAM)
-            r_p1[2] += r_affinetridesc.seamfixupX16;
-         if (index2->flags & ALIAS_ONSEAM)
-            r_p2[2] += r_affinetridesc.seamfixupX16;
-      }
 
       D_PolysetSetEdgeTable();
       D_RasterizeAliasPolySmooth();
@@ -791,8 +826,6 @@ D_RasterizeAliasPolySmooth
 ================
 */
 
-extern int coloredlights;
-
 void D_RasterizeAliasPolySmooth(void)
 {
    int working_lstepx, originalcount;
@@ -1033,3 +1066,425 @@ void D_PolysetSetEdgeTable(void)
 
    pedgetable = &edgetables[edgetableindex];
 }
+
+/*
+ * Half-space rasterizer
+ *
+ * Instead of walking the left and right edges of a triangle, every pixel of
+ * its bounding box is tested against the three edge functions, a whole row
+ * at a time. The setup is just a few integer multiplies, so this is used for
+ * the many tiny triangles of distant models, where the setup of the edge
+ * walker costs more than drawing the pixels. Triangles that don't fit in a
+ * D_POLY_TILE x D_POLY_TILE tile still go to the edge walker, which is
+ * faster once there are more pixels than edges to test.
+ *
+ * Pixels on top and left edges are drawn and pixels on bottom and right edges
+ * are not, so the coverage is the same as D_RasterizeAliasPolySmooth and the
+ * two can be mixed within a model.
+ */
+#define D_POLY_TILE 8
+
+typedef struct {
+   byte *pdest;
+   int16_t *pz;
+   int width, height;
+   int e[3];			/* edge functions at the top left pixel */
+   int a[3], b[3];		/* edge function steps in x and y */
+   int s, t, light, zi;		/* values at the top left pixel */
+} polytile_t;
+
+/*
+================
+D_PolysetSetupEdge
+
+Edge function a * x + b * y + c for the edge from v0 to v1, which is not
+negative for the pixels inside the triangle.
+================
+*/
+static void D_PolysetSetupEdge(const int *v0, const int *v1, int *a, int *b,
+      int *c)
+{
+   int dx = v1[0] - v0[0];
+   int dy = v1[1] - v0[1];
+
+   *a = -dy;
+   *b = dx;
+   *c = dy * v0[0] - dx * v0[1];
+
+   /* pixels exactly on the edge only belong to top and left edges */
+   if (!(dy < 0 || (dy == 0 && dx > 0)))
+      *c -= 1;
+}
+
+/*
+================
+D_PolysetDrawTile
+================
+*/
+static void D_PolysetDrawTile(const polytile_t *tile)
+{
+   const byte *pskin = (const byte *)r_affinetridesc.pskin;
+   const byte *colormap = (const byte *)acolormap;
+   int skinwidth = r_affinetridesc.skinwidth;
+   byte *pdest = tile->pdest;
+   int16_t *pz = tile->pz;
+   int e0 = tile->e[0], e1 = tile->e[1], e2 = tile->e[2];
+   int s = tile->s, t = tile->t, light = tile->light, zi = tile->zi;
+   int x, y;
+
+   for (y = 0; y < tile->height; y++)
+   {
+      int re0 = e0, re1 = e1, re2 = e2;
+      int rs = s, rt = t, rlight = light, rzi = zi;
+
+      for (x = 0; x < tile->width; x++)
+      {
+         if ((re0 | re1 | re2) >= 0 && (rzi >> 16) >= pz[x])
+         {
+            pz[x] = rzi >> 16;
+            pdest[x] = colormap[pskin[(rs >> 16) + (rt >> 16) * skinwidth] +
+               (rlight & 0xFF00)];
+         }
+         re0 += tile->a[0];
+         re1 += tile->a[1];
+         re2 += tile->a[2];
+         rs += r_sstepx;
+         rt += r_tstepx;
+         rlight += r_lstepx;
+         rzi += r_zistepx;
+      }
+
+      e0 += tile->b[0];
+      e1 += tile->b[1];
+      e2 += tile->b[2];
+      s += r_sstepy;
+      t += r_tstepy;
+      light += r_lstepy;
+      zi += r_zistepy;
+      pdest += screenwidth;
+      pz += d_zwidth;
+   }
+}
+
+#ifdef D_SIMD_SPANS
+/*
+================
+D_PolysetDrawTileSIMD
+
+Same as D_PolysetDrawTile, doing the edge and z tests, the z-buffer update
+and the skin offsets for a whole row at a time. Always reads and writes back
+D_POLY_TILE z-buffer entries per row.
+================
+*/
+#ifdef __SSE2__
+static inline __m128i D_PolysetRamp(int base, int step)
+{
+   return _mm_setr_epi32(base, base + step, base + 2 * step, base + 3 * step);
+}
+
+static void D_PolysetDrawTileSIMD(const polytile_t *tile)
+{
+   const byte *pskin = (const byte *)r_affinetridesc.pskin;
+   const byte *colormap = (const byte *)acolormap;
+   const __m128i width =
+      _mm_set1_epi32((r_affinetridesc.skinwidth << 16) | 1);
+   const __m128i himask = _mm_set1_epi32(0xFFFF0000);
+   const __m128i lightmask = _mm_set1_epi32(0xFF00);
+   __m128i elo[3], ehi[3], zlo, zhi, slo, shi, tlo, thi, llo, lhi;
+   __m128i endlo, endhi;
+   byte *pdest = tile->pdest;
+   int16_t *pz = tile->pz;
+   int i, y;
+
+   for (i = 0; i < 3; i++)
+   {
+      elo[i] = D_PolysetRamp(tile->e[i], tile->a[i]);
+      ehi[i] = _mm_add_epi32(elo[i], _mm_set1_epi32(4 * tile->a[i]));
+   }
+   zlo = D_PolysetRamp(tile->zi, r_zistepx);
+   zhi = _mm_add_epi32(zlo, _mm_set1_epi32(4 * r_zistepx));
+   slo = D_PolysetRamp(tile->s, r_sstepx);
+   shi = _mm_add_epi32(slo, _mm_set1_epi32(4 * r_sstepx));
+   tlo = D_PolysetRamp(tile->t, r_tstepx);
+   thi = _mm_add_epi32(tlo, _mm_set1_epi32(4 * r_tstepx));
+   llo = D_PolysetRamp(tile->light, r_lstepx);
+   lhi = _mm_add_epi32(llo, _mm_set1_epi32(4 * r_lstepx));
+
+   /* pixels past the right of the tile are left alone */
+   endlo = _mm_cmpgt_epi32(_mm_setr_epi32(1, 2, 3, 4),
+         _mm_set1_epi32(tile->width));
+   endhi = _mm_cmpgt_epi32(_mm_setr_epi32(5, 6, 7, 8),
+         _mm_set1_epi32(tile->width));
+
+   for (y = 0; y < tile->height; y++)
+   {
+      __m128i faillo, failhi, izlo, izhi, buf, fail, znew;
+      unsigned mask;
+
+      faillo = _mm_or_si128(endlo, _mm_srai_epi32(_mm_or_si128(
+                  _mm_or_si128(elo[0], elo[1]), elo[2]), 31));
+      failhi = _mm_or_si128(endhi, _mm_srai_epi32(_mm_or_si128(
+                  _mm_or_si128(ehi[0], ehi[1]), ehi[2]), 31));
+
+      izlo = _mm_srai_epi32(zlo, 16);
+      izhi = _mm_srai_epi32(zhi, 16);
+      buf = _mm_loadu_si128((const __m128i *)pz);
+      faillo = _mm_or_si128(faillo, _mm_cmpgt_epi32(
+               _mm_srai_epi32(_mm_unpacklo_epi16(buf, buf), 16), izlo));
+      failhi = _mm_or_si128(failhi, _mm_cmpgt_epi32(
+               _mm_srai_epi32(_mm_unpackhi_epi16(buf, buf), 16), izhi));
+      fail = _mm_packs_epi32(faillo, failhi);
+      mask = ~_mm_movemask_epi8(_mm_packs_epi16(fail, fail)) & 0xFF;
+
+      if (mask)
+      {
+         int offsets[D_POLY_TILE], lights[D_POLY_TILE];
+
+         /* the z-buffer keeps the low 16 bits, like the scalar code */
+         znew = _mm_packs_epi32(
+               _mm_srai_epi32(_mm_slli_epi32(izlo, 16), 16),
+               _mm_srai_epi32(_mm_slli_epi32(izhi, 16), 16));
+         buf = _mm_or_si128(_mm_and_si128(fail, buf),
+               _mm_andnot_si128(fail, znew));
+         _mm_storeu_si128((__m128i *)pz, buf);
+
+         /* (s >> 16) + (t >> 16) * skinwidth, with one multiply-add */
+         _mm_storeu_si128((__m128i *)offsets, _mm_madd_epi16(_mm_or_si128(
+                     _mm_and_si128(tlo, himask), _mm_srli_epi32(slo, 16)),
+                  width));
+         _mm_storeu_si128((__m128i *)(offsets + 4), _mm_madd_epi16(
+                  _mm_or_si128(_mm_and_si128(thi, himask),
+                     _mm_srli_epi32(shi, 16)), width));
+         _mm_storeu_si128((__m128i *)lights, _mm_and_si128(llo, lightmask));
+         _mm_storeu_si128((__m128i *)(lights + 4),
+               _mm_and_si128(lhi, lightmask));
+
+         for (i = 0; mask; i++, mask >>= 1)
+         {
+            if (mask & 1)
+               pdest[i] = colormap[pskin[offsets[i]] + lights[i]];
+         }
+      }
+
+      for (i = 0; i < 3; i++)
+      {
+         elo[i] = _mm_add_epi32(elo[i], _mm_set1_epi32(tile->b[i]));
+         ehi[i] = _mm_add_epi32(ehi[i], _mm_set1_epi32(tile->b[i]));
+      }
+      zlo = _mm_add_epi32(zlo, _mm_set1_epi32(r_zistepy));
+      zhi = _mm_add_epi32(zhi, _mm_set1_epi32(r_zistepy));
+      slo = _mm_add_epi32(slo, _mm_set1_epi32(r_sstepy));
+      shi = _mm_add_epi32(shi, _mm_set1_epi32(r_sstepy));
+      tlo = _mm_add_epi32(tlo, _mm_set1_epi32(r_tstepy));
+      thi = _mm_add_epi32(thi, _mm_set1_epi32(r_tstepy));
+      llo = _mm_add_epi32(llo, _mm_set1_epi32(r_lstepy));
+      lhi = _mm_add_epi32(lhi, _mm_set1_epi32(r_lstepy));
+      pdest += screenwidth;
+      pz += d_zwidth;
+   }
+}
+#else /* NEON */
+static void D_PolysetDrawTileSIMD(const polytile_t *tile)
+{
+   static const int32_t ramp[4] = { 0, 1, 2, 3 };
+   static const uint8_t bits[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+   const byte *pskin = (const byte *)r_affinetridesc.pskin;
+   const byte *colormap = (const byte *)acolormap;
+   const int32x4_t vramp = vld1q_s32(ramp);
+   const int32x4_t width = vdupq_n_s32(r_affinetridesc.skinwidth);
+   const int32x4_t lightmask = vdupq_n_s32(0xFF00);
+   int32x4_t elo[3], ehi[3], zlo, zhi, slo, shi, tlo, thi, llo, lhi;
+   uint32x4_t endlo, endhi;
+   byte *pdest = tile->pdest;
+   int16_t *pz = tile->pz;
+   int i, y;
+
+   for (i = 0; i < 3; i++)
+   {
+      elo[i] = vmlaq_n_s32(vdupq_n_s32(tile->e[i]), vramp, tile->a[i]);
+      ehi[i] = vaddq_s32(elo[i], vdupq_n_s32(4 * tile->a[i]));
+   }
+   zlo = vmlaq_n_s32(vdupq_n_s32(tile->zi), vramp, r_zistepx);
+   zhi = vaddq_s32(zlo, vdupq_n_s32(4 * r_zistepx));
+   slo = vmlaq_n_s32(vdupq_n_s32(tile->s), vramp, r_sstepx);
+   shi = vaddq_s32(slo, vdupq_n_s32(4 * r_sstepx));
+   tlo = vmlaq_n_s32(vdupq_n_s32(tile->t), vramp, r_tstepx);
+   thi = vaddq_s32(tlo, vdupq_n_s32(4 * r_tstepx));
+   llo = vmlaq_n_s32(vdupq_n_s32(tile->light), vramp, r_lstepx);
+   lhi = vaddq_s32(llo, vdupq_n_s32(4 * r_lstepx));
+
+   /* pixels past the right of the tile are left alone */
+   endlo = vcgeq_s32(vramp, vdupq_n_s32(tile->width));
+   endhi = vcgeq_s32(vaddq_s32(vramp, vdupq_n_s32(4)),
+         vdupq_n_s32(tile->width));
+
+   for (y = 0; y < tile->height; y++)
+   {
+      uint32x4_t faillo, failhi;
+      int32x4_t izlo, izhi;
+      int16x8_t buf;
+      uint16x8_t fail;
+      unsigned mask;
+
+      faillo = vorrq_u32(endlo, vreinterpretq_u32_s32(vshrq_n_s32(
+                  vorrq_s32(vorrq_s32(elo[0], elo[1]), elo[2]), 31)));
+      failhi = vorrq_u32(endhi, vreinterpretq_u32_s32(vshrq_n_s32(
+                  vorrq_s32(vorrq_s32(ehi[0], ehi[1]), ehi[2]), 31)));
+
+      izlo = vshrq_n_s32(zlo, 16);
+      izhi = vshrq_n_s32(zhi, 16);
+      buf = vld1q_s16(pz);
+      faillo = vorrq_u32(faillo,
+            vcgtq_s32(vmovl_s16(vget_low_s16(buf)), izlo));
+      failhi = vorrq_u32(failhi,
+            vcgtq_s32(vmovl_s16(vget_high_s16(buf)), izhi));
+      fail = vcombine_u16(vmovn_u32(faillo), vmovn_u32(failhi));
+      mask = ~(unsigned)vget_lane_u64(vpaddl_u32(vpaddl_u16(vpaddl_u8(
+                     vand_u8(vmovn_u16(fail), vld1_u8(bits))))), 0) & 0xFF;
+
+      if (mask)
+      {
+         int offsets[D_POLY_TILE], lights[D_POLY_TILE];
+
+         /* the z-buffer keeps the low 16 bits, like the scalar code */
+         vst1q_s16(pz, vbslq_s16(fail, buf,
+                  vcombine_s16(vmovn_s32(izlo), vmovn_s32(izhi))));
+
+         vst1q_s32(offsets, vmlaq_s32(vshrq_n_s32(slo, 16),
+                  vshrq_n_s32(tlo, 16), width));
+         vst1q_s32(offsets + 4, vmlaq_s32(vshrq_n_s32(shi, 16),
+                  vshrq_n_s32(thi, 16), width));
+         vst1q_s32(lights, vandq_s32(llo, lightmask));
+         vst1q_s32(lights + 4, vandq_s32(lhi, lightmask));
+
+         for (i = 0; mask; i++, mask >>= 1)
+         {
+            if (mask & 1)
+               pdest[i] = colormap[pskin[offsets[i]] + lights[i]];
+         }
+      }
+
+      for (i = 0; i < 3; i++)
+      {
+         elo[i] = vaddq_s32(elo[i], vdupq_n_s32(tile->b[i]));
+         ehi[i] = vaddq_s32(ehi[i], vdupq_n_s32(tile->b[i]));
+      }
+      zlo = vaddq_s32(zlo, vdupq_n_s32(r_zistepy));
+      zhi = vaddq_s32(zhi, vdupq_n_s32(r_zistepy));
+      slo = vaddq_s32(slo, vdupq_n_s32(r_sstepy));
+      shi = vaddq_s32(shi, vdupq_n_s32(r_sstepy));
+      tlo = vaddq_s32(tlo, vdupq_n_s32(r_tstepy));
+      thi = vaddq_s32(thi, vdupq_n_s32(r_tstepy));
+      llo = vaddq_s32(llo, vdupq_n_s32(r_lstepy));
+      lhi = vaddq_s32(lhi, vdupq_n_s32(r_lstepy));
+      pdest += screenwidth;
+      pz += d_zwidth;
+   }
+}
+#endif
+#endif /* D_SIMD_SPANS */
+
+/*
+================
+D_PolysetFillTriangle
+
+Draw the triangle in r_p0, r_p1 and r_p2, which must fit in a tile, with
+d_xdenom already set.
+================
+*/
+static void D_PolysetFillTriangle(int minx, int miny, int maxx, int maxy)
+{
+   polytile_t tile;
+   int *ptop;
+   int i, c[3];
+
+   minx = qmax(minx, r_refdef.vrect.x);
+   miny = qmax(miny, r_refdef.vrect.y);
+   maxx = qmin(maxx, r_refdef.vrectright);
+   maxy = qmin(maxy, r_refdef.vrectbottom);
+   if (minx >= maxx || miny >= maxy)
+      return;
+
+   D_PolysetSetupEdge(r_p0, r_p1, &tile.a[0], &tile.b[0], &c[0]);
+   D_PolysetSetupEdge(r_p1, r_p2, &tile.a[1], &tile.b[1], &c[1]);
+   D_PolysetSetupEdge(r_p2, r_p0, &tile.a[2], &tile.b[2], &c[2]);
+   for (i = 0; i < 3; i++)
+      tile.e[i] = tile.a[i] * minx + tile.b[i] * miny + c[i];
+
+   /*
+    * At a pixel or two across, the gradients make no visible difference, so
+    * skip working them out and draw the triangle flat.
+    */
+   if (maxx - minx <= 2 && maxy - miny <= 2)
+   {
+      r_sstepx = r_tstepx = r_lstepx = r_zistepx = 0;
+      r_sstepy = r_tstepy = r_lstepy = r_zistepy = 0;
+   }
+   else
+      D_PolysetCalcGradients(r_affinetridesc.skinwidth);
+
+   /* interpolate from the top vertex, like the edge walker */
+   ptop = r_p0;
+   if (r_p1[1] < ptop[1])
+      ptop = r_p1;
+   if (r_p2[1] < ptop[1])
+      ptop = r_p2;
+
+   tile.s = ptop[2] + (minx - ptop[0]) * r_sstepx +
+      (miny - ptop[1]) * r_sstepy;
+   tile.t = ptop[3] + (minx - ptop[0]) * r_tstepx +
+      (miny - ptop[1]) * r_tstepy;
+   tile.light = ptop[4] + (minx - ptop[0]) * r_lstepx +
+      (miny - ptop[1]) * r_lstepy;
+   tile.zi = ptop[5] + (minx - ptop[0]) * r_zistepx +
+      (miny - ptop[1]) * r_zistepy;
+
+   tile.width = maxx - minx;
+   tile.height = maxy - miny;
+   tile.pdest = (byte *)d_viewbuffer + miny * screenwidth + minx;
+   tile.pz = d_pzbuffer + miny * d_zwidth + minx;
+
+#ifdef D_SIMD_SPANS
+   /* the last row must not run off the end of the z-buffer */
+   if (tile.pz + (tile.height - 1) * d_zwidth + D_POLY_TILE <=
+         d_pzbuffer + vid.height * d_zwidth)
+      D_PolysetDrawTileSIMD(&tile);
+   else
+#endif
+      D_PolysetDrawTile(&tile);
+}
+
+/*
+================
+D_DrawHalfSpace
+================
+*/
+static void D_DrawHalfSpace(void)
+{
+   int i;
+
+   finalvert_t *pfv = r_affinetridesc.pfinalverts;
+   mtriangle_t *ptri = r_affinetridesc.ptriangles;
+   int lnumtriangles = r_affinetridesc.numtriangles;
+
+   for (i = 0; i < lnumtriangles; i++, ptri++)
+   {
+      int minx, miny, maxx, maxy;
+
+      if (!D_PolysetLoadTriangle(pfv, ptri))
+         continue;
+
+      minx = qmin(r_p0[0], qmin(r_p1[0], r_p2[0]));
+      miny = qmin(r_p0[1], qmin(r_p1[1], r_p2[1]));
+      maxx = qmax(r_p0[0], qmax(r_p1[0], r_p2[0]));
+      maxy = qmax(r_p0[1], qmax(r_p1[1], r_p2[1]));
+
+      if (maxx - minx <= D_POLY_TILE && maxy - miny <= D_POLY_TILE)
+         D_PolysetFillTriangle(minx, miny, maxx, maxy);
+      else
+      {
+         D_PolysetSetEdgeTable();
+         D_RasterizeAliasPolySmooth();
+      }
+   }
+}
@@ -21,85 +21,133 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 //
 // Portable C scan-level rasterization code, all pixel depths.
 
+#include <string.h>
+
 #include "quakedef.h"
 #include "r_local.h"
 #include "d_local.h"
 
-unsigned char *r_turb_pbase, *r_turb_pdest;
-fixed16_t r_turb_s, r_turb_t, r_turb_sstep, r_turb_tstep;
-int *r_turb_turb;
-int r_turb_spancount;
+#if defined(D_SIMD_SPANS) && defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(D_SIMD_SPANS)
+#include <arm_neon.h>
+#endif
 
-void D_DrawTurbulent8Span(void);
+static THREAD_LOCAL unsigned char *r_turb_pbase, *r_turb_pdest;
+static THREAD_LOCAL fixed16_t r_turb_s, r_turb_t, r_turb_sstep, r_turb_tstep;
+static THREAD_LOCAL int *r_turb_turb;
+static THREAD_LOCAL int r_turb_spancount;
 
-/*
-=============
-D_WarpScreen
+static void D_DrawTurbulent8Span(void);
 
-// this performs a slight compression of the screen at the same time as
-// the sine warp, to keep the edges from wrapping
-=============
-*/
-void
-D_WarpScreen(void)
+/*
+ * The warp's row and column tables only depend on the view's layout, so
+ * they're kept until it changes. Rows are held as offsets into the view
+ * buffer, which may be a different one (on the stack) each frame.
+ */
+#define MAX_WARP_JOBS JOB_MAX_SPLIT(MAX_JOB_THREADS)
+#define MIN_WARP_ROWS 16
+
+typedef struct {
+   vrect_t view, screen;
+   int rowbytes;
+} warplayout_t;
+
+static warplayout_t warp_layout;
+static int warp_rows[MAXHEIGHT + TURB_SCREEN_AMP * 2];
+static int warp_columns[MAXWIDTH + TURB_SCREEN_AMP * 2];
+static const int *warp_turb;
+static job_t warp_jobs[MAX_WARP_JOBS];
+
+static void
+D_WarpTables(void)
 {
-   int u, v;
-   byte *dest;
-   int *turb;
-   byte **row;
-   int *column;
-
-   int w = r_refdef.vrect.width;
-   int h = r_refdef.vrect.height;
-
-   float wratio = w / (float)scr_vrect.width;
-   float hratio = h / (float)scr_vrect.height;
+   warplayout_t layout;
+   int u, v, w, h;
+   float wratio, hratio;
+
+   memset(&layout, 0, sizeof(layout));
+   layout.view = r_refdef.vrect;
+   layout.view.pnext = NULL;
+   layout.screen = scr_vrect;
+   layout.screen.pnext = NULL;
+   layout.rowbytes = screenwidth;
+   if (!memcmp(&layout, &warp_layout, sizeof(layout)))
+      return;
+   warp_layout = layout;
 
-   // FIXME - use Zmalloc or similar?
-   // FIXME - rowptr and column are constant for same vidmode?
-   // FIXME - do they cycle?
-   byte **rowptr = (byte**)malloc((scr_vrect.height + TURB_SCREEN_AMP * 2) * sizeof(byte *));
+   w = r_refdef.vrect.width;
+   h = r_refdef.vrect.height;
+   wratio = w / (float)scr_vrect.width;
+   hratio = h / (float)scr_vrect.height;
 
    for (v = 0; v < scr_vrect.height + TURB_SCREEN_AMP * 2; v++)
    {
-      rowptr[v] = d_viewbuffer + (r_refdef.vrect.y * screenwidth) +
+      warp_rows[v] = (r_refdef.vrect.y * screenwidth) +
          (screenwidth * (int)((float)v * hratio * h /
                               (h + TURB_SCREEN_AMP * 2)));
    }
 
-   column = (int*)malloc((scr_vrect.width + TURB_SCREEN_AMP * 2) * sizeof(int));
    for (u = 0; u < scr_vrect.width + TURB_SCREEN_AMP * 2; u++)
    {
-      column[u] = r_refdef.vrect.x +
+      warp_columns[u] = r_refdef.vrect.x +
          (int)((float)u * wratio * w / (w + TURB_SCREEN_AMP * 2));
    }
+}
 
-   turb = intsintable + ((int)(cl.time * TURB_SPEED) & (TURB_CYCLE - 1));
-   dest = vid.buffer + scr_vrect.y * vid.rowbytes + scr_vrect.x;
+static const char *
+D_WarpRows(void *data, int start, int end)
+{
+   const byte *src = (const byte *)data;
+   const int *turb = warp_turb;
+   byte *dest;
+   int u, v;
 
-   for (v = 0; v < scr_vrect.height; v++, dest += vid.rowbytes)
+   dest = vid.buffer + (scr_vrect.y + start) * vid.rowbytes + scr_vrect.x;
+
+   for (v = start; v < end; v++, dest += vid.rowbytes)
    {
-      int *col = &column[turb[v & (TURB_CYCLE - 1)]];
-      row = &rowptr[v];
+      const int *col = &warp_columns[turb[v & (TURB_CYCLE - 1)]];
+      const int *row = &warp_rows[v];
       for (u = 0; u < scr_vrect.width; u += 4)
       {
-         dest[u + 0] = row[turb[(u + 0) & (TURB_CYCLE - 1)]][col[u + 0]];
-         dest[u + 1] = row[turb[(u + 1) & (TURB_CYCLE - 1)]][col[u + 1]];
-         dest[u + 2] = row[turb[(u + 2) & (TURB_CYCLE - 1)]][col[u + 2]];
-         dest[u + 3] = row[turb[(u + 3) & (TURB_CYCLE - 1)]][col[u + 3]];
+         dest[u + 0] = src[row[turb[(u + 0) & (TURB_CYCLE - 1)]] + col[u + 0]];
+         dest[u + 1] = src[row[turb[(u + 1) & (TURB_CYCLE - 1)]] + col[u + 1]];
+         dest[u + 2] = src[row[turb[(u + 2) & (TURB_CYCLE - 1)]] + col[u + 2]];
+         dest[u + 3] = src[row[turb[(u + 3) & (TURB_CYCLE - 1)]] + col[u + 3]];
       }
    }
 
-   free(rowptr);
-   free(column);
+   return NULL;
 }
 
 /*
 =============
-D_DrawTurbulent8Span
+D_WarpScreen
+
+// this performs a slight compression of the screen at the same time as
+// the sine warp, to keep the edges from wrapping
 =============
 */
 void
+D_WarpScreen(void)
+{
+   int numjobs;
+
+   D_WarpTables();
+   warp_turb = intsintable + ((int)(cl.time * TURB_SPEED) & (TURB_CYCLE - 1));
+
+   numjobs = Job_Split(warp_jobs, 0, MAX_WARP_JOBS, D_WarpRows, d_viewbuffer,
+         scr_vrect.height, MIN_WARP_ROWS);
+   Job_RunBatch(warp_jobs, numjobs);
+}
+
+/*
+=============
+D_DrawTurbulent8Span
+=============
+*/
+static void
 D_DrawTurbulent8Span(void)
 {
    do
@@ -257,12 +305,6 @@ FIXME: actually make this subdivide by 16 instead of 8!!!  qb:  OK!!!!
             //unrolled- mh, MK, qbism
             //============================================*/
 
-   static int          count, spancount;
-   static byte         *pbase, *pdest;
-   static fixed16_t    s, t, snext, tnext, sstep, tstep;
-   static float        sdivz, tdivz, zi, z, du, dv, spancountminus1;
-   static float        sdivzstepu, tdivzstepu, zistepu;
-
    int dither_kernel[2][2][2] =
 {
    {
@@ -293,10 +335,16 @@ iditht = iditht ? ((iditht) - 1) : iditht
 //qbism: pointer to pbase and macroize idea from mankrip
 #define WRITEPDEST(i) { pdest[i] = *(pbase + (s >> 16) + (t >> 16) * cachewidth); s+=sstep; t+=tstep;}
 
-extern surfcache_t		*pcurrentcache;
+extern THREAD_LOCAL surfcache_t *pcurrentcache;
 
 void D_DrawSpans16Qb(espan_t *pspan) //qb: up it from 8 to 16.  This + unroll = big speed gain!
 {
+   int count, spancount;
+   byte *pbase, *pdest;
+   fixed16_t s, t, snext, tnext, sstep, tstep;
+   float sdivz, tdivz, zi, z, du, dv, spancountminus1;
+   float sdivzstepu, tdivzstepu, zistepu;
+
    sstep = 0;   // keep compiler happy
    tstep = 0;   // ditto
 
@@ -872,7 +920,7 @@ D_DrawZSpans
 =============
 */
 void
-D_DrawZSpans(espan_t *pspan)
+D_DrawZSpansScalar(espan_t *pspan)
 {
    // FIXME: check for clamping/range problems
    // we count on FP exceptions being turned off to avoid range problems
@@ -918,3 +966,503 @@ D_DrawZSpans(espan_t *pspan)
 
    } while ((pspan = pspan->pnext));
 }
+
+#ifdef D_SIMD_SPANS
+/*
+ * SIMD versions of D_DrawSpans16Qb, D_DrawSpans16QbDither and
+ * D_DrawZSpansScalar. The texel offsets for up to 16 pixels are worked out
+ * at once and only the texel fetches are done one at a time; z values are
+ * written eight at a time. The results are the same as the scalar code's.
+ */
+
+#ifdef __SSE2__
+/*
+ * Texel offsets for 16 pixels, 'dither' holding the s and t dither values
+ * for the even and odd pixels, or NULL.
+ */
+static inline void
+D_SpanOffsets16(int *offsets, fixed16_t s, fixed16_t t, fixed16_t sstep,
+      fixed16_t tstep, const int *dither)
+{
+   const __m128i width = _mm_set1_epi32((cachewidth << 16) | 1);
+   const __m128i himask = _mm_set1_epi32(0xFFFF0000);
+   const __m128i lomask = _mm_set1_epi32(0xFFFF);
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i ones = _mm_set1_epi32(1);
+   __m128i vs, vt, ds, dt, is, it, st;
+   unsigned us = s, ut = t;
+   int i;
+
+   vs = _mm_setr_epi32(us, us + sstep, us + 2u * sstep, us + 3u * sstep);
+   vt = _mm_setr_epi32(ut, ut + tstep, ut + 2u * tstep, ut + 3u * tstep);
+   ds = _mm_set1_epi32(4u * sstep);
+   dt = _mm_set1_epi32(4u * tstep);
+
+   if (!dither) {
+      /* (s >> 16) + (t >> 16) * cachewidth, with one multiply-add */
+      for (i = 0; i < 16; i += 4) {
+         st = _mm_or_si128(_mm_and_si128(vt, himask), _mm_srli_epi32(vs, 16));
+         _mm_storeu_si128((__m128i *)(offsets + i), _mm_madd_epi16(st, width));
+         vs = _mm_add_epi32(vs, ds);
+         vt = _mm_add_epi32(vt, dt);
+      }
+      return;
+   }
+
+   vs = _mm_add_epi32(vs, _mm_setr_epi32(dither[0], dither[2], dither[0], dither[2]));
+   vt = _mm_add_epi32(vt, _mm_setr_epi32(dither[1], dither[3], dither[1], dither[3]));
+   for (i = 0; i < 16; i += 4) {
+      /* x = x ? x - 1 : x, as in DITHERED_SOLID_UPDATE */
+      is = _mm_srai_epi32(vs, 16);
+      is = _mm_sub_epi32(_mm_sub_epi32(is, ones), _mm_cmpeq_epi32(is, zero));
+      it = _mm_srai_epi32(vt, 16);
+      it = _mm_sub_epi32(_mm_sub_epi32(it, ones), _mm_cmpeq_epi32(it, zero));
+      st = _mm_or_si128(_mm_slli_epi32(it, 16), _mm_and_si128(is, lomask));
+      _mm_storeu_si128((__m128i *)(offsets + i), _mm_madd_epi16(st, width));
+      vs = _mm_add_epi32(vs, ds);
+      vt = _mm_add_epi32(vt, dt);
+   }
+}
+
+/*
+ * Write 'count' z values, pairs at a time like D_DrawZSpansScalar does. Note
+ * the scalar code doesn't mask off the sign when packing a pair, so the
+ * second of a pair comes out as -1 if the first is negative. Long spans go
+ * out 16 values (a 32 byte line of the z buffer) at a time, aligned.
+ */
+static inline void
+D_ZSpan(int16_t *pdest, int count, int izi, int izistep)
+{
+   const __m128i himask = _mm_set1_epi32(0xFFFF0000);
+   unsigned ui = izi;
+   __m128i even, odd, step2, step8;
+
+   if ((long)pdest & 0x02)
+   {
+      *pdest++ = (short)((int)ui >> 16);
+      ui += izistep;
+      count--;
+   }
+
+   /* pairs up to a 16 byte boundary, so stores don't straddle lines */
+   for (; count >= 2 && ((long)pdest & 0x0c); count -= 2)
+   {
+      unsigned ltemp = (int)ui >> 16;
+      ui += izistep;
+      ltemp |= ui & 0xFFFF0000;
+      ui += izistep;
+      *(int *)pdest = ltemp;
+      pdest += 2;
+   }
+
+   even = _mm_setr_epi32(ui, ui + 2u * izistep, ui + 4u * izistep,
+         ui + 6u * izistep);
+   step2 = _mm_set1_epi32(izistep);
+   step8 = _mm_set1_epi32(8u * izistep);
+   for (; count >= 16; count -= 16)
+   {
+      odd = _mm_add_epi32(even, step2);
+      _mm_store_si128((__m128i *)pdest,
+            _mm_or_si128(_mm_srai_epi32(even, 16), _mm_and_si128(odd, himask)));
+      even = _mm_add_epi32(even, step8);
+      odd = _mm_add_epi32(even, step2);
+      _mm_store_si128((__m128i *)(pdest + 8),
+            _mm_or_si128(_mm_srai_epi32(even, 16), _mm_and_si128(odd, himask)));
+      even = _mm_add_epi32(even, step8);
+      pdest += 16;
+      ui += 16u * izistep;
+   }
+   if (count >= 8)
+   {
+      odd = _mm_add_epi32(even, step2);
+      _mm_store_si128((__m128i *)pdest,
+            _mm_or_si128(_mm_srai_epi32(even, 16), _mm_and_si128(odd, himask)));
+      pdest += 8;
+      ui += 8u * izistep;
+      count -= 8;
+   }
+   for (; count >= 2; count -= 2)
+   {
+      unsigned ltemp = (int)ui >> 16;
+      ui += izistep;
+      ltemp |= ui & 0xFFFF0000;
+      ui += izistep;
+      *(int *)pdest = ltemp;
+      pdest += 2;
+   }
+   if (count)
+      *pdest = (short)((int)ui >> 16);
+}
+#else /* NEON */
+static inline void
+D_SpanOffsets16(int *offsets, fixed16_t s, fixed16_t t, fixed16_t sstep,
+      fixed16_t tstep, const int *dither)
+{
+   static const int32_t ramp[4] = { 0, 1, 2, 3 };
+   const int32x4_t vramp = vld1q_s32(ramp);
+   const int32x4_t width = vdupq_n_s32(cachewidth);
+   const int32x4_t ones = vdupq_n_s32(1);
+   const int32x4_t zero = vdupq_n_s32(0);
+   int32x4_t vs, vt, ds, dt, is, it;
+   int i;
+
+   vs = vmlaq_n_s32(vdupq_n_s32(s), vramp, sstep);
+   vt = vmlaq_n_s32(vdupq_n_s32(t), vramp, tstep);
+   ds = vdupq_n_s32(4u * sstep);
+   dt = vdupq_n_s32(4u * tstep);
+
+   if (!dither) {
+      for (i = 0; i < 16; i += 4) {
+         vst1q_s32(offsets + i, vmlaq_s32(vshrq_n_s32(vs, 16),
+                  vshrq_n_s32(vt, 16), width));
+         vs = vaddq_s32(vs, ds);
+         vt = vaddq_s32(vt, dt);
+      }
+      return;
+   }
+
+   {
+      const int32_t ds_dither[4] = { dither[0], dither[2], dither[0], dither[2] };
+      const int32_t dt_dither[4] = { dither[1], dither[3], dither[1], dither[3] };
+      vs = vaddq_s32(vs, vld1q_s32(ds_dither));
+      vt = vaddq_s32(vt, vld1q_s32(dt_dither));
+   }
+   for (i = 0; i < 16; i += 4) {
+      /* x = x ? x - 1 : x, as in DITHERED_SOLID_UPDATE */
+      is = vshrq_n_s32(vs, 16);
+      is = vsubq_s32(vsubq_s32(is, ones),
+            vreinterpretq_s32_u32(vceqq_s32(is, zero)));
+      it = vshrq_n_s32(vt, 16);
+      it = vsubq_s32(vsubq_s32(it, ones),
+            vreinterpretq_s32_u32(vceqq_s32(it, zero)));
+      vst1q_s32(offsets + i, vmlaq_s32(is, it, width));
+      vs = vaddq_s32(vs, ds);
+      vt = vaddq_s32(vt, dt);
+   }
+}
+
+static inline void
+D_ZSpan(int16_t *pdest, int count, int izi, int izistep)
+{
+   static const int32_t ramp[4] = { 0, 2, 4, 6 };
+   const uint32x4_t himask = vdupq_n_u32(0xFFFF0000);
+   unsigned ui = izi;
+   int32x4_t even, odd, step2, step8;
+   uint32x4_t words, words2;
+
+   if ((long)pdest & 0x02)
+   {
+      *pdest++ = (short)((int)ui >> 16);
+      ui += izistep;
+      count--;
+   }
+
+   /* pairs up to a 16 byte boundary, so stores don't straddle lines */
+   for (; count >= 2 && ((long)pdest & 0x0c); count -= 2)
+   {
+      unsigned ltemp = (int)ui >> 16;
+      ui += izistep;
+      ltemp |= ui & 0xFFFF0000;
+      ui += izistep;
+      *(int *)pdest = ltemp;
+      pdest += 2;
+   }
+
+   even = vmlaq_n_s32(vdupq_n_s32(ui), vld1q_s32(ramp), izistep);
+   step2 = vdupq_n_s32(izistep);
+   step8 = vdupq_n_s32(8u * izistep);
+   for (; count >= 16; count -= 16)
+   {
+      odd = vaddq_s32(even, step2);
+      words = vorrq_u32(vreinterpretq_u32_s32(vshrq_n_s32(even, 16)),
+            vandq_u32(vreinterpretq_u32_s32(odd), himask));
+      even = vaddq_s32(even, step8);
+      odd = vaddq_s32(even, step2);
+      words2 = vorrq_u32(vreinterpretq_u32_s32(vshrq_n_s32(even, 16)),
+            vandq_u32(vreinterpretq_u32_s32(odd), himask));
+      vst1q_u32((uint32_t *)pdest, words);
+      vst1q_u32((uint32_t *)(pdest + 8), words2);
+      even = vaddq_s32(even, step8);
+      pdest += 16;
+      ui += 16u * izistep;
+   }
+   if (count >= 8)
+   {
+      odd = vaddq_s32(even, step2);
+      words = vorrq_u32(vreinterpretq_u32_s32(vshrq_n_s32(even, 16)),
+            vandq_u32(vreinterpretq_u32_s32(odd), himask));
+      vst1q_u32((uint32_t *)pdest, words);
+      pdest += 8;
+      ui += 8u * izistep;
+      count -= 8;
+   }
+   for (; count >= 2; count -= 2)
+   {
+      unsigned ltemp = (int)ui >> 16;
+      ui += izistep;
+      ltemp |= ui & 0xFFFF0000;
+      ui += izistep;
+      *(int *)pdest = ltemp;
+      pdest += 2;
+   }
+   if (count)
+      *pdest = (short)((int)ui >> 16);
+}
+#endif
+
+void D_DrawSpans16QbSIMD(espan_t *pspan)
+{
+   int count, spancount, i;
+   byte *pbase, *pdest;
+   fixed16_t s, t, snext, tnext, sstep, tstep;
+   float sdivz, tdivz, zi, z, du, dv, spancountminus1;
+   float sdivzstepu, tdivzstepu, zistepu;
+   int offsets[16];
+
+   sstep = 0;   // keep compiler happy
+   tstep = 0;   // ditto
+
+   pbase = (byte *)cacheblock;
+   sdivzstepu = d_sdivzstepu * 16;
+   tdivzstepu = d_tdivzstepu * 16;
+   zistepu = d_zistepu * 16;
+
+   do
+   {
+      pdest = (byte *)((byte *)d_viewbuffer + (screenwidth * pspan->v) + pspan->u);
+      count = pspan->count >> 4;
+
+      spancount = pspan->count % 16;
+
+      // calculate the initial s/z, t/z, 1/z, s, and t and clamp
+      du = (float)pspan->u;
+      dv = (float)pspan->v;
+
+      sdivz = d_sdivzorigin + dv*d_sdivzstepv + du*d_sdivzstepu;
+      tdivz = d_tdivzorigin + dv*d_tdivzstepv + du*d_tdivzstepu;
+      zi = d_ziorigin + dv*d_zistepv + du*d_zistepu;
+      z = (float)0x10000 / zi;   // prescale to 16.16 fixed-point
+
+      s = (int)(sdivz * z) + sadjust;
+      if (s < 0) s = 0;
+      else if (s > bbextents) s = bbextents;
+
+      t = (int)(tdivz * z) + tadjust;
+      if (t < 0) t = 0;
+      else if (t > bbextentt) t = bbextentt;
+
+      while (count-- > 0)
+      {
+         sdivz += sdivzstepu;
+         tdivz += tdivzstepu;
+         zi += zistepu;
+         z = (float)0x10000 / zi;   // prescale to 16.16 fixed-point
+
+         snext = (int)(sdivz * z) + sadjust;
+         if (snext < 16) snext = 16;
+         else if (snext > bbextents) snext = bbextents;
+
+         tnext = (int)(tdivz * z) + tadjust;
+         if (tnext < 16) tnext = 16;
+         else if (tnext > bbextentt) tnext = bbextentt;
+
+         sstep = (snext - s) >> 4;
+         tstep = (tnext - t) >> 4;
+
+         D_SpanOffsets16(offsets, s, t, sstep, tstep, NULL);
+         for (i = 0; i < 16; i++)
+            pdest[i] = pbase[offsets[i]];
+         pdest += 16;
+
+         s = snext;
+         t = tnext;
+      }
+      if (spancount > 0)
+      {
+         spancountminus1 = (float)(spancount - 1);
+         sdivz += d_sdivzstepu * spancountminus1;
+         tdivz += d_tdivzstepu * spancountminus1;
+         zi += d_zistepu * spancountminus1;
+         z = (float)0x10000 / zi;   // prescale to 16.16 fixed-point
+
+         snext = (int)(sdivz * z) + sadjust;
+         if (snext < 16) snext = 16;
+         else if (snext > bbextents) snext = bbextents;
+
+         tnext = (int)(tdivz * z) + tadjust;
+         if (tnext < 16) tnext = 16;
+         else if (tnext > bbextentt) tnext = bbextentt;
+
+         if (spancount > 1)
+         {
+            sstep = (snext - s) / (spancount - 1);
+            tstep = (tnext - t) / (spancount - 1);
+         }
+
+         D_SpanOffsets16(offsets, s, t, sstep, tstep, NULL);
+         for (i = 0; i < spancount; i++)
+            pdest[i] = pbase[offsets[i]];
+      }
+   } while ((pspan = pspan->pnext) != NULL);
+}
+
+void D_DrawSpans16QbDitherSIMD(espan_t *pspan)
+{
+   int spancount, i;
+   uint8_t *pbase;
+   fixed16_t snext, tnext, sstep, tstep;
+   float sdivzstepu, tdivzstepu, zistepu;
+   int offsets[16], dither[4];
+
+   // mipmaps shouldn't be dithered
+   if (pcurrentcache->mipscale < 1.0f)
+   {
+      D_DrawSpans16QbSIMD(pspan);
+      return;
+   }
+
+   sstep = 0; // keep compiler happy
+   tstep = 0; // ditto
+
+   pbase      = (uint8_t*)cacheblock;
+   sdivzstepu = d_sdivzstepu * 16;
+   tdivzstepu = d_tdivzstepu * 16;
+   zistepu    = d_zistepu * 16;
+
+   do
+   {
+      fixed16_t t;
+      int count = pspan->count;
+      // calculate the initial s/z, t/z, 1/z, s, and t and clamp
+      float du = (float)pspan->u;
+      float dv = (float)pspan->v;
+
+      float sdivz = d_sdivzorigin + dv*d_sdivzstepv + du*d_sdivzstepu;
+      float tdivz = d_tdivzorigin + dv*d_tdivzstepv + du*d_tdivzstepu;
+      float zi = d_ziorigin + dv*d_zistepv + du*d_zistepu;
+      float z = (float)0x10000 / zi; // prescale to 16.16 fixed-point
+
+      fixed16_t s = (int)(sdivz * z) + sadjust;
+
+      uint8_t *pdest = (uint8_t*)((byte *)d_viewbuffer +
+            (screenwidth * pspan->v) + pspan->u);
+
+      if (s > bbextents)
+         s = bbextents;
+      else if (s < 0)
+         s = 0;
+
+      t = (int)(tdivz * z) + tadjust;
+      if (t > bbextentt)
+         t = bbextentt;
+      else if (t < 0)
+         t = 0;
+
+      do
+      {
+         int X, Y, A, B;
+
+         // calculate s and t at the far end of the span
+         if (count >= 16)
+            spancount = 16;
+         else
+            spancount = count;
+
+         count -= spancount;
+
+         if (count)
+         {
+            sdivz += sdivzstepu;
+            tdivz += tdivzstepu;
+            zi += zistepu;
+            z = (float)0x10000 / zi; // prescale to 16.16 fixed-point
+
+            snext = (int)(sdivz * z) + sadjust;
+            if (snext > bbextents)
+               snext = bbextents;
+            else if (snext <= 16)
+               snext = 16;
+
+            tnext = (int)(tdivz * z) + tadjust;
+            if (tnext > bbextentt)
+               tnext = bbextentt;
+            else if (tnext < 16)
+               tnext = 16;
+
+            sstep = (snext - s) >> 4;
+            tstep = (tnext - t) >> 4;
+         }
+         else
+         {
+            float spancountminus1 = (float)(spancount - 1);
+            sdivz += d_sdivzstepu * spancountminus1;
+            tdivz += d_tdivzstepu * spancountminus1;
+            zi += d_zistepu * spancountminus1;
+            z = (float)0x10000 / zi; // prescale to 16.16 fixed-point
+            snext = (int)(sdivz * z) + sadjust;
+            if (snext > bbextents)
+               snext = bbextents;
+            else if (snext < 16)
+               snext = 16;
+
+            tnext = (int)(tdivz * z) + tadjust;
+            if (tnext > bbextentt)
+               tnext = bbextentt;
+            else if (tnext < 16)
+               tnext = 16;
+
+            if (spancount > 1)
+            {
+               sstep = (snext - s) / (spancount - 1);
+               tstep = (tnext - t) / (spancount - 1);
+            }
+         }
+
+         /*
+          * Pixels an even number from the end of the block use
+          * dither_kernel[X], the others dither_kernel[!X].
+          */
+         X = (pspan->u + spancount) & 1;
+         Y = (pspan->v) & 1;
+         A = (spancount & 1) ? !X : X;
+         B = !A;
+         dither[0] = dither_kernel[A][Y][0];
+         dither[1] = dither_kernel[A][Y][1];
+         dither[2] = dither_kernel[B][Y][0];
+         dither[3] = dither_kernel[B][Y][1];
+
+         D_SpanOffsets16(offsets, s, t, sstep, tstep, dither);
+         for (i = 0; i < spancount; i++)
+            pdest[i] = pbase[offsets[i]];
+         pdest += spancount;
+
+         s = snext;
+         t = tnext;
+
+      } while (count > 0);
+
+   } while ((pspan = pspan->pnext) != NULL);
+}
+
+void
+D_DrawZSpansSIMD(espan_t *pspan)
+{
+   // we count on FP exceptions being turned off to avoid range problems
+   int izistep = (int)(d_zistepu * 0x8000 * 0x10000);
+
+   do
+   {
+      int16_t *pdest = d_pzbuffer + (d_zwidth * pspan->v) + pspan->u;
+
+      // calculate the initial 1/z
+      float du = (float)pspan->u;
+      float dv = (float)pspan->v;
+
+      double zi = d_ziorigin + dv * d_zistepv + du * d_zistepu;
+      // we count on FP exceptions being turned off to avoid range problems
+      int izi = (int)(zi * 0x8000 * 0x10000);
+
+      D_ZSpan(pdest, pspan->count, izi, izistep);
+   } while ((pspan = pspan->pnext));
+}
+#endif /* D_SIMD_SPANS */
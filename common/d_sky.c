@@ -26,11 +26,17 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define SKY_SPAN_SHIFT	5
 #define SKY_SPAN_MAX	(1 << SKY_SPAN_SHIFT)
 
-static float   timespeed1, timespeed2; // Manoel Kasimier - smooth sky
+static THREAD_LOCAL float timespeed1, timespeed2; // Manoel Kasimier - smooth sky
 
 byte *skyunderlay;
 byte *skyoverlay;
 
+cvar_t d_skycomposite = { "d_skycomposite", "1", true };
+
+/* the overlay laid over the underlay, as they line up this frame */
+static byte skycomposite[SKYSIZE * SKYSIZE];
+static int skycomposite_frame;
+
 /*
 =================
 D_Sky_uv_To_st
@@ -63,6 +69,129 @@ unsigned char D_DrawSkyPixelOpaque (unsigned char pixel1, unsigned char pixel2)
    return pixel2 ? pixel2 : pixel1;
 }
 
+/*
+=================
+D_SetSkyFrame
+
+The overlay's s and t run ahead of the underlay's by skytime * skyspeed
+texels. Here that's rounded to whole texels, so the clouds move against
+the sky behind them a texel at a time rather than smoothly.
+=================
+*/
+void D_SetSkyFrame (void)
+{
+   const byte *under, *over;
+   byte *dest, pixel;
+   int s, t, shift;
+
+   if (!d_skycomposite.value || skycomposite_frame == r_framecount)
+      return;
+   skycomposite_frame = r_framecount;
+
+   shift = (int)(skytime * skyspeed + 0.5f);
+   dest = skycomposite;
+   for (t = 0; t < SKYSIZE; t++)
+   {
+      under = skyunderlay + t * SKYSIZE * 2;
+      over = skyoverlay + ((t + shift) & SKYMASK) * SKYSIZE * 2;
+      for (s = 0; s < SKYSIZE; s++)
+      {
+         pixel = over[(s + shift) & SKYMASK];
+         *dest++ = pixel ? pixel : under[s];
+      }
+   }
+}
+
+/*
+=================
+D_SkyComposite_uv_To_st
+
+D_Sky_uv_To_st for the underlay only
+=================
+*/
+static void D_SkyComposite_uv_To_st (int u, int v, fixed16_t *s, fixed16_t *t)
+{
+   vec3_t   end;
+   float wu = (u - xcenter) / xscale;
+   float wv = (ycenter - v) / yscale;
+
+   end[0] = vpn[0] + wu*vright[0] + wv*vup[0];
+   end[1] = vpn[1] + wu*vright[1] + wv*vup[1];
+   end[2] = vpn[2] + wu*vright[2] + wv*vup[2];
+   end[2] *= 3;
+   VectorNormalize (end);
+   *s = (int)((timespeed1 + 6*(SKYSIZE/2-1)*end[0]) * 0x10000);
+   *t = (int)((timespeed1 + 6*(SKYSIZE/2-1)*end[1]) * 0x10000);
+}
+
+/*
+=================
+D_DrawSkyScansComposite
+=================
+*/
+static void D_DrawSkyScansComposite (espan_t *pspan)
+{
+   fixed16_t      s, t;
+   fixed16_t sstep = 0;   // keep compiler happy
+   fixed16_t tstep = 0;   // ditto
+
+   timespeed1=skytime*skyspeed;
+
+   do
+   {
+      fixed16_t      snext = 0, tnext = 0;
+      uint8_t *pdest = (uint8_t*)((byte *)d_viewbuffer +
+            (screenwidth * pspan->v) + pspan->u);
+      int count      = pspan->count;
+      int u = pspan->u;
+      int v = pspan->v;
+
+      D_SkyComposite_uv_To_st (u, v, &s, &t);
+
+      do
+      {
+         int spancount    = count;
+
+         if (count >= SKY_SPAN_MAX)
+            spancount = SKY_SPAN_MAX;
+
+         count -= spancount;
+
+         if (count)
+         {
+            u += spancount;
+            D_SkyComposite_uv_To_st (u, v, &snext, &tnext);
+            sstep = (snext - s) >> SKY_SPAN_SHIFT;
+            tstep = (tnext - t) >> SKY_SPAN_SHIFT;
+         }
+         else
+         {
+            int spancountminus1 = spancount - 1;
+
+            if (spancountminus1 > 0)
+            {
+               u += spancountminus1;
+               D_SkyComposite_uv_To_st (u, v, &snext, &tnext);
+               sstep = (snext - s) / spancountminus1;
+               tstep = (tnext - t) / spancountminus1;
+            }
+         }
+
+         do
+         {
+            *pdest++ = skycomposite[((t & R_SKY_TMASK) >> (16 - SKYSHIFT))
+               + ((s & R_SKY_SMASK) >> 16)];
+            s += sstep;
+            t += tstep;
+         } while (--spancount > 0);
+
+         s = snext;
+         t = tnext;
+
+      } while (count > 0);
+   } while ((pspan = pspan->pnext) != NULL);
+}
+
 /*
 =================
 D_DrawSkyScans8
@@ -74,6 +203,12 @@ void D_DrawSkyScans8 (espan_t *pspan)
    fixed16_t sstep = 0;   // keep compiler happy
    fixed16_t tstep = 0;   // ditto
 
+   if (d_skycomposite.value)
+   {
+      D_DrawSkyScansComposite (pspan);
+      return;
+   }
+
    timespeed1=skytime*skyspeed;
    timespeed2=timespeed1*2.0;
 
@@ -19,8 +19,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // d_surf.c: rasterization driver surface heap manager
 
+#include <stdlib.h>
+
+#include "cmd.h"
 #include "console.h"
 #include "d_local.h"
+#include "jobs.h"
 #include "quakedef.h"
 #include "r_local.h"
 #include "sys.h"
@@ -37,6 +41,31 @@ surfcache_t *sc_rover, *sc_base;
 
 #define GUARDSIZE       4
 
+/*
+ * With d_surfcache_auto set, a cache allocated by D_AllocCaches is doubled
+ * (up to d_surfcache_max kilobytes) once it has turned over more than
+ * 1/SC_GROWTURNOVER of itself a frame for SC_GROWFRAMES frames running:
+ * then it holds only a few frames' worth of surfaces, and what's in view
+ * is being rebuilt as fast as it is thrown out.
+ */
+#define SC_GROWTURNOVER	8
+#define SC_GROWFRAMES	30
+
+static cvar_t d_surfcache_auto = { "d_surfcache_auto", "1", true };
+static cvar_t d_surfcache_max = { "d_surfcache_max", "65536", true };
+
+static byte *sc_buffer;		/* from D_AllocCaches, NULL if passed in */
+static int sc_frameevictbytes;	/* of the c_surfevicted */
+static int sc_thrashframes;	/* frames running over the turnover */
+
+static struct {
+   int frames;
+   int built;
+   int evicted;
+   int wraps;
+   int grown;
+} sc_stats;
+
 int D_SurfaceCacheForRes(int width, int height)
 {
    int size, pix;
@@ -97,10 +126,110 @@ D_InitCaches(void *buffer, int size)
     sc_base->next = NULL;
     sc_base->owner = NULL;
     sc_base->size = sc_size;
+    sc_base->drawbatch = 0;
+
+    sc_frameevictbytes = 0;
+    sc_thrashframes = 0;
 
     D_ClearCacheGuard();
 }
 
+/*
+================
+D_AllocCaches
+
+A cache of its own, that d_surfcache_auto may grow
+================
+*/
+void
+D_AllocCaches(int size)
+{
+   D_FreeCaches();
+   sc_buffer = (byte*)malloc(size);
+   if (!sc_buffer)
+      Sys_Error("%s: couldn't allocate %ik", __func__, size / 1024);
+   D_InitCaches(sc_buffer, size);
+}
+
+void
+D_FreeCaches(void)
+{
+   if (!sc_buffer)
+      return;
+
+   free(sc_buffer);
+   sc_buffer = NULL;
+   sc_base = sc_rover = NULL;
+   sc_size = 0;
+}
+
+/*
+ * Surfaces are freed from under their owners as the rover comes round;
+ * counts those that were still around to be used
+ */
+static void
+D_SCEvict(surfcache_t *cache)
+{
+   if (!cache->owner)
+      return;
+
+   *cache->owner = NULL;
+   cache->owner = NULL;
+   c_surfevicted++;
+   sc_frameevictbytes += cache->size;
+}
+
+/*
+================
+D_AdaptCaches
+
+Called between frames, with the last frame's counts still standing and
+nothing waiting to be drawn from the cache
+================
+*/
+static void
+D_AdaptCaches(void)
+{
+   byte *buffer;
+   int size, max;
+
+   sc_stats.frames++;
+   sc_stats.built += c_surf;
+   sc_stats.evicted += c_surfevicted;
+
+   if (sc_frameevictbytes > sc_size / SC_GROWTURNOVER)
+      sc_thrashframes++;
+   else
+      sc_thrashframes = 0;
+   sc_frameevictbytes = 0;
+
+   if (!sc_buffer || !d_surfcache_auto.value
+         || sc_thrashframes < SC_GROWFRAMES)
+      return;
+   sc_thrashframes = 0;
+
+   max = (int)d_surfcache_max.value * 1024;
+   size = (sc_size + GUARDSIZE) * 2;
+   if (size > max)
+      size = max;
+   if (size <= sc_size + GUARDSIZE)
+      return;
+
+   /* keep the old one if there's not the memory for the new */
+   buffer = (byte*)malloc(size);
+   if (!buffer)
+      return;
+
+   D_FlushCaches();
+   free(sc_buffer);
+   sc_buffer = buffer;
+   msg_suppress_1 = true;
+   D_InitCaches(sc_buffer, size);
+   msg_suppress_1 = false;
+   sc_stats.grown++;
+   Con_DPrintf("Surface cache grown to %ik\n", size / 1024);
+}
+
 
 /*
 ==================
@@ -125,6 +254,7 @@ D_FlushCaches(void)
    sc_base->next = NULL;
    sc_base->owner = NULL;
    sc_base->size = sc_size;
+   sc_base->drawbatch = 0;
 }
 
 /*
@@ -160,16 +290,18 @@ D_SCAlloc(int width, int size)
    }
    // colect and free surfcache_t blocks until the rover block is large enough
    new_surf = sc_rover;
-   if (sc_rover->owner)
-      *sc_rover->owner = NULL;
+   if (sc_rover->drawbatch == d_drawbatch)
+      D_DrawBatch();
+   D_SCEvict(sc_rover);
 
    while (new_surf->size < size) {
       // free another
       sc_rover = sc_rover->next;
       if (!sc_rover)
          Sys_Error("%s: hit the end of memory", __func__);
-      if (sc_rover->owner)
-         *sc_rover->owner = NULL;
+      if (sc_rover->drawbatch == d_drawbatch)
+         D_DrawBatch();
+      D_SCEvict(sc_rover);
 
       new_surf->size += sc_rover->size;
       new_surf->next = sc_rover->next;
@@ -182,6 +314,8 @@ D_SCAlloc(int width, int size)
       sc_rover->next = new_surf->next;
       sc_rover->width = 0;
       sc_rover->owner = NULL;
+      sc_rover->drawbatch = 0;
+      sc_rover->buildframe = 0;
       new_surf->next = sc_rover;
       new_surf->size = size;
    } else
@@ -193,7 +327,11 @@ D_SCAlloc(int width, int size)
       new_surf->height = (size - sizeof(*new_surf) + sizeof(new_surf->data)) / width;
 
    new_surf->owner = NULL;		// should be set properly after return
+   new_surf->drawbatch = 0;
+   new_surf->buildframe = 0;
 
+   if (wrapped_this_time)
+      sc_stats.wraps++;
    if (d_roverwrapped) {
       if (wrapped_this_time || (sc_rover >= d_initial_rover))
          r_cache_thrash = true;
@@ -224,6 +362,66 @@ D_SCDump(void)
    }
 }
 
+static void
+D_SurfCache_f(void)
+{
+   surfcache_t *cache;
+   int blocks, used;
+
+   if (!sc_base)
+   {
+      Con_Printf("No surface cache\n");
+      return;
+   }
+   if (Cmd_Argc() == 2 && !strcmp(Cmd_Argv(1), "reset"))
+   {
+      memset(&sc_stats, 0, sizeof(sc_stats));
+      return;
+   }
+
+   blocks = used = 0;
+   for (cache = sc_base; cache; cache = cache->next)
+   {
+      if (!cache->owner)
+         continue;
+      blocks++;
+      used += cache->size;
+   }
+
+   Con_Printf("%ik surface cache, %ik (%i%%) in use by %i surfaces\n",
+         (sc_size + GUARDSIZE) / 1024, used / 1024,
+         (int)((double)used * 100 / sc_size), blocks);
+   Con_Printf("%i frames: %i built, %i evicted, %i wraps, grown %i times\n",
+         sc_stats.frames, sc_stats.built, sc_stats.evicted, sc_stats.wraps,
+         sc_stats.grown);
+   if (sc_stats.frames)
+      Con_Printf("%.1f built and %.1f evicted a frame\n",
+            (double)sc_stats.built / sc_stats.frames,
+            (double)sc_stats.evicted / sc_stats.frames);
+}
+
+void
+D_InitSurfCache(void)
+{
+   Cvar_RegisterVariable(&d_surfcache_auto);
+   Cvar_RegisterVariable(&d_surfcache_max);
+   Cmd_AddCommand("surfcache", D_SurfCache_f);
+}
+
+/*
+================
+D_SetupSurfCache
+
+Called as each frame starts, to look back at the last
+================
+*/
+void
+D_SetupSurfCache(void)
+{
+   if (sc_base)
+      D_AdaptCaches();
+}
+
 //=============================================================================
 
 /* if the num is not a power of 2, assume it will not repeat */
@@ -256,13 +454,43 @@ D_log2(int num)
 
 //=============================================================================
 
+/*
+ * Surfaces queued by D_QueueSurface wait here until D_BuildSurfaces builds
+ * them on the job threads.
+ */
+#define MAX_SURF_BUILDS 256
+#define MAX_BUILD_JOBS JOB_MAX_SPLIT(MAX_JOB_THREADS)
+
+static drawsurf_t d_surfbuilds[MAX_SURF_BUILDS];
+static int d_numsurfbuilds;
+static job_t d_buildjobs[MAX_BUILD_JOBS];
+
+/*
+ * True if the cached copy was lit by the dynamic lights on the surface now:
+ * by none then or now, or by the same ones earlier this frame
+ */
+static inline qboolean
+D_CacheDlightsMatch(const surfcache_t *cache, const msurface_t *surface)
+{
+   if (surface->dlightframe != r_framecount)
+      return !cache->dlight;
+
+   return cache->dlight && cache->buildframe == r_framecount
+      && !memcmp(cache->dlightbits, surface->dlightbits,
+            sizeof(cache->dlightbits));
+}
+
 /*
 ================
-D_CacheSurface
+D_SetupCacheSurface
+
+Set up r_drawsurf for the surface and make sure it has a cache block.
+Returns NULL if the cached copy is still good, otherwise the block that
+needs building.
 ================
 */
-surfcache_t *
-D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
+static surfcache_t *
+D_SetupCacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
 {
    surfcache_t *cache;
 
@@ -276,13 +504,20 @@ D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
    /* see if the cache holds apropriate data */
    cache = surface->cachespots[miplevel];
 
-   if (cache && !cache->dlight && surface->dlightframe != r_framecount
+   if (cache && D_CacheDlightsMatch(cache, surface)
          && cache->texture == r_drawsurf.texture
          && cache->lightadj[0] == r_drawsurf.lightadj[0]
          && cache->lightadj[1] == r_drawsurf.lightadj[1]
          && cache->lightadj[2] == r_drawsurf.lightadj[2]
          && cache->lightadj[3] == r_drawsurf.lightadj[3])
-      return cache;
+   {
+      c_surfcached++;
+      return NULL;
+   }
+
+   /* don't change a surface that is still waiting to be drawn */
+   if (cache && cache->drawbatch == d_drawbatch)
+      D_DrawBatch();
 
    /* determine shape of surface */
    surfscale = 1.0 / (1 << miplevel);
@@ -303,7 +538,11 @@ D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
    }
 
    if (surface->dlightframe == r_framecount)
+   {
       cache->dlight = 1;
+      memcpy(cache->dlightbits, surface->dlightbits,
+            sizeof(cache->dlightbits));
+   }
    else
       cache->dlight = 0;
 
@@ -314,12 +553,92 @@ D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
    cache->lightadj[1] = r_drawsurf.lightadj[1];
    cache->lightadj[2] = r_drawsurf.lightadj[2];
    cache->lightadj[3] = r_drawsurf.lightadj[3];
+   cache->buildframe = r_framecount;
 
-   /* draw and light the surface texture */
    r_drawsurf.surf = surface;
-
    c_surf++;
-   R_DrawSurface();
+
+   return cache;
+}
+
+/*
+================
+D_CacheSurface
+================
+*/
+surfcache_t *
+D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
+{
+   /* draw and light the surface texture */
+   if (D_SetupCacheSurface(e, surface, miplevel))
+      R_DrawSurface();
 
    return surface->cachespots[miplevel];
 }
+
+/*
+================
+D_QueueSurface
+================
+*/
+void
+D_QueueSurface(const entity_t *e, msurface_t *surface, int miplevel)
+{
+   surfcache_t *cache;
+
+   /*
+    * If the surface is already in use this batch (a brush model drawn more
+    * than once), leave any rebuild to D_CacheSurface.
+    */
+   cache = surface->cachespots[miplevel];
+   if (cache && cache->drawbatch == d_drawbatch)
+      return;
+
+   cache = D_SetupCacheSurface(e, surface, miplevel);
+   if (!cache)
+      return;
+
+   if (d_numsurfbuilds == MAX_SURF_BUILDS)
+      D_BuildSurfaces();
+   d_surfbuilds[d_numsurfbuilds++] = r_drawsurf;
+   cache->drawbatch = d_drawbatch;
+}
+
+static const char *
+D_BuildSurfaceJob(void *data, int start, int end)
+{
+   int i;
+
+   for (i = start; i < end; i++)
+   {
+      r_drawsurf = d_surfbuilds[i];
+      R_DrawSurface();
+   }
+
+   return NULL;
+}
+
+/*
+================
+D_BuildSurfaces
+================
+*/
+void
+D_BuildSurfaces(void)
+{
+   drawsurf_t save_drawsurf;
+   int numjobs;
+
+   if (!d_numsurfbuilds)
+      return;
+
+   /* This thread builds surfaces too; it may be in the middle of one */
+   save_drawsurf = r_drawsurf;
+
+   numjobs = Job_Split(d_buildjobs, 0, MAX_BUILD_JOBS, D_BuildSurfaceJob,
+         NULL, d_numsurfbuilds, 1);
+   Job_RunBatch(d_buildjobs, numjobs);
+   d_numsurfbuilds = 0;
+
+   r_drawsurf = save_drawsurf;
+}
@@ -21,9 +21,15 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // draw.c -- this is the only file outside the refresh that touches the
 // vid buffer
 
+#include <stdio.h>
+#include <string.h>
+
 #include "common.h"
 #include "console.h"
+#include "crc.h"
 #include "d_iface.h"
+#include "jobs.h"
+#include "namehash.h"
 #include "quakedef.h"
 #include "sys.h"
 #include "vid.h"
@@ -39,6 +45,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "client.h"
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 typedef struct {
     vrect_t rect;
     int width;
@@ -67,6 +79,10 @@ typedef struct cachepic_s {
 #define	MAX_CACHED_PICS		128
 static cachepic_t menu_cachepics[MAX_CACHED_PICS];
 static int menu_numcachepics;
+static int menu_cachepicchains[64];
+static int menu_cachepicnext[MAX_CACHED_PICS];
+static namehash_t menu_cachepichash =
+    NAMEHASH_STATIC(menu_cachepicchains, menu_cachepicnext);
 
 
 void *Draw_PicFromWad(const char *name)
@@ -86,15 +102,20 @@ Draw_CachePic(const char *path)
     int i;
     qpic_t *dat;
 
-    for (pic = menu_cachepics, i = 0; i < menu_numcachepics; pic++, i++)
-	if (!strcmp(path, pic->name))
+    for (i = NameHash_First(&menu_cachepichash, path); i >= 0;
+	 i = NameHash_Next(&menu_cachepichash, i))
+	if (!strcmp(path, menu_cachepics[i].name))
 	    break;
 
-    if (i == menu_numcachepics) {
+    if (i >= 0)
+	pic = &menu_cachepics[i];
+    else {
 	if (menu_numcachepics == MAX_CACHED_PICS)
 	    Sys_Error("menu_numcachepics == MAX_CACHED_PICS");
-	menu_numcachepics++;
+	pic = &menu_cachepics[menu_numcachepics];
 	strcpy(pic->name, path);
+	NameHash_Insert(&menu_cachepichash, pic->name, menu_numcachepics);
+	menu_numcachepics++;
     }
 
     dat = (qpic_t*)Cache_Check(&pic->cache);
@@ -119,6 +140,92 @@ Draw_CachePic(const char *path)
 
 
 
+/*
+ * Glyph caches
+ *
+ * The conchars at one scale, each glyph row padded out to whole 64 bit
+ * words alongside a mask of the pixels it draws, so a row goes down as a
+ * few masked word stores instead of a test per pixel.
+ */
+#define CHAR_WIDTH	8
+#define CHAR_HEIGHT	8
+
+typedef struct {
+    int width, height;		/* of one glyph */
+    int fstep;			/* 16.16 step through the conchars per pixel */
+    int rowbytes;		/* width rounded up to a whole word */
+    byte *pixels;		/* 256 glyphs of height rows, 0 where not drawn */
+    byte *masks;		/* 0xff where drawn */
+} glyphcache_t;
+
+static byte draw_conpixels[256 * CHAR_HEIGHT * CHAR_WIDTH];
+static byte draw_conmasks[256 * CHAR_HEIGHT * CHAR_WIDTH];
+static glyphcache_t draw_conglyphs = {
+    CHAR_WIDTH, CHAR_HEIGHT, 0x10000, CHAR_WIDTH, draw_conpixels, draw_conmasks
+};
+static glyphcache_t draw_cbglyphs;	/* scaled to the console background */
+
+static void
+Draw_BuildGlyphs(glyphcache_t *cache, byte colorbase)
+{
+    const byte *source, *src;
+    byte *pixels, *masks;
+    int num, x, y, f;
+
+    pixels = cache->pixels;
+    masks = cache->masks;
+    for (num = 0; num < 256; num++) {
+	source = draw_chars + ((num >> 4) << 10) + ((num & 15) << 3);
+	for (y = 0; y < cache->height; y++) {
+	    src = source + (y * CHAR_HEIGHT / cache->height) * 128;
+	    memset(pixels, 0, cache->rowbytes);
+	    memset(masks, 0, cache->rowbytes);
+	    for (x = 0, f = 0; x < cache->width; x++, f += cache->fstep) {
+		if (src[f >> 16]) {
+		    pixels[x] = colorbase + src[f >> 16];
+		    masks[x] = 0xff;
+		}
+	    }
+	    pixels += cache->rowbytes;
+	    masks += cache->rowbytes;
+	}
+    }
+}
+
+/*
+ * Draws rows [firstrow, firstrow + rows) of a cached glyph
+ */
+static void
+Draw_GlyphRows(const glyphcache_t *cache, int num, int firstrow, int rows,
+	       byte *dest, int stride)
+{
+    const byte *pixels, *masks;
+    uint64_t p, m, d;
+    int x, words;
+
+    pixels = cache->pixels + (num * cache->height + firstrow) * cache->rowbytes;
+    masks = cache->masks + (num * cache->height + firstrow) * cache->rowbytes;
+    words = cache->width & ~7;
+    for (; rows > 0; rows--) {
+	for (x = 0; x < words; x += 8) {
+	    memcpy(&m, masks + x, sizeof(m));
+	    if (!m)
+		continue;
+	    memcpy(&p, pixels + x, sizeof(p));
+	    memcpy(&d, dest + x, sizeof(d));
+	    d = (d & ~m) | p;
+	    memcpy(dest + x, &d, sizeof(d));
+	}
+	for (; x < cache->width; x++) {
+	    if (masks[x])
+		dest[x] = pixels[x];
+	}
+	pixels += cache->rowbytes;
+	masks += cache->rowbytes;
+	dest += stride;
+    }
+}
+
 /*
 ===============
 Draw_Init
@@ -146,6 +253,9 @@ Draw_Init(void)
        VID_SetPalette2 (host_basepal);
        Draw_Generate18BPPTable();
     }
+
+    Draw_BuildGlyphs(&draw_conglyphs, 0);
+    draw_cbglyphs.width = 0;
 }
 
 
@@ -199,27 +309,8 @@ Draw_Character(int x, int y, int num)
 
     if (r_pixbytes == 1) {
 	dest = vid.conbuffer + y * vid.conrowbytes + x;
-
-	while (drawline--) {
-	    if (source[0])
-		dest[0] = source[0];
-	    if (source[1])
-		dest[1] = source[1];
-	    if (source[2])
-		dest[2] = source[2];
-	    if (source[3])
-		dest[3] = source[3];
-	    if (source[4])
-		dest[4] = source[4];
-	    if (source[5])
-		dest[5] = source[5];
-	    if (source[6])
-		dest[6] = source[6];
-	    if (source[7])
-		dest[7] = source[7];
-	    source += 128;
-	    dest += vid.conrowbytes;
-	}
+	Draw_GlyphRows(&draw_conglyphs, num, CHAR_HEIGHT - drawline, drawline,
+		       dest, vid.conrowbytes);
     } else {
 	// FIXME: pre-expand to native format?
 	pusdest = (unsigned short *)
@@ -249,6 +340,87 @@ Draw_Character(int x, int y, int num)
     }
 }
 
+/*
+================
+Draw_OverlayCharacter
+
+Draw_Character into an 8 bit overlay vid.width across, for Draw_Overlay
+================
+*/
+void
+Draw_OverlayCharacter(byte *overlay, int x, int y, int num)
+{
+    byte *dest;
+
+    num &= 255;
+    if (y < 0 || y > vid.height - 8 || x < 0 || x > vid.width - 8)
+	return;
+
+    dest = overlay + y * vid.width + x;
+    Draw_GlyphRows(&draw_conglyphs, num, 0, CHAR_HEIGHT, dest, vid.width);
+}
+
+/*
+================
+Draw_Overlay
+
+Copies the rows of an overlay vid.width across over the console buffer,
+leaving what's under its zeros as it was, the same as drawing the
+characters again
+================
+*/
+void
+Draw_Overlay(int y, int height, const byte *overlay)
+{
+    const byte *source;
+    byte *dest;
+    unsigned short *pusdest;
+    int row, x;
+
+    if (y < 0) {
+	overlay -= y * vid.width;
+	height += y;
+	y = 0;
+    }
+    height = qmin(height, (int)vid.height - y);
+
+    for (row = 0; row < height; row++) {
+	source = overlay + row * vid.width;
+	if (r_pixbytes == 1) {
+	    dest = vid.conbuffer + (y + row) * vid.conrowbytes;
+	    x = 0;
+#if defined(__SSE2__)
+	    for (; x + 16 <= vid.width; x += 16) {
+		__m128i src = _mm_loadu_si128((const __m128i *)(source + x));
+		__m128i dst = _mm_loadu_si128((const __m128i *)(dest + x));
+		__m128i keep = _mm_cmpeq_epi8(src, _mm_setzero_si128());
+
+		dst = _mm_or_si128(_mm_and_si128(keep, dst), src);
+		_mm_storeu_si128((__m128i *)(dest + x), dst);
+	    }
+#elif defined(__ARM_NEON)
+	    for (; x + 16 <= vid.width; x += 16) {
+		uint8x16_t src = vld1q_u8(source + x);
+		uint8x16_t keep = vceqq_u8(src, vdupq_n_u8(0));
+
+		vst1q_u8(dest + x, vbslq_u8(keep, vld1q_u8(dest + x), src));
+	    }
+#endif
+	    for (; x < vid.width; x++) {
+		if (source[x])
+		    dest[x] = source[x];
+	    }
+	} else {
+	    pusdest = (unsigned short *)
+		((byte *)vid.conbuffer + (y + row) * vid.conrowbytes);
+	    for (x = 0; x < vid.width; x++) {
+		if (source[x])
+		    pusdest[x] = d_8to16table[source[x]];
+	    }
+	}
+    }
+}
+
 /*
 ================
 Draw_String
@@ -564,33 +736,45 @@ void Draw_TransPicTranslate(int x, int y, const qpic_t *pic, byte *translation)
 }
 
 
-#define CHAR_WIDTH	8
-#define CHAR_HEIGHT	8
-
+/*
+ * Rebuilds the glyph cache when the console background's size changes
+ */
 static void
-Draw_ScaledCharToConback(const qpic_t *conback, int num, byte *dest)
+Draw_ScaleConbackGlyphs(const qpic_t *conback)
 {
-    int row, col;
-    byte *source, *src;
-    int drawlines, drawwidth;
-    int x, y, fstep, f;
+    glyphcache_t *cache = &draw_cbglyphs;
+    int width, height, fstep;
 
-    drawlines = conback->height * CHAR_HEIGHT / 200;
-    drawwidth = conback->width * CHAR_WIDTH / 320;
-
-    row = num >> 4;
-    col = num & 15;
-    source = draw_chars + (row << 10) + (col << 3);
+    width = conback->width * CHAR_WIDTH / 320;
+    height = conback->height * CHAR_HEIGHT / 200;
     fstep = 320 * 0x10000 / conback->width;
+    if (cache->width == width && cache->height == height
+	&& cache->fstep == fstep)
+	return;
 
-    for (y = 0; y < drawlines; y++, dest += conback->width) {
-	src = source + (y * CHAR_HEIGHT / drawlines) * 128;
-	f = 0;
-	for (x = 0; x < drawwidth; x++, f += fstep) {
-	    if (src[f >> 16])
-		dest[x] = 0x60 + src[f >> 16];
-	}
-    }
+    free(cache->pixels);
+    free(cache->masks);
+    cache->width = width;
+    cache->height = height;
+    cache->fstep = fstep;
+    cache->rowbytes = (width + 7) & ~7;
+    cache->pixels = cache->masks = NULL;
+    if (width <= 0 || height <= 0)
+	return;
+
+    cache->pixels = malloc(256 * height * cache->rowbytes);
+    cache->masks = malloc(256 * height * cache->rowbytes);
+    if (!cache->pixels || !cache->masks)
+	Sys_Error("%s: not enough memory for %dx%d glyphs", __func__,
+		  width, height);
+    Draw_BuildGlyphs(cache, 0x60);
+}
+
+static void
+Draw_ScaledCharToConback(const qpic_t *conback, int num, byte *dest)
+{
+    Draw_GlyphRows(&draw_cbglyphs, num & 255, 0, draw_cbglyphs.height, dest,
+		   conback->width);
 }
 
 /*
@@ -612,6 +796,10 @@ Draw_ConbackString(qpic_t *cb, const char *str)
     row = cb->height - ((CHAR_HEIGHT + 6) * cb->height / 200);
     col = cb->width - ((11 + CHAR_WIDTH * len) * cb->width / 320);
 
+    Draw_ScaleConbackGlyphs(cb);
+    if (draw_cbglyphs.width <= 0 || draw_cbglyphs.height <= 0)
+	return;
+
     dest = cb->data + cb->width * row + col;
     for (x = 0; x < len; x++)
 	Draw_ScaledCharToConback(cb, str[x], dest + (x * CHAR_WIDTH *
@@ -1000,35 +1188,124 @@ byte BestColor (int r, int g, int b, int start, int stop)
 
 	
 
-void Draw_Generate18BPPTable (void)
+/*
+ * The table takes a while to search out on slow machines, so it's kept in
+ * the save directory, named by the CRC of the palette it was made from and
+ * holding the palette itself to make sure of it.
+ */
+#define PALMAP_MAGIC "PMAP"
+#define PALMAP_VERSION 1
+
+typedef struct {
+    char magic[4];
+    int version;
+    byte palette[768];
+} palmapheader_t;
+
+static const char *
+Draw_PalmapJob(void *data, int start, int end)
 {
+    int r, g, b;
 
-	int		i, j, l, c;
-	float  red, green, blue;
-	int		r, g, b;
-	int		beastcolor;
-	int	ugly;
-	
-	unsigned char*	thepaltouse;
+    for (r = start; r < end; r++)
+	for (g = 0; g < 64; g++)
+	    for (b = 0; b < 64; b++)
+		palmap2[r][g][b] = BestColor(r << 2, g << 2, b << 2, 0, 254);
 
-	ugly = 0;
+    return NULL;
+}
 
-	// Make the 18-bit lookup table here
+/*
+ * False if the save directory's path is too long for the name to fit
+ */
+static qboolean
+Draw_PalmapName(char *name, int size)
+{
+    return snprintf(name, size, "%s/palmap_%04x.dat", com_savedir,
+		    CRC_Block(host_basepal, 768)) < size;
+}
 
-	printf ("\nGenerating 18-bit lookup table - ");
-	for (r=0 ; r<256 ; r+=4)
-	{
-		for (g=0 ; g<256 ; g+=4)
-		{
-			for (b=0 ; b<256 ; b+=4)
-			{
-				beastcolor = BestColor (r, g, b, 0, 254);
-				palmap2[r>>2][g>>2][b>>2] = beastcolor;
-			}
-		}
-	}
-	printf ("\nGenerated 18-bit lookup table - ");
+static qboolean
+Draw_LoadPalmap(void)
+{
+    char name[MAX_OSPATH];
+    palmapheader_t header;
+    qboolean loaded;
+    FILE *f;
+
+    if (!Draw_PalmapName(name, sizeof(name)))
+	return false;
+    f = fopen(name, "rb");
+    if (!f)
+	return false;
+
+    loaded = fread(&header, sizeof(header), 1, f) == 1
+	&& !memcmp(header.magic, PALMAP_MAGIC, 4)
+	&& LittleLong(header.version) == PALMAP_VERSION
+	&& !memcmp(header.palette, host_basepal, sizeof(header.palette))
+	&& fread(palmap2, sizeof(palmap2), 1, f) == 1;
+    fclose(f);
+
+    return loaded;
+}
 
+static void
+Draw_SavePalmap(void)
+{
+    char name[MAX_OSPATH];
+    palmapheader_t header;
+    qboolean saved;
+    FILE *f;
 
+    if (!Draw_PalmapName(name, sizeof(name)))
+	return;
+    f = fopen(name, "wb");
+    if (!f)
+	return;
+
+    memcpy(header.magic, PALMAP_MAGIC, 4);
+    header.version = LittleLong(PALMAP_VERSION);
+    memcpy(header.palette, host_basepal, sizeof(header.palette));
+    saved = fwrite(&header, sizeof(header), 1, f) == 1
+	&& fwrite(palmap2, sizeof(palmap2), 1, f) == 1;
+    if (fclose(f) || !saved)
+	remove(name);	/* don't leave half a table to be found */
+}
+
+static job_t draw_palmapjobs[JOB_MAX_SPLIT(MAX_JOB_THREADS)];
+static jobgroup_t draw_palmapgroup;
+static qboolean draw_palmapsave;	// being made, save it once it's done
+
+void Draw_Generate18BPPTable (void)
+{
+	int numjobs;
+
+	if (Draw_LoadPalmap())
+		return;
+
+	// Make the 18-bit lookup table here, in the background as nothing
+	// needs it before a map is drawn
+	Con_DPrintf("Generating 18-bit lookup table\n");
+	numjobs = Job_Split(draw_palmapjobs, 0, JOB_MAX_SPLIT(MAX_JOB_THREADS),
+			    Draw_PalmapJob, NULL, 64, 1);
+	Job_Submit(draw_palmapjobs, numjobs, &draw_palmapgroup, NULL);
+	draw_palmapsave = true;
+}
+
+/*
+===============
+Draw_FinishPalmap
+
+Waits for the 18-bit lookup table, if it's still being made
+===============
+*/
+void
+Draw_FinishPalmap(void)
+{
+    Job_Wait(&draw_palmapgroup);
+    if (draw_palmapsave) {
+	draw_palmapsave = false;
+	Draw_SavePalmap();
+    }
 }
 
@@ -30,7 +30,10 @@ extern const qpic_t *draw_disc;	// also used on sbar
 extern const byte *draw_chars;
 
 void Draw_Init(void);
+void Draw_FinishPalmap(void);	/* before the coloured lights table is used */
 void Draw_Character(int x, int y, int num);
+void Draw_OverlayCharacter(byte *overlay, int x, int y, int num);
+void Draw_Overlay(int y, int height, const byte *overlay);
 void Draw_Pic(int x, int y, const qpic_t *pic);
 void Draw_TransPic(int x, int y, const qpic_t *pic);
 void Draw_TransPicTranslate(int x, int y, const qpic_t *pic,
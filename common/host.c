@@ -19,16 +19,19 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // host.c -- coordinates spawning and killing of local servers
 
+#include "capture.h"
 #include "cdaudio.h"
 #include "cmd.h"
 #include "console.h"
 #include "draw.h"
 #include "host.h"
 #include "input.h"
+#include "jobs.h"
 #include "keys.h"
 #include "menu.h"
 #include "model.h"
 #include "net.h"
+#include "prof.h"
 #include "protocol.h"
 #include "quakedef.h"
 #include "sbar.h"
@@ -77,9 +80,27 @@ byte *host_basepal;
 byte *host_colormap;
 
 cvar_t host_framerate = { "host_framerate", "0" };	// set for slow motion
-cvar_t host_speeds = { "host_speeds", "0" };	// set for running times
+cvar_t host_maxfps = { "host_maxfps", "72" };	// 0 = no limit
 
 cvar_t sys_ticrate = { "sys_ticrate", "0.05" };
+
+/*
+ * With host_serverthread set, a listen server's frame runs as a job while
+ * the client draws what it received from the frame before, at the cost of
+ * a frame of latency; the loopback messages are only passed on either side
+ * of it. Errors in the server's frame are handed back to the main thread,
+ * which raises them again once the frame has been joined. Its prints and
+ * cvar sets are held back until then too, and the zone, hunk and cache take
+ * a lock of their own.
+ */
+static cvar_t host_serverthread = { "host_serverthread", "0", true };
+static THREAD_LOCAL qboolean host_inserverjob;
+static jmp_buf host_serverabort;
+static char host_servererror[MAX_PRINTMSG];
+static qboolean host_serverendgame;
+static qboolean host_serverrunning;
+static jobgroup_t host_servergroup;
+static job_t host_serverjob;
 cvar_t serverprofile = { "serverprofile", "0" };
 
 cvar_t fraglimit = { "fraglimit", "0", false, true };
@@ -111,6 +132,15 @@ Host_EndGame(const char *message, ...)
     va_list argptr;
     char string[MAX_PRINTMSG];
 
+    if (host_inserverjob) {
+	va_start(argptr, message);
+	vsnprintf(host_servererror, sizeof(host_servererror), message, argptr);
+	va_end(argptr);
+	host_serverendgame = true;
+	longjmp(host_serverabort, 1);
+    }
+    Host_JoinServerFrame();
+
     va_start(argptr, message);
     vsnprintf(string, sizeof(string), message, argptr);
     va_end(argptr);
@@ -144,6 +174,15 @@ Host_Error(const char *error, ...)
     char string[MAX_PRINTMSG];
     static qboolean inerror = false;
 
+    if (host_inserverjob) {
+	va_start(argptr, error);
+	vsnprintf(host_servererror, sizeof(host_servererror), error, argptr);
+	va_end(argptr);
+	host_serverendgame = false;
+	longjmp(host_serverabort, 1);
+    }
+    Host_JoinServerFrame();
+
     if (inerror)
 	Sys_Error("%s: recursively entered", __func__);
     inerror = true;
@@ -228,7 +267,8 @@ Host_InitLocal(void)
     Host_InitCommands();
 
     Cvar_RegisterVariable(&host_framerate);
-    Cvar_RegisterVariable(&host_speeds);
+    Cvar_RegisterVariable(&host_maxfps);
+    Cvar_RegisterVariable(&host_serverthread);
 
     Cvar_RegisterVariable(&sys_ticrate);
     Cvar_RegisterVariable(&serverprofile);
@@ -319,15 +359,27 @@ void
 SV_BroadcastPrintf(const char *fmt, ...)
 {
     va_list argptr;
+    char string[MAX_PRINTMSG];
+    byte buf[MAX_PRINTMSG + 1];
+    sizebuf_t msg;
     int i;
 
+    /* put the message together once, each client gets a copy */
+    va_start(argptr, fmt);
+    vsnprintf(string, sizeof(string), fmt, argptr);
+    va_end(argptr);
+
+    msg.allowoverflow = false;
+    msg.overflowed = false;
+    msg.data = buf;
+    msg.maxsize = sizeof(buf);
+    msg.cursize = 0;
+    MSG_WriteByte(&msg, svc_print);
+    MSG_WriteString(&msg, string);
+
     for (i = 0; i < svs.maxclients; i++)
-	if (svs.clients[i].active && svs.clients[i].spawned) {
-	    MSG_WriteByte(&svs.clients[i].message, svc_print);
-	    va_start(argptr, fmt);
-	    MSG_WriteStringvf(&svs.clients[i].message, fmt, argptr);
-	    va_end(argptr);
-	}
+	if (svs.clients[i].active && svs.clients[i].spawned)
+	    SZ_Write(&svs.clients[i].message, msg.data, msg.cursize);
 }
 
 /*
@@ -363,6 +415,7 @@ SV_DropClient(qboolean crash)
     int i;
     client_t *client;
 
+    SV_CmdLogDrop();
     if (!crash) {
 	// send any final messages (don't check for errors)
 	if (NET_CanSendMessage(host_client->netconnection)) {
@@ -515,7 +568,8 @@ Host_FilterTime(float time)
 {
     realtime += time;
 
-    if (!cls.timedemo && realtime - oldrealtime < 1.0 / 72.0)
+    if (!cls.timedemo && host_maxfps.value > 0
+	&& realtime - oldrealtime < 1.0 / host_maxfps.value)
 	return false;		// framerate is too high
 
     host_frametime = realtime - oldrealtime;
@@ -566,6 +620,8 @@ Host_ServerFrame
 void
 _Host_ServerFrame(void)
 {
+    SV_CmdLogFrame();
+
 // run the world state
     pr_global_struct->frametime = host_frametime;
 
@@ -574,8 +630,10 @@ _Host_ServerFrame(void)
 
 // move things around and think
 // always pause in single player if in console or menus
-    if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game))
+    if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game)) {
+	SV_CmdLogPhysics();
 	SV_Physics();
+    }
 }
 
 void
@@ -613,6 +671,8 @@ Host_ServerFrame(void)
 void
 Host_ServerFrame(void)
 {
+    SV_CmdLogFrame();
+
     /* run the world state */
     pr_global_struct->frametime = host_frametime;
 
@@ -629,8 +689,10 @@ Host_ServerFrame(void)
      * Move things around and think. Always pause in single player if in
      * console or menus
      */
-    if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game))
+    if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game)) {
+	SV_CmdLogPhysics();
 	SV_Physics();
+    }
 
     /* send all messages to the clients */
     SV_SendClientMessages();
@@ -639,6 +701,52 @@ Host_ServerFrame(void)
 #endif
 
 
+static const char *
+Host_ServerJob(void *data, int start, int end)
+{
+    host_inserverjob = true;
+    Con_DeferPrints(true);
+    Cvar_DeferSets(true);
+    if (!setjmp(host_serverabort))
+	Host_ServerFrame();
+    Cvar_DeferSets(false);
+    Con_DeferPrints(false);
+    host_inserverjob = false;
+
+    return NULL;
+}
+
+static void
+Host_StartServerFrame(void)
+{
+    host_servererror[0] = 0;
+    host_serverjob.func = Host_ServerJob;
+    host_serverjob.data = NULL;
+    host_serverjob.start = 0;
+    host_serverjob.end = 1;
+    host_serverrunning = true;
+    Job_Submit(&host_serverjob, 1, &host_servergroup, NULL);
+}
+
+/*
+==================
+Host_JoinServerFrame
+
+Waits for the server's frame if it's running alongside the client's
+==================
+*/
+void
+Host_JoinServerFrame(void)
+{
+    if (!host_serverrunning)
+	return;
+
+    Job_Wait(&host_servergroup);
+    host_serverrunning = false;
+    Con_FlushDeferred();
+    Cvar_FlushDeferred();
+}
+
 /*
 ==================
 Host_Frame
@@ -649,9 +757,16 @@ Runs all active servers
 void
 _Host_Frame(float time)
 {
+   qboolean threaded;
+
    /* something bad happened, or the server disconnected */
    if (setjmp(host_abort))
+   {
+      Job_EndFrame();
       return;
+   }
+
+   Frame_Reset();
 
    /* keep the random time dependent */
    rand();
@@ -663,7 +778,16 @@ _Host_Frame(float time)
    if (!Host_FilterTime(time))
       return;
 
-   /* get new key events */
+   NET_Poll();
+
+   /* check for commands typed to the host */
+   Host_GetConsoleCommands();
+
+   /*
+    * Read the input as late as we can, right before the move is made from
+    * it: the key events, then the commands they're bound to along with the
+    * console's
+    */
    Sys_SendKeyEvents();
 
    /* allow mice or other external controllers to add commands */
@@ -672,11 +796,11 @@ _Host_Frame(float time)
    /* process console commands */
    Cbuf_Execute();
 
-   NET_Poll();
-
-   /* if running the server locally, make intentions now */
-   if (sv.active)
-      CL_SendCmd();
+   /*
+    * Make intentions now, for a local server to run this frame, or after
+    * the remote server's messages were read (in the last frame)
+    */
+   CL_SendCmd();
 
    //-------------------
    //
@@ -684,11 +808,16 @@ _Host_Frame(float time)
    //
    //-------------------
 
-   /* check for commands typed to the host */
-   Host_GetConsoleCommands();
+   /* only worth it when there's a client to draw alongside the server */
+   threaded = sv.active && host_serverthread.value && Job_NumThreads()
+      && cls.state >= ca_connected;
 
-   if (sv.active)
+   if (sv.active && !threaded)
+   {
+      Prof_Begin(PROF_SERVER);
       Host_ServerFrame();
+      Prof_End(PROF_SERVER);
+   }
 
    //-------------------
    //
@@ -696,22 +825,43 @@ _Host_Frame(float time)
    //
    //-------------------
 
-   /*
-    * if running the server remotely, send intentions now after the incoming
-    * messages have been read
-    */
-   if (!sv.active)
-      CL_SendCmd();
-
    host_time += host_frametime;
 
    /* fetch results from server */
    if (cls.state >= ca_connected)
+   {
+      Prof_Begin(PROF_CLIENT);
       CL_ReadFromServer();
+      Prof_End(PROF_CLIENT);
+   }
 
+   if (threaded && sv.active)
+      Host_StartServerFrame();
+
+   Prof_Begin(PROF_RENDER);
    SCR_UpdateScreen();
+   Prof_End(PROF_RENDER);
    CL_RunParticles();
 
+   if (host_serverrunning)
+   {
+      Prof_Begin(PROF_SERVER);
+      Host_JoinServerFrame();
+      Prof_End(PROF_SERVER);
+      if (host_servererror[0])
+      {
+         char error[MAX_PRINTMSG];
+
+         snprintf(error, sizeof(error), "%s", host_servererror);
+         host_servererror[0] = 0;
+         if (host_serverendgame)
+            Host_EndGame("%s", error);
+         Host_Error("%s", error);
+      }
+   }
+   Job_EndFrame();
+   Host_SavegameWait(false);
+
    host_framecount++;
    fps_count++;
 }
@@ -774,30 +924,42 @@ Host_Init(quakeparms_t *parms)
     com_argc = parms->argc;
     com_argv = parms->argv;
 
+    Prof_StartupPhase("memory");
     Memory_Init(parms->membase, parms->memsize);
     Cbuf_Init();
     Cmd_Init();
     V_Init();
     Chase_Init();
+    Prof_StartupPhase("filesystem");
     COM_Init();
+    Prof_StartupPhase("jobs");
+    Job_Init();
+    Prof_Init();
+    Capture_Init();
     Host_InitLocal();
+    Prof_StartupPhase("wad");
     if (!W_LoadWadFile("gfx.wad"))
        return false;
 
+    Prof_StartupPhase("console");
     Key_Init();
     Con_Init();
     M_Init();
+    Prof_StartupPhase("progs");
     PR_Init();
     Mod_Init(R_ModelLoader());
+    Prof_StartupPhase("network");
     NET_Init();
     SV_Init();
 
     Con_Printf("Exe: " __TIME__ " " __DATE__ "\n");
     Con_Printf("%4.1f megabyte heap\n", parms->memsize / (1024 * 1024.0));
 
+    Prof_StartupPhase("textures");
     R_InitTextures();		// needed even for dedicated servers
 
     if (cls.state != ca_dedicated) {
+	Prof_StartupPhase("palette");
 	host_basepal = (byte*)COM_LoadHunkFile("gfx/palette.lmp");
 	if (!host_basepal)
 	    return Sys_Error("Couldn't load gfx/palette.lmp");
@@ -809,16 +971,22 @@ Host_Init(quakeparms_t *parms)
    if (coloredlights)
       host_fullbrights = 256-host_colormap[16384]; // leilei - variable our fullbright counts if available
 
+	Prof_StartupPhase("video");
 	VID_Init(host_basepal);
 
+	Prof_StartupPhase("draw");
 	Draw_Init();
+	Prof_StartupPhase("renderer");
 	SCR_Init();
 	R_Init();
 
+	Prof_StartupPhase("sound");
 	S_Init();
+	Prof_StartupPhase("music");
 	CDAudio_Init();
     BGM_Init();
 
+	Prof_StartupPhase("client");
 	Sbar_Init();
 	CL_Init();
 
@@ -831,11 +999,13 @@ Host_Init(quakeparms_t *parms)
     host_initialized = true;
     Sys_Printf("========Quake Initialized=========\n");
 
+    Prof_StartupPhase("quake.rc");
     /* In case exec of quake.rc fails */
     if (!setjmp(host_abort)) {
 	Cbuf_InsertText("exec quake.rc\n");
 	Cbuf_Execute();
     }
+    Prof_StartupPhase(NULL);
 
     return true;
 }
@@ -874,4 +1044,8 @@ Host_Shutdown(void)
     if (cls.state != ca_dedicated) {
 	VID_Shutdown();
     }
+
+    Host_SavegameWait(true);
+    Capture_Shutdown();
+    Job_Shutdown();
 }
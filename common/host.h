@@ -31,6 +31,7 @@ extern quakeparms_t host_parms;
 extern cvar_t sys_ticrate;
 extern cvar_t sys_nostdout;
 extern cvar_t developer;
+extern cvar_t host_maxfps;
 
 extern qboolean host_initialized;	// true if into command execution
 extern double host_frametime;
@@ -44,6 +45,7 @@ extern double realtime;		// not bounded in any way, changed at
 void Host_ClearMemory(void);
 void Host_ServerFrame(void);
 void Host_InitCommands(void);
+void Host_SavegameWait(qboolean block);
 bool Host_Init(quakeparms_t *parms);
 void Host_Shutdown(void);
 void Host_Error(const char *error, ...);
@@ -52,6 +54,7 @@ void Host_Frame(float time);
 void Host_Quit_f(void);
 void Host_ClientCommands(const char *fmt, ...);
 void Host_ShutdownServer(qboolean crash);
+void Host_JoinServerFrame(void);
 
 extern qboolean msg_suppress_1;	// suppresses resolution and cache size console
 
@@ -22,12 +22,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "cmd.h"
 #include "console.h"
 #include "host.h"
+#include "jobs.h"
 #include "keys.h"
 #include "menu.h"
 #include "model.h"
 #include "net.h"
 #include "protocol.h"
 #include "quakedef.h"
+#include "savestate.h"
 #include "screen.h"
 #include "server.h"
 #include "sys.h"
@@ -52,7 +54,9 @@ Host_Quit_f(void)
     CL_Disconnect();
     Host_ShutdownServer(false);
 
-    //Sys_Quit();
+    /* the frontend ends the core, but a dedicated server has to go itself */
+    if (cls.state == ca_dedicated)
+	Sys_Quit();
 }
 
 
@@ -420,6 +424,302 @@ LOAD / SAVE GAME
 
 #define	SAVEGAME_VERSION	5
 
+/*
+ * Binary savegames start with the same version and comment lines as text
+ * ones, so the menu can list them and other engines turn them down, then
+ * copy the globals and edicts as they are in memory. They only load with
+ * the progs they were saved with, so they're only written when
+ * sv_binarysave is set.
+ */
+#define SAVEGAME_BINARY_VERSION	105
+#define SAVEGAME_BINARY_MAGIC	(('S' << 24) | ('V' << 16) | ('B' << 8) | 'Q')
+
+typedef struct {
+   int magic;
+   int crc;			// of the progs
+   int edict_size;
+   int numglobals;
+   int num_edicts;
+   int skill;
+   double time;
+   float spawn_parms[NUM_SPAWN_PARMS];
+   char mapname[MAX_QPATH];
+} binarysave_t;
+
+static cvar_t sv_binarysave = { "sv_binarysave", "0", true };
+
+/*
+ * The file is written out by a job while the game carries on; the next save
+ * or load, the menu and shutdown wait for it first.
+ */
+typedef struct {
+   char name[256];		// as long as the name the save was asked for
+   byte *data;
+   int length;
+} savewrite_t;
+
+static savewrite_t host_savewrite;
+static job_t host_savejob;
+static jobgroup_t host_saving;
+
+static const char *Host_WriteSavegame(void *data, int start, int end)
+{
+   savewrite_t *save = (savewrite_t*)data;
+   FILE *f;
+   int written;
+
+   f = fopen(save->name, "wb");
+   if (!f)
+      return "couldn't open";
+   written = fwrite(save->data, 1, save->length, f);
+   if (fclose(f) || written != save->length)
+      return "couldn't write";
+
+   return NULL;
+}
+
+/*
+===============
+Host_SavegameWait
+
+Reports on the savegame being written, once it's finished or straight
+away if 'block' is set
+===============
+*/
+void Host_SavegameWait(qboolean block)
+{
+   if (!host_savewrite.data)
+      return;
+   if (!block && !Job_Done(&host_saving))
+      return;
+
+   Job_Wait(&host_saving);
+   if (host_savejob.error)
+      Con_Printf("ERROR: %s %s.\n", host_savejob.error, host_savewrite.name);
+   else
+      Con_Printf("Saved game to %s.\n", host_savewrite.name);
+   free(host_savewrite.data);
+   host_savewrite.data = NULL;
+}
+
+static void Host_WriteBinarySave(sizebuf_t *buf, const char *comment)
+{
+   binarysave_t header;
+   const char *style;
+   int i, length;
+   char prelude[64 + SAVEGAME_COMMENT_LENGTH];
+
+   length = snprintf(prelude, sizeof(prelude), "%i\n%s\n",
+         SAVEGAME_BINARY_VERSION, comment);
+   SaveState_Write(buf, prelude, length);
+
+   memset(&header, 0, sizeof(header));
+   header.magic = SAVEGAME_BINARY_MAGIC;
+   header.crc = pr_crc;
+   header.edict_size = pr_edict_size;
+   header.numglobals = progs->numglobals;
+   header.num_edicts = sv.num_edicts;
+   header.skill = current_skill;
+   header.time = sv.time;
+   for (i = 0; i < NUM_SPAWN_PARMS; i++)
+      header.spawn_parms[i] = svs.clients->spawn_parms[i];
+   snprintf(header.mapname, sizeof(header.mapname), "%s", sv.name);
+   SaveState_Write(buf, &header, sizeof(header));
+
+   for (i = 0; i < MAX_LIGHTSTYLES; i++)
+   {
+      style = sv.lightstyles[i] ? sv.lightstyles[i] : "m";
+      length = strlen(style) + 1;
+      SaveState_Write(buf, &length, sizeof(length));
+      SaveState_Write(buf, style, length);
+   }
+
+   SaveState_Write(buf, pr_globals, progs->numglobals * 4);
+   for (i = 0; i < sv.num_edicts; i++)
+   {
+      edict_t *ent = EDICT_NUM(i);
+
+      SaveState_Write(buf, &ent->free, sizeof(ent->free));
+      SaveState_Write(buf, &ent->v, progs->entityfields * 4);
+   }
+   ED_WriteStrings(buf);
+}
+
+/*
+ * Takes the game as it is now into memory and starts writing it out
+ */
+static void Host_SavegameBinary(const char *name, const char *comment)
+{
+   sizebuf_t buf;
+   int size;
+
+   Host_SavegameWait(true);
+
+   size = 64 + SAVEGAME_COMMENT_LENGTH + sizeof(binarysave_t)
+      + MAX_LIGHTSTYLES * 64 + progs->numglobals * 4
+      + sv.num_edicts * (sizeof(qboolean) + progs->entityfields * 4);
+   for (;;)
+   {
+      memset(&buf, 0, sizeof(buf));
+      buf.data = (byte*)malloc(size);
+      buf.maxsize = size;
+      if (!buf.data)
+      {
+         Con_Printf("ERROR: out of memory.\n");
+         return;
+      }
+      Host_WriteBinarySave(&buf, comment);
+      if (!buf.overflowed)
+         break;
+      free(buf.data);
+      size *= 2;
+   }
+
+   snprintf(host_savewrite.name, sizeof(host_savewrite.name), "%s", name);
+   host_savewrite.data = buf.data;
+   host_savewrite.length = buf.cursize;
+   host_savejob.func = Host_WriteSavegame;
+   host_savejob.data = &host_savewrite;
+   host_savejob.start = 0;
+   host_savejob.end = 1;
+   Job_Submit(&host_savejob, 1, &host_saving, NULL);
+}
+
+/*
+ * Loads the map and the game saved on it. Returns an error once the map has
+ * started loading, or NULL.
+ */
+static const char *Host_LoadBinarySave(sizebuf_t *buf,
+      binarysave_t *header)
+{
+   char *lightstyle;
+   edict_t *ent;
+   int i, length;
+
+   current_skill = header->skill;
+   Cvar_SetValue("skill", (float)current_skill);
+
+   CL_Disconnect_f();
+
+   SV_SpawnServer(header->mapname);
+
+   if (!sv.active)
+      return "Couldn't load map";
+   if (header->crc != pr_crc || header->edict_size != pr_edict_size
+         || header->numglobals != progs->numglobals)
+      return "Savegame was made with different progs";
+   if (header->num_edicts < 1 || header->num_edicts > sv.max_edicts)
+      return "Savegame has too many edicts";
+   sv.paused = true;		// pause until all clients connect
+   sv.loadgame = true;
+
+   for (i = 0; i < MAX_LIGHTSTYLES; i++)
+   {
+      if (!SaveState_Read(buf, &length, sizeof(length))
+            || length < 1 || length > buf->maxsize - buf->cursize)
+         return "Savegame is damaged";
+      lightstyle = (char*)Hunk_Alloc(length);
+      SaveState_Read(buf, lightstyle, length);
+      lightstyle[length - 1] = 0;
+      sv.lightstyles[i] = lightstyle;
+   }
+
+   SaveState_Read(buf, pr_globals, progs->numglobals * 4);
+   for (i = 0; i < sv.num_edicts; i++)
+   {
+      ent = EDICT_NUM(i);
+      if (!ent->free)
+         SV_UnlinkEdict(ent);
+   }
+   sv.num_edicts = header->num_edicts;
+   for (i = 0; i < sv.num_edicts; i++)
+   {
+      ent = EDICT_NUM(i);
+      SaveState_Read(buf, &ent->free, sizeof(ent->free));
+      SaveState_Read(buf, &ent->v, progs->entityfields * 4);
+   }
+   if (buf->overflowed || !ED_ReadStrings(buf))
+      return "Savegame is damaged";
+
+   // link them into the bsp tree
+   for (i = 1; i < sv.num_edicts; i++)
+   {
+      ent = EDICT_NUM(i);
+      if (!ent->free)
+         SV_LinkEdict(ent, false);
+   }
+   sv.time = header->time;
+   ED_ResetEdicts();
+
+   for (i = 0; i < NUM_SPAWN_PARMS; i++)
+      svs.clients->spawn_parms[i] = header->spawn_parms[i];
+
+   return NULL;
+}
+
+/*
+ * Reads the whole file into memory and loads it
+ */
+static void Host_LoadgameBinary(const char *name)
+{
+   binarysave_t header;
+   sizebuf_t buf;
+   const char *error;
+   FILE *f;
+   long length;
+   int i;
+
+   f = fopen(name, "rb");
+   if (!f)
+   {
+      Con_Printf("ERROR: couldn't open.\n");
+      return;
+   }
+   fseek(f, 0, SEEK_END);
+   length = ftell(f);
+   fseek(f, 0, SEEK_SET);
+
+   memset(&buf, 0, sizeof(buf));
+   buf.data = length > 0 ? (byte*)malloc(length) : NULL;
+   buf.maxsize = length;
+   if (!buf.data || fread(buf.data, 1, length, f) != (size_t)length)
+   {
+      fclose(f);
+      free(buf.data);
+      Con_Printf("ERROR: couldn't read.\n");
+      return;
+   }
+   fclose(f);
+
+   // skip the version and comment
+   for (i = 0; i < 2; i++)
+   {
+      while (buf.cursize < buf.maxsize && buf.data[buf.cursize] != '\n')
+         buf.cursize++;
+      buf.cursize++;
+   }
+   if (!SaveState_Read(&buf, &header, sizeof(header))
+         || header.magic != SAVEGAME_BINARY_MAGIC)
+   {
+      free(buf.data);
+      Con_Printf("Savegame is damaged\n");
+      return;
+   }
+   header.mapname[sizeof(header.mapname) - 1] = 0;
+
+   error = Host_LoadBinarySave(&buf, &header);
+   free(buf.data);
+   if (error)
+      Host_Error("%s", error);
+
+   if (cls.state != ca_dedicated)
+   {
+      CL_EstablishConnection("local");
+      Host_Reconnect_f();
+   }
+}
+
+
 /*
 ===============
 Host_SavegameComment
@@ -446,6 +746,7 @@ void Host_SavegameComment(char *text)
 }
 
 
+
 /*
 ===============
 Host_Savegame_f
@@ -501,6 +802,15 @@ void Host_Savegame_f(void)
    sprintf(name, "%s%c%s", com_savedir, slash, Cmd_Argv(1));
    COM_DefaultExtension(name, ".sav");
 
+   Host_SavegameComment(comment);
+   if (sv_binarysave.value)
+   {
+      Con_Printf("Saving game to %s...\n", name);
+      Host_SavegameBinary(name, comment);
+      return;
+   }
+
+   Host_SavegameWait(true);
    Con_Printf("Saving game to %s...\n", name);
    f = fopen(name, "w");
    if (!f) {
@@ -509,7 +819,6 @@ void Host_Savegame_f(void)
    }
 
    fprintf(f, "%i\n", SAVEGAME_VERSION);
-   Host_SavegameComment(comment);
    fprintf(f, "%s\n", comment);
    for (i = 0; i < NUM_SPAWN_PARMS; i++)
       fprintf(f, "%f\n", svs.clients->spawn_parms[i]);
@@ -579,6 +888,7 @@ void Host_Loadgame_f(void)
    // been used.  The menu calls it before stuffing loadgame command
    //      SCR_BeginLoadingPlaque();
 
+   Host_SavegameWait(true);
    Con_Printf("Loading game from %s...\n", name);
    f = fopen(name, "r");
    if (!f) {
@@ -587,6 +897,12 @@ void Host_Loadgame_f(void)
    }
 
    fscanf(f, "%i\n", &version);
+   if (version == SAVEGAME_BINARY_VERSION)
+   {
+      fclose(f);
+      Host_LoadgameBinary(name);
+      return;
+   }
    if (version != SAVEGAME_VERSION)
    {
       fclose(f);
@@ -672,6 +988,7 @@ void Host_Loadgame_f(void)
 
    sv.num_edicts = entnum;
    sv.time = time;
+   ED_ResetEdicts();
 
    fclose(f);
 
@@ -1034,7 +1351,8 @@ Host_Spawn_f(void)
 	pr_global_struct->self = EDICT_TO_PROG(sv_player);
 	PR_ExecuteProgram(pr_global_struct->ClientConnect);
 
-	if ((Sys_DoubleTime() - host_client->netconnection->connecttime) <=
+	if (host_client->netconnection &&
+	    (Sys_DoubleTime() - host_client->netconnection->connecttime) <=
 	    sv.time)
 	    Sys_Printf("%s entered the game\n", host_client->name);
 
@@ -1272,7 +1590,7 @@ Host_Give_f(void)
 
     case 's':
 	if (rogue) {
-	    val = GetEdictFieldValue(sv_player, "ammo_shells1");
+	    val = ED_EXTFIELD(sv_player, EXTFIELD_AMMO_SHELLS1);
 	    if (val)
 		val->_float = v;
 	}
@@ -1281,7 +1599,7 @@ Host_Give_f(void)
 	break;
     case 'n':
 	if (rogue) {
-	    val = GetEdictFieldValue(sv_player, "ammo_nails1");
+	    val = ED_EXTFIELD(sv_player, EXTFIELD_AMMO_NAILS1);
 	    if (val) {
 		val->_float = v;
 		if (sv_player->v.weapon <= IT_LIGHTNING)
@@ -1293,7 +1611,7 @@ Host_Give_f(void)
 	break;
     case 'l':
 	if (rogue) {
-	    val = GetEdictFieldValue(sv_player, "ammo_lava_nails");
+	    val = ED_EXTFIELD(sv_player, EXTFIELD_AMMO_LAVA_NAILS);
 	    if (val) {
 		val->_float = v;
 		if (sv_player->v.weapon > IT_LIGHTNING)
@@ -1303,7 +1621,7 @@ Host_Give_f(void)
 	break;
     case 'r':
 	if (rogue) {
-	    val = GetEdictFieldValue(sv_player, "ammo_rockets1");
+	    val = ED_EXTFIELD(sv_player, EXTFIELD_AMMO_ROCKETS1);
 	    if (val) {
 		val->_float = v;
 		if (sv_player->v.weapon <= IT_LIGHTNING)
@@ -1315,7 +1633,7 @@ Host_Give_f(void)
 	break;
     case 'm':
 	if (rogue) {
-	    val = GetEdictFieldValue(sv_player, "ammo_multi_rockets");
+	    val = ED_EXTFIELD(sv_player, EXTFIELD_AMMO_MULTI_ROCKETS);
 	    if (val) {
 		val->_float = v;
 		if (sv_player->v.weapon > IT_LIGHTNING)
@@ -1328,7 +1646,7 @@ Host_Give_f(void)
 	break;
     case 'c':
 	if (rogue) {
-	    val = GetEdictFieldValue(sv_player, "ammo_cells1");
+	    val = ED_EXTFIELD(sv_player, EXTFIELD_AMMO_CELLS1);
 	    if (val) {
 		val->_float = v;
 		if (sv_player->v.weapon <= IT_LIGHTNING)
@@ -1340,7 +1658,7 @@ Host_Give_f(void)
 	break;
     case 'p':
 	if (rogue) {
-	    val = GetEdictFieldValue(sv_player, "ammo_plasma");
+	    val = ED_EXTFIELD(sv_player, EXTFIELD_AMMO_PLASMA);
 	    if (val) {
 		val->_float = v;
 		if (sv_player->v.weapon > IT_LIGHTNING)
@@ -1566,6 +1884,8 @@ Host_InitCommands
 void
 Host_InitCommands(void)
 {
+    Cvar_RegisterVariable(&sv_binarysave);
+
     Cmd_AddCommand("status", Host_Status_f);
     Cmd_AddCommand("quit", Host_Quit_f);
     Cmd_AddCommand("god", Host_God_f);
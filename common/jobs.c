@@ -0,0 +1,401 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// jobs.c -- simple worker pool for running batches of independent jobs
+
+#include <stdlib.h>
+
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+#include "console.h"
+#include "jobs.h"
+#include "mathlib.h"
+#include "sys.h"
+
+#ifdef HAVE_THREADS
+#define JOB_QUEUE_SIZE	256	/* power of two */
+#define JOB_MAX_PARKED	32
+
+/*
+ * Jobs in [tail, head); the owner pushes and pops at the head, the other
+ * threads steal from the tail.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    job_t *jobs[JOB_QUEUE_SIZE];
+    unsigned head;
+    unsigned tail;
+} jobqueue_t;
+
+/* Queue 0 is the main thread's, then one per worker */
+static jobqueue_t job_queues[MAX_JOB_THREADS + 1];
+static THREAD_LOCAL int job_self;
+
+static pthread_t job_threads[MAX_JOB_THREADS];
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_wake = PTHREAD_COND_INITIALIZER;
+static int job_queued;		/* in all the queues, atomic */
+
+/* Batches waiting for a group to finish; protected by job_lock */
+typedef struct {
+    job_t *jobs;
+    int numjobs;
+    jobgroup_t *after;
+} jobparked_t;
+
+static jobparked_t job_parked[JOB_MAX_PARKED];
+static int job_numparked;
+static qboolean job_quit;
+#endif
+
+static int job_numthreads;
+static jobgroup_t job_frame;
+
+#ifdef HAVE_THREADS
+static void Job_Start(job_t *jobs, int numjobs);
+
+/*
+ * Wakes the workers and whoever's waiting, to look again
+ */
+static void
+Job_Wake(void)
+{
+    pthread_mutex_lock(&job_lock);
+    pthread_cond_broadcast(&job_wake);
+    pthread_mutex_unlock(&job_lock);
+}
+
+/*
+ * Starts what was waiting on a group that just finished
+ */
+static void
+Job_Finished(jobgroup_t *group)
+{
+    jobparked_t ready[JOB_MAX_PARKED];
+    int i, numready = 0;
+
+    pthread_mutex_lock(&job_lock);
+    for (i = 0; i < job_numparked; i++) {
+	/* a new group may have taken the address of one that just finished */
+	if (job_parked[i].after != group
+	    || __atomic_load_n(&group->pending, __ATOMIC_ACQUIRE))
+	    continue;
+	ready[numready++] = job_parked[i];
+	job_parked[i--] = job_parked[--job_numparked];
+    }
+    pthread_cond_broadcast(&job_wake);
+    pthread_mutex_unlock(&job_lock);
+
+    for (i = 0; i < numready; i++)
+	Job_Start(ready[i].jobs, ready[i].numjobs);
+}
+#endif
+
+static void
+Job_Run(job_t *job)
+{
+    jobgroup_t *group = job->group;	/* the job may be gone once counted */
+
+    job->error = job->func(job->data, job->start, job->end);
+#ifdef HAVE_THREADS
+    if (!__atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL))
+	Job_Finished(group);
+#else
+    group->pending--;
+#endif
+}
+
+#ifdef HAVE_THREADS
+/*
+ * Onto this thread's queue, and run here what doesn't fit. Not to be
+ * called with job_lock held.
+ */
+static void
+Job_Start(job_t *jobs, int numjobs)
+{
+    jobqueue_t *queue = &job_queues[job_self];
+    int i;
+
+    pthread_mutex_lock(&queue->lock);
+    for (i = 0; i < numjobs && queue->head - queue->tail < JOB_QUEUE_SIZE; i++)
+	queue->jobs[queue->head++ & (JOB_QUEUE_SIZE - 1)] = &jobs[i];
+    __atomic_add_fetch(&job_queued, i, __ATOMIC_ACQ_REL);
+    pthread_mutex_unlock(&queue->lock);
+    Job_Wake();
+
+    for (; i < numjobs; i++)
+	Job_Run(&jobs[i]);
+}
+
+/*
+ * The newest job on this thread's queue, else the oldest on another's
+ */
+static job_t *
+Job_Take(void)
+{
+    jobqueue_t *queue;
+    job_t *job = NULL;
+    int i;
+
+    if (!__atomic_load_n(&job_queued, __ATOMIC_ACQUIRE))
+	return NULL;
+
+    queue = &job_queues[job_self];
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head != queue->tail)
+	job = queue->jobs[--queue->head & (JOB_QUEUE_SIZE - 1)];
+    pthread_mutex_unlock(&queue->lock);
+
+    for (i = 1; !job && i <= job_numthreads; i++) {
+	queue = &job_queues[(job_self + i) % (job_numthreads + 1)];
+	pthread_mutex_lock(&queue->lock);
+	if (queue->head != queue->tail)
+	    job = queue->jobs[queue->tail++ & (JOB_QUEUE_SIZE - 1)];
+	pthread_mutex_unlock(&queue->lock);
+    }
+
+    if (job)
+	__atomic_sub_fetch(&job_queued, 1, __ATOMIC_ACQ_REL);
+
+    return job;
+}
+
+static void *
+Job_Worker(void *self)
+{
+    job_t *job;
+
+    job_self = (intptr_t)self;
+    for (;;) {
+	job = Job_Take();
+	if (job) {
+	    Job_Run(job);
+	    continue;
+	}
+	pthread_mutex_lock(&job_lock);
+	while (!job_quit && !__atomic_load_n(&job_queued, __ATOMIC_ACQUIRE))
+	    pthread_cond_wait(&job_wake, &job_lock);
+	pthread_mutex_unlock(&job_lock);
+	if (job_quit)
+	    break;
+    }
+
+    return NULL;
+}
+#endif
+
+/*
+================
+Job_Init
+
+Start one worker per spare cpu, or as many as given by "-jobthreads <n>".
+================
+*/
+void
+Job_Init(void)
+{
+#ifdef HAVE_THREADS
+    int i, numthreads;
+
+    if (job_numthreads)
+	return;
+
+    i = COM_CheckParm("-jobthreads");
+    if (i && i < com_argc - 1)
+	numthreads = Q_atoi(com_argv[i + 1]);
+    else
+	numthreads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    numthreads = qclamp(numthreads, 0, MAX_JOB_THREADS);
+
+    for (i = 0; i <= MAX_JOB_THREADS; i++)
+	pthread_mutex_init(&job_queues[i].lock, NULL);
+
+    job_quit = false;
+    for (i = 0; i < numthreads; i++) {
+	if (pthread_create(&job_threads[i], NULL, Job_Worker,
+			   (void *)(intptr_t)(i + 1))) {
+	    Con_Printf("%s: unable to start worker thread\n", __func__);
+	    break;
+	}
+    }
+    job_numthreads = i;
+#endif
+}
+
+void
+Job_Shutdown(void)
+{
+#ifdef HAVE_THREADS
+    int i;
+
+    if (!job_numthreads)
+	return;
+
+    Job_EndFrame();
+    pthread_mutex_lock(&job_lock);
+    job_quit = true;
+    pthread_cond_broadcast(&job_wake);
+    pthread_mutex_unlock(&job_lock);
+
+    for (i = 0; i < job_numthreads; i++)
+	pthread_join(job_threads[i], NULL);
+    job_numthreads = 0;
+#endif
+}
+
+int
+Job_NumThreads(void)
+{
+    return job_numthreads;
+}
+
+int
+Job_Split(job_t *jobs, int numjobs, int maxjobs, jobfunc_t func, void *data,
+	  int count, int grain)
+{
+    int start, maxsplit;
+
+    if (numjobs >= maxjobs) {
+	Sys_Error("%s: too many jobs", __func__);
+	return numjobs;
+    }
+
+    /*
+     * No point splitting the work up if it's all run on this thread.
+     * Otherwise, a few chunks per thread is enough to balance the load, and
+     * we must never need more chunks than there is room left for.
+     */
+    maxsplit = job_numthreads ? JOB_MAX_SPLIT(job_numthreads) : 1;
+    maxsplit = qmin(maxsplit, maxjobs - numjobs);
+    if (grain < (count + maxsplit - 1) / maxsplit)
+	grain = (count + maxsplit - 1) / maxsplit;
+    if (grain < 1)
+	grain = 1;
+
+    for (start = 0; start < count; start += grain) {
+	jobs[numjobs].func = func;
+	jobs[numjobs].data = data;
+	jobs[numjobs].start = start;
+	jobs[numjobs].end = qmin(start + grain, count);
+	jobs[numjobs].error = NULL;
+	numjobs++;
+    }
+
+    return numjobs;
+}
+
+void
+Job_Submit(job_t *jobs, int numjobs, jobgroup_t *group, jobgroup_t *after)
+{
+    int i;
+
+    if (numjobs <= 0)
+	return;
+    if (!group)
+	group = &job_frame;
+
+    for (i = 0; i < numjobs; i++)
+	jobs[i].group = group;
+
+#ifdef HAVE_THREADS
+    if (job_numthreads) {
+	__atomic_add_fetch(&group->pending, numjobs, __ATOMIC_ACQ_REL);
+
+	if (after) {
+	    pthread_mutex_lock(&job_lock);
+	    if (__atomic_load_n(&after->pending, __ATOMIC_ACQUIRE)
+		&& job_numparked < JOB_MAX_PARKED) {
+		job_parked[job_numparked].jobs = jobs;
+		job_parked[job_numparked].numjobs = numjobs;
+		job_parked[job_numparked].after = after;
+		job_numparked++;
+		pthread_mutex_unlock(&job_lock);
+		return;
+	    }
+	    pthread_mutex_unlock(&job_lock);
+	    Job_Wait(after);	/* done, or nowhere to leave them */
+	}
+	Job_Start(jobs, numjobs);
+	return;
+    }
+#endif
+
+    /* everything before has finished already */
+    group->pending += numjobs;
+    for (i = 0; i < numjobs; i++)
+	Job_Run(&jobs[i]);
+}
+
+void
+Job_Wait(jobgroup_t *group)
+{
+#ifdef HAVE_THREADS
+    job_t *job;
+
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE)) {
+	job = Job_Take();
+	if (job) {
+	    Job_Run(job);
+	    continue;
+	}
+	pthread_mutex_lock(&job_lock);
+	while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE)
+	       && !__atomic_load_n(&job_queued, __ATOMIC_ACQUIRE))
+	    pthread_cond_wait(&job_wake, &job_lock);
+	pthread_mutex_unlock(&job_lock);
+    }
+#endif
+}
+
+int
+Job_Done(const jobgroup_t *group)
+{
+#ifdef HAVE_THREADS
+    return !__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE);
+#else
+    return !group->pending;
+#endif
+}
+
+void
+Job_EndFrame(void)
+{
+    Job_Wait(&job_frame);
+}
+
+const char *
+Job_RunBatch(job_t *jobs, int numjobs)
+{
+    jobgroup_t group = { 0 };
+    int i;
+
+    Job_Submit(jobs, numjobs, &group, NULL);
+    Job_Wait(&group);
+
+    for (i = 0; i < numjobs; i++)
+	if (jobs[i].error)
+	    return jobs[i].error;
+
+    return NULL;
+}
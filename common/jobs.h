@@ -0,0 +1,116 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef JOBS_H
+#define JOBS_H
+
+/* jobs.h -- run batches of independent work on a pool of worker threads */
+
+/*
+ * Each thread keeps the jobs it submits in a queue of its own and runs them
+ * newest first; threads with nothing left to do take the oldest jobs from
+ * the others' queues.
+ */
+
+/*
+ * A job processes the items [start, end) of whatever 'data' points at.
+ * Jobs may run on any thread, so they must not touch the hunk/zone/cache
+ * allocators or call Sys_Error/SV_Error. Instead they return NULL on
+ * success or a static error string, which the caller reports once the
+ * batch has finished.
+ */
+typedef const char *(*jobfunc_t)(void *data, int start, int end);
+
+/*
+ * Jobs submitted together are counted in a group, which can be waited on
+ * or have other jobs wait for it. Start it zeroed, and keep it (and the
+ * jobs) around until it has been waited on.
+ */
+typedef struct jobgroup_s {
+    int pending;	/* jobs submitted and not yet finished */
+} jobgroup_t;
+
+typedef struct {
+    jobfunc_t func;
+    void *data;
+    int start;
+    int end;
+    const char *error;	/* filled in once the job has run */
+    jobgroup_t *group;	/* filled in by Job_Submit */
+} job_t;
+
+#define MAX_JOB_THREADS 8
+
+/*
+ * Storage class for globals that each thread running jobs needs its own
+ * copy of.
+ */
+#ifdef HAVE_THREADS
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
+/* Most chunks Job_Split will cut one range into */
+#define JOB_MAX_SPLIT(numthreads) (4 * ((numthreads) + 1))
+
+void Job_Init(void);
+void Job_Shutdown(void);
+int Job_NumThreads(void);
+
+/*
+ * Add jobs covering [0, count) to the batch, in chunks of at least 'grain'
+ * items. Returns the new number of jobs in the batch.
+ */
+int Job_Split(job_t *jobs, int numjobs, int maxjobs, jobfunc_t func,
+	      void *data, int count, int grain);
+
+/*
+ * Run all jobs in the batch and wait for them to complete. Returns the
+ * error of the first failed job (in batch order), or NULL. Without worker
+ * threads the jobs are simply run in order on the calling thread.
+ */
+const char *Job_RunBatch(job_t *jobs, int numjobs);
+
+/*
+ * Start the jobs and return without waiting for them. They count towards
+ * 'group', or this frame's group if NULL, and none of them start before
+ * the jobs already submitted to 'after' (if not NULL) have all finished.
+ * Jobs may submit jobs of their own and wait for them.
+ */
+void Job_Submit(job_t *jobs, int numjobs, jobgroup_t *group,
+		jobgroup_t *after);
+
+/*
+ * Wait for the group's jobs to finish, running jobs on this thread in the
+ * meantime. Their errors are left in the jobs.
+ */
+void Job_Wait(jobgroup_t *group);
+
+/* Nonzero once the group's jobs have all finished; doesn't wait */
+int Job_Done(const jobgroup_t *group);
+
+/*
+ * The join point at the end of each frame, and after an aborted one;
+ * waits for the jobs submitted to the frame's group.
+ */
+void Job_EndFrame(void);
+
+#endif /* JOBS_H */
@@ -435,25 +435,22 @@ Key_Console(int key)
     }
 
     if (key == K_PGUP || key == K_MWHEELUP) {
-	con->display -= 2;
+	Con_Scroll(2);
 	return;
     }
 
     if (key == K_PGDN || key == K_MWHEELDOWN) {
-	con->display += 2;
-	if (con->display > con->current)
-	    con->display = con->current;
+	Con_Scroll(-2);
 	return;
     }
 
-    /* FIXME - only scroll back over _used_ lines (and 10 is arbitrary...) */
     if (key == K_HOME) {
-	con->display = con->current - con_totallines + 10;
+	Con_ScrollHome();
 	return;
     }
 
     if (key == K_END) {
-	con->display = con->current;
+	Con_ScrollEnd();
 	return;
     }
 
@@ -40,11 +40,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <unistd.h>
 #endif
 
+#include "capture.h"
 #include "cmd.h"
 #include "common.h"
 #include "quakedef.h"
 #include "d_local.h"
 #include "sys.h"
+#include "vid_convert.h"
 
 #include "qtypes.h"
 #include "sound.h"
@@ -55,6 +57,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifdef NQ_HACK
 #include "client.h"
 #include "host.h"
+#include "jobs.h"
+#include "prof.h"
+#include "savestate.h"
+#include "screen.h"
 
 qboolean isDedicated;
 #endif
@@ -175,6 +181,17 @@ gp_layout_t classic = {
 gp_layout_t *gp_layoutp = NULL;
 
 cvar_t framerate = { "framerate", "60", true };
+/* mix each frame's audio on demand rather than ahead into a ring */
+static cvar_t snd_direct = { "snd_direct", "1", true };
+static float framerate_option; /* 0 = follow the frontend */
+static retro_usec_t frame_usec; /* from the frame time callback */
+
+#ifndef RETRO_ENVIRONMENT_GET_TARGET_REFRESH_RATE
+#define RETRO_ENVIRONMENT_GET_TARGET_REFRESH_RATE (50 | RETRO_ENVIRONMENT_EXPERIMENTAL)
+#endif
+#ifndef RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE
+#define RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE (47 | RETRO_ENVIRONMENT_EXPERIMENTAL)
+#endif
 static bool initial_resolution_set = false;
 static int invert_y_axis = 1;
 
@@ -386,7 +403,7 @@ void retro_deinit(void)
 {
    Sys_Quit();
    if (heap)
-      free(heap);
+      Memory_Release(heap);
 }
 
 unsigned retro_api_version(void)
@@ -468,6 +485,17 @@ void retro_set_environment(retro_environment_t cb)
       { "tyrquake_rumble", "Rumble; disabled|enabled" },
       { "tyrquake_invert_y_axis", "Invert Y Axis; disabled|enabled" },
       { "tyrquake_analog_deadzone", "Analog Deadzone (percent); 15|20|25|30|0|5|10" },
+#ifdef HAVE_MMAP
+      { "tyrquake_mmap_paks", "Memory-map PAK files (restart); disabled|enabled" },
+#endif
+      { "tyrquake_dirty_rects", "Only convert changed screen areas; disabled|enabled" },
+      { "tyrquake_pixel_format", "Pixel format (restart); RGB565|XRGB8888" },
+      { "tyrquake_framerate", "Framerate (restart); auto|50|60|72|75|90|100|119|120|144|165|180|200|240" },
+      { "tyrquake_frame_delay", "Frame delay (ms, reads the input later); 0|2|4|6|8|10|12|14" },
+      { "tyrquake_benchmark", "Benchmark the demos, then quit (restart); disabled|enabled" },
+#ifdef HAVE_THREADS
+      { "tyrquake_job_threads", "Worker threads (restart); auto|0|1|2|3|4|5|6|7|8" },
+#endif
       { NULL, NULL },
    };
 
@@ -656,6 +684,13 @@ void retro_unset_rumble_strong(void)
 extern int coloredlights;
 
 bool state_rumble;
+static bool mmap_paks;
+static bool dirty_rects;
+static bool vid_fullupdate = true;
+static bool xrgb8888;
+static bool benchmark_at_start; /* run the benchmark, then shut down */
+static int frame_delay; /* ms to wait before reading the input and running */
+static char job_threads[4]; /* for -jobthreads, or empty for one per cpu */
 
 static void update_variables(bool startup)
 {
@@ -726,6 +761,81 @@ static void update_variables(bool startup)
 		analog_deadzone = (int)(atoi(var.value) * 0.01f * ANALOG_RANGE);
    }
 
+#ifdef HAVE_MMAP
+   var.key = "tyrquake_mmap_paks";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && startup)
+      mmap_paks = !strcmp(var.value, "enabled");
+#endif
+
+   var.key = "tyrquake_dirty_rects";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      bool enabled = !strcmp(var.value, "enabled");
+
+      /* the areas outside the rects may be stale, so start from scratch */
+      if (enabled && !dirty_rects)
+         vid_fullupdate = true;
+      dirty_rects = enabled;
+   }
+
+   var.key = "tyrquake_pixel_format";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && startup)
+      xrgb8888 = !strcmp(var.value, "XRGB8888");
+
+   var.key = "tyrquake_framerate";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && startup)
+      framerate_option = strcmp(var.value, "auto") ? atof(var.value) : 0;
+
+   var.key = "tyrquake_frame_delay";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      frame_delay = atoi(var.value);
+
+   var.key = "tyrquake_benchmark";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && startup)
+      benchmark_at_start = !strcmp(var.value, "enabled");
+
+#ifdef HAVE_THREADS
+   var.key = "tyrquake_job_threads";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && startup)
+      snprintf(job_threads, sizeof(job_threads), "%s",
+            strcmp(var.value, "auto") ? var.value : "");
+#endif
+}
+
+/*
+ * Use the display's refresh rate unless a rate was picked, so that every
+ * refresh gets a new frame.
+ */
+static float target_framerate(void)
+{
+   float rate = 0;
+
+   if (framerate_option > 0)
+      return framerate_option;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_TARGET_REFRESH_RATE, &rate)
+         && rate >= 20 && rate <= 360)
+      return rate;
+
+   return 60;
+}
+
+static void frame_time_cb(retro_usec_t usec)
+{
+   frame_usec = usec;
 }
 
 static void update_env_variables(void)
@@ -745,22 +855,99 @@ static void update_env_variables(void)
 
 byte *vid_buffer;
 short *zbuffer;
-short *finalimage;
-byte* surfcache;
+void *finalimage;
 
 static void audio_process(void);
-static void audio_callback(void);
+static void audio_callback(double frametime);
+static void VID_Present(void);
 
 static bool did_flip;
+static bool vid_present;	/* a frame is being converted to hand over */
+/* whether the frontend will use this frame's picture and sound */
+static bool video_enabled = true;
+static bool audio_enabled = true;
+
+/*
+ * Frames run ahead (or run for netplay) are thrown away after they are
+ * made, so there's no point drawing or mixing them. The world and client
+ * are still run exactly as on a shown frame.
+ */
+static void update_av_enable(void)
+{
+   int av_enable;
+
+   if (!environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable))
+      av_enable = 3;
+   video_enabled = (av_enable & 1) != 0;
+   audio_enabled = (av_enable & 2) && !(av_enable & 8);
+   scr_skipdraw = !video_enabled;
+}
 
 bool shutdown_core = false;
 
+/*
+ * With a frame delay, the frame's input is read and the frame run that
+ * much later, just ahead of the frontend presenting it. The wait is cut
+ * short so that it and the work of the last frame fit the frame's time.
+ */
+static double frame_work;
+
+static void frame_wait(double frametime)
+{
+   double delay = frame_delay / 1000.0;
+
+   if (delay > frametime - frame_work - 0.002)
+      delay = frametime - frame_work - 0.002;
+   if (delay >= 0.001)
+      retro_sleep((int)(delay * 1000));
+}
+
+/*
+ * While a demo is captured, frames of the capture's length are run back to
+ * back for as long as one of the frontend's frames lasts. Their sound goes
+ * to the capture only; the frontend is shown the last picture.
+ */
+static void capture_run(void)
+{
+   static short samples[(SAMPLERATE / CAPTURE_MINFPS + 1) * 2];
+   static double frames_left;
+   double frametime = Capture_FrameTime();
+   double start = Sys_DoubleTime();
+   double frames;
+   int count;
+
+   do
+   {
+      Prof_BeginFrame();
+      Host_Frame(frametime);
+      if (shutdown_core)
+         return;
+
+      Prof_Begin(PROF_SOUND);
+      audio_process();
+      frames = SAMPLERATE * frametime + frames_left;
+      count = (int)frames;
+      frames_left = frames - count;
+      S_PaintDirect(samples, count);
+      Prof_End(PROF_SOUND);
+
+      Capture_Frame(samples, count);
+      Prof_EndFrame();
+   } while (Capture_Active() && Sys_DoubleTime() - start < 1.0 / framerate.value);
+
+   if (!did_flip)
+      video_cb(NULL, width, height, 0); /* dupe */
+   VID_Present();
+}
+
 void retro_run(void)
 {
    static bool has_set_username = false;
    bool updated = false;
+   double frametime, start;
 
    did_flip = false;
+   update_av_enable();
 
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
       update_variables(false);
@@ -773,15 +960,46 @@ void retro_run(void)
    if (!state_rumble)
       retro_unset_rumble_strong();
 
-   Host_Frame(0.016667);
+   if (Capture_Active())
+   {
+      capture_run();
+      return;
+   }
+
+   if (frame_usec > 0)
+      frametime = frame_usec / 1000000.0;
+   else
+      frametime = 1.0 / framerate.value;
+
+   /* frames run ahead aren't shown, so there's nothing to wait for */
+   if (frame_delay && video_enabled)
+      frame_wait(frametime);
+   start = Sys_DoubleTime();
+
+   Prof_BeginFrame();
+   Host_Frame(frametime);
+
+   /* The benchmark is started by the first frame's commands */
+   if (benchmark_at_start && host_framecount > 0 && !CL_Benchmarking())
+   {
+      shutdown_core = true;
+      environ_cb(RETRO_ENVIRONMENT_SHUTDOWN, NULL);
+   }
 
    if (shutdown_core)
       return;
 
-   if (!did_flip)
-      video_cb(NULL, width, height, width << 1); /* dupe */
+   Prof_Begin(PROF_SOUND);
    audio_process();
-   audio_callback();
+   audio_callback(frametime);
+   Prof_End(PROF_SOUND);
+
+   if (!did_flip)
+      video_cb(NULL, width, height, 0); /* dupe */
+   VID_Present();
+   Prof_EndFrame();
+
+   frame_work = Sys_DoubleTime() - start;
 }
 
 static void extract_directory(char *buf, const char *path, size_t size)
@@ -832,6 +1050,18 @@ bool retro_load_game(const struct retro_game_info *info)
 
    update_variables(true);
 
+   if (xrgb8888)
+   {
+      enum retro_pixel_format fmt = RETRO_PIXEL_FORMAT_XRGB8888;
+
+      if (!environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
+      {
+         if (log_cb)
+            log_cb(RETRO_LOG_WARN, "XRGB8888 is not supported, using RGB565.\n");
+         xrgb8888 = false;
+      }
+   }
+
    extract_directory(g_rom_dir, info->path, sizeof(g_rom_dir));
 
    snprintf(g_pak_path, sizeof(g_pak_path), "%s", info->path);
@@ -921,6 +1151,15 @@ bool retro_load_game(const struct retro_game_info *info)
       extract_directory(g_rom_dir, g_rom_dir, sizeof(g_rom_dir));
    }
 
+   if (mmap_paks)
+      argv[parms.argc++] = "-mmap";
+
+   if (job_threads[0])
+   {
+      argv[parms.argc++] = "-jobthreads";
+      argv[parms.argc++] = job_threads;
+   }
+
    parms.argv = argv;
 
    COM_InitArgv(parms.argc, parms.argv);
@@ -928,7 +1167,7 @@ bool retro_load_game(const struct retro_game_info *info)
    parms.argc = com_argc;
    parms.argv = com_argv;
 
-   heap = (unsigned char*)malloc(parms.memsize);
+   heap = (unsigned char*)Memory_Reserve(parms.memsize);
 
    parms.membase = heap;
 
@@ -958,8 +1197,20 @@ bool retro_load_game(const struct retro_game_info *info)
    }
 
    Cvar_RegisterVariable(&framerate);
-   Cvar_Set("framerate", "60");
-   Cvar_Set("sys_ticrate", "0.016667");
+   Cvar_RegisterVariable(&snd_direct);
+   Cvar_SetValue("framerate", target_framerate());
+   Cvar_SetValue("sys_ticrate", 1.0 / framerate.value);
+
+   /* The frontend paces the frames, and tells us how long each one took */
+   Cvar_SetValue("host_maxfps", 0);
+   {
+      struct retro_frame_time_callback frame_time;
+
+      frame_time.callback = frame_time_cb;
+      frame_time.reference = 1000000 / framerate.value;
+      if (!environ_cb(RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK, &frame_time))
+         frame_usec = 0;
+   }
 
 
    /* Override some default binds with more modern ones if we are booting the 
@@ -994,6 +1245,10 @@ bool retro_load_game(const struct retro_game_info *info)
    Cmd_ExecuteString("bind AUX7 \"+lookup\"", src_command);
    Cmd_ExecuteString("bind AUX8 \"+lookdown\"", src_command);
 
+   /* After quake.rc, so it times the startdemos list */
+   if (benchmark_at_start)
+      Cbuf_AddText("benchmark\n");
+
    return true;
 }
 
@@ -1018,17 +1273,17 @@ bool retro_load_game_special(unsigned type, const struct retro_game_info *info,
 
 size_t retro_serialize_size(void)
 {
-   return 0;
+   return SaveState_Size();
 }
 
 bool retro_serialize(void *data_, size_t size)
 {
-   return false;
+   return SaveState_Save(data_, size);
 }
 
 bool retro_unserialize(const void *data_, size_t size)
 {
-   return false;
+   return SaveState_Load(data_, size);
 }
 
 void *retro_get_memory_data(unsigned id)
@@ -1059,19 +1314,48 @@ void retro_cheat_set(unsigned index, bool enabled, const char *code)
  * VIDEO
  */
 
-unsigned short d_8to16table[256];
-
 #define MAKECOLOR(r, g, b) (((r & 0xf8) << 8) | ((g & 0xfc) << 3) | ((b & 0xf8) >> 3))
 
 
 void VID_SetPalette(unsigned char *palette)
 {
+   unsigned short table16[256];
+   uint32_t table32[256];
    unsigned i, j;
-   unsigned short *pal = &d_8to16table[0];
+   bool changed;
+
+   for (i = 0, j = 0; i < 256; i++, j += 3)
+   {
+      table16[i] = MAKECOLOR(palette[j], palette[j+1], palette[j+2]);
+      table32[i] = (palette[j] << 16) | (palette[j+1] << 8) | palette[j+2];
+   }
 
-   for(i = 0, j = 0; i < 256; i++, j += 3)
-      *pal++ = MAKECOLOR(palette[j], palette[j+1], palette[j+2]);
+   /*
+    * A flash fades a little every frame, often not by enough to change the
+    * colours the frame is converted to, and then the whole frame needn't
+    * be converted again. The table not in use can be changed under a
+    * conversion.
+    */
+   if (xrgb8888)
+      changed = memcmp(table32, d_8to32table, sizeof(table32)) != 0;
+   else
+      changed = memcmp(table16, d_8to16table, sizeof(table16)) != 0;
+   if (!changed)
+   {
+      if (xrgb8888)
+         memcpy(d_8to16table, table16, sizeof(table16));
+      else
+         memcpy(d_8to32table, table32, sizeof(table32));
+      return;
+   }
 
+   VID_LockBuffer();
+   memcpy(d_8to16table, table16, sizeof(table16));
+   memcpy(d_8to32table, table32, sizeof(table32));
+   VID_UpdateConvertTables();
+
+   /* every pixel on screen may have changed colour */
+   vid_fullupdate = true;
 }
 
 unsigned 	d_8to24table[256];
@@ -1116,7 +1400,8 @@ void VID_Init(unsigned char *palette)
    /* TODO */
    vid_buffer = (byte*)malloc(width * height * sizeof(byte));
    zbuffer = (short*)malloc(width * height * sizeof(short));
-   finalimage = (short*)malloc(width * height * sizeof(short));
+   finalimage = malloc(width * height * (xrgb8888 ? sizeof(uint32_t) : sizeof(uint16_t)));
+   vid_fullupdate = true;
 
     vid.width = width;
     vid.height = height;
@@ -1133,47 +1418,150 @@ void VID_Init(unsigned char *palette)
     vid.aspect = ((float)vid.height / (float)vid.width) * (320.0 / 240.0);
 
     d_pzbuffer = zbuffer;
-    surfcache = malloc(SURFCACHE_SIZE);
-    D_InitCaches(surfcache, SURFCACHE_SIZE);
+    D_AllocCaches(SURFCACHE_SIZE);
 }
 
 void VID_Shutdown(void)
 {
+   VID_LockBuffer();
+   vid_present = false;
    if (vid_buffer)
       free(vid_buffer);
    if (zbuffer)
       free(zbuffer);
    if (finalimage)
       free(finalimage);
-   if (surfcache)
-      free(surfcache);
+   D_FreeCaches();
    vid_buffer = NULL;
    zbuffer    = NULL;
    finalimage = NULL;
-   surfcache  = NULL;
 }
 
-void VID_Update(vrect_t *rects)
+/*
+ * The frame is converted on the job threads while the rest of the frame and
+ * the sound mixing carry on, and handed over at the end of retro_run. Big
+ * areas are cut into bands of rows. Nothing may draw into vid.buffer or
+ * change the palette until VID_LockBuffer has waited for it.
+ */
+#define MAX_CONVERT_AREAS 16
+#define MAX_CONVERT_JOBS JOB_MAX_SPLIT(MAX_JOB_THREADS)
+#define MIN_CONVERT_ROWS 16
+#define MIN_CONVERT_PIXELS (256 * 1024)
+
+typedef struct
 {
-   unsigned x, y;
-   unsigned pitch              = width;
-   uint8_t *ilineptr           = (uint8_t*)vid.buffer;
-   uint16_t *olineptr          = (uint16_t*)finalimage;
-   uint16_t *pal               = (uint16_t*)&d_8to16table;
-   uint16_t *ptr               = (uint16_t*)finalimage;
+   int x, y, w;
+} vid_convert_t;
 
+static vid_convert_t vid_converts[MAX_CONVERT_AREAS];
+static job_t vid_convertjobs[MAX_CONVERT_AREAS][MAX_CONVERT_JOBS];
+static int vid_numconverts;
+static jobgroup_t vid_converting;
+
+static const char *VID_ConvertRows(void *data, int start, int end)
+{
+   const vid_convert_t *area = (const vid_convert_t*)data;
+   int row;
+
+   if (xrgb8888)
+   {
+      for (row = area->y + start; row < area->y + end; row++)
+         VID_ConvertSpan32((uint8_t*)vid.buffer + row * vid.rowbytes + area->x,
+               (uint32_t*)finalimage + row * width + area->x, area->w);
+   }
+   else
+   {
+      for (row = area->y + start; row < area->y + end; row++)
+         VID_ConvertSpan((uint8_t*)vid.buffer + row * vid.rowbytes + area->x,
+               (uint16_t*)finalimage + row * width + area->x, area->w);
+   }
+
+   return NULL;
+}
+
+static void VID_ConvertRect(int x, int y, int w, int h)
+{
+   vid_convert_t *area;
+   int numjobs;
+
+   /* clip to the screen */
+   if (x < 0)
+   {
+      w += x;
+      x  = 0;
+   }
+   if (y < 0)
+   {
+      h += y;
+      y  = 0;
+   }
+   if (x + w > (int)width)
+      w = width - x;
+   if (y + h > (int)height)
+      h = height - y;
+   if (w <= 0 || h <= 0)
+      return;
+
+   if (vid_numconverts == MAX_CONVERT_AREAS)
+   {
+      Job_Wait(&vid_converting);
+      vid_numconverts = 0;
+   }
+   area = &vid_converts[vid_numconverts];
+   area->x = x;
+   area->y = y;
+   area->w = w;
+
+   numjobs = Job_Split(vid_convertjobs[vid_numconverts], 0, MAX_CONVERT_JOBS,
+         VID_ConvertRows, area, h,
+         w * h < MIN_CONVERT_PIXELS ? h : MIN_CONVERT_ROWS);
+   Job_Submit(vid_convertjobs[vid_numconverts], numjobs, &vid_converting,
+         NULL);
+   vid_numconverts++;
+}
+
+/*
+ * Hands the converted frame over, once VID_Update's conversion is done
+ */
+static void VID_Present(void)
+{
+   unsigned pitch = width * (xrgb8888 ? sizeof(uint32_t) : sizeof(uint16_t));
+
+   if (!vid_present)
+      return;
+
+   Prof_Begin(PROF_VIDEO);
+   VID_LockBuffer();
+   video_cb(finalimage, width, height, pitch);
+   vid_present = false;
+   Prof_End(PROF_VIDEO);
+}
+
+void VID_Update(vrect_t *rects)
+{
    if (!video_cb || !rects)
       return;
 
-   for (y = 0; y < rects->height; ++y)
+   Prof_Begin(PROF_VIDEO);
+   VID_LockBuffer();
+
+   /*
+    * Without dirty rects, or after the palette changed, the whole frame has
+    * to be converted. Otherwise only the areas the engine says it redrew.
+    */
+   if (!dirty_rects || vid_fullupdate)
+      VID_ConvertRect(0, 0, width, height);
+   else
    {
-      for (x = 0; x < rects->width; ++x)
-         *olineptr++ = pal[*ilineptr++];
-      olineptr += pitch - rects->width;
+      for (; rects; rects = rects->pnext)
+         VID_ConvertRect(rects->x, rects->y, rects->width, rects->height);
    }
+   vid_fullupdate = false;
 
-   video_cb(ptr, width, height, pitch << 1);
+   vid_present = true;
    did_flip = true;
+
+   Prof_End(PROF_VIDEO);
 }
 
 qboolean VID_IsFullScreen(void)
@@ -1181,8 +1569,13 @@ qboolean VID_IsFullScreen(void)
     return true;
 }
 
+/*
+ * Waits for the conversion of the last frame to be done with vid.buffer
+ */
 void VID_LockBuffer(void)
 {
+   Job_Wait(&vid_converting);
+   vid_numconverts = 0;
 }
 
 void VID_UnlockBuffer(void)
@@ -1208,6 +1601,10 @@ static unsigned audio_buffer_ptr;
 
 static void audio_process(void)
 {
+   /* a capture takes each frame's mix as it is made */
+   if (shm)
+      shm->direct = snd_direct.value != 0 || Capture_Active();
+
    /* adds music raw samples and/or advances midi driver */
    BGM_Update(); 
    /* update audio */
@@ -1222,11 +1619,34 @@ static void audio_process(void)
    CDAudio_Update();
 }
 
-static void audio_callback(void)
+static void audio_callback(double frametime)
 {
-   unsigned read_first, read_second;
-   float samples_per_frame = (2 * SAMPLERATE) / framerate.value;
-   unsigned read_end = audio_buffer_ptr + samples_per_frame;
+   static double frames_left;
+   double frames = SAMPLERATE * frametime + frames_left;
+   unsigned read_first, read_second, read_end, samples_per_frame;
+
+   /* carry the fractional frame over so that audio doesn't drift */
+   samples_per_frame = (unsigned)frames;
+   frames_left = frames - samples_per_frame;
+   samples_per_frame *= 2;
+   if (samples_per_frame > AUDIO_BUFFER_SAMPLES)
+      samples_per_frame = AUDIO_BUFFER_SAMPLES;
+
+   if (shm->direct)
+   {
+      if (!audio_enabled)
+      {
+         /* the sounds still play on, but nothing is mixed or sent */
+         S_PaintDirect(NULL, samples_per_frame / 2);
+         return;
+      }
+      /* exactly this frame's samples, mixed from the start of the buffer */
+      S_PaintDirect(audio_buffer, samples_per_frame / 2);
+      audio_batch_cb(audio_buffer, samples_per_frame / 2);
+      return;
+   }
+
+   read_end = audio_buffer_ptr + samples_per_frame;
 
    if (read_end > AUDIO_BUFFER_SAMPLES)
       read_end = AUDIO_BUFFER_SAMPLES;
@@ -21,6 +21,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include <math.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "mathlib.h"
 #include "model.h"
 #include "sys.h"
@@ -170,117 +176,6 @@ SignbitsForPlane(const mplane_t *plane)
    return bits;
 }
 
-/*
-==================
-BOPS_Error
-
-Split out like this for ASM to call.
-==================
-*/
-void BOPS_Error(void)
-{
-    Sys_Error("%s:  Bad signbits", __func__);
-}
-
-/*
-==================
-BoxOnPlaneSide
-
-Returns PSIDE_FRONT, PSIDE_BACK, or PSIDE_BOTH (PSIDE_FRONT | PSIDE_BACK)
-==================
-*/
-int
-BoxOnPlaneSide(const vec3_t mins, const vec3_t maxs, const mplane_t *p)
-{
-   float dist1 = 0.0f, dist2 = 0.0f;
-   int sides;
-
-   /* general case */
-   switch (p->signbits)
-   {
-      case 0:
-         dist1 =
-            p->normal[0] * maxs[0] + p->normal[1] * maxs[1] +
-            p->normal[2] * maxs[2];
-         dist2 =
-            p->normal[0] * mins[0] + p->normal[1] * mins[1] +
-            p->normal[2] * mins[2];
-         break;
-      case 1:
-         dist1 =
-            p->normal[0] * mins[0] + p->normal[1] * maxs[1] +
-            p->normal[2] * maxs[2];
-         dist2 =
-            p->normal[0] * maxs[0] + p->normal[1] * mins[1] +
-            p->normal[2] * mins[2];
-         break;
-      case 2:
-         dist1 =
-            p->normal[0] * maxs[0] + p->normal[1] * mins[1] +
-            p->normal[2] * maxs[2];
-         dist2 =
-            p->normal[0] * mins[0] + p->normal[1] * maxs[1] +
-            p->normal[2] * mins[2];
-         break;
-      case 3:
-         dist1 =
-            p->normal[0] * mins[0] + p->normal[1] * mins[1] +
-            p->normal[2] * maxs[2];
-         dist2 =
-            p->normal[0] * maxs[0] + p->normal[1] * maxs[1] +
-            p->normal[2] * mins[2];
-         break;
-      case 4:
-         dist1 =
-            p->normal[0] * maxs[0] + p->normal[1] * maxs[1] +
-            p->normal[2] * mins[2];
-         dist2 =
-            p->normal[0] * mins[0] + p->normal[1] * mins[1] +
-            p->normal[2] * maxs[2];
-         break;
-      case 5:
-         dist1 =
-            p->normal[0] * mins[0] + p->normal[1] * maxs[1] +
-            p->normal[2] * mins[2];
-         dist2 =
-            p->normal[0] * maxs[0] + p->normal[1] * mins[1] +
-            p->normal[2] * maxs[2];
-         break;
-      case 6:
-         dist1 =
-            p->normal[0] * maxs[0] + p->normal[1] * mins[1] +
-            p->normal[2] * mins[2];
-         dist2 =
-            p->normal[0] * mins[0] + p->normal[1] * maxs[1] +
-            p->normal[2] * maxs[2];
-         break;
-      case 7:
-         dist1 =
-            p->normal[0] * mins[0] + p->normal[1] * mins[1] +
-            p->normal[2] * mins[2];
-         dist2 =
-            p->normal[0] * maxs[0] + p->normal[1] * maxs[1] +
-            p->normal[2] * maxs[2];
-         break;
-      default:
-         BOPS_Error();
-         break;
-   }
-
-   sides = 0;
-   if (dist1 >= p->dist)
-      sides = PSIDE_FRONT;
-   if (dist2 < p->dist)
-      sides |= PSIDE_BACK;
-
-#ifdef PARANOID
-   if (sides == 0)
-      Sys_Error("%s: sides == 0", __func__);
-#endif
-
-   return sides;
-}
-
 void
 AngleVectors(const vec3_t angles, vec3_t forward, vec3_t right, vec3_t up)
 {
@@ -319,13 +214,6 @@ VectorCompare(vec3_t v1, vec3_t v2)
    return 1;
 }
 
-void VectorMA(const vec3_t veca, const float scale, const vec3_t vecb, vec3_t vecc)
-{
-   vecc[0] = veca[0] + scale * vecb[0];
-   vecc[1] = veca[1] + scale * vecb[1];
-   vecc[2] = veca[2] + scale * vecb[2];
-}
-
 
 vec_t _DotProduct(vec3_t v1, vec3_t v2)
 {
@@ -353,39 +241,6 @@ void _VectorCopy(vec3_t in, vec3_t out)
    out[2] = in[2];
 }
 
-void CrossProduct(const vec3_t v1, const vec3_t v2, vec3_t cross)
-{
-#ifdef __ARM_NEON__
-   asm volatile (
-         "flds s3, [%0] \n\t" //d1[1]={x0}
-         "add %0, %0, #4 \n\t" //
-         "vld1.32 {d0}, [%0] \n\t" //d0={y0,z0}
-         "vmov.f32 s2, s1 \n\t" //d1[0]={z0}
-
-         "flds s5, [%1] \n\t" //d2[1]={x1}
-         "add %1, %1, #4 \n\t" //
-         "vld1.32 {d3}, [%1] \n\t" //d3={y1,z1}
-         "vmov.f32 s4, s7 \n\t" //d2[0]=d3[1]
-
-         "vmul.f32 d4, d0, d2 \n\t" //d4=d0*d2
-         "vmls.f32 d4, d1, d3 \n\t" //d4-=d1*d3
-
-         "vmul.f32 d5, d3, d1[1]                 \n\t" //d5=d3*d1[1]
-         "vmls.f32 d5, d0, d2[1]                          \n\t" //d5-=d0*d2[1]
-
-         "vst1.32 d4, [%2] \n\t" //
-         "fsts s10, [%2, #8] \n\t" //
-
-         : "+&r"(v1), "+&r"(v2), "+&r"(cross):
-            : "d0", "d1", "d2", "d3", "d4", "d5", "memory"
-               ); 
-#else
-         cross[0] = v1[1] * v2[2] - v1[2] * v2[1];
-         cross[1] = v1[2] * v2[0] - v1[0] * v2[2];
-         cross[2] = v1[0] * v2[1] - v1[1] * v2[0];
-#endif
-}
-
 double sqrt(double x);
 
 vec_t Length(vec3_t v)
@@ -417,20 +272,6 @@ float VectorNormalize(vec3_t v)
    return length;
 }
 
-void VectorInverse(vec3_t v)
-{
-    v[0] = -v[0];
-    v[1] = -v[1];
-    v[2] = -v[2];
-}
-
-void VectorScale(const vec3_t in, const vec_t scale, vec3_t out)
-{
-    out[0] = in[0] * scale;
-    out[1] = in[1] * scale;
-    out[2] = in[2] * scale;
-}
-
 
 int Q_log2(int val)
 {
@@ -504,6 +345,63 @@ R_ConcatTransforms(float in1[3][4], float in2[3][4], float out[3][4])
 	in1[2][2] * in2[2][3] + in1[2][3];
 }
 
+/*
+================
+TransformPoints
+
+Puts count points through the transform, as DotProduct with each row plus
+its translation would. The columns are multiplied in and summed in the
+same order, so the results are the same.
+================
+*/
+void
+TransformPoints(float transform[3][4], const vec3_t *in, vec3_t *out,
+		int count)
+{
+    int i;
+#if defined(__SSE2__)
+    __m128 column[4], point;
+    float result[4];
+
+    for (i = 0; i < 4; i++)
+	column[i] = _mm_setr_ps(transform[0][i], transform[1][i],
+				transform[2][i], 0);
+    for (i = 0; i < count; i++) {
+	point = _mm_mul_ps(_mm_set1_ps(in[i][0]), column[0]);
+	point = _mm_add_ps(point, _mm_mul_ps(_mm_set1_ps(in[i][1]), column[1]));
+	point = _mm_add_ps(point, _mm_mul_ps(_mm_set1_ps(in[i][2]), column[2]));
+	point = _mm_add_ps(point, column[3]);
+	_mm_storeu_ps(result, point);
+	VectorCopy(result, out[i]);
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t column[4], point;
+    float result[4];
+    int j;
+
+    for (i = 0; i < 4; i++) {
+	for (j = 0; j < 3; j++)
+	    result[j] = transform[j][i];
+	result[3] = 0;
+	column[i] = vld1q_f32(result);
+    }
+    for (i = 0; i < count; i++) {
+	point = vmulq_n_f32(column[0], in[i][0]);
+	point = vaddq_f32(point, vmulq_n_f32(column[1], in[i][1]));
+	point = vaddq_f32(point, vmulq_n_f32(column[2], in[i][2]));
+	point = vaddq_f32(point, column[3]);
+	vst1q_f32(result, point);
+	VectorCopy(result, out[i]);
+    }
+#else
+    for (i = 0; i < count; i++) {
+	out[i][0] = DotProduct(in[i], transform[0]) + transform[0][3];
+	out[i][1] = DotProduct(in[i], transform[1]) + transform[1][3];
+	out[i][2] = DotProduct(in[i], transform[2]) + transform[2][3];
+    }
+#endif
+}
+
 
 /*
 ===================
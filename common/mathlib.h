@@ -61,8 +61,41 @@ extern int nanmask;
 #define VectorAdd(a,b,c) do {c[0]=a[0]+b[0];c[1]=a[1]+b[1];c[2]=a[2]+b[2];} while (0)
 #define VectorCopy(a,b) do {b[0]=a[0];b[1]=a[1];b[2]=a[2];} while (0)
 
-void VectorMA(const vec3_t veca, const float scale, const vec3_t vecb,
-	      vec3_t vecc);
+/*
+ * The small helpers are inline, they're called all over the physics and
+ * the renderer for a handful of operations each.
+ */
+static INLINE void
+VectorMA(const vec3_t veca, const float scale, const vec3_t vecb, vec3_t vecc)
+{
+    vecc[0] = veca[0] + scale * vecb[0];
+    vecc[1] = veca[1] + scale * vecb[1];
+    vecc[2] = veca[2] + scale * vecb[2];
+}
+
+static INLINE void
+CrossProduct(const vec3_t v1, const vec3_t v2, vec3_t cross)
+{
+    cross[0] = v1[1] * v2[2] - v1[2] * v2[1];
+    cross[1] = v1[2] * v2[0] - v1[0] * v2[2];
+    cross[2] = v1[0] * v2[1] - v1[1] * v2[0];
+}
+
+static INLINE void
+VectorInverse(vec3_t v)
+{
+    v[0] = -v[0];
+    v[1] = -v[1];
+    v[2] = -v[2];
+}
+
+static INLINE void
+VectorScale(const vec3_t in, const vec_t scale, vec3_t out)
+{
+    out[0] = in[0] * scale;
+    out[1] = in[1] * scale;
+    out[2] = in[2] * scale;
+}
 
 vec_t _DotProduct(vec3_t v1, vec3_t v2);
 void _VectorSubtract(vec3_t veca, vec3_t vecb, vec3_t out);
@@ -71,14 +104,13 @@ void _VectorCopy(vec3_t in, vec3_t out);
 
 int VectorCompare(vec3_t v1, vec3_t v2);
 vec_t Length(vec3_t v);
-void CrossProduct(const vec3_t v1, const vec3_t v2, vec3_t cross);
 float VectorNormalize(vec3_t v);	// returns vector length
-void VectorInverse(vec3_t v);
-void VectorScale(const vec3_t in, const vec_t scale, vec3_t out);
 int Q_log2(int val);
 
 void R_ConcatRotations(float in1[3][3], float in2[3][3], float out[3][3]);
 void R_ConcatTransforms(float in1[3][4], float in2[3][4], float out[3][4]);
+void TransformPoints(float transform[3][4], const vec3_t *in, vec3_t *out,
+		     int count);
 
 void FloorDivMod(double numer, double denom, int *quotient, int *rem);
 fixed16_t Invert24To16(fixed16_t val);
@@ -103,7 +135,37 @@ int SignbitsForPlane(const mplane_t *plane); /* sign bits for BOPS test */
 #define PSIDE_BACK  2
 #define PSIDE_BOTH  (PSIDE_FRONT | PSIDE_BACK)
 
-int BoxOnPlaneSide(const vec3_t mins, const vec3_t maxs, const mplane_t *plane);
+/*
+ * Returns PSIDE_FRONT, PSIDE_BACK, or PSIDE_BOTH (PSIDE_FRONT | PSIDE_BACK).
+ * On each axis the nearer and farther of the two corners' products are the
+ * ones the plane's sign bits would pick, without going through them.
+ */
+static INLINE int
+BoxOnPlaneSide(const vec3_t mins, const vec3_t maxs, const mplane_t *plane)
+{
+    float lo, hi, nearest, farthest;
+    int i, sides;
+
+    lo = plane->normal[0] * mins[0];
+    hi = plane->normal[0] * maxs[0];
+    nearest = qmin(lo, hi);
+    farthest = qmax(lo, hi);
+    for (i = 1; i < 3; i++) {
+	lo = plane->normal[i] * mins[i];
+	hi = plane->normal[i] * maxs[i];
+	nearest += qmin(lo, hi);
+	farthest += qmax(lo, hi);
+    }
+
+    sides = 0;
+    if (farthest >= plane->dist)
+	sides = PSIDE_FRONT;
+    if (nearest < plane->dist)
+	sides |= PSIDE_BACK;
+
+    return sides;
+}
+
 #define BOX_ON_PLANE_SIDE(mins, maxs, p)			\
 	(((p)->type < 3)?					\
 	(							\
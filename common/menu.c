@@ -116,6 +116,17 @@ enum m_state_enum {
 
 static int m_state;
 
+/*
+ * Back to the menu the connection was made from, when it failed
+ */
+void
+M_ReturnOnError(void)
+{
+    key_dest = key_menu;
+    m_state = m_return_state;
+    m_return_onerror = false;
+}
+
 #include "libretro.h"
 extern retro_environment_t environ_cb;
 
@@ -492,6 +503,8 @@ static void M_ScanSaves(void)
    char slash = '/';
 #endif
 
+   Host_SavegameWait(true);
+
    for (i = 0; i < MAX_SAVEGAMES; i++)
    {
       int j, version;
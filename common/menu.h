@@ -44,6 +44,7 @@ void M_PrintWhite(int cx, int cy, const char *str);
 extern qboolean m_return_onerror;
 extern char m_return_reason[32];
 extern int m_return_state;
+void M_ReturnOnError(void);
 #ifndef _WIN32
 typedef int m_state_enum;
 #endif
@@ -25,10 +25,20 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <float.h>
 #include <stdint.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "cmd.h"
 #include "common.h"
 #include "console.h"
+#include "crc.h"
+#include "cvar.h"
+#include "jobs.h"
 #include "model.h"
+#include "namehash.h"
 
 #ifdef SERVERONLY
 #include "qwsvdef.h"
@@ -38,9 +48,6 @@ static texture_t r_notexture_mip_qwsv;
 #include "quakedef.h"
 #include "render.h"
 #include "sys.h"
-#ifdef QW_HACK
-#include "crc.h"
-#endif
 /* FIXME - quick hack to enable merging of NQ/QWSV shared code */
 #define SV_Error Sys_Error
 #endif
@@ -48,16 +55,31 @@ static texture_t r_notexture_mip_qwsv;
 static model_t *loadmodel;
 static char loadname[MAX_QPATH];	/* for hunk tags */
 
+/*
+ * Lump conversion jobs for the brush model being loaded. The output arrays
+ * are allocated on the main thread when the job is queued, so the jobs
+ * themselves only byte-swap and convert the lump data into them.
+ */
+#define MAX_MOD_JOBS (16 * JOB_MAX_SPLIT(MAX_JOB_THREADS))
+#define MOD_JOB_GRAIN 1024
+static job_t mod_jobs[MAX_MOD_JOBS];
+static int mod_numjobs;
+
 static void Mod_LoadBrushModel(model_t *mod, void *buffer, unsigned long size);
 static model_t *Mod_LoadModel(model_t *mod, qboolean crash);
 
 #define MAX_MOD_KNOWN 512
 static model_t mod_known[MAX_MOD_KNOWN];
 static int mod_numknown;
+static int mod_knownchains[256];
+static int mod_knownnext[MAX_MOD_KNOWN];
+static namehash_t mod_knownhash = NAMEHASH_STATIC(mod_knownchains, mod_knownnext);
 
 static const model_loader_t *mod_loader;
 
 static void PVSCache_f(void);
+static cvar_t pvscache_size = { "pvscache_size", "64" };
+static cvar_t pvstable_maxleafs = { "pvstable_maxleafs", "1024" };
 
 // leilei HACK
 
@@ -73,9 +95,52 @@ void
 Mod_Init(const model_loader_t *loader)
 {
     Cmd_AddCommand("pvscache", PVSCache_f);
+    Cvar_RegisterVariable(&pvscache_size);
+    Cvar_RegisterVariable(&pvstable_maxleafs);
+#ifndef SERVERONLY
+    Cvar_RegisterVariable(&mod_aliascache);
+#endif
     mod_loader = loader;
 }
 
+/*
+ * A compact copy of the nodes for Mod_PointInLeaf, with the planes folded
+ * in. A negative child is the leaf numbered -1 - child.
+ */
+typedef struct mpointnode_s {
+   vec3_t normal;
+   float dist;
+   int type;
+   int children[2];
+} mpointnode_t;
+
+static int mod_brushloads;	/* counts the brush models loaded */
+
+static void Mod_MakePointNodes(model_t *mod)
+{
+   mpointnode_t *out;
+   const mnode_t *in;
+   const mnode_t *child;
+   int i, j;
+
+   out = Hunk_AllocName(mod->numnodes * sizeof(*out), "pointnodes");
+   mod->pointnodes = out;
+   for (i = 0, in = mod->nodes; i < mod->numnodes; i++, in++, out++)
+   {
+      VectorCopy(in->plane->normal, out->normal);
+      out->dist = in->plane->dist;
+      out->type = in->plane->type;
+      for (j = 0; j < 2; j++)
+      {
+         child = in->children[j];
+         if (child->contents < 0)
+            out->children[j] = -1 - (int)((const mleaf_t *)child - mod->leafs);
+         else
+            out->children[j] = child - mod->nodes;
+      }
+   }
+}
+
 /*
 ===============
 Mod_PointInLeaf
@@ -88,6 +153,24 @@ mleaf_t * Mod_PointInLeaf(const model_t *model, const vec3_t point)
    if (!model || !model->nodes)
       SV_Error("%s: bad model", __func__);
 
+   if (model->pointnodes)
+   {
+      const mpointnode_t *pointnode;
+      float dist;
+      int num = 0;
+
+      do {
+         pointnode = &model->pointnodes[num];
+         if (pointnode->type < 3)
+            dist = point[pointnode->type] - pointnode->dist;
+         else
+            dist = DotProduct(point, pointnode->normal) - pointnode->dist;
+         num = pointnode->children[!(dist > 0)];
+      } while (num >= 0);
+
+      return model->leafs + (-1 - num);
+   }
+
    node = model->nodes;
 
    while (1)
@@ -107,6 +190,22 @@ mleaf_t * Mod_PointInLeaf(const model_t *model, const vec3_t point)
    return NULL;		// never reached
 }
 
+mleaf_t *Mod_PointInLeafHint(const model_t *model, const vec3_t point,
+      mleafhint_t *hint)
+{
+   if (hint->leaf && hint->model == model && hint->sequence == mod_brushloads
+         && point[0] == hint->point[0] && point[1] == hint->point[1]
+         && point[2] == hint->point[2])
+      return hint->leaf;
+
+   hint->model = model;
+   hint->sequence = mod_brushloads;
+   VectorCopy(point, hint->point);
+   hint->leaf = Mod_PointInLeaf(model, point);
+
+   return hint->leaf;
+}
+
 void
 Mod_AddLeafBits(leafbits_t *dst, const leafbits_t *src)
 {
@@ -121,8 +220,24 @@ Mod_AddLeafBits(leafbits_t *dst, const leafbits_t *src)
     srcblock = src->bits;
     dstblock = dst->bits;
     leafblocks = (src->numleafs + LEAFMASK) >> LEAFSHIFT;
-    for (i = 0; i < leafblocks; i++)
-	*dstblock++ |= *srcblock++;
+    i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 / (int)sizeof(leafblock_t) <= leafblocks;
+	 i += 16 / sizeof(leafblock_t)) {
+	__m128i a = _mm_loadu_si128((const __m128i *)(dstblock + i));
+	__m128i b = _mm_loadu_si128((const __m128i *)(srcblock + i));
+	_mm_storeu_si128((__m128i *)(dstblock + i), _mm_or_si128(a, b));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 / (int)sizeof(leafblock_t) <= leafblocks;
+	 i += 16 / sizeof(leafblock_t)) {
+	uint8x16_t a = vld1q_u8((const uint8_t *)(dstblock + i));
+	uint8x16_t b = vld1q_u8((const uint8_t *)(srcblock + i));
+	vst1q_u8((uint8_t *)(dstblock + i), vorrq_u8(a, b));
+    }
+#endif
+    for (; i < leafblocks; i++)
+	dstblock[i] |= srcblock[i];
 }
 
 #ifdef SERVERONLY
@@ -147,27 +262,52 @@ Mod_CountLeafBits(const leafbits_t *leafbits)
 #endif
 
 /*
- * Simple LRU cache for decompressed vis data
+ * Set-associative LRU cache for decompressed vis data, keyed on (model,
+ * leaf). The number of entries is taken from the pvscache_size cvar when
+ * the cache is created for a new map and rounded up to a power-of-two
+ * number of sets. The leafbits for every entry live in one hunk block.
  */
 typedef struct {
     const model_t *model;
     const mleaf_t *leaf;
+    unsigned int lastused;
     leafbits_t *leafbits;
 } pvscache_t;
-static pvscache_t pvscache[2];
+static pvscache_t *pvscache;
+static int pvscache_numsets;
+static unsigned int pvscache_clock;
 static leafbits_t *fatpvs;
 static int pvscache_numleafs;
+
+/*
+ * The view's vis is kept apart from the cache, so the renderer can look it
+ * up while the server runs its frame on another thread.
+ */
+static leafbits_t *viewpvs;
+static const model_t *viewpvs_model;
+static const mleaf_t *viewpvs_leaf;
 static int pvscache_bytes;
 static int pvscache_blocks;
 
-static int c_cachehit, c_cachemiss;
+static int c_cachehit, c_cachemiss, c_cacheevict;
+static int c_fatpvshit, c_fatpvsmiss;
 
-#define PVSCACHE_SIZE ARRAY_SIZE(pvscache)
+/* Must be at least two, so the last two results are never evicted */
+#define PVSCACHE_WAYS 4
+
+/*
+ * Maps with no more than pvstable_maxleafs leafs get the vis for every leaf
+ * decompressed at load time instead (see Mod_LoadPVSTable), which makes
+ * Mod_LeafPVS a table lookup. Costs about numleafs^2 / 8 bytes of hunk.
+ */
+static const model_t *pvstable_model;
+static byte *pvstable;
+static int pvstable_rowsize;
 
 static void
 Mod_InitPVSCache(int numleafs)
 {
-    int i;
+    int i, numentries;
     int memsize;
     byte *leafmem;
 
@@ -176,11 +316,21 @@ Mod_InitPVSCache(int numleafs)
     pvscache_blocks = pvscache_bytes / sizeof(leafblock_t);
     memsize = Mod_LeafbitsSize(numleafs);
     fatpvs = (leafbits_t*)Hunk_AllocName(memsize, "fatpvs");
-
-    memset(pvscache, 0, sizeof(pvscache));
-    leafmem = (byte*)Hunk_AllocName(PVSCACHE_SIZE * memsize, "pvscache");
-    for (i = 0; i < PVSCACHE_SIZE; i++)
+    viewpvs = (leafbits_t*)Hunk_AllocName(memsize, "viewpvs");
+    viewpvs_model = NULL;
+    viewpvs_leaf = NULL;
+
+    pvscache_numsets = 1;
+    while (pvscache_numsets * PVSCACHE_WAYS < pvscache_size.value)
+	pvscache_numsets <<= 1;
+    numentries = pvscache_numsets * PVSCACHE_WAYS;
+
+    pvscache = (pvscache_t*)Hunk_AllocName(numentries * sizeof(pvscache_t),
+					   "pvscache");
+    leafmem = (byte*)Hunk_AllocName(numentries * memsize, "pvscache");
+    for (i = 0; i < numentries; i++)
 	pvscache[i].leafbits = (leafbits_t *)(leafmem + i * memsize);
+    pvscache_clock = 0;
 }
 
 /*
@@ -237,43 +387,101 @@ Mod_DecompressVis(const byte *in, const model_t *model, leafbits_t *dest)
 const leafbits_t *
 Mod_LeafPVS(const model_t *model, const mleaf_t *leaf)
 {
-    int slot;
-    pvscache_t tmp;
-
-    for (slot = 0; slot < PVSCACHE_SIZE; slot++)
-	if (pvscache[slot].model == model && pvscache[slot].leaf == leaf) {
-	    c_cachehit++;
+    int way, leafnum;
+    unsigned int hash;
+    pvscache_t *set, *entry;
+
+    leafnum = leaf - model->leafs;
+    if (model == pvstable_model && leafnum <= model->numleafs)
+	return (const leafbits_t *)(pvstable + leafnum * pvstable_rowsize);
+
+    hash = ((uintptr_t)model >> 4) ^ (leafnum * 2654435761U);
+    set = pvscache + (hash & (pvscache_numsets - 1)) * PVSCACHE_WAYS;
+
+    /*
+     * Look for a hit, otherwise take the first unused way or replace the
+     * least recently used one. Ways are filled in order, so there can't be
+     * any hits after an unused one.
+     */
+    entry = set;
+    for (way = 0; way < PVSCACHE_WAYS; way++) {
+	if (!set[way].model) {
+	    entry = &set[way];
 	    break;
 	}
+	if (set[way].model == model && set[way].leaf == leaf) {
+	    c_cachehit++;
+	    set[way].lastused = ++pvscache_clock;
+	    return set[way].leafbits;
+	}
+	if (pvscache_clock - set[way].lastused > pvscache_clock - entry->lastused)
+	    entry = &set[way];
+    }
 
-    if (slot) {
-	if (slot == PVSCACHE_SIZE) {
-	    slot--;
-	    tmp.model = model;
-	    tmp.leaf = leaf;
-	    tmp.leafbits = pvscache[slot].leafbits;
-	    if (leaf == model->leafs) {
-		/* return set with everything visible */
-		tmp.leafbits->numleafs = model->numleafs;
-		memset(tmp.leafbits->bits, 0xff, pvscache_bytes);
-	    } else {
-		Mod_DecompressVis(leaf->compressed_vis, model, tmp.leafbits);
-	    }
-	    c_cachemiss++;
+    c_cachemiss++;
+    if (entry->model)
+	c_cacheevict++;
+
+    entry->model = model;
+    entry->leaf = leaf;
+    entry->lastused = ++pvscache_clock;
+    if (leaf == model->leafs) {
+	/* return set with everything visible */
+	entry->leafbits->numleafs = model->numleafs;
+	memset(entry->leafbits->bits, 0xff, pvscache_bytes);
+    } else {
+	Mod_DecompressVis(leaf->compressed_vis, model, entry->leafbits);
+    }
+
+    return entry->leafbits;
+}
+
+/*
+ * Mod_LeafPVS for the renderer, remembering the last leaf it was asked for
+ * instead of using the cache
+ */
+const leafbits_t *
+Mod_ViewLeafPVS(const model_t *model, const mleaf_t *leaf)
+{
+    int leafnum;
+
+    leafnum = leaf - model->leafs;
+    if (model == pvstable_model && leafnum <= model->numleafs)
+	return (const leafbits_t *)(pvstable + leafnum * pvstable_rowsize);
+
+    if (model != viewpvs_model || leaf != viewpvs_leaf) {
+	viewpvs_model = model;
+	viewpvs_leaf = leaf;
+	if (leaf == model->leafs) {
+	    viewpvs->numleafs = model->numleafs;
+	    memset(viewpvs->bits, 0xff, pvscache_bytes);
 	} else {
-	    tmp = pvscache[slot];
+	    Mod_DecompressVis(leaf->compressed_vis, model, viewpvs);
 	}
-	memmove(pvscache + 1, pvscache, slot * sizeof(pvscache_t));
-	pvscache[0] = tmp;
     }
 
-    return pvscache[0].leafbits;
+    return viewpvs;
 }
 
 static void
 PVSCache_f(void)
 {
-    Con_Printf("PVSCache: %7d hits %7d misses\n", c_cachehit, c_cachemiss);
+    int lookups = c_cachehit + c_cachemiss;
+
+    Con_Printf("PVSCache: %d entries (%d sets, %d-way), %d leafs\n",
+	       pvscache_numsets * PVSCACHE_WAYS, pvscache_numsets,
+	       PVSCACHE_WAYS, pvscache_numleafs);
+    Con_Printf("          %7d hits %7d misses %7d evictions (%.1f%% hit)\n",
+	       c_cachehit, c_cachemiss, c_cacheevict,
+	       lookups ? c_cachehit * 100.0 / lookups : 0.0);
+    lookups = c_fatpvshit + c_fatpvsmiss;
+    Con_Printf("FatPVS:   %7d hits %7d misses (%.1f%% hit)\n",
+	       c_fatpvshit, c_fatpvsmiss,
+	       lookups ? c_fatpvshit * 100.0 / lookups : 0.0);
+    if (pvstable_model)
+	Con_Printf("PVSTable: %s, %d leafs fully decompressed (%d kB)\n",
+		   pvstable_model->name, pvstable_model->numleafs,
+		   (pvstable_model->numleafs + 1) * pvstable_rowsize / 1024);
 }
 
 static void Mod_AddToFatPVS(const model_t *model, const vec3_t point, const mnode_t *node)
@@ -332,6 +540,92 @@ Mod_FatPVS(const model_t *model, const vec3_t point)
     return fatpvs;
 }
 
+/*
+ * Lists the leafs Mod_AddToFatPVS would add, in the same order, counting
+ * past MAX_FATPVS_LEAFS without storing them
+ */
+static int
+Mod_FatPVSLeafs(const vec3_t point, const mnode_t *node,
+		const mleaf_t **leafs, int numleafs)
+{
+    float d;
+
+    while (node->contents >= 0) {
+	d = DotProduct(point, node->plane->normal) - node->plane->dist;
+	if (d > 8) {
+	    node = node->children[0];
+	} else if (d < -8) {
+	    node = node->children[1];
+	} else {
+	    numleafs = Mod_FatPVSLeafs(point, node->children[0], leafs,
+				       numleafs);
+	    node = node->children[1];
+	}
+    }
+    if (node->contents != CONTENTS_SOLID) {
+	if (numleafs < MAX_FATPVS_LEAFS)
+	    leafs[numleafs] = (const mleaf_t *)node;
+	numleafs++;
+    }
+
+    return numleafs;
+}
+
+/*
+ * Gets the cache's bits from the hunk, for the map being loaded
+ */
+void
+Mod_InitFatPVS(mfatpvs_t *cache, const model_t *model)
+{
+    cache->model = NULL;
+    cache->numleafs = 0;
+    cache->bits = Hunk_AllocName(Mod_LeafbitsSize(model->numleafs),
+				 "fatpvs");
+}
+
+/*
+=============
+Mod_CachedFatPVS
+
+Mod_FatPVS, kept in the cache for as long as the same leafs are near the
+point. The result stays valid until the cache is next used.
+=============
+*/
+const leafbits_t *
+Mod_CachedFatPVS(const model_t *model, const vec3_t point, mfatpvs_t *cache)
+{
+    const mleaf_t *leafs[MAX_FATPVS_LEAFS];
+    const leafbits_t *pvs;
+    int i, numleafs;
+
+    numleafs = Mod_FatPVSLeafs(point, model->nodes, leafs, 0);
+    if (numleafs > MAX_FATPVS_LEAFS) {
+	/* too many to compare, so work it out from scratch */
+	c_fatpvsmiss++;
+	cache->model = NULL;
+	return Mod_FatPVS(model, point);
+    }
+
+    if (cache->model == model && cache->numleafs == numleafs
+	&& !memcmp(cache->leafs, leafs, numleafs * sizeof(leafs[0]))) {
+	c_fatpvshit++;
+	return cache->bits;
+    }
+
+    c_fatpvsmiss++;
+    cache->model = model;
+    cache->numleafs = numleafs;
+    memcpy(cache->leafs, leafs, numleafs * sizeof(leafs[0]));
+    cache->bits->numleafs = model->numleafs;
+    memset(cache->bits->bits, 0, pvscache_bytes);
+    for (i = 0; i < numleafs; i++) {
+	pvs = Mod_LeafPVS(model, leafs[i]);
+	Mod_AddLeafBits(cache->bits, pvs);
+    }
+
+    return cache->bits;
+}
+
 /*
 ===================
 Mod_ClearAll
@@ -346,6 +640,8 @@ Mod_ClearAll(void)
     for (i = 0, mod = mod_known; i < mod_numknown; i++, mod++) {
 	if (mod->type != mod_alias)
 	    mod->needload = true;
+	else
+	    mod->recheck = true;
 	/*
 	 * FIXME: sprites use the cache data pointer for their own purposes,
 	 *        bypassing the Cache_Alloc/Free functions.
@@ -355,10 +651,37 @@ Mod_ClearAll(void)
     }
 
     fatpvs = NULL;
-    memset(pvscache, 0, sizeof(pvscache));
+    viewpvs = NULL;
+    viewpvs_model = NULL;
+    viewpvs_leaf = NULL;
+    pvstable_model = NULL;
+    pvstable = NULL;
+    pvscache = NULL;
+    pvscache_numsets = 0;
     pvscache_numleafs = 0;
     pvscache_bytes = pvscache_blocks = 0;
-    c_cachehit = c_cachemiss = 0;
+    c_cachehit = c_cachemiss = c_cacheevict = 0;
+    c_fatpvshit = c_fatpvsmiss = 0;
+}
+
+/*
+==================
+Mod_FindKnown
+
+The model of that name loaded before, or NULL
+==================
+*/
+static model_t *
+Mod_FindKnown(const char *name)
+{
+    int i;
+
+    for (i = NameHash_First(&mod_knownhash, name); i >= 0;
+	 i = NameHash_Next(&mod_knownhash, i))
+	if (!strcmp(mod_known[i].name, name))
+	    return &mod_known[i];
+
+    return NULL;
 }
 
 /*
@@ -370,7 +693,6 @@ Mod_FindName
 static model_t *
 Mod_FindName(const char *name)
 {
-    int i;
     model_t *mod;
 
     if (!name[0])
@@ -379,16 +701,15 @@ Mod_FindName(const char *name)
 //
 // search the currently loaded models
 //
-    for (i = 0, mod = mod_known; i < mod_numknown; i++, mod++)
-	if (!strcmp(mod->name, name))
-	    break;
-
-    if (i == mod_numknown) {
+    mod = Mod_FindKnown(name);
+    if (!mod) {
 	if (mod_numknown == MAX_MOD_KNOWN)
 	    SV_Error("mod_numknown == MAX_MOD_KNOWN");
+	mod = &mod_known[mod_numknown];
 	strncpy(mod->name, name, MAX_QPATH - 1);
 	mod->name[MAX_QPATH - 1] = 0;
 	mod->needload = true;
+	NameHash_Insert(&mod_knownhash, mod->name, mod_numknown);
 	mod_numknown++;
     }
 
@@ -408,10 +729,11 @@ Mod_LoadModel(model_t *mod, qboolean crash)
     unsigned *buf;
     byte stackbuf[1024];	// avoid dirtying the cache heap
     unsigned long size;
+    unsigned short crc;
 
     if (!mod->needload) {
 	if (mod->type == mod_alias) {
-	    if (Cache_Check(&mod->cache))
+	    if (Cache_Check(&mod->cache) && !mod->recheck)
 		return mod;
 	} else
 	    return mod;		// not cached at all
@@ -419,12 +741,31 @@ Mod_LoadModel(model_t *mod, qboolean crash)
 //
 // load the file
 //
-    buf = (unsigned int*)COM_LoadStackFile(mod->name, stackbuf, sizeof(stackbuf), &size);
+    buf = (unsigned int*)COM_MapFile(mod->name, &size);
+    if (!buf)
+	buf = (unsigned int*)COM_LoadStackFile(mod->name, stackbuf, sizeof(stackbuf), &size);
     if (!buf) {
 	if (crash)
 	    SV_Error("%s: %s not found", __func__, mod->name);
 	return NULL;
     }
+
+//
+// an alias model kept over a map change is only reused if the file it
+// was loaded from hasn't changed since
+//
+    if (LittleLong(*(unsigned *)buf) == IDPOLYHEADER) {
+	crc = CRC_Block((byte *)buf, size);
+	if (mod->recheck && Cache_Check(&mod->cache)) {
+	    mod->recheck = false;
+	    if ((int)size == mod->filesize && crc == mod->crc)
+		return mod;
+	    Cache_Free(&mod->cache);
+	}
+	mod->filesize = size;
+	mod->crc = crc;
+    }
+    mod->recheck = false;
 //
 // allocate a new model
 //
@@ -458,6 +799,27 @@ Mod_LoadModel(model_t *mod, qboolean crash)
     return mod;
 }
 
+/*
+==================
+Mod_NeedsLoad
+
+True if Mod_ForName would have to read the model in
+==================
+*/
+qboolean
+Mod_NeedsLoad(const char *name)
+{
+    model_t *mod;
+
+    if (name[0] == '*')
+	return false;		// the world's submodels
+    mod = Mod_FindKnown(name);
+    if (!mod || mod->needload)
+	return true;
+
+    return mod->type == mod_alias && !Cache_Check(&mod->cache);
+}
+
 /*
 ==================
 Mod_ForName
@@ -486,6 +848,34 @@ Mod_ForName(const char *name, qboolean crash)
 
 static byte *mod_base;
 
+static void
+Mod_QueueJob(jobfunc_t func, const void *in, int count, int grain)
+{
+    mod_numjobs = Job_Split(mod_jobs, mod_numjobs, MAX_MOD_JOBS, func,
+			    (void *)in, count, grain);
+}
+
+/*
+=================
+Mod_RunJobs
+
+Run the queued lump conversions and wait for them to finish
+=================
+*/
+static qboolean
+Mod_RunJobs(void)
+{
+    const char *error;
+
+    error = Job_RunBatch(mod_jobs, mod_numjobs);
+    mod_numjobs = 0;
+    if (error) {
+	SV_Error("%s: %s in %s", __func__, error, loadmodel->name);
+	return false;
+    }
+
+    return true;
+}
 
 /*
 =================
@@ -722,6 +1112,54 @@ Mod_LoadVisibility(lump_t *l)
     memcpy(loadmodel->visdata, mod_base + l->fileofs, l->filelen);
 }
 
+static const char *
+Mod_DecompressPVSRows(void *data, int start, int end)
+{
+    const model_t *model = (const model_t *)data;
+    leafbits_t *row;
+    int i;
+
+    for (i = start; i < end; i++) {
+	row = (leafbits_t *)(pvstable + i * pvstable_rowsize);
+	if (!i) {
+	    /* leaf 0 is the solid leaf; everything visible */
+	    row->numleafs = model->numleafs;
+	    memset(row->bits, 0xff, pvscache_bytes);
+	} else {
+	    Mod_DecompressVis(model->leafs[i].compressed_vis, model, row);
+	}
+    }
+
+    return NULL;
+}
+
+/*
+=================
+Mod_LoadPVSTable
+
+Decompress the vis for every leaf of a small enough world model, once its
+visleafs are known and the pvs cache has been sized.
+=================
+*/
+static void
+Mod_LoadPVSTable(const model_t *model)
+{
+    int numrows;
+
+    if (model->numleafs > pvstable_maxleafs.value)
+	return;
+    if (model->numleafs + 1 > pvscache_numleafs)
+	return;
+
+    numrows = model->numleafs + 1;
+    pvstable_rowsize = Mod_LeafbitsSize(pvscache_numleafs);
+    pvstable = (byte*)Hunk_AllocName(numrows * pvstable_rowsize, "pvstable");
+
+    Mod_QueueJob(Mod_DecompressPVSRows, model, numrows, MOD_JOB_GRAIN / 4);
+    if (Mod_RunJobs())
+	pvstable_model = model;
+}
+
 
 /*
 =================
@@ -745,12 +1183,35 @@ Mod_LoadEntities(lump_t *l)
 Mod_LoadVertexes
 =================
 */
+static const char *
+Mod_ConvertVertexes(void *data, int start, int end)
+{
+   const dvertex_t *in = (const dvertex_t *)data + start;
+   mvertex_t *out = loadmodel->vertexes + start;
+   int i;
+
+   for (i = start; i < end; i++, in++, out++)
+   {
+#ifdef MSB_FIRST
+      out->position[0] = LittleFloat(in->point[0]);
+      out->position[1] = LittleFloat(in->point[1]);
+      out->position[2] = LittleFloat(in->point[2]);
+#else
+      out->position[0] = (in->point[0]);
+      out->position[1] = (in->point[1]);
+      out->position[2] = (in->point[2]);
+#endif
+   }
+
+   return NULL;
+}
+
 static void
 Mod_LoadVertexes(lump_t *l)
 {
    dvertex_t *in;
    mvertex_t *out;
-   int i, count;
+   int count;
 
    in = (dvertex_t*)(void *)(mod_base + l->fileofs);
    if (l->filelen % sizeof(*in))
@@ -761,18 +1222,7 @@ Mod_LoadVertexes(lump_t *l)
    loadmodel->vertexes = out;
    loadmodel->numvertexes = count;
 
-   for (i = 0; i < count; i++, in++, out++)
-   {
-#ifdef MSB_FIRST
-      out->position[0] = LittleFloat(in->point[0]);
-      out->position[1] = LittleFloat(in->point[1]);
-      out->position[2] = LittleFloat(in->point[2]);
-#else
-      out->position[0] = (in->point[0]);
-      out->position[1] = (in->point[1]);
-      out->position[2] = (in->point[2]);
-#endif
-   }
+   Mod_QueueJob(Mod_ConvertVertexes, in, count, MOD_JOB_GRAIN);
 }
 
 /*
@@ -780,23 +1230,14 @@ Mod_LoadVertexes(lump_t *l)
 Mod_LoadSubmodels
 =================
 */
-static void
-Mod_LoadSubmodels(lump_t *l)
+static const char *
+Mod_ConvertSubmodels(void *data, int start, int end)
 {
-   dmodel_t *in;
-   dmodel_t *out;
-   int i, j, count;
-
-   in = (dmodel_t*)(void *)(mod_base + l->fileofs);
-   if (l->filelen % sizeof(*in))
-      SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
-   count = l->filelen / sizeof(*in);
-   out = (dmodel_t*)Hunk_AllocName(count * sizeof(*out), loadname);
-
-   loadmodel->submodels = out;
-   loadmodel->numsubmodels = count;
+   const dmodel_t *in = (const dmodel_t *)data + start;
+   dmodel_t *out = loadmodel->submodels + start;
+   int i, j;
 
-   for (i = 0; i < count; i++, in++, out++)
+   for (i = start; i < end; i++, in++, out++)
    {
       for (j = 0; j < 3; j++)
       {	// spread the mins / maxs by a pixel
@@ -828,6 +1269,27 @@ Mod_LoadSubmodels(lump_t *l)
       out->numfaces  = (in->numfaces);
 #endif
    }
+
+   return NULL;
+}
+
+static void
+Mod_LoadSubmodels(lump_t *l)
+{
+   dmodel_t *in;
+   dmodel_t *out;
+   int count;
+
+   in = (dmodel_t*)(void *)(mod_base + l->fileofs);
+   if (l->filelen % sizeof(*in))
+      SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
+   count = l->filelen / sizeof(*in);
+   out = (dmodel_t*)Hunk_AllocName(count * sizeof(*out), loadname);
+
+   loadmodel->submodels = out;
+   loadmodel->numsubmodels = count;
+
+   Mod_QueueJob(Mod_ConvertSubmodels, in, count, MOD_JOB_GRAIN);
 }
 
 /*
@@ -836,12 +1298,33 @@ Mod_LoadEdges
  => Two versions for the different BSP file formats
 =================
 */
+static const char *
+Mod_ConvertEdges_BSP29(void *data, int start, int end)
+{
+   const bsp29_dedge_t *in = (const bsp29_dedge_t *)data + start;
+   medge_t *out = loadmodel->edges + start;
+   int i;
+
+   for (i = start; i < end; i++, in++, out++)
+   {
+#ifdef MSB_FIRST
+      out->v[0] = (uint16_t)LittleShort(in->v[0]);
+      out->v[1] = (uint16_t)LittleShort(in->v[1]);
+#else
+      out->v[0] = (uint16_t)(in->v[0]);
+      out->v[1] = (uint16_t)(in->v[1]);
+#endif
+   }
+
+   return NULL;
+}
+
 static void
 Mod_LoadEdges_BSP29(lump_t *l)
 {
    bsp29_dedge_t *in;
    medge_t *out;
-   int i, count;
+   int count;
 
    in = (bsp29_dedge_t *)(mod_base + l->fileofs);
    if (l->filelen % sizeof(*in))
@@ -852,16 +1335,27 @@ Mod_LoadEdges_BSP29(lump_t *l)
    loadmodel->edges = out;
    loadmodel->numedges = count;
 
-   for (i = 0; i < count; i++, in++, out++)
-   {
+   Mod_QueueJob(Mod_ConvertEdges_BSP29, in, count, MOD_JOB_GRAIN);
+}
+
+static const char *
+Mod_ConvertEdges_BSP2(void *data, int start, int end)
+{
+   const bsp2_dedge_t *in = (const bsp2_dedge_t *)data + start;
+   medge_t *out = loadmodel->edges + start;
+   int i;
+
+   for (i = start; i < end; i++, in++, out++) {
 #ifdef MSB_FIRST
-      out->v[0] = (uint16_t)LittleShort(in->v[0]);
-      out->v[1] = (uint16_t)LittleShort(in->v[1]);
+      out->v[0] = (uint32_t)LittleLong(in->v[0]);
+      out->v[1] = (uint32_t)LittleLong(in->v[1]);
 #else
-      out->v[0] = (uint16_t)(in->v[0]);
-      out->v[1] = (uint16_t)(in->v[1]);
+      out->v[0] = (uint32_t)(in->v[0]);
+      out->v[1] = (uint32_t)(in->v[1]);
 #endif
    }
+
+   return NULL;
 }
 
 static void
@@ -869,7 +1363,7 @@ Mod_LoadEdges_BSP2(lump_t *l)
 {
    bsp2_dedge_t *in;
    medge_t *out;
-   int i, count;
+   int count;
 
    in = (bsp2_dedge_t *)(mod_base + l->fileofs);
    if (l->filelen % sizeof(*in))
@@ -880,15 +1374,7 @@ Mod_LoadEdges_BSP2(lump_t *l)
    loadmodel->edges = out;
    loadmodel->numedges = count;
 
-   for (i = 0; i < count; i++, in++, out++) {
-#ifdef MSB_FIRST
-      out->v[0] = (uint32_t)LittleLong(in->v[0]);
-      out->v[1] = (uint32_t)LittleLong(in->v[1]);
-#else
-      out->v[0] = (uint32_t)(in->v[0]);
-      out->v[1] = (uint32_t)(in->v[1]);
-#endif
-   }
+   Mod_QueueJob(Mod_ConvertEdges_BSP2, in, count, MOD_JOB_GRAIN);
 }
 
 /*
@@ -896,24 +1382,16 @@ Mod_LoadEdges_BSP2(lump_t *l)
 Mod_LoadTexinfo
 =================
 */
-static void Mod_LoadTexinfo(lump_t *l)
+static const char *
+Mod_ConvertTexinfo(void *data, int start, int end)
 {
-   texinfo_t *in;
-   mtexinfo_t *out;
-   int i, j, count;
+   const texinfo_t *in = (const texinfo_t *)data + start;
+   mtexinfo_t *out = loadmodel->texinfo + start;
+   int i, j;
    int miptex;
    float len1, len2;
 
-   in = (texinfo_t*)(void *)(mod_base + l->fileofs);
-   if (l->filelen % sizeof(*in))
-      SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
-   count = l->filelen / sizeof(*in);
-   out = (mtexinfo_t*)Hunk_AllocName(count * sizeof(*out), loadname);
-
-   loadmodel->texinfo = out;
-   loadmodel->numtexinfo = count;
-
-   for (i = 0; i < count; i++, in++, out++)
+   for (i = start; i < end; i++, in++, out++)
    {
       for (j = 0; j < 4; j++)
       {
@@ -954,7 +1432,7 @@ static void Mod_LoadTexinfo(lump_t *l)
          out->flags = 0;
       } else {
          if (miptex >= loadmodel->numtextures)
-            SV_Error("miptex >= loadmodel->numtextures");
+            return "miptex >= loadmodel->numtextures";
          out->texture = loadmodel->textures[miptex];
          if (!out->texture) {
 #ifndef SERVERONLY
@@ -966,6 +1444,26 @@ static void Mod_LoadTexinfo(lump_t *l)
          }
       }
    }
+
+   return NULL;
+}
+
+static void Mod_LoadTexinfo(lump_t *l)
+{
+   texinfo_t *in;
+   mtexinfo_t *out;
+   int count;
+
+   in = (texinfo_t*)(void *)(mod_base + l->fileofs);
+   if (l->filelen % sizeof(*in))
+      SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
+   count = l->filelen / sizeof(*in);
+   out = (mtexinfo_t*)Hunk_AllocName(count * sizeof(*out), loadname);
+
+   loadmodel->texinfo = out;
+   loadmodel->numtexinfo = count;
+
+   Mod_QueueJob(Mod_ConvertTexinfo, in, count, MOD_JOB_GRAIN);
 }
 
 /*
@@ -975,7 +1473,7 @@ CalcSurfaceExtents
 Fills in s->texturemins[] and s->extents[]
 ================
 */
-static void
+static const char *
 CalcSurfaceExtents(msurface_t *s)
 {
     float mins[2], maxs[2], val;
@@ -1014,16 +1512,19 @@ CalcSurfaceExtents(msurface_t *s)
 	s->texturemins[i] = bmins[i] * 16;
 	s->extents[i] = (bmaxs[i] - bmins[i]) * 16;
 	if (!(tex->flags & TEX_SPECIAL) && s->extents[i] > 256)
-	    SV_Error("Bad surface extents");
+	    return "bad surface extents";
     }
+
+    return NULL;
 }
 
 static void
 CalcSurfaceBounds(msurface_t *surf)
 {
-    int i, j, edgenum;
+    int i, j, edgenum, stride;
     medge_t *edge;
     mvertex_t *v;
+    float *bounds;
 
     surf->mins[0] = surf->mins[1] = surf->mins[2] = FLT_MAX;
     surf->maxs[0] = surf->maxs[1] = surf->maxs[2] = -FLT_MAX;
@@ -1045,6 +1546,14 @@ CalcSurfaceBounds(msurface_t *surf)
 		surf->maxs[j] = v->position[j];
 	}
     }
+
+    /* copied apart by axis so the renderer can clip several at once */
+    stride = loadmodel->numsurfaces;
+    bounds = loadmodel->surfbounds + (surf - loadmodel->surfaces);
+    for (j = 0; j < 3; j++) {
+	bounds[j * stride] = surf->mins[j];
+	bounds[(j + 3) * stride] = surf->maxs[j];
+    }
 }
 
 /*
@@ -1053,24 +1562,16 @@ Mod_LoadFaces
  => Two versions for the different BSP file formats
 =================
 */
-static void
-Mod_LoadFaces_BSP29(lump_t *l)
+static const char *
+Mod_ConvertFaces_BSP29(void *data, int start, int end)
 {
-   bsp29_dface_t *in;
-   msurface_t *out;
-   int i, count, surfnum;
+   const bsp29_dface_t *in = (const bsp29_dface_t *)data + start;
+   msurface_t *out = loadmodel->surfaces + start;
+   int i, surfnum;
    int planenum, side;
+   const char *error;
 
-   in = (bsp29_dface_t *)(mod_base + l->fileofs);
-   if (l->filelen % sizeof(*in))
-      SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
-   count = l->filelen / sizeof(*in);
-   out = (msurface_t*)Hunk_AllocName(count * sizeof(*out), loadname);
-
-   loadmodel->surfaces = out;
-   loadmodel->numsurfaces = count;
-
-   for (surfnum = 0; surfnum < count; surfnum++, in++, out++)
+   for (surfnum = start; surfnum < end; surfnum++, in++, out++)
    {
 #ifdef MSB_FIRST
       out->firstedge = LittleLong(in->firstedge);
@@ -1083,8 +1584,7 @@ Mod_LoadFaces_BSP29(lump_t *l)
 
       /* FIXME - Also check numedges doesn't overflow edges */
       if (out->numedges <= 0)
-         SV_Error("%s: bmodel %s has surface with no edges", __func__,
-               loadmodel->name);
+         return "bmodel has surface with no edges";
 
 #ifdef MSB_FIRST
       planenum = LittleShort(in->planenum);
@@ -1103,7 +1603,9 @@ Mod_LoadFaces_BSP29(lump_t *l)
       out->texinfo = &loadmodel->texinfo[in->texinfo];
 #endif
 
-      CalcSurfaceExtents(out);
+      error = CalcSurfaceExtents(out);
+      if (error)
+         return error;
       CalcSurfaceBounds(out);
 
       // lighting info
@@ -1140,25 +1642,41 @@ Mod_LoadFaces_BSP29(lump_t *l)
          }
       }
    }
+
+   return NULL;
 }
 
-static void Mod_LoadFaces_BSP2(lump_t *l)
+static void
+Mod_LoadFaces_BSP29(lump_t *l)
 {
+   bsp29_dface_t *in;
    msurface_t *out;
-   int i, count, surfnum;
-   int planenum, side;
-   bsp2_dface_t *in = (bsp2_dface_t *)(mod_base + l->fileofs);
+   int count;
 
+   in = (bsp29_dface_t *)(mod_base + l->fileofs);
    if (l->filelen % sizeof(*in))
       SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
-
    count = l->filelen / sizeof(*in);
    out = (msurface_t*)Hunk_AllocName(count * sizeof(*out), loadname);
 
    loadmodel->surfaces = out;
    loadmodel->numsurfaces = count;
+   loadmodel->surfbounds = (float*)Hunk_AllocName(count * 6 * sizeof(float), loadname);
+
+   /* extents/bounds are the expensive part, so use smaller chunks */
+   Mod_QueueJob(Mod_ConvertFaces_BSP29, in, count, MOD_JOB_GRAIN / 4);
+}
 
-   for (surfnum = 0; surfnum < count; surfnum++, in++, out++)
+static const char *
+Mod_ConvertFaces_BSP2(void *data, int start, int end)
+{
+   const bsp2_dface_t *in = (const bsp2_dface_t *)data + start;
+   msurface_t *out = loadmodel->surfaces + start;
+   int i, surfnum;
+   int planenum, side;
+   const char *error;
+
+   for (surfnum = start; surfnum < end; surfnum++, in++, out++)
    {
 #ifdef MSB_FIRST
       out->firstedge = LittleLong(in->firstedge);
@@ -1186,7 +1704,9 @@ static void Mod_LoadFaces_BSP2(lump_t *l)
       out->texinfo = &loadmodel->texinfo[in->texinfo];
 #endif
 
-      CalcSurfaceExtents(out);
+      error = CalcSurfaceExtents(out);
+      if (error)
+         return error;
       CalcSurfaceBounds(out);
 
       // lighting info
@@ -1216,6 +1736,28 @@ static void Mod_LoadFaces_BSP2(lump_t *l)
          }
       }
    }
+
+   return NULL;
+}
+
+static void Mod_LoadFaces_BSP2(lump_t *l)
+{
+   msurface_t *out;
+   int count;
+   bsp2_dface_t *in = (bsp2_dface_t *)(mod_base + l->fileofs);
+
+   if (l->filelen % sizeof(*in))
+      SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
+
+   count = l->filelen / sizeof(*in);
+   out = (msurface_t*)Hunk_AllocName(count * sizeof(*out), loadname);
+
+   loadmodel->surfaces = out;
+   loadmodel->numsurfaces = count;
+   loadmodel->surfbounds = (float*)Hunk_AllocName(count * 6 * sizeof(float), loadname);
+
+   /* extents/bounds are the expensive part, so use smaller chunks */
+   Mod_QueueJob(Mod_ConvertFaces_BSP2, in, count, MOD_JOB_GRAIN / 4);
 }
 
 /*
@@ -1239,23 +1781,14 @@ Mod_LoadNodes
  => Two versions for the different BSP file formats
 =================
 */
-static void
-Mod_LoadNodes_BSP29(lump_t *l)
+static const char *
+Mod_ConvertNodes_BSP29(void *data, int start, int end)
 {
-   int i, j, count, p;
-   bsp29_dnode_t *in;
-   mnode_t *out;
+   const bsp29_dnode_t *in = (const bsp29_dnode_t *)data + start;
+   mnode_t *out = loadmodel->nodes + start;
+   int i, j, p;
 
-   in = (bsp29_dnode_t *)(mod_base + l->fileofs);
-   if (l->filelen % sizeof(*in))
-      SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
-   count = l->filelen / sizeof(*in);
-   out = (mnode_t*)Hunk_AllocName(count * sizeof(*out), loadname);
-
-   loadmodel->nodes = out;
-   loadmodel->numnodes = count;
-
-   for (i = 0; i < count; i++, in++, out++) {
+   for (i = start; i < end; i++, in++, out++) {
       for (j = 0; j < 3; j++) {
 #ifdef MSB_FIRST
          out->mins[j] = LittleShort(in->mins[j]);
@@ -1295,25 +1828,36 @@ Mod_LoadNodes_BSP29(lump_t *l)
       }
    }
 
-   Mod_SetParent(loadmodel->nodes, NULL);	// sets nodes and leafs
+   return NULL;
 }
 
-static void Mod_LoadNodes_BSP2(lump_t *l)
+static void
+Mod_LoadNodes_BSP29(lump_t *l)
 {
-   int i, count;
+   int count;
+   bsp29_dnode_t *in;
    mnode_t *out;
-   bsp2_dnode_t *in = (bsp2_dnode_t *)(mod_base + l->fileofs);
 
+   in = (bsp29_dnode_t *)(mod_base + l->fileofs);
    if (l->filelen % sizeof(*in))
       SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
-
    count = l->filelen / sizeof(*in);
-   out   = (mnode_t*)Hunk_AllocName(count * sizeof(*out), loadname);
+   out = (mnode_t*)Hunk_AllocName(count * sizeof(*out), loadname);
 
-   loadmodel->nodes    = out;
+   loadmodel->nodes = out;
    loadmodel->numnodes = count;
 
-   for (i = 0; i < count; i++, in++, out++)
+   Mod_QueueJob(Mod_ConvertNodes_BSP29, in, count, MOD_JOB_GRAIN);
+}
+
+static const char *
+Mod_ConvertNodes_BSP2(void *data, int start, int end)
+{
+   const bsp2_dnode_t *in = (const bsp2_dnode_t *)data + start;
+   mnode_t *out = loadmodel->nodes + start;
+   int i;
+
+   for (i = start; i < end; i++, in++, out++)
    {
       int j, p;
 
@@ -1357,7 +1901,25 @@ static void Mod_LoadNodes_BSP2(lump_t *l)
       }
    }
 
-   Mod_SetParent(loadmodel->nodes, NULL);	// sets nodes and leafs
+   return NULL;
+}
+
+static void Mod_LoadNodes_BSP2(lump_t *l)
+{
+   int count;
+   mnode_t *out;
+   bsp2_dnode_t *in = (bsp2_dnode_t *)(mod_base + l->fileofs);
+
+   if (l->filelen % sizeof(*in))
+      SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
+
+   count = l->filelen / sizeof(*in);
+   out   = (mnode_t*)Hunk_AllocName(count * sizeof(*out), loadname);
+
+   loadmodel->nodes    = out;
+   loadmodel->numnodes = count;
+
+   Mod_QueueJob(Mod_ConvertNodes_BSP2, in, count, MOD_JOB_GRAIN);
 }
 
 /*
@@ -1366,23 +1928,14 @@ Mod_LoadLeafs
  => Two versions for the different BSP file formats
 =================
 */
-static void
-Mod_LoadLeafs_BSP29(lump_t *l)
+static const char *
+Mod_ConvertLeafs_BSP29(void *data, int start, int end)
 {
-   bsp29_dleaf_t *in;
-   mleaf_t *out;
-   int i, j, count, p;
-
-   in = (bsp29_dleaf_t *)(mod_base + l->fileofs);
-   if (l->filelen % sizeof(*in))
-      SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
-   count = l->filelen / sizeof(*in);
-   out = (mleaf_t*)Hunk_AllocName(count * sizeof(*out), loadname);
+   const bsp29_dleaf_t *in = (const bsp29_dleaf_t *)data + start;
+   mleaf_t *out = loadmodel->leafs + start;
+   int i, j, p;
 
-   loadmodel->leafs = out;
-   loadmodel->numleafs = count;
-
-   for (i = 0; i < count; i++, in++, out++)
+   for (i = start; i < end; i++, in++, out++)
    {
       for (j = 0; j < 3; j++)
       {
@@ -1423,16 +1976,18 @@ Mod_LoadLeafs_BSP29(lump_t *l)
       for (j = 0; j < 4; j++)
          out->ambient_sound_level[j] = in->ambient_level[j];
    }
+
+   return NULL;
 }
 
 static void
-Mod_LoadLeafs_BSP2(lump_t *l)
+Mod_LoadLeafs_BSP29(lump_t *l)
 {
-   bsp2_dleaf_t *in;
+   bsp29_dleaf_t *in;
    mleaf_t *out;
-   int i, j, count, p;
+   int count;
 
-   in = (bsp2_dleaf_t *)(mod_base + l->fileofs);
+   in = (bsp29_dleaf_t *)(mod_base + l->fileofs);
    if (l->filelen % sizeof(*in))
       SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
    count = l->filelen / sizeof(*in);
@@ -1441,7 +1996,17 @@ Mod_LoadLeafs_BSP2(lump_t *l)
    loadmodel->leafs = out;
    loadmodel->numleafs = count;
 
-   for (i = 0; i < count; i++, in++, out++) {
+   Mod_QueueJob(Mod_ConvertLeafs_BSP29, in, count, MOD_JOB_GRAIN);
+}
+
+static const char *
+Mod_ConvertLeafs_BSP2(void *data, int start, int end)
+{
+   const bsp2_dleaf_t *in = (const bsp2_dleaf_t *)data + start;
+   mleaf_t *out = loadmodel->leafs + start;
+   int i, j, p;
+
+   for (i = start; i < end; i++, in++, out++) {
       for (j = 0; j < 3; j++) {
 #ifdef MSB_FIRST
          out->mins[j] = LittleShort(in->mins[j]);
@@ -1481,6 +2046,27 @@ Mod_LoadLeafs_BSP2(lump_t *l)
       for (j = 0; j < 4; j++)
          out->ambient_sound_level[j] = in->ambient_level[j];
    }
+
+   return NULL;
+}
+
+static void
+Mod_LoadLeafs_BSP2(lump_t *l)
+{
+   bsp2_dleaf_t *in;
+   mleaf_t *out;
+   int count;
+
+   in = (bsp2_dleaf_t *)(mod_base + l->fileofs);
+   if (l->filelen % sizeof(*in))
+      SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
+   count = l->filelen / sizeof(*in);
+   out = (mleaf_t*)Hunk_AllocName(count * sizeof(*out), loadname);
+
+   loadmodel->leafs = out;
+   loadmodel->numleafs = count;
+
+   Mod_QueueJob(Mod_ConvertLeafs_BSP2, in, count, MOD_JOB_GRAIN);
 }
 
 /*
@@ -1489,12 +2075,43 @@ Mod_LoadClipnodes
  => Two versions for the different BSP file formats
 =================
 */
+static const char *
+Mod_ConvertClipnodes_BSP29(void *data, int start, int end)
+{
+   const bsp29_dclipnode_t *in = (const bsp29_dclipnode_t *)data + start;
+   mclipnode_t *out = loadmodel->clipnodes + start;
+   int i, j, count;
+
+   count = loadmodel->numclipnodes;
+   for (i = start; i < end; i++, out++, in++)
+   {
+#ifdef MSB_FIRST
+      out->planenum = LittleLong(in->planenum);
+#else
+      out->planenum = (in->planenum);
+#endif
+      for (j = 0; j < 2; j++) {
+#ifdef MSB_FIRST
+         out->children[j] = (uint16_t)LittleShort(in->children[j]);
+#else
+         out->children[j] = (uint16_t)(in->children[j]);
+#endif
+         if (out->children[j] > 0xfff0)
+            out->children[j] -= 0x10000;
+         if (out->children[j] >= count)
+            return "bad clipnode child number";
+      }
+   }
+
+   return NULL;
+}
+
 static void
 Mod_LoadClipnodes_BSP29(lump_t *l)
 {
    bsp29_dclipnode_t *in;
    mclipnode_t *out;
-   int i, j, count;
+   int count;
    hull_t *hull;
 
    in = (bsp29_dclipnode_t *)(mod_base + l->fileofs);
@@ -1530,8 +2147,18 @@ Mod_LoadClipnodes_BSP29(lump_t *l)
    hull->clip_maxs[1] = 32;
    hull->clip_maxs[2] = 64;
 
-   for (i = 0; i < count; i++, out++, in++)
-   {
+   Mod_QueueJob(Mod_ConvertClipnodes_BSP29, in, count, MOD_JOB_GRAIN);
+}
+
+static const char *
+Mod_ConvertClipnodes_BSP2(void *data, int start, int end)
+{
+   const bsp2_dclipnode_t *in = (const bsp2_dclipnode_t *)data + start;
+   mclipnode_t *out = loadmodel->clipnodes + start;
+   int i, j, count;
+
+   count = loadmodel->numclipnodes;
+   for (i = start; i < end; i++, out++, in++) {
 #ifdef MSB_FIRST
       out->planenum = LittleLong(in->planenum);
 #else
@@ -1539,16 +2166,16 @@ Mod_LoadClipnodes_BSP29(lump_t *l)
 #endif
       for (j = 0; j < 2; j++) {
 #ifdef MSB_FIRST
-         out->children[j] = (uint16_t)LittleShort(in->children[j]);
+         out->children[j] = LittleLong(in->children[j]);
 #else
-         out->children[j] = (uint16_t)(in->children[j]);
+         out->children[j] = (in->children[j]);
 #endif
-         if (out->children[j] > 0xfff0)
-            out->children[j] -= 0x10000;
          if (out->children[j] >= count)
-            SV_Error("%s: bad clipnode child number", __func__);
+            return "bad clipnode child number";
       }
    }
+
+   return NULL;
 }
 
 static void
@@ -1556,7 +2183,7 @@ Mod_LoadClipnodes_BSP2(lump_t *l)
 {
    bsp2_dclipnode_t *in;
    mclipnode_t *out;
-   int i, j, count;
+   int count;
    hull_t *hull;
 
    in = (bsp2_dclipnode_t *)(mod_base + l->fileofs);
@@ -1592,22 +2219,7 @@ Mod_LoadClipnodes_BSP2(lump_t *l)
    hull->clip_maxs[1] = 32;
    hull->clip_maxs[2] = 64;
 
-   for (i = 0; i < count; i++, out++, in++) {
-#ifdef MSB_FIRST
-      out->planenum = LittleLong(in->planenum);
-#else
-      out->planenum = (in->planenum);
-#endif
-      for (j = 0; j < 2; j++) {
-#ifdef MSB_FIRST
-         out->children[j] = LittleLong(in->children[j]);
-#else
-         out->children[j] = (in->children[j]);
-#endif
-         if (out->children[j] >= count)
-            SV_Error("%s: bad clipnode child number", __func__);
-      }
-   }
+   Mod_QueueJob(Mod_ConvertClipnodes_BSP2, in, count, MOD_JOB_GRAIN);
 }
 
 /*
@@ -1648,16 +2260,70 @@ Mod_MakeHull0(void)
     }
 }
 
+/*
+=================
+Mod_PackHullNodes
+=================
+*/
+void
+Mod_PackHullNodes(mhullnode_t *out, const mclipnode_t *in, int count,
+		  const mplane_t *planes)
+{
+    const mplane_t *plane;
+    int i;
+
+    for (i = 0; i < count; i++, in++, out++) {
+	plane = &planes[in->planenum];
+	out->dist = plane->dist;
+	out->children[0] = in->children[0];
+	out->children[1] = in->children[1];
+	out->plane = in->planenum << 3 | plane->type;
+    }
+}
+
+static mhullnode_t *
+Mod_MakeHullNodes(const mclipnode_t *in, int count)
+{
+    mhullnode_t *out;
+
+    out = Hunk_AllocName(qmax(count, 1) * sizeof(*out), loadname);
+    Mod_PackHullNodes(out, in, count, loadmodel->planes);
+
+    return out;
+}
+
 /*
 =================
 Mod_LoadMarksurfaces
  => Two versions for the different BSP file formats
 =================
 */
+static const char *
+Mod_ConvertMarksurfaces_BSP29(void *data, int start, int end)
+{
+   const uint16_t *in = (const uint16_t *)data;
+   msurface_t **out = loadmodel->marksurfaces;
+   int i, j;
+
+   for (i = start; i < end; i++)
+   {
+#ifdef MSB_FIRST
+      j = (uint16_t)LittleShort(in[i]);
+#else
+      j = (uint16_t)(in[i]);
+#endif
+      if (j >= loadmodel->numsurfaces)
+         return "bad surface number";
+      out[i] = loadmodel->surfaces + j;
+   }
+
+   return NULL;
+}
+
 static void
 Mod_LoadMarksurfaces_BSP29(lump_t *l)
 {
-   int i, j, count;
+   int count;
    uint16_t *in;
    msurface_t **out;
 
@@ -1670,23 +2336,34 @@ Mod_LoadMarksurfaces_BSP29(lump_t *l)
    loadmodel->marksurfaces = out;
    loadmodel->nummarksurfaces = count;
 
-   for (i = 0; i < count; i++)
-   {
+   Mod_QueueJob(Mod_ConvertMarksurfaces_BSP29, in, count, MOD_JOB_GRAIN);
+}
+
+static const char *
+Mod_ConvertMarksurfaces_BSP2(void *data, int start, int end)
+{
+   const uint32_t *in = (const uint32_t *)data;
+   msurface_t **out = loadmodel->marksurfaces;
+   int i, j;
+
+   for (i = start; i < end; i++) {
 #ifdef MSB_FIRST
-      j = (uint16_t)LittleShort(in[i]);
+      j = (uint32_t)LittleLong(in[i]);
 #else
-      j = (uint16_t)(in[i]);
+      j = (uint32_t)(in[i]);
 #endif
       if (j >= loadmodel->numsurfaces)
-         SV_Error("%s: bad surface number", __func__);
+         return "bad surface number";
       out[i] = loadmodel->surfaces + j;
    }
+
+   return NULL;
 }
 
 static void
 Mod_LoadMarksurfaces_BSP2(lump_t *l)
 {
-   int i, j, count;
+   int count;
    uint32_t *in;
    msurface_t **out;
 
@@ -1699,16 +2376,7 @@ Mod_LoadMarksurfaces_BSP2(lump_t *l)
    loadmodel->marksurfaces = out;
    loadmodel->nummarksurfaces = count;
 
-   for (i = 0; i < count; i++) {
-#ifdef MSB_FIRST
-      j = (uint32_t)LittleLong(in[i]);
-#else
-      j = (uint32_t)(in[i]);
-#endif
-      if (j >= loadmodel->numsurfaces)
-         SV_Error("%s: bad surface number", __func__);
-      out[i] = loadmodel->surfaces + j;
-   }
+   Mod_QueueJob(Mod_ConvertMarksurfaces_BSP2, in, count, MOD_JOB_GRAIN);
 }
 
 /*
@@ -1716,10 +2384,20 @@ Mod_LoadMarksurfaces_BSP2(lump_t *l)
 Mod_LoadSurfedges
 =================
 */
+static const char *
+Mod_ConvertSurfedges(void *data, int start, int end)
+{
+   const int *in = (const int *)data;
+
+   COM_LittleLongs(loadmodel->surfedges + start, in + start, end - start);
+
+   return NULL;
+}
+
 static void
 Mod_LoadSurfedges(lump_t *l)
 {
-   int i, count;
+   int count;
    int *in, *out;
 
    in = (int*)(void *)(mod_base + l->fileofs);
@@ -1731,12 +2409,7 @@ Mod_LoadSurfedges(lump_t *l)
    loadmodel->surfedges = out;
    loadmodel->numsurfedges = count;
 
-   for (i = 0; i < count; i++)
-#ifdef MSB_FIRST
-      out[i] = LittleLong(in[i]);
-#else
-      out[i] = (in[i]);
-#endif
+   Mod_QueueJob(Mod_ConvertSurfedges, in, count, MOD_JOB_GRAIN);
 }
 
 /*
@@ -1744,23 +2417,14 @@ Mod_LoadSurfedges(lump_t *l)
 Mod_LoadPlanes
 =================
 */
-static void Mod_LoadPlanes(lump_t *l)
+static const char *
+Mod_ConvertPlanes(void *data, int start, int end)
 {
-   int i, j, count;
-   mplane_t *out;
-   dplane_t *in = (dplane_t*)(void *)(mod_base + l->fileofs);
-
-   if (l->filelen % sizeof(*in))
-      SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
-
-   count = l->filelen / sizeof(*in);
-   out   = (mplane_t*)
-      Hunk_AllocName(count * 2 * sizeof(*out), loadname);
-
-   loadmodel->planes    = out;
-   loadmodel->numplanes = count;
+   const dplane_t *in = (const dplane_t *)data + start;
+   mplane_t *out = loadmodel->planes + start;
+   int i, j;
 
-   for (i = 0; i < count; i++, in++, out++)
+   for (i = start; i < end; i++, in++, out++)
    {
       int bits = 0;
       for (j = 0; j < 3; j++)
@@ -1783,6 +2447,27 @@ static void Mod_LoadPlanes(lump_t *l)
 #endif
       out->signbits = bits;
    }
+
+   return NULL;
+}
+
+static void Mod_LoadPlanes(lump_t *l)
+{
+   int count;
+   mplane_t *out;
+   dplane_t *in = (dplane_t*)(void *)(mod_base + l->fileofs);
+
+   if (l->filelen % sizeof(*in))
+      SV_Error("%s: funny lump size in %s", __func__, loadmodel->name);
+
+   count = l->filelen / sizeof(*in);
+   out   = (mplane_t*)
+      Hunk_AllocName(count * 2 * sizeof(*out), loadname);
+
+   loadmodel->planes    = out;
+   loadmodel->numplanes = count;
+
+   Mod_QueueJob(Mod_ConvertPlanes, in, count, MOD_JOB_GRAIN);
 }
 
 /*
@@ -1811,6 +2496,7 @@ static void Mod_LoadBrushModel(model_t *mod, void *buffer, unsigned long size)
    int i, j;
    dheader_t *header;
    dmodel_t *bm;
+   model_t *world = NULL;
 
    loadmodel->type = mod_brush;
    header = (dheader_t *)buffer;
@@ -1884,7 +2570,13 @@ static void Mod_LoadBrushModel(model_t *mod, void *buffer, unsigned long size)
 #endif
 #endif
 
-   /* load into heap */
+   /*
+    * Load into heap. The simple lumps are converted by jobs, run in two
+    * batches: the faces depend on the vertexes, edges, surfedges and
+    * texinfo having been converted first, everything else only on the raw
+    * lump data and the (already allocated) output arrays.
+    */
+   mod_numjobs = 0;
    Mod_LoadVertexes(&header->lumps[LUMP_VERTEXES]);
    if (header->version == BSPVERSION)
       Mod_LoadEdges_BSP29(&header->lumps[LUMP_EDGES]);
@@ -1895,6 +2587,9 @@ static void Mod_LoadBrushModel(model_t *mod, void *buffer, unsigned long size)
    Mod_LoadLighting(&header->lumps[LUMP_LIGHTING]);
    Mod_LoadPlanes(&header->lumps[LUMP_PLANES]);
    Mod_LoadTexinfo(&header->lumps[LUMP_TEXINFO]);
+   if (!Mod_RunJobs())
+      return;
+
    if (header->version == BSPVERSION) {
       Mod_LoadFaces_BSP29(&header->lumps[LUMP_FACES]);
       Mod_LoadMarksurfaces_BSP29(&header->lumps[LUMP_MARKSURFACES]);
@@ -1914,8 +2609,18 @@ static void Mod_LoadBrushModel(model_t *mod, void *buffer, unsigned long size)
    }
    Mod_LoadEntities(&header->lumps[LUMP_ENTITIES]);
    Mod_LoadSubmodels(&header->lumps[LUMP_MODELS]);
+   if (!Mod_RunJobs())
+      return;
 
+   Mod_SetParent(loadmodel->nodes, NULL);	// sets nodes and leafs
    Mod_MakeHull0();
+   Mod_MakePointNodes(loadmodel);
+   loadmodel->hulls[0].hullnodes =
+      Mod_MakeHullNodes(loadmodel->hulls[0].clipnodes, loadmodel->numnodes);
+   loadmodel->hulls[1].hullnodes =
+      Mod_MakeHullNodes(loadmodel->clipnodes, loadmodel->numclipnodes);
+   loadmodel->hulls[2].hullnodes = loadmodel->hulls[1].hullnodes;
+   mod_brushloads++;
 
    mod->numframes = 2;		// regular and alternate animation
    mod->flags = 0;
@@ -1926,10 +2631,11 @@ static void Mod_LoadBrushModel(model_t *mod, void *buffer, unsigned long size)
     * - If any other model has more leafs, then we may be in trouble...
     */
          if (mod->numleafs > pvscache_numleafs) {
-            if (pvscache[0].leafbits)
+            if (pvscache)
                SV_Error("%s: %d allocated for visdata, but model %s has %d leafs",
                      __func__, pvscache_numleafs, loadmodel->name, mod->numleafs);
             Mod_InitPVSCache(mod->numleafs);
+            world = mod;
          }
 
          //
@@ -1964,6 +2670,9 @@ static void Mod_LoadBrushModel(model_t *mod, void *buffer, unsigned long size)
                mod = loadmodel;
             }
          }
+
+         if (world)
+            Mod_LoadPVSTable(world);
 }
 
 /*
@@ -122,6 +122,7 @@ typedef struct texture_s {
     int anim_min, anim_max;	// time for this frame min <=time< max
     struct texture_s *anim_next;	// in the animation sequence
     struct texture_s *alternate_anims;	// bmodels in frmae 1 use these
+    struct texture_s *anim_frames[2];	// this frame's, for entity frame 0 and others
     unsigned offsets[MIPLEVELS];	// four mip maps stored
 } texture_t;
 
@@ -218,6 +219,20 @@ typedef struct mleaf_s {
     byte ambient_sound_level[NUM_AMBIENTS];
 } mleaf_t;
 
+/*
+ * A hull's clipnodes again, packed for tracing through: the plane's
+ * distance and type are kept with the children, so the nodes on axial
+ * planes (most of them) are decided without going to the planes at all.
+ */
+typedef struct {
+    float dist;
+    int32_t children[2];
+    int32_t plane;		// planenum << 3 | type
+} mhullnode_t;
+
+#define HULLNODE_TYPE(node)	((node)->plane & 7)
+#define HULLNODE_PLANE(node)	((node)->plane >> 3)
+
 // !!! if this is changed, it must be changed in asm_i386.h too !!!
 typedef struct {
     mclipnode_t *clipnodes;
@@ -226,8 +241,25 @@ typedef struct {
     int lastclipnode;
     vec3_t clip_mins;
     vec3_t clip_maxs;
+    mhullnode_t *hullnodes;	// the clipnodes packed, numbered the same
 } hull_t;
 
+void Mod_PackHullNodes(mhullnode_t *out, const mclipnode_t *in, int count,
+		       const mplane_t *planes);
+
+/*
+ * The distance of p in front of the node's plane
+ */
+static INLINE float
+Mod_HullNodeDist(const hull_t *hull, const mhullnode_t *node, const vec3_t p)
+{
+    const int type = HULLNODE_TYPE(node);
+
+    if (type < 3)
+	return p[type] - node->dist;
+    return DotProduct(hull->planes[HULLNODE_PLANE(node)].normal, p) - node->dist;
+}
+
 /*
 ==============================================================================
 
@@ -327,9 +359,24 @@ typedef struct {
 } aliashdr_t;
 
 
+/*
+ * The software renderer keeps the full mesh and up to two reduced ones,
+ * made by merging nearby vertices, for models drawn only a few pixels
+ * high. Each has its own vertices, so the offsets are to its own copies.
+ */
+#define MAX_ALIAS_LODS 3
+
 typedef struct {
+    int numverts;
+    int numtris;
     int stverts;
     int triangles;
+    int posedata;	// (numposes * numverts) trivertx_t
+} swaliaslod_t;
+
+typedef struct {
+    int numlods;
+    swaliaslod_t lods[MAX_ALIAS_LODS];	// lods[0] is the full mesh
     aliashdr_t ahdr;
 } sw_aliashdr_t;
 
@@ -363,6 +410,9 @@ typedef enum { mod_brush, mod_sprite, mod_alias } modtype_t;
 typedef struct model_s {
     char name[MAX_QPATH];
     qboolean needload;		// bmodels and sprites don't cache normally
+    qboolean recheck;		// kept from the last map, check the file
+    int filesize;		// identify the file an alias model came from
+    unsigned short crc;
 
     modtype_t type;
     int numframes;
@@ -398,12 +448,14 @@ typedef struct model_s {
 
     int numnodes;
     mnode_t *nodes;
+    struct mpointnode_s *pointnodes;	/* for Mod_PointInLeaf */
 
     int numtexinfo;
     mtexinfo_t *texinfo;
 
     int numsurfaces;
     msurface_t *surfaces;
+    float *surfbounds;		// mins then maxs of each axis, numsurfaces apart
 
     int numsurfedges;
     int *surfedges;
@@ -440,6 +492,7 @@ typedef struct model_loader {
     void *(*LoadSkinData)(const char *, aliashdr_t *, int, byte **);
     void (*LoadMeshData)(const model_t *, aliashdr_t *hdr, const mtriangle_t *,
 			 const stvert_t *, const trivertx_t **);
+    int (*CacheVariant)(void);	/* tells apart saved layouts, may be NULL */
 } model_loader_t;
 
 //============================================================================
@@ -447,6 +500,7 @@ typedef struct model_loader {
 void Mod_Init(const model_loader_t *loader);
 void Mod_ClearAll(void);
 model_t *Mod_ForName(const char *name, qboolean crash);
+qboolean Mod_NeedsLoad(const char *name);
 void *Mod_Extradata(model_t *mod);	// handles caching
 void Mod_TouchModel(char *name);
 void Mod_Print(void);
@@ -461,9 +515,42 @@ typedef struct {
 } leafbits_t;
 
 mleaf_t *Mod_PointInLeaf(const model_t *model, const vec3_t point);
+
+/*
+ * The last lookup of a caller that tends to ask about the same point, as
+ * the view does from one frame to the next while it stands still. (A leaf's
+ * bounds overlap its neighbours', so a new point has to go down the tree.)
+ */
+typedef struct {
+    const model_t *model;
+    int sequence;		/* of the model's load */
+    vec3_t point;
+    mleaf_t *leaf;
+} mleafhint_t;
+
+mleaf_t *Mod_PointInLeafHint(const model_t *model, const vec3_t point,
+			     mleafhint_t *hint);
 const leafbits_t *Mod_LeafPVS(const model_t *model, const mleaf_t *leaf);
 const leafbits_t *Mod_FatPVS(const model_t *model, const vec3_t point);
 
+/*
+ * A fat PVS kept for one viewer, such as a client, until the leafs near its
+ * view change. The bits are on the hunk, for the map they're set up for.
+ */
+#define MAX_FATPVS_LEAFS 16
+
+typedef struct {
+    const model_t *model;	/* NULL until the first lookup */
+    int numleafs;
+    const mleaf_t *leafs[MAX_FATPVS_LEAFS];
+    leafbits_t *bits;
+} mfatpvs_t;
+
+void Mod_InitFatPVS(mfatpvs_t *cache, const model_t *model);
+const leafbits_t *Mod_CachedFatPVS(const model_t *model, const vec3_t point,
+				   mfatpvs_t *cache);
+const leafbits_t *Mod_ViewLeafPVS(const model_t *model, const mleaf_t *leaf);
+
 #ifdef _WIN32
 static INLINE int __ERRORLONGSIZE(void)
 {
@@ -534,6 +621,7 @@ int Mod_CountLeafBits(const leafbits_t *leafbits);
 // FIXME - surely this doesn't belong here?
 texture_t *R_TextureAnimation(const struct entity_s *e, texture_t *base);
 
+extern struct cvar_s mod_aliascache;
 void Mod_LoadAliasModel(const model_loader_t *loader, model_t *mod,
 			void *buffer, const model_t *loadmodel,
 			const char *loadname);
@@ -0,0 +1,74 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// namehash.c -- chained hash indexes over arrays of named entries
+
+#include <string.h>
+
+#include "namehash.h"
+
+unsigned
+NameHash_String(const char *s)
+{
+    unsigned hash = 2166136261u;
+
+    while (*s)
+	hash = (hash ^ (unsigned char)*s++) * 16777619u;
+
+    return hash;
+}
+
+/*
+ * numchains must be a power of two; next needs room for every entry
+ */
+void
+NameHash_Init(namehash_t *hash, int *chains, int numchains, int *next)
+{
+    hash->mask = numchains - 1;
+    hash->chains = chains;
+    hash->next = next;
+    NameHash_Clear(hash);
+}
+
+void
+NameHash_Clear(namehash_t *hash)
+{
+    memset(hash->chains, 0, (hash->mask + 1) * sizeof(hash->chains[0]));
+}
+
+void
+NameHash_Insert(namehash_t *hash, const char *name, int entry)
+{
+    int *chain = &hash->chains[NameHash_String(name) & hash->mask];
+
+    hash->next[entry] = *chain;
+    *chain = entry + 1;
+}
+
+int
+NameHash_First(const namehash_t *hash, const char *name)
+{
+    return hash->chains[NameHash_String(name) & hash->mask] - 1;
+}
+
+int
+NameHash_Next(const namehash_t *hash, int entry)
+{
+    return hash->next[entry] - 1;
+}
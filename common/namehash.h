@@ -0,0 +1,59 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef NAMEHASH_H
+#define NAMEHASH_H
+
+/* namehash.h -- chained hash indexes over arrays of named entries */
+
+/*
+ * The index only chains entry numbers together by the hash of their
+ * names; the array keeps the names and the caller compares them, so any
+ * layout of entry and any (case sensitive) comparison will do:
+ *
+ *	for (i = NameHash_First(&hash, name); i >= 0;
+ *	     i = NameHash_Next(&hash, i))
+ *	    if (!strcmp(entries[i].name, name))
+ *		break;
+ *
+ * Entries are added but never taken out; clear it and add them again.
+ */
+typedef struct {
+    unsigned mask;	/* number of chains - 1, a power of two less one */
+    int *chains;	/* 1 + the first entry on each chain, or 0 */
+    int *next;		/* per entry, 1 + the next one on its chain, or 0 */
+} namehash_t;
+
+/* An index over static arrays of chains and of next entries */
+#define NAMEHASH_STATIC(chains, next) \
+    { sizeof(chains) / sizeof((chains)[0]) - 1, chains, next }
+
+/* The FNV-1a hash of the string */
+unsigned NameHash_String(const char *s);
+
+void NameHash_Init(namehash_t *hash, int *chains, int numchains, int *next);
+void NameHash_Clear(namehash_t *hash);
+void NameHash_Insert(namehash_t *hash, const char *name, int entry);
+
+/* The entries that may be called name, -1 after the last */
+int NameHash_First(const namehash_t *hash, const char *name);
+int NameHash_Next(const namehash_t *hash, int entry);
+
+#endif /* NAMEHASH_H */
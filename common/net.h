@@ -51,6 +51,16 @@ typedef struct {
 
 #define NET_PROTOCOL_VERSION	3
 
+/*
+ * A connection may agree to keep several fragments of a reliable message
+ * in flight instead of one. Every fragment but the last is then exactly
+ * the agreed mtu, so the receiver can place those that arrive early and
+ * acknowledge each one. Servers and clients that don't know about it
+ * ignore the extra bytes, and the connection stays stop-and-wait.
+ */
+#define NET_WINDOW_MAGIC	(('W' << 24) | ('I' << 16) | ('N' << 8) | 'D')
+#define NET_MAXWINDOW		32	/* bits in the window masks */
+
 /*
  * This is the network info/connection protocol.  It is used to find Quake
  * servers, get info about them, and connect to them.  Once connected, the
@@ -63,6 +73,9 @@ typedef struct {
  * CCREQ_CONNECT
  *              string  game_name               "QUAKE"
  *              byte    net_protocol_version    NET_PROTOCOL_VERSION
+ *              [long   NET_WINDOW_MAGIC]       optional, asks for a window
+ *              [byte   window]                 reliable fragments in flight
+ *              [short  mtu]                    largest fragment
  *
  * CCREQ_SERVER_INFO
  *              string  game_name               "QUAKE"
@@ -78,6 +91,9 @@ typedef struct {
  *
  * CCREP_ACCEPT
  *              long    port
+ *              [long   NET_WINDOW_MAGIC]       only if the client asked
+ *              [byte   window]                 agreed window, 0 for none
+ *              [short  mtu]                    agreed fragment size
  *
  * CCREP_REJECT
  *              string  reason
@@ -149,6 +165,15 @@ typedef struct qsocket_s {
     int sendMessageLength;
     byte sendMessage[NET_MAXMESSAGE];
 
+    /* Windowed reliable delivery, window is 0 for stop-and-wait */
+    int window;
+    unsigned int sendMessageSequence;	/* of the message's first fragment */
+    unsigned int sendAcked;		/* bits from ackSequence */
+    unsigned int sendResent;		/* resent since the last timeout */
+    unsigned int receivePresent;	/* bits from receiveSequence */
+    int receiveLast;			/* bit of the EOM fragment, or -1 */
+    int receiveLastLength;
+
     unsigned int receiveSequence;
     unsigned int unreliableReceiveSequence;
     int receiveMessageLength;
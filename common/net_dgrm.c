@@ -55,6 +55,42 @@ static struct {
     byte data[NET_MAXMESSAGE];
 } packetBuffer;
 
+static cvar_t net_window = { "net_window", "16" };
+static cvar_t net_controlrate = { "net_controlrate", "30" };
+
+/* control packets handled a frame, so a flood can't hold the frame up */
+#define MAX_CONTROL_PACKETS 64
+
+/*
+ * Server and player info replies are built once and sent to everyone who
+ * asks within CONTROL_REPLY_TIME, so a server list refresh doesn't build
+ * one for every client that's looking
+ */
+#define CONTROL_REPLY_TIME 0.1
+
+typedef struct {
+    net_landriver_t *driver;
+    double time;
+    int length;
+    byte data[256];
+} controlreply_t;
+
+static controlreply_t serverInfoReply;
+static controlreply_t playerInfoReply[MAX_SCOREBOARD];
+
+/*
+ * Each address may send net_controlrate control packets a second, in
+ * bursts of as many; the ones over are dropped. Addresses share the slots
+ * by hash, and one that takes a slot starts over with a full allowance.
+ */
+#define CONTROL_RATE_SLOTS 64
+
+static struct {
+    unsigned ip;
+    double time;
+    float allowance;
+} controlRate[CONTROL_RATE_SLOTS];
+
 #ifdef DEBUG
 static const char *
 StrAddr(netadr_t *addr)
@@ -120,14 +156,14 @@ NET_Ban_f(void)
 }
 
 static int
-SendPacket(qsocket_t *sock)
+SendPacket(qsocket_t *sock, unsigned int sequence, int offset)
 {
     unsigned int packetLen;
     unsigned int dataLen;
     unsigned int eom;
 
-    if (sock->sendMessageLength <= sock->mtu) {
-	dataLen = sock->sendMessageLength;
+    if (sock->sendMessageLength - offset <= sock->mtu) {
+	dataLen = sock->sendMessageLength - offset;
 	eom = NETFLAG_EOM;
     } else {
 	dataLen = sock->mtu;
@@ -136,8 +172,8 @@ SendPacket(qsocket_t *sock)
     packetLen = NET_HEADERSIZE + dataLen;
 
     packetBuffer.length = BigLong(packetLen | (NETFLAG_DATA | eom));
-    packetBuffer.sequence = BigLong(sock->sendSequence++);
-    memcpy(packetBuffer.data, sock->sendMessage, dataLen);
+    packetBuffer.sequence = BigLong(sequence);
+    memcpy(packetBuffer.data, sock->sendMessage + offset, dataLen);
 
     if (sock->landriver->Write(sock->socket, &packetBuffer, packetLen,
 			       &sock->addr) == -1)
@@ -149,6 +185,42 @@ SendPacket(qsocket_t *sock)
     return 1;
 }
 
+/*
+ * In windowed mode the whole message stays in sendMessage and each
+ * fragment is found from its sequence.
+ */
+static int
+SendFragment(qsocket_t *sock, unsigned int sequence)
+{
+    int offset = (sequence - sock->sendMessageSequence) * sock->mtu;
+
+    return SendPacket(sock, sequence, offset);
+}
+
+static unsigned int
+NumFragments(const qsocket_t *sock)
+{
+    return (sock->sendMessageLength + sock->mtu - 1) / sock->mtu;
+}
+
+/*
+ * Sends new fragments until the window is full or the message is all out
+ */
+static int
+SendWindow(qsocket_t *sock)
+{
+    unsigned int count = NumFragments(sock);
+
+    while (sock->sendSequence - sock->sendMessageSequence < count &&
+	   sock->sendSequence - sock->ackSequence < sock->window) {
+	if (SendFragment(sock, sock->sendSequence) == -1)
+	    return -1;
+	sock->sendSequence++;
+    }
+
+    return 1;
+}
+
 int
 Datagram_SendMessage(qsocket_t *sock, sizebuf_t *data)
 {
@@ -167,7 +239,14 @@ Datagram_SendMessage(qsocket_t *sock, sizebuf_t *data)
     sock->sendMessageLength = data->cursize;
     sock->canSend = false;
 
-    return SendPacket(sock);
+    if (sock->window) {
+	sock->sendMessageSequence = sock->sendSequence;
+	sock->sendAcked = 0;
+	sock->sendResent = 0;
+	return SendWindow(sock);
+    }
+
+    return SendPacket(sock, sock->sendSequence++, 0);
 }
 
 static int
@@ -175,17 +254,97 @@ SendMessageNext(qsocket_t *sock)
 {
     sock->sendNext = false;
 
-    return SendPacket(sock);
+    if (sock->window)
+	return SendWindow(sock);
+
+    return SendPacket(sock, sock->sendSequence++, 0);
 }
 
 static int
 ReSendMessage(qsocket_t *sock)
 {
+    unsigned int i, count;
+
     sock->sendNext = false;
 
-    return SendPacket(sock);
+    if (!sock->window) {
+	packetsReSent++;
+	return SendPacket(sock, sock->sendSequence - 1, 0);
+    }
+
+    count = sock->sendSequence - sock->ackSequence;
+    for (i = 0; i < count; i++) {
+	if (sock->sendAcked & (1u << i))
+	    continue;
+	if (SendFragment(sock, sock->ackSequence + i) == -1)
+	    return -1;
+	sock->sendResent |= 1u << i;
+	packetsReSent++;
+    }
+
+    return 1;
 }
 
+static int
+AckedAbove(const qsocket_t *sock, unsigned int bit)
+{
+    unsigned int acked = sock->sendAcked >> bit >> 1;
+    int count;
+
+    for (count = 0; acked; acked &= acked - 1)
+	count++;
+
+    return count;
+}
+
+/*
+ * Each fragment in the window is acknowledged on its own. Once the oldest
+ * ones are all in, the window slides on to let new fragments out.
+ */
+static void
+AckFragment(qsocket_t *sock, unsigned int sequence)
+{
+    unsigned int bit, lost, i;
+
+    if (sequence - sock->ackSequence >= sock->sendSequence - sock->ackSequence) {
+	Con_DPrintf("Stale ACK received\n");
+	return;
+    }
+    bit = 1u << (sequence - sock->ackSequence);
+    if (sock->sendAcked & bit) {
+	Con_DPrintf("Duplicate ACK received\n");
+	return;
+    }
+    sock->sendAcked |= bit;
+
+    /*
+     * An earlier fragment still waiting once three later ones are in was
+     * most likely lost rather than reordered, so send it again now rather
+     * than at the timeout, but only once.
+     */
+    lost = (bit - 1) & ~(sock->sendAcked | sock->sendResent);
+    for (i = 0; lost; i++, lost >>= 1) {
+	if (!(lost & 1) || AckedAbove(sock, i) < 3)
+	    continue;
+	SendFragment(sock, sock->ackSequence + i);
+	sock->sendResent |= 1u << i;
+	packetsReSent++;
+    }
+
+    while (sock->sendAcked & 1) {
+	sock->sendAcked >>= 1;
+	sock->sendResent >>= 1;
+	sock->ackSequence++;
+    }
+
+    if (sock->ackSequence == sock->sendMessageSequence + NumFragments(sock)) {
+	sock->sendMessageLength = 0;
+	sock->canSend = true;
+	sock->sendNext = false;
+    } else {
+	sock->sendNext = true;
+    }
+}
 
 qboolean
 Datagram_CanSendMessage(qsocket_t *sock)
@@ -232,6 +391,76 @@ Datagram_SendUnreliableMessage(qsocket_t *sock, sizebuf_t *data)
 }
 
 
+static void
+SendAck(qsocket_t *sock, unsigned int sequence, const netadr_t *addr)
+{
+    packetBuffer.length = BigLong(NET_HEADERSIZE | NETFLAG_ACK);
+    packetBuffer.sequence = BigLong(sequence);
+    sock->landriver->Write(sock->socket, &packetBuffer, NET_HEADERSIZE, addr);
+}
+
+/*
+ * Places a fragment of a reliable message in windowed mode, acknowledging
+ * it if it fits the window. Returns true once a message is complete, which
+ * is then in net_message.
+ */
+static qboolean
+ReceiveFragment(qsocket_t *sock, unsigned int sequence, unsigned int flags,
+		unsigned int length, const netadr_t *addr)
+{
+    unsigned int slot, bit, offset;
+
+    slot = sequence - sock->receiveSequence;
+    if (slot >= sock->window) {
+	// a fragment we have whose ack was lost
+	if ((int)slot < 0) {
+	    SendAck(sock, sequence, addr);
+	    receivedDuplicateCount++;
+	}
+	return false;
+    }
+
+    /* every fragment but the last is the full mtu, nothing follows the last */
+    if (length > sock->mtu || (!(flags & NETFLAG_EOM) && length != sock->mtu))
+	return false;
+    if (sock->receiveLast >= 0 && (int)slot > sock->receiveLast)
+	return false;
+    offset = sock->receiveMessageLength + slot * sock->mtu;
+    if (offset + length > NET_MAXMESSAGE)
+	return false;
+
+    bit = 1u << slot;
+    if (!(sock->receivePresent & bit)) {
+	memcpy(sock->receiveMessage + offset, packetBuffer.data, length);
+	sock->receivePresent |= bit;
+	if (flags & NETFLAG_EOM) {
+	    sock->receiveLast = slot;
+	    sock->receiveLastLength = length;
+	}
+    } else {
+	receivedDuplicateCount++;
+    }
+    SendAck(sock, sequence, addr);
+
+    while (sock->receivePresent & 1) {
+	sock->receivePresent >>= 1;
+	sock->receiveSequence++;
+	if (sock->receiveLast == 0) {
+	    SZ_Clear(&net_message);
+	    SZ_Write(&net_message, sock->receiveMessage,
+		     sock->receiveMessageLength + sock->receiveLastLength);
+	    sock->receiveMessageLength = 0;
+	    sock->receiveLast = -1;
+	    return true;
+	}
+	sock->receiveMessageLength += sock->mtu;
+	if (sock->receiveLast > 0)
+	    sock->receiveLast--;
+    }
+
+    return false;
+}
+
 int
 Datagram_GetMessage(qsocket_t *sock)
 {
@@ -309,6 +538,10 @@ Datagram_GetMessage(qsocket_t *sock)
 	}
 
 	if (flags & NETFLAG_ACK) {
+	    if (sock->window) {
+		AckFragment(sock, sequence);
+		continue;
+	    }
 	    if (sequence != (sock->sendSequence - 1)) {
 		Con_DPrintf("Stale ACK received\n");
 		continue;
@@ -334,10 +567,15 @@ Datagram_GetMessage(qsocket_t *sock)
 	}
 
 	if (flags & NETFLAG_DATA) {
-	    packetBuffer.length = BigLong(NET_HEADERSIZE | NETFLAG_ACK);
-	    packetBuffer.sequence = BigLong(sequence);
-	    sock->landriver->Write(sock->socket, &packetBuffer, NET_HEADERSIZE,
-				   &readaddr);
+	    if (sock->window) {
+		length -= NET_HEADERSIZE;
+		if (ReceiveFragment(sock, sequence, flags, length, &readaddr)) {
+		    ret = 1;
+		    break;
+		}
+		continue;
+	    }
+	    SendAck(sock, sequence, &readaddr);
 
 	    if (sequence != sock->receiveSequence) {
 		receivedDuplicateCount++;
@@ -374,7 +612,8 @@ Datagram_GetMessage(qsocket_t *sock)
 static void
 PrintStats(qsocket_t *s)
 {
-    Con_Printf("canSend = %4u   \n", s->canSend);
+    Con_Printf("canSend = %4u   ", s->canSend);
+    Con_Printf("window  = %4d   \n", s->window);
     Con_Printf("sendSeq = %4u   ", s->sendSequence);
     Con_Printf("recvSeq = %4u   \n", s->receiveSequence);
     Con_Printf("\n");
@@ -698,6 +937,8 @@ Datagram_Init(void)
 
     dgrm_driver = net_driver;
     Cmd_AddCommand("net_stats", NET_Stats_f);
+    Cvar_RegisterVariable(&net_window);
+    Cvar_RegisterVariable(&net_controlrate);
 
     if (COM_CheckParm("-nolan"))
 	return -1;
@@ -758,25 +999,127 @@ Datagram_Listen(qboolean state)
 }
 
 
+/*
+ * The window net_window asks for, 0 if it turns windowing off
+ */
+static int
+Datagram_Window(void)
+{
+    int window = net_window.value;
+
+    if (window < 2)
+	return 0;
+
+    return qmin(window, NET_MAXWINDOW);
+}
+
+/*
+ * Takes up as much of a client's window as net_window allows
+ */
+static void
+AgreeWindow(qsocket_t *sock, int window, int mtu)
+{
+    window = qmin(window, Datagram_Window());
+    if (window < 2 || mtu <= 0) {
+	sock->window = 0;
+	return;
+    }
+    sock->window = window;
+    sock->mtu = qmin(sock->mtu, mtu);
+}
+
+static void
+WriteAccept(qsocket_t *sock, qboolean window)
+{
+    netadr_t newaddr;
+
+    SZ_Clear(&net_message);
+    // save space for the header, filled in later
+    MSG_WriteLong(&net_message, 0);
+    MSG_WriteByte(&net_message, CCREP_ACCEPT);
+    sock->landriver->GetSocketAddr(sock->socket, &newaddr);
+    MSG_WriteLong(&net_message, NET_GetSocketPort(&newaddr));
+    if (window) {
+	MSG_WriteLong(&net_message, NET_WINDOW_MAGIC);
+	MSG_WriteByte(&net_message, sock->window);
+	MSG_WriteShort(&net_message, sock->mtu);
+    }
+    MSG_WriteControlHeader(&net_message);
+}
+
+static qboolean
+ControlRateAllows(const netadr_t *addr)
+{
+    float rate = net_controlrate.value;
+    int slot;
+
+    if (rate <= 0)
+	return true;
+
+    slot = (addr->ip.l * 2654435761u) >> 26;
+    if (controlRate[slot].ip != addr->ip.l || controlRate[slot].time == 0) {
+	controlRate[slot].ip = addr->ip.l;
+	controlRate[slot].allowance = rate;
+    } else {
+	controlRate[slot].allowance +=
+	    (net_time - controlRate[slot].time) * rate;
+	if (controlRate[slot].allowance > rate)
+	    controlRate[slot].allowance = rate;
+    }
+    controlRate[slot].time = net_time;
+
+    if (controlRate[slot].allowance < 1)
+	return false;
+    controlRate[slot].allowance -= 1;
+
+    return true;
+}
+
+static qboolean
+ReplyIsCached(const controlreply_t *reply, const net_landriver_t *driver)
+{
+    return reply->length && reply->driver == driver
+	&& net_time - reply->time < CONTROL_REPLY_TIME
+	&& net_time >= reply->time;
+}
+
+/*
+ * Keeps the reply in net_message for the next ones who ask, unless it's
+ * too big to
+ */
+static void
+CacheReply(controlreply_t *reply, net_landriver_t *driver)
+{
+    if (net_message.cursize > sizeof(reply->data)) {
+	reply->length = 0;
+	return;
+    }
+    memcpy(reply->data, net_message.data, net_message.cursize);
+    reply->length = net_message.cursize;
+    reply->driver = driver;
+    reply->time = net_time;
+}
+
+/*
+ * Handles the control packet waiting on acceptsock, returning the new
+ * connection if it was a client let in
+ */
 static qsocket_t *
-_Datagram_CheckNewConnections(net_landriver_t *driver)
+Datagram_ControlPacket(net_landriver_t *driver, int acceptsock)
 {
     netadr_t clientaddr;
     netadr_t newaddr;
     netadr_t testAddr;
 
     int newsock;
-    int acceptsock;
     qsocket_t *sock;
     qsocket_t *s;
     int len;
     int command;
     int control;
     int ret;
-
-    acceptsock = driver->CheckNewConnections();
-    if (acceptsock == -1)
-	return NULL;
+    qboolean askedWindow;
+    int window, mtu;
 
     SZ_Clear(&net_message);
 
@@ -786,6 +1129,9 @@ _Datagram_CheckNewConnections(net_landriver_t *driver)
 	return NULL;
     net_message.cursize = len;
 
+    if (!ControlRateAllows(&clientaddr))
+	return NULL;
+
     MSG_BeginReading();
     control = MSG_ReadControlHeader();
     if (control == -1)
@@ -800,6 +1146,13 @@ _Datagram_CheckNewConnections(net_landriver_t *driver)
 	if (strcmp(MSG_ReadString(), "QUAKE") != 0)
 	    return NULL;
 
+	if (ReplyIsCached(&serverInfoReply, driver)) {
+	    driver->Write(acceptsock, serverInfoReply.data,
+			  serverInfoReply.length, &clientaddr);
+	    SZ_Clear(&net_message);
+	    return NULL;
+	}
+
 	SZ_Clear(&net_message);
 	// save space for the header, filled in later
 	MSG_WriteLong(&net_message, 0);
@@ -812,6 +1165,7 @@ _Datagram_CheckNewConnections(net_landriver_t *driver)
 	MSG_WriteByte(&net_message, svs.maxclients);
 	MSG_WriteByte(&net_message, NET_PROTOCOL_VERSION);
 	MSG_WriteControlHeader(&net_message);
+	CacheReply(&serverInfoReply, driver);
 	driver->Write(acceptsock, net_message.data, net_message.cursize,
 		      &clientaddr);
 	SZ_Clear(&net_message);
@@ -823,8 +1177,20 @@ _Datagram_CheckNewConnections(net_landriver_t *driver)
 	int activeNumber;
 	int clientNumber;
 	client_t *client;
+	controlreply_t *reply;
 
 	playerNumber = MSG_ReadByte();
+	reply = NULL;
+	if (playerNumber >= 0 && playerNumber < MAX_SCOREBOARD) {
+	    reply = &playerInfoReply[playerNumber];
+	    if (ReplyIsCached(reply, driver)) {
+		driver->Write(acceptsock, reply->data, reply->length,
+			      &clientaddr);
+		SZ_Clear(&net_message);
+		return NULL;
+	    }
+	}
+
 	activeNumber = -1;
 	for (clientNumber = 0, client = svs.clients;
 	     clientNumber < svs.maxclients; clientNumber++, client++) {
@@ -849,6 +1215,8 @@ _Datagram_CheckNewConnections(net_landriver_t *driver)
 		      (int)(net_time - client->netconnection->connecttime));
 	MSG_WriteString(&net_message, client->netconnection->address);
 	MSG_WriteControlHeader(&net_message);
+	if (reply)
+	    CacheReply(reply, driver);
 	driver->Write(acceptsock, net_message.data, net_message.cursize,
 		      &clientaddr);
 	SZ_Clear(&net_message);
@@ -903,6 +1271,17 @@ _Datagram_CheckNewConnections(net_landriver_t *driver)
 	return NULL;
     }
 
+    // a client that can keep several fragments in flight says so
+    window = 0;
+    mtu = 0;
+    askedWindow = MSG_ReadLong() == NET_WINDOW_MAGIC;
+    if (askedWindow) {
+	window = MSG_ReadByte();
+	mtu = MSG_ReadShort();
+	if (msg_badread)
+	    window = 0;
+    }
+
     // check for a ban
     testAddr.ip.l = clientaddr.ip.l;
     if ((testAddr.ip.l & banMask.ip.l) == banAddr.ip.l) {
@@ -927,13 +1306,7 @@ _Datagram_CheckNewConnections(net_landriver_t *driver)
 	    // is this a duplicate connection reqeust?
 	    if (ret == 0 && net_time - s->connecttime < 2.0) {
 		// yes, so send a duplicate reply
-		SZ_Clear(&net_message);
-		// save space for the header, filled in later
-		MSG_WriteLong(&net_message, 0);
-		MSG_WriteByte(&net_message, CCREP_ACCEPT);
-		driver->GetSocketAddr(s->socket, &newaddr);
-		MSG_WriteLong(&net_message, NET_GetSocketPort(&newaddr));
-		MSG_WriteControlHeader(&net_message);
+		WriteAccept(s, askedWindow);
 		driver->Write(acceptsock, net_message.data,
 			      net_message.cursize, &clientaddr);
 		SZ_Clear(&net_message);
@@ -976,15 +1349,10 @@ _Datagram_CheckNewConnections(net_landriver_t *driver)
     sock->addr = clientaddr;
     strcpy(sock->address, NET_AdrToString(&clientaddr));
     sock->mtu = driver->GetDefaultMTU() - NET_HEADERSIZE;
+    AgreeWindow(sock, window, mtu);
 
     // send him back the info about the server connection he has been allocated
-    SZ_Clear(&net_message);
-    // save space for the header, filled in later
-    MSG_WriteLong(&net_message, 0);
-    MSG_WriteByte(&net_message, CCREP_ACCEPT);
-    driver->GetSocketAddr(newsock, &newaddr);
-    MSG_WriteLong(&net_message, NET_GetSocketPort(&newaddr));
-    MSG_WriteControlHeader(&net_message);
+    WriteAccept(sock, askedWindow);
     driver->Write(acceptsock, net_message.data, net_message.cursize,
 		  &clientaddr);
     SZ_Clear(&net_message);
@@ -992,6 +1360,29 @@ _Datagram_CheckNewConnections(net_landriver_t *driver)
     return sock;
 }
 
+/*
+ * Works through the control packets waiting for the driver, up to
+ * MAX_CONTROL_PACKETS, until one lets a client in
+ */
+static qsocket_t *
+_Datagram_CheckNewConnections(net_landriver_t *driver)
+{
+    qsocket_t *sock;
+    int acceptsock;
+    int i;
+
+    for (i = 0; i < MAX_CONTROL_PACKETS; i++) {
+	acceptsock = driver->CheckNewConnections();
+	if (acceptsock == -1)
+	    break;
+	sock = Datagram_ControlPacket(driver, acceptsock);
+	if (sock)
+	    return sock;
+    }
+
+    return NULL;
+}
+
 qsocket_t *
 Datagram_CheckNewConnections(void)
 {
@@ -1145,6 +1536,7 @@ _Datagram_Connect(const char *host, net_landriver_t *driver)
     double start_time;
     int control;
     const char *reason;
+    int window, mtu;
 
     // see if we can resolve the host name
     if (driver->GetAddrFromName(host, &sendaddr) == -1)
@@ -1174,6 +1566,11 @@ _Datagram_Connect(const char *host, net_landriver_t *driver)
 	MSG_WriteByte(&net_message, CCREQ_CONNECT);
 	MSG_WriteString(&net_message, "QUAKE");
 	MSG_WriteByte(&net_message, NET_PROTOCOL_VERSION);
+	if (Datagram_Window()) {
+	    MSG_WriteLong(&net_message, NET_WINDOW_MAGIC);
+	    MSG_WriteByte(&net_message, Datagram_Window());
+	    MSG_WriteShort(&net_message, sock->mtu);
+	}
 	MSG_WriteControlHeader(&net_message);
 	driver->Write(newsock, net_message.data, net_message.cursize,
 		     &sendaddr);
@@ -1244,6 +1641,15 @@ _Datagram_Connect(const char *host, net_landriver_t *driver)
     if (ret == CCREP_ACCEPT) {
 	sock->addr = sendaddr;
 	NET_SetSocketPort(&sock->addr, MSG_ReadLong());
+	if (MSG_ReadLong() == NET_WINDOW_MAGIC) {
+	    window = MSG_ReadByte();
+	    mtu = MSG_ReadShort();
+	    if (!msg_badread && window >= 2 && window <= NET_MAXWINDOW &&
+		mtu > 0 && mtu <= sock->mtu) {
+		sock->window = window;
+		sock->mtu = mtu;
+	    }
+	}
     } else {
 	reason = "Bad Response";
 	goto ErrorReturn;
@@ -1263,11 +1669,8 @@ _Datagram_Connect(const char *host, net_landriver_t *driver)
     NET_FreeQSocket(sock);
   ErrorReturn2:
     driver->CloseSocket(newsock);
-    if (m_return_onerror) {
-	key_dest = key_menu;
-	m_state = m_return_state;
-	m_return_onerror = false;
-    }
+    if (m_return_onerror)
+	M_ReturnOnError();
     return NULL;
 }
 
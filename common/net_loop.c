@@ -25,16 +25,63 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "server.h"
 #include "console.h"
 #include "sys.h"
+#include "zone.h"
 
 qboolean localconnectpending = false;
 qsocket_t *loop_client = NULL;
 qsocket_t *loop_server = NULL;
 
+/*
+ * Each side receives into a ring of message buffers. The sender copies its
+ * message into the next free buffer, and the reader swaps the buffer with
+ * net_message's, so the message is parsed where it was written and the
+ * reader's old buffer goes back to the ring. Only one reliable message is
+ * outstanding at a time, and unreliable ones leave a buffer free for it.
+ */
+#define LOOP_SLOTS 4
+
+typedef struct {
+    byte *data;			/* NET_MAXMESSAGE bytes */
+    int length;
+    int type;			/* as returned by Loop_GetMessage */
+} loopslot_t;
+
+typedef struct {
+    loopslot_t slots[LOOP_SLOTS];
+    int head;			/* next to be read */
+    int count;
+} loopring_t;
+
+static loopring_t loop_rings[2];	/* received by the client, by the server */
+
+static loopring_t *
+Loop_Ring(const qsocket_t *sock)
+{
+    return sock == loop_client ? &loop_rings[0] : &loop_rings[1];
+}
+
+static void
+Loop_ClearRing(loopring_t *ring)
+{
+    ring->head = 0;
+    ring->count = 0;
+}
+
 int
 Loop_Init(void)
 {
+    byte *buffers;
+    int i, j;
+
     if (cls.state == ca_dedicated)
 	return -1;
+
+    buffers = Hunk_AllocName(2 * LOOP_SLOTS * NET_MAXMESSAGE, "loopback");
+    for (i = 0; i < 2; i++)
+	for (j = 0; j < LOOP_SLOTS; j++)
+	    loop_rings[i].slots[j].data =
+		buffers + (i * LOOP_SLOTS + j) * NET_MAXMESSAGE;
+
     return 0;
 }
 
@@ -85,7 +132,7 @@ Loop_Connect(const char *host)
 	}
 	strcpy(loop_client->address, "localhost");
     }
-    loop_client->receiveMessageLength = 0;
+    Loop_ClearRing(&loop_rings[0]);
     loop_client->sendMessageLength = 0;
     loop_client->canSend = true;
     loop_client->mtu = Loop_GetDefaultMTU();
@@ -97,7 +144,7 @@ Loop_Connect(const char *host)
 	}
 	strcpy(loop_server->address, "LOCAL");
     }
-    loop_server->receiveMessageLength = 0;
+    Loop_ClearRing(&loop_rings[1]);
     loop_server->sendMessageLength = 0;
     loop_server->canSend = true;
     loop_server->mtu = Loop_GetDefaultMTU();
@@ -117,43 +164,37 @@ Loop_CheckNewConnections(void)
 
     localconnectpending = false;
     loop_server->sendMessageLength = 0;
-    loop_server->receiveMessageLength = 0;
     loop_server->canSend = true;
     loop_client->sendMessageLength = 0;
-    loop_client->receiveMessageLength = 0;
     loop_client->canSend = true;
+    Loop_ClearRing(&loop_rings[0]);
+    Loop_ClearRing(&loop_rings[1]);
     return loop_server;
 }
 
 
-static int
-IntAlign(int value)
-{
-    return (value + (sizeof(int) - 1)) & (~(sizeof(int) - 1));
-}
-
-
 int
 Loop_GetMessage(qsocket_t *sock)
 {
+    loopring_t *ring = Loop_Ring(sock);
+    loopslot_t *slot;
+    byte *buffer;
     int ret;
-    int length;
 
-    if (sock->receiveMessageLength == 0)
+    if (!ring->count)
 	return 0;
 
-    ret = sock->receiveMessage[0];
-    length = sock->receiveMessage[1] + (sock->receiveMessage[2] << 8);
-    // alignment byte skipped here
-    SZ_Clear(&net_message);
-    SZ_Write(&net_message, &sock->receiveMessage[4], length);
+    /* hand the buffer over to net_message, taking its old one back */
+    slot = &ring->slots[ring->head];
+    buffer = net_message.data;
+    net_message.data = slot->data;
+    net_message.cursize = slot->length;
+    net_message.overflowed = false;
+    slot->data = buffer;
+    ret = slot->type;
 
-    length = IntAlign(length + 4);
-    sock->receiveMessageLength -= length;
-
-    if (sock->receiveMessageLength)
-	memmove(sock->receiveMessage, &sock->receiveMessage[length],
-	       sock->receiveMessageLength);
+    ring->head = (ring->head + 1) % LOOP_SLOTS;
+    ring->count--;
 
     if (sock->driverdata && ret == 1)
 	((qsocket_t *)sock->driverdata)->canSend = true;
@@ -162,35 +203,30 @@ Loop_GetMessage(qsocket_t *sock)
 }
 
 
+static void
+Loop_Write(const qsocket_t *peer, const sizebuf_t *data, int type)
+{
+    loopring_t *ring = Loop_Ring(peer);
+    loopslot_t *slot;
+
+    slot = &ring->slots[(ring->head + ring->count) % LOOP_SLOTS];
+    memcpy(slot->data, data->data, data->cursize);
+    slot->length = data->cursize;
+    slot->type = type;
+    ring->count++;
+}
+
+
 int
 Loop_SendMessage(qsocket_t *sock, sizebuf_t *data)
 {
-    byte *buffer;
-    int *bufferLength;
-
     if (!sock->driverdata)
 	return -1;
 
-    bufferLength = &((qsocket_t *)sock->driverdata)->receiveMessageLength;
-
-    if ((*bufferLength + data->cursize + 4) > NET_MAXMESSAGE)
+    if (Loop_Ring(sock->driverdata)->count == LOOP_SLOTS)
 	Sys_Error("%s: overflow", __func__);
 
-    buffer = ((qsocket_t *)sock->driverdata)->receiveMessage + *bufferLength;
-
-    // message type
-    *buffer++ = 1;
-
-    // length
-    *buffer++ = data->cursize & 0xff;
-    *buffer++ = data->cursize >> 8;
-
-    // align
-    buffer++;
-
-    // message
-    memcpy(buffer, data->data, data->cursize);
-    *bufferLength = IntAlign(*bufferLength + data->cursize + 4);
+    Loop_Write(sock->driverdata, data, 1);
 
     sock->canSend = false;
     return 1;
@@ -200,33 +236,13 @@ Loop_SendMessage(qsocket_t *sock, sizebuf_t *data)
 int
 Loop_SendUnreliableMessage(qsocket_t *sock, sizebuf_t *data)
 {
-    byte *buffer;
-    int *bufferLength;
-
     if (!sock->driverdata)
 	return -1;
 
-    bufferLength = &((qsocket_t *)sock->driverdata)->receiveMessageLength;
-
-    if ((*bufferLength + data->cursize + sizeof(byte) + sizeof(short)) >
-	NET_MAXMESSAGE)
+    if (Loop_Ring(sock->driverdata)->count >= LOOP_SLOTS - 1)
 	return 0;
 
-    buffer = ((qsocket_t *)sock->driverdata)->receiveMessage + *bufferLength;
-
-    // message type
-    *buffer++ = 2;
-
-    // length
-    *buffer++ = data->cursize & 0xff;
-    *buffer++ = data->cursize >> 8;
-
-    // align
-    buffer++;
-
-    // message
-    memcpy(buffer, data->data, data->cursize);
-    *bufferLength = IntAlign(*bufferLength + data->cursize + 4);
+    Loop_Write(sock->driverdata, data, 2);
     return 1;
 }
 
@@ -252,7 +268,7 @@ Loop_Close(qsocket_t *sock)
 {
     if (sock->driverdata)
 	((qsocket_t *)sock->driverdata)->driverdata = NULL;
-    sock->receiveMessageLength = 0;
+    Loop_ClearRing(Loop_Ring(sock));
     sock->sendMessageLength = 0;
     sock->canSend = true;
     if (sock == loop_client)
@@ -190,6 +190,9 @@ NET_NewQSocket(void)
     sock->receiveSequence = 0;
     sock->unreliableReceiveSequence = 0;
     sock->receiveMessageLength = 0;
+    sock->window = 0;
+    sock->receivePresent = 0;
+    sock->receiveLast = -1;
 
     return sock;
 }
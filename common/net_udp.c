@@ -19,6 +19,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include <sys/types.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -42,6 +43,10 @@ static int net_controlsocket;
 static int net_broadcastsocket = 0;
 static netadr_t broadcastaddr;
 
+/* every socket that is open, for UDP_SocketSet */
+static fd_set net_opensockets;
+static int net_maxsocket = -1;
+
 /*
  * There are three addresses that we may use in different ways:
  *   myAddr	- This is the "default" address returned by the OS
@@ -255,6 +260,12 @@ UDP_OpenSocket(int port)
     if (bind(newsocket, (struct sockaddr *)&address, sizeof(address)) == -1)
 	goto ErrorReturn;
 
+    if (newsocket < FD_SETSIZE) {
+	FD_SET(newsocket, &net_opensockets);
+	if (newsocket > net_maxsocket)
+	    net_maxsocket = newsocket;
+    }
+
     return newsocket;
 
   ErrorReturn:
@@ -268,10 +279,29 @@ UDP_CloseSocket(int socket)
 {
     if (socket == net_broadcastsocket)
 	net_broadcastsocket = 0;
+    if (socket >= 0 && socket < FD_SETSIZE)
+	FD_CLR(socket, &net_opensockets);
     return close(socket);
 }
 
 
+/*
+ * Adds every open socket to the set, for waiting on them all at once.
+ * Returns one more than the highest, as select wants.
+ */
+int
+UDP_SocketSet(fd_set *set)
+{
+    int i;
+
+    for (i = 0; i <= net_maxsocket; i++)
+	if (FD_ISSET(i, &net_opensockets))
+	    FD_SET(i, set);
+
+    return net_maxsocket + 1;
+}
+
+
 int
 UDP_CheckNewConnections(void)
 {
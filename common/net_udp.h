@@ -21,6 +21,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifndef NET_UDP_H
 #define NET_UDP_H
 
+#include <sys/select.h>
+
 #include "net.h"
 
 // net_udp.h
@@ -38,5 +40,6 @@ int UDP_GetSocketAddr(int socket, netadr_t *addr);
 int UDP_GetNameFromAddr(const netadr_t *addr, char *name);
 int UDP_GetAddrFromName(const char *name, netadr_t *addr);
 int UDP_GetDefaultMTU(void);
+int UDP_SocketSet(fd_set *set);
 
 #endif /* NET_UDP_H */
@@ -19,10 +19,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include <float.h>
+#include <math.h>
+#include <stdlib.h>
 
 #include "cmd.h"
 #include "console.h"
 #include "model.h"
+#include "namehash.h"
 #include "progs.h"
 #include "server.h"
 #include "world.h"
@@ -279,7 +282,6 @@ static void
 PF_setmodel(void)
 {
     edict_t *e;
-    const char **check;
     const char *m;
     model_t *mod;
     int i;
@@ -288,11 +290,8 @@ PF_setmodel(void)
     m = G_STRING(OFS_PARM1);
 
     /* check to see if model was properly precached */
-    for (i = 0, check = sv.model_precache; *check; i++, check++)
-	if (!strcmp(*check, m))
-	    break;
-
-    if (!*check)
+    i = PR_FindPrecache(&sv.model_hash, sv.model_precache, m);
+    if (i < 0)
 	PR_RunError("no precache: %s\n", m);
 
     e->v.model = PR_SetString(m);
@@ -630,7 +629,6 @@ PF_ambientsound
 static void
 PF_ambientsound(void)
 {
-    const char **check;
     const char *samp;
     float *pos;
     float vol, attenuation;
@@ -642,11 +640,8 @@ PF_ambientsound(void)
     attenuation = G_FLOAT(OFS_PARM3);
 
 // check to see if samp was properly precached
-    for (soundnum = 0, check = sv.sound_precache; *check; check++, soundnum++)
-	if (!strcmp(*check, samp))
-	    break;
-
-    if (!*check) {
+    soundnum = PR_FindPrecache(&sv.sound_hash, sv.sound_precache, samp);
+    if (soundnum < 0) {
 	Con_Printf("no precache: %s\n", samp);
 	return;
     }
@@ -755,7 +750,11 @@ PF_traceline(void)
     nomonsters = G_FLOAT(OFS_PARM2);
     ent = G_EDICT(OFS_PARM3);
 
+#ifdef QW_HACK
+    trace = SV_AntilagTraceline(v1, v2, nomonsters, ent);
+#else
     trace = SV_Move(v1, vec3_origin, vec3_origin, v2, nomonsters, ent);
+#endif
 
     pr_global_struct->trace_allsolid = trace.allsolid;
     pr_global_struct->trace_startsolid = trace.startsolid;
@@ -773,6 +772,38 @@ PF_traceline(void)
 
 //============================================================================
 
+/*
+ * The PVS of the check client's leaf, copied out when the check changes so
+ * every checkclient() until the next one only has to test a bit
+ */
+static leafbits_t *pf_checkpvs;
+static size_t pf_checkpvssize;
+static const mleaf_t *pf_checkpvsleaf;
+
+static const leafbits_t *
+PF_CheckPVS(void)
+{
+    const leafbits_t *pvs;
+    size_t size;
+
+    if (pf_checkpvsleaf == sv.checkleaf)
+	return pf_checkpvs;
+
+    pvs = Mod_LeafPVS(sv.worldmodel, sv.checkleaf);
+    size = Mod_LeafbitsSize(pvs->numleafs);
+    if (size > pf_checkpvssize) {
+	free(pf_checkpvs);
+	pf_checkpvs = malloc(size);
+	if (!pf_checkpvs)
+	    SV_Error("%s: couldn't allocate %d bytes", __func__, (int)size);
+	pf_checkpvssize = size;
+    }
+    memcpy(pf_checkpvs, pvs, size);
+    pf_checkpvsleaf = sv.checkleaf;
+
+    return pf_checkpvs;
+}
+
 static int
 PF_newcheckclient(int check)
 {
@@ -819,6 +850,7 @@ PF_newcheckclient(int check)
 // get the current leaf for the entity
     VectorAdd(ent->v.origin, ent->v.view_ofs, org);
     sv.checkleaf = Mod_PointInLeaf(sv.worldmodel, org);
+    pf_checkpvsleaf = NULL;
 
     return entnum;
 }
@@ -861,7 +893,7 @@ PF_checkclient(void)
 	return;
     }
 // if current entity can't possibly see the check entity, return 0
-    checkpvs = Mod_LeafPVS(sv.worldmodel, sv.checkleaf);
+    checkpvs = PF_CheckPVS();
     self = PROG_TO_EDICT(pr_global_struct->self);
     VectorAdd(self->v.origin, self->v.view_ofs, view);
     leaf = Mod_PointInLeaf(sv.worldmodel, view);
@@ -986,19 +1018,37 @@ findradius (origin, radius)
 static void
 PF_findradius(void)
 {
+    static int nums[MAX_EDICTS * 2 + 1];
     edict_t *ent, *chain;
     float rad;
     float *org;
-    vec3_t eorg;
-    int i, j;
+    vec3_t eorg, mins, maxs;
+    int i, j, count;
 
     chain = (edict_t *)sv.edicts;
 
     org = G_VECTOR(OFS_PARM0);
     rad = G_FLOAT(OFS_PARM1);
 
-    ent = NEXT_EDICT(sv.edicts);
-    for (i = 1; i < sv.num_edicts; i++, ent = NEXT_EDICT(ent)) {
+    /*
+     * Any edict whose center is in the radius is linked to an area node
+     * the box around it reaches, or unplaced. That holds as long as the
+     * numbers are; the extra unit covers the rounding.
+     */
+    if (rad >= 0 && !IS_NAN(org[0]) && !IS_NAN(org[1]) && !IS_NAN(org[2])) {
+	for (j = 0; j < 3; j++) {
+	    mins[j] = org[j] - rad - 1;
+	    maxs[j] = org[j] + rad + 1;
+	}
+	count = SV_BoxEdicts(mins, maxs, nums);
+    } else {
+	for (count = 0; count < sv.num_edicts - 1; count++)
+	    nums[count] = count + 1;
+    }
+
+    /* the chain is built in edict order, as the old scan of them all did */
+    for (i = 0; i < count; i++) {
+	ent = EDICT_NUM(nums[i]);
 	if (ent->free)
 	    continue;
 	if (ent->v.solid == SOLID_NOT)
@@ -1096,6 +1146,14 @@ PF_Find(void)
     if (!s)
 	PR_RunError("%s: bad search string", __func__);
 
+    /* classnames and targetnames are indexed */
+    e = ED_FindString(e, f, s);
+    if (e >= 0) {
+	RETURN_EDICT(EDICT_NUM(e));
+	return;
+    }
+    e = G_EDICTNUM(OFS_PARM0);
+
     for (e++; e < sv.num_edicts; e++) {
 	ed = EDICT_NUM(e);
 	if (ed->free)
@@ -1126,6 +1184,31 @@ PF_precache_file(void)
     G_INT(OFS_RETURN) = G_INT(OFS_PARM0);
 }
 
+void
+PR_AddPrecache(precachehash_t *hash, const char **list, int index,
+	       const char *name)
+{
+    unsigned bucket = NameHash_String(name) & (PRECACHE_HASHSIZE - 1);
+
+    list[index] = name;
+    hash->next[index] = hash->heads[bucket];
+    hash->heads[bucket] = index + 1;
+}
+
+int
+PR_FindPrecache(const precachehash_t *hash, const char **list,
+		const char *name)
+{
+    int i;
+
+    i = hash->heads[NameHash_String(name) & (PRECACHE_HASHSIZE - 1)];
+    for (; i; i = hash->next[i - 1])
+	if (!strcmp(list[i - 1], name))
+	    return i - 1;
+
+    return -1;
+}
+
 static void
 PF_precache_sound(void)
 {
@@ -1140,6 +1223,8 @@ PF_precache_sound(void)
     G_INT(OFS_RETURN) = G_INT(OFS_PARM0);
     PR_CheckEmptyString(s);
 
+    if (PR_FindPrecache(&sv.sound_hash, sv.sound_precache, s) >= 0)
+	return;
 #ifdef NQ_HACK
     for (i = 0; i < max_sounds(sv.protocol); i++) {
 #endif
@@ -1147,11 +1232,9 @@ PF_precache_sound(void)
     for (i = 0; i < MAX_SOUNDS; i++) {
 #endif
 	if (!sv.sound_precache[i]) {
-	    sv.sound_precache[i] = s;
+	    PR_AddPrecache(&sv.sound_hash, sv.sound_precache, i, s);
 	    return;
 	}
-	if (!strcmp(sv.sound_precache[i], s))
-	    return;
     }
 #ifdef NQ_HACK
     PR_RunError("%s: overflow (max = %d)", __func__, max_sounds(sv.protocol));
@@ -1175,6 +1258,8 @@ PF_precache_model(void)
     G_INT(OFS_RETURN) = G_INT(OFS_PARM0);
     PR_CheckEmptyString(s);
 
+    if (PR_FindPrecache(&sv.model_hash, sv.model_precache, s) >= 0)
+	return;
 #ifdef NQ_HACK
     for (i = 0; i < max_models(sv.protocol); i++) {
 #endif
@@ -1182,14 +1267,12 @@ PF_precache_model(void)
     for (i = 0; i < MAX_MODELS; i++) {
 #endif
 	if (!sv.model_precache[i]) {
-	    sv.model_precache[i] = s;
+	    PR_AddPrecache(&sv.model_hash, sv.model_precache, i, s);
 #ifdef NQ_HACK
 	    sv.models[i] = Mod_ForName(s, true);
 #endif
 	    return;
 	}
-	if (!strcmp(sv.model_precache[i], s))
-	    return;
     }
 #ifdef NQ_HACK
     PR_RunError("%s: overflow (max = %d)", __func__, max_models(sv.protocol));
@@ -1313,6 +1396,9 @@ PF_lightstyle(void)
     const char *val;
     client_t *client;
     int i;
+#ifdef QW_HACK
+    sizebuf_t *demo;
+#endif
 
     style = G_FLOAT(OFS_PARM0);
     val = G_STRING(OFS_PARM1);
@@ -1340,6 +1426,12 @@ PF_lightstyle(void)
 	    ClientReliableWrite_Char(client, style);
 	    ClientReliableWrite_String(client, val);
 	}
+    demo = SV_DemoReliable(strlen(val) + 3);
+    if (demo) {
+	MSG_WriteByte(demo, svc_lightstyle);
+	MSG_WriteChar(demo, style);
+	MSG_WriteString(demo, val);
+    }
 #endif
 }
 
@@ -1441,18 +1533,62 @@ cvar_t sv_aim = { "sv_aim", "0.93" };
 cvar_t sv_aim = { "sv_aim", "2" };
 #endif
 
+/*
+ * The box around the part of the aiming cone (the directions within
+ * acos(mindot) of forward) that's in the world. That's everywhere a
+ * target's center could be.
+ */
+static void
+PF_AimBounds(const vec3_t start, const vec3_t forward, float mindot,
+	     vec3_t mins, vec3_t maxs)
+{
+    const model_t *world = sv.worldmodel;
+    float length, side, reach;
+    int i;
+
+    length = 0;
+    for (i = 0; i < 3; i++) {
+	reach = qmax(fabsf(start[i] - world->mins[i]),
+		     fabsf(world->maxs[i] - start[i]));
+	length += reach * reach;
+    }
+    length = sqrtf(length) + 1;
+
+    /*
+     * Along each axis, the cone's farthest reach is in the axis direction
+     * if that's inside it, or else from the cone's edge nearest to it
+     */
+    mindot = qclamp(mindot, -1.0f, 1.0f);
+    side = sqrtf(1 - mindot * mindot);
+    for (i = 0; i < 3; i++) {
+	reach = sqrtf(qmax(1 - forward[i] * forward[i], 0.0f));
+	if (forward[i] >= mindot)
+	    maxs[i] = start[i] + length;
+	else
+	    maxs[i] = start[i] + length
+		* qmax(forward[i] * mindot + reach * side, 0.0f) + 1;
+	if (-forward[i] >= mindot)
+	    mins[i] = start[i] - length;
+	else
+	    mins[i] = start[i] - length
+		* qmax(-forward[i] * mindot + reach * side, 0.0f) - 1;
+    }
+}
+
 static void
 PF_aim(void)
 {
+    static int nums[MAX_EDICTS * 2 + 1];
     edict_t *ent, *check, *bestent;
-    vec3_t start, dir, end, bestdir;
-    int i, j;
+    vec3_t start, dir, end, bestdir, mins, maxs;
+    int i, j, count;
     trace_t tr;
     float dist, bestdist;
+    const float *forward;
     /* NOTE: missilespeed parameter is ignored */
     //float speed;
 #ifdef QW_HACK
-    char *noaim;
+    const char *noaim;
 #endif
 
     ent = G_EDICT(OFS_PARM0);
@@ -1465,7 +1601,7 @@ PF_aim(void)
 // noaim option
     i = NUM_FOR_EDICT(ent);
     if (i > 0 && i < MAX_CLIENTS) {
-	noaim = Info_ValueForKey(svs.clients[i - 1].userinfo, "noaim");
+	noaim = Info_Get(&svs.clients[i - 1].userkeys, "noaim");
 	if (atoi(noaim) > 0) {
 	    VectorCopy(pr_global_struct->v_forward, G_VECTOR(OFS_RETURN));
 	    return;
@@ -1488,8 +1624,23 @@ PF_aim(void)
     bestdist = sv_aim.value;
     bestent = NULL;
 
-    check = NEXT_EDICT(sv.edicts);
-    for (i = 1; i < sv.num_edicts; i++, check = NEXT_EDICT(check)) {
+    /*
+     * Only an entity with its center inside the cone can be picked, so
+     * only those linked where the cone reaches need looking at, in edict
+     * order as the old scan of them all went
+     */
+    forward = pr_global_struct->v_forward;
+    if (isnan(start[0]) || isnan(start[1]) || isnan(start[2])
+	|| isnan(forward[0]) || isnan(forward[1]) || isnan(forward[2])) {
+	for (count = 0; count < sv.num_edicts - 1; count++)
+	    nums[count] = count + 1;
+    } else {
+	PF_AimBounds(start, forward, bestdist, mins, maxs);
+	count = SV_BoxEdicts(mins, maxs, nums);
+    }
+
+    for (i = 0; i < count; i++) {
+	check = EDICT_NUM(nums[i]);
 	if (check->v.takedamage != DAMAGE_AIM)
 	    continue;
 	if (check == ent)
@@ -1562,6 +1713,28 @@ PF_changeyaw(void)
     ent->v.angles[1] = anglemod(current + move);
 }
 
+/*
+==============
+PR_PrefetchMap
+
+Starts reading in the map the server is about to change to, so the file
+I/O is done by the time the switch asks for it
+==============
+*/
+static void
+PR_PrefetchMap(const char *mapname)
+{
+    char path[MAX_QPATH];
+    const char *name = path;
+
+    if (!mapname[0])
+	return;
+    if (snprintf(path, sizeof(path), "maps/%s.bsp", mapname) >= sizeof(path))
+	return;
+    if (!COM_Prefetching(path))
+	COM_PrefetchFiles(&name, 1);
+}
+
 /*
 ===============================================================================
 
@@ -1655,6 +1828,11 @@ PF_WriteByte(void)
     }
 #endif
     MSG_WriteByte(WriteDest(), G_FLOAT(OFS_PARM1));
+
+    /* the intermission is the wait for the progs' nextmap */
+    if (G_FLOAT(OFS_PARM0) == MSG_ALL && G_FLOAT(OFS_PARM1) == svc_intermission
+	&& pr_nextmap >= 0)
+	PR_PrefetchMap(G_STRING(pr_nextmap));
 }
 
 static void
@@ -1851,6 +2029,8 @@ PF_changelevel
 static void
 PF_changelevel(void)
 {
+    PR_PrefetchMap(G_STRING(OFS_PARM0));
+
 #ifdef NQ_HACK
     /* make sure we don't issue two changelevels */
     if (svs.changelevel_issued)
@@ -1899,10 +2079,8 @@ PF_logfrag(void)
 	   svs.clients[e2 - 1].name);
 
     SZ_Print(&svs.log[svs.logsequence & 1], s);
-    if (sv_fraglogfile) {
-	fprintf(sv_fraglogfile, "%s", s);
-	fflush(sv_fraglogfile);
-    }
+    if (sv_fraglogfile)
+	SV_LogWrite(sv_fraglogfile, s);
 }
 
 
@@ -1939,7 +2117,7 @@ PF_infokey(void)
 	    snprintf(buf, sizeof(buf), "%d", ping);
 	    value = buf;
 	} else
-	    value = Info_ValueForKey(svs.clients[e1 - 1].userinfo, key);
+	    value = Info_Get(&svs.clients[e1 - 1].userkeys, key);
     } else
 	value = "";
 
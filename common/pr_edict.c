@@ -19,9 +19,18 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // sv_edict.c -- entity dictionary
 
+#include <ctype.h>
+#include <stdint.h>
+
+#if defined(NQ_HACK) && defined(HAVE_MMAP)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include "cmd.h"
 #include "console.h"
 #include "crc.h"
+#include "namehash.h"
 #include "pr_comp.h"
 #include "progdefs.h"
 #include "progs.h"
@@ -32,6 +41,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifdef NQ_HACK
 #include "host.h"
 #include "quakedef.h"
+#include "savestate.h"
 #include "sys.h"
 
 /* FIXME - quick hack to enable merging of NQ/QWSV shared code */
@@ -53,6 +63,22 @@ int pr_edict_size;		// in bytes
 static ddef_t *pr_fielddefs;
 static ddef_t *pr_globaldefs;
 
+/*
+ * Chained hash indexes over the names of the fields, globals and functions,
+ * built when the progs are loaded. Globals include the locals of every
+ * function, so names repeat; the chains run in progs order so that the
+ * first definition is found, as with the linear search.
+ */
+typedef struct {
+    int mask;
+    int *heads;			/* first index in each chain, or -1 */
+    int *next;			/* next index in the same chain, or -1 */
+} prnamehash_t;
+
+static prnamehash_t pr_fieldhash;
+static prnamehash_t pr_globalhash;
+static prnamehash_t pr_functionhash;
+
 /*
  * These are the sizes of the types enumerated in etype_t (pr_comp.h)
  */
@@ -68,16 +94,24 @@ static int type_size[8] = {
 };
 
 static qboolean ED_ParseEpair(void *base, ddef_t *key, const char *s);
-
-#define	MAX_FIELD_LEN	64
-#define GEFV_CACHESIZE	2
-
-typedef struct {
-    ddef_t *pcache;
-    char field[MAX_FIELD_LEN];
-} gefv_cache;
-
-static gefv_cache gefvCache[GEFV_CACHESIZE] = { {NULL, ""}, {NULL, ""} };
+static void ED_Unfiled(int num);
+
+int pr_extfields[NUM_EXTFIELDS];
+int pr_nextmap;
+
+/* In extfield_t order */
+static const char *pr_extfieldnames[NUM_EXTFIELDS] = {
+    "gravity",
+    "maxspeed",
+    "items2",
+    "ammo_shells1",
+    "ammo_nails1",
+    "ammo_lava_nails",
+    "ammo_rockets1",
+    "ammo_multi_rockets",
+    "ammo_cells1",
+    "ammo_plasma",
+};
 
 #ifdef NQ_HACK
 unsigned short pr_crc;
@@ -111,6 +145,541 @@ ED_ClearEdict(edict_t *e)
 {
     memset(&e->v, 0, progs->entityfields * 4);
     e->free = false;
+    ED_Wake(NUM_FOR_EDICT(e));
+    ED_Unplaced(NUM_FOR_EDICT(e));
+    ED_Unfiled(NUM_FOR_EDICT(e));
+}
+
+/*
+ * SV_Physics puts the edicts it found with nothing to do but wait for their
+ * nextthink to sleep, so that it can pass over them without touching them.
+ * Those with a nextthink are kept in a heap by it, so the ones due to think
+ * can be woken without looking at the others. Whatever may change their
+ * movetype or nextthink has to wake them first.
+ */
+byte ed_idle[MAX_EDICTS];
+static float ed_nextthink[MAX_EDICTS];
+static int ed_thinkheap[MAX_EDICTS];
+static int ed_thinkpos[MAX_EDICTS];	/* in ed_thinkheap, -1 if not there */
+static int ed_numthinks;
+
+static void
+ED_PlaceThink(int num, int pos)
+{
+    ed_thinkheap[pos] = num;
+    ed_thinkpos[num] = pos;
+}
+
+/* Moves the think at pos up or down the heap to where it belongs */
+static void
+ED_SiftThink(int pos)
+{
+    int num = ed_thinkheap[pos];
+    float nextthink = ed_nextthink[num];
+    int parent, child;
+
+    while (pos > 0) {
+	parent = (pos - 1) / 2;
+	if (ed_nextthink[ed_thinkheap[parent]] <= nextthink)
+	    break;
+	ED_PlaceThink(ed_thinkheap[parent], pos);
+	pos = parent;
+    }
+    for (;;) {
+	child = pos * 2 + 1;
+	if (child >= ed_numthinks)
+	    break;
+	if (child + 1 < ed_numthinks &&
+	    ed_nextthink[ed_thinkheap[child + 1]] <
+	    ed_nextthink[ed_thinkheap[child]])
+	    child++;
+	if (nextthink <= ed_nextthink[ed_thinkheap[child]])
+	    break;
+	ED_PlaceThink(ed_thinkheap[child], pos);
+	pos = child;
+    }
+    ED_PlaceThink(num, pos);
+}
+
+void
+ED_Wake(int num)
+{
+    int pos;
+
+    if ((unsigned)num >= MAX_EDICTS || !ed_idle[num])
+	return;
+
+    ed_idle[num] = false;
+    pos = ed_thinkpos[num];
+    if (pos >= 0) {
+	ed_thinkpos[num] = -1;
+	if (pos < --ed_numthinks) {
+	    ED_PlaceThink(ed_thinkheap[ed_numthinks], pos);
+	    ED_SiftThink(pos);
+	}
+    }
+}
+
+/*
+=================
+ED_Sleep
+
+Lets SV_Physics pass over the edict until it is woken, by ED_WakeThinkers
+if nextthink is set
+=================
+*/
+void
+ED_Sleep(int num, float nextthink)
+{
+    ED_Wake(num);
+    ed_idle[num] = true;
+    ed_thinkpos[num] = -1;
+    if (nextthink > 0) {
+	ed_nextthink[num] = nextthink;
+	ED_PlaceThink(num, ed_numthinks++);
+	ED_SiftThink(ed_numthinks - 1);
+    }
+}
+
+/* Wakes the sleeping edicts whose nextthink is no later than time */
+void
+ED_WakeThinkers(double time)
+{
+    while (ed_numthinks && ed_nextthink[ed_thinkheap[0]] <= time)
+	ED_Wake(ed_thinkheap[0]);
+}
+
+/*
+ * The edicts which may not be on the area node their origin and size put
+ * them on: those unlinked or stored to from QuakeC since SV_LinkEdict last
+ * placed them. PF_findradius checks these one by one and finds the others
+ * through the area nodes. The C code only moves an edict without linking
+ * it again straight away while SV_Physics runs it, so that one is added too.
+ */
+int ed_moving = -1;
+static int ed_unplaced[MAX_EDICTS];
+static int ed_unplacedpos[MAX_EDICTS];	/* 1 + index in ed_unplaced, or 0 */
+static int ed_numunplaced;
+
+void
+ED_Unplaced(int num)
+{
+    if ((unsigned)num >= MAX_EDICTS || ed_unplacedpos[num])
+	return;
+
+    ed_unplaced[ed_numunplaced++] = num;
+    ed_unplacedpos[num] = ed_numunplaced;
+}
+
+void
+ED_Placed(int num)
+{
+    int pos = ed_unplacedpos[num] - 1;
+
+    if (pos < 0)
+	return;
+
+    ed_unplacedpos[num] = 0;
+    if (pos < --ed_numunplaced) {
+	ed_unplaced[pos] = ed_unplaced[ed_numunplaced];
+	ed_unplacedpos[ed_unplaced[pos]] = pos + 1;
+    }
+}
+
+/*
+=================
+ED_UnplacedEdicts
+
+Copies the numbers of the unplaced edicts still in use to nums, which has
+room for MAX_EDICTS + 1, and returns how many there are
+=================
+*/
+int
+ED_UnplacedEdicts(int *nums)
+{
+    int i, num, count = 0;
+
+    for (i = ed_numunplaced - 1; i >= 0; i--) {
+	num = ed_unplaced[i];
+	if (num >= sv.num_edicts || EDICT_NUM(num)->free)
+	    ED_Placed(num);	/* ED_ClearEdict adds it again */
+	else
+	    nums[count++] = num;
+    }
+    if (ed_moving >= 0)
+	nums[count++] = ed_moving;
+
+    return count;
+}
+
+/*
+ * Indexes of the edicts by the strings in the fields PF_Find mostly looks
+ * at. Each hash chain runs in edict order. Stored to fields and cleared
+ * edicts are filed again on the next lookup; edicts whose string may
+ * change without a store are kept aside and compared at each lookup.
+ */
+#define ED_FINDHASHSIZE 1024	/* a power of two */
+
+typedef enum {
+    ED_FILED_NONE,		/* free or an empty string */
+    ED_FILED_CHAIN,
+    ED_FILED_VOLATILE
+} edfiled_t;
+
+typedef struct {
+    int field;
+    int heads[ED_FINDHASHSIZE];	/* first and last edict in each chain, */
+    int tails[ED_FINDHASHSIZE];	/* or 0, as the world is never found */
+    int next[MAX_EDICTS];
+    int prev[MAX_EDICTS];
+    unsigned hash[MAX_EDICTS];
+    byte filed[MAX_EDICTS];
+    int volatiles[MAX_EDICTS];
+    int volatilepos[MAX_EDICTS];	/* 1 + index in volatiles, or 0 */
+    int numvolatiles;
+} edfindindex_t;
+
+static edfindindex_t ed_findindex[] = {
+    { ED_FIELDOFS(classname) },
+    { ED_FIELDOFS(targetname) },
+};
+#define ED_NUMFINDINDEXES (sizeof(ed_findindex) / sizeof(ed_findindex[0]))
+
+static int ed_unfiled[MAX_EDICTS];
+static byte ed_unfiledmark[MAX_EDICTS];
+static int ed_numunfiled;
+
+static void
+ED_Unfiled(int num)
+{
+    if ((unsigned)num >= MAX_EDICTS || ed_unfiledmark[num])
+	return;
+
+    ed_unfiledmark[num] = true;
+    ed_unfiled[ed_numunfiled++] = num;
+}
+
+static void
+ED_RemoveFiled(edfindindex_t *index, int num)
+{
+    int chain, pos;
+
+    switch (index->filed[num]) {
+    case ED_FILED_CHAIN:
+	chain = index->hash[num] & (ED_FINDHASHSIZE - 1);
+	if (index->prev[num])
+	    index->next[index->prev[num]] = index->next[num];
+	else
+	    index->heads[chain] = index->next[num];
+	if (index->next[num])
+	    index->prev[index->next[num]] = index->prev[num];
+	else
+	    index->tails[chain] = index->prev[num];
+	break;
+    case ED_FILED_VOLATILE:
+	pos = index->volatilepos[num] - 1;
+	index->volatilepos[num] = 0;
+	if (pos < --index->numvolatiles) {
+	    index->volatiles[pos] = index->volatiles[index->numvolatiles];
+	    index->volatilepos[index->volatiles[pos]] = pos + 1;
+	}
+	break;
+    }
+    index->filed[num] = ED_FILED_NONE;
+}
+
+static void
+ED_FileEdict(edfindindex_t *index, int num)
+{
+    edict_t *ed;
+    const char *s;
+    int string, chain, prev;
+
+    ED_RemoveFiled(index, num);
+    if (num < 1 || num >= sv.num_edicts)
+	return;
+    ed = EDICT_NUM(num);
+    if (ed->free)
+	return;
+
+    string = E_INT(ed, index->field);
+    if (!PR_IsStableString(string)) {
+	index->volatiles[index->numvolatiles++] = num;
+	index->volatilepos[num] = index->numvolatiles;
+	index->filed[num] = ED_FILED_VOLATILE;
+	return;
+    }
+    s = PR_GetString(string);
+    if (!*s)
+	return;
+
+    /* usually filed in order, so look from the end of the chain */
+    index->hash[num] = NameHash_String(s);
+    chain = index->hash[num] & (ED_FINDHASHSIZE - 1);
+    for (prev = index->tails[chain]; prev > num; prev = index->prev[prev])
+	;
+    index->prev[num] = prev;
+    if (prev) {
+	index->next[num] = index->next[prev];
+	index->next[prev] = num;
+    } else {
+	index->next[num] = index->heads[chain];
+	index->heads[chain] = num;
+    }
+    if (index->next[num])
+	index->prev[index->next[num]] = num;
+    else
+	index->tails[chain] = num;
+    index->filed[num] = ED_FILED_CHAIN;
+}
+
+static int
+ED_CompareNums(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+int
+ED_FindString(int start, int field, const char *s)
+{
+    static int nums[MAX_EDICTS];
+    edfindindex_t *index;
+    edict_t *ed;
+    unsigned hash;
+    int i, num, best, count;
+
+    /* an empty string matches the unfiled edicts too */
+    if (!*s)
+	return -1;
+    for (index = ed_findindex; index->field != field; index++)
+	if (index == &ed_findindex[ED_NUMFINDINDEXES - 1])
+	    return -1;
+
+    while (ed_numunfiled) {
+	num = ed_unfiled[--ed_numunfiled];
+	ed_unfiledmark[num] = false;
+	for (i = 0; i < ED_NUMFINDINDEXES; i++)
+	    ED_FileEdict(&ed_findindex[i], num);
+    }
+
+    best = sv.num_edicts;
+    hash = NameHash_String(s);
+    num = index->heads[hash & (ED_FINDHASHSIZE - 1)];
+    for (; num && num < best; num = index->next[num]) {
+	if (num <= start || index->hash[num] != hash)
+	    continue;
+	ed = EDICT_NUM(num);
+	if (!ed->free && !strcmp(E_STRING(ed, field), s))
+	    best = num;
+    }
+
+    /* look at the volatile ones before it in order, as the scan did */
+    count = 0;
+    for (i = 0; i < index->numvolatiles; i++) {
+	num = index->volatiles[i];
+	if (num > start && num < best)
+	    nums[count++] = num;
+    }
+    qsort(nums, count, sizeof(nums[0]), ED_CompareNums);
+    for (i = 0; i < count; i++) {
+	ed = EDICT_NUM(nums[i]);
+	if (!ed->free && !strcmp(E_STRING(ed, field), s)) {
+	    best = nums[i];
+	    break;
+	}
+    }
+
+    return best < sv.num_edicts ? best : 0;
+}
+
+/*
+ * Fields stores through an offset may change, see ED_FIELD_STORED
+ */
+byte ed_fieldwatch[ED_NUMWATCHED];
+
+static void
+ED_WatchField(int ofs, int size, int watch)
+{
+    int i;
+
+    for (i = ofs - 2; i < ofs + size; i++)
+	if (i >= 0)
+	    ed_fieldwatch[i] |= watch;
+}
+
+static void
+ED_WatchFields(void)
+{
+    ED_WatchField(ED_FIELDOFS(movetype), 1, ED_WATCH_THINK);
+    ED_WatchField(ED_FIELDOFS(nextthink), 1, ED_WATCH_THINK);
+    ED_WatchField(ED_FIELDOFS(origin), 3, ED_WATCH_PLACE);
+    ED_WatchField(ED_FIELDOFS(mins), 3, ED_WATCH_PLACE);
+    ED_WatchField(ED_FIELDOFS(maxs), 3, ED_WATCH_PLACE);
+    ED_WatchField(ED_FIELDOFS(solid), 1, ED_WATCH_PLACE);
+    ED_WatchField(ED_FIELDOFS(classname), 1, ED_WATCH_FIND);
+    ED_WatchField(ED_FIELDOFS(targetname), 1, ED_WATCH_FIND);
+}
+
+/*
+=================
+ED_FieldStored
+
+QuakeC is storing to field ofs of edict e (an offset from sv.edicts)
+=================
+*/
+void
+ED_FieldStored(int e, int ofs)
+{
+    int num = e / pr_edict_size;
+
+    if (ed_fieldwatch[ofs] & ED_WATCH_THINK)
+	ED_Wake(num);
+    if (ed_fieldwatch[ofs] & ED_WATCH_PLACE)
+	ED_Unplaced(num);
+    if (ed_fieldwatch[ofs] & ED_WATCH_FIND)
+	ED_Unfiled(num);
+}
+
+/*
+ * The free edicts past the clients' are queued in the order they were
+ * freed, those freed at the same time by number. Ordered like this the
+ * queue only depends on the edicts, so it can be rebuilt from them after
+ * they are loaded. Anything which marks an edict free or in use other
+ * than ED_Alloc and ED_Free has to call ED_ResetEdicts.
+ */
+static int ed_freehead = -1;
+static int ed_freetail = -1;
+static int ed_freeprev[MAX_EDICTS];
+static int ed_freenext[MAX_EDICTS];
+static qboolean ed_freelisted[MAX_EDICTS];
+
+static int
+ED_FirstFree(void)
+{
+#ifdef NQ_HACK
+    return svs.maxclients + 1;
+#endif
+#if defined(QW_HACK) && defined(SERVERONLY)
+    return MAX_CLIENTS + 1;
+#endif
+}
+
+static void
+ED_UnlinkFree(int num)
+{
+    if (ed_freeprev[num] >= 0)
+	ed_freenext[ed_freeprev[num]] = ed_freenext[num];
+    else
+	ed_freehead = ed_freenext[num];
+    if (ed_freenext[num] >= 0)
+	ed_freeprev[ed_freenext[num]] = ed_freeprev[num];
+    else
+	ed_freetail = ed_freeprev[num];
+    ed_freelisted[num] = false;
+}
+
+/* Queues a free edict, usually at the tail */
+static void
+ED_LinkFree(int num)
+{
+    float freetime = EDICT_NUM(num)->freetime;
+    int prev;
+
+    if (num < ED_FirstFree())
+	return;
+    if (ed_freelisted[num])
+	ED_UnlinkFree(num);
+
+    for (prev = ed_freetail; prev >= 0; prev = ed_freeprev[prev]) {
+	if (EDICT_NUM(prev)->freetime < freetime)
+	    break;
+	if (EDICT_NUM(prev)->freetime == freetime && prev < num)
+	    break;
+    }
+
+    ed_freeprev[num] = prev;
+    if (prev >= 0) {
+	ed_freenext[num] = ed_freenext[prev];
+	ed_freenext[prev] = num;
+    } else {
+	ed_freenext[num] = ed_freehead;
+	ed_freehead = num;
+    }
+    if (ed_freenext[num] >= 0)
+	ed_freeprev[ed_freenext[num]] = num;
+    else
+	ed_freetail = num;
+    ed_freelisted[num] = true;
+}
+
+static int
+ED_CompareFree(const void *a, const void *b)
+{
+    int num1 = *(const int *)a;
+    int num2 = *(const int *)b;
+    float freetime1 = EDICT_NUM(num1)->freetime;
+    float freetime2 = EDICT_NUM(num2)->freetime;
+
+    if (freetime1 != freetime2)
+	return freetime1 < freetime2 ? -1 : 1;
+    return num1 - num2;
+}
+
+/*
+=================
+ED_ResetEdicts
+
+Queues the free edicts again, wakes them all and indexes them afresh after
+they were set up or loaded directly
+=================
+*/
+void
+ED_ResetEdicts(void)
+{
+    static int nums[MAX_EDICTS];
+    edfindindex_t *index;
+    int i, count = 0;
+
+    memset(ed_idle, 0, sizeof(ed_idle));
+    ed_numthinks = 0;
+
+    /* the edicts in use were just linked, if they are to be */
+    ed_moving = -1;
+    memset(ed_unplacedpos, 0, sizeof(ed_unplacedpos));
+    ed_numunplaced = 0;
+    for (i = 1; i < sv.num_edicts; i++)
+	if (!EDICT_NUM(i)->free && !EDICT_NUM(i)->area.prev)
+	    ED_Unplaced(i);
+
+    for (i = 0; i < ED_NUMFINDINDEXES; i++) {
+	index = &ed_findindex[i];
+	memset(index->heads, 0, sizeof(index->heads));
+	memset(index->tails, 0, sizeof(index->tails));
+	memset(index->filed, 0, sizeof(index->filed));
+	memset(index->volatilepos, 0, sizeof(index->volatilepos));
+	index->numvolatiles = 0;
+    }
+    memset(ed_unfiledmark, 0, sizeof(ed_unfiledmark));
+    ed_numunfiled = 0;
+    for (i = 1; i < sv.num_edicts; i++)
+	ED_Unfiled(i);
+
+    ed_freehead = ed_freetail = -1;
+    memset(ed_freelisted, 0, sizeof(ed_freelisted));
+    for (i = ED_FirstFree(); i < sv.num_edicts; i++)
+	if (EDICT_NUM(i)->free)
+	    nums[count++] = i;
+
+    qsort(nums, count, sizeof(nums[0]), ED_CompareFree);
+    for (i = 0; i < count; i++) {
+	ed_freeprev[nums[i]] = i ? nums[i - 1] : -1;
+	ed_freenext[nums[i]] = i < count - 1 ? nums[i + 1] : -1;
+	ed_freelisted[nums[i]] = true;
+    }
+    if (count) {
+	ed_freehead = nums[0];
+	ed_freetail = nums[count - 1];
+    }
 }
 
 /*
@@ -130,20 +699,24 @@ ED_Alloc(void)
     int i;
     edict_t *e;
 
-#ifdef NQ_HACK
-    for (i = svs.maxclients + 1; i < sv.num_edicts; i++) {
-#endif
-#if defined(QW_HACK) && defined(SERVERONLY)
-    for (i = MAX_CLIENTS + 1; i < sv.num_edicts; i++) {
-#endif
+    /* if the oldest free edict is too recent, so are all the others */
+    while (ed_freehead >= 0) {
+	i = ed_freehead;
 	e = EDICT_NUM(i);
+	if (!e->free || i >= sv.num_edicts) {
+	    ED_UnlinkFree(i);
+	    continue;
+	}
 	// the first couple seconds of server time can involve a lot of
 	// freeing and allocating, so relax the replacement policy
-	if (e->free && (e->freetime < 2 || sv.time - e->freetime > 0.5)) {
+	if (e->freetime < 2 || sv.time - e->freetime > 0.5) {
+	    ED_UnlinkFree(i);
 	    ED_ClearEdict(e);
 	    return e;
 	}
+	break;
     }
+    i = sv.num_edicts;
 
 #ifdef NQ_HACK
     if (i == MAX_EDICTS)
@@ -192,6 +765,8 @@ ED_Free(edict_t *ed)
     ed->v.solid = 0;
 
     ed->freetime = sv.time;
+    ED_Wake(NUM_FOR_EDICT(ed));
+    ED_LinkFree(NUM_FOR_EDICT(ed));
 }
 
 //===========================================================================
@@ -234,6 +809,38 @@ ED_FieldAtOfs(int ofs)
     return NULL;
 }
 
+/*
+============
+ED_HashNames
+
+Indexes count names, each s_name being stride bytes on from the last
+============
+*/
+static void
+ED_HashNames(prnamehash_t *hash, const int32_t *names, int stride, int count)
+{
+    int i, size, bucket, s_name;
+
+    for (size = 16; size < count; size <<= 1)
+	;
+    hash->mask = size - 1;
+    hash->heads = Hunk_AllocName(size * sizeof(int), "prhash");
+    hash->next = Hunk_AllocName(qmax(count, 1) * sizeof(int), "prhash");
+    for (i = 0; i < size; i++)
+	hash->heads[i] = -1;
+
+    /* in reverse, so each chain runs in progs order */
+    for (i = count - 1; i >= 0; i--) {
+	hash->next[i] = -1;
+	s_name = *(const int32_t *)((const byte *)names + i * stride);
+	if (s_name < 0 || s_name >= pr_strings_size - 1)
+	    continue;	/* never matches, no need to fail on it here */
+	bucket = NameHash_String(pr_strings + s_name) & hash->mask;
+	hash->next[i] = hash->heads[bucket];
+	hash->heads[bucket] = i;
+    }
+}
+
 /*
 ============
 ED_FindField
@@ -245,7 +852,8 @@ ED_FindField(const char *name)
     ddef_t *def;
     int i;
 
-    for (i = 0; i < progs->numfielddefs; i++) {
+    i = pr_fieldhash.heads[NameHash_String(name) & pr_fieldhash.mask];
+    for (; i >= 0; i = pr_fieldhash.next[i]) {
 	def = &pr_fielddefs[i];
 	if (!strcmp(PR_GetString(def->s_name), name))
 	    return def;
@@ -265,7 +873,8 @@ ED_FindGlobal(const char *name)
     ddef_t *def;
     int i;
 
-    for (i = 0; i < progs->numglobaldefs; i++) {
+    i = pr_globalhash.heads[NameHash_String(name) & pr_globalhash.mask];
+    for (; i >= 0; i = pr_globalhash.next[i]) {
 	def = &pr_globaldefs[i];
 	if (!strcmp(PR_GetString(def->s_name), name))
 	    return def;
@@ -285,7 +894,8 @@ ED_FindFunction(const char *name)
     dfunction_t *func;
     int i;
 
-    for (i = 0; i < progs->numfunctions; i++) {
+    i = pr_functionhash.heads[NameHash_String(name) & pr_functionhash.mask];
+    for (; i >= 0; i = pr_functionhash.next[i]) {
 	func = &pr_functions[i];
 	if (!strcmp(PR_GetString(func->s_name), name))
 	    return func;
@@ -293,33 +903,28 @@ ED_FindFunction(const char *name)
     return NULL;
 }
 
-eval_t *
-GetEdictFieldValue(edict_t *ed, const char *field)
+/*
+============
+ED_FindExtFields
+
+Looks up which of the optional fields and globals these progs have
+============
+*/
+static void
+ED_FindExtFields(void)
 {
-    static int rep = 0;
-    ddef_t *def = NULL;
+    ddef_t *def;
     int i;
 
-    for (i = 0; i < GEFV_CACHESIZE; i++) {
-	if (!strcmp(field, gefvCache[i].field)) {
-	    def = gefvCache[i].pcache;
-	    goto Done;
-	}
-    }
-
-    def = ED_FindField(field);
-
-    if (strlen(field) < MAX_FIELD_LEN) {
-	gefvCache[rep].pcache = def;
-	strcpy(gefvCache[rep].field, field);
-	rep ^= 1;
+    for (i = 0; i < NUM_EXTFIELDS; i++) {
+	def = ED_FindField(pr_extfieldnames[i]);
+	pr_extfields[i] = def ? def->ofs : -1;
     }
 
-  Done:
-    if (!def)
-	return NULL;
-
-    return (eval_t *)((char *)&ed->v + def->ofs * 4);
+    def = ED_FindGlobal("nextmap");
+    pr_nextmap = -1;
+    if (def && (def->type & ~DEF_SAVEGLOBAL) == ev_string)
+	pr_nextmap = def->ofs;
 }
 
 /*
@@ -571,6 +1176,68 @@ void ED_Write(FILE *f, edict_t *ed)
    fprintf(f, "}\n");
 }
 
+#define FNV_PRIME 16777619u
+
+static unsigned ED_HashBytes(unsigned hash, const void *data, int size)
+{
+   const byte *bytes = (const byte *)data;
+
+   while (size--)
+      hash = (hash ^ *bytes++) * FNV_PRIME;
+   return hash;
+}
+
+/*
+=============
+ED_StateHash
+
+A hash of every edict's fields, to check that runs of the server come out
+the same. Strings are hashed by their contents rather than by where they
+happened to go in the string table.
+=============
+*/
+unsigned ED_StateHash(void)
+{
+   byte *isstring;
+   const int *v;
+   const char *str;
+   edict_t *ed;
+   unsigned hash = 2166136261u;
+   int i, j;
+
+   isstring = calloc(progs->entityfields, 1);
+   if (!isstring)
+      Sys_Error("%s: out of memory", __func__);
+   for (i = 1; i < progs->numfielddefs; i++)
+      if ((pr_fielddefs[i].type & ~DEF_SAVEGLOBAL) == ev_string
+            && pr_fielddefs[i].ofs < progs->entityfields)
+         isstring[pr_fielddefs[i].ofs] = 1;
+
+   hash = ED_HashBytes(hash, &sv.num_edicts, sizeof(sv.num_edicts));
+   for (i = 0; i < sv.num_edicts; i++)
+   {
+      ed = EDICT_NUM(i);
+      hash = ED_HashBytes(hash, &ed->free, sizeof(ed->free));
+      if (ed->free)
+         continue;
+
+      v = (const int *)&ed->v;
+      for (j = 0; j < progs->entityfields; j++)
+      {
+         if (isstring[j])
+         {
+            str = PR_GetString(v[j]);
+            hash = ED_HashBytes(hash, str, strlen(str) + 1);
+         }
+         else
+            hash = ED_HashBytes(hash, &v[j], sizeof(v[j]));
+      }
+   }
+   free(isstring);
+
+   return hash;
+}
+
 void ED_PrintNum(int ent)
 {
    ED_Print(EDICT_NUM(ent));
@@ -685,6 +1352,163 @@ ED_WriteGlobals(FILE *f)
     fprintf(f, "}\n");
 }
 
+#ifdef NQ_HACK
+/*
+ * Binary savegames copy the globals and edicts as they are, but the strings
+ * QuakeC made at runtime don't outlast the map. Each global or edict field
+ * holding one is written out with the string, by slot: a global's offset,
+ * or past the globals an edict's field.
+ */
+static void
+ED_WriteString(sizebuf_t *buf, int slot, int num)
+{
+    const char *s;
+    int length;
+
+    if (num >= 0)
+	return;			// in the progs, fine as it is
+    s = PR_GetString(num);
+    length = strlen(s) + 1;
+    SaveState_Write(buf, &slot, sizeof(slot));
+    SaveState_Write(buf, &length, sizeof(length));
+    SaveState_Write(buf, s, length);
+}
+
+/*
+=============
+ED_WriteStrings
+=============
+*/
+void
+ED_WriteStrings(sizebuf_t *buf)
+{
+    const ddef_t *def;
+    const edict_t *ed;
+    int i, e, slot;
+
+    for (i = 0; i < progs->numglobaldefs; i++) {
+	def = &pr_globaldefs[i];
+	if ((def->type & ~DEF_SAVEGLOBAL) == ev_string)
+	    ED_WriteString(buf, def->ofs, ((int *)pr_globals)[def->ofs]);
+    }
+    for (e = 0; e < sv.num_edicts; e++) {
+	ed = EDICT_NUM(e);
+	if (ed->free)
+	    continue;
+	for (i = 0; i < progs->numfielddefs; i++) {
+	    def = &pr_fielddefs[i];
+	    if ((def->type & ~DEF_SAVEGLOBAL) != ev_string)
+		continue;
+	    slot = progs->numglobals + e * progs->entityfields + def->ofs;
+	    ED_WriteString(buf, slot, ((const int *)&ed->v)[def->ofs]);
+	}
+    }
+
+    slot = -1;
+    SaveState_Write(buf, &slot, sizeof(slot));
+}
+
+/*
+ * True if a string global or edict field is kept in the slot
+ */
+static qboolean
+ED_IsStringSlot(int slot)
+{
+    const ddef_t *defs;
+    int i, numdefs, ofs;
+
+    if (slot < progs->numglobals) {
+	defs = pr_globaldefs;
+	numdefs = progs->numglobaldefs;
+	ofs = slot;
+    } else {
+	defs = pr_fielddefs;
+	numdefs = progs->numfielddefs;
+	ofs = (slot - progs->numglobals) % progs->entityfields;
+    }
+    for (i = 0; i < numdefs; i++) {
+	if (defs[i].ofs == ofs && (defs[i].type & ~DEF_SAVEGLOBAL) == ev_string)
+	    return true;
+    }
+
+    return false;
+}
+
+/*
+ * The loaded string must be in the progs' string table. One QuakeC made at
+ * runtime was only good for the game that was saved, so it's cleared for
+ * the saved copy to be put back over.
+ */
+static qboolean
+ED_CheckString(int *num)
+{
+    if (*num < 0)
+	*num = 0;
+
+    return *num < pr_strings_size - 1;
+}
+
+/*
+=============
+ED_ReadStrings
+
+Checks the strings loaded with the globals and edicts, then puts back the
+ones ED_WriteStrings wrote. False if any of them are damaged.
+=============
+*/
+qboolean
+ED_ReadStrings(sizebuf_t *buf)
+{
+    const ddef_t *def;
+    char *s;
+    int i, slot, length, e, ofs;
+
+    for (i = 0; i < progs->numglobaldefs; i++) {
+	def = &pr_globaldefs[i];
+	if ((def->type & ~DEF_SAVEGLOBAL) != ev_string)
+	    continue;
+	if (!ED_CheckString(&((int *)pr_globals)[def->ofs]))
+	    return false;
+    }
+    for (e = 0; e < sv.num_edicts; e++) {
+	for (i = 0; i < progs->numfielddefs; i++) {
+	    def = &pr_fielddefs[i];
+	    if ((def->type & ~DEF_SAVEGLOBAL) != ev_string)
+		continue;
+	    if (!ED_CheckString(&((int *)&EDICT_NUM(e)->v)[def->ofs]))
+		return false;
+	}
+    }
+
+    for (;;) {
+	if (!SaveState_Read(buf, &slot, sizeof(slot)))
+	    return false;
+	if (slot < 0)
+	    return true;
+	if (!SaveState_Read(buf, &length, sizeof(length)))
+	    return false;
+	if (length < 1 || length > buf->maxsize - buf->cursize)
+	    return false;
+	if (buf->data[buf->cursize + length - 1])
+	    return false;	// not terminated
+	if (slot >= progs->numglobals + sv.num_edicts * progs->entityfields)
+	    return false;
+	if (!ED_IsStringSlot(slot))
+	    return false;
+
+	s = Hunk_AllocName(length, "string");
+	SaveState_Read(buf, s, length);
+	if (slot < progs->numglobals) {
+	    ((int *)pr_globals)[slot] = PR_SetString(s);
+	    continue;
+	}
+	e = (slot - progs->numglobals) / progs->entityfields;
+	ofs = (slot - progs->numglobals) % progs->entityfields;
+	((int *)&EDICT_NUM(e)->v)[ofs] = PR_SetString(s);
+    }
+}
+#endif
+
 /*
 =============
 ED_ParseGlobals
@@ -738,12 +1562,14 @@ ED_ParseGlobals(const char *data)
 ED_NewString
 =============
 */
-static char *
+static const char *
 ED_NewString(const char *string)
 {
+    const char *interned;
     char *newobj, *new_p;
-    int i, l;
+    int i, l, mark;
 
+    mark = Hunk_LowMark();
     l = strlen(string) + 1;
     newobj = (char*)Hunk_Alloc(l);
     new_p = newobj;
@@ -759,10 +1585,72 @@ ED_NewString(const char *string)
 	    *new_p++ = string[i];
     }
 
-    return newobj;
+    /* entities repeat the same classnames, models and sounds */
+    interned = PR_InternString(newobj, Hunk_LowMark() - mark);
+    if (interned != newobj)
+	Hunk_FreeToLowMark(mark);
+
+    return interned;
 }
 
 
+/*
+=============
+ED_ParseFloat
+
+atof of the first len characters of s. The plain decimals written by map
+editors are converted directly, which gives exactly what atof does as
+long as the digits fit in a double's mantissa and there aren't too many
+after the point. Anything else goes to atof.
+=============
+*/
+static float
+ED_ParseFloat(const char *s, int len)
+{
+    static const double powers[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char *p = s, *end = s + len;
+    uint64_t mantissa = 0;
+    int digits = 0, decimals = -1;
+    qboolean negative = false;
+    double value;
+    char copy[64];
+
+    if (p < end && (*p == '-' || *p == '+'))
+	negative = *p++ == '-';
+    for (; p < end; p++) {
+	if (*p >= '0' && *p <= '9') {
+	    if (mantissa >= ((uint64_t)1 << 53) / 10)
+		break;
+	    mantissa = mantissa * 10 + *p - '0';
+	    digits++;
+	    if (decimals >= 0)
+		decimals++;
+	} else if (*p == '.' && decimals < 0) {
+	    decimals = 0;
+	} else {
+	    break;
+	}
+    }
+
+    /* exponents, hex, inf and nan, whitespace, too many digits */
+    if (!digits || decimals >= (int)(sizeof(powers) / sizeof(powers[0]))
+	|| (p < end && (isalnum((byte)*p) || *p == '.'))) {
+	len = qmin(len, (int)sizeof(copy) - 1);
+	memcpy(copy, s, len);
+	copy[len] = 0;
+	return atof(copy);
+    }
+
+    value = (double)mantissa;
+    if (decimals > 0)
+	value /= powers[decimals];
+
+    return negative ? -value : value;
+}
+
 /*
 =============
 ED_ParseEval
@@ -775,9 +1663,8 @@ static qboolean
 ED_ParseEpair(void *base, ddef_t *key, const char *s)
 {
     int i;
-    char string[128];
     ddef_t *def;
-    char *v, *w;
+    const char *v;
     void *d;
     dfunction_t *func;
 
@@ -789,19 +1676,16 @@ ED_ParseEpair(void *base, ddef_t *key, const char *s)
 	break;
 
     case ev_float:
-	*(float *)d = atof(s);
+	*(float *)d = ED_ParseFloat(s, strlen(s));
 	break;
 
     case ev_vector:
-	strcpy(string, s);
-	v = string;
-	w = string;
+	/* each single space separates a component, missing ones are 0 */
 	for (i = 0; i < 3; i++) {
-	    while (*v && *v != ' ')
-		v++;
-	    *v = 0;
-	    ((float *)d)[i] = atof(w);
-	    w = v = v + 1;
+	    for (v = s; *v && *v != ' '; v++)
+		;
+	    ((float *)d)[i] = ED_ParseFloat(s, v - s);
+	    s = *v ? v + 1 : v;
 	}
 	break;
 
@@ -833,6 +1717,66 @@ ED_ParseEpair(void *base, ddef_t *key, const char *s)
     return true;
 }
 
+/*
+====================
+ED_ParseToken
+
+COM_Parse for the entity lump, into the caller's buffer. A token too long
+for it is cut short.
+====================
+*/
+static const char *
+ED_ParseToken(const char *data, char *token, int size)
+{
+    int c, len = 0;
+
+    token[0] = 0;
+    if (!data)
+	return NULL;
+
+ skipwhite:
+    while ((c = *data) <= ' ') {
+	if (!c)
+	    return NULL;
+	data++;
+    }
+    if (c == '/' && data[1] == '/') {
+	while (*data && *data != '\n')
+	    data++;
+	goto skipwhite;
+    }
+
+    if (c == '\"') {
+	for (data++; (c = *data) && c != '\"'; data++)
+	    if (len < size - 1)
+		token[len++] = c;
+	token[len] = 0;
+	return c ? data + 1 : data;
+    }
+
+#ifdef NQ_HACK
+    /* single character tokens, as for COM_Parse */
+    if (strchr("{})(':", c)) {
+	token[0] = c;
+	token[1] = 0;
+	return data + 1;
+    }
+#endif
+
+    do {
+	if (len < size - 1)
+	    token[len++] = c;
+	c = *++data;
+#ifdef NQ_HACK
+	if (c && strchr("{})(':", c))
+	    break;
+#endif
+    } while (c > ' ');
+    token[len] = 0;
+
+    return data;
+}
+
 /*
 ====================
 ED_ParseEdict
@@ -849,6 +1793,7 @@ ED_ParseEdict(const char *data, edict_t *ent)
     qboolean anglehack;
     qboolean init;
     char keyname[256];
+    char value[1024];
     int n;
 
     init = false;
@@ -860,25 +1805,23 @@ ED_ParseEdict(const char *data, edict_t *ent)
 // go through all the dictionary pairs
     while (1) {
 	// parse key
-	data = COM_Parse(data);
-	if (com_token[0] == '}')
+	data = ED_ParseToken(data, keyname, sizeof(keyname));
+	if (keyname[0] == '}')
 	    break;
 	if (!data)
 	    SV_Error("%s: EOF without closing brace", __func__);
 
 // anglehack is to allow QuakeEd to write single scalar angles
 // and allow them to be turned into vectors. (FIXME...)
-	if (!strcmp(com_token, "angle")) {
-	    strcpy(com_token, "angles");
+	if (!strcmp(keyname, "angle")) {
+	    strcpy(keyname, "angles");
 	    anglehack = true;
 	} else
 	    anglehack = false;
 
 // FIXME: change light to _light to get rid of this hack
-	if (!strcmp(com_token, "light"))
-	    strcpy(com_token, "light_lev");	// hack for single light def
-
-	strcpy(keyname, com_token);
+	if (!strcmp(keyname, "light"))
+	    strcpy(keyname, "light_lev");	// hack for single light def
 
 	// another hack to fix keynames with trailing spaces
 	n = strlen(keyname);
@@ -888,11 +1831,11 @@ ED_ParseEdict(const char *data, edict_t *ent)
 	}
 
 	// parse value
-	data = COM_Parse(data);
+	data = ED_ParseToken(data, value, sizeof(value));
 	if (!data)
 	    SV_Error("%s: EOF without closing brace", __func__);
 
-	if (com_token[0] == '}')
+	if (value[0] == '}')
 	    SV_Error("%s: closing brace without data", __func__);
 
 	init = true;
@@ -911,11 +1854,11 @@ ED_ParseEdict(const char *data, edict_t *ent)
 	if (anglehack) {
 	    char temp[32];
 
-	    strcpy(temp, com_token);
-	    sprintf(com_token, "0 %s 0", temp);
+	    snprintf(temp, sizeof(temp), "%s", value);
+	    snprintf(value, sizeof(value), "0 %s 0", temp);
 	}
 
-	if (!ED_ParseEpair((void *)&ent->v, key, com_token))
+	if (!ED_ParseEpair((void *)&ent->v, key, value))
 #ifdef NQ_HACK
 	    Host_Error("%s: parse error", __func__);
 #endif
@@ -924,8 +1867,12 @@ ED_ParseEdict(const char *data, edict_t *ent)
 #endif
     }
 
-    if (!init)
+    if (!init) {
 	ent->free = true;
+	ED_LinkFree(NUM_FOR_EDICT(ent));
+    }
+    ED_Unplaced(NUM_FOR_EDICT(ent));
+    ED_Unfiled(NUM_FOR_EDICT(ent));
 
     return data;
 }
@@ -952,6 +1899,7 @@ ED_LoadFromFile(const char *data)
     edict_t *ent;
     int inhibit;
     dfunction_t *func;
+    char token[64];
 
     ent = NULL;
     inhibit = 0;
@@ -960,11 +1908,11 @@ ED_LoadFromFile(const char *data)
 // parse ents
     while (1) {
 // parse the opening brace
-	data = COM_Parse(data);
+	data = ED_ParseToken(data, token, sizeof(token));
 	if (!data)
 	    break;
-	if (com_token[0] != '{')
-	    SV_Error("%s: found %s when expecting {", __func__, com_token);
+	if (token[0] != '{')
+	    SV_Error("%s: found %s when expecting {", __func__, token);
 
 	if (!ent)
 	    ent = EDICT_NUM(0);
@@ -1039,10 +1987,6 @@ PR_LoadProgs(void)
    dfunction_t *f;
 #endif
 
-   // flush the non-C variable lookup cache
-   for (i = 0; i < GEFV_CACHESIZE; i++)
-      gefvCache[i].field[0] = 0;
-
 #ifdef NQ_HACK
    progs = (dprograms_t*)COM_LoadHunkFile("progs.dat");
 #endif
@@ -1064,11 +2008,8 @@ PR_LoadProgs(void)
    Info_SetValueForStarKey(svs.info, "*progs", num, MAX_SERVERINFO_STRING);
 #endif
 
-#ifdef MSB_FIRST
    // byte swap the header
-   for (i = 0; i < sizeof(*progs) / 4; i++)
-      ((int *)progs)[i] = LittleLong(((int *)progs)[i]);
-#endif
+   COM_LittleLongs((int *)progs, (const int *)progs, sizeof(*progs) / 4);
 
    if (progs->version != PROG_VERSION)
       SV_Error("progs.dat has wrong version number (%i should be %i)",
@@ -1143,10 +2084,19 @@ PR_LoadProgs(void)
 #endif
    }
 
-#ifdef MSB_FIRST
-   for (i = 0; i < progs->numglobals; i++)
-      ((int *)pr_globals)[i] = LittleLong(((int *)pr_globals)[i]);
-#endif
+   COM_LittleLongs((int *)pr_globals, (const int *)pr_globals,
+         progs->numglobals);
+
+   ED_HashNames(&pr_fieldhash, &pr_fielddefs[0].s_name, sizeof(ddef_t),
+         progs->numfielddefs);
+   ED_HashNames(&pr_globalhash, &pr_globaldefs[0].s_name, sizeof(ddef_t),
+         progs->numglobaldefs);
+   ED_HashNames(&pr_functionhash, &pr_functions[0].s_name,
+         sizeof(dfunction_t), progs->numfunctions);
+   ED_FindExtFields();
+
+   PR_DecodeStatements();
+   PR_JitLoadProgs();
 
 #if defined(QW_HACK) && defined(SERVERONLY)
    // Zoid, find the spectator functions
@@ -1174,6 +2124,12 @@ PR_Init(void)
     Cmd_AddCommand("edicts", ED_PrintEdicts);
     Cmd_AddCommand("edictcount", ED_Count);
     Cmd_AddCommand("profile", PR_Profile_f);
+    Cmd_AddCommand("pr_fusions", PR_Fusions_f);
+    Cmd_AddCommand("pr_builtins", PR_Builtins_f);
+    Cmd_AddCommand("pr_strings", PR_Strings_f);
+    Cvar_RegisterVariable(&pr_builtinprofile);
+    PR_JitInit();
+    ED_WatchFields();
 #ifdef NQ_HACK
     Cvar_RegisterVariable(&nomonsters);
     Cvar_RegisterVariable(&gamecfg);
@@ -1189,16 +2145,92 @@ PR_Init(void)
 #endif
 }
 
+#ifdef NQ_HACK
+/*
+ * The edicts live in address space set aside for all sv.max_edicts of them
+ * when the server spawns, and only ED_COMMIT_EDICTS at a time are given
+ * memory, as EDICT_NUM first reaches past the end of what is. So what's
+ * resident follows the number of edicts in use rather than the progs'
+ * field count times MAX_EDICTS. Without mmap they're on the hunk, all
+ * committed from the start.
+ */
+#define ED_COMMIT_EDICTS 64
+
+static byte *ed_reservation;
+static size_t ed_reservesize;
+static size_t ed_commitsize;	/* bytes committed, page aligned */
+static int ed_committed;	/* edicts entirely within that */
+
+/*
+=================
+ED_ReserveEdicts
+
+Sets aside sv.edicts for the newly loaded progs, with the last server's
+pages given back
+=================
+*/
+void
+ED_ReserveEdicts(void)
+{
+    size_t size = (size_t)sv.max_edicts * pr_edict_size;
+#ifdef HAVE_MMAP
+    void *buf;
+
+    if (ed_reservation) {
+	munmap(ed_reservation, ed_reservesize);
+	ed_reservation = NULL;
+    }
+    buf = mmap(NULL, size, PROT_NONE,
+	       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (buf != MAP_FAILED) {
+	ed_reservation = (byte *)buf;
+	ed_reservesize = size;
+	ed_commitsize = 0;
+	ed_committed = 0;
+	sv.edicts = (edict_t *)buf;
+	return;
+    }
+#endif
+    sv.edicts = (edict_t *)Hunk_AllocName(size, "edicts");
+    ed_committed = sv.max_edicts;
+}
+
+static void
+ED_CommitEdicts(int count)
+{
+#ifdef HAVE_MMAP
+    size_t size, pagesize;
+
+    count = (count + ED_COMMIT_EDICTS - 1) / ED_COMMIT_EDICTS;
+    count = qmin(count * ED_COMMIT_EDICTS, sv.max_edicts);
+    pagesize = sysconf(_SC_PAGESIZE);
+    size = ((size_t)count * pr_edict_size + pagesize - 1) & ~(pagesize - 1);
+    size = qmin(size, ed_reservesize);
+    if (size <= ed_commitsize)
+	return;
+
+    if (mprotect(ed_reservation + ed_commitsize, size - ed_commitsize,
+		 PROT_READ | PROT_WRITE))
+	Host_Error("%s: couldn't commit %i edicts", __func__, count);
+    ed_commitsize = size;
+    ed_committed = qmin((int)(size / pr_edict_size), sv.max_edicts);
+#endif
+}
+#endif /* NQ_HACK */
+
 edict_t *
 EDICT_NUM(int n)
 {
 #ifdef NQ_HACK
     if (n < 0 || n >= sv.max_edicts)
+	SV_Error("%s: bad number %i", __func__, n);
+    if (n >= ed_committed)
+	ED_CommitEdicts(n + 1);
 #endif
 #if defined(QW_HACK) && defined(SERVERONLY)
     if (n < 0 || n >= MAX_EDICTS)
-#endif
 	SV_Error("%s: bad number %i", __func__, n);
+#endif
     return (edict_t *)((byte *)sv.edicts + (n) * pr_edict_size);
 }
 
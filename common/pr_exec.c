@@ -18,7 +18,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmd.h"
 #include "console.h"
+#include "cvar.h"
 #include "pr_comp.h"
 #include "progs.h"
 #include "server.h"
@@ -36,6 +42,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 typedef struct {
     int s;
     dfunction_t *f;
+    int saved;			// locals the function called from here saved
 } prstack_t;
 
 #define	MAX_STACK_DEPTH		32
@@ -46,6 +53,22 @@ int pr_depth;
 int localstack[LOCALSTACK_SIZE];
 int localstack_used;
 
+/*
+ * A function's locals only need saving on the way in if something up the
+ * stack is using them, which is the function itself when it's already
+ * running, or another function whose locals share the same globals (as
+ * some compilers lay them out). Otherwise they hold what the last return
+ * put back, which is what they were loaded with, so they can just be set
+ * to that - when it's all zeroes - and there's nothing to restore after.
+ */
+typedef struct {
+    int active;			// times the function is on the stack
+    int parmsize;		// ints taken by its parameters
+    qboolean save;		// always save locals: shared or not zeroed
+} prfuncinfo_t;
+
+static prfuncinfo_t *pr_funcinfo;
+
 qboolean pr_trace;
 dfunction_t *pr_xfunction;
 int pr_xstatement;
@@ -248,6 +271,189 @@ PR_Profile_f(void)
 }
 
 
+/*
+ * While pr_builtinprofile is set, the calls to each builtin are counted
+ * and timed for each QuakeC function calling it. The time is inclusive,
+ * any QuakeC the builtin runs (touch functions, say) is part of it.
+ */
+cvar_t pr_builtinprofile = { "pr_builtinprofile", "0" };
+
+typedef struct {
+    int builtin;		/* 0 if the slot is unused */
+    int caller;
+    int calls;
+    double time;
+} prbuiltincalls_t;
+
+static prbuiltincalls_t *pr_bcalls;
+static int pr_bcallsize;	/* a power of two */
+static int pr_numbcalls;
+
+static prbuiltincalls_t *
+PR_BuiltinSlot(prbuiltincalls_t *table, int size, int builtin, int caller)
+{
+    unsigned hash = (builtin * 0x9e3779b1u) ^ (caller * 0x85ebca6bu);
+    prbuiltincalls_t *calls;
+    unsigned i;
+
+    for (i = hash ^ (hash >> 16);; i++) {
+	calls = &table[i & (size - 1)];
+	if (!calls->builtin || (calls->builtin == builtin
+				&& calls->caller == caller))
+	    return calls;
+    }
+}
+
+static prbuiltincalls_t *
+PR_BuiltinCalls(int builtin, int caller)
+{
+    prbuiltincalls_t *calls, *table;
+    int i, size;
+
+    if (pr_numbcalls * 2 >= pr_bcallsize) {
+	size = pr_bcallsize ? pr_bcallsize * 2 : 256;
+	table = calloc(size, sizeof(*table));
+	if (!table)
+	    Sys_Error("%s: out of memory", __func__);
+	for (i = 0; i < pr_bcallsize; i++) {
+	    if (pr_bcalls[i].builtin)
+		*PR_BuiltinSlot(table, size, pr_bcalls[i].builtin,
+				pr_bcalls[i].caller) = pr_bcalls[i];
+	}
+	free(pr_bcalls);
+	pr_bcalls = table;
+	pr_bcallsize = size;
+    }
+
+    calls = PR_BuiltinSlot(pr_bcalls, pr_bcallsize, builtin, caller);
+    if (!calls->builtin) {
+	calls->builtin = builtin;
+	calls->caller = caller;
+	pr_numbcalls++;
+    }
+
+    return calls;
+}
+
+/*
+============
+PR_CallBuiltin
+
+Calls builtin number i, which the caller has checked
+============
+*/
+void
+PR_CallBuiltin(int i)
+{
+    prbuiltincalls_t *calls;
+    double start;
+    int caller;
+
+    if (!pr_builtinprofile.value) {
+	pr_builtins[i] ();
+	return;
+    }
+
+    caller = pr_xfunction ? pr_xfunction - pr_functions : 0;
+    start = Sys_DoubleTime();
+    pr_builtins[i] ();
+    calls = PR_BuiltinCalls(i, caller);
+    calls->calls++;
+    calls->time += Sys_DoubleTime() - start;
+}
+
+/* The progs function defining builtin number i */
+static const char *
+PR_BuiltinName(int i)
+{
+    int j;
+
+    for (j = 1; j < progs->numfunctions; j++)
+	if (pr_functions[j].first_statement == -i)
+	    return PR_GetString(pr_functions[j].s_name);
+    return "?";
+}
+
+static int
+PR_CompareBuiltinCalls(const void *a, const void *b)
+{
+    double time1 = ((const prbuiltincalls_t *)a)->time;
+    double time2 = ((const prbuiltincalls_t *)b)->time;
+
+    return time1 > time2 ? -1 : time1 < time2;
+}
+
+/*
+============
+PR_Builtins_f
+
+Lists the builtins taking the most time, then the QuakeC functions
+calling each of them the most. "pr_builtins clear" starts over.
+============
+*/
+void
+PR_Builtins_f(void)
+{
+    prbuiltincalls_t *totals, *calls;
+    int i, j, numtotals, numcallers, limit;
+
+    if (!progs)
+	return;
+
+    if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "clear")) {
+	if (pr_bcalls)
+	    memset(pr_bcalls, 0, pr_bcallsize * sizeof(*pr_bcalls));
+	pr_numbcalls = 0;
+	return;
+    }
+    if (!pr_numbcalls) {
+	Con_Printf("No builtin calls recorded, set pr_builtinprofile to 1\n");
+	return;
+    }
+    limit = Cmd_Argc() > 1 ? Q_atoi(Cmd_Argv(1)) : 10;
+
+    /* gather the calls, then add them up per builtin */
+    calls = malloc(pr_numbcalls * sizeof(*calls));
+    totals = calloc(pr_numbuiltins, sizeof(*totals));
+    if (!calls || !totals)
+	Sys_Error("%s: out of memory", __func__);
+    for (i = j = 0; i < pr_bcallsize; i++) {
+	if (!pr_bcalls[i].builtin)
+	    continue;
+	calls[j++] = pr_bcalls[i];
+	totals[pr_bcalls[i].builtin].builtin = pr_bcalls[i].builtin;
+	totals[pr_bcalls[i].builtin].calls += pr_bcalls[i].calls;
+	totals[pr_bcalls[i].builtin].time += pr_bcalls[i].time;
+    }
+    qsort(calls, pr_numbcalls, sizeof(*calls), PR_CompareBuiltinCalls);
+    qsort(totals, pr_numbuiltins, sizeof(*totals), PR_CompareBuiltinCalls);
+    for (numtotals = 0; numtotals < pr_numbuiltins; numtotals++)
+	if (!totals[numtotals].builtin)
+	    break;
+
+    Con_Printf("   calls    total ms  us/call  builtin / caller\n");
+    for (i = 0; i < numtotals && i < limit; i++) {
+	Con_Printf("%8i %11.3f %8.2f  %s\n", totals[i].calls,
+		   totals[i].time * 1000,
+		   totals[i].time * 1e6 / totals[i].calls,
+		   PR_BuiltinName(totals[i].builtin));
+	numcallers = 0;
+	for (j = 0; j < pr_numbcalls && numcallers < 3; j++) {
+	    if (calls[j].builtin != totals[i].builtin)
+		continue;
+	    Con_Printf("%8i %11.3f %8.2f    %s\n", calls[j].calls,
+		       calls[j].time * 1000,
+		       calls[j].time * 1e6 / calls[j].calls,
+		       PR_GetString(pr_functions[calls[j].caller].s_name));
+	    numcallers++;
+	}
+    }
+
+    free(calls);
+    free(totals);
+}
+
+
 /*
 ============
 PR_RunError
@@ -260,6 +466,7 @@ PR_RunError(const char *error, ...)
 {
     va_list argptr;
     char string[MAX_PRINTMSG];
+    int i;
 
     va_start(argptr, error);
     vsnprintf(string, sizeof(string), error, argptr);
@@ -271,6 +478,9 @@ PR_RunError(const char *error, ...)
 
     /* dump the stack so SV/Host_Error can shutdown functions */
     pr_depth = 0;
+    localstack_used = 0;
+    for (i = 0; i < progs->numfunctions; i++)
+	pr_funcinfo[i].active = 0;
 
 #ifdef NQ_HACK
     Host_Error("Program error");
@@ -288,6 +498,92 @@ The interpretation main loop
 ============================================================================
 */
 
+/*
+ * The statements are decoded into this form when the progs are loaded,
+ * with their operands turned into pointers to the globals and the
+ * branches into pointers to their targets. Built with GCC, each
+ * statement's handler is the address of its label in PR_Execute, so
+ * every handler jumps straight to the next one (direct threading).
+ * Otherwise it's the opcode of a plain switch.
+ */
+#if defined(__GNUC__)
+#define PR_THREADED
+#endif
+
+typedef struct prstatement_s {
+#ifdef PR_THREADED
+    const void *handler;
+#else
+    int op;
+#endif
+    eval_t *a;
+    eval_t *b;
+    union {
+	eval_t *c;
+	const struct prstatement_s *jump;	/* IF, IFNOT and GOTO */
+    } u;
+} prstatement_t;
+
+/* Decoded in place of statements which would fail when executed */
+enum {
+    OP_BADOP = OP_BITOR + 1,	/* unknown opcode */
+    OP_BADBRANCH,		/* branch target out of range */
+    OP_PASTEND,			/* ran past the last statement */
+
+    /*
+     * Superinstructions, each decoded in place of the first of a pair of
+     * statements the compiler often emits together. They run the second
+     * statement too, from its own operands, and skip it. The second
+     * statement is decoded as usual in case a branch lands on it.
+     */
+    OP_FUSED,
+    OP_ADDRESS_STOREP = OP_FUSED,	/* a.b = x */
+    OP_ADDRESS_STOREP_V,
+    OP_LOAD_IF,				/* if (a.b) */
+    OP_LOAD_IFNOT,
+    OP_LOAD_STORE_V,			/* v = a.b */
+    OP_EQ_F_IFNOT,			/* if (x == y) */
+    OP_NE_F_IFNOT,
+    OP_EQ_E_IFNOT,
+    OP_NE_E_IFNOT,
+    OP_LE_IFNOT,
+    OP_GE_IFNOT,
+    OP_LT_IFNOT,
+    OP_GT_IFNOT,
+    OP_BITAND_IF,			/* if (x & y) */
+    OP_BITAND_IFNOT,
+    OP_ADD_F_STORE,			/* x = y + z */
+    OP_SUB_F_STORE,
+    OP_MUL_F_STORE,
+    OP_ADD_V_STORE_V,
+    OP_SUB_V_STORE_V,
+    OP_MUL_VF_STORE_V,
+    OP_MUL_FV_STORE_V,
+    PR_NUMOPS
+};
+
+#define PR_NUMFUSED (PR_NUMOPS - OP_FUSED)
+
+static const char *pr_fusednames[PR_NUMFUSED] = {
+    "address+storep", "address+storep_v",
+    "load+if", "load+ifnot", "load_v+store_v",
+    "eq_f+ifnot", "ne_f+ifnot", "eq_e+ifnot", "ne_e+ifnot",
+    "le+ifnot", "ge+ifnot", "lt+ifnot", "gt+ifnot",
+    "bitand+if", "bitand+ifnot",
+    "add_f+store", "sub_f+store", "mul_f+store",
+    "add_v+store_v", "sub_v+store_v", "mul_vf+store_v", "mul_fv+store_v"
+};
+
+/* For pr_fusions: statements decoded as each, and times they ran */
+static int pr_fusedsites[PR_NUMFUSED];
+static unsigned pr_fusedruns[PR_NUMFUSED];
+
+static prstatement_t *pr_code;
+static byte *pr_fused;		/* per statement, true if decoded fused */
+
+#define RUNAWAY_LIMIT 1000000
+#define RUNAWAY_WARN 50000
+
 /*
 ====================
 PR_EnterFunction
@@ -298,31 +594,49 @@ Returns the new program statement counter
 int
 PR_EnterFunction(dfunction_t *f)
 {
-    int i, j, c, o;
+    prfuncinfo_t *info;
+    int *globals, *locals, *parm;
+    int i, c;
 
     pr_stack[pr_depth].s = pr_xstatement;
     pr_stack[pr_depth].f = pr_xfunction;
     pr_depth++;
     if (pr_depth >= MAX_STACK_DEPTH)
 	PR_RunError("stack overflow");
+    if (f->first_statement >= progs->numstatements)
+	PR_RunError("Bad function entry %i", f->first_statement);
+
+    globals = (int *)pr_globals;
+    locals = globals + f->parm_start;
+    info = &pr_funcinfo[f - pr_functions];
 
 // save off any locals that the new function steps on
     c = f->locals;
-    if (localstack_used + c > LOCALSTACK_SIZE)
-	PR_RunError("PR_ExecuteProgram: locals stack overflow\n");
-
-    for (i = 0; i < c; i++)
-	localstack[localstack_used + i] =
-	    ((int *)pr_globals)[f->parm_start + i];
-    localstack_used += c;
+    if (info->save || info->active) {
+	if (localstack_used + c > LOCALSTACK_SIZE)
+	    PR_RunError("PR_ExecuteProgram: locals stack overflow\n");
+	memcpy(localstack + localstack_used, locals, c * sizeof(int));
+	localstack_used += c;
+    } else {
+	if (c > info->parmsize)
+	    memset(locals + info->parmsize, 0,
+		   (c - info->parmsize) * sizeof(int));
+	c = 0;
+    }
+    pr_stack[pr_depth - 1].saved = c;
+    info->active++;
 
 // copy parameters
-    o = f->parm_start;
-    for (i = 0; i < f->numparms; i++) {
-	for (j = 0; j < f->parm_size[i]; j++) {
-	    ((int *)pr_globals)[o] =
-		((int *)pr_globals)[OFS_PARM0 + i * 3 + j];
-	    o++;
+    parm = globals + OFS_PARM0;
+    for (i = 0; i < f->numparms; i++, parm += 3) {
+	if (f->parm_size[i] == 3) {
+	    locals[0] = parm[0];
+	    locals[1] = parm[1];
+	    locals[2] = parm[2];
+	    locals += 3;
+	} else if (f->parm_size[i]) {
+	    memcpy(locals, parm, f->parm_size[i] * sizeof(int));
+	    locals += f->parm_size[i];
 	}
     }
 
@@ -338,7 +652,7 @@ PR_LeaveFunction
 int
 PR_LeaveFunction(void)
 {
-    int i, c;
+    int c;
 
     if (pr_depth <= 0)
 #ifdef NQ_HACK
@@ -349,39 +663,124 @@ PR_LeaveFunction(void)
 #endif
 
 // restore locals from the stack
-    c = pr_xfunction->locals;
-    localstack_used -= c;
-    if (localstack_used < 0)
-	PR_RunError("PR_ExecuteProgram: locals stack underflow\n");
-
-    for (i = 0; i < c; i++)
-	((int *)pr_globals)[pr_xfunction->parm_start + i] =
-	    localstack[localstack_used + i];
+    c = pr_stack[pr_depth - 1].saved;
+    if (c) {
+	localstack_used -= c;
+	if (localstack_used < 0)
+	    PR_RunError("PR_ExecuteProgram: locals stack underflow\n");
+	memcpy((int *)pr_globals + pr_xfunction->parm_start,
+	       localstack + localstack_used, c * sizeof(int));
+    }
+    pr_funcinfo[pr_xfunction - pr_functions].active--;
 
 // up stack
     pr_depth--;
     pr_xfunction = pr_stack[pr_depth].f;
-    return pr_stack[pr_depth].s;
+    pr_xstatement = pr_stack[pr_depth].s;
+    return pr_xstatement;
 }
 
+#ifdef PR_THREADED
+#define OPCODE(op) L_##op
+#define DISPATCH() \
+    do { if (--runaway <= checkat) goto check; goto *st->handler; } while (0)
+#else
+#define OPCODE(op) case op
+#define DISPATCH() \
+    do { if (--runaway <= checkat) goto check; goto dispatch; } while (0)
+#endif
+#define NEXT() do { st++; DISPATCH(); } while (0)
+
+/* For superinstructions, counting the statement skipped */
+#define FUSED(op) do { pr_fusedruns[op - OP_FUSED]++; runaway--; } while (0)
+#define NEXT2() do { st += 2; DISPATCH(); } while (0)
+#define BRANCH2(cond) \
+    do { \
+	if (cond) { \
+	    st = st[1].u.jump; \
+	    DISPATCH(); \
+	} \
+	NEXT2(); \
+    } while (0)
+
+/*
+ * Bring pr_xstatement and the profile of the current function up to date,
+ * before anything that may look at them
+ */
+#define SYNC() \
+    do { \
+	pr_xstatement = st - pr_code; \
+	pr_xfunction->profile += profiled - runaway; \
+	profiled = runaway; \
+    } while (0)
 
 /*
 ====================
-PR_ExecuteProgram
+PR_Execute
+
+The interpreter proper. Called with decode set, it only hands back the
+handlers for PR_DecodeStatements.
 ====================
 */
-void
-PR_ExecuteProgram(func_t fnum)
+static void
+PR_Execute(func_t fnum, const void *const **decode)
 {
-    eval_t *a, *b, *c;
-    int s;
-    dstatement_t *st;
+#ifdef PR_THREADED
+    static const void *const handlers[PR_NUMOPS] = {
+	&&L_OP_DONE,
+	&&L_OP_MUL_F, &&L_OP_MUL_V, &&L_OP_MUL_FV, &&L_OP_MUL_VF,
+	&&L_OP_DIV_F,
+	&&L_OP_ADD_F, &&L_OP_ADD_V,
+	&&L_OP_SUB_F, &&L_OP_SUB_V,
+	&&L_OP_EQ_F, &&L_OP_EQ_V, &&L_OP_EQ_S, &&L_OP_EQ_E, &&L_OP_EQ_FNC,
+	&&L_OP_NE_F, &&L_OP_NE_V, &&L_OP_NE_S, &&L_OP_NE_E, &&L_OP_NE_FNC,
+	&&L_OP_LE, &&L_OP_GE, &&L_OP_LT, &&L_OP_GT,
+	&&L_OP_LOAD_F, &&L_OP_LOAD_V, &&L_OP_LOAD_S, &&L_OP_LOAD_ENT,
+	&&L_OP_LOAD_FLD, &&L_OP_LOAD_FNC,
+	&&L_OP_ADDRESS,
+	&&L_OP_STORE_F, &&L_OP_STORE_V, &&L_OP_STORE_S, &&L_OP_STORE_ENT,
+	&&L_OP_STORE_FLD, &&L_OP_STORE_FNC,
+	&&L_OP_STOREP_F, &&L_OP_STOREP_V, &&L_OP_STOREP_S, &&L_OP_STOREP_ENT,
+	&&L_OP_STOREP_FLD, &&L_OP_STOREP_FNC,
+	&&L_OP_RETURN,
+	&&L_OP_NOT_F, &&L_OP_NOT_V, &&L_OP_NOT_S, &&L_OP_NOT_ENT,
+	&&L_OP_NOT_FNC,
+	&&L_OP_IF, &&L_OP_IFNOT,
+	&&L_OP_CALL0, &&L_OP_CALL1, &&L_OP_CALL2, &&L_OP_CALL3, &&L_OP_CALL4,
+	&&L_OP_CALL5, &&L_OP_CALL6, &&L_OP_CALL7, &&L_OP_CALL8,
+	&&L_OP_STATE,
+	&&L_OP_GOTO,
+	&&L_OP_AND, &&L_OP_OR,
+	&&L_OP_BITAND, &&L_OP_BITOR,
+	&&L_OP_BADOP, &&L_OP_BADBRANCH, &&L_OP_PASTEND,
+	&&L_OP_ADDRESS_STOREP, &&L_OP_ADDRESS_STOREP_V,
+	&&L_OP_LOAD_IF, &&L_OP_LOAD_IFNOT, &&L_OP_LOAD_STORE_V,
+	&&L_OP_EQ_F_IFNOT, &&L_OP_NE_F_IFNOT, &&L_OP_EQ_E_IFNOT,
+	&&L_OP_NE_E_IFNOT,
+	&&L_OP_LE_IFNOT, &&L_OP_GE_IFNOT, &&L_OP_LT_IFNOT, &&L_OP_GT_IFNOT,
+	&&L_OP_BITAND_IF, &&L_OP_BITAND_IFNOT,
+	&&L_OP_ADD_F_STORE, &&L_OP_SUB_F_STORE, &&L_OP_MUL_F_STORE,
+	&&L_OP_ADD_V_STORE_V, &&L_OP_SUB_V_STORE_V, &&L_OP_MUL_VF_STORE_V,
+	&&L_OP_MUL_FV_STORE_V
+    };
+#endif
+    const prstatement_t *st;
     dfunction_t *f, *newf;
-    int runaway;
-    int i;
+    int runaway, profiled, checkat;
+    int i, s;
     edict_t *ed;
     int exitdepth;
     eval_t *ptr;
+#ifndef PR_THREADED
+    int op;
+#endif
+
+    if (decode) {
+#ifdef PR_THREADED
+	*decode = handlers;
+#endif
+	return;
+    }
 
     if (!fnum || fnum >= progs->numfunctions) {
 	if (pr_global_struct->self)
@@ -396,287 +795,775 @@ PR_ExecuteProgram(func_t fnum)
 
     f = &pr_functions[fnum];
 
-    runaway = 1000000;
     pr_trace = false;
+    if (PR_JitExecute(f))
+	return;
+
+    runaway = profiled = RUNAWAY_LIMIT;
+    checkat = RUNAWAY_WARN;
 
 // make a stack frame
     exitdepth = pr_depth;
 
-    s = PR_EnterFunction(f);
+    st = pr_code + PR_EnterFunction(f) + 1;
+    DISPATCH();
 
-    while (1) {
-	s++;			// next statement
+ check:
+    /* the slow path, when running away or tracing */
+    if (runaway <= 0) {
+	SYNC();
+	PR_RunError("runaway loop error");
+    }
+    if (runaway <= RUNAWAY_WARN && !(runaway % 5000))
+	Con_DPrintf("%s: progs execution running away (%i left)\n",
+		    __func__, runaway);
+    if (pr_trace && st - pr_code < progs->numstatements) {
+	PR_PrintStatement(&pr_statements[st - pr_code]);
+	/* trace every statement of a superinstruction */
+	if (pr_fused[st - pr_code]) {
+#ifdef PR_THREADED
+	    goto *handlers[pr_statements[st - pr_code].op];
+#else
+	    op = pr_statements[st - pr_code].op;
+	    goto dispatch_op;
+#endif
+	}
+    }
+#ifdef PR_THREADED
+    goto *st->handler;
+#else
+ dispatch:
+    op = st->op;
+ dispatch_op:
+    switch (op) {
+#endif
 
-	st = &pr_statements[s];
-	a = (eval_t *)&pr_globals[st->a];
-	b = (eval_t *)&pr_globals[st->b];
-	c = (eval_t *)&pr_globals[st->c];
+    OPCODE(OP_ADD_F):
+	st->u.c->_float = st->a->_float + st->b->_float;
+	NEXT();
+    OPCODE(OP_ADD_V):
+	st->u.c->vector[0] = st->a->vector[0] + st->b->vector[0];
+	st->u.c->vector[1] = st->a->vector[1] + st->b->vector[1];
+	st->u.c->vector[2] = st->a->vector[2] + st->b->vector[2];
+	NEXT();
+
+    OPCODE(OP_SUB_F):
+	st->u.c->_float = st->a->_float - st->b->_float;
+	NEXT();
+    OPCODE(OP_SUB_V):
+	st->u.c->vector[0] = st->a->vector[0] - st->b->vector[0];
+	st->u.c->vector[1] = st->a->vector[1] - st->b->vector[1];
+	st->u.c->vector[2] = st->a->vector[2] - st->b->vector[2];
+	NEXT();
+
+    OPCODE(OP_MUL_F):
+	st->u.c->_float = st->a->_float * st->b->_float;
+	NEXT();
+    OPCODE(OP_MUL_V):
+	st->u.c->_float = st->a->vector[0] * st->b->vector[0]
+	    + st->a->vector[1] * st->b->vector[1]
+	    + st->a->vector[2] * st->b->vector[2];
+	NEXT();
+    OPCODE(OP_MUL_FV):
+	st->u.c->vector[0] = st->a->_float * st->b->vector[0];
+	st->u.c->vector[1] = st->a->_float * st->b->vector[1];
+	st->u.c->vector[2] = st->a->_float * st->b->vector[2];
+	NEXT();
+    OPCODE(OP_MUL_VF):
+	st->u.c->vector[0] = st->b->_float * st->a->vector[0];
+	st->u.c->vector[1] = st->b->_float * st->a->vector[1];
+	st->u.c->vector[2] = st->b->_float * st->a->vector[2];
+	NEXT();
+
+    OPCODE(OP_DIV_F):
+	st->u.c->_float = st->a->_float / st->b->_float;
+	NEXT();
+
+    OPCODE(OP_BITAND):
+	st->u.c->_float = (int)st->a->_float & (int)st->b->_float;
+	NEXT();
+
+    OPCODE(OP_BITOR):
+	st->u.c->_float = (int)st->a->_float | (int)st->b->_float;
+	NEXT();
+
+
+    OPCODE(OP_GE):
+	st->u.c->_float = st->a->_float >= st->b->_float;
+	NEXT();
+    OPCODE(OP_LE):
+	st->u.c->_float = st->a->_float <= st->b->_float;
+	NEXT();
+    OPCODE(OP_GT):
+	st->u.c->_float = st->a->_float > st->b->_float;
+	NEXT();
+    OPCODE(OP_LT):
+	st->u.c->_float = st->a->_float < st->b->_float;
+	NEXT();
+    OPCODE(OP_AND):
+	st->u.c->_float = st->a->_float && st->b->_float;
+	NEXT();
+    OPCODE(OP_OR):
+	st->u.c->_float = st->a->_float || st->b->_float;
+	NEXT();
+
+    OPCODE(OP_NOT_F):
+	st->u.c->_float = !st->a->_float;
+	NEXT();
+    OPCODE(OP_NOT_V):
+	st->u.c->_float = !st->a->vector[0] && !st->a->vector[1]
+	    && !st->a->vector[2];
+	NEXT();
+    OPCODE(OP_NOT_S):
+	st->u.c->_float = !st->a->string || !*PR_GetString(st->a->string);
+	NEXT();
+    OPCODE(OP_NOT_FNC):
+	st->u.c->_float = !st->a->function;
+	NEXT();
+    OPCODE(OP_NOT_ENT):
+	st->u.c->_float = (PROG_TO_EDICT(st->a->edict) == sv.edicts);
+	NEXT();
+
+    OPCODE(OP_EQ_F):
+	st->u.c->_float = st->a->_float == st->b->_float;
+	NEXT();
+    OPCODE(OP_EQ_V):
+	st->u.c->_float = (st->a->vector[0] == st->b->vector[0]) &&
+	    (st->a->vector[1] == st->b->vector[1]) &&
+	    (st->a->vector[2] == st->b->vector[2]);
+	NEXT();
+    OPCODE(OP_EQ_S):
+	st->u.c->_float = st->a->string == st->b->string
+	    || !strcmp(PR_GetString(st->a->string),
+		       PR_GetString(st->b->string));
+	NEXT();
+    OPCODE(OP_EQ_E):
+	st->u.c->_float = st->a->_int == st->b->_int;
+	NEXT();
+    OPCODE(OP_EQ_FNC):
+	st->u.c->_float = st->a->function == st->b->function;
+	NEXT();
+
+    OPCODE(OP_NE_F):
+	st->u.c->_float = st->a->_float != st->b->_float;
+	NEXT();
+    OPCODE(OP_NE_V):
+	st->u.c->_float = (st->a->vector[0] != st->b->vector[0]) ||
+	    (st->a->vector[1] != st->b->vector[1]) ||
+	    (st->a->vector[2] != st->b->vector[2]);
+	NEXT();
+    OPCODE(OP_NE_S):
+	st->u.c->_float = st->a->string == st->b->string ? 0 :
+	    strcmp(PR_GetString(st->a->string), PR_GetString(st->b->string));
+	NEXT();
+    OPCODE(OP_NE_E):
+	st->u.c->_float = st->a->_int != st->b->_int;
+	NEXT();
+    OPCODE(OP_NE_FNC):
+	st->u.c->_float = st->a->function != st->b->function;
+	NEXT();
 
-	if (!--runaway)
-	    PR_RunError("runaway loop error");
-	if (runaway <= 50000 && !(runaway % 5000))
-	    Con_DPrintf("%s: progs execution running away (%i left)\n",
-			__func__, runaway);
+//==================
+    OPCODE(OP_STORE_F):
+    OPCODE(OP_STORE_ENT):
+    OPCODE(OP_STORE_FLD):	// integers
+    OPCODE(OP_STORE_S):
+    OPCODE(OP_STORE_FNC):	// pointers
+	st->b->_int = st->a->_int;
+	NEXT();
+    OPCODE(OP_STORE_V):
+	st->b->vector[0] = st->a->vector[0];
+	st->b->vector[1] = st->a->vector[1];
+	st->b->vector[2] = st->a->vector[2];
+	NEXT();
+
+    OPCODE(OP_STOREP_F):
+    OPCODE(OP_STOREP_ENT):
+    OPCODE(OP_STOREP_FLD):	// integers
+    OPCODE(OP_STOREP_S):
+    OPCODE(OP_STOREP_FNC):	// pointers
+	ptr = (eval_t *)((byte *)sv.edicts + st->b->_int);
+	ptr->_int = st->a->_int;
+	NEXT();
+    OPCODE(OP_STOREP_V):
+	ptr = (eval_t *)((byte *)sv.edicts + st->b->_int);
+	ptr->vector[0] = st->a->vector[0];
+	ptr->vector[1] = st->a->vector[1];
+	ptr->vector[2] = st->a->vector[2];
+	NEXT();
+
+    OPCODE(OP_ADDRESS):
+	ed = PROG_TO_EDICT(st->a->edict);
+#ifdef PARANOID
+	NUM_FOR_EDICT(ed);	// make sure it's in range
+#endif
+	if (ed == (edict_t *)sv.edicts && sv.state == ss_active) {
+	    SYNC();
+	    PR_RunError("assignment to world entity");
+	}
+	ED_FIELD_STORED(st->a->edict, st->b->_int);
+	st->u.c->_int =
+	    (byte *)((int *)&ed->v + st->b->_int) - (byte *)sv.edicts;
+	NEXT();
+
+    OPCODE(OP_LOAD_F):
+    OPCODE(OP_LOAD_FLD):
+    OPCODE(OP_LOAD_ENT):
+    OPCODE(OP_LOAD_S):
+    OPCODE(OP_LOAD_FNC):
+	ed = PROG_TO_EDICT(st->a->edict);
+#ifdef PARANOID
+	NUM_FOR_EDICT(ed);	// make sure it's in range
+#endif
+	ptr = (eval_t *)((int *)&ed->v + st->b->_int);
+	st->u.c->_int = ptr->_int;
+	NEXT();
 
-	pr_xfunction->profile++;
-	pr_xstatement = s;
+    OPCODE(OP_LOAD_V):
+	ed = PROG_TO_EDICT(st->a->edict);
+#ifdef PARANOID
+	NUM_FOR_EDICT(ed);	// make sure it's in range
+#endif
+	ptr = (eval_t *)((int *)&ed->v + st->b->_int);
+	st->u.c->vector[0] = ptr->vector[0];
+	st->u.c->vector[1] = ptr->vector[1];
+	st->u.c->vector[2] = ptr->vector[2];
+	NEXT();
 
-	if (pr_trace)
-	    PR_PrintStatement(st);
+//==================
 
-	switch (st->op) {
-	case OP_ADD_F:
-	    c->_float = a->_float + b->_float;
-	    break;
-	case OP_ADD_V:
-	    c->vector[0] = a->vector[0] + b->vector[0];
-	    c->vector[1] = a->vector[1] + b->vector[1];
-	    c->vector[2] = a->vector[2] + b->vector[2];
-	    break;
+    OPCODE(OP_IFNOT):
+	if (!st->a->_int) {
+	    st = st->u.jump;
+	    DISPATCH();
+	}
+	NEXT();
 
-	case OP_SUB_F:
-	    c->_float = a->_float - b->_float;
-	    break;
-	case OP_SUB_V:
-	    c->vector[0] = a->vector[0] - b->vector[0];
-	    c->vector[1] = a->vector[1] - b->vector[1];
-	    c->vector[2] = a->vector[2] - b->vector[2];
-	    break;
+    OPCODE(OP_IF):
+	if (st->a->_int) {
+	    st = st->u.jump;
+	    DISPATCH();
+	}
+	NEXT();
+
+    OPCODE(OP_GOTO):
+	st = st->u.jump;
+	DISPATCH();
+
+    OPCODE(OP_CALL0):
+	pr_argc = 0;
+	goto call;
+    OPCODE(OP_CALL1):
+	pr_argc = 1;
+	goto call;
+    OPCODE(OP_CALL2):
+	pr_argc = 2;
+	goto call;
+    OPCODE(OP_CALL3):
+	pr_argc = 3;
+	goto call;
+    OPCODE(OP_CALL4):
+	pr_argc = 4;
+	goto call;
+    OPCODE(OP_CALL5):
+	pr_argc = 5;
+	goto call;
+    OPCODE(OP_CALL6):
+	pr_argc = 6;
+	goto call;
+    OPCODE(OP_CALL7):
+	pr_argc = 7;
+	goto call;
+    OPCODE(OP_CALL8):
+	pr_argc = 8;
+    call:
+	SYNC();
+	if (!st->a->function)
+	    PR_RunError("NULL function");
+	if ((unsigned)st->a->function >= progs->numfunctions)
+	    PR_RunError("Bad function %i", st->a->function);
+
+	newf = &pr_functions[st->a->function];
+
+	/* negative statements are built in functions */
+	if (newf->first_statement < 0) {
+	    i = -newf->first_statement;
+	    if (i >= pr_numbuiltins)
+		PR_RunError("Bad builtin call number");
+	    PR_CallBuiltin(i);
+	    checkat = pr_trace ? RUNAWAY_LIMIT : RUNAWAY_WARN;
+	    NEXT();
+	}
 
-	case OP_MUL_F:
-	    c->_float = a->_float * b->_float;
-	    break;
-	case OP_MUL_V:
-	    c->_float = a->vector[0] * b->vector[0]
-		+ a->vector[1] * b->vector[1]
-		+ a->vector[2] * b->vector[2];
-	    break;
-	case OP_MUL_FV:
-	    c->vector[0] = a->_float * b->vector[0];
-	    c->vector[1] = a->_float * b->vector[1];
-	    c->vector[2] = a->_float * b->vector[2];
-	    break;
-	case OP_MUL_VF:
-	    c->vector[0] = b->_float * a->vector[0];
-	    c->vector[1] = b->_float * a->vector[1];
-	    c->vector[2] = b->_float * a->vector[2];
-	    break;
+	if (PR_JitExecute(newf)) {
+	    checkat = pr_trace ? RUNAWAY_LIMIT : RUNAWAY_WARN;
+	    NEXT();
+	}
 
-	case OP_DIV_F:
-	    c->_float = a->_float / b->_float;
-	    break;
+	st = pr_code + PR_EnterFunction(newf) + 1;
+	DISPATCH();
+
+    OPCODE(OP_DONE):
+    OPCODE(OP_RETURN):
+	pr_globals[OFS_RETURN] = st->a->vector[0];
+	pr_globals[OFS_RETURN + 1] = st->a->vector[1];
+	pr_globals[OFS_RETURN + 2] = st->a->vector[2];
+
+	SYNC();
+	s = PR_LeaveFunction();
+	if (pr_depth == exitdepth)
+	    return;		// all done
+	st = pr_code + s;
+	NEXT();
+
+    OPCODE(OP_STATE):
+	ed = PROG_TO_EDICT(pr_global_struct->self);
+	ED_Wake(pr_global_struct->self / pr_edict_size);
+	ed->v.nextthink = pr_global_struct->time + 0.1;
+	if (st->a->_float != ed->v.frame) {
+	    ed->v.frame = st->a->_float;
+	}
+	ed->v.think = st->b->function;
+	NEXT();
 
-	case OP_BITAND:
-	    c->_float = (int)a->_float & (int)b->_float;
-	    break;
+//==================
 
-	case OP_BITOR:
-	    c->_float = (int)a->_float | (int)b->_float;
-	    break;
+    OPCODE(OP_ADDRESS_STOREP):
+	FUSED(OP_ADDRESS_STOREP);
+	ed = PROG_TO_EDICT(st->a->edict);
+#ifdef PARANOID
+	NUM_FOR_EDICT(ed);	// make sure it's in range
+#endif
+	if (ed == (edict_t *)sv.edicts && sv.state == ss_active) {
+	    SYNC();
+	    PR_RunError("assignment to world entity");
+	}
+	ED_FIELD_STORED(st->a->edict, st->b->_int);
+	st->u.c->_int =
+	    (byte *)((int *)&ed->v + st->b->_int) - (byte *)sv.edicts;
+	ptr = (eval_t *)((byte *)sv.edicts + st[1].b->_int);
+	ptr->_int = st[1].a->_int;
+	NEXT2();
+    OPCODE(OP_ADDRESS_STOREP_V):
+	FUSED(OP_ADDRESS_STOREP_V);
+	ed = PROG_TO_EDICT(st->a->edict);
+#ifdef PARANOID
+	NUM_FOR_EDICT(ed);	// make sure it's in range
+#endif
+	if (ed == (edict_t *)sv.edicts && sv.state == ss_active) {
+	    SYNC();
+	    PR_RunError("assignment to world entity");
+	}
+	ED_FIELD_STORED(st->a->edict, st->b->_int);
+	st->u.c->_int =
+	    (byte *)((int *)&ed->v + st->b->_int) - (byte *)sv.edicts;
+	ptr = (eval_t *)((byte *)sv.edicts + st[1].b->_int);
+	ptr->vector[0] = st[1].a->vector[0];
+	ptr->vector[1] = st[1].a->vector[1];
+	ptr->vector[2] = st[1].a->vector[2];
+	NEXT2();
+
+    OPCODE(OP_LOAD_IF):
+	FUSED(OP_LOAD_IF);
+	ed = PROG_TO_EDICT(st->a->edict);
+#ifdef PARANOID
+	NUM_FOR_EDICT(ed);	// make sure it's in range
+#endif
+	ptr = (eval_t *)((int *)&ed->v + st->b->_int);
+	st->u.c->_int = ptr->_int;
+	BRANCH2(st[1].a->_int);
+    OPCODE(OP_LOAD_IFNOT):
+	FUSED(OP_LOAD_IFNOT);
+	ed = PROG_TO_EDICT(st->a->edict);
+#ifdef PARANOID
+	NUM_FOR_EDICT(ed);	// make sure it's in range
+#endif
+	ptr = (eval_t *)((int *)&ed->v + st->b->_int);
+	st->u.c->_int = ptr->_int;
+	BRANCH2(!st[1].a->_int);
+    OPCODE(OP_LOAD_STORE_V):
+	FUSED(OP_LOAD_STORE_V);
+	ed = PROG_TO_EDICT(st->a->edict);
+#ifdef PARANOID
+	NUM_FOR_EDICT(ed);	// make sure it's in range
+#endif
+	ptr = (eval_t *)((int *)&ed->v + st->b->_int);
+	st->u.c->vector[0] = ptr->vector[0];
+	st->u.c->vector[1] = ptr->vector[1];
+	st->u.c->vector[2] = ptr->vector[2];
+	st[1].b->vector[0] = st[1].a->vector[0];
+	st[1].b->vector[1] = st[1].a->vector[1];
+	st[1].b->vector[2] = st[1].a->vector[2];
+	NEXT2();
+
+    OPCODE(OP_EQ_F_IFNOT):
+	FUSED(OP_EQ_F_IFNOT);
+	st->u.c->_float = st->a->_float == st->b->_float;
+	BRANCH2(!st[1].a->_int);
+    OPCODE(OP_NE_F_IFNOT):
+	FUSED(OP_NE_F_IFNOT);
+	st->u.c->_float = st->a->_float != st->b->_float;
+	BRANCH2(!st[1].a->_int);
+    OPCODE(OP_EQ_E_IFNOT):
+	FUSED(OP_EQ_E_IFNOT);
+	st->u.c->_float = st->a->_int == st->b->_int;
+	BRANCH2(!st[1].a->_int);
+    OPCODE(OP_NE_E_IFNOT):
+	FUSED(OP_NE_E_IFNOT);
+	st->u.c->_float = st->a->_int != st->b->_int;
+	BRANCH2(!st[1].a->_int);
+    OPCODE(OP_LE_IFNOT):
+	FUSED(OP_LE_IFNOT);
+	st->u.c->_float = st->a->_float <= st->b->_float;
+	BRANCH2(!st[1].a->_int);
+    OPCODE(OP_GE_IFNOT):
+	FUSED(OP_GE_IFNOT);
+	st->u.c->_float = st->a->_float >= st->b->_float;
+	BRANCH2(!st[1].a->_int);
+    OPCODE(OP_LT_IFNOT):
+	FUSED(OP_LT_IFNOT);
+	st->u.c->_float = st->a->_float < st->b->_float;
+	BRANCH2(!st[1].a->_int);
+    OPCODE(OP_GT_IFNOT):
+	FUSED(OP_GT_IFNOT);
+	st->u.c->_float = st->a->_float > st->b->_float;
+	BRANCH2(!st[1].a->_int);
+    OPCODE(OP_BITAND_IF):
+	FUSED(OP_BITAND_IF);
+	st->u.c->_float = (int)st->a->_float & (int)st->b->_float;
+	BRANCH2(st[1].a->_int);
+    OPCODE(OP_BITAND_IFNOT):
+	FUSED(OP_BITAND_IFNOT);
+	st->u.c->_float = (int)st->a->_float & (int)st->b->_float;
+	BRANCH2(!st[1].a->_int);
+
+    OPCODE(OP_ADD_F_STORE):
+	FUSED(OP_ADD_F_STORE);
+	st->u.c->_float = st->a->_float + st->b->_float;
+	st[1].b->_int = st[1].a->_int;
+	NEXT2();
+    OPCODE(OP_SUB_F_STORE):
+	FUSED(OP_SUB_F_STORE);
+	st->u.c->_float = st->a->_float - st->b->_float;
+	st[1].b->_int = st[1].a->_int;
+	NEXT2();
+    OPCODE(OP_MUL_F_STORE):
+	FUSED(OP_MUL_F_STORE);
+	st->u.c->_float = st->a->_float * st->b->_float;
+	st[1].b->_int = st[1].a->_int;
+	NEXT2();
+    OPCODE(OP_ADD_V_STORE_V):
+	FUSED(OP_ADD_V_STORE_V);
+	st->u.c->vector[0] = st->a->vector[0] + st->b->vector[0];
+	st->u.c->vector[1] = st->a->vector[1] + st->b->vector[1];
+	st->u.c->vector[2] = st->a->vector[2] + st->b->vector[2];
+	goto store_v2;
+    OPCODE(OP_SUB_V_STORE_V):
+	FUSED(OP_SUB_V_STORE_V);
+	st->u.c->vector[0] = st->a->vector[0] - st->b->vector[0];
+	st->u.c->vector[1] = st->a->vector[1] - st->b->vector[1];
+	st->u.c->vector[2] = st->a->vector[2] - st->b->vector[2];
+	goto store_v2;
+    OPCODE(OP_MUL_VF_STORE_V):
+	FUSED(OP_MUL_VF_STORE_V);
+	st->u.c->vector[0] = st->b->_float * st->a->vector[0];
+	st->u.c->vector[1] = st->b->_float * st->a->vector[1];
+	st->u.c->vector[2] = st->b->_float * st->a->vector[2];
+	goto store_v2;
+    OPCODE(OP_MUL_FV_STORE_V):
+	FUSED(OP_MUL_FV_STORE_V);
+	st->u.c->vector[0] = st->a->_float * st->b->vector[0];
+	st->u.c->vector[1] = st->a->_float * st->b->vector[1];
+	st->u.c->vector[2] = st->a->_float * st->b->vector[2];
+    store_v2:
+	st[1].b->vector[0] = st[1].a->vector[0];
+	st[1].b->vector[1] = st[1].a->vector[1];
+	st[1].b->vector[2] = st[1].a->vector[2];
+	NEXT2();
+
+    OPCODE(OP_BADBRANCH):
+	SYNC();
+	PR_RunError("Bad branch target");
+	return;
 
+    OPCODE(OP_PASTEND):
+	st--;
+	SYNC();
+	PR_RunError("Ran past the last statement");
+	return;
 
-	case OP_GE:
-	    c->_float = a->_float >= b->_float;
-	    break;
-	case OP_LE:
-	    c->_float = a->_float <= b->_float;
-	    break;
-	case OP_GT:
-	    c->_float = a->_float > b->_float;
-	    break;
-	case OP_LT:
-	    c->_float = a->_float < b->_float;
-	    break;
-	case OP_AND:
-	    c->_float = a->_float && b->_float;
-	    break;
-	case OP_OR:
-	    c->_float = a->_float || b->_float;
-	    break;
+#ifndef PR_THREADED
+    default:
+#endif
+    OPCODE(OP_BADOP):
+	SYNC();
+	PR_RunError("Bad opcode %i", pr_statements[st - pr_code].op);
+	return;
+#ifndef PR_THREADED
+    }
+#endif
+}
 
-	case OP_NOT_F:
-	    c->_float = !a->_float;
-	    break;
-	case OP_NOT_V:
-	    c->_float = !a->vector[0] && !a->vector[1] && !a->vector[2];
-	    break;
-	case OP_NOT_S:
-	    c->_float = !a->string || !*PR_GetString(a->string);
-	    break;
-	case OP_NOT_FNC:
-	    c->_float = !a->function;
-	    break;
-	case OP_NOT_ENT:
-	    c->_float = (PROG_TO_EDICT(a->edict) == sv.edicts);
-	    break;
+/*
+====================
+PR_ExecuteProgram
+====================
+*/
+#ifdef QW_HACK
+double pr_exectime;
+#endif
 
-	case OP_EQ_F:
-	    c->_float = a->_float == b->_float;
-	    break;
-	case OP_EQ_V:
-	    c->_float = (a->vector[0] == b->vector[0]) &&
-		(a->vector[1] == b->vector[1]) &&
-		(a->vector[2] == b->vector[2]);
-	    break;
-	case OP_EQ_S:
-	    c->_float =
-		!strcmp(PR_GetString(a->string), PR_GetString(b->string));
-	    break;
-	case OP_EQ_E:
-	    c->_float = a->_int == b->_int;
-	    break;
-	case OP_EQ_FNC:
-	    c->_float = a->function == b->function;
-	    break;
+void
+PR_ExecuteProgram(func_t fnum)
+{
+#ifdef QW_HACK
+    double start = Sys_DoubleTime();
 
-	case OP_NE_F:
-	    c->_float = a->_float != b->_float;
-	    break;
-	case OP_NE_V:
-	    c->_float = (a->vector[0] != b->vector[0]) ||
-		(a->vector[1] != b->vector[1]) ||
-		(a->vector[2] != b->vector[2]);
-	    break;
-	case OP_NE_S:
-	    c->_float =
-		strcmp(PR_GetString(a->string), PR_GetString(b->string));
-	    break;
-	case OP_NE_E:
-	    c->_float = a->_int != b->_int;
+    PR_Execute(fnum, NULL);
+    pr_exectime += Sys_DoubleTime() - start;
+#else
+    PR_Execute(fnum, NULL);
+#endif
+}
+
+/*
+ * The superinstruction for statement 'first' followed by 'second', or 0 if
+ * they don't make one. Both must have decoded normally, and the second
+ * must use the result of the first.
+ */
+static int
+PR_FuseStatements(const dstatement_t *first, int firstop,
+		  const dstatement_t *second, int secondop)
+{
+    if (firstop != first->op || secondop != second->op)
+	return 0;
+
+    switch (first->op) {
+    case OP_ADDRESS:
+	if (second->b != first->c)
 	    break;
-	case OP_NE_FNC:
-	    c->_float = a->function != b->function;
+	if (second->op == OP_STOREP_V)
+	    return OP_ADDRESS_STOREP_V;
+	if (second->op >= OP_STOREP_F && second->op <= OP_STOREP_FNC)
+	    return OP_ADDRESS_STOREP;
+	break;
+    case OP_LOAD_F:
+    case OP_LOAD_FLD:
+    case OP_LOAD_ENT:
+    case OP_LOAD_S:
+    case OP_LOAD_FNC:
+	if (second->a != first->c)
 	    break;
-
-//==================
-	case OP_STORE_F:
-	case OP_STORE_ENT:
-	case OP_STORE_FLD:	// integers
-	case OP_STORE_S:
-	case OP_STORE_FNC:	// pointers
-	    b->_int = a->_int;
+	if (second->op == OP_IF)
+	    return OP_LOAD_IF;
+	if (second->op == OP_IFNOT)
+	    return OP_LOAD_IFNOT;
+	break;
+    case OP_LOAD_V:
+	if (second->op == OP_STORE_V && second->a == first->c)
+	    return OP_LOAD_STORE_V;
+	break;
+    case OP_BITAND:
+	if (second->a != first->c)
 	    break;
-	case OP_STORE_V:
-	    b->vector[0] = a->vector[0];
-	    b->vector[1] = a->vector[1];
-	    b->vector[2] = a->vector[2];
+	if (second->op == OP_IF)
+	    return OP_BITAND_IF;
+	if (second->op == OP_IFNOT)
+	    return OP_BITAND_IFNOT;
+	break;
+    case OP_EQ_F:
+    case OP_NE_F:
+    case OP_EQ_E:
+    case OP_NE_E:
+    case OP_LE:
+    case OP_GE:
+    case OP_LT:
+    case OP_GT:
+	if (second->op != OP_IFNOT || second->a != first->c)
 	    break;
-
-	case OP_STOREP_F:
-	case OP_STOREP_ENT:
-	case OP_STOREP_FLD:	// integers
-	case OP_STOREP_S:
-	case OP_STOREP_FNC:	// pointers
-	    ptr = (eval_t *)((byte *)sv.edicts + b->_int);
-	    ptr->_int = a->_int;
+	switch (first->op) {
+	case OP_EQ_F: return OP_EQ_F_IFNOT;
+	case OP_NE_F: return OP_NE_F_IFNOT;
+	case OP_EQ_E: return OP_EQ_E_IFNOT;
+	case OP_NE_E: return OP_NE_E_IFNOT;
+	case OP_LE: return OP_LE_IFNOT;
+	case OP_GE: return OP_GE_IFNOT;
+	case OP_LT: return OP_LT_IFNOT;
+	default: return OP_GT_IFNOT;
+	}
+    case OP_ADD_F:
+    case OP_SUB_F:
+    case OP_MUL_F:
+	if (second->op != OP_STORE_F || second->a != first->c)
 	    break;
-	case OP_STOREP_V:
-	    ptr = (eval_t *)((byte *)sv.edicts + b->_int);
-	    ptr->vector[0] = a->vector[0];
-	    ptr->vector[1] = a->vector[1];
-	    ptr->vector[2] = a->vector[2];
+	return first->op == OP_ADD_F ? OP_ADD_F_STORE :
+	    first->op == OP_SUB_F ? OP_SUB_F_STORE : OP_MUL_F_STORE;
+    case OP_ADD_V:
+    case OP_SUB_V:
+    case OP_MUL_VF:
+    case OP_MUL_FV:
+	if (second->op != OP_STORE_V || second->a != first->c)
 	    break;
+	return first->op == OP_ADD_V ? OP_ADD_V_STORE_V :
+	    first->op == OP_SUB_V ? OP_SUB_V_STORE_V :
+	    first->op == OP_MUL_VF ? OP_MUL_VF_STORE_V : OP_MUL_FV_STORE_V;
+    }
 
-	case OP_ADDRESS:
-	    ed = PROG_TO_EDICT(a->edict);
-#ifdef PARANOID
-	    NUM_FOR_EDICT(ed);	// make sure it's in range
-#endif
-	    if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
-		PR_RunError("assignment to world entity");
-	    c->_int = (byte *)((int *)&ed->v + b->_int) - (byte *)sv.edicts;
-	    break;
+    return 0;
+}
 
-	case OP_LOAD_F:
-	case OP_LOAD_FLD:
-	case OP_LOAD_ENT:
-	case OP_LOAD_S:
-	case OP_LOAD_FNC:
-	    ed = PROG_TO_EDICT(a->edict);
-#ifdef PARANOID
-	    NUM_FOR_EDICT(ed);	// make sure it's in range
-#endif
-	    a = (eval_t *)((int *)&ed->v + b->_int);
-	    c->_int = a->_int;
-	    break;
+static int
+PR_CompareLocals(const void *a, const void *b)
+{
+    const dfunction_t *f1 = &pr_functions[*(const int *)a];
+    const dfunction_t *f2 = &pr_functions[*(const int *)b];
 
-	case OP_LOAD_V:
-	    ed = PROG_TO_EDICT(a->edict);
-#ifdef PARANOID
-	    NUM_FOR_EDICT(ed);	// make sure it's in range
-#endif
-	    a = (eval_t *)((int *)&ed->v + b->_int);
-	    c->vector[0] = a->vector[0];
-	    c->vector[1] = a->vector[1];
-	    c->vector[2] = a->vector[2];
-	    break;
+    return f1->parm_start - f2->parm_start;
+}
 
-//==================
+/*
+ * Works out which functions have to save their locals on every call: the
+ * ones whose locals overlap another's, and the ones whose locals don't
+ * start out zeroed.
+ */
+static void
+PR_SetupFunctions(void)
+{
+    const dfunction_t *f, *prev;
+    prfuncinfo_t *info;
+    int i, j, count, end, *order;
+
+    pr_funcinfo = Hunk_AllocName(progs->numfunctions * sizeof(prfuncinfo_t),
+				 "prfuncs");
+    order = malloc(progs->numfunctions * sizeof(int));
+    if (!order)
+	Sys_Error("%s: out of memory", __func__);
+
+    count = 0;
+    for (i = 0; i < progs->numfunctions; i++) {
+	f = &pr_functions[i];
+	info = &pr_funcinfo[i];
+	for (j = 0; j < f->numparms && j < MAX_PARMS; j++)
+	    info->parmsize += f->parm_size[j];
+	if (f->first_statement < 0 || f->locals <= 0)
+	    continue;
+	if (f->parm_start < 0 || f->parm_start + f->locals > progs->numglobals) {
+	    info->save = true;
+	    continue;
+	}
+	for (j = info->parmsize; j < f->locals; j++)
+	    if (((int *)pr_globals)[f->parm_start + j])
+		info->save = true;
+	order[count++] = i;
+    }
 
-	case OP_IFNOT:
-	    if (!a->_int)
-		s += st->b - 1;	// offset the s++
-	    break;
+    qsort(order, count, sizeof(int), PR_CompareLocals);
+    prev = NULL;
+    end = 0;
+    for (i = 0; i < count; i++) {
+	f = &pr_functions[order[i]];
+	if (prev && f->parm_start < end) {
+	    pr_funcinfo[order[i]].save = true;
+	    pr_funcinfo[prev - pr_functions].save = true;
+	}
+	if (!prev || f->parm_start + f->locals > end) {
+	    prev = f;
+	    end = f->parm_start + f->locals;
+	}
+    }
 
-	case OP_IF:
-	    if (a->_int)
-		s += st->b - 1;	// offset the s++
-	    break;
+    free(order);
+}
 
-	case OP_GOTO:
-	    s += st->a - 1;	// offset the s++
-	    break;
+/*
+====================
+PR_DecodeStatements
 
-	case OP_CALL0:
-	case OP_CALL1:
-	case OP_CALL2:
-	case OP_CALL3:
-	case OP_CALL4:
-	case OP_CALL5:
-	case OP_CALL6:
-	case OP_CALL7:
-	case OP_CALL8:
-	    pr_argc = st->op - OP_CALL0;
-	    if (!a->function)
-		PR_RunError("NULL function");
-
-	    newf = &pr_functions[a->function];
-
-	    /* negative statements are built in functions */
-	    if (newf->first_statement < 0) {
-		i = -newf->first_statement;
-		if (i >= pr_numbuiltins)
-		    PR_RunError("Bad builtin call number");
-		pr_builtins[i] ();
-		break;
+Called by PR_LoadProgs once the statements are in host byte order
+====================
+*/
+void
+PR_DecodeStatements(void)
+{
+    const void *const *handlers = NULL;
+    const dstatement_t *st;
+    prstatement_t *code;
+    int i, op, prevop, fused, target, numstatements;
+
+    PR_Execute(0, &handlers);
+    PR_SetupFunctions();
+
+    numstatements = progs->numstatements;
+    pr_code = Hunk_AllocName((numstatements + 1) * sizeof(prstatement_t),
+			     "prcode");
+    pr_fused = Hunk_AllocName(numstatements + 1, "prcode");
+    memset(pr_fusedsites, 0, sizeof(pr_fusedsites));
+    memset(pr_fusedruns, 0, sizeof(pr_fusedruns));
+    prevop = OP_BADOP;
+    for (i = 0; i <= numstatements; i++) {
+	code = &pr_code[i];
+	if (i == numstatements) {
+	    op = OP_PASTEND;
+	} else {
+	    st = &pr_statements[i];
+	    op = st->op <= OP_BITOR ? st->op : OP_BADOP;
+	    code->a = (eval_t *)&pr_globals[st->a];
+	    code->b = (eval_t *)&pr_globals[st->b];
+	    code->u.c = (eval_t *)&pr_globals[st->c];
+	    if (op == OP_IF || op == OP_IFNOT || op == OP_GOTO) {
+		target = i + (op == OP_GOTO ? st->a : st->b);
+		if (target >= 0 && target < numstatements)
+		    code->u.jump = &pr_code[target];
+		else
+		    op = OP_BADBRANCH;
 	    }
+	}
+#ifdef PR_THREADED
+	code->handler = handlers[op];
+#else
+	code->op = op;
+#endif
 
-	    s = PR_EnterFunction(newf);
-	    break;
+	/* the one before may make a superinstruction with this */
+	if (i && i < numstatements) {
+	    fused = PR_FuseStatements(&pr_statements[i - 1], prevop,
+				      &pr_statements[i], op);
+	    if (fused) {
+#ifdef PR_THREADED
+		code[-1].handler = handlers[fused];
+#else
+		code[-1].op = fused;
+#endif
+		pr_fused[i - 1] = true;
+		pr_fusedsites[fused - OP_FUSED]++;
+	    }
+	}
+	prevop = op;
+    }
+}
 
-	case OP_DONE:
-	case OP_RETURN:
-	    pr_globals[OFS_RETURN] = pr_globals[st->a];
-	    pr_globals[OFS_RETURN + 1] = pr_globals[st->a + 1];
-	    pr_globals[OFS_RETURN + 2] = pr_globals[st->a + 2];
+/*
+============
+PR_Fusions_f
 
-	    s = PR_LeaveFunction();
-	    if (pr_depth == exitdepth)
-		return;		// all done
-	    break;
+Shows how often each superinstruction ran since the last time
+============
+*/
+void
+PR_Fusions_f(void)
+{
+    int i;
 
-	case OP_STATE:
-	    ed = PROG_TO_EDICT(pr_global_struct->self);
-	    ed->v.nextthink = pr_global_struct->time + 0.1;
-	    if (a->_float != ed->v.frame) {
-		ed->v.frame = a->_float;
-	    }
-	    ed->v.think = b->function;
-	    break;
+    if (!progs)
+	return;
 
-	default:
-	    PR_RunError("Bad opcode %i", st->op);
-	}
+    Con_Printf("  sites    runs superinstruction\n");
+    for (i = 0; i < PR_NUMFUSED; i++) {
+	if (!pr_fusedsites[i])
+	    continue;
+	Con_Printf("%7i %7u %s\n", pr_fusedsites[i], pr_fusedruns[i],
+		   pr_fusednames[i]);
+	pr_fusedruns[i] = 0;
     }
 }
 
@@ -687,15 +1574,159 @@ static const char **pr_strtbl = NULL;
 static int pr_strtbl_size;
 static int num_prstr;
 
+/*
+ * Open addressing indexes, each a power of two in size and kept under half
+ * full. pr_strtblhash maps a pointer to its index in pr_strtbl plus one (0
+ * for an empty slot). pr_strpool holds strings that never change, by their
+ * contents: all those of the progs and the copies made by PR_InternString.
+ */
+static int *pr_strtblhash;
+static int pr_strtblhashsize;
+static const char **pr_strpool;
+static int pr_strpoolsize;
+static int pr_strpoolcount;
+
+/* For pr_strings: copies avoided by PR_InternString and their size */
+static int pr_strsharedcount;
+static int pr_strsharedbytes;
+
+static unsigned
+PR_StringHash(const char *s)
+{
+    unsigned hash = 2166136261u;
+
+    while (*s)
+	hash = (hash ^ (byte)*s++) * 16777619u;
+
+    return hash;
+}
+
+static unsigned
+PR_PointerHash(const char *s)
+{
+    uintptr_t p = (uintptr_t)s;
+
+    return (unsigned)(p ^ (p >> 32)) * 2654435761u;
+}
+
+static void
+PR_HashStrtbl(void)
+{
+    int i, slot, mask;
+
+    for (pr_strtblhashsize = 16; pr_strtblhashsize < pr_strtbl_size * 2;)
+	pr_strtblhashsize <<= 1;
+    pr_strtblhash = realloc(pr_strtblhash, pr_strtblhashsize * sizeof(int));
+    if (!pr_strtblhash)
+	Sys_Error("%s: out of memory", __func__);
+    memset(pr_strtblhash, 0, pr_strtblhashsize * sizeof(int));
+
+    mask = pr_strtblhashsize - 1;
+    for (i = 0; i < num_prstr; i++) {
+	slot = PR_PointerHash(pr_strtbl[i]) & mask;
+	while (pr_strtblhash[slot])
+	    slot = (slot + 1) & mask;
+	pr_strtblhash[slot] = i + 1;
+    }
+}
+
+/*
+ * Returns the slot for s in the pool, either holding an equal string or
+ * empty
+ */
+static int
+PR_PoolSlot(const char *s)
+{
+    int slot, mask = pr_strpoolsize - 1;
+
+    slot = PR_StringHash(s) & mask;
+    while (pr_strpool[slot] && strcmp(pr_strpool[slot], s))
+	slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+static void
+PR_PoolAdd(int slot, const char *s)
+{
+    const char **old;
+    int i, oldsize;
+
+    pr_strpool[slot] = s;
+    if (++pr_strpoolcount * 2 < pr_strpoolsize)
+	return;
+
+    old = pr_strpool;
+    oldsize = pr_strpoolsize;
+    pr_strpoolsize <<= 1;
+    pr_strpool = calloc(pr_strpoolsize, sizeof(*pr_strpool));
+    if (!pr_strpool)
+	Sys_Error("%s: out of memory", __func__);
+    for (i = 0; i < oldsize; i++)
+	if (old[i])
+	    pr_strpool[PR_PoolSlot(old[i])] = old[i];
+    free(old);
+}
+
+/*
+ * Called once pr_strings is set up for new progs
+ */
 void
 PR_InitStringTable(void)
 {
+    const char *s;
+    int ofs, slot;
+
     if (pr_strtbl) {
 	Z_Free(pr_strtbl);
 	pr_strtbl = NULL;
     }
     pr_strtbl_size = 0;
     num_prstr = 0;
+    PR_HashStrtbl();
+
+    free(pr_strpool);
+    pr_strpoolsize = 1024;
+    pr_strpool = calloc(pr_strpoolsize, sizeof(*pr_strpool));
+    if (!pr_strpool)
+	Sys_Error("%s: out of memory", __func__);
+    pr_strpoolcount = 0;
+    pr_strsharedcount = pr_strsharedbytes = 0;
+
+    /* the first of any string repeated in the progs is kept */
+    for (ofs = 0; ofs < pr_strings_size - 1; ofs += strlen(s) + 1) {
+	s = pr_strings + ofs;
+	if (!memchr(s, 0, pr_strings_size - ofs))
+	    break;
+	slot = PR_PoolSlot(s);
+	if (!pr_strpool[slot])
+	    PR_PoolAdd(slot, s);
+    }
+}
+
+/*
+ * Number of entries in the string table. It only ever grows until the next
+ * map, so a string index saved earlier stays valid while this is larger.
+ */
+int
+PR_NumStrings(void)
+{
+    return num_prstr;
+}
+
+const char *
+PR_InternString(const char *s, int size)
+{
+    int slot = PR_PoolSlot(s);
+
+    if (pr_strpool[slot]) {
+	pr_strsharedcount++;
+	pr_strsharedbytes += size;
+	return pr_strpool[slot];
+    }
+    PR_PoolAdd(slot, s);
+
+    return s;
 }
 
 const char *
@@ -723,21 +1754,61 @@ PR_GetString(int num)
 int
 PR_SetString(const char *s)
 {
-    int i;
+    int slot, mask;
 
     if (s - pr_strings < 0 || s - pr_strings > pr_strings_size - 2) {
-	for (i = 0; i < num_prstr; i++)
-	    if (pr_strtbl[i] == s)
-		break;
-	if (i < num_prstr)
-	    return -i - 1;
+	mask = pr_strtblhashsize - 1;
+	slot = PR_PointerHash(s) & mask;
+	for (; pr_strtblhash[slot]; slot = (slot + 1) & mask)
+	    if (pr_strtbl[pr_strtblhash[slot] - 1] == s)
+		return -pr_strtblhash[slot];
 	if (num_prstr == pr_strtbl_size) {
 	    pr_strtbl_size += PR_STRTBL_CHUNK;
 	    pr_strtbl = (const char**)Z_Realloc(pr_strtbl, pr_strtbl_size * sizeof(char *));
 	}
 	pr_strtbl[num_prstr] = s;
 	num_prstr++;
+	if (num_prstr * 2 > pr_strtblhashsize)
+	    PR_HashStrtbl();
+	else
+	    pr_strtblhash[slot] = num_prstr;
 	return -num_prstr;
     }
     return (int)(s - pr_strings);
 }
+
+/*
+ * True if string num can't change: a progs string or one whose contents
+ * were pooled by PR_InternString. Others may be in a buffer the engine
+ * reuses, like the one ftos returns.
+ */
+qboolean
+PR_IsStableString(int num)
+{
+    const char *s;
+
+    if (num >= 0 && num < pr_strings_size - 1)
+	return true;
+    if (num >= 0 || num < -num_prstr)
+	return false;
+
+    s = pr_strtbl[-num - 1];
+    return pr_strpoolsize && pr_strpool[PR_PoolSlot(s)] == s;
+}
+
+/*
+============
+PR_Strings_f
+============
+*/
+void
+PR_Strings_f(void)
+{
+    if (!progs)
+	return;
+
+    Con_Printf("%iK of progs strings, %i more strings in the table\n",
+	       pr_strings_size / 1024, num_prstr);
+    Con_Printf("%i distinct strings pooled, %i copies shared (%iK saved)\n",
+	       pr_strpoolcount, pr_strsharedcount, pr_strsharedbytes / 1024);
+}
@@ -0,0 +1,896 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// pr_jit.c -- compiles hot QuakeC functions to native code
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "console.h"
+#include "cvar.h"
+#include "mathlib.h"
+#include "pr_comp.h"
+#include "progs.h"
+#include "server.h"
+#include "sys.h"
+#include "zone.h"
+
+#ifdef NQ_HACK
+#include "host.h"
+#include "quakedef.h"
+#endif
+#ifdef QW_HACK
+#include "qwsvdef.h"
+#endif
+
+/*
+ * Only the System V x86-64 calling convention is implemented, and the
+ * code buffer needs mprotect. Elsewhere everything is interpreted.
+ */
+#if defined(__x86_64__) && !defined(_WIN32) && defined(HAVE_MMAP)
+#define PR_JIT
+#endif
+
+cvar_t pr_jit = { "pr_jit", "0" };
+
+#ifdef PR_JIT
+
+#include <sys/mman.h>
+
+/*
+ * A function is compiled once it has run this many statements in the
+ * interpreter, as counted for PR_Profile_f
+ */
+#define JIT_HOT_STATEMENTS 5000
+
+#define JIT_ARENA_SIZE (8 * 1024 * 1024)
+#define JIT_MAX_STATEMENT 256	/* most bytes compiled for one statement */
+#define JIT_RUNAWAY 1000000
+
+typedef void (*jitfunc_t)(void);
+
+typedef enum { JIT_UNTRIED, JIT_COMPILED, JIT_FAILED } jitstate_t;
+
+static byte *jit_arena;
+static int jit_used;		/* bytes of the arena holding code */
+
+/* Per function of the loaded progs */
+static jitfunc_t *jit_code;
+static byte *jit_state;
+
+/* Scratch for the compiler, per statement of the loaded progs */
+#define JIT_REACHED 1
+#define JIT_LEADER 2		/* starts a basic block */
+static byte *jit_flags;
+static int *jit_offsets;	/* of each statement's code, from the start */
+static int *jit_work;		/* worklist, then branch fixups */
+
+/* The code being written */
+static byte *jit_start;
+static byte *jit_p;
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13,
+    R14, R15
+};
+enum { XMM0, XMM1 };
+
+/*
+ * Register use in compiled code: r14 holds pr_globals, r15 sv.edicts, r13
+ * the function's profile counter and r12 the statements left before it is
+ * a runaway loop. rbx is only saved to keep the stack aligned for calls.
+ */
+#define GLOBALS R14
+#define EDICTS R15
+#define PROFILE R13
+#define RUNAWAY R12
+
+/* condition codes */
+#define CC_B  0x2
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_A  0x7
+#define CC_P  0xa
+#define CC_NP 0xb
+#define CC_G  0xf
+
+static void
+Emit1(int b)
+{
+    *jit_p++ = b;
+}
+
+static void
+Emit4(int v)
+{
+    memcpy(jit_p, &v, 4);
+    jit_p += 4;
+}
+
+static void
+Emit8(const void *p)
+{
+    uint64_t v = (uintptr_t)p;
+
+    memcpy(jit_p, &v, 8);
+    jit_p += 8;
+}
+
+/*
+ * An instruction with a ModRM operand. Opcodes above 0xff are two bytes,
+ * 0x0f and the low byte. 'w' selects 64 bit operands.
+ */
+static void
+EmitOpcode(int prefix, int w, int opcode, int reg, int index, int base)
+{
+    int rex = (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+
+    if (prefix)
+	Emit1(prefix);
+    if (rex)
+	Emit1(0x40 | rex);
+    if (opcode > 0xff)
+	Emit1(opcode >> 8);
+    Emit1(opcode & 0xff);
+}
+
+/* reg, [base + disp] */
+static void
+EmitMem(int prefix, int w, int opcode, int reg, int base, int disp)
+{
+    EmitOpcode(prefix, w, opcode, reg, 0, base);
+    Emit1(0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP)
+	Emit1(0x24);
+    Emit4(disp);
+}
+
+/* reg, [base + index * (1 << scale) + disp] */
+static void
+EmitSib(int prefix, int w, int opcode, int reg, int base, int index,
+	int scale, int disp)
+{
+    EmitOpcode(prefix, w, opcode, reg, index, base);
+    Emit1(0x84 | ((reg & 7) << 3));
+    Emit1((scale << 6) | ((index & 7) << 3) | (base & 7));
+    Emit4(disp);
+}
+
+/* reg, rm */
+static void
+EmitReg(int prefix, int w, int opcode, int reg, int rm)
+{
+    EmitOpcode(prefix, w, opcode, reg, 0, rm);
+    Emit1(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* Offset of a global from GLOBALS */
+#define GOFS(o) ((o) * 4)
+
+static void
+LoadFloat(int xmm, int o)
+{
+    EmitMem(0xf3, 0, 0x0f10, xmm, GLOBALS, GOFS(o));	/* movss */
+}
+
+static void
+StoreFloat(int xmm, int o)
+{
+    EmitMem(0xf3, 0, 0x0f11, xmm, GLOBALS, GOFS(o));	/* movss */
+}
+
+/* addss, subss, mulss or divss with a global */
+static void
+FloatOp(int opcode, int xmm, int o)
+{
+    EmitMem(0xf3, 0, opcode, xmm, GLOBALS, GOFS(o));
+}
+
+#define ADDSS 0x0f58
+#define MULSS 0x0f59
+#define SUBSS 0x0f5c
+#define DIVSS 0x0f5e
+
+static void
+LoadInt(int reg, int o)
+{
+    EmitMem(0, 0, 0x8b, reg, GLOBALS, GOFS(o));		/* mov */
+}
+
+static void
+StoreInt(int reg, int o)
+{
+    EmitMem(0, 0, 0x89, reg, GLOBALS, GOFS(o));		/* mov */
+}
+
+static void
+SetCC(int cc, int reg8)
+{
+    Emit1(0x0f);
+    Emit1(0x90 | cc);
+    Emit1(0xc0 | reg8);
+}
+
+/* After a ucomiss, reg8 = (x == y), using tmp8 */
+static void
+SetEqual(int reg8, int tmp8)
+{
+    SetCC(CC_E, reg8);
+    SetCC(CC_NP, tmp8);
+    Emit1(0x20);		/* and reg8, tmp8 */
+    Emit1(0xc0 | (tmp8 << 3) | reg8);
+}
+
+/* After a ucomiss, reg8 = (x != y), using tmp8 */
+static void
+SetNotEqual(int reg8, int tmp8)
+{
+    SetCC(CC_NE, reg8);
+    SetCC(CC_P, tmp8);
+    Emit1(0x08);		/* or reg8, tmp8 */
+    Emit1(0xc0 | (tmp8 << 3) | reg8);
+}
+
+/* dl, combined into al with and (0x20) or or (0x08) */
+static void
+CombineBool(int opcode)
+{
+    Emit1(opcode);
+    Emit1(0xc0 | (RDX << 3) | RAX);
+}
+
+/* Global o compared with 0.0 */
+static void
+CompareZero(int o)
+{
+    LoadFloat(XMM0, o);
+    EmitReg(0, 0, 0x0f57, XMM1, XMM1);			/* xorps */
+    EmitReg(0, 0, 0x0f2e, XMM0, XMM1);			/* ucomiss */
+}
+
+/* Store al as 0.0 or 1.0 */
+static void
+StoreBool(int o)
+{
+    EmitReg(0, 0, 0x0fb6, RAX, RAX);			/* movzx eax, al */
+    EmitReg(0xf3, 0, 0x0f2a, XMM0, RAX);		/* cvtsi2ss */
+    StoreFloat(XMM0, o);
+}
+
+static void
+CallHelper(void (*helper)(int), int s)
+{
+    Emit1(0xb8 + RDI);					/* mov edi, s */
+    Emit4(s);
+    EmitOpcode(0, 1, 0xb8 + RAX, 0, 0, RAX);		/* mov rax, helper */
+    Emit8((const void *)helper);
+    Emit1(0xff);					/* call rax */
+    Emit1(0xd0);
+}
+
+/* jcc or jmp (cc < 0) to statement 'target', fixed up later */
+static void
+Jump(int cc, int target, int *numfixups)
+{
+    if (cc < 0) {
+	Emit1(0xe9);
+    } else {
+	Emit1(0x0f);
+	Emit1(0x80 | cc);
+    }
+    jit_work[(*numfixups)++] = jit_p - jit_start;
+    jit_work[(*numfixups)++] = target;
+    Emit4(0);
+}
+
+static void
+Epilogue(void)
+{
+    Emit1(0x41); Emit1(0x58 + (R15 & 7));		/* pop r15 */
+    Emit1(0x41); Emit1(0x58 + (R14 & 7));		/* pop r14 */
+    Emit1(0x41); Emit1(0x58 + (R13 & 7));		/* pop r13 */
+    Emit1(0x41); Emit1(0x58 + (R12 & 7));		/* pop r12 */
+    Emit1(0x58 + RBX);					/* pop rbx */
+    Emit1(0xc3);					/* ret */
+}
+
+/*
+ * Helpers the compiled code calls for anything uncommon. They take the
+ * statement being run, so that errors are reported against it.
+ */
+static void
+PR_JitRunaway(int s)
+{
+    pr_xstatement = s;
+    PR_RunError("runaway loop error");
+}
+
+static void
+PR_JitWorldAddress(int s)
+{
+    if (sv.state == ss_active) {
+	pr_xstatement = s;
+	PR_RunError("assignment to world entity");
+    }
+}
+
+static void
+PR_JitFieldStored(int s)
+{
+    const dstatement_t *st = &pr_statements[s];
+
+    ED_FieldStored(G_INT(st->a), G_INT(st->b));
+}
+
+static void
+PR_JitCall(int s)
+{
+    const dstatement_t *st = &pr_statements[s];
+    dfunction_t *newf;
+    func_t fnum;
+    int i;
+
+    pr_xstatement = s;
+    pr_argc = st->op - OP_CALL0;
+    fnum = G_FUNCTION(st->a);
+    if (!fnum)
+	PR_RunError("NULL function");
+    if ((unsigned)fnum >= progs->numfunctions)
+	PR_RunError("Bad function %i", fnum);
+
+    newf = &pr_functions[fnum];
+
+    /* negative statements are built in functions */
+    if (newf->first_statement < 0) {
+	i = -newf->first_statement;
+	if (i >= pr_numbuiltins)
+	    PR_RunError("Bad builtin call number");
+	PR_CallBuiltin(i);
+	return;
+    }
+
+    if (!PR_JitExecute(newf))
+	PR_ExecuteProgram(fnum);
+}
+
+static void
+PR_JitString(int s)
+{
+    const dstatement_t *st = &pr_statements[s];
+    float result;
+
+    switch (st->op) {
+    case OP_NOT_S:
+	result = !G_INT(st->a) || !*G_STRING(st->a);
+	break;
+    case OP_EQ_S:
+	result = G_INT(st->a) == G_INT(st->b)
+	    || !strcmp(G_STRING(st->a), G_STRING(st->b));
+	break;
+    default:
+	result = G_INT(st->a) == G_INT(st->b) ? 0 :
+	    strcmp(G_STRING(st->a), G_STRING(st->b));
+	break;
+    }
+    G_FLOAT(st->c) = result;
+}
+
+static void
+PR_JitState(int s)
+{
+    const dstatement_t *st = &pr_statements[s];
+    edict_t *ed;
+
+    ed = PROG_TO_EDICT(pr_global_struct->self);
+    ED_Wake(pr_global_struct->self / pr_edict_size);
+    ed->v.nextthink = pr_global_struct->time + 0.1;
+    if (G_FLOAT(st->a) != ed->v.frame) {
+	ed->v.frame = G_FLOAT(st->a);
+    }
+    ed->v.think = G_FUNCTION(st->b);
+}
+
+static qboolean
+JitIsBlockEnd(int op)
+{
+    return op == OP_IF || op == OP_IFNOT || op == OP_GOTO
+	|| op == OP_RETURN || op == OP_DONE;
+}
+
+static void
+JitMark(int s, int flag, int *minstatement, int *maxstatement)
+{
+    jit_flags[s] |= flag;
+    *minstatement = qmin(*minstatement, s);
+    *maxstatement = qmax(*maxstatement, s);
+}
+
+/*
+ * Marks the statements reachable from the function's entry and the ones
+ * starting basic blocks, all within [minstatement, maxstatement]. Returns
+ * false if control can leave the statements or runs into one the
+ * interpreter would fail on.
+ */
+static qboolean
+JitFindStatements(int first, int *minstatement, int *maxstatement)
+{
+    const dstatement_t *st;
+    int s, target, numwork;
+
+    *minstatement = *maxstatement = first;
+    JitMark(first, JIT_LEADER, minstatement, maxstatement);
+    jit_work[0] = first;
+    numwork = 1;
+    while (numwork) {
+	s = jit_work[--numwork];
+	while (!(jit_flags[s] & JIT_REACHED)) {
+	    if (s >= progs->numstatements)
+		return false;
+	    JitMark(s, JIT_REACHED, minstatement, maxstatement);
+
+	    st = &pr_statements[s];
+	    if (st->op > OP_BITOR)
+		return false;
+	    if (st->op == OP_RETURN || st->op == OP_DONE)
+		break;
+	    if (st->op == OP_IF || st->op == OP_IFNOT || st->op == OP_GOTO) {
+		target = s + (st->op == OP_GOTO ? st->a : st->b);
+		if (target < 0 || target >= progs->numstatements)
+		    return false;
+		JitMark(target, JIT_LEADER, minstatement, maxstatement);
+		jit_work[numwork++] = target;
+		if (st->op == OP_GOTO)
+		    break;
+		JitMark(s + 1, JIT_LEADER, minstatement, maxstatement);
+	    }
+	    s++;
+	}
+    }
+
+    return true;
+}
+
+/*
+ * Number of statements in the basic block starting at s
+ */
+static int
+JitBlockLength(int s, int maxstatement)
+{
+    int length = 1;
+
+    while (!JitIsBlockEnd(pr_statements[s].op) && s < maxstatement
+	   && jit_flags[s + 1] == JIT_REACHED) {
+	s++;
+	length++;
+    }
+
+    return length;
+}
+
+static void
+JitStatement(int s, int *numfixups)
+{
+    const dstatement_t *st = &pr_statements[s];
+    byte *skip, *watch;
+    int i;
+
+    switch (st->op) {
+    case OP_ADD_F:
+    case OP_SUB_F:
+    case OP_MUL_F:
+    case OP_DIV_F:
+	LoadFloat(XMM0, st->a);
+	FloatOp(st->op == OP_ADD_F ? ADDSS : st->op == OP_SUB_F ? SUBSS :
+		st->op == OP_MUL_F ? MULSS : DIVSS, XMM0, st->b);
+	StoreFloat(XMM0, st->c);
+	break;
+    case OP_ADD_V:
+    case OP_SUB_V:
+	for (i = 0; i < 3; i++) {
+	    LoadFloat(XMM0, st->a + i);
+	    FloatOp(st->op == OP_ADD_V ? ADDSS : SUBSS, XMM0, st->b + i);
+	    StoreFloat(XMM0, st->c + i);
+	}
+	break;
+    case OP_MUL_V:
+	LoadFloat(XMM0, st->a);
+	FloatOp(MULSS, XMM0, st->b);
+	for (i = 1; i < 3; i++) {
+	    LoadFloat(XMM1, st->a + i);
+	    FloatOp(MULSS, XMM1, st->b + i);
+	    EmitReg(0xf3, 0, ADDSS, XMM0, XMM1);
+	}
+	StoreFloat(XMM0, st->c);
+	break;
+    case OP_MUL_FV:
+    case OP_MUL_VF:
+	for (i = 0; i < 3; i++) {
+	    if (st->op == OP_MUL_FV) {
+		LoadFloat(XMM0, st->a);
+		FloatOp(MULSS, XMM0, st->b + i);
+	    } else {
+		LoadFloat(XMM0, st->b);
+		FloatOp(MULSS, XMM0, st->a + i);
+	    }
+	    StoreFloat(XMM0, st->c + i);
+	}
+	break;
+
+    case OP_BITAND:
+    case OP_BITOR:
+	EmitMem(0xf3, 0, 0x0f2c, RAX, GLOBALS, GOFS(st->a));	/* cvttss2si */
+	EmitMem(0xf3, 0, 0x0f2c, RCX, GLOBALS, GOFS(st->b));
+	EmitReg(0, 0, st->op == OP_BITAND ? 0x21 : 0x09, RCX, RAX);
+	EmitReg(0xf3, 0, 0x0f2a, XMM0, RAX);		/* cvtsi2ss */
+	StoreFloat(XMM0, st->c);
+	break;
+
+    case OP_GE:
+    case OP_GT:
+	LoadFloat(XMM0, st->a);
+	EmitMem(0, 0, 0x0f2e, XMM0, GLOBALS, GOFS(st->b));	/* ucomiss */
+	SetCC(st->op == OP_GE ? CC_AE : CC_A, RAX);
+	StoreBool(st->c);
+	break;
+    case OP_LE:
+    case OP_LT:
+	LoadFloat(XMM0, st->b);
+	EmitMem(0, 0, 0x0f2e, XMM0, GLOBALS, GOFS(st->a));
+	SetCC(st->op == OP_LE ? CC_AE : CC_A, RAX);
+	StoreBool(st->c);
+	break;
+    case OP_AND:
+    case OP_OR:
+	CompareZero(st->a);
+	SetNotEqual(RAX, RCX);
+	CompareZero(st->b);
+	SetNotEqual(RDX, RCX);
+	CombineBool(st->op == OP_AND ? 0x20 : 0x08);
+	StoreBool(st->c);
+	break;
+
+    case OP_NOT_F:
+	CompareZero(st->a);
+	SetEqual(RAX, RCX);
+	StoreBool(st->c);
+	break;
+    case OP_NOT_V:
+	CompareZero(st->a);
+	SetEqual(RAX, RCX);
+	for (i = 1; i < 3; i++) {
+	    LoadFloat(XMM0, st->a + i);
+	    EmitReg(0, 0, 0x0f2e, XMM0, XMM1);
+	    SetEqual(RDX, RCX);
+	    CombineBool(0x20);
+	}
+	StoreBool(st->c);
+	break;
+    case OP_NOT_FNC:
+    case OP_NOT_ENT:
+	EmitMem(0, 0, 0x83, 7, GLOBALS, GOFS(st->a));	/* cmp [a], 0 */
+	Emit1(0);
+	SetCC(CC_E, RAX);
+	StoreBool(st->c);
+	break;
+
+    case OP_EQ_F:
+    case OP_NE_F:
+	LoadFloat(XMM0, st->a);
+	EmitMem(0, 0, 0x0f2e, XMM0, GLOBALS, GOFS(st->b));
+	if (st->op == OP_EQ_F)
+	    SetEqual(RAX, RCX);
+	else
+	    SetNotEqual(RAX, RCX);
+	StoreBool(st->c);
+	break;
+    case OP_EQ_V:
+    case OP_NE_V:
+	for (i = 0; i < 3; i++) {
+	    LoadFloat(XMM0, st->a + i);
+	    EmitMem(0, 0, 0x0f2e, XMM0, GLOBALS, GOFS(st->b + i));
+	    if (st->op == OP_EQ_V)
+		SetEqual(i ? RDX : RAX, RCX);
+	    else
+		SetNotEqual(i ? RDX : RAX, RCX);
+	    if (i)
+		CombineBool(st->op == OP_EQ_V ? 0x20 : 0x08);
+	}
+	StoreBool(st->c);
+	break;
+    case OP_EQ_E:
+    case OP_EQ_FNC:
+    case OP_NE_E:
+    case OP_NE_FNC:
+	LoadInt(RAX, st->a);
+	EmitMem(0, 0, 0x3b, RAX, GLOBALS, GOFS(st->b));	/* cmp */
+	SetCC(st->op == OP_EQ_E || st->op == OP_EQ_FNC ? CC_E : CC_NE, RAX);
+	StoreBool(st->c);
+	break;
+
+    case OP_NOT_S:
+    case OP_EQ_S:
+    case OP_NE_S:
+	CallHelper(PR_JitString, s);
+	break;
+
+    case OP_STORE_F:
+    case OP_STORE_ENT:
+    case OP_STORE_FLD:
+    case OP_STORE_S:
+    case OP_STORE_FNC:
+	LoadInt(RAX, st->a);
+	StoreInt(RAX, st->b);
+	break;
+    case OP_STORE_V:
+	for (i = 0; i < 3; i++) {
+	    LoadInt(RAX, st->a + i);
+	    StoreInt(RAX, st->b + i);
+	}
+	break;
+
+    case OP_STOREP_F:
+    case OP_STOREP_ENT:
+    case OP_STOREP_FLD:
+    case OP_STOREP_S:
+    case OP_STOREP_FNC:
+    case OP_STOREP_V:
+	EmitMem(0, 1, 0x63, RAX, GLOBALS, GOFS(st->b));	/* movsxd */
+	for (i = 0; i < (st->op == OP_STOREP_V ? 3 : 1); i++) {
+	    LoadInt(RCX, st->a + i);
+	    EmitSib(0, 0, 0x89, RCX, EDICTS, RAX, 0, i * 4);
+	}
+	break;
+
+    case OP_ADDRESS:
+	LoadInt(RAX, st->a);
+	EmitReg(0, 0, 0x85, RAX, RAX);			/* test */
+	Emit1(0x75);					/* jnz */
+	Emit1(0);
+	skip = jit_p;
+	CallHelper(PR_JitWorldAddress, s);
+	skip[-1] = jit_p - skip;
+
+	/* tell the edict code if this may store to a field it watches */
+	LoadInt(RAX, st->b);
+	EmitReg(0, 0, 0x81, 7, RAX);			/* cmp eax, i */
+	Emit4(ED_NUMWATCHED);
+	Emit1(0x73);					/* jae */
+	Emit1(0);
+	skip = jit_p;
+	EmitOpcode(0, 1, 0xb8 + RCX, 0, 0, RCX);	/* mov rcx, ed_fieldwatch */
+	Emit8(ed_fieldwatch);
+	EmitSib(0, 0, 0x80, 7, RCX, RAX, 0, 0);		/* cmp byte [rcx + rax], 0 */
+	Emit1(0);
+	Emit1(0x74);					/* je */
+	Emit1(0);
+	watch = jit_p;
+	CallHelper(PR_JitFieldStored, s);
+	skip[-1] = jit_p - skip;
+	watch[-1] = jit_p - watch;
+
+	LoadInt(RAX, st->a);
+	LoadInt(RCX, st->b);
+	EmitSib(0, 0, 0x8d, RAX, RAX, RCX, 2, offsetof(edict_t, v));	/* lea */
+	StoreInt(RAX, st->c);
+	break;
+
+    case OP_LOAD_F:
+    case OP_LOAD_FLD:
+    case OP_LOAD_ENT:
+    case OP_LOAD_S:
+    case OP_LOAD_FNC:
+    case OP_LOAD_V:
+	EmitMem(0, 1, 0x63, RAX, GLOBALS, GOFS(st->a));	/* movsxd */
+	EmitMem(0, 1, 0x63, RCX, GLOBALS, GOFS(st->b));
+	EmitSib(0, 1, 0x8d, RAX, RAX, RCX, 2, offsetof(edict_t, v));	/* lea */
+	for (i = 0; i < (st->op == OP_LOAD_V ? 3 : 1); i++) {
+	    EmitSib(0, 0, 0x8b, RDX, EDICTS, RAX, 0, i * 4);
+	    StoreInt(RDX, st->c + i);
+	}
+	break;
+
+    case OP_IF:
+    case OP_IFNOT:
+	LoadInt(RAX, st->a);
+	EmitReg(0, 0, 0x85, RAX, RAX);
+	Jump(st->op == OP_IF ? CC_NE : CC_E, s + st->b, numfixups);
+	break;
+    case OP_GOTO:
+	Jump(-1, s + st->a, numfixups);
+	break;
+
+    case OP_CALL0:
+    case OP_CALL1:
+    case OP_CALL2:
+    case OP_CALL3:
+    case OP_CALL4:
+    case OP_CALL5:
+    case OP_CALL6:
+    case OP_CALL7:
+    case OP_CALL8:
+	CallHelper(PR_JitCall, s);
+	break;
+
+    case OP_DONE:
+    case OP_RETURN:
+	for (i = 0; i < 3; i++) {
+	    LoadInt(RAX, st->a + i);
+	    StoreInt(RAX, OFS_RETURN + i);
+	}
+	Epilogue();
+	break;
+
+    case OP_STATE:
+	CallHelper(PR_JitState, s);
+	break;
+    }
+}
+
+/*
+ * Compiles a function into the arena, or returns NULL if it can't be
+ */
+static jitfunc_t
+PR_JitCompile(dfunction_t *f)
+{
+    int s, minstatement, maxstatement, numfixups, i, target;
+    qboolean found;
+    byte *skip;
+
+    found = JitFindStatements(f->first_statement, &minstatement, &maxstatement);
+    if (found && JIT_ARENA_SIZE - jit_used <
+	(maxstatement - minstatement + 2) * JIT_MAX_STATEMENT) {
+	Con_DPrintf("%s: out of code space\n", __func__);
+	found = false;
+    }
+    if (!found) {
+	memset(jit_flags + minstatement, 0, maxstatement - minstatement + 1);
+	return NULL;
+    }
+
+    if (mprotect(jit_arena, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE)) {
+	memset(jit_flags + minstatement, 0, maxstatement - minstatement + 1);
+	return NULL;
+    }
+
+    jit_start = jit_p = jit_arena + jit_used;
+
+    Emit1(0x50 + RBX);					/* push rbx */
+    Emit1(0x41); Emit1(0x50 + (R12 & 7));		/* push r12 */
+    Emit1(0x41); Emit1(0x50 + (R13 & 7));		/* push r13 */
+    Emit1(0x41); Emit1(0x50 + (R14 & 7));		/* push r14 */
+    Emit1(0x41); Emit1(0x50 + (R15 & 7));		/* push r15 */
+    EmitOpcode(0, 1, 0xb8 + (GLOBALS & 7), 0, 0, GLOBALS);	/* mov imm64 */
+    Emit8(pr_globals);
+    EmitOpcode(0, 1, 0xb8 + RAX, 0, 0, RAX);
+    Emit8(&sv.edicts);
+    EmitMem(0, 1, 0x8b, EDICTS, RAX, 0);
+    EmitOpcode(0, 1, 0xb8 + (PROFILE & 7), 0, 0, PROFILE);
+    Emit8(&f->profile);
+    EmitOpcode(0, 0, 0xb8 + (RUNAWAY & 7), 0, 0, RUNAWAY);	/* mov imm32 */
+    Emit4(JIT_RUNAWAY);
+
+    /* the entry point isn't always the first statement in memory */
+    numfixups = 0;
+    if (f->first_statement != minstatement)
+	Jump(-1, f->first_statement, &numfixups);
+
+    for (s = minstatement; s <= maxstatement; s++) {
+	if (!(jit_flags[s] & JIT_REACHED))
+	    continue;
+	jit_offsets[s] = jit_p - jit_start;
+	if (jit_flags[s] & JIT_LEADER) {
+	    i = JitBlockLength(s, maxstatement);
+	    EmitMem(0, 0, 0x81, 0, PROFILE, 0);		/* add [r13], i */
+	    Emit4(i);
+	    EmitReg(0, 0, 0x81, 5, RUNAWAY);		/* sub r12d, i */
+	    Emit4(i);
+	    Emit1(0x7f);				/* jg */
+	    Emit1(0);
+	    skip = jit_p;
+	    CallHelper(PR_JitRunaway, s);
+	    skip[-1] = jit_p - skip;
+	}
+	JitStatement(s, &numfixups);
+    }
+
+    for (i = 0; i < numfixups; i += 2) {
+	target = jit_offsets[jit_work[i + 1]];
+	s = target - (jit_work[i] + 4);
+	memcpy(jit_start + jit_work[i], &s, 4);
+    }
+
+    memset(jit_flags + minstatement, 0, maxstatement - minstatement + 1);
+    jit_used = (jit_p - jit_arena + 15) & ~15;
+    mprotect(jit_arena, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC);
+    __builtin___clear_cache((char *)jit_start, (char *)jit_p);
+
+    return (jitfunc_t)jit_start;
+}
+
+qboolean
+PR_JitExecute(dfunction_t *f)
+{
+    int fnum;
+
+    if (!pr_jit.value || pr_trace || !jit_code)
+	return false;
+
+    fnum = f - pr_functions;
+    if (!jit_code[fnum]) {
+	if (jit_state[fnum] != JIT_UNTRIED || f->profile < JIT_HOT_STATEMENTS)
+	    return false;
+	jit_code[fnum] = PR_JitCompile(f);
+	jit_state[fnum] = jit_code[fnum] ? JIT_COMPILED : JIT_FAILED;
+	if (!jit_code[fnum])
+	    return false;
+    }
+
+    PR_EnterFunction(f);
+    jit_code[fnum] ();
+    PR_LeaveFunction();
+
+    return true;
+}
+
+void
+PR_JitLoadProgs(void)
+{
+    int numstatements = progs->numstatements;
+
+    jit_code = NULL;
+    if (!jit_arena) {
+	jit_arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit_arena == MAP_FAILED) {
+	    jit_arena = NULL;
+	    Con_DPrintf("%s: no memory for code, interpreting\n", __func__);
+	    return;
+	}
+    }
+    jit_used = 0;
+
+    jit_code = Hunk_AllocName(progs->numfunctions * sizeof(jitfunc_t),
+			      "prjit");
+    jit_state = Hunk_AllocName(progs->numfunctions, "prjit");
+    jit_flags = Hunk_AllocName(numstatements + 1, "prjit");
+    jit_offsets = Hunk_AllocName(numstatements * sizeof(int), "prjit");
+    jit_work = Hunk_AllocName(2 * (numstatements + 1) * sizeof(int), "prjit");
+}
+
+#else /* PR_JIT */
+
+qboolean
+PR_JitExecute(dfunction_t *f)
+{
+    return false;
+}
+
+void
+PR_JitLoadProgs(void)
+{
+}
+
+#endif /* PR_JIT */
+
+void
+PR_JitInit(void)
+{
+    Cvar_RegisterVariable(&pr_jit);
+}
@@ -0,0 +1,451 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// prof.c -- per-frame timings of the main stages of a host frame
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "cvar.h"
+#include "prof.h"
+#include "quakedef.h"
+#include "sys.h"
+
+cvar_t host_speeds = { "host_speeds", "0" };	// set for running times
+
+static const char *prof_names[PROF_NUMSTAGES] = {
+    "frame", "server", "client", "render", "video", "sound"
+};
+
+static const char *prof_counternames[PROF_NUMCOUNTERS] = {
+    "edges", "surfs", "edgeshort", "surfshort", "styles", "built", "cached",
+    "evicted", "dlightsurfs", "dlightmarked"
+};
+
+typedef struct {
+    double start;			/* Sys_DoubleTime at Prof_BeginFrame */
+    float begin[PROF_NUMSTAGES];	/* from the frame start, < 0 if not run */
+    float time[PROF_NUMSTAGES];
+    int count[PROF_NUMCOUNTERS];
+} profframe_t;
+
+#define PROF_MAXPHASES 32
+
+typedef struct {
+    const char *name;
+    double start;
+} profphase_t;
+
+static profphase_t prof_phases[PROF_MAXPHASES + 1];	/* + the end */
+static int prof_numphases;
+static qboolean prof_startedup;
+
+static profframe_t prof_history[PROF_HISTORY];
+static int prof_numframes;	/* recorded since the last prof_clear */
+static int prof_forced;
+
+/* The frame being recorded */
+static qboolean prof_recording;
+static profframe_t prof_frame;
+static qboolean prof_running[PROF_NUMSTAGES];
+static double prof_started[PROF_NUMSTAGES];
+
+void
+Prof_Begin(profstage_t stage)
+{
+    double now;
+
+    if (!prof_recording || prof_running[stage])
+	return;
+
+    now = Sys_DoubleTime();
+    prof_running[stage] = true;
+    prof_started[stage] = now;
+    if (prof_frame.begin[stage] < 0)
+	prof_frame.begin[stage] = now - prof_frame.start;
+}
+
+void
+Prof_End(profstage_t stage)
+{
+    if (!prof_recording || !prof_running[stage])
+	return;
+
+    prof_frame.time[stage] += Sys_DoubleTime() - prof_started[stage];
+    prof_running[stage] = false;
+}
+
+void
+Prof_Count(profcounter_t counter, int count)
+{
+    if (prof_recording)
+	prof_frame.count[counter] += count;
+}
+
+void
+Prof_BeginFrame(void)
+{
+    int i;
+
+    prof_recording = host_speeds.value != 0 || prof_forced > 0;
+    if (!prof_recording)
+	return;
+
+    prof_frame.start = Sys_DoubleTime();
+    for (i = 0; i < PROF_NUMSTAGES; i++) {
+	prof_frame.begin[i] = -1;
+	prof_frame.time[i] = 0;
+	prof_running[i] = false;
+    }
+    for (i = 0; i < PROF_NUMCOUNTERS; i++)
+	prof_frame.count[i] = 0;
+    Prof_Begin(PROF_FRAME);
+}
+
+void
+Prof_EndFrame(void)
+{
+    int i;
+
+    if (!prof_recording)
+	return;
+
+    for (i = PROF_NUMSTAGES - 1; i >= 0; i--)
+	Prof_End(i);
+    prof_history[prof_numframes++ & (PROF_HISTORY - 1)] = prof_frame;
+    prof_recording = false;
+}
+
+void
+Prof_Force(qboolean force)
+{
+    prof_forced += force ? 1 : -1;
+}
+
+const float *
+Prof_LastFrame(void)
+{
+    if (!prof_numframes)
+	return NULL;
+    return prof_history[(prof_numframes - 1) & (PROF_HISTORY - 1)].time;
+}
+
+/*
+ * The recorded frames still in the history, oldest first
+ */
+static int
+Prof_NumFrames(void)
+{
+    return prof_numframes < PROF_HISTORY ? prof_numframes : PROF_HISTORY;
+}
+
+static const profframe_t *
+Prof_Frame(int i)
+{
+    if (prof_numframes > PROF_HISTORY)
+	i += prof_numframes;
+    return &prof_history[i & (PROF_HISTORY - 1)];
+}
+
+static int
+Prof_CompareTimes(const void *a, const void *b)
+{
+    float ta = *(const float *)a;
+    float tb = *(const float *)b;
+
+    return ta < tb ? -1 : ta > tb;
+}
+
+/*
+ * Nearest-rank percentile of the sorted times
+ */
+static float
+Prof_Percentile(const float *times, int count, int percent)
+{
+    int rank = (percent * count + 99) / 100;
+
+    return times[rank > 0 ? rank - 1 : 0];
+}
+
+void
+Prof_Summarize(float *times, int count, profsummary_t *summary)
+{
+    double total = 0;
+    int i;
+
+    memset(summary, 0, sizeof(*summary));
+    summary->count = count;
+    if (!count)
+	return;
+
+    qsort(times, count, sizeof(times[0]), Prof_CompareTimes);
+    for (i = 0; i < count; i++)
+	total += times[i];
+    summary->mean = total / count;
+    summary->min = times[0];
+    summary->p50 = Prof_Percentile(times, count, 50);
+    summary->p90 = Prof_Percentile(times, count, 90);
+    summary->p99 = Prof_Percentile(times, count, 99);
+    summary->max = times[count - 1];
+}
+
+/*
+================
+Prof_Stats_f
+================
+*/
+static void
+Prof_Stats_f(void)
+{
+    static float times[PROF_HISTORY];
+    const profframe_t *frame;
+    profsummary_t summary;
+    int i, stage, count, numframes;
+
+    numframes = Prof_NumFrames();
+    if (!numframes) {
+	Con_Printf("No frames recorded, set host_speeds to 1\n");
+	return;
+    }
+
+    Con_Printf("%d frames, times in ms\n", numframes);
+    Con_Printf("stage     mean    50%%    90%%    99%%     max\n");
+    for (stage = 0; stage < PROF_NUMSTAGES; stage++) {
+	count = 0;
+	for (i = 0; i < numframes; i++) {
+	    frame = Prof_Frame(i);
+	    if (frame->begin[stage] >= 0)
+		times[count++] = frame->time[stage] * 1000;
+	}
+	if (!count)
+	    continue;
+
+	Prof_Summarize(times, count, &summary);
+	Con_Printf("%-7s %6.2f %6.2f %6.2f %6.2f %6.2f\n", prof_names[stage],
+		   summary.mean, summary.p50, summary.p90, summary.p99,
+		   summary.max);
+    }
+
+    Con_Printf("counter     mean    50%%    90%%    99%%     max\n");
+    for (stage = 0; stage < PROF_NUMCOUNTERS; stage++) {
+	for (i = 0; i < numframes; i++)
+	    times[i] = Prof_Frame(i)->count[stage];
+	Prof_Summarize(times, numframes, &summary);
+	Con_Printf("%-9s %6.0f %6.0f %6.0f %6.0f %6.0f\n",
+		   prof_counternames[stage], summary.mean, summary.p50,
+		   summary.p90, summary.p99, summary.max);
+    }
+}
+
+/*
+ * Opens the file named by the command's argument in the save directory
+ */
+static FILE *
+Prof_OpenFile(const char *extension)
+{
+    char name[MAX_OSPATH];
+    FILE *f;
+
+    if (Cmd_Argc() != 2) {
+	Con_Printf("%s <filename> : write out the recorded frames\n",
+		   Cmd_Argv(0));
+	return NULL;
+    }
+    if (strstr(Cmd_Argv(1), "..")) {
+	Con_Printf("Relative pathnames are not allowed.\n");
+	return NULL;
+    }
+    if (!Prof_NumFrames()) {
+	Con_Printf("No frames recorded, set host_speeds to 1\n");
+	return NULL;
+    }
+
+    if (snprintf(name, sizeof(name) - strlen(extension), "%s/%s",
+		 com_savedir, Cmd_Argv(1)) >= sizeof(name) - strlen(extension)) {
+	Con_Printf("Filename too long.\n");
+	return NULL;
+    }
+    COM_DefaultExtension(name, extension);
+    f = fopen(name, "w");
+    if (!f) {
+	Con_Printf("ERROR: couldn't open %s.\n", name);
+	return NULL;
+    }
+    Con_Printf("Writing %d frames to %s...\n", Prof_NumFrames(), name);
+
+    return f;
+}
+
+/*
+================
+Prof_Csv_f
+
+One line per frame: its start in seconds from the first frame, then the
+time in ms of each stage, left empty if the stage didn't run, then the
+counters.
+================
+*/
+static void
+Prof_Csv_f(void)
+{
+    const profframe_t *frame;
+    double start;
+    int i, stage;
+    FILE *f;
+
+    f = Prof_OpenFile(".csv");
+    if (!f)
+	return;
+
+    fprintf(f, "start");
+    for (stage = 0; stage < PROF_NUMSTAGES; stage++)
+	fprintf(f, ",%s", prof_names[stage]);
+    for (i = 0; i < PROF_NUMCOUNTERS; i++)
+	fprintf(f, ",%s", prof_counternames[i]);
+    fprintf(f, "\n");
+
+    start = Prof_Frame(0)->start;
+    for (i = 0; i < Prof_NumFrames(); i++) {
+	frame = Prof_Frame(i);
+	fprintf(f, "%.6f", frame->start - start);
+	for (stage = 0; stage < PROF_NUMSTAGES; stage++) {
+	    if (frame->begin[stage] < 0)
+		fprintf(f, ",");
+	    else
+		fprintf(f, ",%.3f", frame->time[stage] * 1000);
+	}
+	for (stage = 0; stage < PROF_NUMCOUNTERS; stage++)
+	    fprintf(f, ",%d", frame->count[stage]);
+	fprintf(f, "\n");
+    }
+    fclose(f);
+}
+
+/*
+================
+Prof_Trace_f
+
+Writes the frames in the Trace Event Format, each stage a complete event
+with its times in microseconds. A stage that ran more than once in a frame
+is shown as one event covering the sum of its times. The counters are
+counter events at the start of each frame.
+================
+*/
+static void
+Prof_Trace_f(void)
+{
+    const profframe_t *frame;
+    const char *separator = "";
+    double start, ts;
+    int i, stage;
+    FILE *f;
+
+    f = Prof_OpenFile(".json");
+    if (!f)
+	return;
+
+    fprintf(f, "{\"traceEvents\":[");
+    start = Prof_Frame(0)->start;
+    for (i = 0; i < Prof_NumFrames(); i++) {
+	frame = Prof_Frame(i);
+	ts = (frame->start - start) * 1e6;
+	for (stage = 0; stage < PROF_NUMCOUNTERS; stage++) {
+	    fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,"
+		    "\"ts\":%.1f,\"args\":{\"value\":%d}}", separator,
+		    prof_counternames[stage], ts, frame->count[stage]);
+	    separator = ",";
+	}
+	for (stage = 0; stage < PROF_NUMSTAGES; stage++) {
+	    if (frame->begin[stage] < 0)
+		continue;
+	    ts = (frame->start - start + frame->begin[stage]) * 1e6;
+	    fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+		    "\"ts\":%.1f,\"dur\":%.1f}", separator, prof_names[stage],
+		    ts, frame->time[stage] * 1e6);
+	    separator = ",";
+	}
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(f);
+}
+
+void
+Prof_StartupPhase(const char *name)
+{
+    if (prof_startedup)
+	return;
+    if (prof_numphases == PROF_MAXPHASES)
+	name = NULL;
+
+    prof_phases[prof_numphases].name = name;
+    prof_phases[prof_numphases].start = Sys_DoubleTime();
+    if (name) {
+	prof_numphases++;
+	return;
+    }
+
+    prof_startedup = true;
+    Con_DPrintf("Started up in %.0f ms\n",
+		(prof_phases[prof_numphases].start - prof_phases[0].start) * 1000);
+}
+
+/*
+================
+Prof_Startup_f
+================
+*/
+static void
+Prof_Startup_f(void)
+{
+    const profphase_t *phase;
+    int i;
+
+    if (!prof_startedup || !prof_numphases) {
+	Con_Printf("Startup wasn't traced\n");
+	return;
+    }
+
+    for (i = 0, phase = prof_phases; i < prof_numphases; i++, phase++)
+	Con_Printf("%-12s %8.1f ms\n", phase->name,
+		   (phase[1].start - phase->start) * 1000);
+    Con_Printf("%-12s %8.1f ms\n", "total",
+	       (prof_phases[prof_numphases].start - prof_phases[0].start) * 1000);
+}
+
+static void
+Prof_Clear_f(void)
+{
+    prof_numframes = 0;
+}
+
+void
+Prof_Init(void)
+{
+    Cvar_RegisterVariable(&host_speeds);
+
+    Cmd_AddCommand("prof_stats", Prof_Stats_f);
+    Cmd_AddCommand("prof_csv", Prof_Csv_f);
+    Cmd_AddCommand("prof_trace", Prof_Trace_f);
+    Cmd_AddCommand("prof_clear", Prof_Clear_f);
+    Cmd_AddCommand("prof_startup", Prof_Startup_f);
+}
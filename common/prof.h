@@ -0,0 +1,103 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef PROF_H
+#define PROF_H
+
+#include "qtypes.h"
+
+/* prof.c -- per-frame timings of the main stages of a host frame */
+
+/*
+ * While host_speeds is set, the time spent in each stage is recorded for
+ * the last PROF_HISTORY frames. "prof_stats" prints percentiles of them,
+ * "prof_csv" and "prof_trace" write them out as a CSV file or a Chrome
+ * trace (chrome://tracing, Perfetto) in the save directory.
+ */
+typedef enum {
+    PROF_FRAME,		/* the whole frame, from Prof_BeginFrame on */
+    PROF_SERVER,
+    PROF_CLIENT,	/* reading and parsing server messages */
+    PROF_RENDER,	/* SCR_UpdateScreen, including PROF_VIDEO */
+    PROF_VIDEO,		/* converting and handing over the frame */
+    PROF_SOUND,
+    PROF_NUMSTAGES
+} profstage_t;
+
+/*
+ * Counts of things done in a frame, recorded alongside the stage times.
+ * The short counts are what the 3D view had to leave out for lack of room.
+ */
+typedef enum {
+    PROF_EDGES,
+    PROF_SURFS,
+    PROF_EDGESHORT,
+    PROF_SURFSHORT,
+    PROF_STYLES,	/* light styles whose value changed */
+    PROF_BUILT,		/* surfaces drawn into the surface cache */
+    PROF_CACHED,	/* surfaces whose cached copy was still good */
+    PROF_EVICTED,	/* cached surfaces thrown out to make room */
+    PROF_DLIGHTSURFS,	/* surfaces in nodes a dynamic light crossed */
+    PROF_DLIGHTMARKED,	/* of those, the ones the light reaches */
+    PROF_NUMCOUNTERS
+} profcounter_t;
+
+#define PROF_HISTORY 1024	/* must be a power of two */
+
+void Prof_Init(void);
+
+/*
+ * Startup is traced in phases, each started by naming it; NULL ends the
+ * last. "prof_startup" lists how long each took. Usable before Prof_Init.
+ */
+void Prof_StartupPhase(const char *name);
+
+/*
+ * Stages are timed between Prof_Begin and Prof_End, which may nest. A
+ * stage that runs more than once in a frame has its times added up. Any
+ * stage still running at Prof_EndFrame (after a Host_Error, say) is ended
+ * there. Only the main thread may use these.
+ */
+void Prof_BeginFrame(void);
+void Prof_EndFrame(void);
+void Prof_Begin(profstage_t stage);
+void Prof_End(profstage_t stage);
+
+/* Adds to a counter of the frame being recorded, which start at zero */
+void Prof_Count(profcounter_t counter, int count);
+
+/*
+ * While forced on, frames are recorded whatever host_speeds is set to.
+ * Calls nest, each Prof_Force(true) needs a Prof_Force(false).
+ * Prof_LastFrame returns the stage times in seconds of the last frame
+ * recorded, or NULL if there is none.
+ */
+void Prof_Force(qboolean force);
+const float *Prof_LastFrame(void);
+
+typedef struct {
+    int count;
+    float mean, min, p50, p90, p99, max;
+} profsummary_t;
+
+/* Sorts the times in place */
+void Prof_Summarize(float *times, int count, profsummary_t *summary);
+
+#endif /* PROF_H */
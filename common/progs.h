@@ -21,9 +21,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifndef PROGS_H
 #define PROGS_H
 
+#include <stddef.h>
+
 #include "pr_comp.h"		// defs shared with qcc
 #include "progdefs.h"		// generated by program cdefs
 #include "common.h"
+#include "cvar.h"
 
 typedef union eval_s {
     string_t string;
@@ -68,22 +71,110 @@ extern int pr_edict_size;	// in bytes
 void PR_Init(void);
 
 void PR_ExecuteProgram(func_t fnum);
+#ifdef QW_HACK
+extern double pr_exectime;	/* seconds spent in progs, for the metrics */
+#endif
 void PR_LoadProgs(void);
+void PR_DecodeStatements(void);
+int PR_EnterFunction(dfunction_t *f);
+int PR_LeaveFunction(void);
+
+/*
+ * pr_jit.c -- while pr_jit is set, functions that get hot are compiled to
+ * native code where that is supported. PR_JitExecute runs the function if
+ * it has been compiled, returning false if it should be interpreted.
+ */
+void PR_JitInit(void);
+void PR_JitLoadProgs(void);
+qboolean PR_JitExecute(dfunction_t *f);
 
 void PR_Profile_f(void);
+void PR_Fusions_f(void);
+void PR_Builtins_f(void);
 
 edict_t *ED_Alloc(void);
 void ED_Free(edict_t *ed);
+void ED_ResetEdicts(void);
+
+/*
+ * Edicts SV_Physics may pass over, see pr_edict.c
+ */
+extern byte ed_idle[];
+void ED_Sleep(int num, float nextthink);
+void ED_Wake(int num);
+void ED_WakeThinkers(double time);
+
+/*
+ * Edicts which may not be on the area node their origin and size put them
+ * on, and the one SV_Physics is moving. SV_LinkEdict places an edict.
+ */
+extern int ed_moving;
+void ED_Unplaced(int num);
+void ED_Placed(int num);
+int ED_UnplacedEdicts(int *nums);
+
+/*
+ * The first edict after start whose string field matches s, 0 if none, for
+ * the fields PF_Find looks up through an index; -1 for any other field
+ */
+int ED_FindString(int start, int field, const char *s);
+
+/*
+ * Indexes of a precache list by name, so a lookup on the event path isn't
+ * a scan of the list. All zero is empty, as when the server is cleared.
+ */
+#define PRECACHE_HASHSIZE 256	/* a power of two */
+#define MAX_PRECACHE (MAX_MODELS > MAX_SOUNDS ? MAX_MODELS : MAX_SOUNDS)
+
+typedef struct {
+    short heads[PRECACHE_HASHSIZE];	/* 1 + first index in each chain, or 0 */
+    short next[MAX_PRECACHE];		/* 1 + next index in the chain, or 0 */
+} precachehash_t;
+
+/* Sets list[index] to name and indexes it */
+void PR_AddPrecache(precachehash_t *hash, const char **list, int index,
+		    const char *name);
+
+/* The index of name in the list, -1 if it isn't there */
+int PR_FindPrecache(const precachehash_t *hash, const char **list,
+		    const char *name);
+
+/*
+ * What depends on the fields a store through a field offset may change,
+ * for the parts of the entvars the engine knows about. A vector store
+ * covers the two fields after the offset as well.
+ */
+#define ED_FIELDOFS(field) ((int)(offsetof(entvars_t, field) / 4))
+#define ED_NUMWATCHED ((int)(sizeof(entvars_t) / 4))
+#define ED_WATCH_THINK 1	/* movetype, nextthink */
+#define ED_WATCH_PLACE 2	/* origin, mins, maxs, solid */
+#define ED_WATCH_FIND  4	/* classname, targetname */
+
+extern byte ed_fieldwatch[];
+void ED_FieldStored(int e, int ofs);
+
+#define ED_FIELD_STORED(e, ofs) \
+    do { \
+	if ((unsigned)(ofs) < ED_NUMWATCHED && ed_fieldwatch[ofs]) \
+	    ED_FieldStored(e, ofs); \
+    } while (0)
 
 // returns a copy of the string allocated from the server's string heap
 
 void ED_Print(edict_t *ed);
 void ED_Write(FILE *f, edict_t *ed);
+unsigned ED_StateHash(void);
 const char *ED_ParseEdict(const char *data, edict_t *ent);
 
 void ED_WriteGlobals(FILE *f);
 void ED_ParseGlobals(const char *data);
 
+#ifdef NQ_HACK
+void ED_WriteStrings(sizebuf_t *buf);
+qboolean ED_ReadStrings(sizebuf_t *buf);
+void ED_ReserveEdicts(void);
+#endif
+
 void ED_LoadFromFile(const char *data);
 
 //define EDICT_NUM(n) ((edict_t *)(sv.edicts+ (n)*pr_edict_size))
@@ -116,6 +207,10 @@ typedef void (*builtin_t) (void);
 extern builtin_t *pr_builtins;
 extern int pr_numbuiltins;
 
+/* Calls a builtin, timing it while pr_builtinprofile is set */
+extern cvar_t pr_builtinprofile;
+void PR_CallBuiltin(int i);
+
 extern int pr_argc;
 
 extern qboolean pr_trace;
@@ -136,7 +231,32 @@ void PR_RunError(const char *error, ...);
 void ED_PrintEdicts(void);
 void ED_PrintNum(int ent);
 
-eval_t *GetEdictFieldValue(edict_t *ed, const char *field);
+/*
+ * Fields used if the progs define them. Their offsets are found once by
+ * PR_LoadProgs, so ED_EXTFIELD is a load rather than a search by name.
+ */
+typedef enum {
+    EXTFIELD_GRAVITY,
+    EXTFIELD_MAXSPEED,
+    EXTFIELD_ITEMS2,
+    EXTFIELD_AMMO_SHELLS1,
+    EXTFIELD_AMMO_NAILS1,
+    EXTFIELD_AMMO_LAVA_NAILS,
+    EXTFIELD_AMMO_ROCKETS1,
+    EXTFIELD_AMMO_MULTI_ROCKETS,
+    EXTFIELD_AMMO_CELLS1,
+    EXTFIELD_AMMO_PLASMA,
+    NUM_EXTFIELDS
+} extfield_t;
+
+extern int pr_extfields[NUM_EXTFIELDS];	/* field offsets, -1 if missing */
+
+/* The field's value in the edict, NULL if the progs don't have it */
+#define ED_EXTFIELD(e, f) \
+    (pr_extfields[f] < 0 ? NULL : (eval_t *)&((float *)&(e)->v)[pr_extfields[f]])
+
+/* Offset of the "nextmap" string global most progs keep, -1 if missing */
+extern int pr_nextmap;
 
 /*
  * PR Strings stuff
@@ -144,6 +264,19 @@ eval_t *GetEdictFieldValue(edict_t *ed, const char *field);
 void PR_InitStringTable(void);
 const char *PR_GetString(int num);
 int PR_SetString(const char *s);
+int PR_NumStrings(void);
+void PR_Strings_f(void);
+
+/*
+ * Returns a string equal to s that is already pooled, or adds s to the
+ * pool and returns it. Only for strings that won't change or be freed
+ * before the next progs are loaded; size is what a copy takes up, for
+ * the stats.
+ */
+const char *PR_InternString(const char *s, int size);
+
+/* True for the strings whose contents can't change under an index */
+qboolean PR_IsStableString(int num);
 
 /*
  * Somehow, I don't think this should be exposed - but better to have it here
@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // r_alias.c: routines for setting up to draw alias models
 
 #include "console.h"
+#include "crc.h"
 #include "cvar.h"
 #include "model.h"
 #include "quakedef.h"
@@ -30,6 +31,23 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
           move) */
 #include "d_local.h"
 
+/*
+ * Vertices are transformed and lit four at a time where SIMD is available.
+ * The trivertx_t bytes of four vertices are read as four little endian
+ * words.
+ */
+#if defined(__SSE2__) && !defined(MSB_FIRST)
+#include <emmintrin.h>
+#define ALIAS_SSE2
+#elif defined(__ARM_NEON) && !defined(MSB_FIRST)
+#include <arm_neon.h>
+#define ALIAS_NEON
+#endif
+
+#if defined(ALIAS_SSE2) || defined(ALIAS_NEON)
+#define ALIAS_SIMD
+#endif
+
 /* lowest light value we'll allow, to avoid the need for inner-loop light
    clamping */
 #define LIGHT_MIN 5
@@ -49,11 +67,69 @@ static model_t *pmodel;
 static vec3_t alias_forward, alias_right, alias_up;
 
 int r_amodels_drawn;
+int r_amodels_cached;		// of those, how many reused last frame's vertices
+int r_amodels_occluded;
 int a_skinwidth;
 int r_anumverts;
 
 float aliastransform[3][4];
 
+/*
+ * A model drawn with the same poses, transform, lighting and view as the
+ * frame before comes out with the same vertices, so each frame's are kept
+ * in an arena and looked up by all of those by the next frame. Those that
+ * are reused are copied over to that frame's arena, so only the models
+ * drawn last frame are kept around. Models that don't fit just aren't
+ * kept.
+ */
+#define ALIAS_CACHE_ENTRIES 128
+#define ALIAS_CACHE_VERTS 16384
+
+typedef struct {
+    const model_t *model;
+    const swaliaslod_t *lod;
+    int pose[2];		// the poses blended, the same when not lerping
+    float blend;
+    float transform[3][4];
+    vec3_t lightvec;
+    int ambientlight;
+    float shadelight;
+    float xscale, yscale, xcenter, ycenter, ziscale;
+    vrect_t vrect;
+    int vrectright, vrectbottom;
+    int trivial_accept;
+} aliaskey_t;
+
+typedef struct {
+    aliaskey_t key;
+    unsigned hash;
+    int numverts;
+    finalvert_t *finalverts;
+    auxvert_t *auxverts;	// NULL for trivially accepted models
+} aliascache_t;
+
+typedef struct {
+    aliascache_t entries[ALIAS_CACHE_ENTRIES];
+    int numentries;
+    int numverts;
+    finalvert_t finalverts[ALIAS_CACHE_VERTS];
+    auxvert_t auxverts[ALIAS_CACHE_VERTS];
+} aliasarena_t;
+
+static aliasarena_t r_aliasarenas[2];
+static int r_aliasarena;	// this frame's
+static int r_aliasframe;
+
+static int r_apose[2];		// set with r_apverts
+static float r_apblend;
+
+cvar_t r_aliascache = { "r_aliascache", "1" };
+
+/* on-screen size in pixels below which the first reduced mesh is used */
+#define ALIAS_LOD_PIXELS 32
+
+cvar_t r_aliaslod = { "r_aliaslod", "1" };
+
 typedef struct {
     int index0;
     int index1;
@@ -82,7 +158,6 @@ float r_avertexnormals[NUMVERTEXNORMALS][3] = {
 
 static void R_AliasSetUpTransform(const entity_t *e, aliashdr_t *pahdr,
 				  int trivial_accept);
-static void R_AliasTransformVector(const vec3_t in, vec3_t out);
 static void R_AliasTransformFinalVert(finalvert_t *fv, auxvert_t *av,
 				      trivertx_t *pverts, stvert_t *pstverts);
 
@@ -121,20 +196,109 @@ SW_LoadSkinData(const char *modelname, aliashdr_t *ahdr, int skinnum,
     return ret;
 }
 
+/*
+ * Makes a reduced copy of the mesh in 'from' by merging the vertices that
+ * share a cell of a grid (256 >> shift) cells wide over the first pose, and
+ * a part of the skin, keeping the first of each. Triangles left with two
+ * of the same vertex are dropped. Returns false if it would leave out too
+ * little, or everything.
+ */
+static qboolean
+SW_BuildMeshLod(aliashdr_t *hdr, const swaliaslod_t *from, swaliaslod_t *lod,
+		int shift)
+{
+    static int cellof[MAXALIASVERTS], keep[MAXALIASVERTS];
+    static int remap[MAXALIASVERTS];
+    static mtriangle_t lodtris[MAXALIASTRIS];
+    const trivertx_t *fromverts, *base;
+    const stvert_t *fromst;
+    const mtriangle_t *fromtris;
+    trivertx_t *pverts;
+    stvert_t *pstverts;
+    mtriangle_t *ptris;
+    int i, j, cell, skincells, numverts, numtris;
+
+    fromverts = (const trivertx_t *)((byte *)hdr + from->posedata);
+    fromst = (const stvert_t *)((byte *)hdr + from->stverts);
+    fromtris = (const mtriangle_t *)((byte *)hdr + from->triangles);
+    base = fromverts;
+    skincells = (256 >> shift) / 2;
+
+    numverts = 0;
+    for (i = 0; i < from->numverts; i++) {
+	cell = (base[i].v[0] >> shift) | (base[i].v[1] >> shift) << 5;
+	cell |= (base[i].v[2] >> shift) << 10;
+	cell |= ((fromst[i].s >> 16) * skincells / hdr->skinwidth) << 15;
+	cell |= ((fromst[i].t >> 16) * skincells / hdr->skinheight) << 19;
+	cell |= (fromst[i].onseam != 0) << 23;
+	for (j = 0; j < numverts; j++)
+	    if (cellof[j] == cell)
+		break;
+	if (j == numverts) {
+	    cellof[numverts] = cell;
+	    keep[numverts++] = i;
+	}
+	remap[i] = j;
+    }
+
+    numtris = 0;
+    for (i = 0; i < from->numtris; i++) {
+	mtriangle_t *tri = &lodtris[numtris];
+
+	tri->facesfront = fromtris[i].facesfront;
+	for (j = 0; j < 3; j++)
+	    tri->vertindex[j] = remap[fromtris[i].vertindex[j]];
+	if (tri->vertindex[0] == tri->vertindex[1] ||
+	    tri->vertindex[1] == tri->vertindex[2] ||
+	    tri->vertindex[2] == tri->vertindex[0])
+	    continue;
+	numtris++;
+    }
+
+    if (!numtris || numverts * 4 > from->numverts * 3)
+	return false;
+
+    lod->numverts = numverts;
+    lod->numtris = numtris;
+
+    pverts = (trivertx_t *)Hunk_Alloc(hdr->numposes * numverts * sizeof(*pverts));
+    lod->posedata = (byte *)pverts - (byte *)hdr;
+    for (i = 0; i < hdr->numposes; i++, fromverts += from->numverts)
+	for (j = 0; j < numverts; j++)
+	    *pverts++ = fromverts[keep[j]];
+
+    pstverts = (stvert_t *)Hunk_Alloc(numverts * sizeof(*pstverts));
+    lod->stverts = (byte *)pstverts - (byte *)hdr;
+    for (i = 0; i < numverts; i++)
+	pstverts[i] = fromst[keep[i]];
+
+    ptris = (mtriangle_t *)Hunk_Alloc(numtris * sizeof(*ptris));
+    lod->triangles = (byte *)ptris - (byte *)hdr;
+    memcpy(ptris, lodtris, numtris * sizeof(*ptris));
+
+    return true;
+}
+
 static void
 SW_LoadMeshData(const model_t *model, aliashdr_t *hdr, const mtriangle_t *tris,
 		const stvert_t *stverts, const trivertx_t **verts)
 {
     int i;
+    sw_aliashdr_t *swhdr = SW_Aliashdr(hdr);
+    swaliaslod_t *lod = &swhdr->lods[0];
     trivertx_t *pverts;
     stvert_t *pstverts;
     mtriangle_t *ptris;
 
+    lod->numverts = hdr->numverts;
+    lod->numtris = hdr->numtris;
+
     /*
      * Save the pose vertex data
      */
     pverts = (trivertx_t*)Hunk_Alloc(hdr->numposes * hdr->numverts * sizeof(*pverts));
     hdr->posedata = (byte *)pverts - (byte *)hdr;
+    lod->posedata = hdr->posedata;
     for (i = 0; i < hdr->numposes; i++) {
 	memcpy(pverts, verts[i], hdr->numverts * sizeof(*pverts));
 	pverts += hdr->numverts;
@@ -145,7 +309,7 @@ SW_LoadMeshData(const model_t *model, aliashdr_t *hdr, const mtriangle_t *tris,
      * => put s and t in 16.16 format
      */
     pstverts = (stvert_t*)Hunk_Alloc(hdr->numverts * sizeof(*pstverts));
-    SW_Aliashdr(hdr)->stverts = (byte *)pstverts - (byte *)hdr;
+    lod->stverts = (byte *)pstverts - (byte *)hdr;
     for (i = 0; i < hdr->numverts; i++) {
 	pstverts[i].onseam = stverts[i].onseam;
 	pstverts[i].s = stverts[i].s << 16;
@@ -156,14 +320,38 @@ SW_LoadMeshData(const model_t *model, aliashdr_t *hdr, const mtriangle_t *tris,
      * Save the triangle data
      */
     ptris = (mtriangle_t*)Hunk_Alloc(hdr->numtris * sizeof(*ptris));
-    SW_Aliashdr(hdr)->triangles = (byte *)ptris - (byte *)hdr;
+    lod->triangles = (byte *)ptris - (byte *)hdr;
     memcpy(ptris, tris, hdr->numtris * sizeof(*ptris));
+
+    /*
+     * Reduced meshes, on grids 16 and 8 cells wide
+     */
+    swhdr->numlods = 1;
+    while (swhdr->numlods < MAX_ALIAS_LODS) {
+	if (!SW_BuildMeshLod(hdr, lod, lod + 1, 3 + swhdr->numlods))
+	    break;
+	lod++;
+	swhdr->numlods++;
+    }
+}
+
+/*
+ * The skins are saved at r_pixbytes, through d_8to16table when 16 bit
+ */
+static int
+SW_CacheVariant(void)
+{
+    if (r_pixbytes == 1)
+	return 1;
+    return (r_pixbytes << 16) | CRC_Block((byte *)d_8to16table,
+					  sizeof(d_8to16table));
 }
 
 static model_loader_t SW_Model_Loader = {
     SW_Aliashdr_Padding,
     SW_LoadSkinData,
-    SW_LoadMeshData
+    SW_LoadMeshData,
+    SW_CacheVariant
 };
 
 const model_loader_t *
@@ -182,6 +370,8 @@ qboolean R_AliasCheckBBox(entity_t *e)
    int i, flags, frame, numv;
    aliashdr_t *pahdr;
    float zi, basepts[8][3], v0, v1;
+   vec3_t viewpos[8];
+   float left, top, right, bottom, nearzi;
    finalvert_t viewpts[16];
    auxvert_t viewaux[16];
    maliasframedesc_t *pframedesc;
@@ -229,9 +419,10 @@ qboolean R_AliasCheckBBox(entity_t *e)
    zfullyclipped = true;
 
    minz = 9999;
+   TransformPoints(aliastransform, basepts, viewpos, 8);
    for (i = 0; i < 8; i++)
    {
-      R_AliasTransformVector(&basepts[i][0], &viewaux[i].fv[0]);
+      VectorCopy(viewpos[i], viewaux[i].fv);
 
       if (viewaux[i].fv[2] < ALIAS_Z_CLIP_PLANE)
       {
@@ -282,6 +473,9 @@ qboolean R_AliasCheckBBox(entity_t *e)
    // project the vertices that remain after clipping
    anyclip = 0;
    allclip = ALIAS_XY_CLIP_MASK;
+   left = top = 999999;
+   right = bottom = -999999;
+   nearzi = 0;
 
    // TODO: probably should do this loop in ASM, especially if we use floats
    for (i = 0; i < numv; i++) {
@@ -295,6 +489,12 @@ qboolean R_AliasCheckBBox(entity_t *e)
       v0 = (viewaux[i].fv[0] * xscale * zi) + xcenter;
       v1 = (viewaux[i].fv[1] * yscale * zi) + ycenter;
 
+      left = qmin(left, v0);
+      right = qmax(right, v0);
+      top = qmin(top, v1);
+      bottom = qmax(bottom, v1);
+      nearzi = qmax(nearzi, zi);
+
       flags = 0;
 
       if (v0 < r_refdef.fvrectx)
@@ -313,6 +513,21 @@ qboolean R_AliasCheckBBox(entity_t *e)
    if (allclip)
       return false;		// trivial reject off one side
 
+   /*
+    * Hidden behind the world? Not tried while lerping, when this frame's
+    * bbox needn't cover the pose drawn, nor for the view model, whose z is
+    * scaled up.
+    */
+   if (r_occlude.value && !zclipped && e != &cl.viewent
+#ifdef NQ_HACK
+         && !r_lerpmodels.value
+#endif
+         && D_Occluded(left, top, right, bottom, nearzi))
+   {
+      r_amodels_occluded++;
+      return false;
+   }
+
 #ifdef NQ_HACK
    /*
     * FIXME - Trivial accept not safe while lerping unless we check
@@ -333,19 +548,222 @@ qboolean R_AliasCheckBBox(entity_t *e)
 }
 
 
+#ifdef ALIAS_SIMD
 /*
-================
-R_AliasTransformVector
-================
-*/
+ * Four vertex versions of R_AliasTransformFinalVert and
+ * R_AliasTransformAndProjectFinalVerts. The float operations are done in the
+ * same order as the scalar code, so the results are the same.
+ */
+#ifdef ALIAS_SSE2
+typedef __m128 alias4_t;
+
+static inline void
+R_AliasTransform4(const trivertx_t *pverts, __m128 out[3])
+{
+    const __m128i lowbyte = _mm_set1_epi32(0xFF);
+    __m128i w = _mm_loadu_si128((const __m128i *)pverts);
+    __m128 x, y, z;
+    int i;
+
+    x = _mm_cvtepi32_ps(_mm_and_si128(w, lowbyte));
+    y = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(w, 8), lowbyte));
+    z = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(w, 16), lowbyte));
+
+    for (i = 0; i < 3; i++) {
+	out[i] = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(aliastransform[i][0])),
+			    _mm_mul_ps(y, _mm_set1_ps(aliastransform[i][1])));
+	out[i] = _mm_add_ps(out[i],
+			    _mm_mul_ps(z, _mm_set1_ps(aliastransform[i][2])));
+	out[i] = _mm_add_ps(out[i], _mm_set1_ps(aliastransform[i][3]));
+    }
+}
+
+static inline void
+R_AliasLight4(const trivertx_t *pverts, int *light)
+{
+    const float *n0 = r_avertexnormals[pverts[0].lightnormalindex];
+    const float *n1 = r_avertexnormals[pverts[1].lightnormalindex];
+    const float *n2 = r_avertexnormals[pverts[2].lightnormalindex];
+    const float *n3 = r_avertexnormals[pverts[3].lightnormalindex];
+    const __m128 zero = _mm_setzero_ps();
+    __m128 lightcos;
+    __m128i shade, temp;
+
+    lightcos = _mm_add_ps(
+	_mm_mul_ps(_mm_setr_ps(n0[0], n1[0], n2[0], n3[0]),
+		   _mm_set1_ps(r_plightvec[0])),
+	_mm_mul_ps(_mm_setr_ps(n0[1], n1[1], n2[1], n3[1]),
+		   _mm_set1_ps(r_plightvec[1])));
+    lightcos = _mm_add_ps(lightcos,
+	_mm_mul_ps(_mm_setr_ps(n0[2], n1[2], n2[2], n3[2]),
+		   _mm_set1_ps(r_plightvec[2])));
+
+    shade = _mm_cvttps_epi32(_mm_mul_ps(_mm_set1_ps(r_shadelight), lightcos));
+    shade = _mm_and_si128(shade, _mm_castps_si128(_mm_cmplt_ps(lightcos, zero)));
+    temp = _mm_add_epi32(_mm_set1_epi32(r_ambientlight), shade);
+    temp = _mm_andnot_si128(_mm_cmplt_epi32(temp, _mm_setzero_si128()), temp);
+
+    _mm_storeu_si128((__m128i *)light, temp);
+}
+
+static inline void
+R_AliasProject4(const __m128 xyz[3], int *u, int *v, int *zi)
+{
+    __m128 vzi = _mm_div_ps(_mm_set1_ps(1.0f), xyz[2]);
+
+    _mm_storeu_si128((__m128i *)zi, _mm_cvttps_epi32(vzi));
+    _mm_storeu_si128((__m128i *)u, _mm_cvttps_epi32(
+	_mm_add_ps(_mm_mul_ps(xyz[0], vzi), _mm_set1_ps(aliasxcenter))));
+    _mm_storeu_si128((__m128i *)v, _mm_cvttps_epi32(
+	_mm_add_ps(_mm_mul_ps(xyz[1], vzi), _mm_set1_ps(aliasycenter))));
+}
+
+static inline void
+R_AliasStoreAux4(auxvert_t *av, const __m128 xyz[3])
+{
+    float x[4], y[4], z[4];
+    int i;
+
+    _mm_storeu_ps(x, xyz[0]);
+    _mm_storeu_ps(y, xyz[1]);
+    _mm_storeu_ps(z, xyz[2]);
+    for (i = 0; i < 4; i++) {
+	av[i].fv[0] = x[i];
+	av[i].fv[1] = y[i];
+	av[i].fv[2] = z[i];
+    }
+}
+#else /* ALIAS_NEON */
+typedef float32x4_t alias4_t;
+
+static inline void
+R_AliasTransform4(const trivertx_t *pverts, float32x4_t out[3])
+{
+    const uint32x4_t lowbyte = vdupq_n_u32(0xFF);
+    uint32x4_t w = vreinterpretq_u32_u8(vld1q_u8((const uint8_t *)pverts));
+    float32x4_t x, y, z;
+    int i;
+
+    x = vcvtq_f32_u32(vandq_u32(w, lowbyte));
+    y = vcvtq_f32_u32(vandq_u32(vshrq_n_u32(w, 8), lowbyte));
+    z = vcvtq_f32_u32(vandq_u32(vshrq_n_u32(w, 16), lowbyte));
+
+    for (i = 0; i < 3; i++) {
+	out[i] = vaddq_f32(vmulq_n_f32(x, aliastransform[i][0]),
+			   vmulq_n_f32(y, aliastransform[i][1]));
+	out[i] = vaddq_f32(out[i], vmulq_n_f32(z, aliastransform[i][2]));
+	out[i] = vaddq_f32(out[i], vdupq_n_f32(aliastransform[i][3]));
+    }
+}
+
+static inline void
+R_AliasLight4(const trivertx_t *pverts, int *light)
+{
+    float normals[3][4];
+    float32x4_t lightcos;
+    int32x4_t shade, temp;
+    uint32x4_t negative;
+    int i, j;
+
+    for (i = 0; i < 4; i++)
+	for (j = 0; j < 3; j++)
+	    normals[j][i] = r_avertexnormals[pverts[i].lightnormalindex][j];
+
+    lightcos = vaddq_f32(vmulq_n_f32(vld1q_f32(normals[0]), r_plightvec[0]),
+			 vmulq_n_f32(vld1q_f32(normals[1]), r_plightvec[1]));
+    lightcos = vaddq_f32(lightcos,
+			 vmulq_n_f32(vld1q_f32(normals[2]), r_plightvec[2]));
+
+    shade = vcvtq_s32_f32(vmulq_n_f32(lightcos, r_shadelight));
+    negative = vcltq_f32(lightcos, vdupq_n_f32(0));
+    shade = vandq_s32(shade, vreinterpretq_s32_u32(negative));
+    temp = vaddq_s32(vdupq_n_s32(r_ambientlight), shade);
+    temp = vmaxq_s32(temp, vdupq_n_s32(0));
+
+    vst1q_s32(light, temp);
+}
+
+static inline void
+R_AliasProject4(const float32x4_t xyz[3], int *u, int *v, int *zi)
+{
+    float z[4], vzi[4];
+    float32x4_t fzi;
+    int i;
+
+    /* NEON only has a reciprocal estimate, so divide one at a time */
+    vst1q_f32(z, xyz[2]);
+    for (i = 0; i < 4; i++)
+	vzi[i] = 1.0 / z[i];
+    fzi = vld1q_f32(vzi);
+
+    vst1q_s32(zi, vcvtq_s32_f32(fzi));
+    vst1q_s32(u, vcvtq_s32_f32(vaddq_f32(vmulq_f32(xyz[0], fzi),
+					 vdupq_n_f32(aliasxcenter))));
+    vst1q_s32(v, vcvtq_s32_f32(vaddq_f32(vmulq_f32(xyz[1], fzi),
+					 vdupq_n_f32(aliasycenter))));
+}
+
+static inline void
+R_AliasStoreAux4(auxvert_t *av, const float32x4_t xyz[3])
+{
+    float x[4], y[4], z[4];
+    int i;
+
+    vst1q_f32(x, xyz[0]);
+    vst1q_f32(y, xyz[1]);
+    vst1q_f32(z, xyz[2]);
+    for (i = 0; i < 4; i++) {
+	av[i].fv[0] = x[i];
+	av[i].fv[1] = y[i];
+	av[i].fv[2] = z[i];
+    }
+}
+#endif /* ALIAS_NEON */
+
 static void
-R_AliasTransformVector(const vec3_t in, vec3_t out)
+R_AliasTransformFinalVerts4(finalvert_t *fv, auxvert_t *av,
+			    const trivertx_t *pverts, const stvert_t *pstverts)
 {
-    out[0] = DotProduct(in, aliastransform[0]) + aliastransform[0][3];
-    out[1] = DotProduct(in, aliastransform[1]) + aliastransform[1][3];
-    out[2] = DotProduct(in, aliastransform[2]) + aliastransform[2][3];
+    alias4_t xyz[3];
+    int light[4];
+    int i;
+
+    R_AliasTransform4(pverts, xyz);
+    R_AliasStoreAux4(av, xyz);
+    R_AliasLight4(pverts, light);
+
+    for (i = 0; i < 4; i++) {
+	fv[i].v[2] = pstverts[i].s;
+	fv[i].v[3] = pstverts[i].t;
+	fv[i].flags = pstverts[i].onseam;
+	fv[i].v[4] = light[i];
+    }
+}
+
+static void
+R_AliasTransformAndProject4(finalvert_t *fv, const trivertx_t *pverts,
+			    const stvert_t *pstverts)
+{
+    alias4_t xyz[3];
+    int u[4], v[4], zi[4], light[4];
+    int i;
+
+    R_AliasTransform4(pverts, xyz);
+    R_AliasProject4(xyz, u, v, zi);
+    R_AliasLight4(pverts, light);
+
+    for (i = 0; i < 4; i++) {
+	fv[i].v[0] = u[i];
+	fv[i].v[1] = v[i];
+	fv[i].v[2] = pstverts[i].s;
+	fv[i].v[3] = pstverts[i].t;
+	fv[i].v[4] = light[i];
+	fv[i].v[5] = zi[i];
+	fv[i].flags = pstverts[i].onseam;
+    }
 }
 
+#endif /* ALIAS_SIMD */
 
 /*
 ================
@@ -355,23 +773,31 @@ General clipped case
 ================
 */
 static void
-R_AliasPreparePoints(aliashdr_t *pahdr, finalvert_t *pfinalverts,
-		     auxvert_t *pauxverts)
+R_AliasPreparePoints(aliashdr_t *pahdr, const swaliaslod_t *lod,
+		     finalvert_t *pfinalverts, auxvert_t *pauxverts)
 {
     int i;
     stvert_t *pstverts;
     finalvert_t *fv;
     auxvert_t *av;
-    mtriangle_t *ptri;
-    finalvert_t *pfv[3];
 
-    pstverts = (stvert_t *)((byte *)pahdr + SW_Aliashdr(pahdr)->stverts);
-    r_anumverts = pahdr->numverts;
+    pstverts = (stvert_t *)((byte *)pahdr + lod->stverts);
+    r_anumverts = lod->numverts;
+
+    i = 0;
+#ifdef ALIAS_SIMD
+    for (; i + 4 <= r_anumverts; i += 4)
+	R_AliasTransformFinalVerts4(&pfinalverts[i], &pauxverts[i],
+				    &r_apverts[i], &pstverts[i]);
+#endif
+    for (; i < r_anumverts; i++)
+	R_AliasTransformFinalVert(&pfinalverts[i], &pauxverts[i],
+				  &r_apverts[i], &pstverts[i]);
+    r_apverts += r_anumverts;
+
     fv = pfinalverts;
     av = pauxverts;
-
-    for (i = 0; i < r_anumverts; i++, fv++, av++, r_apverts++, pstverts++) {
-	R_AliasTransformFinalVert(fv, av, r_apverts, pstverts);
+    for (i = 0; i < r_anumverts; i++, fv++, av++) {
 	if (av->fv[2] < ALIAS_Z_CLIP_PLANE)
 	    fv->flags |= ALIAS_Z_CLIP;
 	else {
@@ -386,14 +812,28 @@ R_AliasPreparePoints(aliashdr_t *pahdr, finalvert_t *pfinalverts,
 		fv->flags |= ALIAS_BOTTOM_CLIP;
 	}
     }
+}
+
+/*
+================
+R_AliasDrawPoints
 
-//
-// clip and draw all triangles
-//
+Clips and draws the triangles of prepared points
+================
+*/
+static void
+R_AliasDrawPoints(aliashdr_t *pahdr, const swaliaslod_t *lod,
+		  finalvert_t *pfinalverts, auxvert_t *pauxverts)
+{
+    int i;
+    mtriangle_t *ptri;
+    finalvert_t *pfv[3];
+
+    r_anumverts = lod->numverts;
     r_affinetridesc.numtriangles = 1;
 
-    ptri = (mtriangle_t *)((byte *)pahdr + SW_Aliashdr(pahdr)->triangles);
-    for (i = 0; i < pahdr->numtris; i++, ptri++) {
+    ptri = (mtriangle_t *)((byte *)pahdr + lod->triangles);
+    for (i = 0; i < lod->numtris; i++, ptri++) {
 	pfv[0] = &pfinalverts[ptri->vertindex[0]];
 	pfv[1] = &pfinalverts[ptri->vertindex[1]];
 	pfv[2] = &pfinalverts[ptri->vertindex[2]];
@@ -562,10 +1002,15 @@ R_AliasTransformAndProjectFinalVerts
 void
 R_AliasTransformAndProjectFinalVerts(finalvert_t *fv, stvert_t *pstverts)
 {
-   int i;
+   int i = 0;
    trivertx_t *pverts = r_apverts;
 
-   for (i = 0; i < r_anumverts; i++, fv++, pverts++, pstverts++)
+#ifdef ALIAS_SIMD
+   for (; i + 4 <= r_anumverts; i += 4, fv += 4, pverts += 4, pstverts += 4)
+      R_AliasTransformAndProject4(fv, pverts, pstverts);
+#endif
+
+   for (; i < r_anumverts; i++, fv++, pverts++, pstverts++)
    {
       int temp;
       float lightcos, *plightnormal;
@@ -632,22 +1077,35 @@ R_AliasPrepareUnclippedPoints
 ================
 */
 static void
-R_AliasPrepareUnclippedPoints(aliashdr_t *pahdr, finalvert_t *pfinalverts)
+R_AliasPrepareUnclippedPoints(aliashdr_t *pahdr, const swaliaslod_t *lod,
+			      finalvert_t *pfinalverts)
 {
     stvert_t *pstverts;
 
-    pstverts = (stvert_t *)((byte *)pahdr + SW_Aliashdr(pahdr)->stverts);
-    r_anumverts = pahdr->numverts;
+    pstverts = (stvert_t *)((byte *)pahdr + lod->stverts);
+    r_anumverts = lod->numverts;
 
     R_AliasTransformAndProjectFinalVerts(pfinalverts, pstverts);
+}
+
+/*
+================
+R_AliasDrawUnclippedPoints
+================
+*/
+static void
+R_AliasDrawUnclippedPoints(aliashdr_t *pahdr, const swaliaslod_t *lod,
+			   finalvert_t *pfinalverts)
+{
+    r_anumverts = lod->numverts;
 
     if (r_affinetridesc.drawtype)
 	D_PolysetDrawFinalVerts(pfinalverts, r_anumverts);
 
     r_affinetridesc.pfinalverts = pfinalverts;
     r_affinetridesc.ptriangles = (mtriangle_t *)((byte *)pahdr +
-						 SW_Aliashdr(pahdr)->triangles);
-    r_affinetridesc.numtriangles = pahdr->numtris;
+						 lod->triangles);
+    r_affinetridesc.numtriangles = lod->numtris;
 
     D_PolysetDraw();
 }
@@ -745,7 +1203,8 @@ R_AliasSetupLighting(alight_t *plighting)
 
 #ifdef NQ_HACK
 static trivertx_t *
-R_AliasBlendPoseVerts(const entity_t *e, aliashdr_t *hdr, float blend)
+R_AliasBlendPoseVerts(const entity_t *e, aliashdr_t *hdr,
+		      const swaliaslod_t *lod, float blend)
 {
     static trivertx_t blendverts[MAXALIASVERTS];
     trivertx_t *poseverts, *pv1, *pv2, *light;
@@ -755,13 +1214,13 @@ R_AliasBlendPoseVerts(const entity_t *e, aliashdr_t *hdr, float blend)
     blend1 = blend * (1 << SHIFT);
     blend0 = (1 << SHIFT) - blend1;
 
-    poseverts = (trivertx_t *)((byte *)hdr + hdr->posedata);
-    pv1 = poseverts + e->previouspose * hdr->numverts;
-    pv2 = poseverts + e->currentpose * hdr->numverts;
+    poseverts = (trivertx_t *)((byte *)hdr + lod->posedata);
+    pv1 = poseverts + e->previouspose * lod->numverts;
+    pv2 = poseverts + e->currentpose * lod->numverts;
     light = (blend < 0.5f) ? pv1 : pv2;
     poseverts = blendverts;
 
-    for (i = 0; i < hdr->numverts; i++, poseverts++, pv1++, pv2++, light++) {
+    for (i = 0; i < lod->numverts; i++, poseverts++, pv1++, pv2++, light++) {
 	poseverts->v[0] = (pv1->v[0] * blend0 + pv2->v[0] * blend1) >> SHIFT;
 	poseverts->v[1] = (pv1->v[1] * blend0 + pv2->v[1] * blend1) >> SHIFT;
 	poseverts->v[2] = (pv1->v[2] * blend0 + pv2->v[2] * blend1) >> SHIFT;
@@ -773,6 +1232,37 @@ R_AliasBlendPoseVerts(const entity_t *e, aliashdr_t *hdr, float blend)
 }
 #endif
 
+/*
+ * Picks the reduced meshes for models small enough on screen that their
+ * grid cells come to under a couple of pixels, r_aliaslod scaling the
+ * sizes they're used below.
+ */
+static const swaliaslod_t *
+R_AliasSelectLod(const entity_t *e, aliashdr_t *pahdr)
+{
+   sw_aliashdr_t *swhdr = SW_Aliashdr(pahdr);
+   float depth, extent, pixels;
+   vec3_t delta;
+   int lod;
+
+   if (swhdr->numlods == 1 || r_aliaslod.value <= 0 || e == &cl.viewent)
+      return &swhdr->lods[0];
+
+   VectorSubtract(e->origin, r_origin, delta);
+   depth = DotProduct(delta, vpn);
+   if (depth < 1)
+      return &swhdr->lods[0];
+
+   extent = qmax(qmax(pahdr->scale[0], pahdr->scale[1]), pahdr->scale[2]);
+   pixels = extent * 255 * xscale / depth;
+
+   for (lod = 0; lod + 1 < swhdr->numlods; lod++)
+      if (pixels >= (ALIAS_LOD_PIXELS >> lod) * r_aliaslod.value)
+         break;
+
+   return &swhdr->lods[lod];
+}
+
 /*
 =================
 R_AliasSetupFrame
@@ -781,7 +1271,7 @@ set r_apverts
 =================
 */
 static void
-R_AliasSetupFrame(entity_t *e, aliashdr_t *pahdr)
+R_AliasSetupFrame(entity_t *e, aliashdr_t *pahdr, const swaliaslod_t *lod)
 {
    int pose, numposes;
    float *intervals = NULL;
@@ -843,16 +1333,132 @@ R_AliasSetupFrame(entity_t *e, aliashdr_t *pahdr)
          delta = e->currentframetime - e->previousframetime;
       }
       blend = qclamp(time / delta, 0.0f, 1.0f);
-      r_apverts = R_AliasBlendPoseVerts(e, pahdr, blend);
+      r_apverts = R_AliasBlendPoseVerts(e, pahdr, lod, blend);
+      r_apose[0] = e->previouspose;
+      r_apose[1] = e->currentpose;
+      r_apblend = blend;
 
       return;
    }
 nolerp:
 #endif
-   r_apverts = (trivertx_t *)((byte *)pahdr + pahdr->posedata);
-   r_apverts += pose * pahdr->numverts;
+   r_apverts = (trivertx_t *)((byte *)pahdr + lod->posedata);
+   r_apverts += pose * lod->numverts;
+   r_apose[0] = r_apose[1] = pose;
+   r_apblend = 0;
+}
+
+
+/*
+================
+R_AliasClearCache
+
+Forgets the models kept, as the next map's may be loaded in their place
+================
+*/
+void
+R_AliasClearCache(void)
+{
+    r_aliasarenas[0].numentries = r_aliasarenas[0].numverts = 0;
+    r_aliasarenas[1].numentries = r_aliasarenas[1].numverts = 0;
+}
+
+static void
+R_AliasCacheKey(const entity_t *e, const swaliaslod_t *lod, aliaskey_t *key)
+{
+    memset(key, 0, sizeof(*key));
+    key->model = e->model;
+    key->lod = lod;
+    key->pose[0] = r_apose[0];
+    key->pose[1] = r_apose[1];
+    key->blend = r_apblend;
+    memcpy(key->transform, aliastransform, sizeof(key->transform));
+    VectorCopy(r_plightvec, key->lightvec);
+    key->ambientlight = r_ambientlight;
+    key->shadelight = r_shadelight;
+    key->xscale = aliasxscale;
+    key->yscale = aliasyscale;
+    key->xcenter = aliasxcenter;
+    key->ycenter = aliasycenter;
+    key->ziscale = ziscale;
+    key->vrect = r_refdef.aliasvrect;
+    key->vrectright = r_refdef.aliasvrectright;
+    key->vrectbottom = r_refdef.aliasvrectbottom;
+    key->trivial_accept = e->trivial_accept;
+}
+
+static unsigned
+R_AliasCacheHash(const aliaskey_t *key)
+{
+    const byte *bytes = (const byte *)key;
+    unsigned hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < sizeof(*key); i++)
+	hash = (hash ^ bytes[i]) * 16777619u;
+
+    return hash;
+}
+
+/*
+ * Takes room for the model's vertices in this frame's arena, or returns
+ * NULL if it's full.
+ */
+static aliascache_t *
+R_AliasCacheAlloc(const aliaskey_t *key, unsigned hash, int numverts)
+{
+    aliasarena_t *arena = &r_aliasarenas[r_aliasarena];
+    aliascache_t *entry;
+
+    if (arena->numentries == ALIAS_CACHE_ENTRIES)
+	return NULL;
+    if (arena->numverts + numverts > ALIAS_CACHE_VERTS)
+	return NULL;
+
+    entry = &arena->entries[arena->numentries++];
+    entry->key = *key;
+    entry->hash = hash;
+    entry->numverts = numverts;
+    entry->finalverts = arena->finalverts + arena->numverts;
+    entry->auxverts = key->trivial_accept ? NULL
+	: arena->auxverts + arena->numverts;
+    arena->numverts += numverts;
+
+    return entry;
 }
 
+/*
+ * Finds the model's vertices from last frame, keeping them for the next.
+ * They stay where they are if this frame's arena is full, which is good
+ * until the arenas are swapped again.
+ */
+static const aliascache_t *
+R_AliasCacheFind(const aliaskey_t *key, unsigned hash, int numverts)
+{
+    const aliasarena_t *last = &r_aliasarenas[r_aliasarena ^ 1];
+    const aliascache_t *entry;
+    aliascache_t *copy;
+    int i;
+
+    for (i = 0, entry = last->entries; i < last->numentries; i++, entry++) {
+	if (entry->hash != hash || entry->numverts != numverts)
+	    continue;
+	if (memcmp(&entry->key, key, sizeof(*key)))
+	    continue;
+
+	copy = R_AliasCacheAlloc(key, hash, numverts);
+	if (!copy)
+	    return entry;
+	memcpy(copy->finalverts, entry->finalverts,
+	       numverts * sizeof(finalvert_t));
+	if (copy->auxverts)
+	    memcpy(copy->auxverts, entry->auxverts,
+		   numverts * sizeof(auxvert_t));
+	return copy;
+    }
+
+    return NULL;
+}
 
 /*
 ================
@@ -861,14 +1467,13 @@ R_AliasDrawModel
 */
 void R_AliasDrawModel(entity_t *e, alight_t *plighting)
 {
+   static finalvert_t finalverts[CACHE_PAD_ARRAY(MAXALIASVERTS, finalvert_t)];
+   static auxvert_t auxverts[MAXALIASVERTS];
    aliashdr_t *pahdr;
+   const swaliaslod_t *lod;
    finalvert_t *pfinalverts;
-   finalvert_t *finalverts;
    auxvert_t *pauxverts;
-   auxvert_t *auxverts = malloc(sizeof(auxvert_t) * MAXALIASVERTS);
 
-   finalverts = malloc(sizeof(finalvert_t)*CACHE_PAD_ARRAY(MAXALIASVERTS, finalvert_t));
-   
    r_amodels_drawn++;
 
    // cache align
@@ -881,7 +1486,8 @@ void R_AliasDrawModel(entity_t *e, alight_t *plighting)
    R_AliasSetupSkin(e, pahdr);
    R_AliasSetUpTransform(e, pahdr, e->trivial_accept);
    R_AliasSetupLighting(plighting);
-   R_AliasSetupFrame(e, pahdr);
+   lod = R_AliasSelectLod(e, pahdr);
+   R_AliasSetupFrame(e, pahdr, lod);
 
    if (!e->colormap)
       Sys_Error("%s: !e->colormap", __func__);
@@ -899,11 +1505,50 @@ void R_AliasDrawModel(entity_t *e, alight_t *plighting)
    else
       ziscale = ((float)0x8000) * ((float)0x10000) * 3.0;
 
+   if (r_aliascache.value)
+   {
+      const aliascache_t *entry;
+      aliaskey_t key;
+      unsigned hash;
+
+      if (r_aliasframe != r_framecount)
+      {
+         r_aliasframe = r_framecount;
+         r_aliasarena ^= 1;
+         r_aliasarenas[r_aliasarena].numentries = 0;
+         r_aliasarenas[r_aliasarena].numverts = 0;
+      }
+
+      R_AliasCacheKey(e, lod, &key);
+      hash = R_AliasCacheHash(&key);
+      entry = R_AliasCacheFind(&key, hash, lod->numverts);
+      if (entry)
+      {
+         if (e->trivial_accept)
+            R_AliasDrawUnclippedPoints(pahdr, lod, entry->finalverts);
+         else
+            R_AliasDrawPoints(pahdr, lod, entry->finalverts,
+                  entry->auxverts);
+         r_amodels_cached++;
+         return;
+      }
+
+      entry = R_AliasCacheAlloc(&key, hash, lod->numverts);
+      if (entry)
+      {
+         pfinalverts = entry->finalverts;
+         pauxverts = entry->auxverts;
+      }
+   }
+
    if (e->trivial_accept)
-      R_AliasPrepareUnclippedPoints(pahdr, pfinalverts);
+   {
+      R_AliasPrepareUnclippedPoints(pahdr, lod, pfinalverts);
+      R_AliasDrawUnclippedPoints(pahdr, lod, pfinalverts);
+   }
    else
-      R_AliasPreparePoints(pahdr, pfinalverts, pauxverts);
-
-   free(auxverts);
-   free(finalverts);
+   {
+      R_AliasPreparePoints(pahdr, lod, pfinalverts, pauxverts);
+      R_AliasDrawPoints(pahdr, lod, pfinalverts, pauxverts);
+   }
 }
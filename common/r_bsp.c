@@ -19,6 +19,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // r_bsp.c
 
+#include <string.h>
+
 #include "quakedef.h"
 #include "r_local.h"
 #include "console.h"
@@ -145,6 +147,22 @@ void R_RotateBmodel(const entity_t *e)
    R_TransformFrustum();
 }
 
+/*
+================
+R_TranslateBmodel
+
+R_RotateBmodel for a brush model with no rotation, which only needs the
+frustum moved to modelorg
+================
+*/
+void R_TranslateBmodel(void)
+{
+   static const float identity[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+
+   memcpy(entity_rotation, identity, sizeof(entity_rotation));
+   R_TranslateFrustum();
+}
+
 
 /*
 ================
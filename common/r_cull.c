@@ -0,0 +1,271 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// r_cull.c -- boxes and spheres against the view clip planes
+
+#include "model.h"
+#include "quakedef.h"
+#include "r_local.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+ * All these give the same answers as testing each plane with
+ * BoxOnPlaneSide. For each axis the nearer and farther of the two products
+ * is the one BoxOnPlaneSide picks by the plane's sign bits, and the sums are
+ * done in the same order.
+ */
+
+void
+R_SetupClipPlanes(clipplanes_t *planes)
+{
+    int i, j;
+
+    for (i = 0; i < 4; i++) {
+	for (j = 0; j < 3; j++)
+	    planes->normal[j][i] = view_clipplanes[i].plane.normal[j];
+	planes->dist[i] = view_clipplanes[i].plane.dist;
+    }
+}
+
+/*
+ * Clips the box against the planes still set in clipflags. Returns the
+ * planes the box still crosses, or BMODEL_FULLY_CLIPPED if it's behind any
+ * of them.
+ */
+int
+R_ClipBox(const clipplanes_t *planes, const vec3_t mins, const vec3_t maxs,
+	  int clipflags)
+{
+    int back, front;
+#if defined(__SSE2__)
+    __m128 lo, hi, nearest, farthest, dist;
+    int i;
+
+    nearest = farthest = _mm_setzero_ps();
+    for (i = 0; i < 3; i++) {
+	lo = _mm_mul_ps(_mm_loadu_ps(planes->normal[i]), _mm_set1_ps(mins[i]));
+	hi = _mm_mul_ps(_mm_loadu_ps(planes->normal[i]), _mm_set1_ps(maxs[i]));
+	if (i) {
+	    nearest = _mm_add_ps(nearest, _mm_min_ps(lo, hi));
+	    farthest = _mm_add_ps(farthest, _mm_max_ps(lo, hi));
+	} else {
+	    nearest = _mm_min_ps(lo, hi);
+	    farthest = _mm_max_ps(lo, hi);
+	}
+    }
+    dist = _mm_loadu_ps(planes->dist);
+    back = _mm_movemask_ps(_mm_cmplt_ps(farthest, dist));
+    front = _mm_movemask_ps(_mm_cmpge_ps(nearest, dist));
+#elif defined(__ARM_NEON)
+    static const uint32_t bits[4] = { 1, 2, 4, 8 };
+    float32x4_t lo, hi, nearest, farthest, dist;
+    uint32_t mask[4];
+    int i;
+
+    nearest = farthest = vdupq_n_f32(0);
+    for (i = 0; i < 3; i++) {
+	lo = vmulq_n_f32(vld1q_f32(planes->normal[i]), mins[i]);
+	hi = vmulq_n_f32(vld1q_f32(planes->normal[i]), maxs[i]);
+	if (i) {
+	    nearest = vaddq_f32(nearest, vminq_f32(lo, hi));
+	    farthest = vaddq_f32(farthest, vmaxq_f32(lo, hi));
+	} else {
+	    nearest = vminq_f32(lo, hi);
+	    farthest = vmaxq_f32(lo, hi);
+	}
+    }
+    dist = vld1q_f32(planes->dist);
+    vst1q_u32(mask, vandq_u32(vcltq_f32(farthest, dist), vld1q_u32(bits)));
+    back = mask[0] | mask[1] | mask[2] | mask[3];
+    vst1q_u32(mask, vandq_u32(vcgeq_f32(nearest, dist), vld1q_u32(bits)));
+    front = mask[0] | mask[1] | mask[2] | mask[3];
+#else
+    float lo, hi, nearest, farthest;
+    int i, j;
+
+    back = front = 0;
+    for (i = 0; i < 4; i++) {
+	nearest = farthest = 0;
+	for (j = 0; j < 3; j++) {
+	    lo = planes->normal[j][i] * mins[j];
+	    hi = planes->normal[j][i] * maxs[j];
+	    nearest = j ? nearest + qmin(lo, hi) : qmin(lo, hi);
+	    farthest = j ? farthest + qmax(lo, hi) : qmax(lo, hi);
+	}
+	if (farthest < planes->dist[i])
+	    back |= 1 << i;
+	if (nearest >= planes->dist[i])
+	    front |= 1 << i;
+    }
+#endif
+
+    if (back & clipflags)
+	return BMODEL_FULLY_CLIPPED;
+
+    return clipflags & ~front;
+}
+
+/*
+ * Clips a sphere against all four planes. Returns the planes it crosses,
+ * or BMODEL_FULLY_CLIPPED if it's behind any of them.
+ */
+int
+R_ClipSphere(const clipplanes_t *planes, const vec3_t origin, vec_t radius)
+{
+    int i, clipflags;
+    vec_t d;
+
+    clipflags = 0;
+    for (i = 0; i < 4; i++) {
+	d = origin[0] * planes->normal[0][i] + origin[1] * planes->normal[1][i] +
+	    origin[2] * planes->normal[2][i];
+	d -= planes->dist[i];
+
+	if (d <= -radius)
+	    return BMODEL_FULLY_CLIPPED;
+
+	if (d <= radius)
+	    clipflags |= (1 << i);
+    }
+
+    return clipflags;
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+#if defined(__SSE2__)
+typedef __m128 cullfloat_t;
+typedef __m128i cullmask_t;
+#define Cull_Load(p)		_mm_loadu_ps(p)
+#define Cull_Splat(f)		_mm_set1_ps(f)
+#define Cull_Mul(a, b)		_mm_mul_ps(a, b)
+#define Cull_Add(a, b)		_mm_add_ps(a, b)
+#define Cull_Min(a, b)		_mm_min_ps(a, b)
+#define Cull_Max(a, b)		_mm_max_ps(a, b)
+#define Cull_Less(a, b)		_mm_castps_si128(_mm_cmplt_ps(a, b))
+#define Cull_GreaterEqual(a, b)	_mm_castps_si128(_mm_cmpge_ps(a, b))
+#define Cull_SplatMask(i)	_mm_set1_epi32(i)
+#define Cull_And(a, b)		_mm_and_si128(a, b)
+#define Cull_AndNot(a, b)	_mm_andnot_si128(b, a)	/* a & ~b */
+#define Cull_Or(a, b)		_mm_or_si128(a, b)
+#define Cull_Select(m, a, b)	_mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b))
+#define Cull_Store(p, m)	_mm_storeu_si128((__m128i *)(p), m)
+#else
+typedef float32x4_t cullfloat_t;
+typedef uint32x4_t cullmask_t;
+#define Cull_Load(p)		vld1q_f32(p)
+#define Cull_Splat(f)		vdupq_n_f32(f)
+#define Cull_Mul(a, b)		vmulq_f32(a, b)
+#define Cull_Add(a, b)		vaddq_f32(a, b)
+#define Cull_Min(a, b)		vminq_f32(a, b)
+#define Cull_Max(a, b)		vmaxq_f32(a, b)
+#define Cull_Less(a, b)		vcltq_f32(a, b)
+#define Cull_GreaterEqual(a, b)	vcgeq_f32(a, b)
+#define Cull_SplatMask(i)	vdupq_n_u32(i)
+#define Cull_And(a, b)		vandq_u32(a, b)
+#define Cull_AndNot(a, b)	vbicq_u32(a, b)		/* a & ~b */
+#define Cull_Or(a, b)		vorrq_u32(a, b)
+#define Cull_Select(m, a, b)	vbslq_u32(m, a, b)
+#define Cull_Store(p, m)	vst1q_u32((uint32_t *)(p), m)
+#endif
+
+/*
+ * Clips four surfaces at a time, each against every plane in clipflags,
+ * from the model's surface bounds.
+ */
+static int
+R_ClipSurfaces4(const clipplanes_t *planes, const model_t *model, int first,
+		int count, int clipflags)
+{
+    const float *bounds = model->surfbounds;
+    const int stride = model->numsurfaces;
+    cullfloat_t mins[3], maxs[3], normal, lo, hi, nearest, farthest, dist;
+    cullmask_t back, flags;
+    msurface_t *surf;
+    int i, j, plane, result[4];
+
+    for (i = 0; i + 4 <= count; i += 4) {
+	for (j = 0; j < 3; j++) {
+	    mins[j] = Cull_Load(&bounds[j * stride + first + i]);
+	    maxs[j] = Cull_Load(&bounds[(j + 3) * stride + first + i]);
+	}
+	back = Cull_SplatMask(0);
+	flags = Cull_SplatMask(clipflags);
+	for (plane = 0; plane < 4; plane++) {
+	    if (!(clipflags & (1 << plane)))
+		continue;
+	    for (j = 0; j < 3; j++) {
+		normal = Cull_Splat(planes->normal[j][plane]);
+		lo = Cull_Mul(normal, mins[j]);
+		hi = Cull_Mul(normal, maxs[j]);
+		if (j) {
+		    nearest = Cull_Add(nearest, Cull_Min(lo, hi));
+		    farthest = Cull_Add(farthest, Cull_Max(lo, hi));
+		} else {
+		    nearest = Cull_Min(lo, hi);
+		    farthest = Cull_Max(lo, hi);
+		}
+	    }
+	    dist = Cull_Splat(planes->dist[plane]);
+	    back = Cull_Or(back, Cull_Less(farthest, dist));
+	    flags = Cull_AndNot(flags, Cull_And(Cull_GreaterEqual(nearest, dist),
+						Cull_SplatMask(1 << plane)));
+	}
+	flags = Cull_Select(back, Cull_SplatMask(BMODEL_FULLY_CLIPPED), flags);
+	Cull_Store(result, flags);
+
+	surf = &model->surfaces[first + i];
+	for (j = 0; j < 4; j++)
+	    surf[j].clipflags = result[j];
+    }
+
+    return i;
+}
+#endif
+
+/*
+ * Sets the clipflags of the model's surfaces from first to first + count,
+ * starting from the given clipflags
+ */
+void
+R_ClipSurfaces(const clipplanes_t *planes, model_t *model, int first,
+	       int count, int clipflags)
+{
+    msurface_t *surf;
+    int i;
+
+    i = 0;
+    if (clipflags) {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+	i = R_ClipSurfaces4(planes, model, first, count, clipflags);
+#endif
+    }
+
+    surf = &model->surfaces[first + i];
+    for (; i < count; i++, surf++) {
+	surf->clipflags = clipflags;
+	if (clipflags)
+	    surf->clipflags = R_ClipBox(planes, surf->mins, surf->maxs,
+					clipflags);
+    }
+}
@@ -215,8 +215,7 @@ void R_EmitEdge(mvertex_t *pv0, mvertex_t *pv1)
       pcheck->next = edge;
    }
 
-   edge->nextremove = removeedges[v2];
-   removeedges[v2] = edge;
+   edge->lastv = v2;
 }
 
 
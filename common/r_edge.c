@@ -36,7 +36,6 @@ extern int screenwidth;
 */
 #endif
 
-edge_t *auxedges;
 edge_t *r_edges, *edge_p, *edge_max;
 
 surf_t *surfaces, *surface_p, *surf_max;
@@ -46,7 +45,25 @@ surf_t *surfaces, *surface_p, *surf_max;
 // surfaces[1] is the background, and is used as the active surface stack
 
 edge_t *newedges[MAXHEIGHT];
-edge_t *removeedges[MAXHEIGHT];
+
+/*
+ * The active edge table: the edges crossing the current scan, sorted on u,
+ * from edge_head, which always stays first, through edge_tail. Each keeps
+ * a copy of what the span code needs from the edge, so stepping, sorting
+ * and walking it runs down one array rather than chasing edge pointers.
+ * Edges past their last scan are dropped as the rest are stepped.
+ */
+typedef struct {
+   fixed16_t u;
+   fixed16_t u_step;
+   int lastv;			// the last scan it crosses
+   unsigned int surfs[2];
+} aetedge_t;
+
+static aetedge_t *aet;
+static aetedge_t *aet_new;	// the edges starting on the scan, for merging
+static int *aet_newpos;		// and where each goes
+static int aet_count;
 
 espan_t *span_p;
 static espan_t *max_span_p;
@@ -61,17 +78,15 @@ static void (*pdrawfunc) (void);
 
 edge_t edge_head;
 edge_t edge_tail;
-edge_t edge_aftertail;
-edge_t edge_sentinel;
 
 float fv;
 
 void R_GenerateSpans(void);
 void R_GenerateSpansBackward(void);
 
-void R_LeadingEdge(edge_t *edge);
-void R_LeadingEdgeBackwards(edge_t *edge);
-void R_TrailingEdge(surf_t *surf, edge_t *edge);
+static void R_LeadingEdge(const aetedge_t *edge);
+static void R_LeadingEdgeBackwards(const aetedge_t *edge);
+static void R_TrailingEdge(surf_t *surf, const aetedge_t *edge);
 
 //=============================================================================
 
@@ -104,128 +119,83 @@ void R_BeginEdgeFrame(void)
    }
 
    // FIXME: set with memset
-   for (v = r_refdef.vrect.y; v < r_refdef.vrectbottom; v++) {
-      newedges[v] = removeedges[v] = NULL;
-   }
+   for (v = r_refdef.vrect.y; v < r_refdef.vrectbottom; v++)
+      newedges[v] = NULL;
 }
 
 
-/*
-==============
-R_InsertNewEdges
-
-Adds the edges in the linked list edgestoadd, adding them to the edges in the
-linked list edgelist.  edgestoadd is assumed to be sorted on u, and non-empty
-(this is actually newedges[v]).  edgelist is assumed to be sorted on u, with a
-sentinel at the end (actually, this is the active edge table starting at
-edge_head.next).
-==============
-*/
-void R_InsertNewEdges(edge_t *edgestoadd, edge_t *edgelist)
+static void
+R_ActivateEdge(aetedge_t *active, const edge_t *edge)
 {
-   edge_t *next_edge;
-
-   do {
-      next_edge = edgestoadd->next;
-edgesearch:
-      if (edgelist->u >= edgestoadd->u)
-         goto addedge;
-      edgelist = edgelist->next;
-      if (edgelist->u >= edgestoadd->u)
-         goto addedge;
-      edgelist = edgelist->next;
-      if (edgelist->u >= edgestoadd->u)
-         goto addedge;
-      edgelist = edgelist->next;
-      if (edgelist->u >= edgestoadd->u)
-         goto addedge;
-      edgelist = edgelist->next;
-      goto edgesearch;
-
-      // insert edgestoadd before edgelist
-addedge:
-      edgestoadd->next = edgelist;
-      edgestoadd->prev = edgelist->prev;
-      edgelist->prev->next = edgestoadd;
-      edgelist->prev = edgestoadd;
-   } while ((edgestoadd = next_edge) != NULL);
+   active->u = edge->u;
+   active->u_step = edge->u_step;
+   active->lastv = edge->lastv;
+   active->surfs[0] = edge->surfs[0];
+   active->surfs[1] = edge->surfs[1];
 }
 
 /*
 ==============
-R_RemoveEdges
+R_InsertNewEdges
+
+Adds the edges in the linked list edgestoadd to the active edge table.
+edgestoadd is assumed to be sorted on u, and non-empty (this is actually
+newedges[v]). Each goes before the first active edge from where the last
+one went with a u at least its own, so after edge_head. Where they go is
+found first, then they're merged in from the end, so no edge is moved more
+than once.
 ==============
 */
-void R_RemoveEdges(edge_t *pedge)
+void R_InsertNewEdges(edge_t *edgestoadd)
 {
+   int numnew, pos, i;
+   aetedge_t *out;
+
+   pos = 1;
+   for (numnew = 0; edgestoadd; edgestoadd = edgestoadd->next, numnew++) {
+      R_ActivateEdge(&aet_new[numnew], edgestoadd);
+      while (pos < aet_count && aet[pos].u < edgestoadd->u)
+         pos++;
+      aet_newpos[numnew] = pos;
+   }
 
-   do {
-      pedge->next->prev = pedge->prev;
-      pedge->prev->next = pedge->next;
-   } while ((pedge = pedge->nextremove) != NULL);
+   i = aet_count - 1;
+   aet_count += numnew;
+   out = &aet[aet_count - 1];
+   while (numnew--) {
+      while (i >= aet_newpos[numnew])
+         *out-- = aet[i--];
+      *out-- = aet_new[numnew];
+   }
 }
 
 /*
 ==============
 R_StepActiveU
+
+Steps the active edges on to the next scan, dropping those that have ended
+and keeping the rest sorted. Edges only move a little from scan to scan, so
+the insertion sort seldom has far to go.
 ==============
 */
-void R_StepActiveU(edge_t *pedge)
+void R_StepActiveU(void)
 {
-   edge_t *pnext_edge, *pwedge;
-
-   while (1) {
-nextedge:
-      pedge->u += pedge->u_step;
-      if (pedge->u < pedge->prev->u)
-         goto pushback;
-      pedge = pedge->next;
-
-      pedge->u += pedge->u_step;
-      if (pedge->u < pedge->prev->u)
-         goto pushback;
-      pedge = pedge->next;
-
-      pedge->u += pedge->u_step;
-      if (pedge->u < pedge->prev->u)
-         goto pushback;
-      pedge = pedge->next;
+   aetedge_t edge, *table = aet;
+   int i, j, count = 1;
 
-      pedge->u += pedge->u_step;
-      if (pedge->u < pedge->prev->u)
-         goto pushback;
-      pedge = pedge->next;
+   for (i = 1; i < aet_count; i++) {
+      if (table[i].lastv == current_iv)
+         continue;
 
-      goto nextedge;
-
-pushback:
-      if (pedge == &edge_aftertail)
-         return;
+      edge = table[i];
+      edge.u += edge.u_step;
 
       // push it back to keep it sorted
-      pnext_edge = pedge->next;
-
-      // pull the edge out of the edge list
-      pedge->next->prev = pedge->prev;
-      pedge->prev->next = pedge->next;
-
-      // find out where the edge goes in the edge list
-      pwedge = pedge->prev->prev;
-
-      while (pwedge->u > pedge->u) {
-         pwedge = pwedge->prev;
-      }
-
-      // put the edge back into the edge list
-      pedge->next = pwedge->next;
-      pedge->prev = pwedge;
-      pedge->next->prev = pedge;
-      pwedge->next = pedge;
-
-      pedge = pnext_edge;
-      if (pedge == &edge_tail)
-         return;
+      for (j = count++; j > 1 && table[j - 1].u > edge.u; j--)
+         table[j] = table[j - 1];
+      table[j] = edge;
    }
+   aet_count = count;
 }
 
 /*
@@ -265,7 +235,7 @@ void R_CleanupSpan(void)
 R_LeadingEdgeBackwards
 ==============
 */
-void R_LeadingEdgeBackwards(edge_t *edge)
+static void R_LeadingEdgeBackwards(const aetedge_t *edge)
 {
    espan_t *span;
    surf_t *surf2;
@@ -340,7 +310,7 @@ gotposition:
 R_TrailingEdge
 ==============
 */
-void R_TrailingEdge(surf_t *surf, edge_t *edge)
+static void R_TrailingEdge(surf_t *surf, const aetedge_t *edge)
 {
    espan_t *span;
    int iu;
@@ -377,7 +347,7 @@ void R_TrailingEdge(surf_t *surf, edge_t *edge)
 R_LeadingEdge
 ==============
 */
-void R_LeadingEdge(edge_t *edge)
+static void R_LeadingEdge(const aetedge_t *edge)
 {
    espan_t *span;
    surf_t *surf, *surf2;
@@ -491,7 +461,7 @@ R_GenerateSpans
 */
 void R_GenerateSpans(void)
 {
-   edge_t *edge;
+   const aetedge_t *edge;
    surf_t *surf;
 
    r_bmodelactive = 0;
@@ -500,8 +470,8 @@ void R_GenerateSpans(void)
    surfaces[1].next = surfaces[1].prev = &surfaces[1];
    surfaces[1].last_u = edge_head_u_shift20;
 
-   // generate spans
-   for (edge = edge_head.next; edge != &edge_tail; edge = edge->next) {
+   // generate spans, up to the tail, the only edge ending the background
+   for (edge = &aet[1]; edge->surfs[0] != 1; edge++) {
       if (edge->surfs[0]) {
          // it has a left surface, so a surface is going away for this span
          surf = &surfaces[edge->surfs[0]];
@@ -525,7 +495,7 @@ R_GenerateSpansBackward
 */
 void R_GenerateSpansBackward(void)
 {
-   edge_t *edge;
+   const aetedge_t *edge;
 
    r_bmodelactive = 0;
 
@@ -533,8 +503,8 @@ void R_GenerateSpansBackward(void)
    surfaces[1].next = surfaces[1].prev = &surfaces[1];
    surfaces[1].last_u = edge_head_u_shift20;
 
-   // generate spans
-   for (edge = edge_head.next; edge != &edge_tail; edge = edge->next)
+   // generate spans, up to the tail, the only edge ending the background
+   for (edge = &aet[1]; edge->surfs[0] != 1; edge++)
    {
       if (edge->surfs[0])
          R_TrailingEdge(&surfaces[edge->surfs[0]], edge);
@@ -573,32 +543,30 @@ void R_ScanEdges(void)
 
    span_p = basespan_p;
 
+   // room for every edge at once, as well as the head and tail
+   aet = Frame_Alloc((edge_p - r_edges + 2) * sizeof(aetedge_t));
+   aet_new = Frame_Alloc((edge_p - r_edges + 1) * sizeof(aetedge_t));
+   aet_newpos = Frame_Alloc((edge_p - r_edges + 1) * sizeof(int));
+
    // clear active edges to just the background edges around the whole screen
    // FIXME: most of this only needs to be set up once
    edge_head.u = r_refdef.vrect.x << 20;
    edge_head_u_shift20 = edge_head.u >> 20;
    edge_head.u_step = 0;
-   edge_head.prev = NULL;
-   edge_head.next = &edge_tail;
+   edge_head.lastv = MAXHEIGHT;
    edge_head.surfs[0] = 0;
    edge_head.surfs[1] = 1;
 
    edge_tail.u = (r_refdef.vrectright << 20) + 0xFFFFF;
    edge_tail_u_shift20 = edge_tail.u >> 20;
    edge_tail.u_step = 0;
-   edge_tail.prev = &edge_head;
-   edge_tail.next = &edge_aftertail;
+   edge_tail.lastv = MAXHEIGHT;
    edge_tail.surfs[0] = 1;
    edge_tail.surfs[1] = 0;
 
-   edge_aftertail.u = -1;	// force a move
-   edge_aftertail.u_step = 0;
-   edge_aftertail.next = &edge_sentinel;
-   edge_aftertail.prev = &edge_tail;
-
-   // FIXME: do we need this now that we clamp x in r_draw.c?
-   edge_sentinel.u = FIXED16_MAX;	// make sure nothing sorts past this
-   edge_sentinel.prev = &edge_aftertail;
+   R_ActivateEdge(&aet[0], &edge_head);
+   R_ActivateEdge(&aet[1], &edge_tail);
+   aet_count = 2;
 
    //
    // process all scan lines
@@ -612,9 +580,8 @@ void R_ScanEdges(void)
       // mark that the head (background start) span is pre-included
       surfaces[1].spanstate = 1;
 
-      if (newedges[iv]) {
-         R_InsertNewEdges(newedges[iv], edge_head.next);
-      }
+      if (newedges[iv])
+         R_InsertNewEdges(newedges[iv]);
 
       (*pdrawfunc) ();
 
@@ -633,11 +600,7 @@ void R_ScanEdges(void)
          span_p = basespan_p;
       }
 
-      if (removeedges[iv])
-         R_RemoveEdges(removeedges[iv]);
-
-      if (edge_head.next != &edge_tail)
-         R_StepActiveU(edge_head.next);
+      R_StepActiveU();
    }
 
    // do the last scan (no need to step or sort or remove on the last scan)
@@ -649,7 +612,7 @@ void R_ScanEdges(void)
    surfaces[1].spanstate = 1;
 
    if (newedges[iv])
-      R_InsertNewEdges(newedges[iv], edge_head.next);
+      R_InsertNewEdges(newedges[iv]);
 
    (*pdrawfunc) ();
 
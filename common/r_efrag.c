@@ -19,10 +19,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // r_efrag.c
 
+#include <string.h>
+
 #include "console.h"
 #include "model.h"
 #include "quakedef.h"
 #include "sys.h"
+#include "zone.h"
 
 #include "r_local.h"
 
@@ -44,6 +47,41 @@ static entity_t *r_addent;
 
 vec3_t r_emins, r_emaxs;
 
+/*
+ * The efrags of every leaf flattened into one array in leaf order, so
+ * R_StoreEfrags reads a leaf's entities without chasing the links. Rebuilt
+ * whenever an entity is added to or removed from the world, which for the
+ * static entities only happens while the level is being set up.
+ */
+static entity_t *r_leafents[MAX_EFRAGS];
+static int *r_leafentstart;	/* numleafs + 1 entries, on the hunk */
+static qboolean r_leafentsdirty;
+
+/* The static entities already stored this frame */
+static unsigned r_storedents[(MAX_STATIC_ENTITIES + 31) >> 5];
+
+/*
+================
+R_ClearEfrags
+
+Call once the world model of a new level is loaded
+================
+*/
+void
+R_ClearEfrags(void)
+{
+    int i;
+
+// clear out efrags in case the level hasn't been reloaded
+// FIXME: is this one short?
+    for (i = 0; i < cl.worldmodel->numleafs; i++)
+	cl.worldmodel->leafs[i].efrags = NULL;
+
+    r_leafentstart = Hunk_AllocName((cl.worldmodel->numleafs + 1) *
+				    sizeof(*r_leafentstart), "efrags");
+    r_leafentsdirty = true;
+}
+
 /*
 ================
 R_RemoveEfrags
@@ -57,6 +95,8 @@ R_RemoveEfrags(entity_t *ent)
     efrag_t *ef, *old, *walk, **prev;
 
     ef = ent->efrag;
+    if (ef)
+	r_leafentsdirty = true;
 
     while (ef) {
 	prev = &ef->leaf->efrags;
@@ -199,6 +239,7 @@ R_AddEfrags(entity_t *ent)
 	return;
 
     r_addent = ent;
+    r_leafentsdirty = true;
     lastlink = &ent->efrag;
     r_pefragtopnode = NULL;
 
@@ -210,37 +251,88 @@ R_AddEfrags(entity_t *ent)
 }
 
 
+/*
+================
+R_BuildLeafEnts
+================
+*/
+static void
+R_BuildLeafEnts(void)
+{
+    const model_t *model = cl.worldmodel;
+    const efrag_t *ef;
+    int i, count;
+
+    count = 0;
+    for (i = 0; i < model->numleafs; i++) {
+	r_leafentstart[i] = count;
+	for (ef = model->leafs[i + 1].efrags; ef; ef = ef->leafnext) {
+	    switch (ef->entity->model->type) {
+	    case mod_alias:
+	    case mod_brush:
+	    case mod_sprite:
+		r_leafents[count++] = ef->entity;
+		break;
+	    default:
+		Sys_Error("%s: Bad entity type %d", __func__,
+			  ef->entity->model->type);
+	    }
+	}
+    }
+    r_leafentstart[i] = count;
+    r_leafentsdirty = false;
+}
+
+/*
+================
+R_BeginEfrags
+
+Call before storing the efrags of the visible leafs for a frame
+================
+*/
+void
+R_BeginEfrags(void)
+{
+    if (r_leafentsdirty)
+	R_BuildLeafEnts();
+    memset(r_storedents, 0,
+	   ((cl.num_statics + 31) >> 5) * sizeof(r_storedents[0]));
+}
+
 /*
 ================
 R_StoreEfrags
 
-// FIXME: a lot of this goes away with edge-based
+Adds the entities touching the leaf to the visible edicts, each only once
+a frame. The static entities are checked off in a bitset, anything else by
+its visframe.
 ================
 */
 void
-R_StoreEfrags(efrag_t **ppefrag)
+R_StoreEfrags(int leafnum)
 {
-    entity_t *pent;
-    model_t *clmodel;
-    efrag_t *pefrag;
-
-    while ((pefrag = *ppefrag) != NULL) {
-	pent = pefrag->entity;
-	clmodel = pent->model;
-	switch (clmodel->type) {
-	case mod_alias:
-	case mod_brush:
-	case mod_sprite:
-	    if ((pent->visframe != r_framecount) &&
-		(cl_numvisedicts < MAX_VISEDICTS)) {
-		/* mark that we've recorded this entity for this frame */
-		pent->visframe = r_framecount;
-		cl_visedicts[cl_numvisedicts++] = *pent;
-	    }
-	    ppefrag = &pefrag->leafnext;
-	    break;
-	default:
-	    Sys_Error("%s: Bad entity type %d", __func__, clmodel->type);
+    entity_t *const *pent, *const *end;
+    entity_t *ent;
+    unsigned i, bit;
+
+    pent = &r_leafents[r_leafentstart[leafnum]];
+    end = &r_leafents[r_leafentstart[leafnum + 1]];
+    for (; pent < end; pent++) {
+	ent = *pent;
+	i = ent - cl_static_entities;
+	if (i < MAX_STATIC_ENTITIES) {
+	    bit = 1U << (i & 31);
+	    if (r_storedents[i >> 5] & bit)
+		continue;
+	    r_storedents[i >> 5] |= bit;
+	} else if (ent->visframe == r_framecount) {
+	    continue;
 	}
+	if (cl_numvisedicts == MAX_VISEDICTS)
+	    break;
+
+	/* mark that we've recorded this entity for this frame */
+	ent->visframe = r_framecount;
+	cl_visedicts[cl_numvisedicts++] = *ent;
     }
 }
@@ -19,6 +19,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // r_light.c
 
+#include <stdint.h>
+#include <string.h>
+
+#include "prof.h"
 #include "quakedef.h"
 #include "r_local.h"
 
@@ -31,24 +35,33 @@ R_AnimateLight
 */
 void R_AnimateLight(void)
 {
-   int j, k;
+   int j, k, changed = 0;
 
    /* light animations
     * 'm' is normal light, 'a' is no light, 'z' is double bright */
    int i = (int)(cl.time * 10);
 
+   /*
+    * Cached surfaces keep the values of their own styles, so a style that
+    * changes only has its own surfaces rebuilt; count how many did.
+    */
    for (j = 0; j < MAX_LIGHTSTYLES; j++)
    {
       if (!cl_lightstyle[j].length)
+         k = 256;
+      else
       {
-         d_lightstylevalue[j] = 256;
-         continue;
+         k = i % cl_lightstyle[j].length;
+         k = cl_lightstyle[j].map[k] - 'a';
+         k = k * 22;
+      }
+      if (d_lightstylevalue[j] != k)
+      {
+         d_lightstylevalue[j] = k;
+         changed++;
       }
-      k = i % cl_lightstyle[j].length;
-      k = cl_lightstyle[j].map[k] - 'a';
-      k = k * 22;
-      d_lightstylevalue[j] = k;
    }
+   Prof_Count(PROF_STYLES, changed);
 }
 
 
@@ -65,47 +78,71 @@ DYNAMIC LIGHTS
 R_MarkLights
 =============
 */
+#define MARKLIGHTS_STACK 256
+
 void R_MarkLights (dlight_t *light, int num, mnode_t *node)  //qbism- adapted from MH tute - increased dlights
 {
+   mnode_t    *stack[MARKLIGHTS_STACK];
    mplane_t   *splitplane;
    float      dist;
    msurface_t   *surf;
-   int         i;
-
-   if (node->contents < 0)
-      return;
+   int         i, depth = 0;
+
+   /*
+    * Walked with a stack of the far sides still to do, rather than
+    * recursing into both children; should a deep tree ever fill it, the
+    * rest of that side is recursed into instead.
+    */
+   for (;;)
+   {
+      if (node->contents < 0)
+      {
+         if (!depth)
+            return;
+         node = stack[--depth];
+         continue;
+      }
 
-   splitplane = node->plane;
-   dist = DotProduct (light->origin, splitplane->normal) - splitplane->dist;
+      splitplane = node->plane;
+      dist = DotProduct (light->origin, splitplane->normal) - splitplane->dist;
 
-   if (dist > light->radius)
-   {
-      R_MarkLights (light, num, node->children[0]);
-      return;
-   }
+      if (dist > light->radius)
+      {
+         node = node->children[0];
+         continue;
+      }
 
-   if (dist < -light->radius)
-   {
-      R_MarkLights (light, num, node->children[1]);
-      return;
-   }
+      if (dist < -light->radius)
+      {
+         node = node->children[1];
+         continue;
+      }
 
-   // mark the polygons
-   surf = cl.worldmodel->surfaces + node->firstsurface;
+      // mark the polygons the light will actually add to
+      surf = cl.worldmodel->surfaces + node->firstsurface;
 
-   for (i = 0; i < node->numsurfaces; i++, surf++)
-   {
-      if (surf->dlightframe != r_framecount)
+      for (i = 0; i < node->numsurfaces; i++, surf++)
       {
-         memset (surf->dlightbits, 0, sizeof (surf->dlightbits));
-         surf->dlightframe = r_framecount;
+         c_dlightsurfs++;
+         if (!R_DlightTouchesSurface(light, surf))
+            continue;
+         c_dlightmarked++;
+
+         if (surf->dlightframe != r_framecount)
+         {
+            memset (surf->dlightbits, 0, sizeof (surf->dlightbits));
+            surf->dlightframe = r_framecount;
+         }
+
+         surf->dlightbits[num >> 5] |= 1 << (num & 31);
       }
 
-      surf->dlightbits[num >> 5] |= 1 << (num & 31);
+      if (depth < MARKLIGHTS_STACK)
+         stack[depth++] = node->children[1];
+      else
+         R_MarkLights (light, num, node->children[1]);
+      node = node->children[0];
    }
-
-   R_MarkLights (light, num, node->children[0]);
-   R_MarkLights (light, num, node->children[1]);
 }
 
 
@@ -136,8 +173,30 @@ LIGHT SAMPLING
 
 =============================================================================
 */
+/*
+ * Where a point's light comes from: the lightmap sample under it, found by
+ * tracing down through the world. The light itself is worked out from the
+ * sample with the current lightstyles, so a sample stays good until the
+ * level changes.
+ */
+typedef struct {
+   vec3_t point;
+   qboolean colored;
+   const msurface_t *surf;	/* NULL if nothing was hit */
+   const byte *lightmap;	/* NULL if the surface has no samples */
+   int dsfrac, dtfrac;	/* colored only, for the interpolation */
+} lightsample_t;
 
-int RecursiveLightPoint(mnode_t *node, vec3_t start, vec3_t end)
+/*
+ * Recently sampled points, so entities that haven't moved since the last
+ * frame skip the trace
+ */
+#define LIGHTCACHE_SIZE 256
+static lightsample_t r_lightcache[LIGHTCACHE_SIZE];
+static qboolean r_lightcachevalid[LIGHTCACHE_SIZE];
+
+static int RecursiveLightPoint(lightsample_t *sample, mnode_t *node,
+      vec3_t start, vec3_t end)
 {
    int r;
    float front, back, frac;
@@ -148,12 +207,9 @@ int RecursiveLightPoint(mnode_t *node, vec3_t start, vec3_t end)
    int s, t, ds, dt;
    int i;
    mtexinfo_t *tex;
-   byte *lightmap;
-   unsigned scale;
-   int maps;
 
    if (node->contents < 0)
-      return -1;		// didn't hit anything
+      return false;		// didn't hit anything
 
    // calculate mid point
 
@@ -174,7 +230,7 @@ int RecursiveLightPoint(mnode_t *node, vec3_t start, vec3_t end)
 
    /* FIXME - tail recursion => optimize */
    if ((back < 0) == side)
-      return RecursiveLightPoint(node->children[side], start, end);
+      return RecursiveLightPoint(sample, node->children[side], start, end);
 
    frac = front / (front - back);
    mid[0] = start[0] + (end[0] - start[0]) * frac;
@@ -182,12 +238,12 @@ int RecursiveLightPoint(mnode_t *node, vec3_t start, vec3_t end)
    mid[2] = start[2] + (end[2] - start[2]) * frac;
 
    // go down front side
-   r = RecursiveLightPoint(node->children[side], start, mid);
-   if (r >= 0)
+   r = RecursiveLightPoint(sample, node->children[side], start, mid);
+   if (r)
       return r;		// hit something
 
    if ((back < 0) == side)
-      return -1;		// didn't hit anuthing
+      return false;		// didn't hit anuthing
 
    // check for impact on this node
 
@@ -210,45 +266,27 @@ int RecursiveLightPoint(mnode_t *node, vec3_t start, vec3_t end)
       if (ds > surf->extents[0] || dt > surf->extents[1])
          continue;
 
-      if (!surf->samples)
-         return 0;
-
-      ds >>= 4;
-      dt >>= 4;
-
-      /* FIXME: does this account properly for dynamic lights? e.g. rocket */
-      lightmap = surf->samples;
-      r = 0;
-      if (lightmap) {
-         lightmap += dt * ((surf->extents[0] >> 4) + 1) + ds;
-         for (maps = 0; maps < MAXLIGHTMAPS && surf->styles[maps] != 255;
-               maps++) {
-            scale = d_lightstylevalue[surf->styles[maps]];
-            r += *lightmap * scale;
-            if (coloredlights)
-               lightmap += ((surf->extents[0] >> 4) + 1) * ((surf->extents[1] >> 4) + 1) * 3;
-            else
-               lightmap += ((surf->extents[0] >> 4) + 1) * ((surf->extents[1] >> 4) + 1);	/* colored lighting change */
-
-         }
-         r >>= 8;
+      sample->surf = surf;
+      sample->lightmap = NULL;
+      if (surf->samples) {
+         ds >>= 4;
+         dt >>= 4;
+         sample->lightmap = surf->samples + dt * ((surf->extents[0] >> 4) + 1) + ds;
       }
 
-      return r;
+      return true;
    }
 
    /* FIXME - tail recursion => optimize */
    /* go down back side */
-   return RecursiveLightPoint(node->children[!side], mid, end);
+   return RecursiveLightPoint(sample, node->children[!side], mid, end);
 }
 
-
-mplane_t		*lightplane;
-vec3_t			lightspot;
 // LordHavoc: .lit support begin
 // LordHavoc: original code replaced entirely
 
-int RecursiveLightPointRGB(vec3_t color, mnode_t *node, vec3_t start, vec3_t end)
+static int RecursiveLightPointRGB(lightsample_t *sample, mnode_t *node,
+      vec3_t start, vec3_t end)
 {
 	float		front, back, frac;
 	vec3_t		mid;
@@ -283,16 +321,13 @@ loc0:
 	mid[2] = start[2] + (end[2] - start[2])*frac;
 	
 // go down front side
-	if (RecursiveLightPointRGB (color, node->children[front < 0], start, mid))
+	if (RecursiveLightPointRGB (sample, node->children[front < 0], start, mid))
 		return true;	// hit something
 	else
 	{
 		int i, ds, dt;
 		msurface_t *surf;
 	// check for impact on this node
-		VectorCopy (mid, lightspot);
-		lightplane = node->plane;
-
 		surf = cl.worldmodel->surfaces + node->firstsurface;
 		for (i = 0;i < node->numsurfaces;i++, surf++)
 		{
@@ -311,38 +346,128 @@ loc0:
 			if (ds > surf->extents[0] || dt > surf->extents[1])
 				continue;
 
+			sample->surf = surf;
+			sample->lightmap = NULL;
 			if (surf->samples)
 			{
-				// LordHavoc: enhanced to interpolate lighting
-				byte *lightmap;
-				int maps, line3, dsfrac = ds & 15, dtfrac = dt & 15, r00 = 0, g00 = 0, b00 = 0, r01 = 0, g01 = 0, b01 = 0, r10 = 0, g10 = 0, b10 = 0, r11 = 0, g11 = 0, b11 = 0;
-				float scale;
-				line3 = ((surf->extents[0]>>4)+1)*3;
-
-				lightmap = surf->samples + ((dt>>4) * ((surf->extents[0]>>4)+1) + (ds>>4))*3; // LordHavoc: *3 for color
-
-				for (maps = 0;maps < MAXLIGHTMAPS && surf->styles[maps] != 255;maps++)
-				{
-					scale = (float) d_lightstylevalue[surf->styles[maps]] * 1.0 / 256.0;
-					r00 += (float) lightmap[      0] * scale;g00 += (float) lightmap[      1] * scale;b00 += (float) lightmap[2] * scale;
-					r01 += (float) lightmap[      3] * scale;g01 += (float) lightmap[      4] * scale;b01 += (float) lightmap[5] * scale;
-					r10 += (float) lightmap[line3+0] * scale;g10 += (float) lightmap[line3+1] * scale;b10 += (float) lightmap[line3+2] * scale;
-					r11 += (float) lightmap[line3+3] * scale;g11 += (float) lightmap[line3+4] * scale;b11 += (float) lightmap[line3+5] * scale;
-					lightmap += ((surf->extents[0]>>4)+1) * ((surf->extents[1]>>4)+1)*3; // LordHavoc: *3 for colored lighting
-				}
-
-				color[0] += (float) ((int) ((((((((r11-r10) * dsfrac) >> 4) + r10)-((((r01-r00) * dsfrac) >> 4) + r00)) * dtfrac) >> 4) + ((((r01-r00) * dsfrac) >> 4) + r00)));
-				color[1] += (float) ((int) ((((((((g11-g10) * dsfrac) >> 4) + g10)-((((g01-g00) * dsfrac) >> 4) + g00)) * dtfrac) >> 4) + ((((g01-g00) * dsfrac) >> 4) + g00)));
-				color[2] += (float) ((int) ((((((((b11-b10) * dsfrac) >> 4) + b10)-((((b01-b00) * dsfrac) >> 4) + b00)) * dtfrac) >> 4) + ((((b01-b00) * dsfrac) >> 4) + b00)));
+				sample->dsfrac = ds & 15;
+				sample->dtfrac = dt & 15;
+				sample->lightmap = surf->samples + ((dt>>4) * ((surf->extents[0]>>4)+1) + (ds>>4))*3; // LordHavoc: *3 for color
 			}
 			return true; // success
 		}
 
 	// go down back side
-		return RecursiveLightPointRGB (color, node->children[front >= 0], mid, end);
+		return RecursiveLightPointRGB (sample, node->children[front >= 0], mid, end);
 	}
 }
 
+/*
+ * The light at a sample, summed over the surface's lightstyles
+ */
+static int R_SampleLight(const lightsample_t *sample)
+{
+   const msurface_t *surf = sample->surf;
+   const byte *lightmap;
+   unsigned scale;
+   int maps, r;
+
+   if (!surf)
+      return -1;
+
+   /* FIXME: does this account properly for dynamic lights? e.g. rocket */
+   lightmap = sample->lightmap;
+   r = 0;
+   if (lightmap) {
+      for (maps = 0; maps < MAXLIGHTMAPS && surf->styles[maps] != 255;
+            maps++) {
+         scale = d_lightstylevalue[surf->styles[maps]];
+         r += *lightmap * scale;
+         if (coloredlights)
+            lightmap += ((surf->extents[0] >> 4) + 1) * ((surf->extents[1] >> 4) + 1) * 3;
+         else
+            lightmap += ((surf->extents[0] >> 4) + 1) * ((surf->extents[1] >> 4) + 1);	/* colored lighting change */
+
+      }
+      r >>= 8;
+   }
+
+   return r;
+}
+
+static void R_SampleLightRGB(const lightsample_t *sample, vec3_t color)
+{
+	const msurface_t *surf = sample->surf;
+
+	if (surf && sample->lightmap)
+	{
+		// LordHavoc: enhanced to interpolate lighting
+		const byte *lightmap;
+		int maps, line3, dsfrac = sample->dsfrac, dtfrac = sample->dtfrac, r00 = 0, g00 = 0, b00 = 0, r01 = 0, g01 = 0, b01 = 0, r10 = 0, g10 = 0, b10 = 0, r11 = 0, g11 = 0, b11 = 0;
+		float scale;
+		line3 = ((surf->extents[0]>>4)+1)*3;
+
+		lightmap = sample->lightmap;
+
+		for (maps = 0;maps < MAXLIGHTMAPS && surf->styles[maps] != 255;maps++)
+		{
+			scale = (float) d_lightstylevalue[surf->styles[maps]] * 1.0 / 256.0;
+			r00 += (float) lightmap[      0] * scale;g00 += (float) lightmap[      1] * scale;b00 += (float) lightmap[2] * scale;
+			r01 += (float) lightmap[      3] * scale;g01 += (float) lightmap[      4] * scale;b01 += (float) lightmap[5] * scale;
+			r10 += (float) lightmap[line3+0] * scale;g10 += (float) lightmap[line3+1] * scale;b10 += (float) lightmap[line3+2] * scale;
+			r11 += (float) lightmap[line3+3] * scale;g11 += (float) lightmap[line3+4] * scale;b11 += (float) lightmap[line3+5] * scale;
+			lightmap += ((surf->extents[0]>>4)+1) * ((surf->extents[1]>>4)+1)*3; // LordHavoc: *3 for colored lighting
+		}
+
+		color[0] += (float) ((int) ((((((((r11-r10) * dsfrac) >> 4) + r10)-((((r01-r00) * dsfrac) >> 4) + r00)) * dtfrac) >> 4) + ((((r01-r00) * dsfrac) >> 4) + r00)));
+		color[1] += (float) ((int) ((((((((g11-g10) * dsfrac) >> 4) + g10)-((((g01-g00) * dsfrac) >> 4) + g00)) * dtfrac) >> 4) + ((((g01-g00) * dsfrac) >> 4) + g00)));
+		color[2] += (float) ((int) ((((((((b11-b10) * dsfrac) >> 4) + b10)-((((b01-b00) * dsfrac) >> 4) + b00)) * dtfrac) >> 4) + ((((b01-b00) * dsfrac) >> 4) + b00)));
+	}
+}
+
+/*
+ * Call when the world model changes, the cached samples point into it
+ */
+void R_ClearLightCache(void)
+{
+   memset(r_lightcachevalid, 0, sizeof(r_lightcachevalid));
+}
+
+/*
+ * Finds the sample for a point, from the cache if the point was sampled
+ * recently, otherwise by tracing down from it.
+ */
+static const lightsample_t *R_LightSample(const vec3_t p)
+{
+   lightsample_t *sample;
+   vec3_t end;
+   uint32_t bits[3], hash;
+
+   memcpy(bits, p, sizeof(bits));
+   hash = bits[0] * 0x9e3779b1U ^ bits[1] * 0x85ebca77U ^ bits[2] * 0xc2b2ae3dU;
+   hash = (hash ^ (hash >> 16)) & (LIGHTCACHE_SIZE - 1);
+
+   sample = &r_lightcache[hash];
+   if (r_lightcachevalid[hash] && sample->colored == !!coloredlights &&
+         !memcmp(sample->point, p, sizeof(sample->point)))
+      return sample;
+
+   VectorCopy(p, sample->point);
+   sample->colored = !!coloredlights;
+   sample->surf = NULL;
+   r_lightcachevalid[hash] = true;
+
+   end[0] = p[0];
+   end[1] = p[1];
+   end[2] = p[2] - (8192 + 2); 
+   if (coloredlights)
+      RecursiveLightPointRGB(sample, cl.worldmodel->nodes, sample->point, end);
+   else
+      RecursiveLightPoint(sample, cl.worldmodel->nodes, sample->point, end);
+
+   return sample;
+}
+
 
 /*
  * FIXME - check what the callers do, but I don't think this will check the
@@ -351,11 +476,10 @@ loc0:
  */
 
 vec3_t lightcolor; // for colored lighting
-extern int coloredlights;
 
 int R_LightPoint(vec3_t p)
 {
-   vec3_t end;
+   const lightsample_t *sample;
    int r;
 
    if (!cl.worldmodel->lightdata){
@@ -363,26 +487,17 @@ int R_LightPoint(vec3_t p)
      	 return 255;
 	}
 
-
-
+   sample = R_LightSample(p);
 
 	if (coloredlights)
    {
-      end[0] = p[0];
-      end[1] = p[1];
-      end[2] = p[2] - (8192 + 2); 
       lightcolor[0] = lightcolor[1] = lightcolor[2] = 0;
-      r = RecursiveLightPointRGB(lightcolor, cl.worldmodel->nodes, p, end);
+      R_SampleLightRGB(sample, lightcolor);
       return ((lightcolor[0] + lightcolor[1] + lightcolor[2]) * (1.0f / 3.0f));
    }
 	else
    {
-      end[0] = p[0];
-      end[1] = p[1];
-      end[2] = p[2] - (8192 + 2); 
-
-
-      r = RecursiveLightPoint(cl.worldmodel->nodes, p, end);
+      r = R_SampleLight(sample);
 
       if (r == -1)
          r = 0;
@@ -65,9 +65,12 @@ extern cvar_t r_clearcolor;
 extern cvar_t r_waterwarp;
 extern cvar_t r_fullbright;
 extern cvar_t r_drawentities;
+extern cvar_t r_occlude;
 extern cvar_t r_ambient;
 extern cvar_t r_numsurfs;
 extern cvar_t r_numedges;
+extern cvar_t r_aliascache;
+extern cvar_t r_aliaslod;
 
 #define XCENTERING	(1.0 / 2.0)
 #define YCENTERING	(1.0 / 2.0)
@@ -91,6 +94,22 @@ typedef struct clipplane_s {
 
 extern clipplane_t view_clipplanes[4];
 
+/*
+ * The view clip planes laid out to test against all four together
+ */
+typedef struct {
+    float normal[3][4];
+    float dist[4];
+} clipplanes_t;
+
+void R_SetupClipPlanes(clipplanes_t *planes);
+int R_ClipBox(const clipplanes_t *planes, const vec3_t mins,
+	      const vec3_t maxs, int clipflags);
+int R_ClipSphere(const clipplanes_t *planes, const vec3_t origin,
+		 vec_t radius);
+void R_ClipSurfaces(const clipplanes_t *planes, model_t *model, int first,
+		    int count, int clipflags);
+
 //=============================================================================
 
 void R_RenderWorld(void);
@@ -114,6 +133,7 @@ void R_RenderFace(const entity_t *e, msurface_t *fa, int clipflags);
 void R_RenderBmodelFace(const entity_t *e, bedge_t *pedges, msurface_t *psurf);
 void R_TransformPlane(mplane_t *p, float *normal, float *dist);
 void R_TransformFrustum(void);
+void R_TranslateFrustum(void);
 void R_SetSkyFrame(void);
 void R_DrawSurfaceBlock16(void);
 void R_DrawSurfaceBlock8(void);
@@ -126,11 +146,14 @@ void R_DrawSolidClippedSubmodelPolygons(const entity_t *e, model_t *pmodel);
 void R_AddPolygonEdges(emitpoint_t *pverts, int numverts, int miplevel);
 surf_t *R_GetSurf(void);
 void R_AliasDrawModel(entity_t *e, alight_t *plighting);
+void R_AliasClearCache(void);
+void R_BuildAnimTextures(void);
+texture_t *R_ResolveTextureAnimation(texture_t *base, int frame, int tenths);
+void R_AnimateTextures(void);
 void R_BeginEdgeFrame(void);
 void R_ScanEdges(void);
-void R_InsertNewEdges(edge_t *edgestoadd, edge_t *edgelist);
-void R_StepActiveU(edge_t *pedge);
-void R_RemoveEdges(edge_t *pedge);
+void R_InsertNewEdges(edge_t *edgestoadd);
+void R_StepActiveU(void);
 
 extern void R_Surf8Start(void);
 extern void R_Surf8End(void);
@@ -140,6 +163,7 @@ extern void R_EdgeCodeStart(void);
 extern void R_EdgeCodeEnd(void);
 
 extern void R_RotateBmodel(const entity_t *e);
+extern void R_TranslateBmodel(void);
 
 extern int c_faceclip;
 extern int r_polycount;
@@ -149,8 +173,8 @@ extern int r_polycount;
 
 extern int ubasestep, errorterm, erroradjustup, erroradjustdown;
 
-extern fixed16_t sadjust, tadjust;
-extern fixed16_t bbextents, bbextentt;
+extern THREAD_LOCAL fixed16_t sadjust, tadjust;
+extern THREAD_LOCAL fixed16_t bbextents, bbextentt;
 
 #define MAXBVERTINDEXES	1000	// new clipped vertices when clipping bmodels
 				// to the world BSP
@@ -195,19 +219,19 @@ void R_ReadPointFile_f(void);
 void R_PushDlights (struct mnode_s *headnode); //qbism - moved from render.h
 
 extern int r_amodels_drawn;
-extern edge_t *auxedges;
+extern int r_amodels_cached;
+extern qboolean r_viewdrawn;	// the 3D view was drawn, not copied back
+extern int r_amodels_occluded;
 extern int r_numallocatededges;
 extern edge_t *r_edges, *edge_p, *edge_max;
 
 extern edge_t *newedges[MAXHEIGHT];
-extern edge_t *removeedges[MAXHEIGHT];
 
 extern int screenwidth;
 
 // FIXME: make stack vars when debugging done
 extern edge_t edge_head;
 extern edge_t edge_tail;
-extern edge_t edge_aftertail;
 extern int r_bmodelactive;
 
 extern float aliasxscale, aliasyscale, aliasxcenter, aliasycenter;
@@ -232,6 +256,7 @@ extern float se_time1, se_time2, de_time1, de_time2, dv_time1, dv_time2;
 extern int r_maxsurfsseen, r_maxedgesseen;
 extern cshift_t cshift_water;
 extern qboolean r_dowarpold, r_viewchanged;
+extern float r_dynscale;
 
 extern mleaf_t *r_viewleaf, *r_oldviewleaf;
 
@@ -239,7 +264,9 @@ extern vec3_t r_emins, r_emaxs;
 extern mnode_t *r_pefragtopnode;
 extern int r_clipflags;
 
-void R_StoreEfrags(efrag_t **ppefrag);
+void R_ClearEfrags(void);
+void R_BeginEfrags(void);
+void R_StoreEfrags(int leafnum);
 void R_TimeRefresh_f(void);
 void R_TimeGraph(void);
 void R_PrintAliasStats(void);
@@ -247,12 +274,14 @@ void R_PrintTimes(void);
 void R_PrintDSpeeds(void);
 void R_AnimateLight(void);
 int R_LightPoint(vec3_t p);
+void R_ClearLightCache(void);
 void R_SetupFrame(void);
 void R_cshift_f(void);
 void R_EmitEdge(mvertex_t *pv0, mvertex_t *pv1);
 void R_ClipEdge(mvertex_t *pv0, mvertex_t *pv1, clipplane_t *clip);
 void R_SplitEntityOnNode2(mnode_t *node);
 void R_MarkLights(dlight_t *light, int bit, mnode_t *node);
+qboolean R_DlightTouchesSurface(const dlight_t *light, const msurface_t *surf);
 
 void R_DrawSurfaceBlockRGB_mip0(void);
 void R_DrawSurfaceBlockRGB_mip1(void);
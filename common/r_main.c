@@ -20,9 +20,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // r_main.c
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "cmd.h"
 #include "console.h"
+#include "cvar.h"
+#include "draw.h"
+#include "prof.h"
 #include "quakedef.h"
 #include "r_local.h"
 #include "screen.h"
@@ -48,11 +53,12 @@ qboolean r_dowarp, r_dowarpold, r_viewchanged;
 
 mvertex_t *r_pcurrentvertbase;
 
-int c_surf;
+int c_surf, c_surfcached;	// surface cache rebuilds and reuses this frame
+int c_surfevicted;		// cached surfaces thrown out this frame
+int c_dlightsurfs, c_dlightmarked;	// surfaces dlights got to, and marked
 int r_maxsurfsseen, r_maxedgesseen;
 
 static int r_cnumsurfs;
-static qboolean r_surfsonstack;
 
 byte *r_warpbuffer;
 
@@ -109,6 +115,7 @@ cvar_t r_graphheight = { "r_graphheight", "15" };
 cvar_t r_clearcolor = { "r_clearcolor", "2" };
 cvar_t r_waterwarp = { "r_waterwarp", "1" };
 cvar_t r_drawentities = { "r_drawentities", "1" };
+cvar_t r_occlude = { "r_occlude", "1" };	// skip entities behind the world
 cvar_t r_drawviewmodel = { "r_drawviewmodel", "1" };
 cvar_t r_ambient = { "r_ambient", "0" };
 cvar_t r_numsurfs = { "r_numsurfs", "0" };
@@ -134,6 +141,19 @@ static cvar_t r_maxedges = { "r_maxedges", "0" };
 static cvar_t r_aliastransbase = { "r_aliastransbase", "200" };
 static cvar_t r_aliastransadj = { "r_aliastransadj", "100" };
 
+/*
+ * Dynamic resolution: with r_dynres set to a time in ms, the 3D view is
+ * drawn smaller when it takes longer than that, down to r_dynres_min of
+ * the full size, and stretched back over the view rect.
+ */
+static cvar_t r_dynres = { "r_dynres", "0", true };
+static cvar_t r_dynres_min = { "r_dynres_min", "0.5", true };
+
+#define DYNRES_STEPS 32		/* the scale moves in steps of 1/32 */
+
+float r_dynscale = 1;		/* fraction of the full size to draw at */
+static float r_dyncost;		/* smoothed ms to draw the full size */
+
 /*
 ==================
 R_InitTextures
@@ -212,6 +232,7 @@ R_Init(void)
     Cvar_RegisterVariable(&r_clearcolor);
     Cvar_RegisterVariable(&r_waterwarp);
     Cvar_RegisterVariable(&r_drawentities);
+    Cvar_RegisterVariable(&r_occlude);
     Cvar_RegisterVariable(&r_drawviewmodel);
     Cvar_RegisterVariable(&r_ambient);
     Cvar_RegisterVariable(&r_numsurfs);
@@ -220,6 +241,8 @@ R_Init(void)
     Cvar_RegisterVariable(&r_lerpmodels);
     Cvar_RegisterVariable(&r_lerpmove);
 #endif
+    Cvar_RegisterVariable(&r_aliascache);
+    Cvar_RegisterVariable(&r_aliaslod);
     Cvar_RegisterVariable(&r_lockpvs);
     Cvar_RegisterVariable(&r_lockfrustum);
 
@@ -234,6 +257,8 @@ R_Init(void)
     Cvar_RegisterVariable(&r_maxedges);
     Cvar_RegisterVariable(&r_aliastransbase);
     Cvar_RegisterVariable(&r_aliastransadj);
+    Cvar_RegisterVariable(&r_dynres);
+    Cvar_RegisterVariable(&r_dynres_min);
 
 #ifdef QW_HACK
     Cvar_RegisterVariable(&r_netgraph);
@@ -260,6 +285,126 @@ R_Init(void)
 
 extern void V_NewMap (void);
 
+/*
+ * The surfaces of each leaf as indexes in the world model, sorted and
+ * without repeats, so marking a leaf's surfaces walks forward through them
+ * in memory. r_leafsurfstart[i] is the first for leafs[i + 1].
+ */
+static int *r_leafsurfs;
+static int *r_leafsurfstart;
+
+static int
+R_CompareSurfs(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+===============
+R_BuildLeafSurfaces
+===============
+*/
+static void
+R_BuildLeafSurfaces(void)
+{
+    const model_t *model = cl.worldmodel;
+    const mleaf_t *leaf;
+    int i, j, count, start, *surfs;
+
+    count = 0;
+    for (i = 0; i < model->numleafs; i++)
+	count += model->leafs[i + 1].nummarksurfaces;
+
+    r_leafsurfs = Hunk_AllocName(qmax(count, 1) * sizeof(*r_leafsurfs),
+				 "leafsurf");
+    r_leafsurfstart = Hunk_AllocName((model->numleafs + 1) *
+				     sizeof(*r_leafsurfstart), "leafsurf");
+
+    count = 0;
+    for (i = 0; i < model->numleafs; i++) {
+	leaf = &model->leafs[i + 1];
+	start = count;
+	r_leafsurfstart[i] = start;
+	surfs = &r_leafsurfs[start];
+	for (j = 0; j < leaf->nummarksurfaces; j++)
+	    surfs[j] = leaf->firstmarksurface[j] - model->surfaces;
+	qsort(surfs, leaf->nummarksurfaces, sizeof(*surfs), R_CompareSurfs);
+	for (j = 0; j < leaf->nummarksurfaces; j++) {
+	    if (count == start || r_leafsurfs[count - 1] != surfs[j])
+		r_leafsurfs[count++] = surfs[j];
+	}
+    }
+    r_leafsurfstart[i] = count;
+}
+
+/*
+ * The animated textures of the map's brush models, whose frames
+ * R_AnimateTextures works out once a frame for all the surfaces using them
+ */
+static texture_t **r_animtextures;
+static int r_numanimtextures;
+
+/*
+===============
+R_BuildAnimTextures
+===============
+*/
+void
+R_BuildAnimTextures(void)
+{
+    const model_t *model;
+    texture_t *texture;
+    int pass, i, j;
+
+    r_numanimtextures = 0;
+    for (pass = 0; pass < 2; pass++) {
+	if (pass)
+	    r_animtextures = Hunk_AllocName(qmax(r_numanimtextures, 1) *
+					    sizeof(*r_animtextures), "animtex");
+	r_numanimtextures = 0;
+	for (i = 1; i < MAX_MODELS; i++) {
+	    model = cl.model_precache[i];
+	    if (!model || model->type != mod_brush || !model->textures)
+		continue;
+	    for (j = 0; j < model->numtextures; j++) {
+		texture = model->textures[j];
+		if (!texture || !texture->anim_total)
+		    continue;
+		if (!pass) {
+		    texture->anim_frames[0] = texture->anim_frames[1] = NULL;
+		    r_numanimtextures++;
+		    continue;
+		}
+		/* the world's inline models share its textures */
+		if (texture->anim_frames[0])
+		    continue;
+		texture->anim_frames[0] = texture->anim_frames[1] = texture;
+		r_animtextures[r_numanimtextures++] = texture;
+	    }
+	}
+    }
+}
+
+/*
+===============
+R_AnimateTextures
+
+Works out this frame's frame of each animated texture
+===============
+*/
+void
+R_AnimateTextures(void)
+{
+    int i, tenths = (int)(cl.time * 10);
+    texture_t *texture;
+
+    for (i = 0; i < r_numanimtextures; i++) {
+	texture = r_animtextures[i];
+	texture->anim_frames[0] = R_ResolveTextureAnimation(texture, 0, tenths);
+	texture->anim_frames[1] = R_ResolveTextureAnimation(texture, 1, tenths);
+    }
+}
+
 /*
 ===============
 R_NewMap
@@ -268,36 +413,26 @@ R_NewMap
 void
 R_NewMap(void)
 {
-    int i;
+    Draw_FinishPalmap();
 
     memset(&r_worldentity, 0, sizeof(r_worldentity));
     r_worldentity.model = cl.worldmodel;
 
-// clear out efrags in case the level hasn't been reloaded
-// FIXME: is this one short?
-    for (i = 0; i < cl.worldmodel->numleafs; i++)
-	cl.worldmodel->leafs[i].efrags = NULL;
+    R_ClearEfrags();
+    R_ClearLightCache();
+    R_AliasClearCache();
+    R_BuildLeafSurfaces();
+    R_BuildAnimTextures();
 
     r_viewleaf = NULL;
     R_ClearParticles();
 
+    // starting sizes; R_EdgeDrawing grows them for views that need more
     r_cnumsurfs = r_maxsurfs.value;
 
     if (r_cnumsurfs <= MINSURFACES)
 	r_cnumsurfs = MINSURFACES;
 
-    if (r_cnumsurfs > NUMSTACKSURFACES) {
-	surfaces = (surf_t*)Hunk_AllocName(r_cnumsurfs * sizeof(surf_t), "surfaces");
-	surface_p = surfaces;
-	surf_max = &surfaces[r_cnumsurfs];
-	r_surfsonstack = false;
-	// surface 0 doesn't really exist; it's just a dummy because index 0
-	// is used to indicate no edge attached to surface
-	surfaces--;
-    } else {
-	r_surfsonstack = true;
-    }
-
     r_maxedgesseen = 0;
     r_maxsurfsseen = 0;
 
@@ -306,13 +441,6 @@ R_NewMap(void)
     if (r_numallocatededges < MINEDGES)
 	r_numallocatededges = MINEDGES;
 
-    if (r_numallocatededges <= NUMSTACKEDGES) {
-	auxedges = NULL;
-    } else {
-	auxedges = (edge_t*)Hunk_AllocName(r_numallocatededges * sizeof(edge_t),
-				  "edges");
-    }
-
     r_dowarpold = false;
     r_viewchanged = false;
 
@@ -503,10 +631,11 @@ R_MarkSurfaces(void)
 {
     const leafbits_t *pvs;
     leafblock_t check;
-    int leafnum, i;
+    int leafnum;
+    const int *mark, *end;
     mleaf_t *leaf;
     mnode_t *node;
-    msurface_t **mark;
+    msurface_t *surfaces;
     qboolean pvs_changed;
 
     /*
@@ -519,20 +648,21 @@ R_MarkSurfaces(void)
 	r_oldviewleaf = r_viewleaf;
     }
 
-    pvs = Mod_LeafPVS(cl.worldmodel, r_viewleaf);
+    R_BeginEfrags();
+    pvs = Mod_ViewLeafPVS(cl.worldmodel, r_viewleaf);
     foreach_leafbit(pvs, leafnum, check) {
 	leaf = &cl.worldmodel->leafs[leafnum + 1];
 	if (leaf->efrags)
-	    R_StoreEfrags(&leaf->efrags);
+	    R_StoreEfrags(leafnum);
 	if (!pvs_changed)
 	    continue;
 
 	/* Mark the surfaces */
-	mark = leaf->firstmarksurface;
-	for (i = 0; i < leaf->nummarksurfaces; i++) {
-	    (*mark)->visframe = r_visframecount;
-	    mark++;
-	}
+	surfaces = cl.worldmodel->surfaces;
+	mark = &r_leafsurfs[r_leafsurfstart[leafnum]];
+	end = &r_leafsurfs[r_leafsurfstart[leafnum + 1]];
+	for (; mark < end; mark++)
+	    surfaces[*mark].visframe = r_visframecount;
 
 	/* Mark the leaf and all parent nodes */
 	node = (mnode_t *)leaf;
@@ -553,13 +683,14 @@ R_CullSurfaces
 static void
 R_CullSurfaces(model_t *model, vec3_t vieworg)
 {
-    int i, j;
-    int side;
+    int i;
     mnode_t *node;
     msurface_t *surf;
-    mplane_t *plane;
+    clipplanes_t planes;
     vec_t dist;
 
+    R_SetupClipPlanes(&planes);
+
     node = model->nodes;
     node->clipflags = 15;
 
@@ -569,40 +700,25 @@ R_CullSurfaces(model_t *model, vec3_t vieworg)
 
 	if (node->clipflags) {
 	    /* Clip the node against the frustum */
-	    for (i = 0; i < 4; i++) {
-		if (!(node->clipflags & (1 << i)))
-		    continue;
-		plane = &view_clipplanes[i].plane;
-		side = BoxOnPlaneSide(node->mins, node->maxs, plane);
-		if (side == PSIDE_BACK) {
-		    node->clipflags = BMODEL_FULLY_CLIPPED;
-		    goto NodeUp;
-		}
-		if (side == PSIDE_FRONT)
-		    node->clipflags &= ~(1 << i);
-	    }
+	    node->clipflags = R_ClipBox(&planes, node->mins, node->maxs,
+					node->clipflags);
+	    if (node->clipflags == BMODEL_FULLY_CLIPPED)
+		goto NodeUp;
 	}
 
 	if (node->contents < 0)
 	    goto NodeUp;
 
+	/* Clip the surfaces against the frustum */
+	R_ClipSurfaces(&planes, model, node->firstsurface, node->numsurfaces,
+		       node->clipflags);
+
 	surf = model->surfaces + node->firstsurface;
 	for (i = 0; i < node->numsurfaces; i++, surf++) {
-	    /* Clip the surfaces against the frustum */
-	    surf->clipflags = node->clipflags;
-	    for (j = 0; j < 4; j++) {
-		if (!(node->clipflags & (1 << j)))
-		    continue;
-		plane = &view_clipplanes[j].plane;
-		side = BoxOnPlaneSide(surf->mins, surf->maxs, plane);
-		if (side == PSIDE_BACK) {
-		    surf->clipflags = BMODEL_FULLY_CLIPPED;
-		    break;
-		}
-		if (side == PSIDE_FRONT)
-		    surf->clipflags &= ~(1 << j);
-	    }
-	    if (j < 4)
+	    /* R_RenderWorld skips the surfaces outside the PVS anyway */
+	    if (surf->visframe != r_visframecount)
+		continue;
+	    if (surf->clipflags == BMODEL_FULLY_CLIPPED)
 		continue;
 
 	    /* Cull backward facing surfs */
@@ -665,31 +781,22 @@ R_CullSubmodelSurfaces
 =============
 */
 static void
-R_CullSubmodelSurfaces(const model_t *submodel, const vec3_t vieworg,
+R_CullSubmodelSurfaces(model_t *submodel, const vec3_t vieworg,
 		       int clipflags)
 {
-    int i, j, side;
+    int i;
     msurface_t *surf;
-    mplane_t *plane;
+    clipplanes_t planes;
     vec_t dist;
 
+    /* Clip the surfaces against the frustum */
+    R_SetupClipPlanes(&planes);
+    R_ClipSurfaces(&planes, submodel, submodel->firstmodelsurface,
+		   submodel->nummodelsurfaces, clipflags);
+
     surf = submodel->surfaces + submodel->firstmodelsurface;
     for (i = 0; i < submodel->nummodelsurfaces; i++, surf++) {
-	/* Clip the surface against the frustum */
-	surf->clipflags = clipflags;
-	for (j = 0; j < 4; j++) {
-	    if (!(surf->clipflags & (1 << j)))
-		continue;
-	    plane = &view_clipplanes[j].plane;
-	    side = BoxOnPlaneSide(surf->mins, surf->maxs, plane);
-	    if (side == PSIDE_BACK) {
-		surf->clipflags = BMODEL_FULLY_CLIPPED;
-		break;
-	    }
-	    if (side == PSIDE_FRONT)
-		surf->clipflags &= ~(1 << j);
-	}
-	if (j < 4)
+	if (surf->clipflags == BMODEL_FULLY_CLIPPED)
 	    continue;
 
 	/* Cull backward facing surfs */
@@ -887,33 +994,13 @@ static int
 R_BmodelCheckBBox(const entity_t *e, model_t *clmodel,
 		  const vec3_t mins, const vec3_t maxs)
 {
-    int i, side, clipflags;
-    vec_t d;
-
-    clipflags = 0;
+    clipplanes_t planes;
 
-    if (e->angles[0] || e->angles[1] || e->angles[2]) {
-	for (i = 0; i < 4; i++) {
-	    d = DotProduct(e->origin, view_clipplanes[i].plane.normal);
-	    d -= view_clipplanes[i].plane.dist;
-
-	    if (d <= -clmodel->radius)
-		return BMODEL_FULLY_CLIPPED;
-
-	    if (d <= clmodel->radius)
-		clipflags |= (1 << i);
-	}
-    } else {
-	for (i = 0; i < 4; i++) {
-	    side = BoxOnPlaneSide(mins, maxs, &view_clipplanes[i].plane);
-	    if (side == PSIDE_BACK)
-		return BMODEL_FULLY_CLIPPED;
-	    if (side == PSIDE_BOTH)
-		clipflags |= (1 << i);
-	}
-    }
+    R_SetupClipPlanes(&planes);
+    if (e->angles[0] || e->angles[1] || e->angles[2])
+	return R_ClipSphere(&planes, e->origin, clmodel->radius);
 
-    return clipflags;
+    return R_ClipBox(&planes, mins, maxs, 15);
 }
 
 
@@ -926,6 +1013,7 @@ static void R_DrawBEntitiesOnList(void)
 {
     entity_t *e;
     int i, clipflags;
+    qboolean rotated;
     vec3_t oldorigin;
     model_t *model;
     vec3_t mins, maxs;
@@ -952,53 +1040,78 @@ static void R_DrawBEntitiesOnList(void)
 	if (clipflags == BMODEL_FULLY_CLIPPED)
 	    continue;
 
+	// find the first node that splits it, nothing to draw if it's
+	// only in leafs outside the PVS or frustum
+	r_pefragtopnode = NULL;
+	VectorCopy(mins, r_emins);
+	VectorCopy(maxs, r_emaxs);
+	R_SplitEntityOnNode2(cl.worldmodel->nodes);
+	if (!r_pefragtopnode)
+	    continue;
+
 	VectorCopy(e->origin, r_entorigin);
 	VectorSubtract(r_origin, r_entorigin, modelorg);
 	r_pcurrentvertbase = model->vertexes;
 
 	// FIXME: stop transforming twice
-	R_RotateBmodel(e);
+	rotated = e->angles[0] || e->angles[1] || e->angles[2];
+	if (rotated)
+	    R_RotateBmodel(e);
+	else
+	    R_TranslateBmodel();
 
 	// calculate dynamic lighting for bmodel if it's not an
 	// instanced model
 	if (model->firstmodelsurface != 0)
        R_PushDlights (model->nodes + model->hulls[0].firstclipnode);  /*qbism - from MH */
 
-	r_pefragtopnode = NULL;
-	VectorCopy(mins, r_emins);
-	VectorCopy(maxs, r_emaxs);
-	R_SplitEntityOnNode2(cl.worldmodel->nodes);
 	R_CullSubmodelSurfaces(model, modelorg, clipflags);
 
-	if (r_pefragtopnode) {
-	    e->topnode = r_pefragtopnode;
-
-	    if (r_pefragtopnode->contents >= 0) {
-		// not a leaf; has to be clipped to the world BSP
-		R_DrawSolidClippedSubmodelPolygons(e, model);
-	    } else {
-		// falls entirely in one leaf, so we just put all
-		// the edges in the edge list and let 1/z sorting
-		// handle drawing order
-		R_DrawSubmodelPolygons(e, model, clipflags);
-	    }
-	    e->topnode = NULL;
+	e->topnode = r_pefragtopnode;
+	if (r_pefragtopnode->contents >= 0) {
+	    // not a leaf; has to be clipped to the world BSP
+	    R_DrawSolidClippedSubmodelPolygons(e, model);
+	} else {
+	    // falls entirely in one leaf, so we just put all
+	    // the edges in the edge list and let 1/z sorting
+	    // handle drawing order
+	    R_DrawSubmodelPolygons(e, model, clipflags);
 	}
+	e->topnode = NULL;
 
 	// put back world rotation and frustum clipping
 	// FIXME: R_RotateBmodel should just work off base_vxx
-	VectorCopy(base_vpn, vpn);
-	VectorCopy(base_vup, vup);
-	VectorCopy(base_vright, vright);
-	VectorCopy(base_modelorg, modelorg);
 	VectorCopy(oldorigin, modelorg);
-	R_TransformFrustum();
+	if (rotated) {
+	    VectorCopy(base_vpn, vpn);
+	    VectorCopy(base_vup, vup);
+	    VectorCopy(base_vright, vright);
+	    R_TransformFrustum();
+	} else {
+	    R_TranslateFrustum();
+	}
     }
 
     insubmodel = false;
 }
 
 
+/*
+ * Sizes a per-frame pool for the next frame from this frame's use. If the
+ * view was short of room, the next frame gets twice as much. Otherwise the
+ * pool grows once it's three quarters full, so that a scene getting busier
+ * is caught before anything is dropped.
+ */
+static int R_PoolSize(int size, int used, qboolean short_of_room, int max)
+{
+   if (short_of_room)
+      size *= 2;
+   else if (used > size - size / 4)
+      size = used + used / 2;
+
+   return qmin(size, max);
+}
+
 /*
 ================
 R_EdgeDrawing
@@ -1006,26 +1119,21 @@ R_EdgeDrawing
 */
 static void R_EdgeDrawing(void)
 {
-   edge_t * ledges = malloc(sizeof(edge_t)*CACHE_PAD_ARRAY(NUMSTACKEDGES, edge_t));
-   surf_t * lsurfs = malloc(sizeof(surf_t)*CACHE_PAD_ARRAY(NUMSTACKSURFACES, surf_t));
-
-   if (auxedges) {
-      r_edges = auxedges;
-   } else {
-      r_edges =  (edge_t *)
-				(((long)&ledges[0] + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
-   }
-
-   if (r_surfsonstack) {
-      surfaces =  (surf_t *)
-				(((long)&lsurfs[0] + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
-      surf_max = &surfaces[r_cnumsurfs];
-      // surface 0 doesn't really exist; it's just a dummy because index 0
-      // is used to indicate no edge attached to surface
-      surfaces--;
-   }
+   edge_t * ledges = Frame_Alloc(sizeof(edge_t)*CACHE_PAD_ARRAY(r_numallocatededges, edge_t));
+   surf_t * lsurfs = Frame_Alloc(sizeof(surf_t)*CACHE_PAD_ARRAY(r_cnumsurfs, surf_t));
+
+   r_edges =  (edge_t *)
+			(((intptr_t)&ledges[0] + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
+
+   surfaces =  (surf_t *)
+			(((intptr_t)&lsurfs[0] + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
+   surf_max = &surfaces[r_cnumsurfs];
+   // surface 0 doesn't really exist; it's just a dummy because index 0
+   // is used to indicate no edge attached to surface
+   surfaces--;
 
    R_BeginEdgeFrame();
+   c_surf = c_surfcached = c_surfevicted = 0;
 
    R_RenderWorld();
 
@@ -1037,11 +1145,98 @@ static void R_EdgeDrawing(void)
 
    R_ScanEdges();
 
-   free(lsurfs);
-   free(ledges);
+   Prof_Count(PROF_EDGES, edge_p - r_edges);
+   Prof_Count(PROF_SURFS, surface_p - surfaces);
+   Prof_Count(PROF_EDGESHORT, r_outofedges * 2 / 3);
+   Prof_Count(PROF_SURFSHORT, r_outofsurfaces);
+   Prof_Count(PROF_BUILT, c_surf);
+   Prof_Count(PROF_CACHED, c_surfcached);
+   Prof_Count(PROF_EVICTED, c_surfevicted);
+   Prof_Count(PROF_DLIGHTSURFS, c_dlightsurfs);
+   Prof_Count(PROF_DLIGHTMARKED, c_dlightmarked);
+
+   r_numallocatededges = R_PoolSize(r_numallocatededges, edge_p - r_edges,
+         r_outofedges > 0, MAXFRAMEEDGES);
+   r_cnumsurfs = R_PoolSize(r_cnumsurfs, surface_p - surfaces,
+         r_outofsurfaces > 0, MAXFRAMESURFACES);
+}
+
 
+/*
+================
+R_ScaleView
+
+Stretches the view drawn at the dynamic resolution scale over the full
+view rect. The smaller view sits at the top left of the full one, so it
+is stretched in place from the bottom up; each source row is copied out
+first, as it may be the row being written.
+================
+*/
+static void
+R_ScaleView(void)
+{
+    static int column[MAXWIDTH];
+    static byte line[MAXWIDTH];
+    const vrect_t *src = &r_refdef.vrect;
+    const vrect_t *dst = &scr_vrect;
+    byte *out;
+    int u, v, row;
+
+    for (u = 0; u < dst->width; u++)
+	column[u] = u * src->width / dst->width;
+
+    for (v = dst->height - 1; v >= 0; v--) {
+	row = src->y + v * src->height / dst->height;
+	if (row > dst->y + v)
+	    row = dst->y + v;	/* rows below have already been written */
+	memcpy(line, vid.buffer + row * vid.rowbytes + src->x, src->width);
+	out = vid.buffer + (dst->y + v) * vid.rowbytes + dst->x;
+	for (u = 0; u < dst->width; u++)
+	    out[u] = line[column[u]];
+    }
 }
 
+/*
+================
+R_UpdateDynamicScale
+
+Picks the scale for the next frame from how long this one took. The time
+is taken as mostly proportional to the pixels drawn, so it's scaled up to
+an estimate for the full size and smoothed over a few frames. The scale
+drops as soon as the estimate says it should, but only rises again once
+there's room for a couple of steps, so it doesn't flicker between two.
+================
+*/
+static void
+R_UpdateDynamicScale(double seconds)
+{
+    float cost, scale, minscale;
+
+    if (r_dynres.value <= 0) {
+	if (r_dynscale != 1) {
+	    r_dynscale = 1;
+	    r_viewchanged = true;
+	}
+	r_dyncost = 0;
+	return;
+    }
+
+    cost = seconds * 1000 / (r_dynscale * r_dynscale);
+    r_dyncost = r_dyncost ? r_dyncost * 0.875f + cost * 0.125f : cost;
+
+    minscale = qclamp(r_dynres_min.value, 0.25f, 1.0f);
+    scale = sqrt(r_dynres.value / r_dyncost);
+    scale = qclamp(scale, minscale, 1.0f);
+    scale = floor(scale * DYNRES_STEPS) / DYNRES_STEPS;
+    if (scale < minscale)
+	scale = minscale;
+
+    if (scale < r_dynscale || scale >= r_dynscale + 2.0f / DYNRES_STEPS
+	|| (scale == 1 && r_dynscale != 1)) {
+	r_dynscale = scale;
+	r_viewchanged = true;
+    }
+}
 
 /*
 ================
@@ -1058,6 +1253,8 @@ R_RenderView_(void)
     r_warpbuffer = warpbuffer;
 
     R_SetupFrame();
+    R_AnimateTextures();
+    c_dlightsurfs = c_dlightmarked = 0;
     R_PushDlights (cl.worldmodel->nodes);  /* qbism - moved here from view.c */
     R_MarkSurfaces();		// done here so we know if we're in water
     R_CullSurfaces(r_worldentity.model, r_refdef.vieworg);
@@ -1081,6 +1278,8 @@ R_RenderView_(void)
 
     if (r_dowarp)
 	D_WarpScreen();
+    else if (r_dynscale < 1)
+	R_ScaleView();
 
     V_SetContentsColor(r_viewleaf->contents);
 
@@ -1097,10 +1296,106 @@ R_RenderView_(void)
     Sys_HighFPPrecision();
 }
 
+/*
+ * With scr_stillframes, a view with the same inputs as the last one, as
+ * while paused or with the menu up in single player, is copied back from
+ * the last frame rather than drawn again. The inputs are hashed into a
+ * key, and a view is only kept once two frames in a row have the same key
+ * so normal play doesn't pay for the copy.
+ */
+qboolean r_viewdrawn;		// drawn rather than copied back
+static unsigned r_viewkey;
+static byte *r_viewcopy;
+static int r_viewcopyalloc;
+static int r_viewcopysize;	// of the view kept in r_viewcopy, 0 if none
+
+static unsigned
+R_HashBytes(unsigned hash, const void *data, int size)
+{
+    const byte *bytes = data;
+
+    while (size--)
+	hash = (hash ^ *bytes++) * 16777619;
+
+    return hash;
+}
+
+static unsigned
+R_HashEntity(unsigned hash, const entity_t *e)
+{
+    hash = R_HashBytes(hash, &e->model, sizeof(e->model));
+    hash = R_HashBytes(hash, e->origin, sizeof(e->origin));
+    hash = R_HashBytes(hash, e->angles, sizeof(e->angles));
+    hash = R_HashBytes(hash, &e->frame, sizeof(e->frame));
+    hash = R_HashBytes(hash, &e->colormap, sizeof(e->colormap));
+    hash = R_HashBytes(hash, &e->skinnum, sizeof(e->skinnum));
+
+    return hash;
+}
+
+static unsigned
+R_ViewKey(void)
+{
+    unsigned hash = 2166136261U;
+    const dlight_t *dl;
+    int i;
+
+    /* the time drives the light styles, animations, warps and particles */
+    hash = R_HashBytes(hash, &cl.time, sizeof(cl.time));
+    hash = R_HashBytes(hash, &cvar_changes, sizeof(cvar_changes));
+    hash = R_HashBytes(hash, &r_dynscale, sizeof(r_dynscale));
+    hash = R_HashBytes(hash, &scr_vrect.x, sizeof(scr_vrect.x));
+    hash = R_HashBytes(hash, &scr_vrect.y, sizeof(scr_vrect.y));
+    hash = R_HashBytes(hash, &scr_vrect.width, sizeof(scr_vrect.width));
+    hash = R_HashBytes(hash, &scr_vrect.height, sizeof(scr_vrect.height));
+    hash = R_HashBytes(hash, r_refdef.vieworg, sizeof(r_refdef.vieworg));
+    hash = R_HashBytes(hash, r_refdef.viewangles, sizeof(r_refdef.viewangles));
+    hash = R_HashBytes(hash, &r_refdef.fov_x, sizeof(r_refdef.fov_x));
+    hash = R_HashBytes(hash, &r_refdef.fov_y, sizeof(r_refdef.fov_y));
+
+    hash = R_HashBytes(hash, &cl_numvisedicts, sizeof(cl_numvisedicts));
+    for (i = 0; i < cl_numvisedicts; i++)
+	hash = R_HashEntity(hash, &cl_visedicts[i]);
+    hash = R_HashEntity(hash, &cl.viewent);
+
+    /* lights fade out with the frame time, paused or not */
+    for (i = 0, dl = cl_dlights; i < MAX_DLIGHTS; i++, dl++) {
+	if (dl->die < cl.time || !dl->radius)
+	    continue;
+	hash = R_HashBytes(hash, dl->origin, sizeof(dl->origin));
+	hash = R_HashBytes(hash, &dl->radius, sizeof(dl->radius));
+    }
+
+    return hash;
+}
+
+/*
+ * Copies the view between the screen and r_viewcopy
+ */
+static void
+R_CopyView(qboolean keep)
+{
+    byte *screen = vid.buffer + scr_vrect.y * vid.rowbytes + scr_vrect.x;
+    byte *copy = r_viewcopy;
+    int row;
+
+    for (row = 0; row < scr_vrect.height; row++) {
+	if (keep)
+	    memcpy(copy, screen, scr_vrect.width);
+	else
+	    memcpy(screen, copy, scr_vrect.width);
+	screen += vid.rowbytes;
+	copy += scr_vrect.width;
+    }
+}
+
 void
 R_RenderView(void)
 {
     int dummy;
+    double start;
+    unsigned key;
+    int size;
 
     if (Hunk_LowMark() & 3)
 	Sys_Error("Hunk is missaligned");
@@ -1111,5 +1406,30 @@ R_RenderView(void)
     if ((intptr_t)(&r_warpbuffer) & 3)
 	Sys_Error("Globals are missaligned");
 
+    key = R_ViewKey();
+    size = scr_vrect.width * scr_vrect.height;
+    if (scr_stillframes.value && key == r_viewkey && size == r_viewcopysize) {
+	R_CopyView(false);
+	return;
+    }
+
+    start = Sys_DoubleTime();
     R_RenderView_();
+    R_UpdateDynamicScale(Sys_DoubleTime() - start);
+    r_viewdrawn = true;
+
+    /* the same view twice running, so keep it in case it goes on */
+    r_viewcopysize = 0;
+    if (scr_stillframes.value && key == r_viewkey && size > 0) {
+	if (size > r_viewcopyalloc) {
+	    free(r_viewcopy);
+	    r_viewcopy = malloc(size);
+	    r_viewcopyalloc = r_viewcopy ? size : 0;
+	}
+	if (r_viewcopy) {
+	    R_CopyView(true);
+	    r_viewcopysize = size;
+	}
+    }
+    r_viewkey = key;
 }
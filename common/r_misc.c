@@ -19,6 +19,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // r_misc.c
 
+#include <stdlib.h>
+
 #include "console.h"
 #include "draw.h"
 #include "menu.h"
@@ -224,6 +226,8 @@ void
 R_PrintAliasStats(void)
 {
     Con_Printf("%3i polygon model drawn\n", r_amodels_drawn);
+    Con_Printf("%3i polygon model cached\n", r_amodels_cached);
+    Con_Printf("%3i polygon model occluded\n", r_amodels_occluded);
 }
 
 void
@@ -248,6 +252,89 @@ WarpPalette(void)
     VID_ShiftPalette(newpalette);
 }
 
+/*
+ * Player colour translations, one for each pair of colours (as offsets
+ * into a colormap row) that has been asked for. Players in the same
+ * colours share a table, and a table stays for as long as the program
+ * runs, so going back to colours used before costs nothing.
+ */
+#define MAX_TRANSLATIONS 256
+
+typedef struct {
+    int top, bottom;
+    byte *table;
+} translation_t;
+
+static translation_t r_translations[MAX_TRANSLATIONS];
+static int r_numtranslations;
+static const byte *r_translationsource;
+
+static void
+R_BuildTranslation(const translation_t *translation)
+{
+    const byte *source = vid.colormap;
+    byte *dest = translation->table;
+    int top = translation->top;
+    int bottom = translation->bottom;
+    int i, j;
+
+    memcpy(dest, source, VID_GRADES * 256);
+    for (i = 0; i < VID_GRADES; i++, dest += 256, source += 256) {
+	// the artists made some backwards ranges.  sigh.
+	if (top < 128)
+	    memcpy(dest + TOP_RANGE, source + top, 16);
+	else
+	    for (j = 0; j < 16; j++)
+		dest[TOP_RANGE + j] = source[top + 15 - j];
+
+	if (bottom < 128)
+	    memcpy(dest + BOTTOM_RANGE, source + bottom, 16);
+	else
+	    for (j = 0; j < 16; j++)
+		dest[BOTTOM_RANGE + j] = source[bottom + 15 - j];
+    }
+}
+
+/*
+================
+R_TranslationTable
+
+The colormap with its shirt and pants ranges taken from the ranges at the
+top and bottom offsets. Falls back to the plain colormap if there's no
+room for another table.
+================
+*/
+byte *
+R_TranslationTable(int top, int bottom)
+{
+    translation_t *translation;
+    int i;
+
+    /* a new colormap means the old tables have to be made again */
+    if (r_translationsource != vid.colormap) {
+	r_translationsource = vid.colormap;
+	for (i = 0; i < r_numtranslations; i++)
+	    R_BuildTranslation(&r_translations[i]);
+    }
+
+    for (i = 0, translation = r_translations; i < r_numtranslations;
+	 i++, translation++)
+	if (translation->top == top && translation->bottom == bottom)
+	    return translation->table;
+
+    if (r_numtranslations == MAX_TRANSLATIONS)
+	return vid.colormap;
+    translation->table = malloc(VID_GRADES * 256);
+    if (!translation->table)
+	return vid.colormap;
+    translation->top = top;
+    translation->bottom = bottom;
+    R_BuildTranslation(translation);
+    r_numtranslations++;
+
+    return translation->table;
+}
+
 /*
 ===================
 R_TransformFrustum
@@ -282,16 +369,28 @@ R_TransformFrustum(void)
 }
 
 /*
-================
-TransformVector
-================
+===================
+R_TranslateFrustum
+
+Moves the view clip planes to modelorg without turning them, for when only
+modelorg has changed since R_TransformFrustum
+===================
 */
 void
-TransformVector(vec3_t in, vec3_t out)
+R_TranslateFrustum(void)
 {
-    out[0] = DotProduct(in, vright);
-    out[1] = DotProduct(in, vup);
-    out[2] = DotProduct(in, vpn);
+    int i;
+    mplane_t *plane;
+
+#ifdef NQ_HACK
+    if (r_lockfrustum.value)
+	return;
+#endif
+
+    for (i = 0; i < 4; i++) {
+	plane = &view_clipplanes[i].plane;
+	plane->dist = DotProduct(modelorg, plane->normal);
+    }
 }
 
 /*
@@ -310,6 +409,8 @@ R_TransformPlane(mplane_t *p, float *normal, float *dist)
     TransformVector(p->normal, normal);
 }
 
+static mleafhint_t r_viewleafhint;
+
 /*
 ===============
 R_SetupFrame
@@ -392,55 +493,44 @@ R_SetupFrame(void)
 
 // current viewleaf
     r_oldviewleaf = r_viewleaf;
-    r_viewleaf = Mod_PointInLeaf(cl.worldmodel, r_origin);
+    r_viewleaf = Mod_PointInLeafHint(cl.worldmodel, r_origin, &r_viewleafhint);
 
     r_dowarpold = r_dowarp;
     r_dowarp = r_waterwarp.value && (r_viewleaf->contents <= CONTENTS_WATER);
 
     if ((r_dowarp != r_dowarpold) || r_viewchanged) {
+	w = vid.width;
+	h = vid.height;
+
 	if (r_dowarp) {
-	    if ((vid.width <= vid.maxwarpwidth) &&
-		(vid.height <= vid.maxwarpheight)) {
-		vrect.x = 0;
-		vrect.y = 0;
-		vrect.width = vid.width;
-		vrect.height = vid.height;
-
-		R_ViewChanged(&vrect, sb_lines, vid.aspect);
-	    } else {
-		w = vid.width;
-		h = vid.height;
-
-		if (w > vid.maxwarpwidth) {
-		    h *= (float)vid.maxwarpwidth / w;
-		    w = vid.maxwarpwidth;
-		}
-
-		if (h > vid.maxwarpheight) {
-		    h = vid.maxwarpheight;
-		    w *= (float)vid.maxwarpheight / h;
-		}
-
-		vrect.x = 0;
-		vrect.y = 0;
-		vrect.width = (int)w;
-		vrect.height = (int)h;
-
-		R_ViewChanged(&vrect,
-			      (int)((float)sb_lines *
-				    (h / (float)vid.height)),
-			      vid.aspect * (h / w) * ((float)vid.width /
-						      (float)vid.height));
+	    if (w > vid.maxwarpwidth) {
+		h *= (float)vid.maxwarpwidth / w;
+		w = vid.maxwarpwidth;
 	    }
-	} else {
-	    vrect.x = 0;
-	    vrect.y = 0;
-	    vrect.width = vid.width;
-	    vrect.height = vid.height;
 
-	    R_ViewChanged(&vrect, sb_lines, vid.aspect);
+	    if (h > vid.maxwarpheight) {
+		h = vid.maxwarpheight;
+		w *= (float)vid.maxwarpheight / h;
+	    }
 	}
 
+	/* drawn smaller for dynamic resolution, and stretched back after */
+	w *= r_dynscale;
+	h *= r_dynscale;
+
+	vrect.x = 0;
+	vrect.y = 0;
+	vrect.width = (int)w;
+	vrect.height = (int)h;
+
+	if (vrect.width == vid.width && vrect.height == vid.height)
+	    R_ViewChanged(&vrect, sb_lines, vid.aspect);
+	else
+	    R_ViewChanged(&vrect,
+			  (int)((float)sb_lines * (h / (float)vid.height)),
+			  vid.aspect * (h / w) * ((float)vid.width /
+						  (float)vid.height));
+
 	r_viewchanged = false;
     }
 // start off with just the four screen edge clip planes
@@ -461,8 +551,11 @@ R_SetupFrame(void)
     r_polycount = 0;
     r_drawnpolycount = 0;
     r_amodels_drawn = 0;
+    r_amodels_cached = 0;
+    r_amodels_occluded = 0;
     r_outofsurfaces = 0;
     r_outofedges = 0;
 
+    D_SetupSurfCache();
     D_SetupFrame();
 }
@@ -18,32 +18,144 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "console.h"
 #include "model.h"
 #include "quakedef.h"
+#include "sys.h"
 #ifdef NQ_HACK
+#include "savestate.h"
 #include "server.h"
 #endif
 
 #include "d_iface.h"
 #include "r_local.h"
 
+#if defined(__SSE2__) && !defined(MSB_FIRST)
+#include <emmintrin.h>
+#define PART_SSE2
+#elif defined(__ARM_NEON) && !defined(MSB_FIRST)
+#include <arm_neon.h>
+#define PART_NEON
+#endif
+
 #define MAX_PARTICLES		2048	// default max # of particles at one
 					//  time
 #define ABSOLUTE_MIN_PARTICLES	512	// no fewer than this no matter what's
 					//  on the command line
+#define ABSOLUTE_MAX_PARTICLES	262144	// r_maxparticles won't go past this
 
 int ramp1[8] = { 0x6f, 0x6d, 0x6b, 0x69, 0x67, 0x65, 0x63, 0x61 };
 int ramp2[8] = { 0x6f, 0x6e, 0x6d, 0x6c, 0x6b, 0x6a, 0x68, 0x66 };
 int ramp3[8] = { 0x6d, 0x6b, 6, 5, 4, 3 };
 
-particle_t *active_particles, *free_particles;
+particles_t r_particles;
 
-particle_t *particles;
-int r_numparticles;
+/* Snapshots only have room for as many particles as there were at startup */
+static int r_saveparticles;
+
+static void R_MaxParticles_f(cvar_t *var);
+static cvar_t r_maxparticles = { "r_maxparticles", "0" };
+static cvar_t r_particlecull = { "r_particlecull", "1", true };
+
+/*
+ * How far from where they start the particles of each kind of effect get
+ * while there are still enough of them to see. Explosions keep speeding up
+ * until they fade, so theirs is as far as they get in any numbers.
+ */
+#define REACH_EXPLOSION	1024
+#define REACH_SPLASH	512
+#define REACH_TELEPORT	64
+#define REACH_EFFECT	32
+#define REACH_TRAIL	96	/* blood falls that far before it goes */
 
 vec3_t r_pright, r_pup, r_ppn;
 
+/*
+ * How each type of particle moves during a frame, set up by
+ * CL_RunParticles.  Each velocity component has itself times kxy (or kz)
+ * added to it, then grav is added to the vertical component.  Particles
+ * with a ramp step through it at 'rate' and die when they reach 'limit'
+ * (FLT_MAX for the others).  R_MoveParticles4 loads kxy to rate as a
+ * vector, so keep them together.
+ */
+typedef struct {
+   float kxy, kz, grav, rate, limit;
+   const int *ramp;
+} ptypemove_t;
+
+static ptypemove_t r_ptypemove[pt_blob2 + 1];
+
+
+/*
+===============
+R_ResizeParticles
+
+All the arrays share one block, with the floats first to keep them aligned.
+===============
+*/
+static qboolean R_ResizeParticles(int count)
+{
+   particles_t p;
+   byte *block;
+   int i;
+
+   block = malloc(count * (8 * sizeof(float) + 2));
+   if (!block)
+      return false;
+
+   p.numparticles = r_particles.numparticles;
+   p.maxparticles = count;
+   for (i = 0; i < 3; i++) {
+      p.org[i] = (float *)block + i * count;
+      p.vel[i] = (float *)block + (3 + i) * count;
+   }
+   p.ramp = (float *)block + 6 * count;
+   p.die = (float *)block + 7 * count;
+   p.color = block + 8 * sizeof(float) * count;
+   p.type = p.color + count;
+
+   if (r_particles.maxparticles) {
+      for (i = 0; i < 3; i++) {
+         memcpy(p.org[i], r_particles.org[i], p.numparticles * sizeof(float));
+         memcpy(p.vel[i], r_particles.vel[i], p.numparticles * sizeof(float));
+      }
+      memcpy(p.ramp, r_particles.ramp, p.numparticles * sizeof(float));
+      memcpy(p.die, r_particles.die, p.numparticles * sizeof(float));
+      memcpy(p.color, r_particles.color, p.numparticles);
+      memcpy(p.type, r_particles.type, p.numparticles);
+      free(r_particles.org[0]);
+   }
+   r_particles = p;
+
+   return true;
+}
+
+/*
+===============
+R_MaxParticles_f
+
+The particle arrays can grow while the game is running, but never shrink.
+===============
+*/
+static void R_MaxParticles_f(cvar_t *var)
+{
+   int count = var->value;
+
+   if (count == r_particles.maxparticles)
+      return;
+   if (count < r_particles.maxparticles)
+      Con_Printf("%s can only be raised\n", var->name);
+   else if (count > ABSOLUTE_MAX_PARTICLES)
+      Con_Printf("%s can't be more than %d\n", var->name,
+            ABSOLUTE_MAX_PARTICLES);
+   else if (!R_ResizeParticles(count))
+      Con_Printf("Not enough memory for %d particles\n", count);
+   Cvar_SetValue(var->name, r_particles.maxparticles);
+}
 
 /*
 ===============
@@ -53,18 +165,125 @@ R_InitParticles
 void R_InitParticles(void)
 {
    int i = COM_CheckParm("-particles");
+   int count;
 
    if (i)
    {
-      r_numparticles = (int)(Q_atoi(com_argv[i + 1]));
-      if (r_numparticles < ABSOLUTE_MIN_PARTICLES)
-         r_numparticles = ABSOLUTE_MIN_PARTICLES;
+      count = (int)(Q_atoi(com_argv[i + 1]));
+      count = qclamp(count, ABSOLUTE_MIN_PARTICLES, ABSOLUTE_MAX_PARTICLES);
    }
    else
-      r_numparticles = MAX_PARTICLES;
+      count = MAX_PARTICLES;
+
+   if (!R_ResizeParticles(count))
+      Sys_Error("%s: not enough memory for %d particles", __func__, count);
+   r_saveparticles = count;
 
-   particles = (particle_t *)
-      Hunk_AllocName(r_numparticles * sizeof(particle_t), "particles");
+   Cvar_RegisterVariable(&r_maxparticles);
+   Cvar_RegisterVariable(&r_particlecull);
+   Cvar_SetValue(r_maxparticles.name, count);
+   Cvar_SetCallback(&r_maxparticles, R_MaxParticles_f);
+}
+
+/*
+===============
+R_AllocParticle
+
+Returns a cleared particle, or -1 if there is no room for another.
+===============
+*/
+static int R_AllocParticle(void)
+{
+   particles_t *p = &r_particles;
+   int i, j;
+
+   if (p->numparticles >= p->maxparticles)
+      return -1;
+
+   i = p->numparticles++;
+   for (j = 0; j < 3; j++) {
+      p->org[j][i] = 0;
+      p->vel[j][i] = 0;
+   }
+   p->ramp[i] = 0;
+   p->die[i] = 0;
+   p->color[i] = 0;
+   p->type[i] = pt_static;
+
+   return i;
+}
+
+/*
+===============
+R_KillParticle
+
+Moves the last particle into the dead one's slot.
+===============
+*/
+static void R_KillParticle(int i)
+{
+   particles_t *p = &r_particles;
+   int j, last = --p->numparticles;
+
+   for (j = 0; j < 3; j++) {
+      p->org[j][i] = p->org[j][last];
+      p->vel[j][i] = p->vel[j][last];
+   }
+   p->ramp[i] = p->ramp[last];
+   p->die[i] = p->die[last];
+   p->color[i] = p->color[last];
+   p->type[i] = p->type[last];
+}
+
+/*
+ * True if the box reaches a leaf in the PVS the view was last drawn from.
+ * Nodes are marked along with the leaves under them, so the parts of the
+ * map out of sight are passed over whole. Effects are started as the
+ * server's messages are read, before this frame's marks are made, so the
+ * test is a frame late; the reach the boxes are grown by covers that.
+ */
+static qboolean R_BoxInView(const mnode_t *node, const vec3_t mins,
+      const vec3_t maxs)
+{
+   int sides;
+
+   for (;;) {
+      if (node->visframe != r_visframecount)
+         return false;
+      if (node->contents < 0)
+         return true;
+
+      sides = BOX_ON_PLANE_SIDE(mins, maxs, node->plane);
+      if (sides == 3 && R_BoxInView(node->children[0], mins, maxs))
+         return true;
+      node = node->children[sides == 1 ? 0 : 1];
+   }
+}
+
+/*
+===============
+R_EffectHidden
+
+True if nothing in the box around an effect, grown by how far its
+particles reach, can be seen from where the view is. Those effects aren't
+made at all.
+===============
+*/
+static qboolean R_EffectHidden(const vec3_t mins, const vec3_t maxs,
+      float reach)
+{
+   vec3_t bmins, bmaxs;
+   int i;
+
+   if (!r_particlecull.value || !cl.worldmodel)
+      return false;
+
+   for (i = 0; i < 3; i++) {
+      bmins[i] = mins[i] - reach;
+      bmaxs[i] = maxs[i] + reach;
+   }
+
+   return !R_BoxInView(cl.worldmodel->nodes, bmins, bmaxs);
 }
 
 #ifdef NQ_HACK
@@ -84,7 +303,7 @@ float timescale = 0.01;
 void R_EntityParticles(const entity_t *ent)
 {
    int i;
-   particle_t *p;
+   int p;
    float angle;
    float sp, sy, cp, cy;
    vec3_t forward;
@@ -108,24 +327,21 @@ void R_EntityParticles(const entity_t *ent)
       forward[1] = cp * sy;
       forward[2] = -sp;
 
-      if (!free_particles)
+      p = R_AllocParticle();
+      if (p < 0)
          return;
-      p = free_particles;
-      free_particles = p->next;
-      p->next = active_particles;
-      active_particles = p;
 
-      p->die = cl.time + 0.01;
-      p->color = 0x6f;
-      p->type = pt_explode;
+      r_particles.die[p] = cl.time + 0.01;
+      r_particles.color[p] = 0x6f;
+      r_particles.type[p] = pt_explode;
 
-      p->org[0] =
+      r_particles.org[0][p] =
          ent->origin[0] + r_avertexnormals[i][0] * dist +
          forward[0] * beamlength;
-      p->org[1] =
+      r_particles.org[1][p] =
          ent->origin[1] + r_avertexnormals[i][1] * dist +
          forward[1] * beamlength;
-      p->org[2] =
+      r_particles.org[2][p] =
          ent->origin[2] + r_avertexnormals[i][2] * dist +
          forward[2] * beamlength;
    }
@@ -139,16 +355,87 @@ R_ClearParticles
 */
 void R_ClearParticles(void)
 {
-   int i;
+   r_particles.numparticles = 0;
+}
 
-   free_particles = &particles[0];
-   active_particles = NULL;
+#ifdef NQ_HACK
+/*
+===============
+R_SaveParticles
+
+Each field is saved as an array with room for the startup number of
+particles, zero padded past the live ones so that every array stays at the
+same offset in the snapshot. Any particles past that number (after
+r_maxparticles has been raised) are left out.
+===============
+*/
+#define PARTICLE_FLOATS 8
 
-   for (i = 0; i < r_numparticles; i++)
-      particles[i].next = &particles[i + 1];
-   particles[r_numparticles - 1].next = NULL;
+static float *R_ParticleFloats(int i)
+{
+   if (i < 3)
+      return r_particles.org[i];
+   if (i < 6)
+      return r_particles.vel[i - 3];
+   return i == 6 ? r_particles.ramp : r_particles.die;
 }
 
+int R_ParticleStateSize(void)
+{
+   return sizeof(int) + r_saveparticles * (PARTICLE_FLOATS * sizeof(float) + 2);
+}
+
+void R_SaveParticles(sizebuf_t *buf)
+{
+   int i, count, unused;
+
+   count = qmin(r_particles.numparticles, r_saveparticles);
+   unused = r_saveparticles - count;
+
+   SaveState_Write(buf, &count, sizeof(count));
+   for (i = 0; i < PARTICLE_FLOATS; i++) {
+      SaveState_Write(buf, R_ParticleFloats(i), count * sizeof(float));
+      SaveState_Zero(buf, unused * sizeof(float));
+   }
+   SaveState_Write(buf, r_particles.color, count);
+   SaveState_Zero(buf, unused);
+   SaveState_Write(buf, r_particles.type, count);
+   SaveState_Zero(buf, unused);
+}
+
+qboolean R_LoadParticles(sizebuf_t *buf)
+{
+   int i, count, unused;
+
+   if (!SaveState_Read(buf, &count, sizeof(count)))
+      return false;
+   if (count < 0 || count > r_saveparticles)
+      return false;
+   unused = r_saveparticles - count;
+
+   for (i = 0; i < PARTICLE_FLOATS; i++) {
+      if (!SaveState_Read(buf, R_ParticleFloats(i), count * sizeof(float))
+            || !SaveState_Skip(buf, unused * sizeof(float)))
+         goto fail;
+   }
+   if (!SaveState_Read(buf, r_particles.color, count)
+         || !SaveState_Skip(buf, unused)
+         || !SaveState_Read(buf, r_particles.type, count)
+         || !SaveState_Skip(buf, unused))
+      goto fail;
+   for (i = 0; i < count; i++)
+      if (r_particles.type[i] > pt_blob2)
+         goto fail;
+
+   r_particles.numparticles = count;
+   return true;
+
+fail:
+   R_ClearParticles();
+   return false;
+}
+#endif
+
 
 void R_ReadPointFile_f(void)
 {
@@ -156,7 +443,7 @@ void R_ReadPointFile_f(void)
    vec3_t org;
    int r;
    int c;
-   particle_t *p;
+   int p, j;
    char name[MAX_OSPATH];
 
 #ifdef NQ_HACK
@@ -164,7 +451,7 @@ void R_ReadPointFile_f(void)
 #endif
 #ifdef QW_HACK
    snprintf(name, sizeof(name), "maps/%s.pts",
-         Info_ValueForKey(cl.serverinfo, "map"));
+         Info_Get(&cl.serverkeys, "map"));
 #endif
 
    COM_FOpenFile(name, &f);
@@ -181,20 +468,17 @@ void R_ReadPointFile_f(void)
          break;
       c++;
 
-      if (!free_particles) {
+      p = R_AllocParticle();
+      if (p < 0) {
          Con_Printf("Not enough free particles\n");
          break;
       }
-      p = free_particles;
-      free_particles = p->next;
-      p->next = active_particles;
-      active_particles = p;
-
-      p->die = 99999;
-      p->color = (-c) & 15;
-      p->type = pt_static;
-      VectorCopy(vec3_origin, p->vel);
-      VectorCopy(org, p->org);
+
+      r_particles.die[p] = 99999;
+      r_particles.color[p] = (-c) & 15;
+      r_particles.type[p] = pt_static;
+      for (j = 0; j < 3; j++)
+         r_particles.org[j][p] = org[j];
    }
 
    fclose(f);
@@ -239,30 +523,30 @@ R_ParticleExplosion
 void R_ParticleExplosion(vec3_t org)
 {
    int i, j;
-   particle_t *p;
+   int p;
+
+   if (R_EffectHidden(org, org, REACH_EXPLOSION))
+      return;
 
    for (i = 0; i < 1024; i++) {
-      if (!free_particles)
+      p = R_AllocParticle();
+      if (p < 0)
          return;
-      p = free_particles;
-      free_particles = p->next;
-      p->next = active_particles;
-      active_particles = p;
-
-      p->die = cl.time + 5;
-      p->color = ramp1[0];
-      p->ramp = rand() & 3;
+
+      r_particles.die[p] = cl.time + 5;
+      r_particles.color[p] = ramp1[0];
+      r_particles.ramp[p] = rand() & 3;
       if (i & 1) {
-         p->type = pt_explode;
+         r_particles.type[p] = pt_explode;
          for (j = 0; j < 3; j++) {
-            p->org[j] = org[j] + ((rand() % 32) - 16);
-            p->vel[j] = (rand() % 512) - 256;
+            r_particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+            r_particles.vel[j][p] = (rand() % 512) - 256;
          }
       } else {
-         p->type = pt_explode2;
+         r_particles.type[p] = pt_explode2;
          for (j = 0; j < 3; j++) {
-            p->org[j] = org[j] + ((rand() % 32) - 16);
-            p->vel[j] = (rand() % 512) - 256;
+            r_particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+            r_particles.vel[j][p] = (rand() % 512) - 256;
          }
       }
    }
@@ -278,25 +562,25 @@ R_ParticleExplosion2
 void R_ParticleExplosion2(vec3_t org, int colorStart, int colorLength)
 {
    int i, j;
-   particle_t *p;
+   int p;
    int colorMod = 0;
 
+   if (R_EffectHidden(org, org, REACH_EXPLOSION))
+      return;
+
    for (i = 0; i < 512; i++) {
-      if (!free_particles)
+      p = R_AllocParticle();
+      if (p < 0)
          return;
-      p = free_particles;
-      free_particles = p->next;
-      p->next = active_particles;
-      active_particles = p;
 
-      p->die = cl.time + 0.3;
-      p->color = colorStart + (colorMod % colorLength);
+      r_particles.die[p] = cl.time + 0.3;
+      r_particles.color[p] = colorStart + (colorMod % colorLength);
       colorMod++;
 
-      p->type = pt_blob;
+      r_particles.type[p] = pt_blob;
       for (j = 0; j < 3; j++) {
-         p->org[j] = org[j] + ((rand() % 32) - 16);
-         p->vel[j] = (rand() % 512) - 256;
+         r_particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+         r_particles.vel[j][p] = (rand() % 512) - 256;
       }
    }
 }
@@ -311,31 +595,31 @@ R_BlobExplosion
 void R_BlobExplosion(vec3_t org)
 {
    int i, j;
-   particle_t *p;
+   int p;
+
+   if (R_EffectHidden(org, org, REACH_EXPLOSION))
+      return;
 
    for (i = 0; i < 1024; i++) {
-      if (!free_particles)
+      p = R_AllocParticle();
+      if (p < 0)
          return;
-      p = free_particles;
-      free_particles = p->next;
-      p->next = active_particles;
-      active_particles = p;
 
-      p->die = cl.time + 1 + (rand() & 8) * 0.05;
+      r_particles.die[p] = cl.time + 1 + (rand() & 8) * 0.05;
 
       if (i & 1) {
-         p->type = pt_blob;
-         p->color = 66 + rand() % 6;
+         r_particles.type[p] = pt_blob;
+         r_particles.color[p] = 66 + rand() % 6;
          for (j = 0; j < 3; j++) {
-            p->org[j] = org[j] + ((rand() % 32) - 16);
-            p->vel[j] = (rand() % 512) - 256;
+            r_particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+            r_particles.vel[j][p] = (rand() % 512) - 256;
          }
       } else {
-         p->type = pt_blob2;
-         p->color = 150 + rand() % 6;
+         r_particles.type[p] = pt_blob2;
+         r_particles.color[p] = 150 + rand() % 6;
          for (j = 0; j < 3; j++) {
-            p->org[j] = org[j] + ((rand() % 32) - 16);
-            p->vel[j] = (rand() % 512) - 256;
+            r_particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+            r_particles.vel[j][p] = (rand() % 512) - 256;
          }
       }
    }
@@ -350,7 +634,7 @@ R_RunParticleEffect
 void R_RunParticleEffect(vec3_t org, vec3_t dir, int color, int count)
 {
    int i, j;
-   particle_t *p;
+   int p;
 #ifdef QW_HACK
    int scale;
 
@@ -362,49 +646,49 @@ void R_RunParticleEffect(vec3_t org, vec3_t dir, int color, int count)
       scale = 1;
 #endif
 
+   if (R_EffectHidden(org, org, count == 1024 ? REACH_EXPLOSION : REACH_EFFECT))
+      return;
+
    for (i = 0; i < count; i++) {
-      if (!free_particles)
+      p = R_AllocParticle();
+      if (p < 0)
          return;
-      p = free_particles;
-      free_particles = p->next;
-      p->next = active_particles;
-      active_particles = p;
 
 #ifdef NQ_HACK
       if (count == 1024) {	// rocket explosion
-         p->die = cl.time + 5;
-         p->color = ramp1[0];
-         p->ramp = rand() & 3;
+         r_particles.die[p] = cl.time + 5;
+         r_particles.color[p] = ramp1[0];
+         r_particles.ramp[p] = rand() & 3;
          if (i & 1) {
-            p->type = pt_explode;
+            r_particles.type[p] = pt_explode;
             for (j = 0; j < 3; j++) {
-               p->org[j] = org[j] + ((rand() % 32) - 16);
-               p->vel[j] = (rand() % 512) - 256;
+               r_particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+               r_particles.vel[j][p] = (rand() % 512) - 256;
             }
          } else {
-            p->type = pt_explode2;
+            r_particles.type[p] = pt_explode2;
             for (j = 0; j < 3; j++) {
-               p->org[j] = org[j] + ((rand() % 32) - 16);
-               p->vel[j] = (rand() % 512) - 256;
+               r_particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+               r_particles.vel[j][p] = (rand() % 512) - 256;
             }
          }
       } else {
-         p->die = cl.time + 0.1 * (rand() % 5);
-         p->color = (color & ~7) + (rand() & 7);
-         p->type = pt_slowgrav;
+         r_particles.die[p] = cl.time + 0.1 * (rand() % 5);
+         r_particles.color[p] = (color & ~7) + (rand() & 7);
+         r_particles.type[p] = pt_slowgrav;
          for (j = 0; j < 3; j++) {
-            p->org[j] = org[j] + ((rand() & 15) - 8);
-            p->vel[j] = dir[j] * 15;	// + (rand()%300)-150;
+            r_particles.org[j][p] = org[j] + ((rand() & 15) - 8);
+            r_particles.vel[j][p] = dir[j] * 15;	// + (rand()%300)-150;
          }
       }
 #endif
 #ifdef QW_HACK
-      p->die = cl.time + 0.1 * (rand() % 5);
-      p->color = (color & ~7) + (rand() & 7);
-      p->type = pt_grav;
+      r_particles.die[p] = cl.time + 0.1 * (rand() % 5);
+      r_particles.color[p] = (color & ~7) + (rand() & 7);
+      r_particles.type[p] = pt_grav;
       for (j = 0; j < 3; j++) {
-         p->org[j] = org[j] + scale * ((rand() & 15) - 8);
-         p->vel[j] = dir[j] * 15;	// + (rand()%300)-150;
+         r_particles.org[j][p] = org[j] + scale * ((rand() & 15) - 8);
+         r_particles.vel[j][p] = dir[j] * 15;	// + (rand()%300)-150;
       }
 #endif
    }
@@ -419,37 +703,38 @@ R_LavaSplash
 */
 void R_LavaSplash(vec3_t org)
 {
-   int i, j, k;
-   particle_t *p;
+   int i, j, k, n;
+   int p;
    float vel;
    vec3_t dir;
 
+   if (R_EffectHidden(org, org, REACH_SPLASH))
+      return;
+
    for (i = -16; i < 16; i++)
       for (j = -16; j < 16; j++)
          for (k = 0; k < 1; k++)
          {
-            if (!free_particles)
+            p = R_AllocParticle();
+            if (p < 0)
                return;
-            p = free_particles;
-            free_particles = p->next;
-            p->next = active_particles;
-            active_particles = p;
 
-            p->die = cl.time + 2 + (rand() & 31) * 0.02;
-            p->color = 224 + (rand() & 7);
-            p->type = pt_grav;
+            r_particles.die[p] = cl.time + 2 + (rand() & 31) * 0.02;
+            r_particles.color[p] = 224 + (rand() & 7);
+            r_particles.type[p] = pt_grav;
 
             dir[0] = j * 8 + (rand() & 7);
             dir[1] = i * 8 + (rand() & 7);
             dir[2] = 256;
 
-            p->org[0] = org[0] + dir[0];
-            p->org[1] = org[1] + dir[1];
-            p->org[2] = org[2] + (rand() & 63);
+            r_particles.org[0][p] = org[0] + dir[0];
+            r_particles.org[1][p] = org[1] + dir[1];
+            r_particles.org[2][p] = org[2] + (rand() & 63);
 
             VectorNormalize(dir);
             vel = 50 + (rand() & 63);
-            VectorScale(dir, vel, p->vel);
+            for (n = 0; n < 3; n++)
+               r_particles.vel[n][p] = dir[n] * vel;
          }
 }
 
@@ -461,51 +746,59 @@ R_TeleportSplash
 */
 void R_TeleportSplash(vec3_t org)
 {
-   int i, j, k;
-   particle_t *p;
+   int i, j, k, n;
+   int p;
    float vel;
    vec3_t dir;
 
+   if (R_EffectHidden(org, org, REACH_TELEPORT))
+      return;
+
    for (i = -16; i < 16; i += 4)
       for (j = -16; j < 16; j += 4)
          for (k = -24; k < 32; k += 4)
          {
-            if (!free_particles)
+            p = R_AllocParticle();
+            if (p < 0)
                return;
-            p = free_particles;
-            free_particles = p->next;
-            p->next = active_particles;
-            active_particles = p;
 
-            p->die = cl.time + 0.2 + (rand() & 7) * 0.02;
-            p->color = 7 + (rand() & 7);
-            p->type = pt_grav;
+            r_particles.die[p] = cl.time + 0.2 + (rand() & 7) * 0.02;
+            r_particles.color[p] = 7 + (rand() & 7);
+            r_particles.type[p] = pt_grav;
 
             dir[0] = j * 8;
             dir[1] = i * 8;
             dir[2] = k * 8;
 
-            p->org[0] = org[0] + i + (rand() & 3);
-            p->org[1] = org[1] + j + (rand() & 3);
-            p->org[2] = org[2] + k + (rand() & 3);
+            r_particles.org[0][p] = org[0] + i + (rand() & 3);
+            r_particles.org[1][p] = org[1] + j + (rand() & 3);
+            r_particles.org[2][p] = org[2] + k + (rand() & 3);
 
             VectorNormalize(dir);
             vel = 50 + (rand() & 63);
-            VectorScale(dir, vel, p->vel);
+            for (n = 0; n < 3; n++)
+               r_particles.vel[n][p] = dir[n] * vel;
          }
 }
 
 void R_RocketTrail(vec3_t start, vec3_t end, int type)
 {
    static int tracercount;
-   vec3_t vec;
+   vec3_t vec, mins, maxs;
    float len;
    int j;
-   particle_t *p;
+   int p;
 #ifdef NQ_HACK
    int dec;
 #endif
 
+   for (j = 0; j < 3; j++) {
+      mins[j] = qmin(start[j], end[j]);
+      maxs[j] = qmax(start[j], end[j]);
+   }
+   if (R_EffectHidden(mins, maxs, REACH_TRAIL))
+      return;
+
    VectorSubtract(end, start, vec);
    len = VectorNormalize(vec);
 #ifdef NQ_HACK
@@ -524,74 +817,71 @@ void R_RocketTrail(vec3_t start, vec3_t end, int type)
 #ifdef QW_HACK
       len -= 3;
 #endif
-      if (!free_particles)
+      p = R_AllocParticle();
+      if (p < 0)
          return;
-      p = free_particles;
-      free_particles = p->next;
-      p->next = active_particles;
-      active_particles = p;
 
-      VectorCopy(vec3_origin, p->vel);
-      p->die = cl.time + 2;
+      r_particles.die[p] = cl.time + 2;
 
       switch (type) {
          case 0:		// rocket trail
-            p->ramp = (rand() & 3);
-            p->color = ramp3[(int)p->ramp];
-            p->type = pt_fire;
+            r_particles.ramp[p] = (rand() & 3);
+            r_particles.color[p] = ramp3[(int)r_particles.ramp[p]];
+            r_particles.type[p] = pt_fire;
             for (j = 0; j < 3; j++)
-               p->org[j] = start[j] + ((rand() % 6) - 3);
+               r_particles.org[j][p] = start[j] + ((rand() % 6) - 3);
             break;
 
          case 1:		// smoke smoke
-            p->ramp = (rand() & 3) + 2;
-            p->color = ramp3[(int)p->ramp];
-            p->type = pt_fire;
+            r_particles.ramp[p] = (rand() & 3) + 2;
+            r_particles.color[p] = ramp3[(int)r_particles.ramp[p]];
+            r_particles.type[p] = pt_fire;
             for (j = 0; j < 3; j++)
-               p->org[j] = start[j] + ((rand() % 6) - 3);
+               r_particles.org[j][p] = start[j] + ((rand() % 6) - 3);
             break;
 
          case 2:		// blood
-            p->type = pt_grav;
-            p->color = 67 + (rand() & 3);
+            r_particles.type[p] = pt_grav;
+            r_particles.color[p] = 67 + (rand() & 3);
             for (j = 0; j < 3; j++)
-               p->org[j] = start[j] + ((rand() % 6) - 3);
+               r_particles.org[j][p] = start[j] + ((rand() % 6) - 3);
             break;
 
          case 3:
          case 5:		// tracer
-            p->die = cl.time + 0.5;
-            p->type = pt_static;
+            r_particles.die[p] = cl.time + 0.5;
+            r_particles.type[p] = pt_static;
             if (type == 3)
-               p->color = 52 + ((tracercount & 4) << 1);
+               r_particles.color[p] = 52 + ((tracercount & 4) << 1);
             else
-               p->color = 230 + ((tracercount & 4) << 1);
+               r_particles.color[p] = 230 + ((tracercount & 4) << 1);
 
             tracercount++;
-            VectorCopy(start, p->org);
+            for (j = 0; j < 3; j++)
+               r_particles.org[j][p] = start[j];
             if (tracercount & 1) {
-               p->vel[0] = 30 * vec[1];
-               p->vel[1] = 30 * -vec[0];
+               r_particles.vel[0][p] = 30 * vec[1];
+               r_particles.vel[1][p] = 30 * -vec[0];
             } else {
-               p->vel[0] = 30 * -vec[1];
-               p->vel[1] = 30 * vec[0];
+               r_particles.vel[0][p] = 30 * -vec[1];
+               r_particles.vel[1][p] = 30 * vec[0];
             }
             break;
 
          case 4:		// slight blood
-            p->type = pt_grav;
-            p->color = 67 + (rand() & 3);
+            r_particles.type[p] = pt_grav;
+            r_particles.color[p] = 67 + (rand() & 3);
             for (j = 0; j < 3; j++)
-               p->org[j] = start[j] + ((rand() % 6) - 3);
+               r_particles.org[j][p] = start[j] + ((rand() % 6) - 3);
             len -= 3;
             break;
 
          case 6:		// voor trail
-            p->color = 9 * 16 + 8 + (rand() & 3);
-            p->type = pt_static;
-            p->die = cl.time + 0.3;
+            r_particles.color[p] = 9 * 16 + 8 + (rand() & 3);
+            r_particles.type[p] = pt_static;
+            r_particles.die[p] = cl.time + 0.3;
             for (j = 0; j < 3; j++)
-               p->org[j] = start[j] + ((rand() & 15) - 8);
+               r_particles.org[j][p] = start[j] + ((rand() & 15) - 8);
             break;
       }
 
@@ -599,6 +889,199 @@ void R_RocketTrail(vec3_t start, vec3_t end, int type)
    }
 }
 
+/*
+===============
+R_KillParticles
+
+Removes the particles that died before cl.time. The die times are checked
+four at a time against the nearest float at or above cl.time, which gives
+the same answer as comparing them with cl.time itself.
+===============
+*/
+static void R_KillParticles(void)
+{
+   particles_t *p = &r_particles;
+   float dietime = cl.time;
+   int i;
+
+   if (dietime < cl.time)
+      dietime = nextafterf(dietime, FLT_MAX);
+
+   for (i = 0; i < p->numparticles;) {
+#if defined(PART_SSE2)
+      if (i + 4 <= p->numparticles && !_mm_movemask_ps(_mm_cmplt_ps(
+                  _mm_loadu_ps(p->die + i), _mm_set1_ps(dietime)))) {
+         i += 4;
+         continue;
+      }
+#elif defined(PART_NEON)
+      if (i + 4 <= p->numparticles) {
+         uint32x4_t dead = vcltq_f32(vld1q_f32(p->die + i),
+               vdupq_n_f32(dietime));
+         uint32x2_t any = vorr_u32(vget_low_u32(dead), vget_high_u32(dead));
+
+         if (!(vget_lane_u32(any, 0) | vget_lane_u32(any, 1))) {
+            i += 4;
+            continue;
+         }
+      }
+#endif
+      if (p->die[i] < dietime)
+         R_KillParticle(i);
+      else
+         i++;
+   }
+}
+
+/*
+===============
+R_MoveParticle
+===============
+*/
+static void R_MoveParticle(int i, float frametime)
+{
+   particles_t *p = &r_particles;
+   const ptypemove_t *move = &r_ptypemove[p->type[i]];
+   int j;
+
+   for (j = 0; j < 3; j++)
+      p->org[j][i] += p->vel[j][i] * frametime;
+
+   p->vel[0][i] += p->vel[0][i] * move->kxy;
+   p->vel[1][i] += p->vel[1][i] * move->kxy;
+   p->vel[2][i] += p->vel[2][i] * move->kz;
+   p->vel[2][i] += move->grav;
+   p->ramp[i] += move->rate;
+
+   /* particles that have run out of ramp die next frame */
+   if (p->ramp[i] >= move->limit)
+      p->die[i] = -1;
+   else if (move->ramp)
+      p->color[i] = move->ramp[(int)p->ramp[i]];
+}
+
+#if defined(PART_SSE2) || defined(PART_NEON)
+/*
+===============
+R_MoveParticles4
+
+Same as R_MoveParticle, four particles at a time; returns how many were
+moved. The particles can be any mix of types: the moves for each four are
+loaded and transposed so kxy, kz, grav and rate end up in vectors of their
+own. The arrays are copied to 'p' first as the byte stores to the colours
+could otherwise alias them.
+===============
+*/
+static int R_MoveParticles4(float frametime)
+{
+   const particles_t p = r_particles;
+   const int count = p.numparticles & ~3;
+   int i, j, dead, index[4];
+#ifdef PART_SSE2
+   const __m128 ft = _mm_set1_ps(frametime);
+   __m128 kxy, kz, grav, rate, velx, vely, velz, ramp, limit, mask;
+
+   for (i = 0; i < count; i += 4) {
+      const byte *type = p.type + i;
+
+      kxy = _mm_loadu_ps(&r_ptypemove[type[0]].kxy);
+      kz = _mm_loadu_ps(&r_ptypemove[type[1]].kxy);
+      grav = _mm_loadu_ps(&r_ptypemove[type[2]].kxy);
+      rate = _mm_loadu_ps(&r_ptypemove[type[3]].kxy);
+      _MM_TRANSPOSE4_PS(kxy, kz, grav, rate);
+
+      velx = _mm_loadu_ps(p.vel[0] + i);
+      vely = _mm_loadu_ps(p.vel[1] + i);
+      velz = _mm_loadu_ps(p.vel[2] + i);
+      _mm_storeu_ps(p.org[0] + i, _mm_add_ps(_mm_loadu_ps(p.org[0] + i),
+               _mm_mul_ps(velx, ft)));
+      _mm_storeu_ps(p.org[1] + i, _mm_add_ps(_mm_loadu_ps(p.org[1] + i),
+               _mm_mul_ps(vely, ft)));
+      _mm_storeu_ps(p.org[2] + i, _mm_add_ps(_mm_loadu_ps(p.org[2] + i),
+               _mm_mul_ps(velz, ft)));
+
+      velx = _mm_add_ps(velx, _mm_mul_ps(velx, kxy));
+      vely = _mm_add_ps(vely, _mm_mul_ps(vely, kxy));
+      velz = _mm_add_ps(velz, _mm_mul_ps(velz, kz));
+      velz = _mm_add_ps(velz, grav);
+      _mm_storeu_ps(p.vel[0] + i, velx);
+      _mm_storeu_ps(p.vel[1] + i, vely);
+      _mm_storeu_ps(p.vel[2] + i, velz);
+
+      ramp = _mm_add_ps(_mm_loadu_ps(p.ramp + i), rate);
+      _mm_storeu_ps(p.ramp + i, ramp);
+
+      limit = _mm_setr_ps(r_ptypemove[type[0]].limit,
+            r_ptypemove[type[1]].limit, r_ptypemove[type[2]].limit,
+            r_ptypemove[type[3]].limit);
+      mask = _mm_cmpge_ps(ramp, limit);
+      _mm_storeu_ps(p.die + i, _mm_or_ps(_mm_and_ps(mask, _mm_set1_ps(-1)),
+               _mm_andnot_ps(mask, _mm_loadu_ps(p.die + i))));
+      dead = _mm_movemask_ps(mask);
+      _mm_storeu_si128((__m128i *)index, _mm_cvttps_epi32(ramp));
+#else /* PART_NEON */
+   float32x4x2_t lo, hi;
+   float32x4_t kxy, kz, grav, rate, velx, vely, velz, ramp;
+   float limit[4];
+   uint32x4_t mask;
+   uint32_t lanes[4];
+
+   for (i = 0; i < count; i += 4) {
+      const byte *type = p.type + i;
+
+      lo = vtrnq_f32(vld1q_f32(&r_ptypemove[type[0]].kxy),
+            vld1q_f32(&r_ptypemove[type[1]].kxy));
+      hi = vtrnq_f32(vld1q_f32(&r_ptypemove[type[2]].kxy),
+            vld1q_f32(&r_ptypemove[type[3]].kxy));
+      kxy = vcombine_f32(vget_low_f32(lo.val[0]), vget_low_f32(hi.val[0]));
+      kz = vcombine_f32(vget_low_f32(lo.val[1]), vget_low_f32(hi.val[1]));
+      grav = vcombine_f32(vget_high_f32(lo.val[0]), vget_high_f32(hi.val[0]));
+      rate = vcombine_f32(vget_high_f32(lo.val[1]), vget_high_f32(hi.val[1]));
+
+      velx = vld1q_f32(p.vel[0] + i);
+      vely = vld1q_f32(p.vel[1] + i);
+      velz = vld1q_f32(p.vel[2] + i);
+      vst1q_f32(p.org[0] + i, vaddq_f32(vld1q_f32(p.org[0] + i),
+               vmulq_n_f32(velx, frametime)));
+      vst1q_f32(p.org[1] + i, vaddq_f32(vld1q_f32(p.org[1] + i),
+               vmulq_n_f32(vely, frametime)));
+      vst1q_f32(p.org[2] + i, vaddq_f32(vld1q_f32(p.org[2] + i),
+               vmulq_n_f32(velz, frametime)));
+
+      velx = vaddq_f32(velx, vmulq_f32(velx, kxy));
+      vely = vaddq_f32(vely, vmulq_f32(vely, kxy));
+      velz = vaddq_f32(velz, vmulq_f32(velz, kz));
+      velz = vaddq_f32(velz, grav);
+      vst1q_f32(p.vel[0] + i, velx);
+      vst1q_f32(p.vel[1] + i, vely);
+      vst1q_f32(p.vel[2] + i, velz);
+
+      ramp = vaddq_f32(vld1q_f32(p.ramp + i), rate);
+      vst1q_f32(p.ramp + i, ramp);
+
+      for (j = 0; j < 4; j++)
+         limit[j] = r_ptypemove[type[j]].limit;
+      mask = vcgeq_f32(ramp, vld1q_f32(limit));
+      vst1q_f32(p.die + i, vbslq_f32(mask, vdupq_n_f32(-1),
+               vld1q_f32(p.die + i)));
+      vst1q_u32(lanes, mask);
+      dead = (lanes[0] & 1) | (lanes[1] & 2) | (lanes[2] & 4) | (lanes[3] & 8);
+      vst1q_s32(index, vcvtq_s32_f32(ramp));
+#endif
+
+      /* particles that have run out of ramp die next frame */
+      for (j = 0; j < 4; j++) {
+         const int *table = r_ptypemove[type[j]].ramp;
+
+         if (table && !(dead & (1 << j)))
+            p.color[i + j] = table[index[j]];
+      }
+   }
+
+   return count;
+}
+#endif
+
 /*
 ===============
 CL_RunParticles
@@ -606,7 +1089,8 @@ CL_RunParticles
 */
 void CL_RunParticles(void)
 {
-   particle_t *p, *kill;
+   particles_t *p = &r_particles;
+   ptypemove_t *move = r_ptypemove;
    float grav;
    float time1, time2, time3;
    float frametime;
@@ -626,86 +1110,45 @@ void CL_RunParticles(void)
    time1 = frametime * 5;
    dvel = 4 * frametime;
 
-   for (;;) {
-      kill = active_particles;
-      if (kill && kill->die < cl.time) {
-         active_particles = kill->next;
-         kill->next = free_particles;
-         free_particles = kill;
-         continue;
-      }
-      break;
-   }
+   memset(r_ptypemove, 0, sizeof(r_ptypemove));
+   for (i = 0; i <= pt_blob2; i++)
+      move[i].limit = FLT_MAX;
 
-   for (p = active_particles; p; p = p->next) {
-      for (;;) {
-         kill = p->next;
-         if (kill && kill->die < cl.time) {
-            p->next = kill->next;
-            kill->next = free_particles;
-            free_particles = kill;
-            continue;
-         }
-         break;
-      }
+   move[pt_fire].grav = grav;
+   move[pt_fire].rate = time1;
+   move[pt_fire].limit = 6;
+   move[pt_fire].ramp = ramp3;
 
-      p->org[0] += p->vel[0] * frametime;
-      p->org[1] += p->vel[1] * frametime;
-      p->org[2] += p->vel[2] * frametime;
+   move[pt_explode].kxy = move[pt_explode].kz = dvel;
+   move[pt_explode].grav = -grav;
+   move[pt_explode].rate = time2;
+   move[pt_explode].limit = 8;
+   move[pt_explode].ramp = ramp1;
 
-      switch (p->type)
-      {
-         case pt_static:
-            break;
-         case pt_fire:
-            p->ramp += time1;
-            if (p->ramp >= 6)
-               p->die = -1;
-            else
-               p->color = ramp3[(int)p->ramp];
-            p->vel[2] += grav;
-            break;
+   move[pt_explode2].kxy = move[pt_explode2].kz = -frametime;
+   move[pt_explode2].grav = -grav;
+   move[pt_explode2].rate = time3;
+   move[pt_explode2].limit = 8;
+   move[pt_explode2].ramp = ramp2;
 
-         case pt_explode:
-            p->ramp += time2;
-            if (p->ramp >= 8)
-               p->die = -1;
-            else
-               p->color = ramp1[(int)p->ramp];
-            for (i = 0; i < 3; i++)
-               p->vel[i] += p->vel[i] * dvel;
-            p->vel[2] -= grav;
-            break;
+   move[pt_blob].kxy = move[pt_blob].kz = dvel;
+   move[pt_blob].grav = -grav;
 
-         case pt_explode2:
-            p->ramp += time3;
-            if (p->ramp >= 8)
-               p->die = -1;
-            else
-               p->color = ramp2[(int)p->ramp];
-            for (i = 0; i < 3; i++)
-               p->vel[i] -= p->vel[i] * frametime;
-            p->vel[2] -= grav;
-            break;
+   move[pt_blob2].kxy = -dvel;
+   move[pt_blob2].grav = -grav;
 
-         case pt_blob:
-            for (i = 0; i < 3; i++)
-               p->vel[i] += p->vel[i] * dvel;
-            p->vel[2] -= grav;
-            break;
+   move[pt_slowgrav].grav = -grav;
+   move[pt_grav].grav = -grav;
 
-         case pt_blob2:
-            for (i = 0; i < 2; i++)
-               p->vel[i] -= p->vel[i] * dvel;
-            p->vel[2] -= grav;
-            break;
+   R_KillParticles();
 
-         case pt_slowgrav:
-         case pt_grav:
-            p->vel[2] -= grav;
-            break;
-      }
-   }
+#if defined(PART_SSE2) || defined(PART_NEON)
+   i = R_MoveParticles4(frametime);
+#else
+   i = 0;
+#endif
+   for (; i < p->numparticles; i++)
+      R_MoveParticle(i, frametime);
 }
 
 /*
@@ -715,16 +1158,13 @@ R_DrawParticles
 */
 void R_DrawParticles(void)
 {
-   particle_t *p;
-
    D_StartParticles();
 
    VectorScale(vright, xscaleshrink, r_pright);
    VectorScale(vup, yscaleshrink, r_pup);
    VectorCopy(vpn, r_ppn);
 
-   for (p = active_particles; p; p = p->next)
-      D_DrawParticle(p);
+   D_DrawParticles(&r_particles);
 
    D_EndParticles();
 }
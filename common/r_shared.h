@@ -25,6 +25,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // driver
 
 #include "d_iface.h"
+#include "jobs.h"
 #include "mathlib.h"
 #include "render.h"
 
@@ -44,8 +45,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 //===================================================================
 
-extern int cachewidth;
-extern pixel_t *cacheblock;
+extern THREAD_LOCAL int cachewidth;
+extern THREAD_LOCAL pixel_t *cacheblock;
 extern int screenwidth;
 
 extern float pixelAspect;
@@ -67,6 +68,8 @@ extern vec3_t vright, base_vright;
 #define	MINEDGES		NUMSTACKEDGES
 #define NUMSTACKSURFACES	1500
 #define MINSURFACES		NUMSTACKSURFACES
+#define MAXFRAMEEDGES		(NUMSTACKEDGES * 64)
+#define MAXFRAMESURFACES	(NUMSTACKSURFACES * 64)
 #define	MAXSPANS		3000
 
 // !!! if this is changed, it must be changed in asm_draw.h too !!!
@@ -119,7 +122,17 @@ extern float xscaleshrink, yscaleshrink;
 
 extern int d_lightstylevalue[256];	// 8.8 frac of base light value
 
-extern void TransformVector(vec3_t in, vec3_t out);
+/*
+ * In to view space, without the translation
+ */
+static INLINE void
+TransformVector(const vec3_t in, vec3_t out)
+{
+    out[0] = DotProduct(in, vright);
+    out[1] = DotProduct(in, vup);
+    out[2] = DotProduct(in, vpn);
+}
+
 extern void SetUpForLineScan(fixed8_t startvertu, fixed8_t startvertv,
 			     fixed8_t endvertu, fixed8_t endvertv);
 
@@ -140,9 +153,9 @@ extern int ubasestep, errorterm, erroradjustup, erroradjustdown;
 typedef struct edge_s {
     fixed16_t u;
     fixed16_t u_step;
-    struct edge_s *prev, *next;
+    struct edge_s *next;	// in newedges[]
     unsigned int surfs[2];
-    struct edge_s *nextremove;
+    int lastv;			// the last scan it crosses
     float nearzi;
     medge_t *owner;
 } edge_t;
@@ -245,6 +245,25 @@ static void R_SetupAndDrawSprite(void)
       pv += sizeof(vec5_t) / sizeof(*pv);
    }
 
+   // skip it if it's behind the world
+   if (r_occlude.value)
+   {
+      float left = 999999, top = 999999, right = -999999, bottom = -999999;
+
+      for (i = 0; i < nump; i++)
+      {
+         left = qmin(left, outverts[i].u);
+         right = qmax(right, outverts[i].u);
+         top = qmin(top, outverts[i].v);
+         bottom = qmax(bottom, outverts[i].v);
+      }
+      if (D_Occluded(left, top, right, bottom, r_spritedesc.nearzi))
+      {
+         free(outverts);
+         return;
+      }
+   }
+
    // draw it
    r_spritedesc.nump = nump;
    r_spritedesc.pverts = outverts;
@@ -23,30 +23,49 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "r_local.h"
 #include "sys.h"
 
-drawsurf_t r_drawsurf;
-
-int lightleft, sourcesstep, blocksize, sourcetstep;
-int lightdelta, lightdeltastep;
-int lightright, lightleftstep, lightrightstep, blockdivshift;
+/*
+ * The lighting for a texel row is worked out with SIMD, then only the
+ * colormap lookups are done per texel. The coloured light kernels stay in
+ * C, which measured faster than lighting their channels four at a time.
+ */
+#if defined(__SSE2__) && !defined(MSB_FIRST)
+#include <emmintrin.h>
+#define SURF_SSE2
+#elif defined(__ARM_NEON) && !defined(MSB_FIRST)
+#include <arm_neon.h>
+#define SURF_NEON
+#endif
 
-int				lightlefta[3];
-int				sourcesstep, blocksize, sourcetstep;
-int				lightrighta[3];
-int				lightleftstepa[3], lightrightstepa[3], blockdivshift;
+#if defined(SURF_SSE2) || defined(SURF_NEON)
+#define SURF_SIMD
+#endif
 
-unsigned blockdivmask;
-void *prowdestbase;
-unsigned char *pbasesource;
-int surfrowbytes;		// used by ASM files
+/*
+ * Surfaces may be built on any of the job threads, so all of the state used
+ * while building one is per thread.
+ */
+THREAD_LOCAL drawsurf_t r_drawsurf;
+
+static THREAD_LOCAL int lightleft, sourcesstep, blocksize, sourcetstep;
+static THREAD_LOCAL int lightright, lightleftstep, lightrightstep, blockdivshift;
+
+static THREAD_LOCAL int lightlefta[3];
+static THREAD_LOCAL int lightrighta[3];
+static THREAD_LOCAL int lightleftstepa[3], lightrightstepa[3];
+
+static THREAD_LOCAL unsigned blockdivmask;
+static THREAD_LOCAL void *prowdestbase;
+static THREAD_LOCAL unsigned char *pbasesource;
+static THREAD_LOCAL int surfrowbytes;
 //unsigned *r_lightptr;
-int *r_lightptr;
+static THREAD_LOCAL int *r_lightptr;
 
-int r_stepback;
-int r_lightwidth;
-unsigned char *r_source, *r_sourcemax;
+static THREAD_LOCAL int r_stepback;
+static THREAD_LOCAL int r_lightwidth;
+static THREAD_LOCAL unsigned char *r_source, *r_sourcemax;
 
-static int r_numhblocks;
-int r_numvblocks;
+static THREAD_LOCAL int r_numhblocks;
+static THREAD_LOCAL int r_numvblocks;
 
 void R_DrawSurfaceBlock8_mip0(void);
 void R_DrawSurfaceBlock8_mip1(void);
@@ -59,9 +78,23 @@ void R_DrawSurfaceBlockRGB_mip2(void);
 void R_DrawSurfaceBlockRGB_mip3(void);
 
 
+#ifdef SURF_SIMD
+static void R_DrawSurfaceBlock8_mip0_SIMD(void);
+static void R_DrawSurfaceBlock8_mip1_SIMD(void);
+#endif
+
+/*
+ * Rows at mip 2 and 3 are only 4 and 2 texels wide, not enough to be worth
+ * doing with SIMD.
+ */
 static void (*surfmiptable[4]) (void) = {
+#ifdef SURF_SIMD
+    R_DrawSurfaceBlock8_mip0_SIMD,
+    R_DrawSurfaceBlock8_mip1_SIMD,
+#else
     R_DrawSurfaceBlock8_mip0,
     R_DrawSurfaceBlock8_mip1,
+#endif
     R_DrawSurfaceBlock8_mip2,
     R_DrawSurfaceBlock8_mip3
 };
@@ -75,7 +108,7 @@ static void	(*surfmiptableRGB[4])(void) =
 };
 
 //static unsigned blocklights[18 * 18 * 3];
-int		blocklights[18*18*3]; // LordHavoc: .lit support (*3 for RGB)
+static THREAD_LOCAL int blocklights[18*18*3]; // LordHavoc: .lit support (*3 for RGB)
 
 // Leilei - macros to make colored lighting code look a little more bearable to sanity
 // Macros for initiating the RGB light deltas.
@@ -90,6 +123,337 @@ int		blocklights[18*18*3]; // LordHavoc: .lit support (*3 for RGB)
 
 int			host_fullbrights;   // for preserving fullbrights in color operations
 
+/*
+ * Whether the light can reach any of the surface's lightmap samples. Sample
+ * distances are truncated, so allow one unit of slack.
+ */
+static qboolean
+R_DlightReachesSurface(const vec3_t local, int smax, int tmax, float minlight)
+{
+   float reach = minlight + 1;
+
+   if (local[0] <= -reach || local[0] >= (smax - 1) * 16 + reach)
+      return false;
+   if (local[1] <= -reach || local[1] >= (tmax - 1) * 16 + reach)
+      return false;
+
+   return true;
+}
+
+/*
+ * Whether R_AddDynamicLights will add any of the light to the surface,
+ * worked out the same way it does, so R_MarkLights only marks (and has
+ * rebuilt) the surfaces a light changes.
+ */
+qboolean
+R_DlightTouchesSurface(const dlight_t *light, const msurface_t *surf)
+{
+   const mtexinfo_t *tex = surf->texinfo;
+   float dist, rad, minlight;
+   vec3_t impact, local;
+   int i;
+
+   rad = light->radius;
+   dist = DotProduct(light->origin, surf->plane->normal) - surf->plane->dist;
+   rad -= fabs(dist);
+   minlight = light->minlight;
+   if (rad < minlight)
+      return false;
+   minlight = rad - minlight;
+
+   for (i = 0; i < 3; i++)
+      impact[i] = light->origin[i] - surf->plane->normal[i] * dist;
+
+   local[0] = DotProduct(impact, tex->vecs[0]) + tex->vecs[0][3];
+   local[1] = DotProduct(impact, tex->vecs[1]) + tex->vecs[1][3];
+
+   local[0] -= surf->texturemins[0];
+   local[1] -= surf->texturemins[1];
+
+   return R_DlightReachesSurface(local, (surf->extents[0] >> 4) + 1,
+         (surf->extents[1] >> 4) + 1, minlight);
+}
+
+/*
+ * R_AddDlightRow / R_AddDlightRowRGB add one dynamic light to a row of
+ * lightmap samples, 'td' being the row's distance from the light. The SIMD
+ * versions do four samples at a time and give the same results as the
+ * scalar code, which they fall back to for the last few samples.
+ */
+#ifdef SURF_SSE2
+/*
+ * (rad - dist) for four samples s to s + 3 where dist < minlight, otherwise
+ * zero. 'mask' is set for the samples the light reaches.
+ */
+static inline __m128
+R_DlightFalloff(int s, float local0, int td, float minlight, float rad,
+      __m128 *mask)
+{
+   __m128i svec, sd, sign, tdv, major, dist;
+   __m128 fdist;
+
+   svec = _mm_add_epi32(_mm_set1_epi32(s), _mm_set_epi32(3, 2, 1, 0));
+   svec = _mm_slli_epi32(svec, 4);
+   sd = _mm_cvttps_epi32(_mm_sub_ps(_mm_set1_ps(local0),
+            _mm_cvtepi32_ps(svec)));
+   sign = _mm_srai_epi32(sd, 31);
+   sd = _mm_sub_epi32(_mm_xor_si128(sd, sign), sign);
+
+   tdv = _mm_set1_epi32(td);
+   major = _mm_cmpgt_epi32(sd, tdv);
+   dist = _mm_or_si128(
+         _mm_and_si128(major, _mm_add_epi32(sd, _mm_srai_epi32(tdv, 1))),
+         _mm_andnot_si128(major, _mm_add_epi32(tdv, _mm_srai_epi32(sd, 1))));
+
+   fdist = _mm_cvtepi32_ps(dist);
+   *mask = _mm_cmplt_ps(fdist, _mm_set1_ps(minlight));
+
+   return _mm_and_ps(*mask, _mm_sub_ps(_mm_set1_ps(rad), fdist));
+}
+
+static void
+R_AddDlightRow(int *bl, int smax, float local0, int td, float minlight,
+      float rad)
+{
+   __m128 mask, falloff;
+   __m128i old, lit;
+   int s, sd;
+   float dist;
+
+   for (s = 0; s + 4 <= smax; s += 4)
+   {
+      falloff = R_DlightFalloff(s, local0, td, minlight, rad, &mask);
+      old = _mm_loadu_si128((const __m128i *)(bl + s));
+      lit = _mm_cvttps_epi32(_mm_add_ps(_mm_cvtepi32_ps(old),
+               _mm_mul_ps(falloff, _mm_set1_ps(256))));
+      lit = _mm_or_si128(_mm_and_si128(_mm_castps_si128(mask), lit),
+            _mm_andnot_si128(_mm_castps_si128(mask), old));
+      _mm_storeu_si128((__m128i *)(bl + s), lit);
+   }
+
+   for (; s < smax; s++)
+   {
+      sd = local0 - s * 16;
+      if (sd < 0)
+         sd = -sd;
+      if (sd > td)
+         dist = sd + (td >> 1);
+      else
+         dist = td + (sd >> 1);
+      if (dist < minlight)
+         bl[s] += (rad - dist) * 256;
+   }
+}
+
+static void
+R_AddDlightRowRGB(int *bl, int smax, float local0, int td, float minlight,
+      float rad, const float color[3])
+{
+   const __m128 color0 = _mm_setr_ps(color[0], color[1], color[2], color[0]);
+   const __m128 color1 = _mm_setr_ps(color[1], color[2], color[0], color[1]);
+   const __m128 color2 = _mm_setr_ps(color[2], color[0], color[1], color[2]);
+   __m128 mask, falloff, f;
+   __m128i *out;
+   int s, sd;
+   float dist, brightness;
+
+   /* Four RGB samples are spread over three vectors of blocklights */
+   for (s = 0; s + 4 <= smax; s += 4)
+   {
+      falloff = R_DlightFalloff(s, local0, td, minlight, rad, &mask);
+      out = (__m128i *)(bl + s * 3);
+
+      f = _mm_shuffle_ps(falloff, falloff, _MM_SHUFFLE(1, 0, 0, 0));
+      _mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out),
+               _mm_cvttps_epi32(_mm_mul_ps(f, color0))));
+      f = _mm_shuffle_ps(falloff, falloff, _MM_SHUFFLE(2, 2, 1, 1));
+      _mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1),
+               _mm_cvttps_epi32(_mm_mul_ps(f, color1))));
+      f = _mm_shuffle_ps(falloff, falloff, _MM_SHUFFLE(3, 3, 3, 2));
+      _mm_storeu_si128(out + 2, _mm_add_epi32(_mm_loadu_si128(out + 2),
+               _mm_cvttps_epi32(_mm_mul_ps(f, color2))));
+   }
+
+   for (; s < smax; s++)
+   {
+      sd = local0 - s * 16;
+      if (sd < 0)
+         sd = -sd;
+      if (sd > td)
+         dist = sd + (td >> 1);
+      else
+         dist = td + (sd >> 1);
+      if (dist < minlight)
+      {
+         brightness = rad - dist;
+         bl[s * 3 + 0] += (int)(brightness * color[0]);
+         bl[s * 3 + 1] += (int)(brightness * color[1]);
+         bl[s * 3 + 2] += (int)(brightness * color[2]);
+      }
+   }
+}
+#elif defined(SURF_NEON)
+static inline float32x4_t
+R_DlightFalloff(int s, float local0, int td, float minlight, float rad,
+      uint32x4_t *mask)
+{
+   static const int32_t ramp[4] = { 0, 1, 2, 3 };
+   int32x4_t svec, sd, tdv, dist;
+   uint32x4_t major;
+   float32x4_t fdist;
+
+   svec = vshlq_n_s32(vaddq_s32(vdupq_n_s32(s), vld1q_s32(ramp)), 4);
+   sd = vcvtq_s32_f32(vsubq_f32(vdupq_n_f32(local0), vcvtq_f32_s32(svec)));
+   sd = vabsq_s32(sd);
+
+   tdv = vdupq_n_s32(td);
+   major = vcgtq_s32(sd, tdv);
+   dist = vbslq_s32(major, vaddq_s32(sd, vshrq_n_s32(tdv, 1)),
+         vaddq_s32(tdv, vshrq_n_s32(sd, 1)));
+
+   fdist = vcvtq_f32_s32(dist);
+   *mask = vcltq_f32(fdist, vdupq_n_f32(minlight));
+
+   return vreinterpretq_f32_u32(vandq_u32(*mask,
+            vreinterpretq_u32_f32(vsubq_f32(vdupq_n_f32(rad), fdist))));
+}
+
+static void
+R_AddDlightRow(int *bl, int smax, float local0, int td, float minlight,
+      float rad)
+{
+   uint32x4_t mask;
+   float32x4_t falloff;
+   int32x4_t old, lit;
+   int s, sd;
+   float dist;
+
+   for (s = 0; s + 4 <= smax; s += 4)
+   {
+      falloff = R_DlightFalloff(s, local0, td, minlight, rad, &mask);
+      old = vld1q_s32(bl + s);
+      lit = vcvtq_s32_f32(vaddq_f32(vcvtq_f32_s32(old),
+               vmulq_n_f32(falloff, 256)));
+      vst1q_s32(bl + s, vbslq_s32(mask, lit, old));
+   }
+
+   for (; s < smax; s++)
+   {
+      sd = local0 - s * 16;
+      if (sd < 0)
+         sd = -sd;
+      if (sd > td)
+         dist = sd + (td >> 1);
+      else
+         dist = td + (sd >> 1);
+      if (dist < minlight)
+         bl[s] += (rad - dist) * 256;
+   }
+}
+
+static void
+R_AddDlightRowRGB(int *bl, int smax, float local0, int td, float minlight,
+      float rad, const float color[3])
+{
+   const float pattern[6] = {
+      color[0], color[1], color[2], color[0], color[1], color[2]
+   };
+   const float32x4_t color0 = vld1q_f32(pattern);
+   const float32x4_t color1 = vld1q_f32(pattern + 1);
+   const float32x4_t color2 = vld1q_f32(pattern + 2);
+   uint32x4_t mask;
+   float32x4_t falloff, f;
+   float32x2_t lo, hi;
+   int32_t *out;
+   int s, sd;
+   float dist, brightness;
+
+   /* Four RGB samples are spread over three vectors of blocklights */
+   for (s = 0; s + 4 <= smax; s += 4)
+   {
+      falloff = R_DlightFalloff(s, local0, td, minlight, rad, &mask);
+      lo = vget_low_f32(falloff);
+      hi = vget_high_f32(falloff);
+      out = bl + s * 3;
+
+      f = vcombine_f32(vdup_lane_f32(lo, 0), lo);
+      vst1q_s32(out, vaddq_s32(vld1q_s32(out),
+               vcvtq_s32_f32(vmulq_f32(f, color0))));
+      f = vcombine_f32(vdup_lane_f32(lo, 1), vdup_lane_f32(hi, 0));
+      vst1q_s32(out + 4, vaddq_s32(vld1q_s32(out + 4),
+               vcvtq_s32_f32(vmulq_f32(f, color1))));
+      f = vcombine_f32(hi, vdup_lane_f32(hi, 1));
+      vst1q_s32(out + 8, vaddq_s32(vld1q_s32(out + 8),
+               vcvtq_s32_f32(vmulq_f32(f, color2))));
+   }
+
+   for (; s < smax; s++)
+   {
+      sd = local0 - s * 16;
+      if (sd < 0)
+         sd = -sd;
+      if (sd > td)
+         dist = sd + (td >> 1);
+      else
+         dist = td + (sd >> 1);
+      if (dist < minlight)
+      {
+         brightness = rad - dist;
+         bl[s * 3 + 0] += (int)(brightness * color[0]);
+         bl[s * 3 + 1] += (int)(brightness * color[1]);
+         bl[s * 3 + 2] += (int)(brightness * color[2]);
+      }
+   }
+}
+#else
+static void
+R_AddDlightRow(int *bl, int smax, float local0, int td, float minlight,
+      float rad)
+{
+   int s, sd;
+   float dist;
+
+   for (s = 0; s < smax; s++)
+   {
+      sd = local0 - s * 16;
+      if (sd < 0)
+         sd = -sd;
+      if (sd > td)
+         dist = sd + (td >> 1);
+      else
+         dist = td + (sd >> 1);
+      if (dist < minlight)
+         bl[s] += (rad - dist) * 256;
+   }
+}
+
+static void
+R_AddDlightRowRGB(int *bl, int smax, float local0, int td, float minlight,
+      float rad, const float color[3])
+{
+   int s, sd;
+   float dist, brightness;
+
+   for (s = 0; s < smax; s++)
+   {
+      sd = local0 - s * 16;
+      if (sd < 0)
+         sd = -sd;
+      if (sd > td)
+         dist = sd + (td >> 1);
+      else
+         dist = td + (sd >> 1);
+      if (dist < minlight)
+      {
+         brightness = rad - dist;
+         bl[s * 3 + 0] += (int)(brightness * color[0]);
+         bl[s * 3 + 1] += (int)(brightness * color[1]);
+         bl[s * 3 + 2] += (int)(brightness * color[2]);
+      }
+   }
+}
+#endif
+
 
 /*
 ===============
@@ -100,10 +464,10 @@ static void R_AddDynamicLights(void)
 {
    msurface_t *surf;
    int lnum;
-   int sd, td;
+   int td;
    float dist, rad, minlight;
    vec3_t impact, local;
-   int s, t;
+   int t;
    int i;
    int smax, tmax;
    mtexinfo_t *tex;
@@ -136,21 +500,18 @@ static void R_AddDynamicLights(void)
       local[0] -= surf->texturemins[0];
       local[1] -= surf->texturemins[1];
 
+      if (!R_DlightReachesSurface(local, smax, tmax, minlight))
+         continue;
+
       for (t = 0; t < tmax; t++) {
          td = local[1] - t * 16;
          if (td < 0)
             td = -td;
-         for (s = 0; s < smax; s++) {
-            sd = local[0] - s * 16;
-            if (sd < 0)
-               sd = -sd;
-            if (sd > td)
-               dist = sd + (td >> 1);
-            else
-               dist = td + (sd >> 1);
-            if (dist < minlight)
-               blocklights[t * smax + s] += (rad - dist) * 256;
-         }
+         /* dist is never less than td */
+         if (td >= minlight)
+            continue;
+         R_AddDlightRow(blocklights + t * smax, smax, local[0], td,
+               minlight, rad);
       }
    }
 }
@@ -159,15 +520,14 @@ static void R_AddDynamicLightsRGB(void)
 {
    msurface_t *surf;
    int lnum;
-   int sd, td;
+   int td;
    float dist, rad, minlight;
    vec3_t impact, local;
-   int s, t;
+   int t;
    int i;
    int smax, tmax;
    mtexinfo_t *tex;
-   float		cred, cgreen, cblue, brightness;
-   unsigned	*bl;
+   float color[3];
 
    surf = r_drawsurf.surf;
    smax = (surf->extents[0] >> 4) + 1;
@@ -197,37 +557,24 @@ static void R_AddDynamicLightsRGB(void)
       local[0] -= surf->texturemins[0];
       local[1] -= surf->texturemins[1];
 
-      cred = cl_dlights[lnum].color[0] * 256.0f * 2;
-      cgreen = cl_dlights[lnum].color[1] * 256.0f* 2;
-      cblue = cl_dlights[lnum].color[2] * 256.0f* 2;
+      if (!R_DlightReachesSurface(local, smax, tmax, minlight))
+         continue;
 
-      bl = blocklights;
+      color[0] = cl_dlights[lnum].color[0] * 256.0f * 2;
+      color[1] = cl_dlights[lnum].color[1] * 256.0f* 2;
+      color[2] = cl_dlights[lnum].color[2] * 256.0f* 2;
 
-		for (t = 0 ; t<tmax ; t++)
-		{
-			td = local[1] - t*16;
-			if (td < 0)
-				td = -td;
-			for (s=0 ; s<smax ; s++)
-			{
-				sd = local[0] - s*16;
-				if (sd < 0)
-					sd = -sd;
-				if (sd > td)
-					dist = sd + (td>>1);
-				else
-					dist = td + (sd>>1);
-				if (dist < minlight)
-				{
-					brightness = rad - dist;
-					bl[0] += (int) (brightness * cred);
-					bl[1] += (int) (brightness * cgreen);
-					bl[2] += (int) (brightness * cblue);
-				}
-				bl += 3;
-			}
-		}
- 	}  
+      for (t = 0; t < tmax; t++) {
+         td = local[1] - t * 16;
+         if (td < 0)
+            td = -td;
+         /* dist is never less than td */
+         if (td >= minlight)
+            continue;
+         R_AddDlightRowRGB(blocklights + t * smax * 3, smax, local[0], td,
+               minlight, rad, color);
+      }
+   }
 }
 
 
@@ -380,18 +727,15 @@ void R_BuildLightMapRGB (void)
 
 
 /*
-===============
-R_TextureAnimation
-
-Returns the proper texture for a given time and base texture
-===============
-*/
-texture_t *R_TextureAnimation(const entity_t *e, texture_t *base)
+ * Follows an animated texture's sequence to the frame shown at 'tenths'
+ */
+texture_t *
+R_ResolveTextureAnimation(texture_t *base, int frame, int tenths)
 {
    int reletive;
    int count;
 
-   if (e->frame)
+   if (frame)
    {
       if (base->alternate_anims)
          base = base->alternate_anims;
@@ -400,7 +744,7 @@ texture_t *R_TextureAnimation(const entity_t *e, texture_t *base)
    if (!base->anim_total)
       return base;
 
-   reletive = (int)(cl.time * 10) % base->anim_total;
+   reletive = tenths % base->anim_total;
 
    count = 0;
    while (base->anim_min > reletive || base->anim_max <= reletive) {
@@ -414,6 +758,26 @@ texture_t *R_TextureAnimation(const entity_t *e, texture_t *base)
    return base;
 }
 
+/*
+===============
+R_TextureAnimation
+
+Returns the proper texture for a given time and base texture
+===============
+*/
+texture_t *R_TextureAnimation(const entity_t *e, texture_t *base)
+{
+   texture_t *frame = base->anim_frames[e->frame != 0];
+
+   if (frame)
+      return frame;
+   if (!base->anim_total)
+      return base;
+
+   /* one that wasn't loaded with the map */
+   return R_ResolveTextureAnimation(base, e->frame, (int)(cl.time * 10));
+}
+
 /*
 ===============
 R_DrawSurface
@@ -982,6 +1346,118 @@ void R_DrawSurfaceBlock16(void)
 
 //============================================================================
 
+#ifdef SURF_SIMD
+
+#ifdef SURF_SSE2
+/*
+================
+R_LightRow8
+
+Light 'count' texels (a multiple of 8). Texel b gets the light value
+(light + (count - 1 - b) * lightstep).
+================
+*/
+static void
+R_LightRow8(const byte *psource, byte *prowdest, int count, int light,
+	    int lightstep)
+{
+    const byte *colormap = (const byte *)vid.colormap;
+    const __m128i ramp = _mm_set_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m128i mask = _mm_set1_epi16((short)0xFF00);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i steps, lights, pix;
+    unsigned short index[8];
+    int b, i;
+
+    steps = _mm_mullo_epi16(ramp, _mm_set1_epi16(lightstep));
+    for (b = 0; b < count; b += 8) {
+	lights = _mm_set1_epi16(light + (count - 8 - b) * lightstep);
+	lights = _mm_add_epi16(lights, steps);
+	pix = _mm_loadl_epi64((const __m128i *)(psource + b));
+	pix = _mm_unpacklo_epi8(pix, zero);
+	_mm_storeu_si128((__m128i *)index,
+			 _mm_add_epi16(_mm_and_si128(lights, mask), pix));
+	for (i = 0; i < 8; i++)
+	    prowdest[b + i] = colormap[index[i]];
+    }
+}
+#endif /* SURF_SSE2 */
+
+#ifdef SURF_NEON
+static void
+R_LightRow8(const byte *psource, byte *prowdest, int count, int light,
+	    int lightstep)
+{
+    static const int16_t ramp[8] = { 7, 6, 5, 4, 3, 2, 1, 0 };
+    const byte *colormap = (const byte *)vid.colormap;
+    const uint16x8_t mask = vdupq_n_u16(0xFF00);
+    int16x8_t steps, lights;
+    uint16x8_t index;
+    uint16_t indices[8];
+    int b, i;
+
+    steps = vmulq_n_s16(vld1q_s16(ramp), lightstep);
+    for (b = 0; b < count; b += 8) {
+	lights = vdupq_n_s16(light + (count - 8 - b) * lightstep);
+	lights = vaddq_s16(lights, steps);
+	index = vandq_u16(vreinterpretq_u16_s16(lights), mask);
+	index = vaddq_u16(index, vmovl_u8(vld1_u8(psource + b)));
+	vst1q_u16(indices, index);
+	for (i = 0; i < 8; i++)
+	    prowdest[b + i] = colormap[indices[i]];
+    }
+}
+#endif /* SURF_NEON */
+
+/*
+ * Same as R_DrawSurfaceBlock8_mip*, for blocks (1 << shift) texels wide
+ */
+static void
+R_DrawSurfaceBlock8_SIMD(int shift)
+{
+    int v, i, lightstep;
+    int size = 1 << shift;
+    unsigned char *psource = pbasesource;
+    unsigned char *prowdest = (unsigned char *)prowdestbase;
+
+    for (v = 0; v < r_numvblocks; v++) {
+	lightleft = r_lightptr[0];
+	lightright = r_lightptr[1];
+	r_lightptr += r_lightwidth;
+	lightleftstep = (r_lightptr[0] - lightleft) >> shift;
+	lightrightstep = (r_lightptr[1] - lightright) >> shift;
+
+	for (i = 0; i < size; i++) {
+	    lightstep = (lightleft - lightright) >> shift;
+	    R_LightRow8(psource, prowdest, size, lightright, lightstep);
+
+	    psource += sourcetstep;
+	    lightright += lightrightstep;
+	    lightleft += lightleftstep;
+	    prowdest += surfrowbytes;
+	}
+
+	if (psource >= r_sourcemax)
+	    psource -= r_stepback;
+    }
+}
+
+static void
+R_DrawSurfaceBlock8_mip0_SIMD(void)
+{
+    R_DrawSurfaceBlock8_SIMD(4);
+}
+
+static void
+R_DrawSurfaceBlock8_mip1_SIMD(void)
+{
+    R_DrawSurfaceBlock8_SIMD(3);
+}
+
+#endif /* SURF_SIMD */
+
+//============================================================================
+
 // FIXME - unused functions?
 #if 0
 /*
@@ -48,6 +48,16 @@ typedef struct efrag_s {
 } efrag_t;
 
 
+#ifdef NQ_HACK
+#define ENTITY_SNAPSHOTS 8	// power of two
+
+typedef struct {
+    double time;		// server time of the update
+    vec3_t origin;
+    vec3_t angles;
+} entitysnapshot_t;
+#endif
+
 typedef struct entity_s {
 #ifdef NQ_HACK
     qboolean forcelink;		// model changed
@@ -108,6 +118,12 @@ typedef struct entity_s {
     vec3_t currentangles;
     float previousanglestime;
     float currentanglestime;
+
+#ifdef NQ_HACK
+    /* The recent updates, to draw it from a little in the past */
+    entitysnapshot_t snapshots[ENTITY_SNAPSHOTS];
+    int numsnapshots;		// since it last jumped, newest is numsnapshots - 1
+#endif
 } entity_t;
 
 extern cvar_t r_lerpmodels;
@@ -189,6 +205,12 @@ void R_ParticleExplosion2(vec3_t org, int colorStart, int colorLength);
 
 void R_InitParticles(void);
 void R_ClearParticles(void);
+#ifdef NQ_HACK
+struct sizebuf_s;
+int R_ParticleStateSize(void);
+void R_SaveParticles(struct sizebuf_s *buf);
+qboolean R_LoadParticles(struct sizebuf_s *buf);
+#endif
 void R_DrawParticles(void);
 
 /*
@@ -205,6 +227,13 @@ int D_SurfaceCacheForRes(int width, int height);
 void D_FlushCaches(void);
 void D_DeleteSurfaceCache(void);
 void D_InitCaches(void *buffer, int size);
+void D_AllocCaches(int size);
+void D_FreeCaches(void);
+void D_InitSurfCache(void);
+void D_SetupSurfCache(void);
 void R_SetVrect(const vrect_t *pvrectin, vrect_t *pvrect, int lineadj);
 
+/* shared player colour translations of vid.colormap */
+byte *R_TranslationTable(int top, int bottom);
+
 #endif /* RENDER_H */
@@ -0,0 +1,690 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// savestate.c -- binary snapshots of the running game
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "client.h"
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "host.h"
+#include "model.h"
+#include "progs.h"
+#include "quakedef.h"
+#include "render.h"
+#include "savestate.h"
+#include "server.h"
+#include "sound.h"
+#include "vid.h"
+#include "world.h"
+
+#define SAVESTATE_MAGIC		(('S' << 24) | ('S' << 16) | ('Q' << 8) | 'T')
+#define SAVESTATE_VERSION	3
+
+/* Lightstyles that were never set by QuakeC */
+#define SAVESTATE_NOSTRING	INT_MIN
+
+typedef struct {
+   int magic;
+   int version;
+   int length;			/* bytes used, the rest is zero padding */
+   int edict_size;
+   int numglobals;
+   int maxclients;
+   int activeclients;		/* bitmask of active svs.clients */
+   int num_strings;
+   char mapname[MAX_QPATH];
+} savestate_header_t;
+
+typedef struct {
+   double time;
+   double lastchecktime;
+   int paused;
+   int lastcheck;
+   int checkleaf;
+   int num_edicts;
+   int lightstyles[MAX_LIGHTSTYLES];
+} savestate_server_t;
+
+typedef struct {
+   char name[MAX_SCOREBOARDNAME];
+   float entertime;
+   int frags;
+   byte topcolor;
+   byte bottomcolor;
+} savestate_player_t;
+
+/*
+ * Everything up to the message buffers lives at a fixed offset: edicts,
+ * clients and entities each get a slot whether they are in use or not. With
+ * only the handful of edicts touched in a frame changing between two
+ * snapshots, a frontend storing its rewind buffer as deltas only keeps
+ * those.
+ */
+#define EDICT_RECORD_SIZE(edict_size) \
+   (sizeof(qboolean) + sizeof(float) + sizeof(entity_state_t) \
+    + (edict_size) - offsetof(edict_t, v))
+#define CLIENT_HEAD_SIZE offsetof(client_t, msgbuf)
+#define CLIENT_TAIL_SIZE (sizeof(client_t) - offsetof(client_t, edict))
+#define CLIENT_RECORD_SIZE (CLIENT_HEAD_SIZE + CLIENT_TAIL_SIZE)
+
+#define ENTITY_RECORD_SIZE (2 * sizeof(int) + sizeof(entity_t))
+
+static size_t savestate_size;
+
+/* Too big for the stack; only used while loading */
+static client_t savestate_client;
+static client_state_t savestate_cl;
+
+void SaveState_Write(sizebuf_t *buf, const void *data, int length)
+{
+   if (buf->overflowed || length > buf->maxsize - buf->cursize)
+   {
+      buf->overflowed = true;
+      return;
+   }
+   memcpy(buf->data + buf->cursize, data, length);
+   buf->cursize += length;
+}
+
+qboolean SaveState_Read(sizebuf_t *buf, void *data, int length)
+{
+   if (buf->overflowed || length > buf->maxsize - buf->cursize)
+   {
+      buf->overflowed = true;
+      return false;
+   }
+   memcpy(data, buf->data + buf->cursize, length);
+   buf->cursize += length;
+
+   return true;
+}
+
+void SaveState_Zero(sizebuf_t *buf, int length)
+{
+   if (buf->overflowed || length > buf->maxsize - buf->cursize)
+   {
+      buf->overflowed = true;
+      return;
+   }
+   memset(buf->data + buf->cursize, 0, length);
+   buf->cursize += length;
+}
+
+qboolean SaveState_Skip(sizebuf_t *buf, int length)
+{
+   if (buf->overflowed || length > buf->maxsize - buf->cursize)
+   {
+      buf->overflowed = true;
+      return false;
+   }
+   buf->cursize += length;
+
+   return true;
+}
+
+/*
+==================
+SaveState_ProgsSizes
+
+Edict size and global count of the progs, read from the progs.dat header if
+it isn't loaded yet.
+==================
+*/
+static qboolean SaveState_ProgsSizes(int *edict_size, int *numglobals)
+{
+   dprograms_t header;
+   FILE *f;
+   size_t count;
+
+   if (progs)
+   {
+      *edict_size = pr_edict_size;
+      *numglobals = progs->numglobals;
+      return true;
+   }
+
+   if (COM_FOpenFile("progs.dat", &f) < (int)sizeof(header))
+   {
+      if (f)
+         fclose(f);
+      return false;
+   }
+   count = fread(&header, sizeof(header), 1, f);
+   fclose(f);
+   if (count != 1)
+      return false;
+
+   *edict_size = LittleLong(header.entityfields) * 4
+      + sizeof(edict_t) - sizeof(entvars_t);
+   *numglobals = LittleLong(header.numglobals);
+
+   return true;
+}
+
+/*
+==================
+SaveState_Size
+==================
+*/
+size_t SaveState_Size(void)
+{
+   int edict_size, numglobals;
+   size_t size;
+
+   if (savestate_size)
+      return savestate_size;
+   if (!SaveState_ProgsSizes(&edict_size, &numglobals))
+      return 0;
+
+   size = sizeof(savestate_header_t);
+
+   /* server */
+   size += sizeof(savestate_server_t);
+   size += svs.maxclientslimit * CLIENT_RECORD_SIZE;
+   size += numglobals * sizeof(float);
+   size += MAX_EDICTS * EDICT_RECORD_SIZE(edict_size);
+
+   /* client */
+   size += sizeof(client_state_t);
+   size += MAX_SCOREBOARD * sizeof(savestate_player_t);
+   size += MAX_EDICTS * ENTITY_RECORD_SIZE;
+   size += MAX_DLIGHTS * (sizeof(int) + sizeof(dlight_t));
+   size += sizeof(cl_lightstyle);
+   size += R_ParticleStateSize();
+   size += S_ChannelStateSize();
+
+   /* messages */
+   size += 3 * sizeof(int) + MAX_DATAGRAM + 2 * MAX_MSGLEN;
+   size += svs.maxclientslimit * MAX_MSGLEN;
+
+   savestate_size = size;
+
+   return size;
+}
+
+/*
+==================
+SaveState_CanSave
+
+Snapshots only make sense for a fully connected local game.
+==================
+*/
+static qboolean SaveState_CanSave(void)
+{
+   return sv.active && sv.state == ss_active && progs
+      && cls.state == ca_connected && cls.signon == SIGNONS
+      && !cls.demoplayback;
+}
+
+static int SaveState_ModelNum(const struct model_s *model)
+{
+   int i;
+
+   if (!model)
+      return 0;
+   for (i = 1; i < MAX_MODELS && cl.model_precache[i]; i++)
+      if (cl.model_precache[i] == model)
+         return i;
+
+   return 0;
+}
+
+static void SaveState_WriteSizebuf(sizebuf_t *buf, const sizebuf_t *sb)
+{
+   SaveState_Write(buf, &sb->cursize, sizeof(sb->cursize));
+   SaveState_Write(buf, sb->data, sb->cursize);
+}
+
+static qboolean SaveState_ReadSizebuf(sizebuf_t *buf, sizebuf_t *sb)
+{
+   int cursize;
+
+   if (!SaveState_Read(buf, &cursize, sizeof(cursize)))
+      return false;
+   if (cursize < 0 || cursize > sb->maxsize)
+      return false;
+   sb->cursize = cursize;
+   sb->overflowed = false;
+
+   return SaveState_Read(buf, sb->data, cursize);
+}
+
+/*
+ * Edicts are saved without their area links and touched leafs; these are
+ * rebuilt by relinking every entity after loading.
+ */
+
+static void SaveState_WriteEdict(sizebuf_t *buf, const edict_t *ed)
+{
+   SaveState_Write(buf, &ed->free, sizeof(ed->free));
+   SaveState_Write(buf, &ed->freetime, sizeof(ed->freetime));
+   SaveState_Write(buf, &ed->baseline, sizeof(ed->baseline));
+   SaveState_Write(buf, &ed->v, pr_edict_size - offsetof(edict_t, v));
+}
+
+static void SaveState_ReadEdict(sizebuf_t *buf, edict_t *ed)
+{
+   SaveState_Read(buf, &ed->free, sizeof(ed->free));
+   SaveState_Read(buf, &ed->freetime, sizeof(ed->freetime));
+   SaveState_Read(buf, &ed->baseline, sizeof(ed->baseline));
+   SaveState_Read(buf, &ed->v, pr_edict_size - offsetof(edict_t, v));
+}
+
+/*
+ * client_t is written in two parts around the message buffer. The used part
+ * of the buffer goes into the variable sized part of the snapshot.
+ */
+static void SaveState_WriteClient(sizebuf_t *buf, const client_t *client)
+{
+   SaveState_Write(buf, client, CLIENT_HEAD_SIZE);
+   SaveState_Write(buf, &client->edict, CLIENT_TAIL_SIZE);
+}
+
+static qboolean SaveState_ReadClient(sizebuf_t *buf, client_t *client)
+{
+   client_t *saved = &savestate_client;
+
+   if (!SaveState_Read(buf, saved, CLIENT_HEAD_SIZE))
+      return false;
+   if (saved->message.cursize < 0 || saved->message.cursize > MAX_MSGLEN)
+      return false;
+   if (!SaveState_Read(buf, &saved->edict, CLIENT_TAIL_SIZE))
+      return false;
+
+   /* Keep the live connection and pointers */
+   saved->netconnection = client->netconnection;
+   saved->message.data = client->message.data;
+   saved->message.maxsize = client->message.maxsize;
+   saved->message.allowoverflow = client->message.allowoverflow;
+   saved->edict = client->edict;
+
+   memcpy(client, saved, CLIENT_HEAD_SIZE);
+   memcpy(&client->edict, &saved->edict, CLIENT_TAIL_SIZE);
+
+   return true;
+}
+
+static void SaveState_WriteServer(sizebuf_t *buf)
+{
+   savestate_server_t state;
+   int i;
+
+   state.time = sv.time;
+   state.lastchecktime = sv.lastchecktime;
+   state.paused = sv.paused;
+   state.lastcheck = sv.lastcheck;
+   state.checkleaf = sv.checkleaf ? sv.checkleaf - sv.worldmodel->leafs : -1;
+   state.num_edicts = sv.num_edicts;
+   for (i = 0; i < MAX_LIGHTSTYLES; i++)
+      state.lightstyles[i] = sv.lightstyles[i]
+         ? PR_SetString(sv.lightstyles[i]) : SAVESTATE_NOSTRING;
+   SaveState_Write(buf, &state, sizeof(state));
+
+   for (i = 0; i < svs.maxclients; i++)
+      SaveState_WriteClient(buf, &svs.clients[i]);
+   SaveState_Zero(buf, (svs.maxclientslimit - i) * CLIENT_RECORD_SIZE);
+
+   SaveState_Write(buf, pr_globals, progs->numglobals * sizeof(float));
+
+   for (i = 0; i < sv.num_edicts; i++)
+      SaveState_WriteEdict(buf, EDICT_NUM(i));
+   SaveState_Zero(buf, (MAX_EDICTS - i) * EDICT_RECORD_SIZE(pr_edict_size));
+}
+
+static qboolean SaveState_ReadServer(sizebuf_t *buf)
+{
+   savestate_server_t state;
+   edict_t *ed;
+   int i;
+
+   if (!SaveState_Read(buf, &state, sizeof(state)))
+      return false;
+   if (state.num_edicts < 1 || state.num_edicts > sv.max_edicts)
+      return false;
+   if (state.checkleaf >= sv.worldmodel->numleafs + 1)
+      return false;
+
+   sv.time = state.time;
+   sv.lastchecktime = state.lastchecktime;
+   sv.paused = state.paused;
+   sv.lastcheck = state.lastcheck;
+   sv.checkleaf = state.checkleaf >= 0
+      ? sv.worldmodel->leafs + state.checkleaf : NULL;
+   for (i = 0; i < MAX_LIGHTSTYLES; i++)
+      sv.lightstyles[i] = state.lightstyles[i] != SAVESTATE_NOSTRING
+         ? PR_GetString(state.lightstyles[i]) : NULL;
+
+   for (i = 0; i < svs.maxclients; i++)
+      if (!SaveState_ReadClient(buf, &svs.clients[i]))
+         return false;
+   if (!SaveState_Skip(buf, (svs.maxclientslimit - i) * CLIENT_RECORD_SIZE))
+      return false;
+
+   if (!SaveState_Read(buf, pr_globals, progs->numglobals * sizeof(float)))
+      return false;
+
+   /* Unlink everything before the edicts are overwritten */
+   for (i = 0; i < sv.num_edicts; i++)
+      SV_UnlinkEdict(EDICT_NUM(i));
+
+   sv.num_edicts = state.num_edicts;
+   for (i = 0; i < sv.num_edicts; i++)
+      SaveState_ReadEdict(buf, EDICT_NUM(i));
+   SaveState_Skip(buf, (MAX_EDICTS - i) * EDICT_RECORD_SIZE(pr_edict_size));
+   if (buf->overflowed)
+      return false;
+
+   for (i = 1; i < sv.num_edicts; i++)
+   {
+      ed = EDICT_NUM(i);
+      ed->num_leafs = 0;
+      if (!ed->free)
+         SV_LinkEdict(ed, false);
+   }
+   ED_ResetEdicts();
+
+   return true;
+}
+
+static void SaveState_WriteClientState(sizebuf_t *buf)
+{
+   savestate_player_t player;
+   const entity_t *ent;
+   const dlight_t *dl;
+   int i, num;
+
+   SaveState_Write(buf, &cl, sizeof(cl));
+
+   for (i = 0; i < cl.maxclients; i++)
+   {
+      memcpy(player.name, cl.players[i].name, sizeof(player.name));
+      player.entertime = cl.players[i].entertime;
+      player.frags = cl.players[i].frags;
+      player.topcolor = cl.players[i].topcolor;
+      player.bottomcolor = cl.players[i].bottomcolor;
+      SaveState_Write(buf, &player, sizeof(player));
+   }
+   SaveState_Zero(buf, (MAX_SCOREBOARD - i) * sizeof(player));
+
+   for (i = 0, ent = cl_entities; i < cl.num_entities; i++, ent++)
+   {
+      num = SaveState_ModelNum(ent->model);
+      SaveState_Write(buf, &num, sizeof(num));
+      if (!ent->colormap)
+         num = -2;
+      else if (ent->colormap == vid.colormap)
+         num = -1;
+      else
+      {
+         /* players in the same colours share one, any of them will do */
+         for (num = 0; num < cl.maxclients; num++)
+            if (ent->colormap == cl.players[num].translations)
+               break;
+         if (num == cl.maxclients)
+            num = -1;
+      }
+      SaveState_Write(buf, &num, sizeof(num));
+      SaveState_Write(buf, ent, sizeof(*ent));
+   }
+   SaveState_Zero(buf, (MAX_EDICTS - i) * ENTITY_RECORD_SIZE);
+
+   for (i = 0, dl = cl_dlights; i < MAX_DLIGHTS; i++, dl++)
+   {
+      num = dl->color ? (dl->color - dl_colors[0]) / 4 : -1;
+      SaveState_Write(buf, &num, sizeof(num));
+      SaveState_Write(buf, dl, sizeof(*dl));
+   }
+
+   SaveState_Write(buf, cl_lightstyle, sizeof(cl_lightstyle));
+   R_SaveParticles(buf);
+   S_SaveChannels(buf);
+}
+
+static qboolean SaveState_ReadClientState(sizebuf_t *buf)
+{
+   client_state_t *saved = &savestate_cl;
+   savestate_player_t player;
+   entity_t *ent;
+   struct efrag_s *efrag;
+   struct mnode_s *topnode;
+   dlight_t *dl;
+   int i, modelnum, colormap;
+
+   if (!SaveState_Read(buf, saved, sizeof(*saved)))
+      return false;
+   if (saved->maxclients != cl.maxclients)
+      return false;
+   if (saved->num_entities < 0 || saved->num_entities > MAX_EDICTS)
+      return false;
+
+   /* Precaches and others things fixed for the map are kept as they are */
+   memcpy(saved->model_precache, cl.model_precache, sizeof(cl.model_precache));
+   memcpy(saved->sound_precache, cl.sound_precache, sizeof(cl.sound_precache));
+   memcpy(saved->mapname, cl.mapname, sizeof(cl.mapname));
+   memcpy(saved->levelname, cl.levelname, sizeof(cl.levelname));
+   saved->viewentity = cl.viewentity;
+   saved->gametype = cl.gametype;
+   saved->worldmodel = cl.worldmodel;
+   saved->free_efrags = cl.free_efrags;
+   saved->num_statics = cl.num_statics;
+   saved->viewent = cl.viewent;
+   saved->cdtrack = cl.cdtrack;
+   saved->looptrack = cl.looptrack;
+   saved->players = cl.players;
+   saved->protocol = cl.protocol;
+   cl = *saved;
+
+   for (i = 0; i < cl.maxclients; i++)
+   {
+      if (!SaveState_Read(buf, &player, sizeof(player)))
+         return false;
+      memcpy(cl.players[i].name, player.name, sizeof(player.name));
+      cl.players[i].name[sizeof(player.name) - 1] = 0;
+      cl.players[i].entertime = player.entertime;
+      cl.players[i].frags = player.frags;
+      if (cl.players[i].topcolor != player.topcolor
+            || cl.players[i].bottomcolor != player.bottomcolor)
+      {
+         cl.players[i].topcolor = player.topcolor;
+         cl.players[i].bottomcolor = player.bottomcolor;
+         CL_NewTranslation(i);
+      }
+   }
+   if (!SaveState_Skip(buf, (MAX_SCOREBOARD - i) * sizeof(player)))
+      return false;
+
+   for (i = 0, ent = cl_entities; i < cl.num_entities; i++, ent++)
+   {
+      if (!SaveState_Read(buf, &modelnum, sizeof(modelnum)))
+         return false;
+      if (!SaveState_Read(buf, &colormap, sizeof(colormap)))
+         return false;
+      efrag = ent->efrag;
+      topnode = ent->topnode;
+      if (!SaveState_Read(buf, ent, sizeof(*ent)))
+         return false;
+      ent->efrag = efrag;
+      ent->topnode = topnode;
+      ent->model = (modelnum > 0 && modelnum < MAX_MODELS)
+         ? cl.model_precache[modelnum] : NULL;
+      if (colormap >= 0 && colormap < cl.maxclients)
+         ent->colormap = cl.players[colormap].translations;
+      else if (colormap == -1)
+         ent->colormap = vid.colormap;
+      else
+         ent->colormap = NULL;
+   }
+   if (!SaveState_Skip(buf, (MAX_EDICTS - i) * ENTITY_RECORD_SIZE))
+      return false;
+
+   for (i = 0, dl = cl_dlights; i < MAX_DLIGHTS; i++, dl++)
+   {
+      if (!SaveState_Read(buf, &colormap, sizeof(colormap)))
+         return false;
+      if (!SaveState_Read(buf, dl, sizeof(*dl)))
+         return false;
+      dl->color = (colormap >= 0 && colormap < 4) ? dl_colors[colormap] : NULL;
+   }
+
+   if (!SaveState_Read(buf, cl_lightstyle, sizeof(cl_lightstyle)))
+      return false;
+   if (!R_LoadParticles(buf))
+      return false;
+   if (!S_LoadChannels(buf))
+      return false;
+
+   /* Beams are resent by the server while they last */
+   CL_ClearTEnts();
+
+   return true;
+}
+
+/*
+ * Message buffers vary in size, so they go last where they can't shift the
+ * rest of the snapshot around.
+ */
+static void SaveState_WriteMessages(sizebuf_t *buf)
+{
+   int i;
+
+   SaveState_WriteSizebuf(buf, &sv.datagram);
+   SaveState_WriteSizebuf(buf, &sv.reliable_datagram);
+   SaveState_WriteSizebuf(buf, &sv.signon);
+   for (i = 0; i < svs.maxclients; i++)
+      SaveState_Write(buf, svs.clients[i].msgbuf,
+            svs.clients[i].message.cursize);
+}
+
+static qboolean SaveState_ReadMessages(sizebuf_t *buf)
+{
+   int i;
+
+   if (!SaveState_ReadSizebuf(buf, &sv.datagram))
+      return false;
+   if (!SaveState_ReadSizebuf(buf, &sv.reliable_datagram))
+      return false;
+   if (!SaveState_ReadSizebuf(buf, &sv.signon))
+      return false;
+   for (i = 0; i < svs.maxclients; i++)
+      if (!SaveState_Read(buf, svs.clients[i].msgbuf,
+               svs.clients[i].message.cursize))
+         return false;
+
+   return true;
+}
+
+/*
+==================
+SaveState_Save
+==================
+*/
+qboolean SaveState_Save(void *data, size_t size)
+{
+   savestate_header_t *header = (savestate_header_t *)data;
+   sizebuf_t buf;
+   int i;
+
+   if (!SaveState_CanSave() || size < SaveState_Size() || size > INT_MAX)
+      return false;
+
+   memset(&buf, 0, sizeof(buf));
+   buf.data = (byte *)data;
+   buf.maxsize = size;
+   buf.cursize = sizeof(*header);
+
+   SaveState_WriteServer(&buf);
+   SaveState_WriteClientState(&buf);
+   SaveState_WriteMessages(&buf);
+   if (buf.overflowed)
+      return false;
+
+   memset(header, 0, sizeof(*header));
+   header->magic = SAVESTATE_MAGIC;
+   header->version = SAVESTATE_VERSION;
+   header->length = buf.cursize;
+   header->edict_size = pr_edict_size;
+   header->numglobals = progs->numglobals;
+   header->maxclients = svs.maxclients;
+   for (i = 0; i < svs.maxclients; i++)
+      if (svs.clients[i].active)
+         header->activeclients |= 1 << i;
+   header->num_strings = PR_NumStrings();
+   snprintf(header->mapname, sizeof(header->mapname), "%s", sv.name);
+
+   /* Keep the padding stable for anyone diffing snapshots */
+   memset(buf.data + buf.cursize, 0, size - buf.cursize);
+
+   return true;
+}
+
+/*
+==================
+SaveState_Load
+
+Everything that would make the snapshot unusable is checked up front, so
+that a snapshot from another map or another mod is simply refused.
+==================
+*/
+qboolean SaveState_Load(const void *data, size_t size)
+{
+   savestate_header_t header;
+   sizebuf_t buf;
+   int i;
+
+   if (!SaveState_CanSave() || size < sizeof(header) || size > INT_MAX)
+      return false;
+
+   memcpy(&header, data, sizeof(header));
+   if (header.magic != SAVESTATE_MAGIC || header.version != SAVESTATE_VERSION)
+      return false;
+   if (header.length < (int)sizeof(header) || (size_t)header.length > size)
+      return false;
+   if (header.edict_size != pr_edict_size
+         || header.numglobals != progs->numglobals
+         || header.maxclients != svs.maxclients
+         || header.num_strings > PR_NumStrings())
+      return false;
+   header.mapname[sizeof(header.mapname) - 1] = 0;
+   if (strcmp(header.mapname, sv.name))
+      return false;
+   for (i = 0; i < svs.maxclients; i++)
+      if ((header.activeclients & (1 << i)) && !svs.clients[i].netconnection)
+         return false;
+
+   memset(&buf, 0, sizeof(buf));
+   buf.data = (byte *)data;
+   buf.maxsize = header.length;
+   buf.cursize = sizeof(header);
+
+   if (!SaveState_ReadServer(&buf) || !SaveState_ReadClientState(&buf)
+         || !SaveState_ReadMessages(&buf))
+   {
+      Con_Printf("%s: bad snapshot, restarting map\n", __func__);
+      Cbuf_AddText("restart\n");
+      return false;
+   }
+
+   return true;
+}
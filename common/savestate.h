@@ -0,0 +1,61 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stddef.h>
+
+#include "common.h"
+#include "qtypes.h"
+
+/* savestate.c -- binary snapshots of a running local game
+ *
+ * Unlike a savegame, a snapshot holds the engine state as it is in memory
+ * (edicts, QuakeC globals, client and sound state), so it can be taken and
+ * restored every frame. A snapshot can only be restored into the same map
+ * running the same progs, which is all rewind and run-ahead need.
+ */
+
+/*
+ * Upper bound on the size of a snapshot for the current game directory.
+ * Only depends on things fixed at startup, so it doesn't change when a new
+ * map is loaded.
+ */
+size_t SaveState_Size(void);
+
+qboolean SaveState_Save(void *data, size_t size);
+qboolean SaveState_Load(const void *data, size_t size);
+
+/*
+ * Snapshots are written through a sizebuf_t. When reading, cursize is the
+ * read position; a short read sets overflowed and returns false.
+ */
+void SaveState_Write(sizebuf_t *buf, const void *data, int length);
+qboolean SaveState_Read(sizebuf_t *buf, void *data, int length);
+
+/*
+ * Unused slots are zeroed when saving and skipped when loading, so that
+ * everything in the fixed part of a snapshot stays at the same offset.
+ */
+void SaveState_Zero(sizebuf_t *buf, int length);
+qboolean SaveState_Skip(sizebuf_t *buf, int length);
+
+#endif /* SAVESTATE_H */
@@ -856,7 +856,8 @@ Sbar_Draw(void)
     if (sb_updates >= vid.numpages)
 	return;
 
-    scr_copyeverything = 1;
+    SCR_CopyRows(vid.height - qmax(sb_lines, SBAR_HEIGHT),
+		 qmax(sb_lines, SBAR_HEIGHT));
 
     sb_updates++;
 
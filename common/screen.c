@@ -18,6 +18,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "client.h"
@@ -89,6 +90,11 @@ static qboolean scr_initialized;	/* ready to draw */
 int scr_copytop;
 int scr_copyeverything;
 
+// bands of rows drawn over this frame, updated along with the refresh window
+#define MAX_COPYROWS 4
+static vrect_t scr_copyrows[MAX_COPYROWS];
+static int scr_numcopyrows;
+
 float scr_con_current;
 static float scr_conlines;		/* lines of console to display */
 
@@ -107,8 +113,10 @@ static cvar_t scr_printspeed = { "scr_printspeed", "8" };
 cvar_t scr_viewsize = { "viewsize", "100", true };
 cvar_t scr_fov = { "fov", "90" };	// 10 - 170
 static cvar_t scr_conspeed = { "scr_conspeed", "300" };
+cvar_t scr_stillframes = { "scr_stillframes", "1" };	// reuse unchanged frames
 static vrect_t *pconupdate;
 qboolean scr_skipupdate;
+qboolean scr_skipdraw;		// frame won't be shown, so draw nothing
 
 static const qpic_t *scr_ram;
 static const qpic_t *scr_net;
@@ -281,7 +289,7 @@ SCR_EraseCenterString(void)
     /* Make sure we don't draw off the bottom of the screen*/
     height = qmin(8 * scr_erase_lines, ((int)vid.height) - y - 1);
 
-    scr_copytop = 1;
+    SCR_CopyRows(y, height);
     Draw_TileClear(0, y, vid.width, height);
 }
 
@@ -294,7 +302,6 @@ SCR_DrawCenterString(void)
     int x, y;
     int remaining;
 
-    scr_copytop = 1;
     if (scr_center_lines > scr_erase_lines)
 	scr_erase_lines = scr_center_lines;
 
@@ -318,6 +325,7 @@ SCR_DrawCenterString(void)
 	y = vid.height * 0.35;
     else
 	y = 48;
+    SCR_CopyRows(y, 8 * scr_center_lines);
 
     do {
 	// scan the width of the line
@@ -601,6 +609,88 @@ void SCR_EndLoadingPlaque(void)
 
 //=============================================================================
 
+/*
+==================
+SCR_CopyRows
+
+Adds the rows to the area VID_Update converts this frame, joined to a band
+already added if they touch
+==================
+*/
+void
+SCR_CopyRows(int y, int height)
+{
+   vrect_t *band;
+   int i, bottom;
+
+   bottom = qmin(y + height, (int)vid.height);
+   y = qmax(y, 0);
+   if (bottom <= y)
+      return;
+
+   for (i = 0; i < scr_numcopyrows; i++)
+   {
+      band = &scr_copyrows[i];
+      if (y <= band->y + band->height && bottom >= band->y)
+         break;
+   }
+   if (i == scr_numcopyrows)
+   {
+      if (scr_numcopyrows == MAX_COPYROWS)
+         i = MAX_COPYROWS - 1;
+      else
+      {
+         band = &scr_copyrows[scr_numcopyrows++];
+         band->x = 0;
+         band->y = y;
+         band->width = vid.width;
+         band->height = bottom - y;
+         return;
+      }
+   }
+
+   band = &scr_copyrows[i];
+   bottom = qmax(bottom, band->y + band->height);
+   band->y = qmin(y, band->y);
+   band->height = bottom - band->y;
+}
+
+/*
+ * With scr_stillframes, a frame that comes out just as the last one shown
+ * isn't handed over, and the frontend shows the last one again. Only frames
+ * whose 3D view was copied back or not drawn at all are compared, so normal
+ * play doesn't pay for keeping the copy.
+ */
+static byte *scr_lastframe;
+static int scr_lastsize;	// of the copy in scr_lastframe, 0 if none
+static qboolean scr_palettechanged;	// since the last frame shown
+
+static qboolean
+SCR_StillFrame(void)
+{
+   int size = vid.rowbytes * vid.height;
+
+   if (!scr_stillframes.value || r_viewdrawn || scr_palettechanged) {
+      scr_lastsize = 0;
+      return false;
+   }
+   if (size == scr_lastsize && !memcmp(scr_lastframe, vid.buffer, size))
+      return true;
+
+   if (size != scr_lastsize) {
+      free(scr_lastframe);
+      scr_lastframe = malloc(size);
+      if (!scr_lastframe) {
+	 scr_lastsize = 0;
+	 return false;
+      }
+   }
+   memcpy(scr_lastframe, vid.buffer, size);
+   scr_lastsize = size;
+
+   return false;
+}
+
 /*
 ==================
 SCR_UpdateScreen
@@ -617,6 +707,7 @@ SCR_UpdateScreen(void)
 {
    static float old_viewsize, old_fov;
    vrect_t vrect;
+   int i;
 
    if (scr_skipupdate)
       return;
@@ -650,8 +741,11 @@ SCR_UpdateScreen(void)
    if (!scr_initialized || !con_initialized)
       return;			// not initialized yet
 
+   VID_LockBuffer();
+
    scr_copytop = 0;
    scr_copyeverything = 0;
+   scr_numcopyrows = 0;
 
    /*
     * Check for vid setting changes
@@ -674,6 +768,24 @@ SCR_UpdateScreen(void)
    if (vid.recalc_refdef)
       SCR_CalcRefdef();
 
+   /*
+    * A frame nobody will see still moves the view, the console and the
+    * palette shifts along as drawing it would have.
+    */
+   if (scr_skipdraw) {
+      SCR_SetUpToDrawConsole();
+      V_UpdateView();
+      if (V_UpdatePalette())
+	 scr_palettechanged = true;
+      if (!scr_drawdialog
+#ifdef NQ_HACK
+	  && !scr_drawloading
+#endif
+	  && !(cl.intermission == 1 && key_dest == key_game))
+	 scr_centertime_off -= host_frametime;
+      return;
+   }
+
    /*
     * do 3D refresh drawing, and then update the screen
     */
@@ -688,6 +800,7 @@ SCR_UpdateScreen(void)
    SCR_SetUpToDrawConsole();
    SCR_EraseCenterString();
 
+   r_viewdrawn = false;
    V_RenderView();
 
    if (scr_drawdialog) {
@@ -720,7 +833,11 @@ SCR_UpdateScreen(void)
    if (pconupdate)
       D_UpdateRects(pconupdate);
 
-   V_UpdatePalette();
+   if (V_UpdatePalette())
+      scr_palettechanged = true;
+   if (SCR_StillFrame())
+      return;
+   scr_palettechanged = false;
 
    /*
     * update one of three areas
@@ -747,6 +864,14 @@ SCR_UpdateScreen(void)
       vrect.height = scr_vrect.height;
    }
    vrect.pnext = 0;
+   if (!scr_copyeverything)
+   {
+      for (i = 0; i < scr_numcopyrows; i++)
+      {
+         scr_copyrows[i].pnext = vrect.pnext;
+         vrect.pnext = &scr_copyrows[i];
+      }
+   }
    VID_Update(&vrect);
 }
 
@@ -765,6 +890,7 @@ SCR_Init(void)
     Cvar_RegisterVariable(&scr_conspeed);
     Cvar_RegisterVariable(&scr_centertime);
     Cvar_RegisterVariable(&scr_printspeed);
+    Cvar_RegisterVariable(&scr_stillframes);
 
     Cmd_AddCommand("sizeup", SCR_SizeUp_f);
     Cmd_AddCommand("sizedown", SCR_SizeDown_f);
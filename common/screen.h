@@ -41,13 +41,18 @@ extern int scr_fullupdate;	// set to 0 to force full redraw
 extern int clearnotify;		// set to 0 whenever notify text is drawn
 extern qboolean scr_disabled_for_loading;
 extern qboolean scr_skipupdate;
+extern qboolean scr_skipdraw;
 extern qboolean scr_block_drawing;
 extern cvar_t scr_viewsize;
 extern cvar_t scr_fov;
+extern cvar_t scr_stillframes;
 extern vrect_t scr_vrect;
 
 // only the refresh window will be updated unless these variables are flagged
 extern int scr_copytop;
 extern int scr_copyeverything;
 
+// or the rows drawn over are added
+void SCR_CopyRows(int y, int height);
+
 #endif /* SCREEN_H */
@@ -46,6 +46,8 @@ typedef struct {
     const char *model_precache[MAX_MODELS];	// NULL terminated
     struct model_s *models[MAX_MODELS];
     const char *sound_precache[MAX_SOUNDS];	// NULL terminated
+    precachehash_t model_hash;		// by name into model_precache
+    precachehash_t sound_hash;		// and sound_precache
     const char *lightstyles[MAX_LIGHTSTYLES];
     int num_edicts;
     int max_edicts;
@@ -63,7 +65,12 @@ typedef struct {
     sizebuf_t signon;
     byte signon_buf[MAX_MSGLEN];
 
+    sizebuf_t serverinfo;	// the start of SV_SendServerinfo, once a map
+    byte serverinfo_buf[MAX_MSGLEN];
+
     int protocol;		/* Active network protocol version */
+
+    mfatpvs_t *fatpvs;		/* for each client, by SV_WriteEntitiesToClient */
 } server_t;
 
 
@@ -185,6 +192,7 @@ extern cvar_t pausable;
 extern cvar_t sv_maxvelocity;
 extern cvar_t sv_gravity;
 extern cvar_t sv_nostep;
+extern cvar_t sv_skipidle;
 extern cvar_t sv_friction;
 extern cvar_t sv_edgefriction;
 extern cvar_t sv_stopspeed;
@@ -241,6 +249,18 @@ void SV_RunClients(void);
 void SV_SaveSpawnparms();
 
 void SV_SpawnServer(char *server);
+void SV_ConnectClient(int clientnum);
+
+/* Recording the clients' commands and replaying them (sv_bench.c) */
+void SV_BenchInit(void);
+void SV_CmdLogStart(void);
+void SV_CmdLogFrame(void);
+void SV_CmdLogConnect(int clientnum);
+void SV_CmdLogDrop(void);
+void SV_CmdLogMove(void);
+void SV_CmdLogCommand(const char *text);
+void SV_CmdLogThink(void);
+void SV_CmdLogPhysics(void);
 
 /*
  * Protocol dependent write of model index to buffer
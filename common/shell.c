@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -252,6 +253,39 @@ STree_Find(struct stree_root *root, const char *s)
     return ret;
 }
 
+static unsigned
+STree_Hash(const char *s)
+{
+    unsigned hash = 2166136261u;
+    unsigned char c;
+
+    while ((c = *s++))
+	hash = (hash ^ tolower(c)) * 16777619u;
+
+    return hash & (STREE_HASH_SIZE - 1);
+}
+
+void
+STree_HashInsert(struct stree_hash *hash, struct stree_node *node)
+{
+    struct stree_node **chain = &hash->chains[STree_Hash(node->string)];
+
+    node->hashnext = *chain;
+    *chain = node;
+}
+
+struct stree_node *
+STree_HashFind(const struct stree_hash *hash, const char *s)
+{
+    struct stree_node *node;
+
+    for (node = hash->chains[STree_Hash(s)]; node; node = node->hashnext)
+	if (!strcasecmp(s, node->string))
+	    return node;
+
+    return NULL;
+}
+
 /* An R-B Tree with n entries has a maximum height of 2log(n +1) */
 static int
 STree_MaxDepth(struct stree_root *root)
@@ -31,6 +31,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 struct stree_node {
     const char *string;
     struct rb_node node;
+    struct stree_node *hashnext; /* next in the same stree_hash chain */
 };
 
 /* stree_entry - Gets the stree_node ptr from the internal rb_node ptr */
@@ -65,6 +66,21 @@ struct stree_root {
 		NULL    \
 	}
 
+/*
+ * A chained hash index over the nodes of a tree, for exact lookups that
+ * don't walk the tree. Matching is case-insensitive, as with STree_Find.
+ * The nodes stay in their tree for ordered walks and completion.
+ */
+#define STREE_HASH_SIZE 256
+
+struct stree_hash {
+    struct stree_node *chains[STREE_HASH_SIZE];
+};
+
+void STree_HashInsert(struct stree_hash *hash, struct stree_node *node);
+struct stree_node *STree_HashFind(const struct stree_hash *hash,
+				  const char *s);
+
 void STree_AllocInit(void);
 qboolean STree_Insert(struct stree_root *root, struct stree_node *node);
 qboolean STree_InsertAlloc(struct stree_root *root, const char *s,
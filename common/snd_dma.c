@@ -29,6 +29,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "console.h"
 #include "input.h"
 #include "model.h"
+#include "namehash.h"
 #include "quakedef.h"
 #include "sound.h"
 #include "snd_codec.h"
@@ -37,6 +38,19 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #ifdef NQ_HACK
 #include "host.h"
+#include "savestate.h"
+#endif
+
+/*
+ * Channels are spatialized four at a time where SIMD is available, with
+ * the float operations in the same order as SND_Spatialize.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SPATIAL_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SPATIAL_NEON
 #endif
 
 /* FIXME - reorder to remove forward decls? */
@@ -50,6 +64,7 @@ static void S_StopAllSoundsC(void);
  */
 
 channel_t channels[MAX_CHANNELS];
+byte channel_virtual[MAX_CHANNELS];
 int total_channels;
 
 int snd_blocked = 0;
@@ -74,6 +89,9 @@ int paintedtime;		/* sample PAIRS */
 #define	MAX_SFX 512
 static sfx_t *known_sfx;	/* hunk allocated [MAX_SFX] */
 static int num_sfx;
+static int known_sfxchains[256];
+static int known_sfxnext[MAX_SFX];
+static namehash_t known_sfxhash = NAMEHASH_STATIC(known_sfxchains, known_sfxnext);
 
 int s_rawend;
 portable_samplepair_t	s_rawsamples[MAX_RAW_SAMPLES];
@@ -91,6 +109,15 @@ static cvar_t ambient_level = { "ambient_level", "0.3" };
 static cvar_t ambient_fade = { "ambient_fade", "100" };
 static cvar_t snd_noextraupdate = { "snd_noextraupdate", "0" };
 static cvar_t _snd_mixahead = { "_snd_mixahead", "0.1", true };
+static cvar_t snd_voices = { "snd_voices", "64", true };
+
+/* Last frame's voices, and the most seen since soundinfo last showed them */
+static struct {
+   int mixed;
+   int virtual;
+   int peakmixed;
+   int peakvirtual;
+} voicestats;
 
 /*
  * User-setable variables
@@ -116,6 +143,12 @@ static void S_SoundInfo_f(void)
    Con_Printf("%5d speed\n", shm->speed);
    Con_Printf("%p dma buffer\n", shm->buffer);
    Con_Printf("%5d total_channels\n", total_channels);
+   Con_Printf("%5d voices mixed (peak %d)\n", voicestats.mixed,
+         voicestats.peakmixed);
+   Con_Printf("%5d voices virtual (peak %d)\n", voicestats.virtual,
+         voicestats.peakvirtual);
+   voicestats.peakmixed = voicestats.mixed;
+   voicestats.peakvirtual = voicestats.virtual;
 }
 
 static void SND_Callback_sfxvolume (cvar_t *var)
@@ -178,6 +211,11 @@ S_Init(void)
     Cvar_RegisterVariable(&ambient_fade);
     Cvar_RegisterVariable(&snd_noextraupdate);
     Cvar_RegisterVariable(&_snd_mixahead);
+    Cvar_RegisterVariable(&snd_voices);
+    Cvar_RegisterVariable(&snd_resample);
+    Cvar_RegisterVariable(&snd_resamplecache);
+    Cvar_RegisterVariable(&snd_streamsize);
+    Cvar_RegisterVariable(&snd_compresssize);
 
     snd_initialized = true;
 
@@ -189,6 +227,7 @@ S_Init(void)
 
     known_sfx = (sfx_t*)Hunk_AllocName(MAX_SFX * sizeof(sfx_t), "sfx_t");
     num_sfx = 0;
+    NameHash_Clear(&known_sfxhash);
 
     /* create a piece of DMA memory */
     if (fakedma) {
@@ -236,6 +275,20 @@ S_Shutdown(void)
       SNDDMA_Shutdown();
 }
 
+/* The sfx of that name made before, or NULL */
+static sfx_t *
+S_FindKnown(const char *name)
+{
+    int i;
+
+    for (i = NameHash_First(&known_sfxhash, name); i >= 0;
+	 i = NameHash_Next(&known_sfxhash, i))
+	if (!strcmp(known_sfx[i].name, name))
+	    return &known_sfx[i];
+
+    return NULL;
+}
+
 /*
  * ==================
  * S_FindName
@@ -244,7 +297,6 @@ S_Shutdown(void)
 static sfx_t *
 S_FindName(const char *name)
 {
-    int i;
     sfx_t *sfx;
 
     if (!name)
@@ -253,15 +305,16 @@ S_FindName(const char *name)
 	Sys_Error("%s: name too long: %s", __func__, name);
 
     /* see if already loaded */
-    for (i = 0; i < num_sfx; i++)
-	if (!strcmp(known_sfx[i].name, name))
-	    return &known_sfx[i];
+    sfx = S_FindKnown(name);
+    if (sfx)
+	return sfx;
 
     if (num_sfx == MAX_SFX)
 	Sys_Error("%s: out of sfx_t", __func__);
 
-    sfx = &known_sfx[i];
+    sfx = &known_sfx[num_sfx];
     strcpy(sfx->name, name);
+    NameHash_Insert(&known_sfxhash, sfx->name, num_sfx);
 
     num_sfx++;
 
@@ -269,6 +322,27 @@ S_FindName(const char *name)
 }
 
 
+/*
+ * ==================
+ * S_SoundNeedsLoad
+ *
+ * True if S_PrecacheSound would have to read the sound in
+ * ==================
+ */
+qboolean
+S_SoundNeedsLoad(const char *name)
+{
+    sfx_t *sfx;
+
+    if (!sound_started || nosound.value || !precache.value)
+	return false;
+
+    sfx = S_FindKnown(name);
+
+    return !sfx || !Cache_Check(&sfx->cache);
+}
+
+
 /*
  * ==================
  * S_TouchSound
@@ -303,12 +377,19 @@ S_PrecacheSound(const char *name)
 
     /* cache it in */
     if (precache.value)
-	S_LoadSound(sfx);
+	S_QueueSound(sfx);
 
     return sfx;
 }
 
 
+/* How loud a channel was last spatialized, which the voices are ranked by */
+static inline int
+SND_Loudness(const channel_t *ch)
+{
+    return ch->leftvol > ch->rightvol ? ch->leftvol : ch->rightvol;
+}
+
 /*
  * =================
  * SND_PickChannel
@@ -318,12 +399,17 @@ static channel_t *
 SND_PickChannel(int entnum, int entchannel)
 {
     int i;
-    int life_left;
+    int life_left, loudness, quietest;
     channel_t *channel;
     channel_t *first_to_die = NULL;
+    channel_t *quietest_playing = NULL;
 
-    /* Check for replacement sound, or find the best one to replace */
+    /*
+     * Check for replacement sound, or find the best one to replace: one
+     * that's finished, or else the quietest of those still playing
+     */
     life_left = 0x7fffffff;
+    quietest = 0x7fffffff;
     for (i = NUM_AMBIENTS; i < NUM_AMBIENTS + MAX_DYNAMIC_CHANNELS; i++) {
 	channel = &channels[i];
 	/*
@@ -346,17 +432,40 @@ SND_PickChannel(int entnum, int entchannel)
 	    && entnum != cl.playernum + 1 && channel->sfx)
 	    continue;
 #endif
+	if (channel->sfx && channel->end > paintedtime) {
+	    loudness = SND_Loudness(channel);
+	    if (loudness < quietest || (loudness == quietest
+			&& channel->end < quietest_playing->end)) {
+		quietest = loudness;
+		quietest_playing = channel;
+	    }
+	    continue;
+	}
 	if (channel->end - paintedtime < life_left) {
 	    life_left = channel->end - paintedtime;
 	    first_to_die = channel;
 	}
     }
+    if (!first_to_die)
+	first_to_die = quietest_playing;
     if (first_to_die && first_to_die->sfx)
 	first_to_die->sfx = NULL;
 
     return first_to_die;
 }
 
+/* anything coming from the view entity will allways be full volume */
+static inline qboolean
+SND_FromViewEntity(const channel_t *ch)
+{
+#ifdef NQ_HACK
+    return ch->entnum == cl.viewentity;
+#endif
+#ifdef QW_HACK
+    return ch->entnum == cl.playernum + 1;
+#endif
+}
+
 /*
  * =================
  * SND_Spatialize
@@ -370,42 +479,176 @@ SND_Spatialize(channel_t *ch)
     vec_t lscale, rscale, scale;
     vec3_t source_vec;
 
-    /* anything coming from the view entity will allways be full volume */
-#ifdef NQ_HACK
-    if (ch->entnum == cl.viewentity) {
+    if (SND_FromViewEntity(ch)) {
 	ch->leftvol = ch->master_vol;
 	ch->rightvol = ch->master_vol;
 	return;
     }
-#endif
-#ifdef QW_HACK
-    if (ch->entnum == cl.playernum + 1) {
-	ch->leftvol = ch->master_vol;
-	ch->rightvol = ch->master_vol;
-	return;
-    }
-#endif
 
     /* calculate stereo seperation and distance attenuation */
     VectorSubtract(ch->origin, listener_origin, source_vec);
     dist = VectorNormalize(source_vec) * ch->dist_mult;
 
     dot = DotProduct(listener_right, source_vec);
-    rscale = 1.0 + dot;
-    lscale = 1.0 - dot;
+    rscale = 1.0f + dot;
+    lscale = 1.0f - dot;
 
     /* add in distance effect */
-    scale = (1.0 - dist) * rscale;
+    scale = (1.0f - dist) * rscale;
     ch->rightvol = (int)(ch->master_vol * scale);
     if (ch->rightvol < 0)
 	ch->rightvol = 0;
 
-    scale = (1.0 - dist) * lscale;
+    scale = (1.0f - dist) * lscale;
     ch->leftvol = (int)(ch->master_vol * scale);
     if (ch->leftvol < 0)
 	ch->leftvol = 0;
 }
 
+#if defined(SPATIAL_SSE2) || defined(SPATIAL_NEON)
+/*
+ * The playing channels not from the view entity, gathered for
+ * SND_SpatializeChannels.
+ */
+static struct {
+    channel_t *channel[MAX_CHANNELS];
+    float x[MAX_CHANNELS];
+    float y[MAX_CHANNELS];
+    float z[MAX_CHANNELS];
+    float dist_mult[MAX_CHANNELS];
+    float master_vol[MAX_CHANNELS];
+    int leftvol[MAX_CHANNELS];
+    int rightvol[MAX_CHANNELS];
+} spatial;
+
+#ifdef SPATIAL_SSE2
+static inline __m128i
+SND_Volume4(__m128 master_vol, __m128 scale)
+{
+    __m128i vol = _mm_cvttps_epi32(_mm_mul_ps(master_vol, scale));
+
+    /* negatives to zero */
+    return _mm_andnot_si128(_mm_srai_epi32(vol, 31), vol);
+}
+
+static void
+SND_Spatialize4(int i)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 x = _mm_loadu_ps(&spatial.x[i]);
+    __m128 y = _mm_loadu_ps(&spatial.y[i]);
+    __m128 z = _mm_loadu_ps(&spatial.z[i]);
+    __m128 master_vol = _mm_loadu_ps(&spatial.master_vol[i]);
+    __m128 length, ilength, nonzero, dist, dot, distscale;
+
+    /* VectorNormalize */
+    length = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+			_mm_mul_ps(z, z));
+    length = _mm_sqrt_ps(length);
+    nonzero = _mm_cmpneq_ps(length, _mm_setzero_ps());
+    ilength = _mm_and_ps(nonzero, _mm_div_ps(one, length));
+    ilength = _mm_or_ps(ilength, _mm_andnot_ps(nonzero, one));
+    x = _mm_mul_ps(x, ilength);
+    y = _mm_mul_ps(y, ilength);
+    z = _mm_mul_ps(z, ilength);
+    dist = _mm_mul_ps(length, _mm_loadu_ps(&spatial.dist_mult[i]));
+
+    dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(listener_right[0]), x),
+				_mm_mul_ps(_mm_set1_ps(listener_right[1]), y)),
+		     _mm_mul_ps(_mm_set1_ps(listener_right[2]), z));
+    distscale = _mm_sub_ps(one, dist);
+
+    _mm_storeu_si128((__m128i *)&spatial.rightvol[i],
+		     SND_Volume4(master_vol, _mm_mul_ps(distscale, _mm_add_ps(one, dot))));
+    _mm_storeu_si128((__m128i *)&spatial.leftvol[i],
+		     SND_Volume4(master_vol, _mm_mul_ps(distscale, _mm_sub_ps(one, dot))));
+}
+#else
+static inline int32x4_t
+SND_Volume4(float32x4_t master_vol, float32x4_t scale)
+{
+    return vmaxq_s32(vcvtq_s32_f32(vmulq_f32(master_vol, scale)), vdupq_n_s32(0));
+}
+
+static void
+SND_Spatialize4(int i)
+{
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    float32x4_t x = vld1q_f32(&spatial.x[i]);
+    float32x4_t y = vld1q_f32(&spatial.y[i]);
+    float32x4_t z = vld1q_f32(&spatial.z[i]);
+    float32x4_t master_vol = vld1q_f32(&spatial.master_vol[i]);
+    float32x4_t length, ilength, dist, dot, distscale;
+    uint32x4_t nonzero;
+
+    /* VectorNormalize; no fused multiply-adds, to match the scalar code */
+    length = vaddq_f32(vaddq_f32(vmulq_f32(x, x), vmulq_f32(y, y)),
+		       vmulq_f32(z, z));
+    length = vsqrtq_f32(length);
+    nonzero = vmvnq_u32(vceqq_f32(length, vdupq_n_f32(0)));
+    ilength = vbslq_f32(nonzero, vdivq_f32(one, length), one);
+    x = vmulq_f32(x, ilength);
+    y = vmulq_f32(y, ilength);
+    z = vmulq_f32(z, ilength);
+    dist = vmulq_f32(length, vld1q_f32(&spatial.dist_mult[i]));
+
+    dot = vaddq_f32(vaddq_f32(vmulq_n_f32(x, listener_right[0]),
+			      vmulq_n_f32(y, listener_right[1])),
+		    vmulq_n_f32(z, listener_right[2]));
+    distscale = vsubq_f32(one, dist);
+
+    vst1q_s32(&spatial.rightvol[i],
+	      SND_Volume4(master_vol, vmulq_f32(distscale, vaddq_f32(one, dot))));
+    vst1q_s32(&spatial.leftvol[i],
+	      SND_Volume4(master_vol, vmulq_f32(distscale, vsubq_f32(one, dot))));
+}
+#endif
+#endif /* SPATIAL_SSE2 || SPATIAL_NEON */
+
+/*
+ * Respatializes the playing channels in [start, end)
+ */
+static void
+SND_SpatializeChannels(int start, int end)
+{
+    channel_t *ch;
+    int i;
+#if defined(SPATIAL_SSE2) || defined(SPATIAL_NEON)
+    int count = 0;
+
+    for (i = start, ch = channels + start; i < end; i++, ch++) {
+	if (!ch->sfx)
+	    continue;
+	if (SND_FromViewEntity(ch)) {
+	    ch->leftvol = ch->master_vol;
+	    ch->rightvol = ch->master_vol;
+	    continue;
+	}
+	spatial.channel[count] = ch;
+	spatial.x[count] = ch->origin[0] - listener_origin[0];
+	spatial.y[count] = ch->origin[1] - listener_origin[1];
+	spatial.z[count] = ch->origin[2] - listener_origin[2];
+	spatial.dist_mult[count] = ch->dist_mult;
+	spatial.master_vol[count] = ch->master_vol;
+	count++;
+    }
+
+    for (i = 0; i + 4 <= count; i += 4)
+	SND_Spatialize4(i);
+    for (; i < count; i++)
+	SND_Spatialize(spatial.channel[i]);
+
+    for (i = count & ~3; i-- > 0;) {
+	spatial.channel[i]->leftvol = spatial.leftvol[i];
+	spatial.channel[i]->rightvol = spatial.rightvol[i];
+    }
+#else
+    for (i = start, ch = channels + start; i < end; i++, ch++)
+	if (ch->sfx)
+	    SND_Spatialize(ch);
+#endif
+}
+
 
 void
 S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin,
@@ -433,6 +676,7 @@ S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin,
 
     /* spatialize */
     memset(target_chan, 0, sizeof(*target_chan));
+    channel_virtual[target_chan - channels] = 0;
     VectorCopy(origin, target_chan->origin);
     target_chan->dist_mult = attenuation / sound_nominal_clip_dist;
     target_chan->master_vol = vol;
@@ -505,6 +749,8 @@ S_StopAllSounds(qboolean clear)
 	    channels[i].sfx = NULL;
 
     memset(channels, 0, MAX_CHANNELS * sizeof(channel_t));
+    memset(channel_virtual, 0, sizeof(channel_virtual));
+    S_CloseStreams();
     if (clear)
 	S_ClearBuffer();
 }
@@ -523,6 +769,67 @@ void S_ClearBuffer(void)
    memset(shm->buffer, 0, shm->samples * shm->samplebits / 8);
 }
 
+#ifdef NQ_HACK
+/*
+===================
+S_SaveChannels
+
+Sfx are saved as indices into known_sfx and end times relative to
+paintedtime, so channels pick up where they were without disturbing the
+mixer's own idea of time.
+===================
+*/
+int
+S_ChannelStateSize(void)
+{
+    return 2 * sizeof(int) + MAX_CHANNELS * (sizeof(int) + sizeof(channel_t));
+}
+
+void
+S_SaveChannels(sizebuf_t *buf)
+{
+    int i, sfxnum;
+
+    SaveState_Write(buf, &total_channels, sizeof(total_channels));
+    SaveState_Write(buf, &paintedtime, sizeof(paintedtime));
+    for (i = 0; i < MAX_CHANNELS; i++) {
+	sfxnum = channels[i].sfx ? channels[i].sfx - known_sfx : -1;
+	SaveState_Write(buf, &sfxnum, sizeof(sfxnum));
+	SaveState_Write(buf, &channels[i], sizeof(channel_t));
+    }
+}
+
+qboolean
+S_LoadChannels(sizebuf_t *buf)
+{
+    int i, sfxnum, savedtime, numchannels;
+    channel_t *ch;
+
+    if (!SaveState_Read(buf, &numchannels, sizeof(numchannels)))
+	return false;
+    if (!SaveState_Read(buf, &savedtime, sizeof(savedtime)))
+	return false;
+    if (numchannels < 0 || numchannels > MAX_CHANNELS)
+	return false;
+
+    total_channels = numchannels;
+    for (i = 0, ch = channels; i < MAX_CHANNELS; i++, ch++) {
+	if (!SaveState_Read(buf, &sfxnum, sizeof(sfxnum)))
+	    return false;
+	if (!SaveState_Read(buf, ch, sizeof(*ch)))
+	    return false;
+	if (sfxnum >= 0 && sfxnum < num_sfx) {
+	    ch->sfx = &known_sfx[sfxnum];
+	    ch->end += paintedtime - savedtime;
+	} else {
+	    ch->sfx = NULL;
+	}
+    }
+
+    return true;
+}
+#endif
+
 /*
 ===================
 S_RawSamples		(from QuakeII)
@@ -628,6 +935,7 @@ S_StaticSound(sfx_t *sfx, vec3_t origin, float vol, float attenuation)
     }
 
     ss = &channels[total_channels];
+    channel_virtual[total_channels] = 0;
     total_channels++;
 
     sc = S_LoadSound(sfx);
@@ -657,6 +965,7 @@ S_StaticSound(sfx_t *sfx, vec3_t origin, float vol, float attenuation)
 static void
 S_UpdateAmbientSounds(void)
 {
+   static mleafhint_t leafhint;
    mleaf_t *leaf;
    int ambient_channel;
 
@@ -667,7 +976,7 @@ S_UpdateAmbientSounds(void)
    if (!cl.worldmodel)
       return;
 
-   leaf = Mod_PointInLeaf(cl.worldmodel, listener_origin);
+   leaf = Mod_PointInLeafHint(cl.worldmodel, listener_origin, &leafhint);
 
    if (!leaf || !ambient_level.value)
    {
@@ -741,6 +1050,10 @@ static void S_Update_(void)
    if (!sound_started || (snd_blocked > 0))
       return;
 
+   /* the driver asks for the mix itself */
+   if (shm->direct)
+      return;
+
    /* Updates DMA time */
    GetSoundtime();
 
@@ -750,6 +1063,9 @@ static void S_Update_(void)
       //Con_DPrintf("%s: overflow\n", __func__);
       paintedtime = soundtime;
    }
+   /* or run on ahead, after the driver was taking the mix directly */
+   if (paintedtime - soundtime > (shm->samples >> 1))
+      paintedtime = soundtime;
    /* mix ahead of current position */
    endtime = soundtime + _snd_mixahead.value * shm->speed;
    samps = shm->samples >> 1;
@@ -760,6 +1076,38 @@ static void S_Update_(void)
    SNDDMA_Submit();
 }
 
+/*
+ * ============
+ * S_PaintDirect
+ *
+ * For drivers that take the mix a frame at a time: paints the next 'frames'
+ * stereo pairs straight into 'buffer', with no mixahead. With no buffer the
+ * channels are only moved on as far, for frames whose sound isn't wanted.
+ * ============
+ */
+void S_PaintDirect(short *buffer, int frames)
+{
+   if (!sound_started || (snd_blocked > 0))
+   {
+      if (buffer)
+         memset(buffer, 0, frames * 2 * sizeof(short));
+      return;
+   }
+
+   /* time to chop things off to avoid 32 bit limits */
+   if (paintedtime > 0x40000000)
+   {
+      paintedtime = 0;
+      s_rawend = 0;
+      S_StopAllSounds(false);
+   }
+
+   if (buffer)
+      S_PaintChannelsLinear(buffer, paintedtime + frames);
+   else
+      S_SkipChannels(paintedtime + frames);
+}
+
 /*
  * ============
  * S_Update
@@ -767,9 +1115,85 @@ static void S_Update_(void)
  * Called once each time through the main loop
  * ============
  */
+/*
+ * Only the snd_voices loudest channels are mixed, and the rest go virtual:
+ * the mixer moves them on without painting them, so they carry on where
+ * they should be if they get loud enough again. The ambients always play.
+ * Channels are ranked by loudness with a histogram, and the ones as loud
+ * as the quietest that gets in are let in in channel order.
+ */
+static void S_UpdateVoices(void)
+{
+   int histogram[256];
+   int i, loudness, limit, audible, kept, room, threshold;
+   channel_t *ch;
+
+   memset(channel_virtual, 0, total_channels);
+   memset(histogram, 0, sizeof(histogram));
+
+   audible = 0;
+   ch = channels + NUM_AMBIENTS;
+   for (i = NUM_AMBIENTS; i < total_channels; i++, ch++)
+   {
+      if (!ch->sfx || (!ch->leftvol && !ch->rightvol))
+         continue;
+      loudness = SND_Loudness(ch);
+      histogram[loudness > 255 ? 255 : loudness]++;
+      audible++;
+   }
+
+   limit = (int)snd_voices.value;
+   if (limit <= 0 || audible <= limit)
+   {
+      voicestats.mixed = audible;
+      voicestats.virtual = 0;
+   }
+   else
+   {
+      kept = 0;
+      for (threshold = 255; threshold > 0; threshold--)
+      {
+         if (kept + histogram[threshold] >= limit)
+            break;
+         kept += histogram[threshold];
+      }
+      room = limit - kept;
+
+      ch = channels + NUM_AMBIENTS;
+      for (i = NUM_AMBIENTS; i < total_channels; i++, ch++)
+      {
+         if (!ch->sfx || (!ch->leftvol && !ch->rightvol))
+            continue;
+         loudness = SND_Loudness(ch);
+         if (loudness > 255)
+            loudness = 255;
+         if (loudness > threshold)
+            continue;
+         if (loudness == threshold && room > 0)
+         {
+            room--;
+            continue;
+         }
+         channel_virtual[i] = 1;
+      }
+
+      voicestats.mixed = limit;
+      voicestats.virtual = audible - limit;
+   }
+
+   if (voicestats.mixed > voicestats.peakmixed)
+      voicestats.peakmixed = voicestats.mixed;
+   if (voicestats.virtual > voicestats.peakvirtual)
+      voicestats.peakvirtual = voicestats.virtual;
+}
+
 void S_Update(vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 {
-   int i, j;
+   /* the first static channel playing each sfx this frame */
+   static int combine_stamp[MAX_SFX];
+   static short combine_target[MAX_SFX];
+   static int combine_frame;
+   int i, sfxnum;
    channel_t *ch;
    channel_t *combine;
 
@@ -784,49 +1208,36 @@ void S_Update(vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
    /* update general area ambient sound sources */
    S_UpdateAmbientSounds();
 
-   combine = NULL;
-
    /* update spatialization for static and dynamic sounds */
-   ch = channels + NUM_AMBIENTS;
-   for (i = NUM_AMBIENTS; i < total_channels; i++, ch++) {
+   SND_SpatializeChannels(NUM_AMBIENTS, total_channels);
+
+   /*
+    * try to combine static sounds with the first channel of the same sound
+    * effect so we don't mix five torches every frame
+    */
+   combine_frame++;
+   ch = channels + MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;
+   for (i = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS; i < total_channels; i++, ch++) {
       if (!ch->sfx)
          continue;
-      SND_Spatialize(ch);	/* respatialize channel */
-      if (!ch->leftvol && !ch->rightvol)
+      sfxnum = ch->sfx - known_sfx;
+      if (sfxnum < 0 || sfxnum >= num_sfx)
+         continue;
+      if (combine_stamp[sfxnum] != combine_frame) {
+         combine_stamp[sfxnum] = combine_frame;
+         combine_target[sfxnum] = i;
          continue;
-
-      /*
-       * try to combine static sounds with a previous channel of the same
-       * sound effect so we don't mix five torches every frame
-       */
-      if (i >= MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS) {
-         /* see if it can just use the last one */
-         if (combine && combine->sfx == ch->sfx) {
-            combine->leftvol += ch->leftvol;
-            combine->rightvol += ch->rightvol;
-            ch->leftvol = ch->rightvol = 0;
-            continue;
-         }
-         /* search for one */
-         combine = channels + MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;
-         for (j = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS; j < i;
-               j++, combine++)
-            if (combine->sfx == ch->sfx)
-               break;
-
-         if (j == total_channels) {
-            combine = NULL;
-         } else {
-            if (combine != ch) {
-               combine->leftvol += ch->leftvol;
-               combine->rightvol += ch->rightvol;
-               ch->leftvol = ch->rightvol = 0;
-            }
-            continue;
-         }
       }
+      if (!ch->leftvol && !ch->rightvol)
+         continue;
+      combine = &channels[combine_target[sfxnum]];
+      combine->leftvol += ch->leftvol;
+      combine->rightvol += ch->rightvol;
+      ch->leftvol = ch->rightvol = 0;
    }
 
+   S_UpdateVoices();
+
    /* mix some sound */
    S_Update_();
 }
@@ -900,13 +1311,21 @@ static void S_SoundList(void)
       sfxcache_t *sc = (sfxcache_t*)Cache_Check(&sfx->cache);
       if (!sc)
          continue;
-      size = sc->length * sc->width * (sc->stereo + 1);
+      if (sc->streamrate)
+         size = 0;
+      else if (sc->adpcm)
+         size = SND_ADPCMSize(sc->length);
+      else
+         size = sc->length * sc->width * (sc->stereo + 1);
       total += size;
-      if (sc->loopstart >= 0)
+      if (sc->streamrate)
+         Con_Printf("S");
+      else if (sc->loopstart >= 0)
          Con_Printf("L");
       else
          Con_Printf(" ");
-      Con_Printf("(%2db) %6i : %s\n", sc->width * 8, size, sfx->name);
+      Con_Printf("(%2db) %6i : %s\n", sc->adpcm ? 4 : sc->width * 8, size,
+            sfx->name);
    }
    Con_Printf("Total resident: %i\n", total);
 }
@@ -934,11 +1353,3 @@ void S_LocalSound(const char *sound)
 #endif
 }
 
-void S_BeginPrecaching(void)
-{
-}
-
-
-void S_EndPrecaching(void)
-{
-}
@@ -19,96 +19,605 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // snd_mem.c: sound caching
 
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "common.h"
 #include "console.h"
+#include "crc.h"
+#include "cvar.h"
+#include "jobs.h"
 #include "quakedef.h"
+#include "snd_codec.h"
 #include "sound.h"
 #include "sys.h"
 
+/* 0 = nearest, 1 = linear, 2 = windowed sinc */
+cvar_t snd_resample = { "snd_resample", "2", true };
+cvar_t snd_resamplecache = { "snd_resamplecache", "1", true };
+/* sounds bigger than this once resampled are streamed from their files */
+cvar_t snd_streamsize = { "snd_streamsize", "1048576", true };
+/* resident sounds bigger than this once resampled are kept ADPCM compressed */
+cvar_t snd_compresssize = { "snd_compresssize", "131072", true };
+
+/*
+ * Windowed sinc resampling. The kernel is tabulated for SINC_PHASES
+ * positions between input samples and the nearest phase used; each output
+ * sample takes SINC_TAPS input samples around it. Sounds are resampled on
+ * the job threads while precaching, so each has its own.
+ */
+#define SINC_TAPS	16
+#define SINC_PHASES	256
+
+static void SND_WriteCachedSound(sfx_t *sfx, const sfxcache_t *sc,
+				 const void *samples, int width, int filesize,
+				 int crc);
+
+static THREAD_LOCAL float sinc_kernel[SINC_PHASES][SINC_TAPS];
+static THREAD_LOCAL float sinc_cutoff;
+
+/* The key in the resampled sound cache of the sound being loaded */
+static int soundcache_filesize;
+static int soundcache_crc;
+
+/* Counts the precaches, so kept sounds are checked once for each map */
+static int snd_precacheseq;
+
+/*
+ * A Blackman windowed sinc, cut off below the lower of the two Nyquist
+ * frequencies. Each phase is normalised to unity gain.
+ */
+static void
+SND_InitSincKernel(float cutoff)
+{
+   int phase, tap;
+   double x, w, sum;
+
+   for (phase = 0; phase < SINC_PHASES; phase++)
+   {
+      sum = 0;
+      for (tap = 0; tap < SINC_TAPS; tap++)
+      {
+         x = tap - (SINC_TAPS / 2 - 1) - (double)phase / SINC_PHASES;
+         w = 0.42 + 0.5 * cos(M_PI * x / (SINC_TAPS / 2))
+            + 0.08 * cos(2 * M_PI * x / (SINC_TAPS / 2));
+         if (x == 0)
+            sinc_kernel[phase][tap] = cutoff;
+         else
+            sinc_kernel[phase][tap] = sin(M_PI * cutoff * x) / (M_PI * x) * w;
+         sum += sinc_kernel[phase][tap];
+      }
+      for (tap = 0; tap < SINC_TAPS; tap++)
+         sinc_kernel[phase][tap] /= sum;
+   }
+   sinc_cutoff = cutoff;
+}
+
+/* One input sample, scaled to 16 bits; silence outside the sound */
+static int
+SND_GetSample(const byte *data, int inwidth, int count, int i)
+{
+   if (i < 0 || i >= count)
+      return 0;
+   if (inwidth == 2)
+      return LittleShort(((const short *)data)[i]);
+   return (int)((unsigned char)(data[i]) - 128) << 8;
+}
+
 /*
 ================
-ResampleSfx
+SND_Resample
+
+Converts the mono samples to outcount samples at outrate, of the same
+width. Touches only the output and the kernel, so any thread may run it.
 ================
 */
 static void
-ResampleSfx(sfx_t *sfx, int inrate, int inwidth, const byte *data)
+SND_Resample(const byte *data, int inrate, int width, int incount,
+	     void *out, int outrate, int outcount, int quality)
 {
-   int outcount;
    int srcsample;
    float stepscale;
-   int i;
+   int i, tap;
    int sample, samplefrac, fracstep;
-   sfxcache_t *sc;
-
-   sc = (sfxcache_t*)Cache_Check(&sfx->cache);
-   if (!sc)
-      return;
+   int phase;
+   double pos, frac, sum;
+   const float *kernel;
 
-   stepscale = (float)inrate / shm->speed;	// this is usually 0.5, 1, or 2
-
-   outcount = sc->length / stepscale;
-   sc->length = outcount;
-   if (sc->loopstart != -1)
-      sc->loopstart = sc->loopstart / stepscale;
-
-   sc->speed = shm->speed;
-   sc->width = inwidth;
-   sc->stereo = 1;
+   stepscale = (float)inrate / outrate;	// this is usually 0.5, 1, or 2
 
    // resample / decimate to the current source rate
 
-   if (stepscale == 1/* && inwidth == 1*/ && sc->width == 1)
+   if (stepscale == 1 && width == 1)
    {
       // fast special case
       for (i = 0; i < outcount; i++)
-         ((signed char *)sc->data)[i]
-         = (int)((unsigned char)(data[i]) - 128);
+         ((signed char *)out)[i] = (int)((unsigned char)(data[i]) - 128);
+      return;
    }
-   else if (stepscale == 1/* && inwidth == 2*/ && sc->width == 2) // LordHavoc: quick case for 16bit
-	{
-		if (sc->stereo) // LordHavoc: stereo sound support
-			for (i=0 ; i<outcount*2 ;i++)
-				((short *)sc->data)[i] = LittleShort (((short *)data)[i]);
-		else
-			for (i=0 ; i<outcount ;i++)
-				((short *)sc->data)[i] = LittleShort (((short *)data)[i]);
-	}
-   else
+   else if (stepscale == 1 && width == 2) // LordHavoc: quick case for 16bit
    {
-      // general case
-      samplefrac = 0;
-      fracstep = stepscale * 256;
-      for (i = 0; i < outcount; i++)
+      COM_LittleShorts((short *)out, (const short *)data, outcount);
+      return;
+   }
+
+   if (quality >= 2)
+   {
+      float cutoff = stepscale > 1 ? 1 / stepscale : 1;
+
+      if (cutoff != sinc_cutoff)
+         SND_InitSincKernel(cutoff);
+   }
+
+   samplefrac = 0;
+   fracstep = stepscale * 256;
+   for (i = 0; i < outcount; i++)
+   {
+      if (quality <= 0)
       {
+         // nearest sample, as Quake always did
          srcsample = samplefrac >> 8;
          samplefrac += fracstep;
-         if (inwidth == 2)
+         sample = SND_GetSample(data, width, incount, srcsample);
+      }
+      else
+      {
+         pos = (double)i * inrate / outrate;
+         srcsample = (int)pos;
+         frac = pos - srcsample;
+         if (quality == 1)
          {
-#ifdef MSB_FIRST
-            sample = LittleShort(((const short *)data)[srcsample]);
-#else
-            sample = (((const short *)data)[srcsample]);
-#endif
+            sample = SND_GetSample(data, width, incount, srcsample);
+            if (srcsample + 1 < incount)
+               sample += (SND_GetSample(data, width, incount, srcsample + 1) - sample) * frac;
          }
          else
-            sample = (int)((unsigned char)(data[srcsample]) - 128) << 8;
-         if (sc->width == 2)
-            ((short *)sc->data)[i] = sample;
-         else
-            ((signed char *)sc->data)[i] = sample >> 8;
+         {
+            phase = (int)(frac * SINC_PHASES + 0.5);
+            if (phase == SINC_PHASES)
+            {
+               srcsample++;
+               phase = 0;
+            }
+            kernel = sinc_kernel[phase];
+            srcsample -= SINC_TAPS / 2 - 1;
+            sum = 0;
+            for (tap = 0; tap < SINC_TAPS; tap++)
+               sum += SND_GetSample(data, width, incount, srcsample + tap) * kernel[tap];
+            sample = (int)floor(sum + 0.5);
+            if (sample > 32767)
+               sample = 32767;
+            else if (sample < -32768)
+               sample = -32768;
+         }
       }
+      if (width == 2)
+         ((short *)out)[i] = sample;
+      else
+         ((signed char *)out)[i] = sample >> 8;
    }
 }
 
+/*
+ * Encodes the samples as IMA ADPCM blocks. The encoder's state carries on
+ * from one block to the next, and each block starts with it.
+ */
+static void
+SND_EncodeADPCM(const void *samples, int width, int length, byte *out)
+{
+   int pred, index, sample, diff, step, delta, nibble;
+   int i, j;
+   byte *nibbles = NULL;
+
+   pred = 0;
+   if (length)
+      pred = width == 2 ? ((const short *)samples)[0]
+         : ((const signed char *)samples)[0] * 256;
+   index = 0;
+   for (i = 0; i < length; i++)
+   {
+      j = i % SND_ADPCM_BLOCK;
+      if (!j)
+      {
+         out[0] = pred & 255;
+         out[1] = (pred >> 8) & 255;
+         out[2] = index;
+         out[3] = 0;
+         nibbles = out + 4;
+         memset(nibbles, 0, SND_ADPCM_BLOCK / 2);
+         out += SND_ADPCM_BLOCKSIZE;
+      }
+
+      if (width == 2)
+         sample = ((const short *)samples)[i];
+      else
+         sample = ((const signed char *)samples)[i] * 256;
+
+      // the decoder's delta is step / 8 plus any of step, step / 2, step / 4
+      step = snd_adpcmstep[index];
+      diff = sample - pred;
+      nibble = 0;
+      if (diff < 0)
+      {
+         nibble = 8;
+         diff = -diff;
+      }
+      delta = step >> 3;
+      if (diff >= step)
+      {
+         nibble |= 4;
+         diff -= step;
+         delta += step;
+      }
+      if (diff >= step >> 1)
+      {
+         nibble |= 2;
+         diff -= step >> 1;
+         delta += step >> 1;
+      }
+      if (diff >= step >> 2)
+      {
+         nibble |= 1;
+         delta += step >> 2;
+      }
+
+      pred += (nibble & 8) ? -delta : delta;
+      if (pred > 32767)
+         pred = 32767;
+      else if (pred < -32768)
+         pred = -32768;
+      index += snd_adpcmindex[nibble & 7];
+      if (index < 0)
+         index = 0;
+      else if (index > 88)
+         index = 88;
+
+      nibbles[j >> 1] |= (j & 1) ? nibble << 4 : nibble;
+   }
+}
+
+/*
+================
+SND_CacheSamples
+
+Puts a sound's resampled samples in the cache, compressed if they come to
+more than snd_compresssize
+================
+*/
+static sfxcache_t *
+SND_CacheSamples(sfx_t *sfx, const void *samples, int width, int length,
+		 int loopstart)
+{
+   sfxcache_t *sc;
+   qboolean adpcm;
+   int size;
+
+   size = length * width;
+   adpcm = snd_compresssize.value > 0 && size > snd_compresssize.value;
+   if (adpcm)
+      size = SND_ADPCMSize(length);
+
+   sc = (sfxcache_t*)Cache_Alloc(&sfx->cache, size + sizeof(sfxcache_t), sfx->name);
+   if (!sc)
+      return NULL;
+   sc->length = length;
+   sc->loopstart = loopstart;
+   sc->speed = shm->speed;
+   sc->width = adpcm ? 2 : width;
+   sc->stereo = 1;
+   sc->streamrate = 0;
+   sc->adpcm = adpcm;
+   if (adpcm)
+      SND_EncodeADPCM(samples, width, length, sc->data);
+   else
+      memcpy(sc->data, samples, size);
+
+   return sc;
+}
+
+/*
+================
+ResampleSfx
+================
+*/
+static sfxcache_t *
+ResampleSfx(sfx_t *sfx, const wavinfo_t *info, const byte *data, int outcount)
+{
+   float stepscale;
+   sfxcache_t *sc;
+   int loopstart;
+   void *out;
+
+   out = malloc(outcount * info->width + 1);
+   if (!out)
+      return NULL;
+   SND_Resample(data, info->rate, info->width, info->samples, out,
+		shm->speed, outcount, snd_resample.value);
+
+   stepscale = (float)info->rate / shm->speed;
+   loopstart = info->loopstart;
+   if (loopstart != -1)
+      loopstart = loopstart / stepscale;
+
+   sc = SND_CacheSamples(sfx, out, info->width, outcount, loopstart);
+   if (sc && snd_resamplecache.value)
+      SND_WriteCachedSound(sfx, sc, out, info->width, soundcache_filesize,
+            soundcache_crc);
+   free(out);
+
+   return sc;
+}
+
+/*
+===============================================================================
+
+RESAMPLED SOUND CACHE
+
+Resampled sounds are written under the save directory, so later sessions at
+the same rate only have to check the source file is unchanged. The files
+are in native byte order; they are only read back on the machine that
+wrote them.
+
+===============================================================================
+*/
+
+#define SOUNDCACHE_IDENT	(('C' << 24) + ('N' << 16) + ('D' << 8) + 'S')
+#define SOUNDCACHE_VERSION	1
+
+typedef struct {
+   int ident;
+   int version;
+   int filesize;	// of the source wav
+   int crc;		// of the source wav
+   int speed;		// resampled to
+   int quality;		// snd_resample
+   int length;
+   int loopstart;
+   int width;
+} soundcache_t;
+
+
+static qboolean
+SND_CachedSoundPath(const sfx_t *sfx, char *path, int size)
+{
+   return snprintf(path, size, "%s/soundcache/%s", com_savedir, sfx->name) < size;
+}
+
+static void
+SND_WriteCachedSound(sfx_t *sfx, const sfxcache_t *sc, const void *samples,
+		     int width, int filesize, int crc)
+{
+   char path[MAX_OSPATH];
+   soundcache_t header;
+   FILE *f;
+
+   if (!SND_CachedSoundPath(sfx, path, sizeof(path)))
+      return;
+   COM_CreatePath(path);
+   f = fopen(path, "wb");
+   if (!f)
+      return;
+
+   header.ident = SOUNDCACHE_IDENT;
+   header.version = SOUNDCACHE_VERSION;
+   header.filesize = filesize;
+   header.crc = crc;
+   header.speed = sc->speed;
+   header.quality = snd_resample.value;
+   header.length = sc->length;
+   header.loopstart = sc->loopstart;
+   header.width = width;
+
+   if (fwrite(&header, sizeof(header), 1, f) != 1
+       || fwrite(samples, width, sc->length, f) != sc->length)
+   {
+      fclose(f);
+      remove(path);
+      return;
+   }
+   fclose(f);
+}
+
+/*
+ * Loads the sound from the cache if it was resampled from the same file,
+ * to the current rate, at the current quality.
+ */
+static sfxcache_t *
+SND_LoadCachedSound(sfx_t *sfx)
+{
+   char path[MAX_OSPATH];
+   soundcache_t header;
+   sfxcache_t *sc;
+   void *samples;
+   FILE *f;
+
+   if (!SND_CachedSoundPath(sfx, path, sizeof(path)))
+      return NULL;
+   f = fopen(path, "rb");
+   if (!f)
+      return NULL;
+
+   sc = NULL;
+   if (fread(&header, sizeof(header), 1, f) != 1)
+      goto out;
+   if (header.ident != SOUNDCACHE_IDENT || header.version != SOUNDCACHE_VERSION)
+      goto out;
+   if (header.filesize != soundcache_filesize || header.crc != soundcache_crc)
+      goto out;
+   if (header.speed != shm->speed || header.quality != (int)snd_resample.value)
+      goto out;
+   if ((header.width != 1 && header.width != 2) || header.length < 0)
+      goto out;
+
+   samples = malloc(header.length * header.width + 1);
+   if (!samples)
+      goto out;
+   if (fread(samples, header.width, header.length, f) == header.length)
+      sc = SND_CacheSamples(sfx, samples, header.width, header.length,
+            header.loopstart);
+   free(samples);
+
+ out:
+   fclose(f);
+   return sc;
+}
+
+/*
+===============================================================================
+
+DEFERRED RESAMPLING
+
+Between S_BeginPrecaching and S_EndPrecaching the sounds S_QueueSound
+loads are only read and checked. Their samples are copied out and queued,
+to be resampled together on the job threads by S_EndPrecaching, which
+then puts each in the cache.
+
+===============================================================================
+*/
+
+#define MAX_RESAMPLE_JOBS JOB_MAX_SPLIT(MAX_JOB_THREADS)
+
+typedef struct {
+   sfx_t *sfx;
+   byte *in;			// the samples, copied out of the file
+   int inrate;
+   int width;
+   int incount;
+   int loopstart;
+   int outcount;
+   void *out;			// resampled by the job
+   int filesize;		// the key in the resampled sound cache
+   int crc;
+} resample_t;
+
+static qboolean snd_precaching;
+static resample_t *snd_resamples;
+static int snd_numresamples;
+static int snd_maxresamples;
+static int snd_resampleto;	// shm->speed and snd_resample when queued
+static int snd_resamplequality;
+
+static qboolean
+SND_QueueResample(sfx_t *sfx, const wavinfo_t *info, const byte *data,
+		  int outcount)
+{
+   resample_t *resample;
+
+   if (snd_numresamples == snd_maxresamples)
+   {
+      int count = snd_maxresamples ? snd_maxresamples * 2 : 64;
+
+      resample = (resample_t*)realloc(snd_resamples, count * sizeof(*resample));
+      if (!resample)
+         return false;
+      snd_resamples = resample;
+      snd_maxresamples = count;
+   }
+
+   resample = &snd_resamples[snd_numresamples];
+   resample->in = (byte*)malloc(info->samples * info->width);
+   resample->out = malloc(outcount * info->width);
+   if (!resample->in || !resample->out)
+   {
+      free(resample->in);
+      free(resample->out);
+      return false;
+   }
+   memcpy(resample->in, data, info->samples * info->width);
+   resample->sfx = sfx;
+   resample->inrate = info->rate;
+   resample->width = info->width;
+   resample->incount = info->samples;
+   resample->loopstart = info->loopstart;
+   resample->outcount = outcount;
+   resample->filesize = soundcache_filesize;
+   resample->crc = soundcache_crc;
+   snd_numresamples++;
+
+   return true;
+}
+
+static const char *
+SND_ResampleJob(void *data, int start, int end)
+{
+   const resample_t *resample;
+   int i;
+
+   for (i = start; i < end; i++)
+   {
+      resample = (const resample_t*)data + i;
+      SND_Resample(resample->in, resample->inrate, resample->width,
+		   resample->incount, resample->out, snd_resampleto,
+		   resample->outcount, snd_resamplequality);
+   }
+
+   return NULL;
+}
+
+void
+S_BeginPrecaching(void)
+{
+   snd_precaching = true;
+   snd_precacheseq++;
+}
+
+void
+S_EndPrecaching(void)
+{
+   job_t jobs[MAX_RESAMPLE_JOBS];
+   resample_t *resample;
+   sfxcache_t *sc;
+   float stepscale;
+   int i, numjobs, loopstart;
+
+   snd_precaching = false;
+   if (!snd_numresamples)
+      return;
+
+   snd_resampleto = shm->speed;
+   snd_resamplequality = snd_resample.value;
+   numjobs = Job_Split(jobs, 0, MAX_RESAMPLE_JOBS, SND_ResampleJob,
+		       snd_resamples, snd_numresamples, 1);
+   Job_RunBatch(jobs, numjobs);
+
+   for (i = 0; i < snd_numresamples; i++)
+   {
+      resample = &snd_resamples[i];
+
+      // played and loaded since, or no room for it now
+      if (Cache_Check(&resample->sfx->cache))
+         sc = NULL;
+      else
+      {
+         stepscale = (float)resample->inrate / shm->speed;
+         loopstart = resample->loopstart;
+         if (loopstart != -1)
+            loopstart = loopstart / stepscale;
+         sc = SND_CacheSamples(resample->sfx, resample->out,
+               resample->width, resample->outcount, loopstart);
+      }
+      if (sc && snd_resamplecache.value)
+         SND_WriteCachedSound(resample->sfx, sc, resample->out,
+               resample->width, resample->filesize, resample->crc);
+      free(resample->in);
+      free(resample->out);
+   }
+   snd_numresamples = 0;
+}
+
 //=============================================================================
 
 /*
 ==============
-S_LoadSound
+SND_LoadSound
+
+With defer, a sound that needs resampling is queued for S_EndPrecaching
+and NULL returned
 ==============
 */
-sfxcache_t *
-S_LoadSound(sfx_t *s)
+static sfxcache_t *
+SND_LoadSound(sfx_t *s, qboolean defer)
 {
     char namebuffer[256];
     byte *data;
@@ -130,12 +639,17 @@ S_LoadSound(sfx_t *s)
 
 //      Con_Printf ("loading %s\n",namebuffer);
 
-    data = (byte*)COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf), NULL);
+    data = (byte*)COM_MapFile(namebuffer, NULL);
+    if (!data)
+	data = (byte*)COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf), NULL);
 
     if (!data) {
 	Con_Printf("Couldn't load %s\n", namebuffer);
 	return NULL;
     }
+    s->filesize = com_filesize;
+    s->crc = CRC_Block(data, com_filesize);
+    s->checked = snd_precacheseq;
 
     info = GetWavinfo(s->name, data, com_filesize);
     if (info->channels != 1) {
@@ -148,19 +662,100 @@ S_LoadSound(sfx_t *s)
 
     len = len * info->width * info->channels;
 
-    sc = (sfxcache_t*)Cache_Alloc(&s->cache, len + sizeof(sfxcache_t), s->name);
-    if (!sc)
+    // too big to keep resident; the mixer reads it from the file as it goes
+    if (snd_streamsize.value > 0 && len > snd_streamsize.value
+	&& S_CodecIsAvailable(CODECTYPE_WAV) > 0) {
+	sc = (sfxcache_t*)Cache_Alloc(&s->cache, sizeof(sfxcache_t), s->name);
+	if (!sc)
+	    return NULL;
+	sc->length = info->samples / stepscale;
+	sc->loopstart = info->loopstart;
+	if (sc->loopstart != -1)
+	    sc->loopstart = sc->loopstart / stepscale;
+	sc->speed = shm->speed;
+	sc->width = info->width;
+	sc->stereo = 1;
+	sc->streamrate = info->rate;
+	sc->adpcm = false;
+	return sc;
+    }
+
+    if (snd_resamplecache.value) {
+	soundcache_filesize = s->filesize;
+	soundcache_crc = s->crc;
+	sc = SND_LoadCachedSound(s);
+	if (sc)
+	    return sc;
+    }
+
+    if (defer && SND_QueueResample(s, info, data + info->dataofs,
+				   len / info->width))
 	return NULL;
 
-    sc->length = info->samples;
-    sc->loopstart = info->loopstart;
-    sc->speed = info->rate;
-    sc->width = info->width;
-    sc->stereo = info->channels;
+    return ResampleSfx(s, info, data + info->dataofs, len / info->width);
+}
 
-    ResampleSfx(s, sc->speed, sc->width, data + info->dataofs);
+sfxcache_t *
+S_LoadSound(sfx_t *s)
+{
+    return SND_LoadSound(s, false);
+}
+
+/*
+==============
+SND_RecheckSound
 
-    return sc;
+A sound kept in the cache from the last map is dropped if the file it was
+loaded from has changed since, so it gets loaded again
+==============
+*/
+static void
+SND_RecheckSound(sfx_t *s)
+{
+    char namebuffer[256];
+    byte stackbuf[1024];	// avoid dirtying the cache heap
+    byte *data;
+
+    if (s->checked == snd_precacheseq)
+	return;
+    s->checked = snd_precacheseq;
+    if (!Cache_Check(&s->cache))
+	return;
+
+    snprintf(namebuffer, sizeof(namebuffer), "sound/%s", s->name);
+    data = (byte*)COM_MapFile(namebuffer, NULL);
+    if (!data)
+	data = (byte*)COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf), NULL);
+    if (data && com_filesize == s->filesize
+	&& CRC_Block(data, com_filesize) == s->crc)
+	return;
+
+    Cache_Free(&s->cache);
+}
+
+/*
+==============
+S_QueueSound
+
+Loads the sound for precaching, which may leave it to S_EndPrecaching
+==============
+*/
+void
+S_QueueSound(sfx_t *s)
+{
+    int i;
+
+    if (!snd_precaching) {
+	S_LoadSound(s);
+	return;
+    }
+    SND_RecheckSound(s);
+    if (Cache_Check(&s->cache))
+	return;
+    for (i = 0; i < snd_numresamples; i++)
+	if (snd_resamples[i].sfx == s)
+	    return;		// precached twice
+    SND_LoadSound(s, true);
 }
 
 
@@ -25,8 +25,23 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "common.h"
 #include "console.h"
 #include "quakedef.h"
+#include "snd_codec.h"
 #include "sound.h"
 
+/*
+ * Channels are mixed into the paint buffer, and the paint buffer clipped
+ * and written out, several samples at a time where SIMD is available. The
+ * paint buffer stays 32 bit ints, so the results match the plain C loops
+ * bit for bit.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SND_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SND_NEON
+#endif
+
 #define	CLAMP(_minval, x, _maxval)		\
 	((x) < (_minval) ? (_minval) :		\
 	 (x) > (_maxval) ? (_maxval) : (x))
@@ -39,12 +54,33 @@ short		*snd_out;
 
 static int	snd_vol;
 
+/* Set while S_PaintChannelsLinear runs */
+static short	*snd_linear_buffer;
+static int	snd_linear_start;
+static qboolean	snd_skip;	/* move the channels on without mixing */
+
 static void Snd_WriteLinearBlastStereo16 (void)
 {
 	int		i;
 	int		val;
 
-	for (i = 0; i < snd_linear_count; i += 2)
+	i = 0;
+#if defined(SND_SSE2)
+	for (; i + 8 <= snd_linear_count; i += 8)
+	{
+		__m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(snd_p + i)), 8);
+		__m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(snd_p + i + 4)), 8);
+		_mm_storeu_si128((__m128i *)(snd_out + i), _mm_packs_epi32(a, b));
+	}
+#elif defined(SND_NEON)
+	for (; i + 8 <= snd_linear_count; i += 8)
+	{
+		int16x4_t a = vqmovn_s32(vshrq_n_s32(vld1q_s32(snd_p + i), 8));
+		int16x4_t b = vqmovn_s32(vshrq_n_s32(vld1q_s32(snd_p + i + 4), 8));
+		vst1q_s16(snd_out + i, vcombine_s16(a, b));
+	}
+#endif
+	for (; i < snd_linear_count; i += 2)
 	{
 		val = snd_p[i] >> 8;
 		if (val > 0x7fff)
@@ -99,6 +135,15 @@ static void S_TransferPaintBuffer (int endtime)
 	int	count, step, val;
 	int	*p;
 
+	if (snd_linear_buffer)
+	{
+		snd_p = (int *) paintbuffer;
+		snd_out = snd_linear_buffer + (paintedtime - snd_linear_start) * 2;
+		snd_linear_count = (endtime - paintedtime) * 2;
+		Snd_WriteLinearBlastStereo16 ();
+		return;
+	}
+
 	if (shm->samplebits == 16 && shm->channels == 2)
 	{
 		S_TransferStereo16 (endtime);
@@ -166,13 +211,53 @@ CHANNEL MIXING
 ===============================================================================
 */
 
-static void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int endtime, int paintbufferstart);
-static void SND_PaintChannelFrom16 (channel_t *ch, sfxcache_t *sc, int endtime, int paintbufferstart);
+static void SND_PaintChannelFrom8 (channel_t *ch, const unsigned char *sfx, int count, int paintbufferstart);
+static void SND_PaintChannelFrom16 (channel_t *ch, const signed short *sfx, int count, int paintbufferstart);
+static qboolean SND_PaintChannelFromStream (channel_t *ch, sfxcache_t *sc, int count, int paintbufferstart);
+static void SND_PaintChannelFromADPCM (channel_t *ch, const sfxcache_t *sc, int count, int paintbufferstart);
+
+// clip each sample to 0dB
+static void SND_ClipPaintBuffer (int count)
+{
+	int	*p = (int *) paintbuffer;
+	int	i;
+
+	count *= 2;
+	i = 0;
+#if defined(SND_SSE2)
+	{
+		const __m128i maxval = _mm_set1_epi32(32767 << 8);
+		const __m128i minval = _mm_set1_epi32(-32768 << 8);
+		__m128i x, mask;
+
+		for (; i + 4 <= count; i += 4)
+		{
+			x = _mm_loadu_si128((const __m128i *)(p + i));
+			mask = _mm_cmpgt_epi32(x, maxval);
+			x = _mm_or_si128(_mm_and_si128(mask, maxval), _mm_andnot_si128(mask, x));
+			mask = _mm_cmplt_epi32(x, minval);
+			x = _mm_or_si128(_mm_and_si128(mask, minval), _mm_andnot_si128(mask, x));
+			_mm_storeu_si128((__m128i *)(p + i), x);
+		}
+	}
+#elif defined(SND_NEON)
+	{
+		const int32x4_t maxval = vdupq_n_s32(32767 << 8);
+		const int32x4_t minval = vdupq_n_s32(-32768 << 8);
+
+		for (; i + 4 <= count; i += 4)
+			vst1q_s32(p + i, vmaxq_s32(vminq_s32(vld1q_s32(p + i), maxval), minval));
+	}
+#endif
+	for (; i < count; i++)
+		p[i] = CLAMP(-32768 << 8, p[i], 32767 << 8);
+}
 
 void S_PaintChannels (int endtime)
 {
 	int		i;
 	int		end, ltime, count;
+	qboolean	skip;
 	channel_t	*ch;
 	sfxcache_t	*sc;
 
@@ -186,7 +271,8 @@ void S_PaintChannels (int endtime)
 			end = paintedtime + PAINTBUFFER_SIZE;
 
 	// clear the paint buffer
-		memset(paintbuffer, 0, (end - paintedtime) * sizeof(portable_samplepair_t));
+		if (!snd_skip)
+			memset(paintbuffer, 0, (end - paintedtime) * sizeof(portable_samplepair_t));
 
 	// paint in the channels.
 		ch = channels;
@@ -200,6 +286,8 @@ void S_PaintChannels (int endtime)
 			if (!sc)
 				continue;
 
+		// virtual voices only keep time, but streams can't skip ahead
+			skip = snd_skip || (channel_virtual[i] && !sc->streamrate);
 			ltime = paintedtime;
 
 			while (ltime < end)
@@ -213,10 +301,22 @@ void S_PaintChannels (int endtime)
 				{
 					// the last param to SND_PaintChannelFrom is the index
 					// to start painting to in the paintbuffer, usually 0.
-					if (sc->width == 1)
-						SND_PaintChannelFrom8(ch, sc, count, ltime - paintedtime);
+					if (skip)
+						ch->pos += count;
+					else if (sc->streamrate)
+					{
+						if (!SND_PaintChannelFromStream(ch, sc, count, ltime - paintedtime))
+						{
+							ch->sfx = NULL;
+							break;
+						}
+					}
+					else if (sc->adpcm)
+						SND_PaintChannelFromADPCM(ch, sc, count, ltime - paintedtime);
+					else if (sc->width == 1)
+						SND_PaintChannelFrom8(ch, sc->data + ch->pos, count, ltime - paintedtime);
 					else
-						SND_PaintChannelFrom16(ch, sc, count, ltime - paintedtime);
+						SND_PaintChannelFrom16(ch, (signed short *)sc->data + ch->pos, count, ltime - paintedtime);
 
 					ltime += count;
 				}
@@ -238,14 +338,16 @@ void S_PaintChannels (int endtime)
 			}
 		}
 
+		if (snd_skip)
+		{
+			paintedtime = end;
+			continue;
+		}
+
 	// clip each sample to 0dB, then reduce by 6dB (to leave some headroom for
 	// the lowpass filter and the music). the lowpass will smooth out the
 	// clipping
-		for (i=0; i<end-paintedtime; i++)
-		{
-			paintbuffer[i].left = CLAMP(-32768 << 8, paintbuffer[i].left, 32767 << 8);
-			paintbuffer[i].right = CLAMP(-32768 << 8, paintbuffer[i].right, 32767 << 8);
-		}
+		SND_ClipPaintBuffer(end - paintedtime);
 
 	// paint in the music
 		if (s_rawend >= paintedtime)
@@ -274,6 +376,63 @@ void S_PaintChannels (int endtime)
 	}
 }
 
+#if defined(SND_SSE2)
+/*
+ * Adds the products of four samples to the next four left/right pairs.
+ * Each 32 bit lane of 'samples' holds the 16 bit multiplicands for one
+ * sample, and 'vol' the left then right multipliers for them.
+ */
+static inline void SND_MixSamples_SSE2 (int *out, __m128i samples, __m128i vol)
+{
+	__m128i	pb;
+
+	pb = _mm_loadu_si128((const __m128i *)out);
+	pb = _mm_add_epi32(pb, _mm_madd_epi16(_mm_unpacklo_epi32(samples, samples), vol));
+	_mm_storeu_si128((__m128i *)out, pb);
+
+	pb = _mm_loadu_si128((const __m128i *)(out + 4));
+	pb = _mm_add_epi32(pb, _mm_madd_epi16(_mm_unpackhi_epi32(samples, samples), vol));
+	_mm_storeu_si128((__m128i *)(out + 4), pb);
+}
+#elif defined(SND_NEON)
+/*
+ * Adds four samples scaled by the left and right volumes to the next four
+ * left/right pairs.
+ */
+static inline void SND_MixSamples_NEON (int *out, int32x4_t samples, int leftvol, int rightvol)
+{
+	int32x4x2_t	pb;
+
+	pb = vld2q_s32(out);
+	pb.val[0] = vmlaq_n_s32(pb.val[0], samples, leftvol);
+	pb.val[1] = vmlaq_n_s32(pb.val[1], samples, rightvol);
+	vst2q_s32(out, pb);
+}
+#endif
+
+/*
+ * Paints up to endtime into a plain array of 16 bit stereo sample pairs,
+ * rather than the DMA ring.
+ */
+void S_PaintChannelsLinear (short *buffer, int endtime)
+{
+	snd_linear_buffer = buffer;
+	snd_linear_start = paintedtime;
+	S_PaintChannels(endtime);
+	snd_linear_buffer = NULL;
+}
+
+/*
+ * Moves the channels on to endtime as painting would, for sound nobody
+ * will hear, without mixing anything.
+ */
+void S_SkipChannels (int endtime)
+{
+	snd_skip = true;
+	S_PaintChannels(endtime);
+	snd_skip = false;
+}
+
 void SND_InitScaletable (void)
 {
 	int		i, j;
@@ -297,11 +456,10 @@ void SND_InitScaletable (void)
 }
 
 
-static void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int count, int paintbufferstart)
+static void SND_PaintChannelFrom8 (channel_t *ch, const unsigned char *sfx, int count, int paintbufferstart)
 {
 	int	data;
 	int		*lscale, *rscale;
-	unsigned char	*sfx;
 	int		i;
 
 	if (ch->leftvol > 255)
@@ -311,9 +469,48 @@ static void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int count, int
 
 	lscale = snd_scaletable[ch->leftvol >> 3];
 	rscale = snd_scaletable[ch->rightvol >> 3];
-	sfx = (unsigned char *)sc->data + ch->pos;
 
-	for (i = 0; i < count; i++)
+	i = 0;
+#if defined(SND_SSE2) || defined(SND_NEON)
+	{
+		// each table entry is just the signed sample times entry 1
+		int	lvol = lscale[1];
+		int	rvol = rscale[1];
+		int	*out;
+
+#if defined(SND_SSE2)
+		// no 32 bit multiply, so the volumes are split into high and low
+		// bytes and paired with (sample, sample << 8)
+		if ((lvol >> 8) == (short)(lvol >> 8) && (rvol >> 8) == (short)(rvol >> 8))
+		{
+			const __m128i vol = _mm_setr_epi16(lvol & 255, lvol >> 8, rvol & 255, rvol >> 8,
+							   lvol & 255, lvol >> 8, rvol & 255, rvol >> 8);
+			__m128i	high, low;
+
+			for (; i + 8 <= count; i += 8)
+			{
+				out = &paintbuffer[paintbufferstart + i].left;
+				high = _mm_unpacklo_epi8(_mm_setzero_si128(),
+							 _mm_loadl_epi64((const __m128i *)(sfx + i)));
+				low = _mm_srai_epi16(high, 8);
+				SND_MixSamples_SSE2(out, _mm_unpacklo_epi16(low, high), vol);
+				SND_MixSamples_SSE2(out + 8, _mm_unpackhi_epi16(low, high), vol);
+			}
+		}
+#else
+		int16x8_t	data;
+
+		for (; i + 8 <= count; i += 8)
+		{
+			out = &paintbuffer[paintbufferstart + i].left;
+			data = vmovl_s8(vld1_s8((const int8_t *)(sfx + i)));
+			SND_MixSamples_NEON(out, vmovl_s16(vget_low_s16(data)), lvol, rvol);
+			SND_MixSamples_NEON(out + 8, vmovl_s16(vget_high_s16(data)), lvol, rvol);
+		}
+#endif
+	}
+#endif
+	for (; i < count; i++)
 	{
 		data = sfx[i];
 		paintbuffer[paintbufferstart + i].left += lscale[data];
@@ -323,21 +520,51 @@ static void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int count, int
 	ch->pos += count;
 }
 
-static void SND_PaintChannelFrom16 (channel_t *ch, sfxcache_t *sc, int count, int paintbufferstart)
+static void SND_PaintChannelFrom16 (channel_t *ch, const signed short *sfx, int count, int paintbufferstart)
 {
 	int	data;
 	int	left, right;
 	int	leftvol, rightvol;
-	signed short	*sfx;
 	int	i;
 
 	leftvol = ch->leftvol * snd_vol;
 	rightvol = ch->rightvol * snd_vol;
 	leftvol >>= 8;
 	rightvol >>= 8;
-	sfx = (signed short *)sc->data + ch->pos;
 
-	for (i = 0; i < count; i++)
+	i = 0;
+#if defined(SND_SSE2)
+	// volumes past 16 bits only come from sfxvolume well above 1
+	if (leftvol == (short)leftvol && rightvol == (short)rightvol)
+	{
+		const __m128i vol = _mm_setr_epi16(leftvol, 0, rightvol, 0,
+						   leftvol, 0, rightvol, 0);
+		int	*out;
+		__m128i	samples;
+
+		for (; i + 8 <= count; i += 8)
+		{
+			out = &paintbuffer[paintbufferstart + i].left;
+			samples = _mm_loadu_si128((const __m128i *)(sfx + i));
+			SND_MixSamples_SSE2(out, _mm_unpacklo_epi16(samples, _mm_setzero_si128()), vol);
+			SND_MixSamples_SSE2(out + 8, _mm_unpackhi_epi16(samples, _mm_setzero_si128()), vol);
+		}
+	}
+#elif defined(SND_NEON)
+	{
+		int	*out;
+		int16x8_t	samples;
+
+		for (; i + 8 <= count; i += 8)
+		{
+			out = &paintbuffer[paintbufferstart + i].left;
+			samples = vld1q_s16(sfx + i);
+			SND_MixSamples_NEON(out, vmovl_s16(vget_low_s16(samples)), leftvol, rightvol);
+			SND_MixSamples_NEON(out + 8, vmovl_s16(vget_high_s16(samples)), leftvol, rightvol);
+		}
+	}
+#endif
+	for (; i < count; i++)
 	{
 		data = sfx[i];
 	// this was causing integer overflow as observed in quakespasm
@@ -353,3 +580,257 @@ static void SND_PaintChannelFrom16 (channel_t *ch, sfxcache_t *sc, int count, in
 	ch->pos += count;
 }
 
+/*
+===============================================================================
+
+COMPRESSED SOUNDS
+
+IMA ADPCM, as in snd_mem.c's encoder. A paint decodes the blocks it covers
+onto the stack, from the start of the first, and mixes them as 16 bit.
+
+===============================================================================
+*/
+
+const short snd_adpcmstep[89] =
+{
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37,
+	41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173,
+	190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+	724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+	7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818,
+	18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+const signed char snd_adpcmindex[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+/* Decodes the first count samples of the block */
+static void SND_DecodeADPCM (const sfxcache_t *sc, int block, int count, short *out)
+{
+	const byte	*in = sc->data + block * SND_ADPCM_BLOCKSIZE;
+	int	pred, index, step, delta, nibble;
+	int	i;
+
+	pred = (short)(in[0] | (in[1] << 8));
+	index = in[2];
+	in += 4;
+	for (i = 0; i < count; i++)
+	{
+		nibble = (i & 1) ? in[i >> 1] >> 4 : in[i >> 1] & 15;
+		step = snd_adpcmstep[index];
+		delta = step >> 3;
+		if (nibble & 4)
+			delta += step;
+		if (nibble & 2)
+			delta += step >> 1;
+		if (nibble & 1)
+			delta += step >> 2;
+		pred += (nibble & 8) ? -delta : delta;
+		pred = CLAMP(-32768, pred, 32767);
+		index = CLAMP(0, index + snd_adpcmindex[nibble & 7], 88);
+		out[i] = pred;
+	}
+}
+
+static void SND_PaintChannelFromADPCM (channel_t *ch, const sfxcache_t *sc, int count, int paintbufferstart)
+{
+	short	samples[SND_ADPCM_BLOCK];
+	int	block, offset, n;
+
+	while (count > 0)
+	{
+		block = ch->pos / SND_ADPCM_BLOCK;
+		offset = ch->pos - block * SND_ADPCM_BLOCK;
+		n = qmin(count, SND_ADPCM_BLOCK - offset);
+		SND_DecodeADPCM(sc, block, offset + n, samples);
+		SND_PaintChannelFrom16(ch, samples + offset, n, paintbufferstart);
+		paintbufferstart += n;
+		count -= n;
+	}
+}
+
+/*
+===============================================================================
+
+STREAMED SOUNDS
+
+Sounds too big to keep resident are read from their files by the channels
+playing them. Each such channel gets a stream, which decodes the file
+in order and keeps a window of samples at the output rate around the
+channel's position. Samples are resampled by nearest neighbour.
+
+===============================================================================
+*/
+
+#define	MAX_SND_STREAMS		8
+#define	SND_STREAM_WINDOW	4096	/* output samples kept */
+#define	SND_STREAM_READ		2048	/* file samples read at a time */
+
+typedef struct
+{
+	channel_t	*channel;	/* NULL if free */
+	sfx_t		*sfx;
+	snd_stream_t	*file;
+	int		start, count;	/* output samples in data */
+	int		inbase, incount;	/* file samples in in */
+	byte		data[SND_STREAM_WINDOW * 2];
+	byte		in[SND_STREAM_READ * 2];
+} sndstream_t;
+
+static sndstream_t	snd_streams[MAX_SND_STREAMS];
+
+static void SND_CloseStream (sndstream_t *stream)
+{
+	if (stream->file)
+		S_CodecCloseStream(stream->file);
+	memset(stream, 0, offsetof(sndstream_t, data));
+}
+
+void S_CloseStreams (void)
+{
+	int	i;
+
+	for (i = 0; i < MAX_SND_STREAMS; i++)
+		SND_CloseStream(&snd_streams[i]);
+}
+
+/*
+ * Finds the channel's stream, or opens one. A stream is free once its
+ * channel has stopped or moved on to another sound.
+ */
+static sndstream_t *SND_ChannelStream (channel_t *ch, sfxcache_t *sc)
+{
+	char		name[MAX_OSPATH];
+	sndstream_t	*stream, *unused;
+	int		i;
+
+	unused = NULL;
+	for (i = 0, stream = snd_streams; i < MAX_SND_STREAMS; i++, stream++)
+	{
+		if (stream->channel == ch && stream->sfx == ch->sfx)
+			return stream;
+		if (!stream->channel || stream->channel->sfx != stream->sfx || stream->channel == ch)
+		{
+			if (!unused || unused->channel)
+				unused = stream;
+		}
+	}
+	if (!unused)
+		return NULL;
+
+	SND_CloseStream(unused);
+	snprintf(name, sizeof(name), "sound/%s", ch->sfx->name);
+	unused->file = S_CodecOpenStreamType(name, CODECTYPE_WAV);
+	if (!unused->file)
+		return NULL;
+	if (unused->file->info.channels != 1 || unused->file->info.width != sc->width
+	    || unused->file->info.rate != sc->streamrate)
+	{
+		SND_CloseStream(unused);
+		return NULL;
+	}
+	unused->channel = ch;
+	unused->sfx = ch->sfx;
+
+	return unused;
+}
+
+/*
+ * Makes sure the window holds samples from 'pos' on, where the sound has
+ * any. Returns the number of samples the window has from there.
+ */
+static int SND_FillStream (sndstream_t *stream, sfxcache_t *sc, int pos)
+{
+	int	drop, n, src, res;
+
+	if (pos >= stream->start && pos < stream->start + stream->count)
+		return stream->start + stream->count - pos;
+
+	if (pos < stream->start || pos > stream->start + stream->count + SND_STREAM_WINDOW / 2)
+	{
+		// somewhere else altogether; start over from here
+		stream->start = pos;
+		stream->count = 0;
+	}
+	else
+	{
+		// carry on from the end of the window, keeping a little behind
+		drop = qmin(stream->count, pos - stream->start - SND_STREAM_WINDOW / 4);
+		if (drop > 0)
+		{
+			stream->start += drop;
+			stream->count -= drop;
+			memmove(stream->data, stream->data + drop * sc->width, stream->count * sc->width);
+		}
+	}
+
+	while (stream->count < SND_STREAM_WINDOW)
+	{
+		n = stream->start + stream->count;
+		if (n >= sc->length)
+			break;
+		src = (long long)n * sc->streamrate / sc->speed;
+
+		if (src < stream->inbase)
+		{
+			if (S_CodecRewindStream(stream->file))
+				break;
+			stream->inbase = 0;
+			stream->incount = 0;
+		}
+		while (src >= stream->inbase + stream->incount)
+		{
+			stream->inbase += stream->incount;
+			res = S_CodecReadStream(stream->file, SND_STREAM_READ * sc->width, stream->in);
+			stream->incount = res > 0 ? res / sc->width : 0;
+			if (!stream->incount)
+				goto out;
+		}
+
+		src -= stream->inbase;
+		if (sc->width == 2)
+			((short *)stream->data)[stream->count] = ((short *)stream->in)[src];
+		else
+			((signed char *)stream->data)[stream->count] = (int)stream->in[src] - 128;
+		stream->count++;
+	}
+
+ out:
+	if (pos < stream->start || pos >= stream->start + stream->count)
+		return 0;
+	return stream->start + stream->count - pos;
+}
+
+/*
+ * Returns false if the channel can't be streamed, in which case it's
+ * stopped.
+ */
+static qboolean SND_PaintChannelFromStream (channel_t *ch, sfxcache_t *sc, int count, int paintbufferstart)
+{
+	sndstream_t	*stream;
+	int		avail;
+
+	stream = SND_ChannelStream(ch, sc);
+	if (!stream)
+		return false;
+
+	while (count > 0)
+	{
+		avail = SND_FillStream(stream, sc, ch->pos);
+		if (!avail)
+		{
+			// the file came up short; play out the rest as silence
+			ch->pos += count;
+			return true;
+		}
+		avail = qmin(avail, count);
+		if (sc->width == 1)
+			SND_PaintChannelFrom8(ch, stream->data + (ch->pos - stream->start), avail, paintbufferstart);
+		else
+			SND_PaintChannelFrom16(ch, (short *)stream->data + (ch->pos - stream->start), avail, paintbufferstart);
+		paintbufferstart += avail;
+		count -= avail;
+	}
+
+	return true;
+}
@@ -50,6 +50,9 @@ typedef struct {
 typedef struct sfx_s {
     char name[MAX_QPATH];
     cache_user_t cache;
+    int filesize;		// identify the file it was loaded from
+    unsigned short crc;
+    int checked;		// the precache it was last checked for
 } sfx_t;
 
 // !!! if this is changed, it much be changed in asm_i386.h too !!!
@@ -59,9 +62,26 @@ typedef struct {
     int speed;
     int width;
     int stereo;
-    byte data[1];		// variable sized
+    int streamrate;		// rate of the file if streamed, else 0
+    int adpcm;			// data is IMA ADPCM blocks, mixed as 16 bit
+    byte data[1];		// variable sized, empty if streamed
 } sfxcache_t;
 
+/*
+ * Resident sounds bigger than snd_compresssize are kept as IMA ADPCM, four
+ * bits a sample, and decoded as they are mixed. Each block of
+ * SND_ADPCM_BLOCK samples starts with the decoder's state (the predicted
+ * sample, little endian, and the step index), so mixing can start at any
+ * block.
+ */
+#define SND_ADPCM_BLOCK		512
+#define SND_ADPCM_BLOCKSIZE	(4 + SND_ADPCM_BLOCK / 2)	// bytes
+#define SND_ADPCMSize(length) \
+    (((length) + SND_ADPCM_BLOCK - 1) / SND_ADPCM_BLOCK * SND_ADPCM_BLOCKSIZE)
+
+extern const short snd_adpcmstep[89];
+extern const signed char snd_adpcmindex[8];
+
 typedef struct {
     int channels;
     int samples;		// mono samples in buffer
@@ -71,6 +91,7 @@ typedef struct {
 	int	signed8;		/* device opened for S8 format? (e.g. Amiga AHI) */
     int speed;
     unsigned char *buffer;
+    qboolean direct;		// driver pulls each frame's mix with S_PaintDirect
 } dma_t;
 
 // !!! if this is changed, it much be changed in asm_i386.h too !!!
@@ -109,14 +130,25 @@ void S_StaticSound(sfx_t *sfx, vec3_t origin, float vol, float attenuation);
 void S_StopSound(int entnum, int entchannel);
 void S_StopAllSounds(qboolean clear);
 void S_ClearBuffer(void);
+#ifdef NQ_HACK
+struct sizebuf_s;
+int S_ChannelStateSize(void);
+void S_SaveChannels(struct sizebuf_s *buf);
+qboolean S_LoadChannels(struct sizebuf_s *buf);
+#endif
 void S_Update(vec3_t origin, vec3_t v_forward, vec3_t v_right, vec3_t v_up);
 void S_ExtraUpdate(void);
 
 sfx_t *S_PrecacheSound(const char *sample);
+qboolean S_SoundNeedsLoad(const char *sample);
 void S_TouchSound(const char *sample);
 void S_BeginPrecaching(void);
 void S_EndPrecaching(void);
 void S_PaintChannels(int endtime);
+void S_PaintChannelsLinear(short *buffer, int endtime);
+void S_SkipChannels(int endtime);
+void S_PaintDirect(short *buffer, int frames);
+void S_CloseStreams(void);
 void S_InitPaintChannels(void);
 
 /* music stream support */
@@ -140,11 +172,15 @@ void SNDDMA_Shutdown(void);
 // User-setable variables
 // ====================================================================
 
-#define	MAX_CHANNELS		512
-#define	MAX_DYNAMIC_CHANNELS	128
+#define	MAX_CHANNELS		1024
+#define	MAX_DYNAMIC_CHANNELS	512
 
 extern channel_t channels[MAX_CHANNELS];
 
+// set for the channels left out of this frame's mix (see snd_voices); they
+// are moved on as if they had been mixed
+extern byte channel_virtual[MAX_CHANNELS];
+
 // 0 to MAX_DYNAMIC_CHANNELS-1  = normal entity sounds
 // MAX_DYNAMIC_CHANNELS to MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS -1 = water, etc
 // MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS to total_channels = static sounds
@@ -158,6 +194,10 @@ extern int s_rawend;
 extern cvar_t loadas8bit;
 extern cvar_t bgmvolume;
 extern cvar_t sfxvolume;
+extern cvar_t snd_resample;
+extern cvar_t snd_resamplecache;
+extern cvar_t snd_streamsize;
+extern cvar_t snd_compresssize;
 
 extern int snd_blocked;
 
@@ -166,6 +206,7 @@ extern	portable_samplepair_t	s_rawsamples[MAX_RAW_SAMPLES];
 
 void S_LocalSound(const char *s);
 sfxcache_t *S_LoadSound(sfx_t *s);
+void S_QueueSound(sfx_t *s);
 
 void SND_InitScaletable(void);
 void SNDDMA_Submit(void);
@@ -0,0 +1,690 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_bench.c -- recording the clients' input and replaying it headless
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "client.h"
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "host.h"
+#include "net.h"
+#include "progs.h"
+#include "quakedef.h"
+#include "server.h"
+#include "sys.h"
+
+/*
+ * "svcmdlog <file>" records what the clients feed the server from the next
+ * map start until the map after it (or "svcmdlog stop"): the settings the
+ * map was started with, the clients carried over into it, and then for
+ * each server frame its length and, in order, the moves and commands read
+ * from each client, the thinks and the physics run. It's a text file in
+ * the game directory, by default with a ".cmds" extension.
+ *
+ * "svbench <file|map> [frames]" starts the map again with no networking
+ * and no client, replays the log (or just runs the map's physics for
+ * 'frames' frames of SVBENCH_FRAMETIME) with the random numbers seeded the
+ * same each time, and reports the time per frame, the QuakeC functions
+ * running the most statements, the builtins taking the most time (while
+ * pr_builtinprofile is set) and a hash of the edicts at the end, which
+ * should come out the same however the VM and physics are optimised.
+ */
+
+#define SVCMDLOG_VERSION 1
+#define SVBENCH_FRAMETIME 0.05
+#define SVBENCH_FRAMES 1000
+
+static FILE *sv_cmdlog;
+static char sv_cmdlogname[MAX_OSPATH];	// armed for the next map start
+static int sv_cmdlogframes;
+
+/*
+ * ============================================================================
+ * Recording
+ * ============================================================================
+ */
+
+/*
+ * Only the commands changing the game are kept; the rest either just
+ * print or need a connection to the client.
+ */
+static const char *const sv_cmdlogcommands[] = {
+   "prespawn", "spawn", "begin", "name", "color", "kill", "pause",
+   "god", "notarget", "fly", "noclip", "give", NULL
+};
+
+static void SV_CmdLogClose(void)
+{
+   if (!sv_cmdlog)
+      return;
+
+   fclose(sv_cmdlog);
+   sv_cmdlog = NULL;
+   Con_Printf("Finished the command log, %i frames\n", sv_cmdlogframes);
+}
+
+/* Called once the map has been started, with its first frames run */
+void SV_CmdLogStart(void)
+{
+   client_t *client;
+   int i, j;
+
+   SV_CmdLogClose();
+   if (!sv_cmdlogname[0])
+      return;
+
+   sv_cmdlog = fopen(sv_cmdlogname, "w");
+   if (!sv_cmdlog)
+   {
+      Con_Printf("Couldn't open %s\n", sv_cmdlogname);
+      sv_cmdlogname[0] = 0;
+      return;
+   }
+   Con_Printf("Logging the clients' commands to %s\n", sv_cmdlogname);
+   sv_cmdlogname[0] = 0;
+   sv_cmdlogframes = 0;
+
+   fprintf(sv_cmdlog, "svcmdlog %i\n", SVCMDLOG_VERSION);
+   fprintf(sv_cmdlog, "map %s\n", sv.name);
+   fprintf(sv_cmdlog, "maxclients %i\n", svs.maxclients);
+   fprintf(sv_cmdlog, "serverflags %i\n", svs.serverflags);
+   fprintf(sv_cmdlog, "skill %i\n", current_skill);
+   fprintf(sv_cmdlog, "deathmatch %g\n", deathmatch.value);
+   fprintf(sv_cmdlog, "coop %g\n", coop.value);
+   fprintf(sv_cmdlog, "teamplay %g\n", teamplay.value);
+
+   for (i = 0, client = svs.clients; i < svs.maxclients; i++, client++)
+   {
+      if (!client->active)
+         continue;
+      fprintf(sv_cmdlog, "client %i %i", i, client->colors);
+      for (j = 0; j < NUM_SPAWN_PARMS; j++)
+         fprintf(sv_cmdlog, " %.9g", client->spawn_parms[j]);
+      fprintf(sv_cmdlog, " %s\n", client->name);
+   }
+}
+
+void SV_CmdLogFrame(void)
+{
+   if (!sv_cmdlog)
+      return;
+
+   fprintf(sv_cmdlog, "frame %.9g\n", host_frametime);
+   sv_cmdlogframes++;
+}
+
+void SV_CmdLogConnect(int clientnum)
+{
+   if (sv_cmdlog)
+      fprintf(sv_cmdlog, "connect %i\n", clientnum);
+}
+
+void SV_CmdLogDrop(void)
+{
+   if (sv_cmdlog)
+      fprintf(sv_cmdlog, "drop %i\n", (int)(host_client - svs.clients));
+}
+
+/* After SV_ReadClientMove has read host_client's move */
+void SV_CmdLogMove(void)
+{
+   const edict_t *ent = host_client->edict;
+   const usercmd_t *cmd = &host_client->cmd;
+
+   if (!sv_cmdlog)
+      return;
+
+   fprintf(sv_cmdlog, "move %i %.9g %.9g %.9g %g %g %g %i %i\n",
+         (int)(host_client - svs.clients),
+         ent->v.v_angle[0], ent->v.v_angle[1], ent->v.v_angle[2],
+         cmd->forwardmove, cmd->sidemove, cmd->upmove,
+         (int)ent->v.button0 | ((int)ent->v.button2 << 1),
+         (int)ent->v.impulse);
+}
+
+/* Before host_client's command is executed */
+void SV_CmdLogCommand(const char *text)
+{
+   int i, len;
+
+   if (!sv_cmdlog)
+      return;
+
+   for (i = 0; sv_cmdlogcommands[i]; i++)
+   {
+      len = strlen(sv_cmdlogcommands[i]);
+      if (!strncasecmp(text, sv_cmdlogcommands[i], len)
+            && (!text[len] || text[len] == ' '))
+         break;
+   }
+   if (!sv_cmdlogcommands[i] || strchr(text, '\n'))
+      return;
+
+   fprintf(sv_cmdlog, "cmd %i %s\n", (int)(host_client - svs.clients), text);
+}
+
+void SV_CmdLogThink(void)
+{
+   if (sv_cmdlog)
+      fprintf(sv_cmdlog, "think %i\n", (int)(host_client - svs.clients));
+}
+
+void SV_CmdLogPhysics(void)
+{
+   if (sv_cmdlog)
+      fprintf(sv_cmdlog, "physics\n");
+}
+
+/*
+ * The command log file named by arg, in the game directory. False if the
+ * path, with the extension it may need, is too long.
+ */
+static qboolean SV_CmdLogPath(char *name, int size, const char *arg)
+{
+   if (snprintf(name, size, "%s/%s", com_gamedir, arg)
+         >= size - (int)strlen(".cmds"))
+      return false;
+   COM_DefaultExtension(name, ".cmds");
+
+   return true;
+}
+
+static void SV_CmdLog_f(void)
+{
+   char name[MAX_OSPATH];
+
+   if (Cmd_Argc() != 2)
+   {
+      Con_Printf("svcmdlog <file> : log the clients' commands from the "
+            "next map start\nsvcmdlog stop : stop logging\n");
+      return;
+   }
+   if (!strcmp(Cmd_Argv(1), "stop"))
+   {
+      sv_cmdlogname[0] = 0;
+      SV_CmdLogClose();
+      return;
+   }
+
+   if (!SV_CmdLogPath(name, sizeof(name), Cmd_Argv(1)))
+   {
+      Con_Printf("%s: name too long\n", Cmd_Argv(1));
+      return;
+   }
+   snprintf(sv_cmdlogname, sizeof(sv_cmdlogname), "%s", name);
+   Con_Printf("The clients' commands will be logged to %s from the next "
+         "map start\n", name);
+}
+
+/*
+ * ============================================================================
+ * Replaying
+ * ============================================================================
+ */
+
+typedef enum {
+   SVB_FRAME, SVB_CONNECT, SVB_DROP, SVB_MOVE, SVB_CMD, SVB_THINK,
+   SVB_PHYSICS
+} svbenchop_t;
+
+typedef struct {
+   svbenchop_t op;
+   int client;
+   float values[8];		// frame length, or move angles, moves, bits, impulse
+   char *text;
+} svbenchevent_t;
+
+typedef struct {
+   char map[MAX_QPATH];
+   int maxclients;
+   int serverflags;
+   float skill, deathmatch, coop, teamplay;
+
+   svbenchevent_t *events;
+   int numevents;
+   int maxevents;
+} svbenchlog_t;
+
+static svbenchevent_t *SV_BenchAddEvent(svbenchlog_t *log, svbenchop_t op,
+      int client)
+{
+   svbenchevent_t *event;
+
+   if (log->numevents == log->maxevents)
+   {
+      log->maxevents = log->maxevents ? log->maxevents * 2 : 4096;
+      log->events = realloc(log->events,
+            log->maxevents * sizeof(*log->events));
+      if (!log->events)
+         Sys_Error("%s: out of memory", __func__);
+   }
+   event = &log->events[log->numevents++];
+   memset(event, 0, sizeof(*event));
+   event->op = op;
+   event->client = client;
+
+   return event;
+}
+
+static void SV_BenchFreeLog(svbenchlog_t *log)
+{
+   int i;
+
+   for (i = 0; i < log->numevents; i++)
+      free(log->events[i].text);
+   free(log->events);
+}
+
+/*
+ * Reads a command log into 'log', the clients carried over into the map
+ * becoming connect events at the start. Returns false if it isn't one.
+ */
+static qboolean SV_BenchReadLog(FILE *f, svbenchlog_t *log)
+{
+   char line[1024], word[32];
+   svbenchevent_t *event;
+   int version, client, len;
+   float *v;
+   char *rest;
+
+   if (!fgets(line, sizeof(line), f)
+         || sscanf(line, "svcmdlog %i", &version) != 1)
+      return false;
+   if (version != SVCMDLOG_VERSION)
+   {
+      Con_Printf("Command log version %i, not %i\n", version,
+            SVCMDLOG_VERSION);
+      return false;
+   }
+
+   while (fgets(line, sizeof(line), f))
+   {
+      len = strlen(line);
+      if (len && line[len - 1] == '\n')
+         line[--len] = 0;
+      if (sscanf(line, "%31s %n", word, &len) != 1)
+         continue;
+      rest = line + len;
+      client = atoi(rest);
+      if (client < 0 || client >= MAX_SCOREBOARD)
+         continue;
+
+      if (!strcmp(word, "frame"))
+         SV_BenchAddEvent(log, SVB_FRAME, 0)->values[0] = atof(rest);
+      else if (!strcmp(word, "move"))
+      {
+         v = SV_BenchAddEvent(log, SVB_MOVE, client)->values;
+         sscanf(rest, "%*i %f %f %f %f %f %f %f %f",
+               &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+      }
+      else if (!strcmp(word, "cmd") && (rest = strchr(rest, ' ')))
+      {
+         event = SV_BenchAddEvent(log, SVB_CMD, client);
+         event->text = strdup(rest + 1);
+      }
+      else if (!strcmp(word, "think"))
+         SV_BenchAddEvent(log, SVB_THINK, client);
+      else if (!strcmp(word, "physics"))
+         SV_BenchAddEvent(log, SVB_PHYSICS, 0);
+      else if (!strcmp(word, "connect"))
+         SV_BenchAddEvent(log, SVB_CONNECT, client);
+      else if (!strcmp(word, "drop"))
+         SV_BenchAddEvent(log, SVB_DROP, client);
+      else if (!strcmp(word, "client"))
+      {
+         /* colors, parms and name; the text keeps them for the connect */
+         event = SV_BenchAddEvent(log, SVB_CONNECT, client);
+         event->text = strdup(rest);
+      }
+      else if (!strcmp(word, "map"))
+         snprintf(log->map, sizeof(log->map), "%s", rest);
+      else if (!strcmp(word, "maxclients"))
+         log->maxclients = client;
+      else if (!strcmp(word, "serverflags"))
+         log->serverflags = client;
+      else if (!strcmp(word, "skill"))
+         log->skill = atof(rest);
+      else if (!strcmp(word, "deathmatch"))
+         log->deathmatch = atof(rest);
+      else if (!strcmp(word, "coop"))
+         log->coop = atof(rest);
+      else if (!strcmp(word, "teamplay"))
+         log->teamplay = atof(rest);
+   }
+
+   return log->map[0] != 0;
+}
+
+/*
+ * Sets up a client with no connection, as SV_ConnectClient would, or as
+ * it was when carried over into the map if 'carried' has its colors,
+ * spawn parms and name.
+ */
+static void SV_BenchConnect(int clientnum, const char *carried)
+{
+   client_t *client = svs.clients + clientnum;
+   const char *p;
+   char *end;
+   int i;
+
+   if (clientnum >= svs.maxclients)
+      return;
+   if (client->active)
+   {
+      host_client = client;
+      SV_DropClient(false);
+   }
+
+   client->netconnection = NULL;
+   net_activeconnections++;
+   SV_ConnectClient(clientnum);
+   SZ_Clear(&client->message);
+   if (!carried)
+      return;
+
+   /* carried over from the last map: colors, the spawn parms, the name */
+   client->colors = strtol(carried, &end, 10);
+   p = end;
+   for (i = 0; i < NUM_SPAWN_PARMS; i++)
+   {
+      client->spawn_parms[i] = strtod(p, &end);
+      p = end;
+   }
+   while (*p == ' ')
+      p++;
+   snprintf(client->name, sizeof(client->name), "%s", p);
+}
+
+static void SV_BenchMove(const svbenchevent_t *event)
+{
+   client_t *client = svs.clients + event->client;
+   edict_t *ent = client->edict;
+   int bits;
+
+   if (event->client >= svs.maxclients || !client->active)
+      return;
+
+   VectorCopy(event->values, ent->v.v_angle);
+   client->cmd.forwardmove = event->values[3];
+   client->cmd.sidemove = event->values[4];
+   client->cmd.upmove = event->values[5];
+   bits = (int)event->values[6];
+   ent->v.button0 = bits & 1;
+   ent->v.button2 = (bits & 2) >> 1;
+   if (event->values[7])
+      ent->v.impulse = event->values[7];
+}
+
+/* So that the replay doesn't pile up messages nobody will read */
+static void SV_BenchClearMessages(void)
+{
+   int i;
+
+   for (i = 0; i < svs.maxclients; i++)
+      SZ_Clear(&svs.clients[i].message);
+   SZ_Clear(&sv.datagram);
+   SZ_Clear(&sv.reliable_datagram);
+   SZ_Clear(&sv.signon);
+}
+
+/* Runs one event of the replay */
+static void SV_BenchEvent(const svbenchevent_t *event)
+{
+   client_t *client = svs.clients + event->client;
+
+   switch (event->op)
+   {
+      case SVB_FRAME:
+         host_frametime = event->values[0];
+         pr_global_struct->frametime = host_frametime;
+         SV_ClearDatagram();
+         break;
+      case SVB_CONNECT:
+         SV_BenchConnect(event->client, event->text);
+         break;
+      case SVB_DROP:
+         if (event->client < svs.maxclients && client->active)
+         {
+            host_client = client;
+            SV_DropClient(false);
+         }
+         break;
+      case SVB_MOVE:
+         SV_BenchMove(event);
+         break;
+      case SVB_CMD:
+         if (event->client < svs.maxclients && client->active)
+         {
+            host_client = client;
+            sv_player = client->edict;
+            Cmd_ExecuteString(event->text, src_client);
+         }
+         break;
+      case SVB_THINK:
+         if (event->client < svs.maxclients && client->active
+               && client->spawned)
+         {
+            host_client = client;
+            sv_player = client->edict;
+            SV_ClientThink();
+         }
+         break;
+      case SVB_PHYSICS:
+         SV_Physics();
+         break;
+   }
+}
+
+static int SV_BenchCompareTimes(const void *a, const void *b)
+{
+   double time1 = *(const double *)a;
+   double time2 = *(const double *)b;
+
+   return time1 < time2 ? -1 : time1 > time2;
+}
+
+static void SV_BenchReport(double *times, int frames, double total)
+{
+   double mean;
+   int i;
+
+   qsort(times, frames, sizeof(*times), SV_BenchCompareTimes);
+   mean = total / frames;
+
+   Con_Printf("%i frames of %s in %.3f seconds\n", frames, sv.name, total);
+   Con_Printf("ms/frame: mean %.3f min %.3f median %.3f 95%% %.3f "
+         "max %.3f\n", mean * 1000, times[0] * 1000,
+         times[frames / 2] * 1000, times[frames * 95 / 100] * 1000,
+         times[frames - 1] * 1000);
+
+   Con_Printf("QuakeC functions running the most statements:\n");
+   Cmd_ExecuteString("profile", src_command);
+   if (pr_builtinprofile.value)
+      Cmd_ExecuteString("pr_builtins 10", src_command);
+   else
+      Con_Printf("(set pr_builtinprofile 1 to list the builtins)\n");
+
+   for (i = 0; i < progs->numfunctions; i++)
+      pr_functions[i].profile = 0;
+}
+
+/*
+ * Restarts the server on the map with the log's settings, no networking
+ * and no local client
+ */
+static qboolean SV_BenchSpawn(const svbenchlog_t *log)
+{
+   CL_Disconnect();
+   Host_ShutdownServer(false);
+
+   svs.maxclients = log->maxclients;
+   if (svs.maxclients < 1)
+      svs.maxclients = 1;
+   if (svs.maxclients > svs.maxclientslimit)
+      svs.maxclients = svs.maxclientslimit;
+   svs.serverflags = log->serverflags;
+   Cvar_SetValue("skill", log->skill);
+   Cvar_SetValue("deathmatch", log->deathmatch);
+   Cvar_SetValue("coop", log->coop);
+   Cvar_SetValue("teamplay", log->teamplay);
+
+   SV_SpawnServer((char *)log->map);
+   return sv.active;
+}
+
+static void SV_Bench_f(void)
+{
+   svbenchlog_t log;
+   char name[MAX_OSPATH];
+   const svbenchevent_t *event;
+   double *times, start, total;
+   int i, frames, maxframes, oldmaxclients;
+   qboolean replay;
+   FILE *f;
+
+   if (Cmd_Argc() < 2 || Cmd_Argc() > 3)
+   {
+      Con_Printf("svbench <cmdlog|map> [frames] : time the server on "
+            "its own\n");
+      return;
+   }
+   maxframes = Cmd_Argc() > 2 ? Q_atoi(Cmd_Argv(2)) : 0;
+
+   if (!SV_CmdLogPath(name, sizeof(name), Cmd_Argv(1)))
+   {
+      Con_Printf("%s: name too long\n", Cmd_Argv(1));
+      return;
+   }
+
+   memset(&log, 0, sizeof(log));
+   f = fopen(name, "r");
+   replay = f != NULL;
+   if (f)
+   {
+      if (!SV_BenchReadLog(f, &log))
+      {
+         Con_Printf("%s isn't a command log\n", name);
+         fclose(f);
+         SV_BenchFreeLog(&log);
+         return;
+      }
+      fclose(f);
+   }
+   else
+   {
+      /* just the map's own physics */
+      snprintf(log.map, sizeof(log.map), "%s", Cmd_Argv(1));
+      log.maxclients = 1;
+      log.skill = skill.value;
+      log.deathmatch = deathmatch.value;
+      log.coop = coop.value;
+      log.teamplay = teamplay.value;
+      if (!maxframes)
+         maxframes = SVBENCH_FRAMES;
+      for (i = 0; i < maxframes; i++)
+      {
+         SV_BenchAddEvent(&log, SVB_FRAME, 0)->values[0] = SVBENCH_FRAMETIME;
+         SV_BenchAddEvent(&log, SVB_PHYSICS, 0);
+      }
+   }
+
+   frames = 0;
+   for (i = 0; i < log.numevents; i++)
+      if (log.events[i].op == SVB_FRAME)
+         frames++;
+   if (!maxframes || maxframes > frames)
+      maxframes = frames;
+   if (!maxframes)
+   {
+      Con_Printf("No frames to run\n");
+      SV_BenchFreeLog(&log);
+      return;
+   }
+
+   oldmaxclients = svs.maxclients;
+   srand(0);
+   if (!SV_BenchSpawn(&log))
+   {
+      svs.maxclients = oldmaxclients;
+      SV_BenchFreeLog(&log);
+      return;
+   }
+   SV_BenchClearMessages();
+
+   for (i = 0; i < progs->numfunctions; i++)
+      pr_functions[i].profile = 0;
+   Cmd_ExecuteString("pr_builtins clear", src_command);
+
+   times = malloc(maxframes * sizeof(*times));
+   if (!times)
+      Sys_Error("%s: out of memory", __func__);
+
+   /* the events before the first frame are the clients carried over */
+   frames = -1;
+   total = 0;
+   start = Sys_DoubleTime();
+   for (event = log.events; event < log.events + log.numevents; event++)
+   {
+      if (event->op == SVB_FRAME)
+      {
+         if (frames >= 0)
+         {
+            times[frames] = Sys_DoubleTime() - start;
+            total += times[frames];
+         }
+         SV_BenchClearMessages();
+         if (++frames == maxframes)
+            break;
+         start = Sys_DoubleTime();
+      }
+      SV_BenchEvent(event);
+      if (!sv.active)
+         break;
+   }
+   if (frames >= 0 && frames < maxframes && sv.active)
+   {
+      times[frames] = Sys_DoubleTime() - start;
+      total += times[frames++];
+   }
+   SV_BenchClearMessages();
+
+   if (frames > 0)
+   {
+      Con_Printf("%s %s\n", replay ? "Replayed" : "Ran", Cmd_Argv(1));
+      SV_BenchReport(times, frames, total);
+      Con_Printf("state hash %08x at %.3f seconds\n", ED_StateHash(),
+            sv.time);
+   }
+
+   free(times);
+   SV_BenchFreeLog(&log);
+   Host_ShutdownServer(false);
+   svs.maxclients = oldmaxclients;
+}
+
+void SV_BenchInit(void)
+{
+   Cmd_AddCommand("svcmdlog", SV_CmdLog_f);
+   Cmd_AddCommand("svbench", SV_Bench_f);
+}
@@ -161,9 +161,13 @@ void SV_Init(void)
     Cvar_RegisterVariable(&sv_idealpitchscale);
     Cvar_RegisterVariable(&sv_aim);
     Cvar_RegisterVariable(&sv_nostep);
+    Cvar_RegisterVariable(&sv_skipidle);
+
+    SV_WorldInit();
 
     Cmd_AddCommand("sv_protocol", SV_Protocol_f);
     Cmd_SetCompletion("sv_protocol", SV_Protocol_Arg_f);
+    SV_BenchInit();
 
     for (i = 0; i < MAX_MODELS; i++)
 	sprintf(localmodels[i], "*%i", i);
@@ -277,12 +281,8 @@ void SV_StartSound(edict_t *entity, int channel, const char *sample, int volume,
       return;
 
    // find precache number for sound
-   for (sound_num = 1; sound_num < MAX_SOUNDS
-         && sv.sound_precache[sound_num]; sound_num++)
-      if (!strcmp(sample, sv.sound_precache[sound_num]))
-         break;
-
-   if (sound_num == MAX_SOUNDS || !sv.sound_precache[sound_num]) {
+   sound_num = PR_FindPrecache(&sv.sound_hash, sv.sound_precache, sample);
+   if (sound_num < 1) {
       Con_Printf("%s: %s not precacheed\n", __func__, sample);
       return;
    }
@@ -337,44 +337,63 @@ CLIENT SPAWNING
 
 /*
 ================
-SV_SendServerinfo
+SV_CreateServerinfo
 
-Sends the first message from the server to a connected client.
-This will be sent on the initial connection and upon each server load.
+Everything SV_SendServerinfo sends that is the same for every client,
+put together once the map is loaded and the precache lists are final.
 ================
 */
-void SV_SendServerinfo(client_t *client)
+static void SV_CreateServerinfo(void)
 {
+   sizebuf_t *msg = &sv.serverinfo;
    const char **s;
 
-   MSG_WriteByte(&client->message, svc_print);
-   MSG_WriteStringf(&client->message,
-         "%c\nVERSION TyrQuake-%s SERVER (%i CRC)",
+   MSG_WriteByte(msg, svc_print);
+   MSG_WriteStringf(msg, "%c\nVERSION TyrQuake-%s SERVER (%i CRC)",
          2, stringify(TYR_VERSION), pr_crc);
 
-   MSG_WriteByte(&client->message, svc_serverinfo);
-   MSG_WriteLong(&client->message, sv.protocol);
-   MSG_WriteByte(&client->message, svs.maxclients);
+   MSG_WriteByte(msg, svc_serverinfo);
+   MSG_WriteLong(msg, sv.protocol);
+   MSG_WriteByte(msg, svs.maxclients);
 
    if (!coop.value && deathmatch.value)
-      MSG_WriteByte(&client->message, GAME_DEATHMATCH);
+      MSG_WriteByte(msg, GAME_DEATHMATCH);
    else
-      MSG_WriteByte(&client->message, GAME_COOP);
+      MSG_WriteByte(msg, GAME_COOP);
 
-   MSG_WriteString(&client->message, PR_GetString(sv.edicts->v.message));
+   MSG_WriteString(msg, PR_GetString(sv.edicts->v.message));
 
    for (s = sv.model_precache + 1; *s; s++)
-      MSG_WriteString(&client->message, *s);
-   MSG_WriteByte(&client->message, 0);
+      MSG_WriteString(msg, *s);
+   MSG_WriteByte(msg, 0);
 
    for (s = sv.sound_precache + 1; *s; s++)
-      MSG_WriteString(&client->message, *s);
-   MSG_WriteByte(&client->message, 0);
+      MSG_WriteString(msg, *s);
+   MSG_WriteByte(msg, 0);
 
    // send music
-   MSG_WriteByte(&client->message, svc_cdtrack);
-   MSG_WriteByte(&client->message, sv.edicts->v.sounds);
-   MSG_WriteByte(&client->message, sv.edicts->v.sounds);
+   MSG_WriteByte(msg, svc_cdtrack);
+   MSG_WriteByte(msg, sv.edicts->v.sounds);
+   MSG_WriteByte(msg, sv.edicts->v.sounds);
+
+   if (msg->overflowed)
+      Con_Printf("WARNING: serverinfo overflowed, clients can't connect\n");
+}
+
+/*
+================
+SV_SendServerinfo
+
+Sends the first message from the server to a connected client.
+This will be sent on the initial connection and upon each server load.
+================
+*/
+void SV_SendServerinfo(client_t *client)
+{
+   if (sv.serverinfo.overflowed)
+      client->message.overflowed = true;	// drops the client
+   else
+      SZ_Write(&client->message, sv.serverinfo.data, sv.serverinfo.cursize);
 
    // set view
    MSG_WriteByte(&client->message, svc_setview);
@@ -404,7 +423,8 @@ void SV_ConnectClient(int clientnum)
    float spawn_parms[NUM_SPAWN_PARMS];
    client_t *client = svs.clients + clientnum;
 
-   Con_DPrintf("Client %s connected\n", client->netconnection->address);
+   if (client->netconnection)
+      Con_DPrintf("Client %s connected\n", client->netconnection->address);
 
    edictnum = clientnum + 1;
 
@@ -466,6 +486,7 @@ void SV_CheckForNewClients(void)
 
       svs.clients[i].netconnection = sock;
       SV_ConnectClient(i);
+      SV_CmdLogConnect(i);
 
       net_activeconnections++;
    }
@@ -517,157 +538,264 @@ void SV_WriteModelIndex(sizebuf_t *sb, int c, unsigned int bits)
    }
 }
 
+/*
+ * The entity updates don't depend on who they're sent to, so each frame
+ * they are written once, for every entity with a visible model, and then
+ * copied into the datagrams of the clients that can see them.
+ */
+#define SV_MAXENTUPDATE 32	// bits, number and every field
+
+typedef struct {
+   edict_t *ent;
+   int num;
+   int offset;	// into sv_entupdatedata
+   int length;
+} entupdate_t;
+
+static entupdate_t sv_entupdates[MAX_EDICTS];
+static byte sv_entupdatedata[MAX_EDICTS * SV_MAXENTUPDATE];
+static int sv_numentupdates;
+static qboolean sv_entupdatesvalid;	// for this frame
+
 /*
 =============
-SV_WriteEntitiesToClient
+SV_WriteEntityUpdate
 
+Writes the entity's differences from its baseline
 =============
 */
-void SV_WriteEntitiesToClient(edict_t *clent, sizebuf_t *msg)
+static void SV_WriteEntityUpdate(edict_t *ent, int e, sizebuf_t *msg)
 {
-   int e, i;
+   int i;
    int bits;
-   const leafbits_t *pvs;
-   vec3_t org;
    float miss;
-   edict_t *ent;
+   byte *p;
 
-   // find the client's PVS
-   VectorAdd(clent->v.origin, clent->v.view_ofs, org);
-   pvs = Mod_FatPVS(sv.worldmodel, org);
+   bits = 0;
 
-   // send over all entities (excpet the client) that touch the pvs
-   ent = NEXT_EDICT(sv.edicts);
-   for (e = 1; e < sv.num_edicts; e++, ent = NEXT_EDICT(ent)) {
+   for (i = 0; i < 3; i++) {
+      miss = ent->v.origin[i] - ent->baseline.origin[i];
+      if (miss < -0.1 || miss > 0.1)
+         bits |= U_ORIGIN1 << i;
+   }
 
-      // clent is ALWAYS sent
-      if (ent != clent) {
+   if (ent->v.angles[0] != ent->baseline.angles[0])
+      bits |= U_ANGLE1;
 
-         // ignore ents without visible models
-         if (!ent->v.modelindex || !*PR_GetString(ent->v.model))
-            continue;
+   if (ent->v.angles[1] != ent->baseline.angles[1])
+      bits |= U_ANGLE2;
 
-         // ignore if not touching a PV leaf
-         for (i = 0; i < ent->num_leafs; i++)
-            if (Mod_TestLeafBit(pvs, ent->leafnums[i]))
-               break;
+   if (ent->v.angles[2] != ent->baseline.angles[2])
+      bits |= U_ANGLE3;
 
-         if (i == ent->num_leafs)
-            continue;	// not visible
-      }
+   if (ent->v.movetype == MOVETYPE_STEP)
+      bits |= U_NOLERP;	// don't mess up the step animation
 
-      if (msg->maxsize - msg->cursize < 16) {
-         Con_Printf("packet overflow\n");
-         return;
-      }
-      // send an update
-      bits = 0;
+   if (ent->baseline.colormap != ent->v.colormap)
+      bits |= U_COLORMAP;
 
-      for (i = 0; i < 3; i++) {
-         miss = ent->v.origin[i] - ent->baseline.origin[i];
-         if (miss < -0.1 || miss > 0.1)
-            bits |= U_ORIGIN1 << i;
-      }
+   if (ent->baseline.skinnum != ent->v.skin)
+      bits |= U_SKIN;
 
-      if (ent->v.angles[0] != ent->baseline.angles[0])
-         bits |= U_ANGLE1;
+   if (ent->baseline.frame != ent->v.frame)
+      bits |= U_FRAME;
 
-      if (ent->v.angles[1] != ent->baseline.angles[1])
-         bits |= U_ANGLE2;
+   if (ent->baseline.effects != ent->v.effects)
+      bits |= U_EFFECTS;
 
-      if (ent->v.angles[2] != ent->baseline.angles[2])
-         bits |= U_ANGLE3;
+   if (ent->baseline.modelindex != ent->v.modelindex)
+      bits |= U_MODEL;
 
-      if (ent->v.movetype == MOVETYPE_STEP)
-         bits |= U_NOLERP;	// don't mess up the step animation
+   /* FIXME - TODO: add alpha stuff here */
 
-      if (ent->baseline.colormap != ent->v.colormap)
-         bits |= U_COLORMAP;
+   if (sv.protocol == PROTOCOL_VERSION_FITZ) {
+      if ((bits & U_FRAME) && ((int)ent->v.frame & 0xff00))
+         bits |= U_FITZ_FRAME2;
+      if ((bits & U_MODEL) && ((int)ent->v.modelindex & 0xff00))
+         bits |= U_FITZ_MODEL2;
+      /* FIXME - Add the U_LERPFINISH bit */
+      if (bits & 0x00ff0000)
+         bits |= U_FITZ_EXTEND1;
+      if (bits & 0xff000000)
+         bits |= U_FITZ_EXTEND2;
+   }
 
-      if (ent->baseline.skinnum != ent->v.skin)
-         bits |= U_SKIN;
+   if (e >= 256)
+      bits |= U_LONGENTITY;
 
-      if (ent->baseline.frame != ent->v.frame)
-         bits |= U_FRAME;
+   if (bits >= 256)
+      bits |= U_MOREBITS;
 
-      if (ent->baseline.effects != ent->v.effects)
-         bits |= U_EFFECTS;
+   //
+   // write the message
+   //
+   p = SZ_Reserve(msg, SV_MAXENTUPDATE);
+   p = MSG_PutByte(p, bits | U_SIGNAL);
+
+   if (bits & U_MOREBITS)
+      p = MSG_PutByte(p, bits >> 8);
+   if (bits & U_FITZ_EXTEND1)
+      p = MSG_PutByte(p, bits >> 16);
+   if (bits & U_FITZ_EXTEND2)
+      p = MSG_PutByte(p, bits >> 24);
+
+   if (bits & U_LONGENTITY)
+      p = MSG_PutShort(p, e);
+   else
+      p = MSG_PutByte(p, e);
 
-      if (ent->baseline.modelindex != ent->v.modelindex)
-         bits |= U_MODEL;
+   if (bits & U_MODEL)
+   {
+      /* as SV_WriteModelIndex does without B_FITZ_LARGEMODEL */
+      if (sv.protocol == PROTOCOL_VERSION_BJP
+            || sv.protocol == PROTOCOL_VERSION_BJP2
+            || sv.protocol == PROTOCOL_VERSION_BJP3)
+         p = MSG_PutShort(p, ent->v.modelindex);
+      else
+         p = MSG_PutByte(p, ent->v.modelindex);
+   }
+   if (bits & U_FRAME)
+      p = MSG_PutByte(p, ent->v.frame);
+   if (bits & U_COLORMAP)
+      p = MSG_PutByte(p, ent->v.colormap);
+   if (bits & U_SKIN)
+      p = MSG_PutByte(p, ent->v.skin);
+   if (bits & U_EFFECTS)
+      p = MSG_PutByte(p, ent->v.effects);
+   if (bits & U_ORIGIN1)
+      p = MSG_PutCoord(p, ent->v.origin[0]);
+   if (bits & U_ANGLE1)
+      p = MSG_PutAngle(p, ent->v.angles[0]);
+   if (bits & U_ORIGIN2)
+      p = MSG_PutCoord(p, ent->v.origin[1]);
+   if (bits & U_ANGLE2)
+      p = MSG_PutAngle(p, ent->v.angles[1]);
+   if (bits & U_ORIGIN3)
+      p = MSG_PutCoord(p, ent->v.origin[2]);
+   if (bits & U_ANGLE3)
+      p = MSG_PutAngle(p, ent->v.angles[2]);
+#if 0 /* FIXME */
+   if (bits & U_FITZ_ALPHA)
+      p = MSG_PutByte(p, ent->alpha);
+#endif
+   if (bits & U_FITZ_FRAME2)
+      p = MSG_PutByte(p, (int)ent->v.frame >> 8);
+   if (bits & U_FITZ_MODEL2)
+      p = MSG_PutByte(p, (int)ent->v.modelindex >> 8);
+#if 0 /* FIXME */
+   if (bits & U_FITZ_LERPFINISH)
+      p = MSG_PutByte(p, (byte)floorf(((ent->v.nextthink - sv.time) * 255.0f) + 0.5f));
+#endif
+   SZ_Commit(msg, p);
+}
 
-      /* FIXME - TODO: add alpha stuff here */
+/*
+=============
+SV_BuildEntityUpdates
 
-      if (sv.protocol == PROTOCOL_VERSION_FITZ) {
-         if ((bits & U_FRAME) && ((int)ent->v.frame & 0xff00))
-            bits |= U_FITZ_FRAME2;
-         if ((bits & U_MODEL) && ((int)ent->v.modelindex & 0xff00))
-            bits |= U_FITZ_MODEL2;
-         /* FIXME - Add the U_LERPFINISH bit */
-         if (bits & 0x00ff0000)
-            bits |= U_FITZ_EXTEND1;
-         if (bits & 0xff000000)
-            bits |= U_FITZ_EXTEND2;
-      }
+Writes this frame's update for each entity with a visible model
+=============
+*/
+static void SV_BuildEntityUpdates(void)
+{
+   int e;
+   edict_t *ent;
+   sizebuf_t buf;
+   entupdate_t *update;
 
-      if (e >= 256)
-         bits |= U_LONGENTITY;
+   buf.data = sv_entupdatedata;
+   buf.maxsize = sizeof(sv_entupdatedata);
+   buf.cursize = 0;
+   buf.allowoverflow = false;
+   buf.overflowed = false;
 
-      if (bits >= 256)
-         bits |= U_MOREBITS;
+   sv_numentupdates = 0;
+   ent = NEXT_EDICT(sv.edicts);
+   for (e = 1; e < sv.num_edicts; e++, ent = NEXT_EDICT(ent)) {
+      // ignore ents without visible models
+      if (!ent->v.modelindex || !*PR_GetString(ent->v.model))
+         continue;
 
-      //
-      // write the message
-      //
-      MSG_WriteByte(msg, bits | U_SIGNAL);
+      update = &sv_entupdates[sv_numentupdates++];
+      update->ent = ent;
+      update->num = e;
+      update->offset = buf.cursize;
+      SV_WriteEntityUpdate(ent, e, &buf);
+      update->length = buf.cursize - update->offset;
+   }
+   sv_entupdatesvalid = true;
+}
 
-      if (bits & U_MOREBITS)
-         MSG_WriteByte(msg, bits >> 8);
-      if (bits & U_FITZ_EXTEND1)
-         MSG_WriteByte(msg, bits >> 16);
-      if (bits & U_FITZ_EXTEND2)
-         MSG_WriteByte(msg, bits >> 24);
+/*
+ * The client's own entity isn't in the updates if it has no model
+ */
+static qboolean SV_WriteClentUpdate(edict_t *clent, int e, sizebuf_t *msg)
+{
+   if (msg->maxsize - msg->cursize < SV_MAXENTUPDATE) {
+      Con_Printf("packet overflow\n");
+      return false;
+   }
+   SV_WriteEntityUpdate(clent, e, msg);
 
-      if (bits & U_LONGENTITY)
-         MSG_WriteShort(msg, e);
-      else
-         MSG_WriteByte(msg, e);
-
-      if (bits & U_MODEL)
-         SV_WriteModelIndex(msg, ent->v.modelindex, 0);
-      if (bits & U_FRAME)
-         MSG_WriteByte(msg, ent->v.frame);
-      if (bits & U_COLORMAP)
-         MSG_WriteByte(msg, ent->v.colormap);
-      if (bits & U_SKIN)
-         MSG_WriteByte(msg, ent->v.skin);
-      if (bits & U_EFFECTS)
-         MSG_WriteByte(msg, ent->v.effects);
-      if (bits & U_ORIGIN1)
-         MSG_WriteCoord(msg, ent->v.origin[0]);
-      if (bits & U_ANGLE1)
-         MSG_WriteAngle(msg, ent->v.angles[0]);
-      if (bits & U_ORIGIN2)
-         MSG_WriteCoord(msg, ent->v.origin[1]);
-      if (bits & U_ANGLE2)
-         MSG_WriteAngle(msg, ent->v.angles[1]);
-      if (bits & U_ORIGIN3)
-         MSG_WriteCoord(msg, ent->v.origin[2]);
-      if (bits & U_ANGLE3)
-         MSG_WriteAngle(msg, ent->v.angles[2]);
-#if 0 /* FIXME */
-      if (bits & U_FITZ_ALPHA)
-         MSG_WriteByte(msg, ent->alpha);
-#endif
-      if (bits & U_FITZ_FRAME2)
-         MSG_WriteByte(msg, (int)ent->v.frame >> 8);
-      if (bits & U_FITZ_MODEL2)
-         MSG_WriteByte(msg, (int)ent->v.modelindex >> 8);
-#if 0 /* FIXME */
-      if (bits & U_FITZ_LERPFINISH)
-         MSG_WriteByte(msg, (byte)floorf(((ent->v.nextthink - sv.time) * 255.0f) + 0.5f));
-#endif
+   return true;
+}
+
+/*
+=============
+SV_WriteEntitiesToClient
+
+=============
+*/
+void SV_WriteEntitiesToClient(edict_t *clent, sizebuf_t *msg)
+{
+   int i, j, clentnum;
+   const leafbits_t *pvs;
+   const entupdate_t *update;
+   vec3_t org;
+   edict_t *ent;
+
+   if (!sv_entupdatesvalid)
+      SV_BuildEntityUpdates();
+
+   // find the client's PVS
+   VectorAdd(clent->v.origin, clent->v.view_ofs, org);
+   pvs = Mod_CachedFatPVS(sv.worldmodel, org,
+         &sv.fatpvs[NUM_FOR_EDICT(clent) - 1]);
+
+   // send over all entities (excpet the client) that touch the pvs
+   clentnum = NUM_FOR_EDICT(clent);
+   update = sv_entupdates;
+   for (i = 0; i < sv_numentupdates; i++, update++) {
+
+      // clent is ALWAYS sent
+      if (update->num == clentnum)
+         clentnum = 0;
+      else {
+         // in its place, even without a visible model
+         if (clentnum && update->num > clentnum) {
+            if (!SV_WriteClentUpdate(clent, clentnum, msg))
+               return;
+            clentnum = 0;
+         }
+
+         // ignore if not touching a PV leaf
+         ent = update->ent;
+         for (j = 0; j < ent->num_leafs; j++)
+            if (Mod_TestLeafBit(pvs, ent->leafnums[j]))
+               break;
+
+         if (j == ent->num_leafs)
+            continue;	// not visible
+      }
+
+      if (msg->maxsize - msg->cursize < qmax(16, update->length)) {
+         Con_Printf("packet overflow\n");
+         return;
+      }
+      SZ_Write(msg, sv_entupdatedata + update->offset, update->length);
    }
+   if (clentnum)
+      SV_WriteClentUpdate(clent, clentnum, msg);
 }
 
 /*
@@ -738,7 +866,7 @@ void SV_WriteClientdataToMessage(edict_t *ent, sizebuf_t *msg)
    // stuff the sigil bits into the high bits of items for sbar, or else
    // mix in items2
    items = ent->v.items;
-   items2 = GetEdictFieldValue(ent, "items2");
+   items2 = ED_EXTFIELD(ent, EXTFIELD_ITEMS2);
    if (items2)
       items |= (int)items2->_float << 23;
    else
@@ -918,19 +1046,22 @@ void SV_UpdateToReliableMessages(void)
 {
    int i, j;
    client_t *client;
-
-   // check for changes to be sent over the reliable streams
+   sizebuf_t frags;
+   byte buf[MAX_SCOREBOARD * 4];
+
+   // check for changes to be sent over the reliable streams, written
+   // once and copied to every client below
+   frags.allowoverflow = false;
+   frags.overflowed = false;
+   frags.data = buf;
+   frags.maxsize = sizeof(buf);
+   frags.cursize = 0;
    for (i = 0, host_client = svs.clients; i < svs.maxclients;
          i++, host_client++) {
       if (host_client->old_frags != host_client->edict->v.frags) {
-         for (j = 0, client = svs.clients; j < svs.maxclients;
-               j++, client++) {
-            if (!client->active)
-               continue;
-            MSG_WriteByte(&client->message, svc_updatefrags);
-            MSG_WriteByte(&client->message, i);
-            MSG_WriteShort(&client->message, host_client->edict->v.frags);
-         }
+         MSG_WriteByte(&frags, svc_updatefrags);
+         MSG_WriteByte(&frags, i);
+         MSG_WriteShort(&frags, host_client->edict->v.frags);
          host_client->old_frags = host_client->edict->v.frags;
       }
    }
@@ -938,6 +1069,7 @@ void SV_UpdateToReliableMessages(void)
    for (j = 0, client = svs.clients; j < svs.maxclients; j++, client++) {
       if (!client->active)
          continue;
+      SZ_Write(&client->message, frags.data, frags.cursize);
       SZ_Write(&client->message, sv.reliable_datagram.data,
             sv.reliable_datagram.cursize);
    }
@@ -985,6 +1117,9 @@ void SV_SendClientMessages(void)
    // update frags, names, etc
    SV_UpdateToReliableMessages();
 
+   // the entity updates are written again for the first datagram
+   sv_entupdatesvalid = false;
+
    // build individual updates
    for (i = 0, host_client = svs.clients; i < svs.maxclients;
          i++, host_client++) {
@@ -1062,10 +1197,8 @@ int SV_ModelIndex(const char *name)
    if (!name || !name[0])
       return 0;
 
-   for (i = 0; i < MAX_MODELS && sv.model_precache[i]; i++)
-      if (!strcmp(sv.model_precache[i], name))
-         return i;
-   if (i == MAX_MODELS || !sv.model_precache[i])
+   i = PR_FindPrecache(&sv.model_hash, sv.model_precache, name);
+   if (i < 0)
       Sys_Error("%s: model %s not precached", __func__, name);
    return i;
 }
@@ -1255,11 +1388,12 @@ void SV_SpawnServer(char *server)
    sv.protocol = sv_protocol;
 
    // load progs to get entity field count
+   Memory_TracePhase("progs");
    PR_LoadProgs();
 
    // allocate server memory
    sv.max_edicts = MAX_EDICTS;
-   sv.edicts = (edict_t*)Hunk_AllocName(sv.max_edicts * pr_edict_size, "edicts");
+   ED_ReserveEdicts();
 
    sv.datagram.maxsize = sizeof(sv.datagram_buf);
    sv.datagram.cursize = 0;
@@ -1273,12 +1407,18 @@ void SV_SpawnServer(char *server)
    sv.signon.cursize = 0;
    sv.signon.data = sv.signon_buf;
 
+   sv.serverinfo.maxsize = sizeof(sv.serverinfo_buf);
+   sv.serverinfo.cursize = 0;
+   sv.serverinfo.data = sv.serverinfo_buf;
+   sv.serverinfo.allowoverflow = true;	// warned about when it's built
+
    // leave slots at start for clients only
    sv.num_edicts = svs.maxclients + 1;
    for (i = 0; i < svs.maxclients; i++) {
       ent = EDICT_NUM(i + 1);
       svs.clients[i].edict = ent;
    }
+   ED_ResetEdicts();
 
    sv.state = ss_loading;
    sv.paused = false;
@@ -1287,6 +1427,7 @@ void SV_SpawnServer(char *server)
 
    strcpy(sv.name, server);
    sprintf(sv.modelname, "maps/%s.bsp", server);
+   Memory_TracePhase("models");
    sv.worldmodel = Mod_ForName(sv.modelname, false);
    if (!sv.worldmodel) {
       Con_Printf("Couldn't spawn server %s\n", sv.modelname);
@@ -1295,17 +1436,22 @@ void SV_SpawnServer(char *server)
    }
    sv.models[1] = sv.worldmodel;
 
+   sv.fatpvs = (mfatpvs_t*)Hunk_AllocName(svs.maxclients * sizeof(*sv.fatpvs),
+         "fatpvs");
+   for (i = 0; i < svs.maxclients; i++)
+      Mod_InitFatPVS(&sv.fatpvs[i], sv.worldmodel);
+
    //
    // clear world interaction links
    //
    SV_ClearWorld();
 
-   sv.sound_precache[0] = pr_strings;
+   PR_AddPrecache(&sv.sound_hash, sv.sound_precache, 0, pr_strings);
 
-   sv.model_precache[0] = pr_strings;
-   sv.model_precache[1] = sv.modelname;
+   PR_AddPrecache(&sv.model_hash, sv.model_precache, 0, pr_strings);
+   PR_AddPrecache(&sv.model_hash, sv.model_precache, 1, sv.modelname);
    for (i = 1; i < sv.worldmodel->numsubmodels; i++) {
-      sv.model_precache[1 + i] = localmodels[i];
+      PR_AddPrecache(&sv.model_hash, sv.model_precache, 1 + i, localmodels[i]);
       sv.models[i + 1] = Mod_ForName(localmodels[i], false);
    }
 
@@ -1330,6 +1476,7 @@ void SV_SpawnServer(char *server)
    // serverflags are for cross level information (sigils)
    pr_global_struct->serverflags = svs.serverflags;
 
+   Memory_TracePhase("entities");
    ED_LoadFromFile(sv.worldmodel->entities);
 
    sv.active = true;
@@ -1345,6 +1492,7 @@ void SV_SpawnServer(char *server)
 
    // create a baseline for more efficient communications
    SV_CreateBaseline();
+   SV_CreateServerinfo();
 
    // send serverinfo to all connected clients
    for (i = 0, host_client = svs.clients; i < svs.maxclients;
@@ -1352,5 +1500,6 @@ void SV_SpawnServer(char *server)
       if (host_client->active)
          SV_SendServerinfo(host_client);
 
+   SV_CmdLogStart();
    Con_DPrintf("Server spawned.\n");
 }
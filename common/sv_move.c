@@ -47,8 +47,9 @@ int c_yes, c_no;
 qboolean SV_CheckBottom(edict_t *ent)
 {
    vec3_t mins, maxs, start, stop;
-   trace_t trace;
-   int x, y;
+   vec3_t starts[4], stops[4];
+   trace_t trace, traces[4];
+   int x, y, i;
    float mid, bottom;
 
    VectorAdd(ent->v.origin, ent->v.mins, mins);
@@ -87,18 +88,21 @@ realcheck:
    mid = bottom = trace.endpos[2];
 
    // the corners must be within 16 of the midpoint
-   for (x = 0; x <= 1; x++)
-      for (y = 0; y <= 1; y++) {
-         start[0] = stop[0] = x ? maxs[0] : mins[0];
-         start[1] = stop[1] = y ? maxs[1] : mins[1];
-
-         trace = SV_Move(start, vec3_origin, vec3_origin, stop, true, ent);
+   for (i = 0; i < 4; i++) {
+      starts[i][0] = stops[i][0] = (i & 2) ? maxs[0] : mins[0];
+      starts[i][1] = stops[i][1] = (i & 1) ? maxs[1] : mins[1];
+      starts[i][2] = start[2];
+      stops[i][2] = stop[2];
+   }
+   SV_MoveBatch(4, starts, stops, vec3_origin, vec3_origin, true, ent,
+         traces);
 
-         if (trace.fraction != 1.0 && trace.endpos[2] > bottom)
-            bottom = trace.endpos[2];
-         if (trace.fraction == 1.0 || mid - trace.endpos[2] > STEPSIZE)
-            return false;
-      }
+   for (i = 0; i < 4; i++) {
+      if (traces[i].fraction != 1.0 && traces[i].endpos[2] > bottom)
+         bottom = traces[i].endpos[2];
+      if (traces[i].fraction == 1.0 || mid - traces[i].endpos[2] > STEPSIZE)
+         return false;
+   }
 
    c_yes++;
    return true;
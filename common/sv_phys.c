@@ -52,6 +52,7 @@ cvar_t sv_stopspeed = { "sv_stopspeed", "100" };
 cvar_t sv_gravity = { "sv_gravity", "800", false, true };
 cvar_t sv_maxvelocity = { "sv_maxvelocity", "2000" };
 cvar_t sv_nostep = { "sv_nostep", "0" };
+cvar_t sv_skipidle = { "sv_skipidle", "1" };
 
 #define	MOVE_EPSILON	0.01
 
@@ -414,7 +415,7 @@ void
 SV_AddGravity(edict_t *ent)
 {
    float ent_gravity = 1.0;
-   eval_t *val       = GetEdictFieldValue(ent, "gravity");
+   eval_t *val       = ED_EXTFIELD(ent, EXTFIELD_GRAVITY);
 
    if (val && val->_float)
       ent_gravity = val->_float;
@@ -482,13 +483,15 @@ TODO/FIXME - update with Hexen 2 code
 void
 SV_PushMove(edict_t *pusher, float movetime)
 {
-   int i, e;
+   int i, e, n, numcheck;
    edict_t *check, *block;
    vec3_t mins, maxs, move;
    vec3_t entorig, pushorig;
+   vec3_t areamins, areamaxs;
    int num_moved;
    edict_t *moved_edict[MAX_EDICTS];
    vec3_t moved_from[MAX_EDICTS];
+   int checknums[MAX_EDICTS * 2 + 1];
 
    if (!pusher->v.velocity[0] && !pusher->v.velocity[1]
          && !pusher->v.velocity[2])
@@ -502,6 +505,9 @@ SV_PushMove(edict_t *pusher, float movetime)
       move[i] = pusher->v.velocity[i] * movetime;
       mins[i] = pusher->v.absmin[i] + move[i];
       maxs[i] = pusher->v.absmax[i] + move[i];
+      /* riders touch the start box, anything else pushed the end one */
+      areamins[i] = qmin(mins[i], pusher->v.absmin[i]);
+      areamaxs[i] = qmax(maxs[i], pusher->v.absmax[i]);
    }
 
    VectorCopy(pusher->v.origin, pushorig);
@@ -514,9 +520,11 @@ SV_PushMove(edict_t *pusher, float movetime)
 
    /* see if any solid entities are inside the final position */
    num_moved = 0;
-   check = NEXT_EDICT(sv.edicts);
-   for (e = 1; e < sv.num_edicts; e++, check = NEXT_EDICT(check))
+   numcheck = SV_BoxEdicts(areamins, areamaxs, checknums);
+   for (n = 0; n < numcheck; n++)
    {
+      e = checknums[n];
+      check = EDICT_NUM(e);
       if (check->free)
          continue;
       if (check->v.movetype == MOVETYPE_PUSH
@@ -569,6 +577,7 @@ SV_PushMove(edict_t *pusher, float movetime)
             /* corpse */
             check->v.mins[0] = check->v.mins[1] = 0;
             VectorCopy(check->v.mins, check->v.maxs);
+            ED_Unplaced(e);
             continue;
          }
 
@@ -1242,6 +1251,28 @@ SV_Physics_Step(edict_t *ent)
 
 //============================================================================
 
+/*
+================
+SV_MarkIdle
+
+Lets SV_Physics pass over a free or MOVETYPE_NONE edict until it is
+woken or its nextthink comes round
+================
+*/
+static void
+SV_MarkIdle(edict_t *ent, int num)
+{
+   if (num <= svs.maxclients)
+      return;
+
+   if (ent->free)
+      ED_Sleep(num, 0);
+   else if (ent->v.movetype == MOVETYPE_NONE)
+      ED_Sleep(num, ent->v.nextthink);
+   else
+      ED_Wake(num);
+}
+
 /*
 ================
 SV_Physics
@@ -1265,12 +1296,22 @@ SV_Physics(void)
 
    //SV_CheckAllEnts ();
 
+   /* the sleeping edicts due to think, as SV_RunThink decides */
+   ED_WakeThinkers(sv.time + host_frametime);
+
    /* treat each object in turn */
    ent = sv.edicts;
    for (i = 0; i < sv.num_edicts; i++, ent = NEXT_EDICT(ent))
    {
+      /* pass over what SV_Physics_None would do nothing with */
+      if (ed_idle[i] && sv_skipidle.value && !pr_global_struct->force_retouch)
+         continue;
+
       if (ent->free)
+      {
+         SV_MarkIdle(ent, i);
          continue;
+      }
 
 #ifdef HEXEN2
       ent2 = PROG_TO_EDICT(ent->v.movechain);
@@ -1281,6 +1322,7 @@ SV_Physics(void)
       }
 #endif
 
+      ed_moving = i;
       if (pr_global_struct->force_retouch)
          SV_LinkEdict(ent, true);	/* force retouch even for stationary */
 
@@ -1310,6 +1352,9 @@ SV_Physics(void)
       else
          Sys_Error("%s: bad movetype %i", __func__, (int)ent->v.movetype);
 
+      ed_moving = -1;
+      SV_MarkIdle(ent, i);
+
 #ifdef HEXEN2
       if (ent2 != sv.edicts)
       {
@@ -648,7 +648,10 @@ nextmsg:
                else
 #endif
                if (ret == 1)
+               {
+                  SV_CmdLogCommand(s);
                   Cmd_ExecuteString(s, src_client);
+               }
                else
                   Con_DPrintf("%s tried to %s\n", host_client->name, s);
                break;
@@ -659,6 +662,7 @@ nextmsg:
 
             case clc_move:
                SV_ReadClientMove(&host_client->cmd);
+               SV_CmdLogMove();
                break;
 
 #ifdef HEXEN2
@@ -712,6 +716,9 @@ void SV_RunClients(void)
 
       /* always pause in single player if in console or menus */
       if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game))
+      {
+         SV_CmdLogThink();
          SV_ClientThink();
+      }
    }
 }
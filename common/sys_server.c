@@ -0,0 +1,347 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sys_server.c -- the dedicated server's system layer and main loop
+
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "host.h"
+#include "jobs.h"
+#include "net.h"
+#include "net_udp.h"
+#include "quakedef.h"
+#include "sys.h"
+#include "zone.h"
+
+#define SERVER_MEMSIZE_MB 32
+#define MAX_INSTANCES 256
+
+qboolean isDedicated = true;
+
+static qboolean stdin_ready;
+static qboolean do_stdin = true;
+
+void Sys_Printf(const char *fmt, ...)
+{
+   va_list argptr;
+   char text[MAX_PRINTMSG];
+   unsigned char *p;
+
+   va_start(argptr, fmt);
+   vsnprintf(text, sizeof(text), fmt, argptr);
+   va_end(argptr);
+
+   for (p = (unsigned char *)text; *p; p++)
+   {
+      *p &= 0x7f;
+      if ((*p > 128 || *p < 32) && *p != 10 && *p != 13 && *p != 9)
+         printf("[%02x]", *p);
+      else
+         putc(*p, stdout);
+   }
+   fflush(stdout);
+}
+
+bool Sys_Error(const char *error, ...)
+{
+   va_list argptr;
+   char string[MAX_PRINTMSG];
+
+   va_start(argptr, error);
+   vsnprintf(string, sizeof(string), error, argptr);
+   va_end(argptr);
+   fprintf(stderr, "Fatal error: %s\n", string);
+
+   if (host_initialized)
+      Host_Shutdown();
+   exit(1);
+}
+
+void Sys_Quit(void)
+{
+   Host_Shutdown();
+   exit(0);
+}
+
+/*
+============
+Sys_FileTime
+
+returns -1 if not present
+============
+*/
+int Sys_FileTime(const char *path)
+{
+   struct stat buf;
+
+   if (stat(path, &buf) == -1)
+      return -1;
+
+   return buf.st_mtime;
+}
+
+void Sys_mkdir(const char *path)
+{
+   if (mkdir(path, 0777) != -1)
+      return;
+   if (errno != EEXIST)
+      Sys_Error("mkdir %s: %s", path, strerror(errno));
+}
+
+void Sys_DebugLog(const char *file, const char *fmt, ...)
+{
+   va_list argptr;
+   FILE *f;
+
+   f = fopen(file, "a");
+   if (!f)
+      return;
+   va_start(argptr, fmt);
+   vfprintf(f, fmt, argptr);
+   va_end(argptr);
+   fclose(f);
+}
+
+double Sys_DoubleTime(void)
+{
+   struct timeval tp;
+   static int secbase;
+
+   gettimeofday(&tp, NULL);
+
+   if (!secbase)
+   {
+      secbase = tp.tv_sec;
+      return tp.tv_usec / 1000000.0;
+   }
+
+   return (tp.tv_sec - secbase) + tp.tv_usec / 1000000.0;
+}
+
+/*
+================
+Sys_ConsoleInput
+
+A line typed at the terminal, once the main loop's select says there is
+one
+================
+*/
+char *Sys_ConsoleInput(void)
+{
+   static char text[256];
+   int len;
+
+   if (!stdin_ready || !do_stdin)
+      return NULL;
+   stdin_ready = false;
+
+   len = read(0, text, sizeof(text) - 1);
+   if (len == 0)
+   {
+      /* end of file, there's no terminal to listen to */
+      do_stdin = false;
+      return NULL;
+   }
+   if (len < 1)
+      return NULL;
+   text[len] = 0;
+
+   return text;
+}
+
+void Sys_SendKeyEvents(void)
+{
+}
+
+/*
+ * Sleeps until it's time for the next frame. A packet can bring the frame
+ * forward, as long as it doesn't run faster than host_maxfps; a line on
+ * the terminal wakes it at any time.
+ */
+static void Sys_WaitForFrame(double lastframe)
+{
+   struct timeval timeout;
+   fd_set fdset;
+   double now, left, wait, mintime;
+   int maxfd;
+
+   mintime = host_maxfps.value > 0 ? 1.0 / host_maxfps.value : 0;
+   if (sys_ticrate.value > mintime)
+      wait = sys_ticrate.value;
+   else
+      wait = mintime;
+
+   while (1)
+   {
+      now = Sys_DoubleTime();
+      if (now >= lastframe + wait)
+         return;
+
+      FD_ZERO(&fdset);
+      maxfd = 0;
+      if (now >= lastframe + mintime)
+         maxfd = UDP_SocketSet(&fdset);
+      if (do_stdin && !stdin_ready)
+      {
+         FD_SET(0, &fdset);
+         if (maxfd < 1)
+            maxfd = 1;
+      }
+
+      if (now < lastframe + mintime)
+         left = lastframe + mintime - now;
+      else
+         left = lastframe + wait - now;
+      timeout.tv_sec = (long)left;
+      timeout.tv_usec = (long)((left - timeout.tv_sec) * 1000000);
+
+      if (select(maxfd, &fdset, NULL, NULL, &timeout) <= 0)
+         continue;
+
+      if (do_stdin && FD_ISSET(0, &fdset))
+         stdin_ready = true;
+      return;
+   }
+}
+
+/*
+ * -instances <n> runs n matches from the one start. Once the first frame
+ * has loaded the map, the process forks the others, each listening on the
+ * next port up. What is loaded by then (the pak directories and, with
+ * -mmap, the paks themselves, the progs and the map's models, all on the
+ * hunk) stays shared copy-on-write between them until a match changes it.
+ * Only the first instance reads the terminal, and on Linux the others go
+ * when it does.
+ *
+ * A child of fork() only has the thread that called it, so the job
+ * workers are stopped first, with no lock held, and every instance starts
+ * its own afterwards.
+ */
+static void Sys_StartInstances(void)
+{
+   int i, count, port;
+   pid_t pid;
+
+   i = COM_CheckParm("-instances");
+   if (!i || i >= com_argc - 1)
+      return;
+   count = Q_atoi(com_argv[i + 1]);
+   if (count > MAX_INSTANCES)
+      count = MAX_INSTANCES;
+
+   if (count < 2)
+      return;
+
+   /* nobody waits for the instances, so don't leave them as zombies */
+   signal(SIGCHLD, SIG_IGN);
+   Job_Shutdown();
+
+   port = net_hostport;
+   for (i = 1; i < count; i++)
+   {
+      pid = fork();
+      if (pid == -1)
+      {
+         Con_Printf("Couldn't start instance %d: %s\n", i, strerror(errno));
+         break;
+      }
+      if (pid)
+         continue;
+
+#ifdef __linux__
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+      do_stdin = false;
+      Con_Printf("Instance %d on port %d\n", i, port + i);
+      Cbuf_AddText("port %d\n", port + i);
+      Cbuf_Execute();
+      break;
+   }
+
+   Job_Init();
+}
+
+int main(int argc, const char *argv[])
+{
+   static const char *args[MAX_NUM_ARGVS];
+   quakeparms_t parms;
+   double oldtime, newtime;
+   int i;
+
+   memset(&parms, 0, sizeof(parms));
+
+   /* always dedicated, to eight players unless told otherwise */
+   for (i = 0; i < argc && i < MAX_NUM_ARGVS - 1; i++)
+      args[i] = argv[i];
+   COM_InitArgv(i, args);
+   if (!COM_CheckParm("-dedicated"))
+      args[i++] = "-dedicated";
+   COM_InitArgv(i, args);
+
+   parms.argc = com_argc;
+   parms.argv = com_argv;
+   parms.basedir = stringify(QBASEDIR);
+   parms.savedir = parms.basedir;
+
+   parms.memsize = SERVER_MEMSIZE_MB * 1024 * 1024;
+   i = COM_CheckParm("-mem");
+   if (i && i < com_argc - 1)
+      parms.memsize = (int)(Q_atof(com_argv[i + 1]) * 1024 * 1024);
+   parms.membase = Memory_Reserve(parms.memsize);
+   if (!parms.membase)
+      Sys_Error("Can't allocate %d", parms.memsize);
+
+   if (!Host_Init(&parms))
+      Sys_Error("Couldn't start the server");
+
+   oldtime = Sys_DoubleTime() - 0.1;
+   newtime = Sys_DoubleTime();
+   Host_Frame(newtime - oldtime);
+   oldtime = newtime;
+
+   Sys_StartInstances();
+
+   while (1)
+   {
+      Sys_WaitForFrame(oldtime);
+
+      newtime = Sys_DoubleTime();
+      Host_Frame(newtime - oldtime);
+      oldtime = newtime;
+   }
+
+   return 0;
+}
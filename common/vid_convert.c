@@ -0,0 +1,152 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+// vid_convert.c -- converting the 8-bit frame to the output pixel formats
+
+#include "vid.h"
+#include "vid_convert.h"
+
+#if defined(__ARM_NEON) && defined(__aarch64__) && !defined(MSB_FIRST)
+#include <arm_neon.h>
+#define VID_NEON_TBL
+#endif
+
+unsigned short d_8to16table[256];
+uint32_t d_8to32table[256];
+
+#ifdef VID_NEON_TBL
+/* low and high bytes of d_8to16table, split for table lookups */
+static uint8_t d_8to16lo[256];
+static uint8_t d_8to16hi[256];
+#endif
+
+void VID_UpdateConvertTables(void)
+{
+#ifdef VID_NEON_TBL
+   unsigned i;
+
+   for (i = 0; i < 256; i++)
+   {
+      d_8to16lo[i] = d_8to16table[i] & 0xff;
+      d_8to16hi[i] = d_8to16table[i] >> 8;
+   }
+#endif
+}
+
+#ifdef VID_NEON_TBL
+static INLINE uint8x16x4_t VID_LoadTable(const uint8_t *table)
+{
+   uint8x16x4_t t;
+
+   t.val[0] = vld1q_u8(table);
+   t.val[1] = vld1q_u8(table + 16);
+   t.val[2] = vld1q_u8(table + 32);
+   t.val[3] = vld1q_u8(table + 48);
+
+   return t;
+}
+
+/*
+ * 16 pixels at a time: look up the low and high bytes of each colour with
+ * four chained 64-byte table lookups each (indices outside the 64 entries of
+ * a sub-table leave the result alone), then interleave them on the store.
+ */
+static unsigned VID_ConvertSpanNEON(const uint8_t *in, uint16_t *out,
+      unsigned count)
+{
+   unsigned done = 0;
+   const uint8x16_t c64  = vdupq_n_u8(64);
+   const uint8x16_t c128 = vdupq_n_u8(128);
+   const uint8x16_t c192 = vdupq_n_u8(192);
+   const uint8x16x4_t lo0 = VID_LoadTable(d_8to16lo);
+   const uint8x16x4_t lo1 = VID_LoadTable(d_8to16lo + 64);
+   const uint8x16x4_t lo2 = VID_LoadTable(d_8to16lo + 128);
+   const uint8x16x4_t lo3 = VID_LoadTable(d_8to16lo + 192);
+   const uint8x16x4_t hi0 = VID_LoadTable(d_8to16hi);
+   const uint8x16x4_t hi1 = VID_LoadTable(d_8to16hi + 64);
+   const uint8x16x4_t hi2 = VID_LoadTable(d_8to16hi + 128);
+   const uint8x16x4_t hi3 = VID_LoadTable(d_8to16hi + 192);
+
+   for (; done + 16 <= count; done += 16, in += 16, out += 16)
+   {
+      uint8x16x2_t px;
+      uint8x16_t idx0 = vld1q_u8(in);
+      uint8x16_t idx1 = vsubq_u8(idx0, c64);
+      uint8x16_t idx2 = vsubq_u8(idx0, c128);
+      uint8x16_t idx3 = vsubq_u8(idx0, c192);
+
+      px.val[0] = vqtbl4q_u8(lo0, idx0);
+      px.val[0] = vqtbx4q_u8(px.val[0], lo1, idx1);
+      px.val[0] = vqtbx4q_u8(px.val[0], lo2, idx2);
+      px.val[0] = vqtbx4q_u8(px.val[0], lo3, idx3);
+      px.val[1] = vqtbl4q_u8(hi0, idx0);
+      px.val[1] = vqtbx4q_u8(px.val[1], hi1, idx1);
+      px.val[1] = vqtbx4q_u8(px.val[1], hi2, idx2);
+      px.val[1] = vqtbx4q_u8(px.val[1], hi3, idx3);
+      vst2q_u8((uint8_t*)out, px);
+   }
+
+   return done;
+}
+#endif
+
+void VID_ConvertSpanScalar(const uint8_t *in, uint16_t *out,
+      unsigned count)
+{
+   const uint16_t *pal = d_8to16table;
+
+   for (; count >= 4; count -= 4, in += 4, out += 4)
+   {
+      out[0] = pal[in[0]];
+      out[1] = pal[in[1]];
+      out[2] = pal[in[2]];
+      out[3] = pal[in[3]];
+   }
+   while (count--)
+      *out++ = pal[*in++];
+}
+
+void VID_ConvertSpan(const uint8_t *in, uint16_t *out, unsigned count)
+{
+#ifdef VID_NEON_TBL
+   unsigned done = VID_ConvertSpanNEON(in, out, count);
+
+   in    += done;
+   out   += done;
+   count -= done;
+#endif
+   VID_ConvertSpanScalar(in, out, count);
+}
+
+void VID_ConvertSpan32(const uint8_t *in, uint32_t *out,
+      unsigned count)
+{
+   const uint32_t *pal = d_8to32table;
+
+   for (; count >= 4; count -= 4, in += 4, out += 4)
+   {
+      out[0] = pal[in[0]];
+      out[1] = pal[in[1]];
+      out[2] = pal[in[2]];
+      out[3] = pal[in[3]];
+   }
+   while (count--)
+      *out++ = pal[*in++];
+}
@@ -0,0 +1,40 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef VID_CONVERT_H
+#define VID_CONVERT_H
+
+/* vid_convert.h -- converting the 8-bit frame to the output pixel formats */
+
+#include <stdint.h>
+
+/* d_8to16table (vid.h) is the RGB565 palette */
+extern uint32_t d_8to32table[256];	/* XRGB8888 output */
+
+/* Call after changing d_8to16table, before converting with it */
+void VID_UpdateConvertTables(void);
+
+void VID_ConvertSpan(const uint8_t *in, uint16_t *out, unsigned count);
+void VID_ConvertSpan32(const uint8_t *in, uint32_t *out, unsigned count);
+
+/* The plain C conversion, which VID_ConvertSpan gives the same results as */
+void VID_ConvertSpanScalar(const uint8_t *in, uint16_t *out, unsigned count);
+
+#endif /* VID_CONVERT_H */
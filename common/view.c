@@ -482,7 +482,7 @@ void V_DropCShift (cshift_t *cs, float droprate)
 V_UpdatePalette
 =============
 */
-void V_UpdatePalette(void)
+qboolean V_UpdatePalette(void)
 {
    int i, j;
    qboolean newobj;
@@ -515,7 +515,7 @@ void V_UpdatePalette(void)
 
    force = V_CheckGamma();
    if (!newobj && !force)
-      return;
+      return false;
 
    basepal = host_basepal;
    newpal  = pal;
@@ -544,6 +544,8 @@ void V_UpdatePalette(void)
    }
 
    VID_ShiftPalette(pal);
+
+   return true;
 }
 
 /*
@@ -863,13 +865,12 @@ void V_CalcRefdef(void)
 
 /*
 ==================
-V_RenderView
+V_UpdateView
 
-The player's clipping box goes from (-16 -16 -24) to (16 16 32) from
-the entity origin, so any view position inside that will be valid
+Everything V_RenderView does to the view over time, without drawing it
 ==================
 */
-void V_RenderView(void)
+void V_UpdateView(void)
 {
    if (con_forcedup)
       return;
@@ -889,7 +890,22 @@ void V_RenderView(void)
       if (!cl.paused /* && (sv.maxclients > 1 || key_dest == key_game) */ )
          V_CalcRefdef();
    }
+}
+
+/*
+==================
+V_RenderView
+
+The player's clipping box goes from (-16 -16 -24) to (16 16 32) from
+the entity origin, so any view position inside that will be valid
+==================
+*/
+void V_RenderView(void)
+{
+   if (con_forcedup)
+      return;
 
+   V_UpdateView();
    R_RenderView();
 
    if (crosshair.value)
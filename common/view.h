@@ -31,7 +31,8 @@ extern cvar_t crosshaircolor;
 
 void V_Init(void);
 void V_RenderView(void);
-void V_UpdatePalette(void);
+void V_UpdateView(void);
+qboolean V_UpdatePalette(void);	/* true if it changed the palette */
 void V_CalcBlend(void);
 
 float V_CalcRoll(vec3_t angles, vec3_t velocity);
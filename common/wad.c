@@ -20,14 +20,27 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // wad.c
 
 #include "common.h"
+#include "namehash.h"
 #include "quakedef.h"
 #include "sys.h"
 #include "wad.h"
+#include "zone.h"
 
 int wad_numlumps;
 lumpinfo_t *wad_lumps;
 byte *wad_base;
 
+static int wad_lumpchains[256];
+static namehash_t wad_lumphash;
+
+/* The lump names are only terminated if shorter than the 16 they fill */
+static const char *W_LumpName(const char *name, char *buf)
+{
+   memcpy(buf, name, 16);
+   buf[16] = 0;
+   return buf;
+}
+
 void SwapPic(qpic_t *pic);
 
 /*
@@ -74,6 +87,7 @@ bool W_LoadWadFile(const char *filename)
    wadinfo_t *header;
    unsigned i;
    int infotableofs;
+   char name[17];
 
    wad_base = (byte*)COM_LoadHunkFile(filename);
    if (!wad_base)
@@ -95,6 +109,8 @@ bool W_LoadWadFile(const char *filename)
    infotableofs = (header->infotableofs);
 #endif
    wad_lumps    = (lumpinfo_t *)(wad_base + infotableofs);
+   NameHash_Init(&wad_lumphash, wad_lumpchains, 256,
+         (int*)Hunk_AllocName(wad_numlumps * sizeof(int), "wadhash"));
 
    for (i = 0, lump_p = wad_lumps; i < wad_numlumps; i++, lump_p++)
    {
@@ -103,6 +119,7 @@ bool W_LoadWadFile(const char *filename)
       lump_p->size    = LittleLong(lump_p->size);
 #endif
       W_CleanupName(lump_p->name, lump_p->name);
+      NameHash_Insert(&wad_lumphash, W_LumpName(lump_p->name, name), i);
 #ifdef MSB_FIRST
       if (lump_p->type == TYP_QPIC)
          SwapPic((qpic_t *)(wad_base + lump_p->filepos));
@@ -121,15 +138,16 @@ W_GetLumpinfo
 lumpinfo_t * W_GetLumpinfo(const char *name)
 {
    int i;
-   lumpinfo_t *lump_p;
-   char clean[16];
+   char clean[17];
 
    W_CleanupName(name, clean);
+   clean[16] = 0;
 
-   for (lump_p = wad_lumps, i = 0; i < wad_numlumps; i++, lump_p++)
+   for (i = NameHash_First(&wad_lumphash, clean); i >= 0;
+         i = NameHash_Next(&wad_lumphash, i))
    {
-      if (!strcmp(clean, lump_p->name))
-         return lump_p;
+      if (!strncmp(clean, wad_lumps[i].name, 16))
+         return &wad_lumps[i];
    }
 
    Sys_Error("%s: %s not found", __func__, name);
@@ -19,18 +19,24 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // world.c -- world query functions
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "bspfile.h"
+#include "cmd.h"
 #include "console.h"
+#include "cvar.h"
 #include "mathlib.h"
 #include "model.h"
 #include "progs.h"
 #include "server.h"
+#include "sys.h"
 #include "world.h"
 
 #ifdef NQ_HACK
 #include "host.h"
 #include "quakedef.h"
-#include "sys.h"
 /* FIXME - quick hack to enable merging of NQ/QWSV shared code */
 #define SV_Error Sys_Error
 #endif
@@ -57,6 +63,7 @@ typedef struct {
     trace_t trace;
     int type;
     edict_t *passedict;
+    unsigned rewound;		// clients clipped at other origins (QWSV)
 } moveclip_t;
 
 
@@ -73,6 +80,7 @@ HULL BOXES
 
 static hull_t box_hull;
 static mclipnode_t box_clipnodes[6];
+static mhullnode_t box_hullnodes[6];
 static mplane_t box_planes[6];
 static	int			move_type;
 
@@ -110,6 +118,9 @@ static void SV_InitBoxHull(void)
       box_planes[i].type = i >> 1;
       box_planes[i].normal[i >> 1] = 1;
    }
+
+   box_hull.hullnodes = box_hullnodes;
+   Mod_PackHullNodes(box_hullnodes, box_clipnodes, 6, box_planes);
 }
 
 
@@ -129,6 +140,12 @@ static hull_t *SV_HullForBox(vec3_t mins, vec3_t maxs)
     box_planes[3].dist = mins[1];
     box_planes[4].dist = maxs[2];
     box_planes[5].dist = mins[2];
+    box_hullnodes[0].dist = maxs[0];
+    box_hullnodes[1].dist = mins[0];
+    box_hullnodes[2].dist = maxs[1];
+    box_hullnodes[3].dist = mins[1];
+    box_hullnodes[4].dist = maxs[2];
+    box_hullnodes[5].dist = mins[2];
 
     return &box_hull;
 }
@@ -237,19 +254,37 @@ ENTITY AREA CHECKING
 ===============================================================================
 */
 
+/*
+ * The area nodes split the world in two along x or y, down to sv_areadepth
+ * levels. An edict is linked to the deepest node its box fits under, so
+ * one straddling a split stays on the node above. With sv_arealoose set,
+ * each child reaches past the split by that fraction of its own width
+ * (bounds[0] is where children[0] starts, bounds[1] where children[1]
+ * ends), letting edicts near a split sink into a child rather than
+ * crowding the node above.
+ */
 typedef struct areanode_s {
     int axis;			// -1 = leaf node
     float dist;
+    float bounds[2];		// loose edges of the children on axis
     struct areanode_s *children[2];
     link_t trigger_edicts;
     link_t solid_edicts;
 } areanode_t;
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	32
+#define	AREA_MAXDEPTH	8
+#define	AREA_NODES	(1 << (AREA_MAXDEPTH + 1))
+#define	AREA_LEAFSIZE	512	// sv_areadepth 0 splits leaves down to this
+
+cvar_t sv_areadepth = { "sv_areadepth", "4" };
+cvar_t sv_arealoose = { "sv_arealoose", "0" };
 
 static areanode_t sv_areanodes[AREA_NODES];
 static int sv_numareanodes;
+static int sv_areanodedepth;	// the settings this map's nodes were built
+static float sv_areanodeloose;	// with
+
+static int sv_worldnum;		// counts the maps SV_ClearWorld was run for
 
 #if defined(QW_HACK) && defined(SERVERONLY)
 /*
@@ -308,9 +343,9 @@ SV_AddLinksToPmove_r(const areanode_t *node, const vec3_t mins,
    if (node->axis == -1)
       return;
 
-   if (maxs[node->axis] > node->dist)
+   if (maxs[node->axis] > node->bounds[0])
       SV_AddLinksToPmove_r(node->children[0], mins, maxs);
-   if (mins[node->axis] < node->dist)
+   if (mins[node->axis] < node->bounds[1])
       SV_AddLinksToPmove_r(node->children[1], mins, maxs);
 }
 
@@ -332,6 +367,7 @@ SV_CreateAreaNode(int depth, vec3_t mins, vec3_t maxs)
    areanode_t *anode;
    vec3_t size;
    vec3_t mins1, maxs1, mins2, maxs2;
+   float margin;
 
    anode = &sv_areanodes[sv_numareanodes];
    sv_numareanodes++;
@@ -339,7 +375,7 @@ SV_CreateAreaNode(int depth, vec3_t mins, vec3_t maxs)
    ClearLink(&anode->trigger_edicts);
    ClearLink(&anode->solid_edicts);
 
-   if (depth == AREA_DEPTH)
+   if (depth == sv_areanodedepth)
    {
       anode->axis = -1;
       anode->children[0] = anode->children[1] = NULL;
@@ -353,6 +389,9 @@ SV_CreateAreaNode(int depth, vec3_t mins, vec3_t maxs)
       anode->axis = 1;
 
    anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
+   margin = sv_areanodeloose * 0.5 * size[anode->axis];
+   anode->bounds[0] = anode->dist - margin;
+   anode->bounds[1] = anode->dist + margin;
    VectorCopy(mins, mins1);
    VectorCopy(mins, mins2);
    VectorCopy(maxs, maxs1);
@@ -372,11 +411,50 @@ SV_ClearWorld
 
 ===============
 */
+/*
+ * The depth sv_areadepth asks for, 0 meaning enough splits to bring the
+ * world's leaves down to about AREA_LEAFSIZE across
+ */
+static int
+SV_AreaDepth(const vec3_t mins, const vec3_t maxs)
+{
+   vec3_t size;
+   int depth;
+
+   depth = sv_areadepth.value;
+   if (depth > 0)
+      return depth < AREA_MAXDEPTH ? depth : AREA_MAXDEPTH;
+
+   VectorSubtract(maxs, mins, size);
+   for (depth = 0; depth < AREA_MAXDEPTH; depth++) {
+      if (size[0] <= AREA_LEAFSIZE && size[1] <= AREA_LEAFSIZE)
+         break;
+      if (size[0] > size[1])
+         size[0] *= 0.5;
+      else
+         size[1] *= 0.5;
+   }
+
+   return depth;
+}
+
+static float
+SV_AreaLoose(void)
+{
+   if (!(sv_arealoose.value >= 0))
+      return 0;
+   return sv_arealoose.value < 1 ? sv_arealoose.value : 1;
+}
+
 void
 SV_ClearWorld(void)
 {
    SV_InitBoxHull();
 
+   sv_worldnum++;		/* drops what was cached from the last map */
+   sv_areanodedepth = SV_AreaDepth(sv.worldmodel->mins, sv.worldmodel->maxs);
+   sv_areanodeloose = SV_AreaLoose();
+
    memset(sv_areanodes, 0, sizeof(sv_areanodes));
    sv_numareanodes = 0;
    SV_CreateAreaNode(0, sv.worldmodel->mins, sv.worldmodel->maxs);
@@ -396,6 +474,80 @@ SV_UnlinkEdict(edict_t *ent)
       return;			// not linked in anywhere
    RemoveLink(&ent->area);
    ent->area.prev = ent->area.next = NULL;
+   ED_Unplaced(NUM_FOR_EDICT(ent));
+}
+
+/*
+====================
+SV_AreaEdicts
+
+Each edict is linked once, so MAX_EDICTS is room enough for nums
+====================
+*/
+static int
+SV_AreaEdicts_r(const areanode_t *node, const vec3_t mins, const vec3_t maxs,
+                int *nums, int count)
+{
+   const link_t *l;
+
+   for (l = node->solid_edicts.next; l != &node->solid_edicts; l = l->next)
+      nums[count++] = NUM_FOR_EDICT(EDICT_FROM_AREA(l));
+   for (l = node->trigger_edicts.next; l != &node->trigger_edicts; l = l->next)
+      nums[count++] = NUM_FOR_EDICT(EDICT_FROM_AREA(l));
+
+   if (node->axis == -1)
+      return count;
+
+   if (maxs[node->axis] >= node->bounds[0])
+      count = SV_AreaEdicts_r(node->children[0], mins, maxs, nums, count);
+   if (mins[node->axis] <= node->bounds[1])
+      count = SV_AreaEdicts_r(node->children[1], mins, maxs, nums, count);
+
+   return count;
+}
+
+int
+SV_AreaEdicts(const vec3_t mins, const vec3_t maxs, int *nums)
+{
+   return SV_AreaEdicts_r(sv_areanodes, mins, maxs, nums, 0);
+}
+
+static int
+SV_CompareNums(const void *a, const void *b)
+{
+   return *(const int *)a - *(const int *)b;
+}
+
+/*
+====================
+SV_BoxEdicts
+
+Every edict whose box may touch the given one: those on the area nodes it
+reaches and the unplaced ones. nums needs room for MAX_EDICTS * 2 + 1 and
+comes back in edict order without repeats, so a loop over it visits the
+edicts just as a scan of them all would, minus the ones far away.
+====================
+*/
+int
+SV_BoxEdicts(const vec3_t mins, const vec3_t maxs, int *nums)
+{
+   int i, count, unique;
+
+   count = SV_AreaEdicts(mins, maxs, nums);
+   count += ED_UnplacedEdicts(nums + count);
+   qsort(nums, count, sizeof(nums[0]), SV_CompareNums);
+
+   unique = 0;
+   for (i = 0; i < count; i++)
+   {
+      if (nums[i] < 1 || nums[i] >= sv.num_edicts)
+         continue;
+      if (unique && nums[i] == nums[unique - 1])
+         continue;
+      nums[unique++] = nums[i];
+   }
+
+   return unique;
 }
 
 
@@ -453,25 +605,47 @@ static void SV_TouchLinks(edict_t *ent, areanode_t *node)
    if (node->axis == -1)
       return;
 
-   if (ent->v.absmax[node->axis] > node->dist)
+   if (ent->v.absmax[node->axis] > node->bounds[0])
       SV_TouchLinks(ent, node->children[0]);
-   if (ent->v.absmin[node->axis] < node->dist)
+   if (ent->v.absmin[node->axis] < node->bounds[1])
       SV_TouchLinks(ent, node->children[1]);
 }
 
 
+/*
+ * The leafs an edict is in only depend on its abs box. Each edict keeps
+ * the box its leafs were found for and how far the box's edges could have
+ * been moved without changing which side of any plane the walk tested it
+ * against. Linking it again with every edge that close to where it was
+ * gives the same leafs, so the walk is skipped.
+ */
+#define LEAF_EPSILON	0.0625
+#define LEAF_LIMIT	16384	// boxes reaching further out aren't cached
+
+typedef struct {
+   vec3_t absmin, absmax;
+   float slack;			// LEAF_EPSILON taken off
+   int num_leafs;		// to catch num_leafs being reset elsewhere
+   int world;			// sv_worldnum when found, 0 for never
+} leafcache_t;
+
+static leafcache_t sv_leafcache[MAX_EDICTS];
+
 /*
 ===============
 SV_FindTouchedLeafs
 
+Slack is brought down to how far the box could move before the test at
+any node on the way changes.
 ===============
 */
 static void
-SV_FindTouchedLeafs(edict_t *ent, mnode_t *node)
+SV_FindTouchedLeafs(edict_t *ent, mnode_t *node, float *slack)
 {
    mplane_t *splitplane;
    mleaf_t *leaf;
-   int sides;
+   int sides, i;
+   float dist1, dist2, margin, scale;
 
    if (node->contents == CONTENTS_SOLID)
       return;
@@ -497,12 +671,84 @@ SV_FindTouchedLeafs(edict_t *ent, mnode_t *node)
    splitplane = node->plane;
    sides = BOX_ON_PLANE_SIDE(ent->v.absmin, ent->v.absmax, splitplane);
 
+   if (splitplane->type < 3)
+   {
+      dist1 = ent->v.absmax[splitplane->type];
+      dist2 = ent->v.absmin[splitplane->type];
+      scale = 1;
+   }
+   else
+   {
+      dist1 = dist2 = scale = 0;
+      for (i = 0; i < 3; i++)
+      {
+         if (splitplane->normal[i] < 0)
+         {
+            dist1 += splitplane->normal[i] * ent->v.absmin[i];
+            dist2 += splitplane->normal[i] * ent->v.absmax[i];
+            scale -= splitplane->normal[i];
+         }
+         else
+         {
+            dist1 += splitplane->normal[i] * ent->v.absmax[i];
+            dist2 += splitplane->normal[i] * ent->v.absmin[i];
+            scale += splitplane->normal[i];
+         }
+      }
+   }
+   /* an inside out box has dist2 above dist1 */
+   if (sides == PSIDE_FRONT)
+      margin = (dist1 < dist2 ? dist1 : dist2) - splitplane->dist;
+   else if (sides == PSIDE_BACK)
+      margin = splitplane->dist - (dist1 > dist2 ? dist1 : dist2);
+   else if (dist1 - splitplane->dist < splitplane->dist - dist2)
+      margin = dist1 - splitplane->dist;
+   else
+      margin = splitplane->dist - dist2;
+   if (margin < *slack * scale)
+      *slack = margin / scale;
+
    /* recurse down the contacted sides */
    if (sides & PSIDE_FRONT)
-      SV_FindTouchedLeafs(ent, node->children[0]);
+      SV_FindTouchedLeafs(ent, node->children[0], slack);
 
    if (sides & PSIDE_BACK)
-      SV_FindTouchedLeafs(ent, node->children[1]);
+      SV_FindTouchedLeafs(ent, node->children[1], slack);
+}
+
+/*
+ * Finds the leafs the edict's abs box is in, unless it's still close
+ * enough to the box they were last found for
+ */
+static void
+SV_LinkToLeafs(edict_t *ent)
+{
+   leafcache_t *cache = &sv_leafcache[NUM_FOR_EDICT(ent)];
+   int i;
+
+   if (cache->world == sv_worldnum && cache->num_leafs == ent->num_leafs)
+   {
+      for (i = 0; i < 3; i++)
+      {
+         if (!(fabsf(ent->v.absmin[i] - cache->absmin[i]) < cache->slack
+                  && fabsf(ent->v.absmax[i] - cache->absmax[i]) < cache->slack))
+            break;
+      }
+      if (i == 3)
+         return;
+   }
+
+   ent->num_leafs = 0;
+   cache->slack = LEAF_LIMIT;
+   SV_FindTouchedLeafs(ent, sv.worldmodel->nodes, &cache->slack);
+   cache->slack -= LEAF_EPSILON;
+   VectorCopy(ent->v.absmin, cache->absmin);
+   VectorCopy(ent->v.absmax, cache->absmax);
+   cache->num_leafs = ent->num_leafs;
+   cache->world = sv_worldnum;
+   for (i = 0; i < 3; i++)
+      if (!(ent->v.absmin[i] > -LEAF_LIMIT && ent->v.absmax[i] < LEAF_LIMIT))
+         cache->world = 0;
 }
 
 /*
@@ -515,6 +761,7 @@ void
 SV_LinkEdict(edict_t *ent, qboolean touch_triggers)
 {
    areanode_t *node;
+   qboolean above, below;
 
    if (ent->area.prev)
       SV_UnlinkEdict(ent);	/* unlink from old position */
@@ -579,21 +826,31 @@ SV_LinkEdict(edict_t *ent, qboolean touch_triggers)
    }
 
    /* link to PVS leafs */
-   ent->num_leafs = 0;
    if (ent->v.modelindex)
-      SV_FindTouchedLeafs(ent, sv.worldmodel->nodes);
+      SV_LinkToLeafs(ent);
+   else
+      ent->num_leafs = 0;
 
    if (ent->v.solid == SOLID_NOT)
+   {
+      ED_Placed(NUM_FOR_EDICT(ent));
       return;
+   }
 
    /* find the first node that the ent's box crosses */
    node = sv_areanodes;
    while (1) {
       if (node->axis == -1)
          break;
-      if (ent->v.absmin[node->axis] > node->dist)
+      above = ent->v.absmin[node->axis] > node->bounds[0];
+      below = ent->v.absmax[node->axis] < node->bounds[1];
+      if (above && below && node->bounds[0] < node->bounds[1])
+         /* fits in either loose child, take the one its center is in */
+         above = ent->v.absmin[node->axis] + ent->v.absmax[node->axis]
+            > 2 * node->dist;
+      if (above)
          node = node->children[0];
-      else if (ent->v.absmax[node->axis] < node->dist)
+      else if (below)
          node = node->children[1];
       else
          break;		// crosses the node
@@ -605,6 +862,12 @@ SV_LinkEdict(edict_t *ent, qboolean touch_triggers)
    else
       InsertLinkBefore(&ent->area, &node->solid_edicts);
 
+   /* an inside out box could be on a node its center isn't under */
+   if (ent->v.mins[0] <= ent->v.maxs[0]
+         && ent->v.mins[1] <= ent->v.maxs[1]
+         && ent->v.mins[2] <= ent->v.maxs[2])
+      ED_Placed(NUM_FOR_EDICT(ent));
+
    if (touch_triggers)
       /* touch all entities at this node and decend for more */
       SV_TouchLinks(ent, sv_areanodes);
@@ -632,18 +895,12 @@ SV_HullPointContents(hull_t *hull, int num, vec3_t p)
 
    while (num >= 0)
    {
-      mclipnode_t *node;
-      mplane_t *plane;
+      const mhullnode_t *node;
       if (num < hull->firstclipnode || num > hull->lastclipnode)
          SV_Error("%s: bad node number (%i)", __func__, num);
 
-      node = hull->clipnodes + num;
-      plane = hull->planes + node->planenum;
-
-      if (plane->type < 3)
-         d = p[plane->type] - plane->dist;
-      else
-         d = DotProduct(plane->normal, p) - plane->dist;
+      node = hull->hullnodes + num;
+      d = Mod_HullNodeDist(hull, node, p);
       if (d < 0)
          num = node->children[1];
       else
@@ -659,24 +916,143 @@ SV_PointContents
 
 ==================
 */
+/*
+ * The world's contents at a point are cached, keyed on the POINT_CELL
+ * sized cell it falls in. An entry keeps the point it was looked up at and
+ * how far that point is from the nearest plane along its way down the
+ * hull: any point closer to it than that goes down the same way, so ends
+ * in the same leaf. POINT_EPSILON covers the rounding of those distances.
+ * Entries are tagged with the map they were filled on, the world hull
+ * doesn't change while it runs.
+ */
+#define POINT_CACHE	4096	// must be a power of two
+#define POINT_CELL	64
+#define POINT_LIMIT	16384	// points further out aren't cached
+#define POINT_EPSILON	0.0625
+
+typedef struct {
+   vec3_t point;
+   float radius2;		// squared, with POINT_EPSILON taken off
+   int contents;
+   int world;			// sv_worldnum when filled, 0 for never
+} pointcache_t;
+
+cvar_t sv_pointcache = { "sv_pointcache", "1" };
+cvar_t sv_boxtrace = { "sv_boxtrace", "1" };
+
+static pointcache_t sv_pointcache_entries[POINT_CACHE];
+static int sv_pointlookups, sv_pointhits;
+
+/*
+ * SV_HullPointContents for the world, also returning the distance from
+ * p to the nearest plane passed on the way
+ */
+static int
+SV_WorldPointContents(const vec3_t p, float *radius)
+{
+   hull_t *hull = &sv.worldmodel->hulls[0];
+   int num = 0;
+   float d, nearest;
+
+   nearest = POINT_LIMIT;
+   while (num >= 0)
+   {
+      const mhullnode_t *node;
+      if (num < hull->firstclipnode || num > hull->lastclipnode)
+         SV_Error("%s: bad node number (%i)", __func__, num);
+
+      node = hull->hullnodes + num;
+      d = Mod_HullNodeDist(hull, node, p);
+      if (d < 0)
+      {
+         num = node->children[1];
+         if (-d < nearest)
+            nearest = -d;
+      }
+      else
+      {
+         num = node->children[0];
+         if (d < nearest)
+            nearest = d;
+      }
+   }
+   *radius = nearest;
+
+   return num;
+}
+
+static int
+SV_CachedPointContents(vec3_t p)
+{
+   pointcache_t *entry;
+   vec3_t delta;
+   float radius;
+   unsigned hash;
+   int i, cell[3];
+
+   if (!sv_pointcache.value)
+      return SV_HullPointContents(&sv.worldmodel->hulls[0], 0, p);
+
+   for (i = 0; i < 3; i++)
+   {
+      if (!(p[i] > -POINT_LIMIT && p[i] < POINT_LIMIT))
+         return SV_HullPointContents(&sv.worldmodel->hulls[0], 0, p);
+      cell[i] = (int)floorf(p[i] * (1.0f / POINT_CELL));
+   }
+   hash = (cell[0] * 73856093u) ^ (cell[1] * 19349663u) ^ (cell[2] * 83492791u);
+   entry = &sv_pointcache_entries[hash & (POINT_CACHE - 1)];
+
+   sv_pointlookups++;
+   if (entry->world == sv_worldnum)
+   {
+      VectorSubtract(p, entry->point, delta);
+      if (DotProduct(delta, delta) < entry->radius2)
+      {
+         sv_pointhits++;
+         return entry->contents;
+      }
+   }
+
+   entry->contents = SV_WorldPointContents(p, &radius);
+   radius -= POINT_EPSILON;
+   entry->radius2 = radius > 0 ? radius * radius : 0;
+   VectorCopy(p, entry->point);
+   entry->world = sv_worldnum;
+
+   return entry->contents;
+}
+
 int
 SV_PointContents(vec3_t p)
 {
 #ifdef QUAKE2RJ
    int cont;
 
-   cont = SV_HullPointContents(&sv.worldmodel->hulls[0], 0, p);
+   cont = SV_CachedPointContents(p);
    if (cont <= CONTENTS_CURRENT_0 && cont >= CONTENTS_CURRENT_DOWN)
       cont = CONTENTS_WATER;
    return cont;
 #else
-   return SV_HullPointContents(&sv.worldmodel->hulls[0], 0, p);
+   return SV_CachedPointContents(p);
 #endif
 }
 
 int SV_TruePointContents (vec3_t p)
 {
-	return SV_HullPointContents (&sv.worldmodel->hulls[0], 0, p);
+	return SV_CachedPointContents(p);
+}
+
+static void
+SV_PointStats_f(void)
+{
+   if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "clear"))
+   {
+      sv_pointlookups = sv_pointhits = 0;
+      return;
+   }
+   Con_Printf("%d point contents lookups, %d hits (%.1f%%)\n",
+         sv_pointlookups, sv_pointhits,
+         sv_pointlookups ? 100.0 * sv_pointhits / sv_pointlookups : 0.0);
 }
 
 
@@ -728,8 +1104,8 @@ SV_RecursiveHullCheck
 qboolean SV_RecursiveHullCheck(hull_t *hull, int num, float p1f, float p2f,
 		      vec3_t p1, vec3_t p2, trace_t *trace)
 {
-   mclipnode_t *node;
-   mplane_t *plane;
+   const mhullnode_t *node;
+   const mplane_t *plane;
    float t1, t2;
    float frac;
    int i;
@@ -754,19 +1130,9 @@ qboolean SV_RecursiveHullCheck(hull_t *hull, int num, float p1f, float p2f,
       SV_Error("%s: bad node number", __func__);
 
    /* find the point distances */
-   node = hull->clipnodes + num;
-   plane = hull->planes + node->planenum;
-
-   if (plane->type < 3)
-   {
-      t1 = p1[plane->type] - plane->dist;
-      t2 = p2[plane->type] - plane->dist;
-   }
-   else
-   {
-      t1 = DotProduct(plane->normal, p1) - plane->dist;
-      t2 = DotProduct(plane->normal, p2) - plane->dist;
-   }
+   node = hull->hullnodes + num;
+   t1 = Mod_HullNodeDist(hull, node, p1);
+   t2 = Mod_HullNodeDist(hull, node, p2);
 
 #if 1
    if (t1 >= 0 && t2 >= 0)
@@ -817,15 +1183,16 @@ qboolean SV_RecursiveHullCheck(hull_t *hull, int num, float p1f, float p2f,
    //==================
    // the other side of the node is solid, this is the impact point
    //==================
+   plane = hull->planes + HULLNODE_PLANE(node);
    if (!side)
    {
       VectorCopy(plane->normal, trace->plane.normal);
-      trace->plane.dist = plane->dist;
+      trace->plane.dist = node->dist;
    }
    else
    {
       VectorSubtract(vec3_origin, plane->normal, trace->plane.normal);
-      trace->plane.dist = -plane->dist;
+      trace->plane.dist = -node->dist;
    }
 
 #ifdef HEXEN2
@@ -877,98 +1244,409 @@ qboolean SV_RecursiveHullCheck(hull_t *hull, int num, float p1f, float p2f,
 
 /*
 ==================
-SV_ClipMoveToEntity
-
-Handles selection or creation of a clipping hull, and offseting (and
-eventually rotation) of the end points
+SV_HullCheck
+
+SV_RecursiveHullCheck without the recursion. A call either goes straight
+on to the side of the node both ends are on, which here is just a step
+down, or crosses the node and waits on the near side before doing the
+far side. Only the crossed nodes are kept on the stack, with everything
+the far side and the impact need, so the results come out bit for bit as
+the recursive version gives them. A hull crossing more nodes than the
+stack holds finishes the rest recursively.
 ==================
 */
-static trace_t
-SV_ClipMoveToEntity(edict_t *ent, vec3_t start, vec3_t mins, vec3_t maxs,
-		    vec3_t end, edict_t *move_ent)
-{
-   trace_t trace;
-   vec3_t offset;
-   vec3_t start_l, end_l;
-   hull_t *hull;
+#define	HULL_STACK	64
 
-   /* fill in a default trace */
-   memset(&trace, 0, sizeof(trace_t));
-   trace.fraction = 1;
-   trace.allsolid = true;
-   VectorCopy(end, trace.endpos);
+typedef struct {
+   const mhullnode_t *node;
+   int side;
+   float frac;
+   float p1f, p2f, midf;
+   vec3_t p1, p2, mid;
+} hullframe_t;
 
-   /* get the clipping hull */
-   hull = SV_HullForEntity(ent, mins, maxs, offset, move_ent);
+qboolean SV_HullCheck(hull_t *hull, int num, float p1f, float p2f,
+		      vec3_t p1, vec3_t p2, trace_t *trace)
+{
+   hullframe_t stack[HULL_STACK], *frame;
+   const mhullnode_t *node;
+   const mplane_t *plane;
+   vec3_t start, end;
+   float t1, t2;
+   float frac;
+   int i, depth;
 
-   VectorSubtract(start, offset, start_l);
-   VectorSubtract(end, offset, end_l);
+   VectorCopy(p1, start);
+   VectorCopy(p2, end);
+   depth = 0;
 
-	if (sys_quake2.value)
-	{
-		// rotate start and end into the models frame of reference
-		if (ent->v.solid == SOLID_BSP && 
-		(fabsf(ent->v.angles[0]) > 1 || fabsf(ent->v.angles[1]) > 1 || fabsf(ent->v.angles[2]) > 1) )
-		{
-			vec3_t	a;
-			vec3_t	forward, right, up;
-			vec3_t	temp;
+   for (;;)
+   {
+      /* go down the near side, keeping the nodes crossed on the way */
+      while (num >= 0)
+      {
+         if (num < hull->firstclipnode || num > hull->lastclipnode)
+            SV_Error("%s: bad node number", __func__);
 
-			AngleVectors (ent->v.angles, forward, right, up);
+         node = hull->hullnodes + num;
+         t1 = Mod_HullNodeDist(hull, node, start);
+         t2 = Mod_HullNodeDist(hull, node, end);
+         if (t1 >= 0 && t2 >= 0)
+         {
+            num = node->children[0];
+            continue;
+         }
+         if (t1 < 0 && t2 < 0)
+         {
+            num = node->children[1];
+            continue;
+         }
 
-			VectorCopy (start_l, temp);
-			start_l[0] = DotProduct (temp, forward);
-			start_l[1] = -DotProduct (temp, right);
-			start_l[2] = DotProduct (temp, up);
+         if (depth == HULL_STACK)
+         {
+            if (!SV_RecursiveHullCheck(hull, num, p1f, p2f, start, end, trace))
+               return false;
+            break;
+         }
 
-			VectorCopy (end_l, temp);
-			end_l[0] = DotProduct (temp, forward);
-			end_l[1] = -DotProduct (temp, right);
-			end_l[2] = DotProduct (temp, up);
-		}
-	}
+         /* put the crosspoint DIST_EPSILON pixels on the near side */
+         if (t1 < 0)
+            frac = (t1 + DIST_EPSILON) / (t1 - t2);
+         else
+            frac = (t1 - DIST_EPSILON) / (t1 - t2);
+         if (frac < 0)
+            frac = 0;
+         if (frac > 1)
+            frac = 1;
+
+         frame = &stack[depth++];
+         frame->node = node;
+         frame->side = (t1 < 0);
+         frame->frac = frac;
+         frame->p1f = p1f;
+         frame->p2f = p2f;
+         frame->midf = p1f + (p2f - p1f) * frac;
+         VectorCopy(start, frame->p1);
+         VectorCopy(end, frame->p2);
+         for (i = 0; i < 3; i++)
+            frame->mid[i] = start[i] + frac * (end[i] - start[i]);
 
-   /* trace a line through the apropriate clipping hull */
-   SV_RecursiveHullCheck(hull, hull->firstclipnode, 0, 1, start_l, end_l,
-         &trace);
-	if (move_type == MOVE_WATER)
-	{
-		if (SV_PointContents (trace.endpos) != CONTENTS_WATER)
-		{
-			VectorCopy(start_l, trace.endpos);
-			trace.fraction = 0;
-		}
-	}
+         /* move up to the node */
+         num = node->children[frame->side];
+         p2f = frame->midf;
+         VectorCopy(frame->mid, end);
+      }
 
-	if (sys_quake2.value)
-	{
-		// rotate endpos back to world frame of reference
-		if (ent->v.solid == SOLID_BSP && 
-		(fabsf(ent->v.angles[0]) > 1 || fabsf(ent->v.angles[1]) > 1 || fabsf(ent->v.angles[2]) > 1) )
-		{
-			vec3_t	a;
-			vec3_t	forward, right, up;
-			vec3_t	temp;
+      /* check for empty */
+      if (num < 0)
+      {
+         if (num != CONTENTS_SOLID) {
+            trace->allsolid = false;
+            if (num == CONTENTS_EMPTY)
+               trace->inopen = true;
+            else
+               trace->inwater = true;
+         } else
+            trace->startsolid = true;
+      }
 
-			if (trace.fraction != 1)
-			{
-				VectorSubtract (vec3_origin, ent->v.angles, a);
-				AngleVectors (a, forward, right, up);
+      /* the near side of the last node crossed is done */
+      if (!depth)
+         return true;
+      frame = &stack[--depth];
 
-				VectorCopy (trace.endpos, temp);
-				trace.endpos[0] = DotProduct (temp, forward);
-				trace.endpos[1] = -DotProduct (temp, right);
-				trace.endpos[2] = DotProduct (temp, up);
+      num = frame->node->children[frame->side ^ 1];
+      if (SV_HullPointContents(hull, num, frame->mid) != CONTENTS_SOLID)
+      {
+         /* go past the node */
+         p1f = frame->midf;
+         p2f = frame->p2f;
+         VectorCopy(frame->mid, start);
+         VectorCopy(frame->p2, end);
+         continue;
+      }
 
-				VectorCopy (trace.plane.normal, temp);
-				trace.plane.normal[0] = DotProduct (temp, forward);
-				trace.plane.normal[1] = -DotProduct (temp, right);
-				trace.plane.normal[2] = DotProduct (temp, up);
-			}
-		}
-	}
+      if (trace->allsolid)
+         return false;		/* never got out of the solid area */
 
-   // fix trace up by the offset
+      /* the other side of the node is solid, this is the impact point */
+      plane = hull->planes + HULLNODE_PLANE(frame->node);
+      if (!frame->side)
+      {
+         VectorCopy(plane->normal, trace->plane.normal);
+         trace->plane.dist = frame->node->dist;
+      }
+      else
+      {
+         VectorSubtract(vec3_origin, plane->normal, trace->plane.normal);
+         trace->plane.dist = -frame->node->dist;
+      }
+
+      /* shouldn't really happen, but does occasionally */
+      frac = frame->frac;
+      while (SV_HullPointContents(hull, hull->firstclipnode, frame->mid) == CONTENTS_SOLID) {
+         frac -= 0.1;
+         if (frac < 0) {
+            trace->fraction = frame->midf;
+            VectorCopy(frame->mid, trace->endpos);
+            Con_DPrintf("backup past 0\n");
+            return false;
+         }
+         frame->midf = frame->p1f + (frame->p2f - frame->p1f) * frac;
+         for (i = 0; i < 3; i++)
+            frame->mid[i] = frame->p1[i] + frac * (frame->p2[i] - frame->p1[i]);
+      }
+
+      trace->fraction = frame->midf;
+      VectorCopy(frame->mid, trace->endpos);
+
+      return false;
+   }
+}
+
+/*
+ * The box hull is a chain: node k is on one of the box's faces, in the
+ * order SV_InitBoxHull gives them, and has EMPTY on the outside with the
+ * next node, or SOLID after the last one, on the inside.
+ */
+#define BOX_OUTSIDE(k, t)	(((k) & 1) ? (t) < 0 : (t) >= 0)
+
+static int
+SV_BoxPointContents(const vec3_t mins, const vec3_t maxs, int k,
+		    const vec3_t p)
+{
+   for (; k < 6; k++)
+   {
+      const int axis = k >> 1;
+      const float dist = (k & 1) ? mins[axis] : maxs[axis];
+
+      if (BOX_OUTSIDE(k, p[axis] - dist))
+         return CONTENTS_EMPTY;
+   }
+
+   return CONTENTS_SOLID;
+}
+
+/*
+==================
+SV_BoxCheck
+
+SV_HullCheck through the hull SV_HullForBox would make, without making
+it. Going down the chain, a line crossing a face either starts outside
+it, so the near side is open and the trace carries on from the crossing,
+or starts inside it, so the far side is open and the trace carries on to
+the crossing. Either way there's never more than the one line to follow,
+and the same sums are done in the same order as the hull trace does them,
+so the traces come out the same.
+==================
+*/
+static void
+SV_BoxCheck(const vec3_t mins, const vec3_t maxs, const vec3_t p1,
+	    const vec3_t p2, trace_t *trace)
+{
+   vec3_t start, end, mid;
+   float t1, t2, frac, dist;
+   float p1f, p2f, midf;
+   qboolean open_after;
+   int i, k, axis, side;
+
+   VectorCopy(p1, start);
+   VectorCopy(p2, end);
+   p1f = 0;
+   p2f = 1;
+   open_after = false;
+
+   for (k = 0; k < 6; k++)
+   {
+      axis = k >> 1;
+      dist = (k & 1) ? mins[axis] : maxs[axis];
+      t1 = start[axis] - dist;
+      t2 = end[axis] - dist;
+      if ((t1 >= 0 && t2 >= 0) || (t1 < 0 && t2 < 0))
+      {
+         if (BOX_OUTSIDE(k, t1))
+            break;
+         continue;
+      }
+
+      /* put the crosspoint DIST_EPSILON pixels on the near side */
+      if (t1 < 0)
+         frac = (t1 + DIST_EPSILON) / (t1 - t2);
+      else
+         frac = (t1 - DIST_EPSILON) / (t1 - t2);
+      if (frac < 0)
+         frac = 0;
+      if (frac > 1)
+         frac = 1;
+
+      midf = p1f + (p2f - p1f) * frac;
+      for (i = 0; i < 3; i++)
+         mid[i] = start[i] + frac * (end[i] - start[i]);
+      side = (t1 < 0);
+
+      if (side != (k & 1))
+      {
+         /* starts inside the face: the rest of the chain up to it */
+         VectorCopy(mid, end);
+         p2f = midf;
+         open_after = true;
+         continue;
+      }
+
+      /* starts outside the face, in the open */
+      trace->allsolid = false;
+      trace->inopen = true;
+      if (SV_BoxPointContents(mins, maxs, k + 1, mid) != CONTENTS_SOLID)
+      {
+         VectorCopy(mid, start);
+         p1f = midf;
+         continue;
+      }
+
+      /* the other side of the face is solid, this is the impact point */
+      for (i = 0; i < 3; i++)
+         trace->plane.normal[i] = 0;
+      trace->plane.normal[axis] = side ? -1 : 1;
+      trace->plane.dist = side ? -dist : dist;
+
+      /* shouldn't really happen, but does occasionally */
+      while (SV_BoxPointContents(mins, maxs, 0, mid) == CONTENTS_SOLID) {
+         frac -= 0.1;
+         if (frac < 0) {
+            trace->fraction = midf;
+            VectorCopy(mid, trace->endpos);
+            Con_DPrintf("backup past 0\n");
+            return;
+         }
+         midf = p1f + (p2f - p1f) * frac;
+         for (i = 0; i < 3; i++)
+            mid[i] = start[i] + frac * (end[i] - start[i]);
+      }
+
+      trace->fraction = midf;
+      VectorCopy(mid, trace->endpos);
+      return;
+   }
+
+   if (k == 6)
+      trace->startsolid = true;
+   else
+   {
+      trace->allsolid = false;
+      trace->inopen = true;
+   }
+   if (open_after)
+   {
+      trace->allsolid = false;
+      trace->inopen = true;
+   }
+}
+
+/*
+==================
+SV_ClipMoveToEntity
+
+Handles selection or creation of a clipping hull, and offseting (and
+eventually rotation) of the end points
+==================
+*/
+static trace_t
+SV_ClipMoveToEntity(edict_t *ent, vec3_t start, vec3_t mins, vec3_t maxs,
+		    vec3_t end, edict_t *move_ent)
+{
+   trace_t trace;
+   vec3_t offset;
+   vec3_t start_l, end_l;
+   vec3_t boxmins, boxmaxs;
+   hull_t *hull;
+
+   /* fill in a default trace */
+   memset(&trace, 0, sizeof(trace_t));
+   trace.fraction = 1;
+   trace.allsolid = true;
+   VectorCopy(end, trace.endpos);
+
+   /* get the clipping hull, boxes are traced directly */
+   if (ent->v.solid != SOLID_BSP && sv_boxtrace.value)
+   {
+      hull = NULL;
+      VectorSubtract(ent->v.mins, maxs, boxmins);
+      VectorSubtract(ent->v.maxs, mins, boxmaxs);
+      VectorCopy(ent->v.origin, offset);
+   }
+   else
+      hull = SV_HullForEntity(ent, mins, maxs, offset, move_ent);
+
+   VectorSubtract(start, offset, start_l);
+   VectorSubtract(end, offset, end_l);
+
+	if (sys_quake2.value)
+	{
+		// rotate start and end into the models frame of reference
+		if (ent->v.solid == SOLID_BSP && 
+		(fabsf(ent->v.angles[0]) > 1 || fabsf(ent->v.angles[1]) > 1 || fabsf(ent->v.angles[2]) > 1) )
+		{
+			vec3_t	a;
+			vec3_t	forward, right, up;
+			vec3_t	temp;
+
+			AngleVectors (ent->v.angles, forward, right, up);
+
+			VectorCopy (start_l, temp);
+			start_l[0] = DotProduct (temp, forward);
+			start_l[1] = -DotProduct (temp, right);
+			start_l[2] = DotProduct (temp, up);
+
+			VectorCopy (end_l, temp);
+			end_l[0] = DotProduct (temp, forward);
+			end_l[1] = -DotProduct (temp, right);
+			end_l[2] = DotProduct (temp, up);
+		}
+	}
+
+   /* trace a line through the apropriate clipping hull */
+   if (hull)
+      SV_HullCheck(hull, hull->firstclipnode, 0, 1, start_l, end_l, &trace);
+   else
+      SV_BoxCheck(boxmins, boxmaxs, start_l, end_l, &trace);
+	if (move_type == MOVE_WATER)
+	{
+		if (SV_PointContents (trace.endpos) != CONTENTS_WATER)
+		{
+			VectorCopy(start_l, trace.endpos);
+			trace.fraction = 0;
+		}
+	}
+
+	if (sys_quake2.value)
+	{
+		// rotate endpos back to world frame of reference
+		if (ent->v.solid == SOLID_BSP && 
+		(fabsf(ent->v.angles[0]) > 1 || fabsf(ent->v.angles[1]) > 1 || fabsf(ent->v.angles[2]) > 1) )
+		{
+			vec3_t	a;
+			vec3_t	forward, right, up;
+			vec3_t	temp;
+
+			if (trace.fraction != 1)
+			{
+				VectorSubtract (vec3_origin, ent->v.angles, a);
+				AngleVectors (a, forward, right, up);
+
+				VectorCopy (trace.endpos, temp);
+				trace.endpos[0] = DotProduct (temp, forward);
+				trace.endpos[1] = -DotProduct (temp, right);
+				trace.endpos[2] = DotProduct (temp, up);
+
+				VectorCopy (trace.plane.normal, temp);
+				trace.plane.normal[0] = DotProduct (temp, forward);
+				trace.plane.normal[1] = -DotProduct (temp, right);
+				trace.plane.normal[2] = DotProduct (temp, up);
+			}
+		}
+	}
+
+   // fix trace up by the offset
    if (trace.fraction != 1)
       VectorAdd(trace.endpos, offset, trace.endpos);
 
@@ -981,6 +1659,47 @@ SV_ClipMoveToEntity(edict_t *ent, vec3_t start, vec3_t mins, vec3_t maxs,
 
 //===========================================================================
 
+/*
+ * Clips the move against one edict that passed the link checks, keeping
+ * the nearest hit
+ */
+static void
+SV_ClipToEdict(moveclip_t *clip, edict_t *touch)
+{
+   trace_t trace;
+
+   if ((int)touch->v.flags & FL_MONSTER)
+      trace = SV_ClipMoveToEntity(
+            touch, clip->start, clip->mins2, clip->maxs2, clip->end, touch);
+   else
+      trace = SV_ClipMoveToEntity(
+            touch, clip->start, clip->mins, clip->maxs, clip->end, touch);
+
+   if (trace.allsolid || trace.startsolid
+         || trace.fraction < clip->trace.fraction)
+   {
+      trace.ent = touch;
+      if (clip->trace.startsolid)
+      {
+         clip->trace = trace;
+         clip->trace.startsolid = true;
+      } else
+         clip->trace = trace;
+   }
+   else if (trace.startsolid)
+      clip->trace.startsolid = true;
+}
+
+#if defined(QW_HACK) && defined(SERVERONLY)
+static qboolean
+SV_ClientRewound(const moveclip_t *clip, const edict_t *touch)
+{
+   int num = NUM_FOR_EDICT(touch) - 1;
+
+   return num >= 0 && num < MAX_CLIENTS && (clip->rewound & (1u << num));
+}
+#endif
+
 /*
 ====================
 SV_ClipToLinks
@@ -992,7 +1711,6 @@ static void SV_ClipToLinks(areanode_t *node, moveclip_t *clip)
 {
    link_t *l, *next;
    edict_t *touch;
-   trace_t trace;
 
    /* touch linked edicts */
    for (l = node->solid_edicts.next; l != &node->solid_edicts; l = next)
@@ -1003,6 +1721,10 @@ static void SV_ClipToLinks(areanode_t *node, moveclip_t *clip)
          continue;
       if (touch == clip->passedict)
          continue;
+#if defined(QW_HACK) && defined(SERVERONLY)
+      if (clip->rewound && SV_ClientRewound(clip, touch))
+         continue;
+#endif
       if (touch->v.solid == SOLID_TRIGGER)
 			Sys_Error ("Trigger in clipping list (%s)",touch->v.classname + pr_strings);
 
@@ -1034,35 +1756,16 @@ static void SV_ClipToLinks(areanode_t *node, moveclip_t *clip)
             continue;	/* don't clip against owner */
       }
 
-      if ((int)touch->v.flags & FL_MONSTER)
-         trace = SV_ClipMoveToEntity(
-               touch, clip->start, clip->mins2, clip->maxs2, clip->end, touch);
-      else
-         trace = SV_ClipMoveToEntity(
-               touch, clip->start, clip->mins, clip->maxs, clip->end, touch);
-
-      if (trace.allsolid || trace.startsolid
-            || trace.fraction < clip->trace.fraction)
-      {
-         trace.ent = touch;
-         if (clip->trace.startsolid)
-         {
-            clip->trace = trace;
-            clip->trace.startsolid = true;
-         } else
-            clip->trace = trace;
-      }
-      else if (trace.startsolid)
-         clip->trace.startsolid = true;
+      SV_ClipToEdict(clip, touch);
    }
 
    /* recurse down both sides */
    if (node->axis == -1)
       return;
 
-   if (clip->boxmaxs[node->axis] > node->dist)
+   if (clip->boxmaxs[node->axis] > node->bounds[0])
       SV_ClipToLinks(node->children[0], clip);
-   if (clip->boxmins[node->axis] < node->dist)
+   if (clip->boxmins[node->axis] < node->bounds[1])
       SV_ClipToLinks(node->children[1], clip);
 }
 
@@ -1093,26 +1796,57 @@ static void SV_MoveBounds(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end,
 }
 
 /*
-==================
-SV_Move
-==================
+===============================================================================
+
+MOVE REPLAY
+
+"sv_recordmoves <count>" keeps the arguments of the next count SV_Move
+calls, "sv_replaymoves" runs them again against the current world and
+times them. Changing sv_areadepth or sv_arealoose before a replay rebuilds
+the area nodes, so the same moves can be timed under each setting.
+
+===============================================================================
 */
-trace_t SV_Move(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type,
-	edict_t *passedict)
+
+typedef struct {
+   vec3_t start, mins, maxs, end;
+   int type;
+   int passedict;		// -1 for none
+} svmove_t;
+
+static svmove_t *sv_moves;
+static int sv_nummoves;
+static int sv_maxmoves;		// still recording while sv_nummoves is below
+
+static void
+SV_RecordMove(const vec3_t start, const vec3_t mins, const vec3_t maxs,
+              const vec3_t end, int type, const edict_t *passedict)
 {
-   moveclip_t clip;
+   svmove_t *move = &sv_moves[sv_nummoves++];
+
+   VectorCopy(start, move->start);
+   VectorCopy(mins, move->mins);
+   VectorCopy(maxs, move->maxs);
+   VectorCopy(end, move->end);
+   move->type = type;
+   move->passedict = passedict ? NUM_FOR_EDICT(passedict) : -1;
+}
 
-   memset(&clip, 0, sizeof(moveclip_t));
+static void
+SV_InitMoveClip(moveclip_t *clip, vec3_t start, vec3_t mins, vec3_t maxs,
+      vec3_t end, int type, edict_t *passedict)
+{
+   memset(clip, 0, sizeof(moveclip_t));
 
    /* clip to world */
-   clip.trace = SV_ClipMoveToEntity(sv.edicts, start, mins, maxs, end, passedict);
+   clip->trace = SV_ClipMoveToEntity(sv.edicts, start, mins, maxs, end, passedict);
 
-   clip.start = start;
-   clip.end = end;
-   clip.mins = mins;
-   clip.maxs = maxs;
-   clip.type = type;
-   clip.passedict = passedict;
+   clip->start = start;
+   clip->end = end;
+   clip->mins = mins;
+   clip->maxs = maxs;
+   clip->type = type;
+   clip->passedict = passedict;
 
 	if (type == MOVE_MISSILE || type == MOVE_PHASE)
    {
@@ -1120,22 +1854,478 @@ trace_t SV_Move(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type,
       int i;
       for (i = 0; i < 3; i++)
       {
-         clip.mins2[i] = -15;
-         clip.maxs2[i] = 15;
+         clip->mins2[i] = -15;
+         clip->maxs2[i] = 15;
       }
    }
    else
    {
-      VectorCopy(mins, clip.mins2);
-      VectorCopy(maxs, clip.maxs2);
+      VectorCopy(mins, clip->mins2);
+      VectorCopy(maxs, clip->maxs2);
    }
 
    /* create the bounding box of the entire move */
-   SV_MoveBounds(start, clip.mins2, clip.maxs2, end, clip.boxmins,
-         clip.boxmaxs);
+   SV_MoveBounds(start, clip->mins2, clip->maxs2, end, clip->boxmins,
+         clip->boxmaxs);
+}
+
+/*
+==================
+SV_Move
+==================
+*/
+trace_t SV_Move(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type,
+	edict_t *passedict)
+{
+   moveclip_t clip;
+
+   if (sv_nummoves < sv_maxmoves)
+      SV_RecordMove(start, mins, maxs, end, type, passedict);
+
+   SV_InitMoveClip(&clip, start, mins, maxs, end, type, passedict);
 
    /* clip to entities */
    SV_ClipToLinks(sv_areanodes, &clip);
 
    return clip.trace;
 }
+
+#if defined(QW_HACK) && defined(SERVERONLY)
+/*
+==================
+SV_MoveRewound
+
+As SV_Move, but the clients with their bit set in rewound are clipped
+against at origins[client] instead of where they are linked. Nothing is
+moved or relinked; each one's origin is only swapped while it is clipped.
+==================
+*/
+trace_t SV_MoveRewound(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end,
+      int type, edict_t *passedict, unsigned rewound, vec3_t *origins)
+{
+   moveclip_t clip;
+   edict_t *touch;
+   vec3_t origin, absmin, absmax;
+   int i;
+
+   SV_InitMoveClip(&clip, start, mins, maxs, end, type, passedict);
+   clip.rewound = rewound;
+
+   /* clip to entities, then to the rewound clients */
+   SV_ClipToLinks(sv_areanodes, &clip);
+
+   if (type == MOVE_NOMONSTERS || type == MOVE_PHASE)
+      return clip.trace;
+
+   for (i = 0; i < MAX_CLIENTS && !clip.trace.allsolid; i++)
+   {
+      if (!(rewound & (1u << i)))
+         continue;
+      touch = EDICT_NUM(i + 1);
+      if (touch->free || touch == passedict)
+         continue;
+      if (touch->v.solid == SOLID_NOT || touch->v.solid == SOLID_TRIGGER)
+         continue;
+
+      VectorAdd(origins[i], touch->v.mins, absmin);
+      VectorAdd(origins[i], touch->v.maxs, absmax);
+      if (clip.boxmins[0] > absmax[0] || clip.boxmins[1] > absmax[1]
+            || clip.boxmins[2] > absmax[2] || clip.boxmaxs[0] < absmin[0]
+            || clip.boxmaxs[1] < absmin[1] || clip.boxmaxs[2] < absmin[2])
+         continue;
+
+      if (passedict && passedict->v.size[0] && !touch->v.size[0])
+         continue;
+      if (passedict)
+      {
+         if (PROG_TO_EDICT(touch->v.owner) == passedict)
+            continue;
+         if (PROG_TO_EDICT(passedict->v.owner) == touch)
+            continue;
+      }
+
+      VectorCopy(touch->v.origin, origin);
+      VectorCopy(origins[i], touch->v.origin);
+      SV_ClipToEdict(&clip, touch);
+      VectorCopy(origin, touch->v.origin);
+   }
+
+   return clip.trace;
+}
+#endif
+
+/*
+====================
+SV_GatherClipLinks
+
+The edicts SV_ClipToLinks could clip a move inside the box against, in
+the order it would reach them. Only the checks that don't depend on
+where the move goes are made here.
+====================
+*/
+static int
+SV_GatherClipLinks(const areanode_t *node, const moveclip_t *clip,
+      const vec3_t boxmins, const vec3_t boxmaxs, edict_t **list, int count)
+{
+   const link_t *l;
+   edict_t *touch;
+
+   for (l = node->solid_edicts.next; l != &node->solid_edicts; l = l->next)
+   {
+      touch = EDICT_FROM_AREA(l);
+      if (touch->v.solid == SOLID_NOT)
+         continue;
+      if (touch == clip->passedict)
+         continue;
+      if (touch->v.solid == SOLID_TRIGGER)
+			Sys_Error ("Trigger in clipping list (%s)",touch->v.classname + pr_strings);
+
+      if ((clip->type == MOVE_NOMONSTERS ||
+               clip->type == MOVE_PHASE) && touch->v.solid != SOLID_BSP)
+         continue;
+
+      if (boxmins[0] > touch->v.absmax[0]
+            || boxmins[1] > touch->v.absmax[1]
+            || boxmins[2] > touch->v.absmax[2]
+            || boxmaxs[0] < touch->v.absmin[0]
+            || boxmaxs[1] < touch->v.absmin[1]
+            || boxmaxs[2] < touch->v.absmin[2])
+         continue;
+
+      if (clip->passedict && clip->passedict->v.size[0]
+            && !touch->v.size[0])
+         continue;		/* points never interact */
+
+      if (clip->passedict)
+      {
+         if (PROG_TO_EDICT(touch->v.owner) == clip->passedict)
+            continue;	/* don't clip against own missiles */
+         if (PROG_TO_EDICT(clip->passedict->v.owner) == touch)
+            continue;	/* don't clip against owner */
+      }
+
+      list[count++] = touch;
+   }
+
+   if (node->axis == -1)
+      return count;
+
+   if (boxmaxs[node->axis] > node->bounds[0])
+      count = SV_GatherClipLinks(node->children[0], clip, boxmins, boxmaxs,
+            list, count);
+   if (boxmins[node->axis] < node->bounds[1])
+      count = SV_GatherClipLinks(node->children[1], clip, boxmins, boxmaxs,
+            list, count);
+
+   return count;
+}
+
+/*
+==================
+SV_MoveBatch
+
+Each trace comes out as SV_Move would give it, the area nodes are walked
+once for the box around every move instead of once per move. An edict
+off a move's own box is skipped, which covers the nodes SV_ClipToLinks
+wouldn't have gone down for it.
+==================
+*/
+void SV_MoveBatch(int count, vec3_t *starts, vec3_t *ends, vec3_t mins,
+      vec3_t maxs, int type, edict_t *passedict, trace_t *traces)
+{
+   static edict_t *list[MAX_EDICTS];
+   moveclip_t clips[MOVE_BATCH], *clip;
+   vec3_t boxmins, boxmaxs;
+   edict_t *touch;
+   int i, j, batch, numlinks;
+
+   for (; count > 0; count -= batch, starts += batch, ends += batch,
+         traces += batch)
+   {
+      batch = count < MOVE_BATCH ? count : MOVE_BATCH;
+      for (i = 0; i < batch; i++)
+      {
+         if (sv_nummoves < sv_maxmoves)
+            SV_RecordMove(starts[i], mins, maxs, ends[i], type, passedict);
+
+         clip = &clips[i];
+         SV_InitMoveClip(clip, starts[i], mins, maxs, ends[i], type,
+               passedict);
+         if (!i)
+         {
+            VectorCopy(clip->boxmins, boxmins);
+            VectorCopy(clip->boxmaxs, boxmaxs);
+            continue;
+         }
+         for (j = 0; j < 3; j++)
+         {
+            if (clip->boxmins[j] < boxmins[j])
+               boxmins[j] = clip->boxmins[j];
+            if (clip->boxmaxs[j] > boxmaxs[j])
+               boxmaxs[j] = clip->boxmaxs[j];
+         }
+      }
+
+      numlinks = SV_GatherClipLinks(sv_areanodes, &clips[0], boxmins, boxmaxs,
+            list, 0);
+
+      for (i = 0; i < batch; i++)
+      {
+         clip = &clips[i];
+         for (j = 0; j < numlinks; j++)
+         {
+            touch = list[j];
+            if (clip->boxmins[0] > touch->v.absmax[0]
+                  || clip->boxmins[1] > touch->v.absmax[1]
+                  || clip->boxmins[2] > touch->v.absmax[2]
+                  || clip->boxmaxs[0] < touch->v.absmin[0]
+                  || clip->boxmaxs[1] < touch->v.absmin[1]
+                  || clip->boxmaxs[2] < touch->v.absmin[2])
+               continue;
+            if (clip->trace.allsolid)
+               break;
+            SV_ClipToEdict(clip, touch);
+         }
+         traces[i] = clip->trace;
+      }
+   }
+}
+
+
+static qboolean
+SV_WorldActive(void)
+{
+#ifdef NQ_HACK
+   return sv.active;
+#else
+   return sv.state != ss_dead;
+#endif
+}
+
+/*
+ * Builds the area nodes again from the cvars and links every edict back in,
+ * without touching triggers
+ */
+static void
+SV_RebuildAreaNodes(void)
+{
+   edict_t *ent;
+   int i;
+
+   for (i = 1; i < sv.num_edicts; i++)
+      SV_UnlinkEdict(EDICT_NUM(i));
+
+   SV_ClearWorld();
+
+   for (i = 1; i < sv.num_edicts; i++)
+   {
+      ent = EDICT_NUM(i);
+      if (!ent->free)
+         SV_LinkEdict(ent, false);
+   }
+}
+
+/*
+ * How many of the linked edicts are stuck on a node above the leaves
+ */
+static int
+SV_AreaNodeLinks(int *above)
+{
+   const areanode_t *node;
+   const link_t *l;
+   int i, count;
+
+   count = *above = 0;
+   for (i = 0; i < sv_numareanodes; i++)
+   {
+      node = &sv_areanodes[i];
+      for (l = node->solid_edicts.next; l != &node->solid_edicts; l = l->next)
+      {
+         count++;
+         if (node->axis != -1)
+            (*above)++;
+      }
+      for (l = node->trigger_edicts.next; l != &node->trigger_edicts; l = l->next)
+      {
+         count++;
+         if (node->axis != -1)
+            (*above)++;
+      }
+   }
+
+   return count;
+}
+
+static void
+SV_RecordMoves_f(void)
+{
+   int count;
+
+   if (Cmd_Argc() != 2)
+   {
+      Con_Printf("%s <count> : record the next count traces\n", Cmd_Argv(0));
+      if (sv_nummoves < sv_maxmoves)
+         Con_Printf("recording, %d of %d so far\n", sv_nummoves, sv_maxmoves);
+      else
+         Con_Printf("%d recorded\n", sv_nummoves);
+      return;
+   }
+
+   count = Q_atoi(Cmd_Argv(1));
+   free(sv_moves);
+   sv_moves = NULL;
+   sv_nummoves = sv_maxmoves = 0;
+   if (count <= 0)
+      return;
+
+   sv_moves = malloc(count * sizeof(*sv_moves));
+   if (!sv_moves)
+   {
+      Con_Printf("Couldn't allocate %d moves\n", count);
+      return;
+   }
+   sv_maxmoves = count;
+}
+
+static void
+SV_ReplayMoves_f(void)
+{
+   const svmove_t *move;
+   edict_t *passedict;
+   trace_t trace;
+   double start, time, fractions;
+   int i, pass, passes, linked, above;
+
+   if (!SV_WorldActive())
+   {
+      Con_Printf("No map running\n");
+      return;
+   }
+   if (!sv_nummoves)
+   {
+      Con_Printf("No moves recorded, use sv_recordmoves\n");
+      return;
+   }
+   passes = Cmd_Argc() > 1 ? Q_atoi(Cmd_Argv(1)) : 10;
+   if (passes < 1)
+      passes = 1;
+
+   /* stop recording, or the replay would record itself */
+   sv_maxmoves = sv_nummoves;
+
+   if (SV_AreaDepth(sv.worldmodel->mins, sv.worldmodel->maxs) != sv_areanodedepth
+         || SV_AreaLoose() != sv_areanodeloose)
+      SV_RebuildAreaNodes();
+
+   fractions = 0;
+   start = Sys_DoubleTime();
+   for (pass = 0; pass < passes; pass++)
+   {
+      for (i = 0, move = sv_moves; i < sv_nummoves; i++, move++)
+      {
+         passedict = NULL;
+         if (move->passedict >= 0 && move->passedict < sv.num_edicts)
+            passedict = EDICT_NUM(move->passedict);
+         trace = SV_Move((float *)move->start, (float *)move->mins,
+               (float *)move->maxs, (float *)move->end, move->type, passedict);
+         fractions += trace.fraction;
+      }
+   }
+   time = Sys_DoubleTime() - start;
+
+   linked = SV_AreaNodeLinks(&above);
+   Con_Printf("depth %d, loose %g: %d nodes, %d of %d edicts above the leaves\n",
+         sv_areanodedepth, sv_areanodeloose, sv_numareanodes, above, linked);
+   Con_Printf("%d moves x %d: %.3f ms, %.3f us a move, fractions %.4f\n",
+         sv_nummoves, passes, time * 1000,
+         time * 1e6 / ((double)sv_nummoves * passes), fractions / passes);
+}
+
+/*
+ * Traces random lines through the world's hulls both with SV_HullCheck and
+ * with SV_RecursiveHullCheck, and through random boxes both with
+ * SV_BoxCheck and with SV_HullCheck, counting the traces that differ at all
+ */
+static void
+SV_CheckHulls_f(void)
+{
+   model_t *world;
+   hull_t *hull;
+   trace_t trace, check;
+   vec3_t p1, p2, mins, maxs;
+   float frac;
+   int i, j, h, count, bad, boxbad;
+
+   if (!SV_WorldActive())
+   {
+      Con_Printf("No map running\n");
+      return;
+   }
+   count = Cmd_Argc() > 1 ? Q_atoi(Cmd_Argv(1)) : 100000;
+
+   world = sv.worldmodel;
+   bad = boxbad = 0;
+   for (i = 0; i < count; i++)
+   {
+      for (j = 0; j < 3; j++)
+      {
+         p1[j] = world->mins[j] + (world->maxs[j] - world->mins[j]) * (rand() & 0x7fff) / 0x7fff;
+         p2[j] = world->mins[j] + (world->maxs[j] - world->mins[j]) * (rand() & 0x7fff) / 0x7fff;
+      }
+      if (i & 1)
+      {
+         /* and some short ones */
+         frac = (rand() & 0xff) / 256.0;
+         for (j = 0; j < 3; j++)
+            p2[j] = p1[j] + frac * (p2[j] - p1[j]);
+      }
+      h = i % MAX_MAP_HULLS;
+      hull = &world->hulls[h];
+      if (!hull->clipnodes)
+         continue;
+
+      memset(&trace, 0, sizeof(trace));
+      trace.fraction = 1;
+      trace.allsolid = true;
+      VectorCopy(p2, trace.endpos);
+      check = trace;
+      SV_HullCheck(hull, hull->firstclipnode, 0, 1, p1, p2, &trace);
+      SV_RecursiveHullCheck(hull, hull->firstclipnode, 0, 1, p1, p2, &check);
+      if (memcmp(&trace, &check, sizeof(trace)))
+         bad++;
+
+      /* a box about the line's midpoint, sometimes one it starts in */
+      for (j = 0; j < 3; j++)
+      {
+         frac = (i & 2) ? p1[j] : (p1[j] + p2[j]) * 0.5f;
+         mins[j] = frac - (rand() & 0x3f) - 1;
+         maxs[j] = frac + (rand() & 0x3f) + 1;
+      }
+      memset(&trace, 0, sizeof(trace));
+      trace.fraction = 1;
+      trace.allsolid = true;
+      VectorCopy(p2, trace.endpos);
+      check = trace;
+      SV_BoxCheck(mins, maxs, p1, p2, &trace);
+      hull = SV_HullForBox(mins, maxs);
+      SV_HullCheck(hull, hull->firstclipnode, 0, 1, p1, p2, &check);
+      if (memcmp(&trace, &check, sizeof(trace)))
+         boxbad++;
+   }
+   Con_Printf("%d traces, %d differ\n", count, bad);
+   Con_Printf("%d box traces, %d differ\n", count, boxbad);
+}
+
+void
+SV_WorldInit(void)
+{
+   Cvar_RegisterVariable(&sv_areadepth);
+   Cvar_RegisterVariable(&sv_arealoose);
+   Cvar_RegisterVariable(&sv_pointcache);
+   Cvar_RegisterVariable(&sv_boxtrace);
+
+   Cmd_AddCommand("sv_recordmoves", SV_RecordMoves_f);
+   Cmd_AddCommand("sv_replaymoves", SV_ReplayMoves_f);
+   Cmd_AddCommand("sv_checkhulls", SV_CheckHulls_f);
+   Cmd_AddCommand("sv_pointstats", SV_PointStats_f);
+}
@@ -21,6 +21,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifndef WORLD_H
 #define WORLD_H
 
+#include "cvar.h"
 #include "mathlib.h"
 #include "progs.h"
 #include "qtypes.h"
@@ -49,6 +50,16 @@ typedef struct {
 #define	MOVE_PHASE		4
 
 
+void SV_WorldInit(void);
+
+// registers the area node cvars and the sv_recordmoves/sv_replaymoves
+// commands
+
+extern cvar_t sv_areadepth;	// 0 picks a depth from the world's size
+extern cvar_t sv_arealoose;	// 0 to 1, how far each node's boxes reach
+extern cvar_t sv_pointcache;	// cache the world's point contents
+extern cvar_t sv_boxtrace;	// trace box entities without the box hull
+
 void SV_ClearWorld(void);
 
 // called after the world model has been loaded, before linking any entities
@@ -66,6 +77,16 @@ void SV_LinkEdict(edict_t *ent, qboolean touch_triggers);
 // sets ent->v.absmin and ent->v.absmax
 // if touchtriggers, calls prog functions for the intersected triggers
 
+int SV_AreaEdicts(const vec3_t mins, const vec3_t maxs, int *nums);
+
+// adds to nums the numbers of the edicts linked to the area nodes the box
+// reaches, whether their own boxes touch it or not, and returns how many
+
+int SV_BoxEdicts(const vec3_t mins, const vec3_t maxs, int *nums);
+
+// the numbers of all the edicts that may touch the box, in edict order,
+// not counting the world; nums needs room for MAX_EDICTS * 2 + 1
+
 int SV_PointContents(vec3_t p);
 
 // returns the CONTENTS_* value from the world at the given point.
@@ -87,14 +108,37 @@ trace_t SV_Move(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end,
 
 // passedict is explicitly excluded from clipping checks (normally NULL)
 
+#define MOVE_BATCH 16
+
+void SV_MoveBatch(int count, vec3_t *starts, vec3_t *ends, vec3_t mins,
+		  vec3_t maxs, int type, edict_t *passedict, trace_t *traces);
+
+// traces count moves of the same box, each as SV_Move would, gathering
+// the edicts near them in one pass over the area nodes for every
+// MOVE_BATCH moves
+
 #if defined(QW_HACK) && defined(SERVERONLY)
 void SV_AddLinksToPmove(const vec3_t mins, const vec3_t maxs);
+
+trace_t SV_MoveRewound(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end,
+		       int type, edict_t *passedict, unsigned rewound,
+		       vec3_t *origins);
+// as SV_Move, but the clients with a bit set in rewound (client number,
+// not edict number) are clipped at origins[client] instead of where they
+// are linked
+
+trace_t SV_AntilagTraceline(vec3_t start, vec3_t end, int type,
+			    edict_t *passedict);
+// a traceline against the other players where the client whose commands
+// are running saw them (sv_user.c)
 #endif
 #ifdef NQ_HACK
 // FIXME - needed in chase.c, but doesn't seem like the right interface
 #include "model.h"
 qboolean SV_RecursiveHullCheck(hull_t *hull, int num, float p1f, float p2f,
 			       vec3_t p1, vec3_t p2, trace_t *trace);
+qboolean SV_HullCheck(hull_t *hull, int num, float p1f, float p2f,
+		      vec3_t p1, vec3_t p2, trace_t *trace);
 #endif
 
 #endif /* WORLD_H */
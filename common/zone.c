@@ -18,6 +18,17 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#include <stdlib.h>
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif
+
 #include "cmd.h"
 #include "common.h"
 #include "console.h"
@@ -26,6 +37,20 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "sys.h"
 #include "zone.h"
 
+/*
+ * The zone, hunk and cache are used from the main thread and from the
+ * server's frame when that runs alongside it, so the functions that change
+ * them take memory_lock. It's recursive, as they call each other.
+ */
+#ifdef HAVE_THREADS
+static pthread_mutex_t memory_lock;
+#define Memory_Lock()	pthread_mutex_lock(&memory_lock)
+#define Memory_Unlock()	pthread_mutex_unlock(&memory_lock)
+#else
+#define Memory_Lock()
+#define Memory_Unlock()
+#endif
+
 #ifdef HEXEN2
 #define	DYNAMIC_SIZE	0xc000
 #else
@@ -40,7 +65,7 @@ typedef struct memblock_s
     int tag;		/* a tag of 0 is a free block */
     int id;		/* should be ZONEID */
     struct memblock_s *next, *prev;
-    int pad;		/* pad to 64 bit boundary */
+    int slab;		/* size class + 1 of a slab chunk, 0 in the zone */
 } memblock_t;
 
 typedef struct
@@ -52,6 +77,26 @@ typedef struct
 
 static void Cache_FreeLow(int new_low_hunk);
 static void Cache_FreeHigh(int new_high_hunk);
+static byte *Cache_End(void);
+static int Cache_Used(void);
+
+typedef enum {
+   MEMTRACE_HUNK,
+   MEMTRACE_HIGH,
+   MEMTRACE_TEMP,
+   MEMTRACE_LOWMARK,
+   MEMTRACE_HIGHMARK,
+   MEMTRACE_CACHE,
+   MEMTRACE_CACHEFREE,
+   MEMTRACE_ZONE,
+   MEMTRACE_ZONEFREE,
+   MEMTRACE_PHASE,
+   MEMTRACE_NUMKINDS
+} memtracekind_t;
+
+static qboolean memtrace_active;
+static void Memory_Trace(memtracekind_t kind, const char *name, int tag,
+      int size);
 
 /*
  * ============================================================================
@@ -65,10 +110,38 @@ static void Cache_FreeHigh(int new_high_hunk);
  *
  * The zone calls are pretty much only used for small strings and structures,
  * all big things are allocated on the hunk.
+ *
+ * Small allocations are carved from slabs, zone blocks tagged ZONE_SLABTAG
+ * that each hold ZONE_SLABCHUNKS chunks of one size class. A chunk has the
+ * same header as a zone block, with prev pointing at its slab's block and
+ * next linking the slab's free chunks. Keeping the small, short lived
+ * allocations together stops them being scattered through the free space
+ * the larger ones need.
  * ============================================================================
  */
 
+#define ZONE_SLABTAG	2
+#define ZONE_SLABCHUNKS	16
+
+/* chunk sizes, including the header and trash marker */
+static const int zone_classes[] = { 64, 96, 128, 192, 256 };
+#define ZONE_NUMCLASSES	ARRAY_SIZE(zone_classes)
+
+typedef struct zslab_s
+{
+    struct zslab_s *next, *prev;	/* slabs of the class with free chunks */
+    memblock_t *free;
+    int sizeclass;
+    int used;
+} zslab_t;
+
+/* offset of the first chunk from the slab's block */
+#define ZONE_SLABHEADER	((sizeof(memblock_t) + sizeof(zslab_t) + 7) & ~7)
+#define ZONE_SLAB(block) ((zslab_t *)((byte *)(block) + sizeof(memblock_t)))
+
 static memzone_t *mainzone;
+static zslab_t *zone_slabs[ZONE_NUMCLASSES];
+static int zone_used;		/* in blocks and chunks handed out */
 
 static void Z_ClearZone(memzone_t *zone, int size);
 
@@ -97,16 +170,21 @@ Z_ClearZone(memzone_t *zone, int size)
     block->tag           = 0;		/* free block */
     block->id            = ZONEID;
     block->size          = size - sizeof(memzone_t);
+    block->slab          = 0;
+
+    memset(zone_slabs, 0, sizeof(zone_slabs));
 }
 
+static void Z_SlabFree(memblock_t *chunk);
+
 
 /*
  * ========================
  * Z_Free
  * ========================
  */
-void
-Z_Free(const void *ptr)
+static void
+Z_FreeLocked(const void *ptr)
 {
    memblock_t *block, *other;
 
@@ -119,6 +197,19 @@ Z_Free(const void *ptr)
    if (block->tag == 0)
       Sys_Error("%s: freed a freed pointer", __func__);
 
+   if (block->tag != ZONE_SLABTAG)
+   {
+      zone_used -= block->size;
+      if (memtrace_active)
+         Memory_Trace(MEMTRACE_ZONEFREE, NULL, block->tag, block->size);
+   }
+
+   if (block->slab)
+   {
+      Z_SlabFree(block);
+      return;
+   }
+
    block->tag = 0;		/* mark as free */
 
    other = block->prev;
@@ -145,6 +236,52 @@ Z_Free(const void *ptr)
    }
 }
 
+void Z_Free(const void *ptr)
+{
+   Memory_Lock();
+   Z_FreeLocked(ptr);
+   Memory_Unlock();
+}
+
+
+/*
+ * ========================
+ * Z_CheckSlab
+ * ========================
+ */
+static void Z_CheckSlab(memblock_t *block)
+{
+   zslab_t *slab = ZONE_SLAB(block);
+   memblock_t *chunk;
+   int i, size, numfree;
+
+   if (slab->sizeclass < 0 || slab->sizeclass >= ZONE_NUMCLASSES)
+      Sys_Error("%s: bad size class", __func__);
+   size = zone_classes[slab->sizeclass];
+   if (ZONE_SLABHEADER + size * ZONE_SLABCHUNKS > block->size)
+      Sys_Error("%s: chunks run past the slab", __func__);
+
+   for (i = 0; i < ZONE_SLABCHUNKS; i++)
+   {
+      chunk = (memblock_t *)((byte *)block + ZONE_SLABHEADER + i * size);
+      if (chunk->id != ZONEID || chunk->prev != block)
+         Sys_Error("%s: trashed chunk header", __func__);
+      if (chunk->size != size || chunk->slab != slab->sizeclass + 1)
+         Sys_Error("%s: chunk in the wrong size class", __func__);
+   }
+
+   numfree = 0;
+   for (chunk = slab->free; chunk; chunk = chunk->next)
+   {
+      if (chunk->prev != block || chunk->tag)
+         Sys_Error("%s: bad free chunk", __func__);
+      if (++numfree > ZONE_SLABCHUNKS)
+         Sys_Error("%s: free chunk list loops", __func__);
+   }
+   if (numfree + slab->used != ZONE_SLABCHUNKS)
+      Sys_Error("%s: used count doesn't match the free chunks", __func__);
+}
+
 
 /*
  * ========================
@@ -157,6 +294,8 @@ static void Z_CheckHeap(void)
 
    for (block = mainzone->blocklist.next;; block = block->next)
    {
+      if (block->tag == ZONE_SLABTAG)
+         Z_CheckSlab(block);
       if (block->next == &mainzone->blocklist)
          break;	/* all blocks have been hit */
       if ((byte *)block + block->size != (byte *)block->next)
@@ -219,6 +358,7 @@ static void *Z_TagMalloc(int size, int tag)
    mainzone->rover = base->next;  /* next allocation starts looking here */
 
    base->id = ZONEID;
+   base->slab = 0;
 
    /* marker for memory trash testing */
    *(int *)((byte *)base + base->size - 4) = ZONEID;
@@ -227,17 +367,184 @@ static void *Z_TagMalloc(int size, int tag)
 }
 
 
+
+/*
+ * ========================
+ * Z_SlabClass
+ *
+ * The size class an allocation is carved from a slab in, or -1 if it's
+ * too big for any
+ * ========================
+ */
+static int Z_SlabClass(int size)
+{
+   int i;
+
+   size += sizeof(memblock_t) + 4;
+   for (i = 0; i < ZONE_NUMCLASSES; i++)
+      if (size <= zone_classes[i])
+         return i;
+
+   return -1;
+}
+
+
+static zslab_t *Z_NewSlab(int sizeclass)
+{
+   memblock_t *block, *chunk;
+   zslab_t *slab;
+   int i, size;
+   void *buf;
+
+   size = zone_classes[sizeclass];
+   buf = Z_TagMalloc(ZONE_SLABHEADER - sizeof(memblock_t)
+         + size * ZONE_SLABCHUNKS, ZONE_SLABTAG);
+   if (!buf)
+      return NULL;
+
+   block = (memblock_t *)((byte *)buf - sizeof(memblock_t));
+   slab = ZONE_SLAB(block);
+   slab->sizeclass = sizeclass;
+   slab->used = 0;
+   slab->free = NULL;
+
+   for (i = ZONE_SLABCHUNKS - 1; i >= 0; i--)
+   {
+      chunk = (memblock_t *)((byte *)block + ZONE_SLABHEADER + i * size);
+      chunk->size = size;
+      chunk->tag = 0;
+      chunk->id = ZONEID;
+      chunk->prev = block;
+      chunk->slab = sizeclass + 1;
+      chunk->next = slab->free;
+      slab->free = chunk;
+
+      /* marker for memory trash testing */
+      *(int *)((byte *)chunk + size - 4) = ZONEID;
+   }
+
+   slab->prev = NULL;
+   slab->next = zone_slabs[sizeclass];
+   if (slab->next)
+      slab->next->prev = slab;
+   zone_slabs[sizeclass] = slab;
+
+   return slab;
+}
+
+
+static void Z_UnlinkSlab(zslab_t *slab)
+{
+   if (slab->prev)
+      slab->prev->next = slab->next;
+   else
+      zone_slabs[slab->sizeclass] = slab->next;
+   if (slab->next)
+      slab->next->prev = slab->prev;
+   slab->next = slab->prev = NULL;
+}
+
+
+static void *Z_SlabMalloc(int sizeclass)
+{
+   memblock_t *chunk;
+   zslab_t *slab;
+
+   slab = zone_slabs[sizeclass];
+   if (!slab)
+   {
+      slab = Z_NewSlab(sizeclass);
+      if (!slab)
+         return NULL;
+   }
+
+   chunk = slab->free;
+   slab->free = chunk->next;
+   if (!slab->free)
+      Z_UnlinkSlab(slab);	/* full, nothing more to give out */
+   slab->used++;
+
+   chunk->tag = 1;
+   chunk->next = NULL;
+
+   return (void *)((byte *)chunk + sizeof(memblock_t));
+}
+
+
+/*
+ * ========================
+ * Z_SlabFree
+ *
+ * Empty slabs go back to the zone, except the last one of their size
+ * class with free chunks, so one allocation and free in a loop doesn't
+ * create and destroy a slab each time
+ * ========================
+ */
+static void Z_SlabFree(memblock_t *chunk)
+{
+   memblock_t *block = chunk->prev;
+   zslab_t *slab = ZONE_SLAB(block);
+   int sizeclass = slab->sizeclass;
+
+   if (!slab->free)
+   {
+      slab->prev = NULL;
+      slab->next = zone_slabs[sizeclass];
+      if (slab->next)
+         slab->next->prev = slab;
+      zone_slabs[sizeclass] = slab;
+   }
+
+   chunk->tag = 0;
+   chunk->next = slab->free;
+   slab->free = chunk;
+   slab->used--;
+
+   if (!slab->used && (slab->next || slab->prev))
+   {
+      Z_UnlinkSlab(slab);
+      Z_Free((byte *)block + sizeof(memblock_t));
+   }
+}
+
+
+/*
+ * Small allocations come from a slab when there's room for one, the rest
+ * from the zone's block list
+ */
+static void *Z_Alloc(int size)
+{
+   int sizeclass;
+   void *buf;
+
+   buf = NULL;
+   sizeclass = Z_SlabClass(size);
+   if (sizeclass >= 0)
+      buf = Z_SlabMalloc(sizeclass);
+   if (!buf)
+      buf = Z_TagMalloc(size, 1);
+   if (buf)
+   {
+      zone_used += ((memblock_t *)buf - 1)->size;
+      if (memtrace_active)
+         Memory_Trace(MEMTRACE_ZONE, NULL, 1, size);
+   }
+
+   return buf;
+}
+
+
 /*
  * ========================
  * Z_Malloc
  * ========================
  */
-void * Z_Malloc(int size)
+static void *Z_MallocLocked(int size)
 {
    void *buf;
 
    Z_CheckHeap();		/* DEBUG */
-   buf = Z_TagMalloc(size, 1);
+   buf = Z_Alloc(size);
    if (!buf)
       Sys_Error("%s: failed on allocation of %i bytes", __func__, size);
    memset(buf, 0, size);
@@ -245,65 +552,595 @@ void * Z_Malloc(int size)
    return buf;
 }
 
+void *Z_Malloc(int size)
+{
+   void *buf;
+
+   Memory_Lock();
+   buf = Z_MallocLocked(size);
+   Memory_Unlock();
+
+   return buf;
+}
+
+/*
+ * ========================
+ * Z_Realloc
+ * ========================
+ */
+static void *Z_ReallocLocked(const void *ptr, int size)
+{
+   memblock_t *block;
+   int orig_size, sizeclass;
+   void *ret;
+
+   if (!ptr)
+      return Z_Malloc(size);
+
+   block = (memblock_t *)((byte *)ptr - sizeof(memblock_t));
+   if (block->id != ZONEID)
+      Sys_Error("%s: realloced a pointer without ZONEID", __func__);
+   if (!block->tag)
+      Sys_Error("%s: realloced a freed pointer", __func__);
+
+   orig_size = block->size;
+   orig_size -= sizeof(memblock_t);
+   orig_size -= 4;
+
+   sizeclass = Z_SlabClass(size);
+   if (block->slab || sizeclass >= 0)
+   {
+      /* still fits the chunk it's in */
+      if (block->slab == sizeclass + 1)
+         return (void *)ptr;
+
+      ret = Z_Alloc(size);
+      if (!ret)
+         Sys_Error("%s: failed on allocation of %i bytes", __func__, size);
+      memcpy(ret, ptr, qmin(orig_size, size));
+      Z_Free(ptr);
+
+      return ret;
+   }
+
+   Z_Free(ptr);
+   ret = Z_TagMalloc(size, 1);
+   if (!ret)
+      Sys_Error("%s: failed on allocation of %i bytes", __func__, size);
+   zone_used += ((memblock_t *)ret - 1)->size;
+   if (memtrace_active)
+      Memory_Trace(MEMTRACE_ZONE, NULL, 1, size);
+   if (ret != ptr)
+      memmove(ret, ptr, qmin(orig_size, size));
+
+   return ret;
+}
+
+void *Z_Realloc(const void *ptr, int size)
+{
+   void *buf;
+
+   Memory_Lock();
+   buf = Z_ReallocLocked(ptr, size);
+   Memory_Unlock();
+
+   return buf;
+}
+
+/* ======================================================================= */
+
+#define	HUNK_SENTINAL	0x1df001ed
+
+#ifdef HEXEN2
+#define HUNK_NAMELEN	20
+#else
+#define HUNK_NAMELEN	8
+#endif
+
+typedef struct
+{
+   int sentinal;
+   int size;		/* including sizeof(hunk_t), -1 = not allocated */
+   char name[HUNK_NAMELEN]; /* not necessarily zero terminated */
+} hunk_t;
+
+static byte *hunk_base;
+static int hunk_size;
+
+static int hunk_low_used;
+static int hunk_high_used;
+
+static qboolean hunk_tempactive;
+static int hunk_tempmark;
+
+/*
+ * ===========================================================================
+ *
+ * ALLOCATION TRACE
+ *
+ * With "memtrace on" (or -memtrace) every hunk, cache and zone allocation
+ * and release is recorded with the time, the load phase and how much of
+ * each area is in use after it. "memtrace write" saves the peaks for each
+ * phase followed by the whole timeline, to size -mem and -zone from.
+ * ===========================================================================
+ */
+
+#define MEMTRACE_MAX		65536
+#define MEMTRACE_NAMELEN	16
+#define MEMTRACE_MAXPHASES	32
+
+typedef struct
+{
+   double time;
+   short kind;
+   short phase;
+   int tag;
+   int size;
+   int low, high, cache, zone;	/* in use after the event */
+   char name[MEMTRACE_NAMELEN];
+} memtrace_t;
+
+static const char *memtrace_kinds[MEMTRACE_NUMKINDS] = {
+   "hunk", "high", "temp", "lowmark", "highmark",
+   "cache", "cachefree", "zone", "zonefree", "phase"
+};
+
+static memtrace_t *memtrace_events;
+static int memtrace_count;
+static int memtrace_dropped;	/* past the end of the buffer */
+static char memtrace_phases[MEMTRACE_MAXPHASES][MEMTRACE_NAMELEN];
+static int memtrace_numphases;
+static int memtrace_phase;
+
+static void Memory_Trace(memtracekind_t kind, const char *name, int tag,
+      int size)
+{
+   memtrace_t *event;
+
+   if (memtrace_count == MEMTRACE_MAX)
+   {
+      memtrace_dropped++;
+      return;
+   }
+
+   event = &memtrace_events[memtrace_count++];
+   event->time = Sys_DoubleTime();
+   event->kind = kind;
+   event->phase = memtrace_phase;
+   event->tag = tag;
+   event->size = size;
+   event->low = hunk_low_used;
+   event->high = hunk_high_used;
+   event->cache = Cache_Used();
+   event->zone = zone_used;
+   event->name[0] = 0;
+   if (name)
+      snprintf(event->name, sizeof(event->name), "%s", name);
+}
+
+/*
+ * ===================
+ * Memory_TracePhase
+ *
+ * Marks the start of a load phase; allocations are counted against the
+ * last one named until the next
+ * ===================
+ */
+void Memory_TracePhase(const char *phase)
+{
+   int i;
+
+   for (i = 0; i < memtrace_numphases; i++)
+      if (!strncmp(memtrace_phases[i], phase, MEMTRACE_NAMELEN - 1))
+         break;
+   if (i == memtrace_numphases)
+   {
+      if (i == MEMTRACE_MAXPHASES)
+         i--;		/* lump the rest in with the last */
+      else
+         memtrace_numphases++;
+      snprintf(memtrace_phases[i], MEMTRACE_NAMELEN, "%s", phase);
+   }
+   memtrace_phase = i;
+
+   if (memtrace_active)
+      Memory_Trace(MEMTRACE_PHASE, phase, 0, 0);
+}
+
+static void Memory_TraceStart(void)
+{
+   if (memtrace_active)
+      return;
+   if (!memtrace_events)
+   {
+      memtrace_events = (memtrace_t *)malloc(MEMTRACE_MAX * sizeof(memtrace_t));
+      if (!memtrace_events)
+      {
+         Con_Printf("Not enough memory for the allocation trace\n");
+         return;
+      }
+   }
+   memtrace_active = true;
+}
+
+/*
+ * ===================
+ * Memory_TraceWrite
+ *
+ * The peak use of each area while each phase was current, then every
+ * event, as CSV
+ * ===================
+ */
+static void Memory_TraceWrite(const char *filename)
+{
+   char path[MAX_OSPATH];
+   int peaks[MEMTRACE_MAXPHASES][5];
+   const memtrace_t *event;
+   int i, phase, total;
+   FILE *f;
+
+   if (!memtrace_count)
+   {
+      Con_Printf("No allocations traced, use memtrace on\n");
+      return;
+   }
+   if (strstr(filename, ".."))
+   {
+      Con_Printf("Relative pathnames are not allowed.\n");
+      return;
+   }
+   if (snprintf(path, sizeof(path) - 4, "%s/%s", com_savedir, filename)
+         >= sizeof(path) - 4)
+   {
+      Con_Printf("Filename too long.\n");
+      return;
+   }
+   COM_DefaultExtension(path, ".csv");
+   f = fopen(path, "w");
+   if (!f)
+   {
+      Con_Printf("ERROR: couldn't open %s.\n", path);
+      return;
+   }
+
+   memset(peaks, 0, sizeof(peaks));
+   for (i = 0, event = memtrace_events; i < memtrace_count; i++, event++)
+   {
+      phase = event->phase;
+      total = event->low + event->high + event->cache;
+      peaks[phase][0] = qmax(peaks[phase][0], event->low);
+      peaks[phase][1] = qmax(peaks[phase][1], event->high);
+      peaks[phase][2] = qmax(peaks[phase][2], event->cache);
+      peaks[phase][3] = qmax(peaks[phase][3], event->zone);
+      peaks[phase][4] = qmax(peaks[phase][4], total);
+   }
+
+   fprintf(f, "phase,peak_low,peak_high,peak_cache,peak_zone,peak_hunk\n");
+   for (i = 0; i < memtrace_numphases; i++)
+      fprintf(f, "%s,%d,%d,%d,%d,%d\n", memtrace_phases[i], peaks[i][0],
+            peaks[i][1], peaks[i][2], peaks[i][3], peaks[i][4]);
+   fprintf(f, "\n");
+
+   fprintf(f, "time,phase,kind,name,tag,size,low,high,cache,zone\n");
+   for (i = 0, event = memtrace_events; i < memtrace_count; i++, event++)
+      fprintf(f, "%.6f,%s,%s,%s,%d,%d,%d,%d,%d,%d\n",
+            event->time - memtrace_events[0].time,
+            memtrace_phases[event->phase], memtrace_kinds[event->kind],
+            event->name, event->tag, event->size, event->low, event->high,
+            event->cache, event->zone);
+   fclose(f);
+
+   Con_Printf("Wrote %d allocations to %s", memtrace_count, path);
+   if (memtrace_dropped)
+      Con_Printf(" (%d more dropped)", memtrace_dropped);
+   Con_Printf("\n");
+}
+
+static void Memory_Trace_f(void)
+{
+   if (Cmd_Argc() == 2)
+   {
+      if (!strcmp(Cmd_Argv(1), "on"))
+      {
+         Memory_TraceStart();
+         return;
+      }
+      if (!strcmp(Cmd_Argv(1), "off"))
+      {
+         memtrace_active = false;
+         return;
+      }
+      if (!strcmp(Cmd_Argv(1), "clear"))
+      {
+         memtrace_count = 0;
+         memtrace_dropped = 0;
+         return;
+      }
+   }
+   if (Cmd_Argc() == 3 && !strcmp(Cmd_Argv(1), "write"))
+   {
+      Memory_TraceWrite(Cmd_Argv(2));
+      return;
+   }
+   Con_Printf("Usage: memtrace on|off|clear|write <filename>\n");
+}
+
+/*
+ * ===========================================================================
+ *
+ * HUNK COMMIT
+ *
+ * When the hunk is in a range from Memory_Reserve, only the pages in use are
+ * backed by memory. The bottom hunk_commit_low and top hunk_commit_high bytes
+ * are committed, growing a little ahead of the allocations at each end and
+ * given back when the hunk is freed down, so what's resident tracks what's
+ * loaded rather than the size reserved. The two never overlap.
+ * ===========================================================================
+ */
+
+#define HUNK_COMMIT_SLACK	0x40000	/* 256k committed past the used end */
+
+static byte *hunk_reservation;
+static int hunk_reservesize;
+static qboolean hunk_reserved;	/* hunk_base is the reservation */
+static int hunk_pagesize;
+static int hunk_commit_low;
+static int hunk_commit_high;
+
+/*
+ * ===================
+ * Memory_Reserve
+ *
+ * The buffer to pass to Memory_Init, address space only where that's
+ * supported and plain malloc'd memory where it isn't
+ * ===================
+ */
+void *Memory_Reserve(int size)
+{
+#ifdef HAVE_MMAP
+   void *buf;
+
+   if (!hunk_reservation)
+   {
+      buf = mmap(NULL, size, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (buf != MAP_FAILED)
+      {
+         hunk_reservation = (byte *)buf;
+         hunk_reservesize = size;
+         return buf;
+      }
+   }
+#endif
+
+   return malloc(size);
+}
+
+void Memory_Release(void *buf)
+{
+#ifdef HAVE_MMAP
+   if (buf && buf == hunk_reservation)
+   {
+      munmap(buf, hunk_reservesize);
+      hunk_reservation = NULL;
+      if (hunk_base == buf)
+         hunk_reserved = false;
+      return;
+   }
+#endif
+
+   free(buf);
+}
+
+#ifdef HAVE_MMAP
+static int Hunk_PageAlign(int size)
+{
+   return (size + hunk_pagesize - 1) & ~(hunk_pagesize - 1);
+}
+
+static void Hunk_Protect(int offset, int size, int prot)
+{
+   byte *start = hunk_base + offset;
+   void *buf;
+   int err;
+
+   if (prot == PROT_NONE)
+   {
+      /* map fresh pages over the range, so the old ones are released */
+      buf = mmap(start, size, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+      err = buf == MAP_FAILED;
+   }
+   else
+      err = mprotect(start, size, prot);
+
+   if (err)
+      Sys_Error("%s: couldn't %s %i bytes of the hunk", __func__,
+            prot == PROT_NONE ? "decommit" : "commit", size);
+}
+#endif
+
+/*
+ * ===================
+ * Hunk_CommitLow
+ *
+ * Makes the bottom used bytes of the hunk usable. Where the top end is
+ * already committed below that it's left to cover the rest.
+ * ===================
+ */
+static void Hunk_CommitLow(int used)
+{
+#ifdef HAVE_MMAP
+   int commit;
+
+   if (!hunk_reserved || used <= hunk_commit_low)
+      return;
+
+   commit = Hunk_PageAlign(used + HUNK_COMMIT_SLACK);
+   commit = qmin(commit, hunk_size - hunk_commit_high);
+   if (commit > hunk_commit_low)
+   {
+      Hunk_Protect(hunk_commit_low, commit - hunk_commit_low,
+            PROT_READ | PROT_WRITE);
+      hunk_commit_low = commit;
+   }
+#endif
+}
+
+static void Hunk_CommitHigh(int used)
+{
+#ifdef HAVE_MMAP
+   int commit;
+
+   if (!hunk_reserved || used <= hunk_commit_high)
+      return;
+
+   commit = Hunk_PageAlign(used + HUNK_COMMIT_SLACK);
+   commit = qmin(commit, hunk_size - hunk_commit_low);
+   if (commit > hunk_commit_high)
+   {
+      Hunk_Protect(hunk_size - commit, commit - hunk_commit_high,
+            PROT_READ | PROT_WRITE);
+      hunk_commit_high = commit;
+   }
+#endif
+}
+
+#ifdef HAVE_MMAP
+/*
+ * ===================
+ * Hunk_MoveCommit
+ *
+ * Makes the bottom low and top high bytes the committed ones, committing
+ * what the old ranges didn't cover and decommitting what the new ones
+ * don't. A page one side gives back that the other now covers stays
+ * committed, so data at the meeting point is never lost.
+ * ===================
+ */
+static void Hunk_MoveCommit(int low, int high)
+{
+   int edges[6], edge, i, j;
+   qboolean was, now;
+
+   edges[0] = 0;
+   edges[1] = hunk_commit_low;
+   edges[2] = hunk_size - hunk_commit_high;
+   edges[3] = low;
+   edges[4] = hunk_size - high;
+   edges[5] = hunk_size;
+   for (i = 1; i < 6; i++)
+   {
+      edge = edges[i];
+      for (j = i; j > 0 && edges[j - 1] > edge; j--)
+         edges[j] = edges[j - 1];
+      edges[j] = edge;
+   }
+
+   for (i = 0; i < 5; i++)
+   {
+      if (edges[i] == edges[i + 1])
+         continue;
+      was = edges[i] < hunk_commit_low
+         || edges[i] >= hunk_size - hunk_commit_high;
+      now = edges[i] < low || edges[i] >= hunk_size - high;
+      if (was != now)
+         Hunk_Protect(edges[i], edges[i + 1] - edges[i],
+               now ? PROT_READ | PROT_WRITE : PROT_NONE);
+   }
+
+   hunk_commit_low = low;
+   hunk_commit_high = high;
+}
+#endif
+
+/*
+ * ===================
+ * Hunk_Decommit
+ *
+ * Brings each side back to HUNK_COMMIT_SLACK past its used end, counting
+ * the cache as part of the low end. Where that would make the two
+ * overlap they meet in between instead, with what the low end uses past
+ * the meeting point covered by the top range, and the other way round.
+ * ===================
+ */
+static void Hunk_Decommit(void)
+{
+#ifdef HAVE_MMAP
+   int low, high, used;
+
+   if (!hunk_reserved)
+      return;
+
+   used = qmax(hunk_low_used, (int)(Cache_End() - hunk_base));
+   low = qmin(Hunk_PageAlign(used + HUNK_COMMIT_SLACK), hunk_size);
+   high = qmin(Hunk_PageAlign(hunk_high_used + HUNK_COMMIT_SLACK), hunk_size);
+   if (low + high > hunk_size)
+   {
+      low = qclamp(hunk_commit_low, hunk_size - high, low);
+      high = hunk_size - low;
+   }
+
+   if (low != hunk_commit_low || high != hunk_commit_high)
+      Hunk_MoveCommit(low, high);
+#endif
+}
+
 /*
- * ========================
- * Z_Realloc
- * ========================
+ * ===================
+ * Hunk_CommitCheck
+ *
+ * Grows the top of the hunk, grows the bottom into the pages committed
+ * for the top, frees the top and reads back what the bottom wrote
+ * ===================
  */
-void *Z_Realloc(const void *ptr, int size)
+static void Hunk_CommitCheck(void)
 {
-   memblock_t *block;
-   int orig_size;
-   void *ret;
+#ifdef HAVE_MMAP
+   int lowmark, highmark, space, lowsize, highsize, i;
+   byte *buf;
+   qboolean ok;
 
-   if (!ptr)
-      return Z_Malloc(size);
+   if (!hunk_reserved)
+   {
+      Con_Printf("The hunk isn't in reserved memory\n");
+      return;
+   }
 
-   block = (memblock_t *)((byte *)ptr - sizeof(memblock_t));
-   if (block->id != ZONEID)
-      Sys_Error("%s: realloced a pointer without ZONEID", __func__);
-   if (!block->tag)
-      Sys_Error("%s: realloced a freed pointer", __func__);
+   space = hunk_size - hunk_low_used - hunk_high_used;
+   if (space < 4 * HUNK_COMMIT_SLACK)
+   {
+      Con_Printf("Not enough free hunk to check the commit\n");
+      return;
+   }
 
-   orig_size = block->size;
-   orig_size -= sizeof(memblock_t);
-   orig_size -= 4;
+   highsize = space / 2;
+   lowsize = space - highsize - 4 * sizeof(hunk_t) - 4096;
 
-   Z_Free(ptr);
-   ret = Z_TagMalloc(size, 1);
-   if (!ret)
-      Sys_Error("%s: failed on allocation of %i bytes", __func__, size);
-   if (ret != ptr)
-      memmove(ret, ptr, qmin(orig_size, size));
+   lowmark = Hunk_LowMark();
+   highmark = Hunk_HighMark();
+   Hunk_HighAllocName(highsize, "commitchk");
+   buf = (byte *)Hunk_AllocName(lowsize, "commitchk");
+   for (i = 0; i < lowsize; i += 1024)
+      buf[i] = (byte)(i >> 10) | 1;
+   buf[lowsize - 1] = 0xff;
 
-   return ret;
-}
+   Hunk_FreeToHighMark(highmark);
 
-/* ======================================================================= */
+   ok = buf[lowsize - 1] == 0xff;
+   for (i = 0; ok && i < lowsize; i += 1024)
+      ok = buf[i] == ((byte)(i >> 10) | 1);
+   ok = ok && hunk_commit_low + hunk_commit_high <= hunk_size;
+   ok = ok && (hunk_commit_low >= Hunk_PageAlign(hunk_low_used)
+         || hunk_commit_low + hunk_commit_high == hunk_size);
 
-#define	HUNK_SENTINAL	0x1df001ed
+   Hunk_FreeToLowMark(lowmark);
 
-#ifdef HEXEN2
-#define HUNK_NAMELEN	20
+   Con_Printf("Hunk commit check %s, %i bytes committed\n",
+         ok ? "passed" : "FAILED", hunk_commit_low + hunk_commit_high);
 #else
-#define HUNK_NAMELEN	8
+   Con_Printf("The hunk isn't in reserved memory\n");
 #endif
-
-typedef struct
-{
-   int sentinal;
-   int size;		/* including sizeof(hunk_t), -1 = not allocated */
-   char name[HUNK_NAMELEN]; /* not necessarily zero terminated */
-} hunk_t;
-
-static byte *hunk_base;
-static int hunk_size;
-
-static int hunk_low_used;
-static int hunk_high_used;
-
-static qboolean hunk_tempactive;
-static int hunk_tempmark;
+}
 
 /*
  * ==============
@@ -406,6 +1243,8 @@ static void Hunk_Print(qboolean all)
    }
    Con_Printf("-------------------------\n");
    Con_Printf("%8i total blocks\n", totalblocks);
+   if (hunk_reserved)
+      Con_Printf("%8i bytes committed\n", hunk_commit_low + hunk_commit_high);
 }
 
 static void Hunk_f(void)
@@ -419,8 +1258,12 @@ static void Hunk_f(void)
          Hunk_Print(true);
          return;
       }
+      if (!strcmp(Cmd_Argv(1), "commitcheck")) {
+         Hunk_CommitCheck();
+         return;
+      }
    }
-   Con_Printf("Usage: hunk print|printall\n");
+   Con_Printf("Usage: hunk print|printall|commitcheck\n");
 }
 
 /*
@@ -428,7 +1271,7 @@ static void Hunk_f(void)
  * Hunk_AllocName
  * ===================
  */
-void * Hunk_AllocName(int size, const char *name)
+static void *Hunk_AllocNameLocked(int size, const char *name)
 {
    hunk_t *h;
 
@@ -450,6 +1293,7 @@ void * Hunk_AllocName(int size, const char *name)
    hunk_low_used += size;
 
    Cache_FreeLow(hunk_low_used);
+   Hunk_CommitLow(hunk_low_used);
 
    memset(h, 0, size);
 
@@ -458,9 +1302,23 @@ void * Hunk_AllocName(int size, const char *name)
    memset(h->name, 0, HUNK_NAMELEN);
    memcpy(h->name, name, qmin((int)strlen(name), HUNK_NAMELEN));
 
+   if (memtrace_active)
+      Memory_Trace(MEMTRACE_HUNK, name, 0, size);
+
    return (void *)(h + 1);
 }
 
+void *Hunk_AllocName(int size, const char *name)
+{
+   void *buf;
+
+   Memory_Lock();
+   buf = Hunk_AllocNameLocked(size, name);
+   Memory_Unlock();
+
+   return buf;
+}
+
 /*
  * ===================
  * Hunk_Alloc
@@ -476,15 +1334,28 @@ int Hunk_LowMark(void)
    return hunk_low_used;
 }
 
-void Hunk_FreeToLowMark(int mark)
+static void Hunk_FreeToLowMarkLocked(int mark)
 {
+   int freed;
+
    if (mark < 0 || mark > hunk_low_used)
       Sys_Error("%s: bad mark %i", __func__, mark);
    memset(hunk_base + mark, 0, hunk_low_used - mark);
+   freed = hunk_low_used - mark;
    hunk_low_used = mark;
+   if (memtrace_active && freed)
+      Memory_Trace(MEMTRACE_LOWMARK, NULL, 0, freed);
+   Hunk_Decommit();
 }
 
-int Hunk_HighMark(void)
+void Hunk_FreeToLowMark(int mark)
+{
+   Memory_Lock();
+   Hunk_FreeToLowMarkLocked(mark);
+   Memory_Unlock();
+}
+
+static int Hunk_HighMarkLocked(void)
 {
    if (hunk_tempactive)
    {
@@ -495,8 +1366,21 @@ int Hunk_HighMark(void)
    return hunk_high_used;
 }
 
-void Hunk_FreeToHighMark(int mark)
+int Hunk_HighMark(void)
+{
+   int mark;
+
+   Memory_Lock();
+   mark = Hunk_HighMarkLocked();
+   Memory_Unlock();
+
+   return mark;
+}
+
+static void Hunk_FreeToHighMarkLocked(int mark)
 {
+   int freed;
+
    if (hunk_tempactive)
    {
       hunk_tempactive = false;
@@ -505,7 +1389,18 @@ void Hunk_FreeToHighMark(int mark)
    if (mark < 0 || mark > hunk_high_used)
       Sys_Error("%s: bad mark %i", __func__, mark);
    memset(hunk_base + hunk_size - hunk_high_used, 0, hunk_high_used - mark);
+   freed = hunk_high_used - mark;
    hunk_high_used = mark;
+   if (memtrace_active && freed)
+      Memory_Trace(MEMTRACE_HIGHMARK, NULL, 0, freed);
+   Hunk_Decommit();
+}
+
+void Hunk_FreeToHighMark(int mark)
+{
+   Memory_Lock();
+   Hunk_FreeToHighMarkLocked(mark);
+   Memory_Unlock();
 }
 
 
@@ -514,7 +1409,7 @@ void Hunk_FreeToHighMark(int mark)
  * Hunk_HighAllocName
  * ===================
  */
-void *Hunk_HighAllocName(int size, const char *name)
+static void *Hunk_HighAlloc(int size, const char *name, memtracekind_t kind)
 {
    hunk_t *h;
 
@@ -541,6 +1436,7 @@ void *Hunk_HighAllocName(int size, const char *name)
 
    hunk_high_used += size;
    Cache_FreeHigh(hunk_high_used);
+   Hunk_CommitHigh(hunk_high_used);
 
    h = (hunk_t *)(hunk_base + hunk_size - hunk_high_used);
 
@@ -550,9 +1446,28 @@ void *Hunk_HighAllocName(int size, const char *name)
    strncpy(h->name, name, HUNK_NAMELEN - 1);
    h->name[HUNK_NAMELEN - 1] = 0;
 
+   if (memtrace_active)
+      Memory_Trace(kind, name, 0, size);
+
    return (void *)(h + 1);
 }
 
+static void *Hunk_HighAllocNameLocked(int size, const char *name)
+{
+   return Hunk_HighAlloc(size, name, MEMTRACE_HIGH);
+}
+
+void *Hunk_HighAllocName(int size, const char *name)
+{
+   void *buf;
+
+   Memory_Lock();
+   buf = Hunk_HighAllocNameLocked(size, name);
+   Memory_Unlock();
+
+   return buf;
+}
+
 
 /*
  * =================
@@ -561,7 +1476,7 @@ void *Hunk_HighAllocName(int size, const char *name)
  * Return space from the top of the hunk
  * =================
  */
-void *Hunk_TempAlloc(int size)
+static void *Hunk_TempAllocLocked(int size)
 {
    void *buf;
 
@@ -575,13 +1490,24 @@ void *Hunk_TempAlloc(int size)
 
    hunk_tempmark = Hunk_HighMark();
 
-   buf = Hunk_HighAllocName(size, "temp");
+   buf = Hunk_HighAlloc(size, "temp", MEMTRACE_TEMP);
 
    hunk_tempactive = true;
 
    return buf;
 }
 
+void *Hunk_TempAlloc(int size)
+{
+   void *buf;
+
+   Memory_Lock();
+   buf = Hunk_TempAllocLocked(size);
+   Memory_Unlock();
+
+   return buf;
+}
+
 /*
  * =====================
  * Hunk_TempAllocExtend
@@ -590,7 +1516,7 @@ void *Hunk_TempAlloc(int size)
  * Size is the number of extra bytes required
  * =====================
  */
-void *Hunk_TempAllocExtend(int size)
+static void *Hunk_TempAllocExtendLocked(int size)
 {
    hunk_t *old, *newobj;
 
@@ -612,14 +1538,29 @@ void *Hunk_TempAllocExtend(int size)
 
    hunk_high_used += size;
    Cache_FreeHigh(hunk_high_used);
+   Hunk_CommitHigh(hunk_high_used);
 
    newobj = (hunk_t *)(hunk_base + hunk_size - hunk_high_used);
    memmove(newobj, old, sizeof(hunk_t));
    newobj->size += size;
 
+   if (memtrace_active)
+      Memory_Trace(MEMTRACE_TEMP, "temp", 0, size);
+
    return (void *)(newobj + 1);
 }
 
+void *Hunk_TempAllocExtend(int size)
+{
+   void *buf;
+
+   Memory_Lock();
+   buf = Hunk_TempAllocExtendLocked(size);
+   Memory_Unlock();
+
+   return buf;
+}
+
 /*
  * ===========================================================================
  *
@@ -637,10 +1578,47 @@ typedef struct cache_system_s
    char name[CACHE_NAMELEN];
    struct cache_system_s *prev, *next;
    struct cache_system_s *lru_prev, *lru_next;	/* for LRU flushing */
+   int segment;			/* the LRU list it's on */
+   int hits;			/* aged when it reaches the protected tail */
 } cache_system_t;
 
-static cache_system_t cache_head;
+/*
+ * The cache is a segmented LRU. New data goes on the probation list and
+ * moves to the protected list the first time it's looked up again, so data
+ * used once (a sound played at the start of a map, say) is thrown out
+ * before data that's wanted every frame. The protected list holds at most
+ * CACHE_PROTECTED_SHARE of the free hunk; past that its tail drops back to
+ * probation, except entries hit CACHE_PINHITS times or more, which have
+ * their count halved and go round again instead.
+ */
+#define CACHE_PROBATION		0
+#define CACHE_PROTECTED		1
+#define CACHE_NUMSEGMENTS	2
+
+#define CACHE_PROTECTED_SHARE	0.75
+#define CACHE_PINHITS		8
+#define CACHE_MAXHITS		64
+
+static cache_system_t cache_head;	/* and the probation LRU list */
+static cache_system_t cache_protected;	/* LRU list only */
+static int cache_segbytes[CACHE_NUMSEGMENTS];
+static int cache_segcount[CACHE_NUMSEGMENTS];
+
+static struct {
+   int hits;
+   int misses;
+   int allocs;
+   double allocbytes;
+   int evictions;
+   double evictbytes;
+   int reloads;		/* allocs for data that was evicted */
+   double reloadbytes;
+} cache_stats;
+
 static cache_system_t *Cache_TryAlloc(int size, qboolean nobottom);
+static void Cache_UnlinkLRU(cache_system_t *cs);
+static void Cache_MakeLRU(cache_system_t *cs, int segment);
+static void Cache_Remove(cache_user_t *c);
 
 static INLINE cache_system_t *Cache_System(const cache_user_t *c)
 {
@@ -652,6 +1630,32 @@ static INLINE void *Cache_Data(const cache_system_t *c)
    return (byte *)(c + 1) + c->user->pad;
 }
 
+static int Cache_Used(void)
+{
+   return cache_segbytes[CACHE_PROBATION] + cache_segbytes[CACHE_PROTECTED];
+}
+
+/* the end of the highest cache block, or the low hunk if there are none */
+static byte *Cache_End(void)
+{
+   cache_system_t *c = cache_head.prev;
+
+   if (c == &cache_head)
+      return hunk_base + hunk_low_used;
+   return (byte *)c + c->size;
+}
+
+/*
+ * Throws out data to make room, so loading it again counts as a reload
+ */
+static void Cache_Evict(cache_system_t *cs)
+{
+   cache_stats.evictions++;
+   cache_stats.evictbytes += cs->size;
+   cs->user->evicted = true;
+   Cache_Free(cs->user);
+}
+
 /*
  * ===========
  * Cache_Move
@@ -668,15 +1672,27 @@ static void Cache_Move(cache_system_t *c)
       memcpy(newobj + 1, c + 1, c->size - sizeof(cache_system_t));
       newobj->user = c->user;
       memcpy(newobj->name, c->name, sizeof(newobj->name));
+
+      /* take its place in the LRU lists too */
+      Cache_UnlinkLRU(newobj);
+      newobj->segment = c->segment;
+      newobj->hits = c->hits;
+      newobj->lru_next = c;
+      newobj->lru_prev = c->lru_prev;
+      c->lru_prev->lru_next = newobj;
+      c->lru_prev = newobj;
+      cache_segbytes[newobj->segment] += newobj->size;
+      cache_segcount[newobj->segment]++;
+
       pad = c->user->pad;
-      Cache_Free(c->user);
+      Cache_Remove(c->user);
       newobj->user->pad = pad;
       newobj->user->data = Cache_Data(newobj);
    }
    else
    {
       /* tough luck... */
-      Cache_Free(c->user);
+      Cache_Evict(c);
    }
 }
 
@@ -722,7 +1738,7 @@ static void Cache_FreeHigh(int new_high_hunk)
       if ((byte *)c + c->size <= hunk_base + hunk_size - new_high_hunk)
          return;		/* there is space to grow the hunk */
       if (c == prev)
-         Cache_Free(c->user);	/* didn't move out of the way */
+         Cache_Evict(c);	/* didn't move out of the way */
       else
       {
          Cache_Move(c);	/* try to move it */
@@ -740,17 +1756,68 @@ static void Cache_UnlinkLRU(cache_system_t *cs)
    cs->lru_prev->lru_next = cs->lru_next;
 
    cs->lru_prev = cs->lru_next = NULL;
+
+   cache_segbytes[cs->segment] -= cs->size;
+   cache_segcount[cs->segment]--;
 }
 
-static void Cache_MakeLRU(cache_system_t *cs)
+static void Cache_MakeLRU(cache_system_t *cs, int segment)
 {
+   cache_system_t *head;
+
    if (cs->lru_next || cs->lru_prev)
       Sys_Error("%s: active link", __func__);
 
-   cache_head.lru_next->lru_prev = cs;
-   cs->lru_next = cache_head.lru_next;
-   cs->lru_prev = &cache_head;
-   cache_head.lru_next = cs;
+   head = segment == CACHE_PROTECTED ? &cache_protected : &cache_head;
+   head->lru_next->lru_prev = cs;
+   cs->lru_next = head->lru_next;
+   cs->lru_prev = head;
+   head->lru_next = cs;
+
+   cs->segment = segment;
+   cache_segbytes[segment] += cs->size;
+   cache_segcount[segment]++;
+}
+
+/*
+ * ============
+ * Cache_Balance
+ *
+ * Keeps the protected list within its share of the cache
+ * ============
+ */
+static void Cache_Balance(void)
+{
+   cache_system_t *cs;
+   int limit;
+
+   limit = (hunk_size - hunk_low_used - hunk_high_used) * CACHE_PROTECTED_SHARE;
+   while (cache_segbytes[CACHE_PROTECTED] > limit)
+   {
+      cs = cache_protected.lru_prev;
+      Cache_UnlinkLRU(cs);
+      if (cs->hits >= CACHE_PINHITS)
+      {
+         cs->hits >>= 1;
+         Cache_MakeLRU(cs, CACHE_PROTECTED);
+      }
+      else
+         Cache_MakeLRU(cs, CACHE_PROBATION);
+   }
+}
+
+/*
+ * The next to be thrown out: the probation list's oldest, then the
+ * protected list's
+ */
+static cache_system_t *Cache_Victim(void)
+{
+   if (cache_head.lru_prev != &cache_head)
+      return cache_head.lru_prev;
+   if (cache_protected.lru_prev != &cache_protected)
+      return cache_protected.lru_prev;
+
+   return NULL;
 }
 
 /*
@@ -772,13 +1839,14 @@ static cache_system_t *Cache_TryAlloc(int size, qboolean nobottom)
          Sys_Error("%s: %i is greater than free hunk", __func__, size);
 
       newobj = (cache_system_t *)(hunk_base + hunk_low_used);
+      Hunk_CommitLow((byte *)newobj + size - hunk_base);
       memset(newobj, 0, sizeof(*newobj));
       newobj->size = size;
 
       cache_head.prev = cache_head.next = newobj;
       newobj->prev = newobj->next = &cache_head;
 
-      Cache_MakeLRU(newobj);
+      Cache_MakeLRU(newobj, CACHE_PROBATION);
       return newobj;
    }
 
@@ -792,6 +1860,7 @@ static cache_system_t *Cache_TryAlloc(int size, qboolean nobottom)
       {
          if ((byte *)cs - (byte *)newobj >= size)
          {	/* found space */
+            Hunk_CommitLow((byte *)newobj + size - hunk_base);
             memset(newobj, 0, sizeof(*newobj));
             newobj->size = size;
 
@@ -800,7 +1869,7 @@ static cache_system_t *Cache_TryAlloc(int size, qboolean nobottom)
             cs->prev->next = newobj;
             cs->prev = newobj;
 
-            Cache_MakeLRU(newobj);
+            Cache_MakeLRU(newobj, CACHE_PROBATION);
 
             return newobj;
          }
@@ -814,6 +1883,7 @@ static cache_system_t *Cache_TryAlloc(int size, qboolean nobottom)
 
    /* try to allocate one at the very end */
    if (hunk_base + hunk_size - hunk_high_used - (byte *)newobj >= size) {
+      Hunk_CommitLow((byte *)newobj + size - hunk_base);
       memset(newobj, 0, sizeof(*newobj));
       newobj->size = size;
 
@@ -822,7 +1892,7 @@ static cache_system_t *Cache_TryAlloc(int size, qboolean nobottom)
       cache_head.prev->next = newobj;
       cache_head.prev = newobj;
 
-      Cache_MakeLRU(newobj);
+      Cache_MakeLRU(newobj, CACHE_PROBATION);
 
       return newobj;
    }
@@ -837,12 +1907,19 @@ static cache_system_t *Cache_TryAlloc(int size, qboolean nobottom)
  * Throw everything out, so new data will be demand cached
  * ============
  */
-void Cache_Flush(void)
+static void Cache_FlushLocked(void)
 {
    while (cache_head.next != &cache_head)
       Cache_Free(cache_head.next->user);	/* reclaim the space */
 }
 
+void Cache_Flush(void)
+{
+   Memory_Lock();
+   Cache_FlushLocked();
+   Memory_Unlock();
+}
+
 /*
  * ============
  * Cache_Print
@@ -853,10 +1930,44 @@ static void Cache_Print(void)
    cache_system_t *cd;
 
    for (cd = cache_head.next; cd != &cache_head; cd = cd->next) {
-      Con_Printf("%8i : %s\n", cd->size, cd->name);
+      Con_Printf("%8i : %s%s\n", cd->size, cd->name,
+            cd->segment == CACHE_PROTECTED ? " (protected)" : "");
    }
 }
 
+/*
+ * ============
+ * Cache_Stats
+ * ============
+ */
+static void Cache_Stats(void)
+{
+   cache_system_t *cs;
+   int lookups, pinned;
+
+   pinned = 0;
+   for (cs = cache_protected.lru_next; cs != &cache_protected; cs = cs->lru_next)
+      if (cs->hits >= CACHE_PINHITS)
+         pinned++;
+
+   lookups = cache_stats.hits + cache_stats.misses;
+   Con_Printf("%10i hits (%.1f%%)\n", cache_stats.hits,
+         lookups ? cache_stats.hits * 100.0 / lookups : 0.0);
+   Con_Printf("%10i misses\n", cache_stats.misses);
+   Con_Printf("%10i allocs, %.1f KB\n", cache_stats.allocs,
+         cache_stats.allocbytes / 1024);
+   Con_Printf("%10i reloads, %.1f KB\n", cache_stats.reloads,
+         cache_stats.reloadbytes / 1024);
+   Con_Printf("%10i evictions, %.1f KB\n", cache_stats.evictions,
+         cache_stats.evictbytes / 1024);
+   Con_Printf("%10i on probation, %.1f KB\n",
+         cache_segcount[CACHE_PROBATION],
+         cache_segbytes[CACHE_PROBATION] / 1024.0);
+   Con_Printf("%10i protected, %.1f KB, %i pinned\n",
+         cache_segcount[CACHE_PROTECTED],
+         cache_segbytes[CACHE_PROTECTED] / 1024.0, pinned);
+}
+
 /*
  * ============
  * Cache_Report
@@ -892,6 +2003,10 @@ static void Cache_Init(void)
 {
    cache_head.next = cache_head.prev = &cache_head;
    cache_head.lru_next = cache_head.lru_prev = &cache_head;
+   cache_protected.lru_next = cache_protected.lru_prev = &cache_protected;
+   memset(cache_segbytes, 0, sizeof(cache_segbytes));
+   memset(cache_segcount, 0, sizeof(cache_segcount));
+   memset(&cache_stats, 0, sizeof(cache_stats));
 
    Cmd_AddCommand ("flush", Cache_Flush);
 }
@@ -903,7 +2018,7 @@ static void Cache_Init(void)
  * Frees the memory and removes it from the LRU list
  * ==============
  */
-void Cache_Free(cache_user_t *c)
+static void Cache_Remove(cache_user_t *c)
 {
    cache_system_t *cs;
 
@@ -921,27 +2036,69 @@ void Cache_Free(cache_user_t *c)
    Cache_UnlinkLRU(cs);
 }
 
+static void Cache_FreeLocked(cache_user_t *c)
+{
+   cache_system_t *cs;
+
+   if (memtrace_active && c->data)
+   {
+      cs = Cache_System(c);
+      Cache_Remove(c);
+      Memory_Trace(MEMTRACE_CACHEFREE, cs->name, 0, cs->size);
+      return;
+   }
+   Cache_Remove(c);
+}
+
+void Cache_Free(cache_user_t *c)
+{
+   Memory_Lock();
+   Cache_FreeLocked(c);
+   Memory_Unlock();
+}
+
 /*
  * ==============
  * Cache_Check
  * ==============
  */
-void *Cache_Check(const cache_user_t *c)
+static void *Cache_CheckLocked(const cache_user_t *c)
 {
    cache_system_t *cs;
+   int segment;
 
    if (!c->data)
+   {
+      cache_stats.misses++;
       return NULL;
+   }
 
    cs = Cache_System(c);
+   cache_stats.hits++;
+   if (cs->hits < CACHE_MAXHITS)
+      cs->hits++;
 
-   /* move to head of LRU */
+   /* move to head of the protected LRU */
+   segment = cs->segment;
    Cache_UnlinkLRU(cs);
-   Cache_MakeLRU(cs);
+   Cache_MakeLRU(cs, CACHE_PROTECTED);
+   if (segment != CACHE_PROTECTED)
+      Cache_Balance();
 
    return c->data;
 }
 
+void *Cache_Check(const cache_user_t *c)
+{
+   void *buf;
+
+   Memory_Lock();
+   buf = Cache_CheckLocked(c);
+   Memory_Unlock();
+
+   return buf;
+}
+
 
 /*
  * ==============
@@ -958,7 +2115,8 @@ void *Cache_Alloc(cache_user_t *c, int size, const char *name)
  * Cache_AllocPadded
  * ==============
  */
-void *Cache_AllocPadded(cache_user_t *c, int pad, int size, const char *name)
+static void *Cache_AllocPaddedLocked(cache_user_t *c, int pad, int size,
+      const char *name)
 {
    if (c->data)
       Sys_Error("%s: allready allocated", __func__);
@@ -982,13 +2140,37 @@ void *Cache_AllocPadded(cache_user_t *c, int pad, int size, const char *name)
          break;
       }
       /* free the least recently used cache data */
-      if (cache_head.lru_prev == &cache_head)
+      cs = Cache_Victim();
+      if (!cs)
          Sys_Error("%s: out of memory", __func__);
       /* not enough memory at all */
-      Cache_Free(cache_head.lru_prev->user);
+      Cache_Evict(cs);
+   }
+
+   if (memtrace_active)
+      Memory_Trace(MEMTRACE_CACHE, name, 0, size);
+
+   cache_stats.allocs++;
+   cache_stats.allocbytes += size;
+   if (c->evicted)
+   {
+      cache_stats.reloads++;
+      cache_stats.reloadbytes += size;
+      c->evicted = false;
    }
 
-   return Cache_Check(c);
+   return c->data;
+}
+
+void *Cache_AllocPadded(cache_user_t *c, int pad, int size, const char *name)
+{
+   void *buf;
+
+   Memory_Lock();
+   buf = Cache_AllocPaddedLocked(c, pad, size, name);
+   Memory_Unlock();
+
+   return buf;
 }
 
 static void Cache_f(void)
@@ -1005,8 +2187,98 @@ static void Cache_f(void)
          Cache_Flush();
          return;
       }
+      if (!strcmp(Cmd_Argv(1), "stats"))
+      {
+         Cache_Stats();
+         return;
+      }
+   }
+   Con_Printf("Usage: cache print|flush|stats\n");
+}
+
+/*
+ * ===========================================================================
+ *
+ * FRAME ARENA
+ *
+ * Scratch memory that only has to last until the end of the host frame.
+ * Allocation bumps a pointer through one block; what doesn't fit is
+ * malloc'd on the side, and at the next Frame_Reset the block grows to
+ * hold the whole of the busiest frame so far. Main thread only.
+ * ===========================================================================
+ */
+
+#define FRAME_ARENA_SIZE	0x80000	/* 512k to start with */
+
+typedef struct frameoverflow_s
+{
+   struct frameoverflow_s *next;
+} frameoverflow_t;
+
+static byte *frame_arena;
+static int frame_size;
+static int frame_used;		/* in the arena block */
+static int frame_wanted;	/* including what overflowed */
+static frameoverflow_t *frame_overflow;
+
+void Frame_Reset(void)
+{
+   frameoverflow_t *overflow;
+
+   while (frame_overflow)
+   {
+      overflow = frame_overflow;
+      frame_overflow = overflow->next;
+      free(overflow);
+   }
+
+   if (frame_wanted > frame_size)
+   {
+      free(frame_arena);
+      frame_size = (frame_wanted + frame_wanted / 2 + 0xffff) & ~0xffff;
+      frame_arena = (byte *)malloc(frame_size);
+      if (!frame_arena)
+         Sys_Error("%s: couldn't allocate %i bytes", __func__, frame_size);
+   }
+
+   frame_used = 0;
+   frame_wanted = 0;
+}
+
+void *Frame_Alloc(int size)
+{
+   frameoverflow_t *overflow;
+   void *buf;
+
+   if (size < 0)
+      Sys_Error("%s: bad size: %i", __func__, size);
+
+   size = (size + 15) & ~15;
+   frame_wanted += size;
+
+   if (!frame_arena)
+   {
+      frame_size = qmax(FRAME_ARENA_SIZE, size);
+      frame_arena = (byte *)malloc(frame_size);
+      if (!frame_arena)
+         Sys_Error("%s: couldn't allocate %i bytes", __func__, frame_size);
+   }
+
+   if (frame_size - frame_used >= size)
+   {
+      buf = frame_arena + frame_used;
+      frame_used += size;
+      return buf;
    }
-   Con_Printf("Usage: cache print|flush\n");
+
+   /* header padded to keep the 16 byte alignment */
+   overflow = (frameoverflow_t *)malloc(size + 16);
+   if (!overflow)
+      Sys_Error("%s: couldn't allocate %i bytes", __func__, size);
+   overflow->next = frame_overflow;
+   frame_overflow = overflow;
+
+   return (byte *)overflow + 16;
 }
 
 /* ========================================================================= */
@@ -1021,13 +2293,42 @@ void Memory_Init(void *buf, int size)
 {
    int p;
    int zonesize = DYNAMIC_SIZE;
+#ifdef HAVE_THREADS
+   static qboolean lockinit;
+   pthread_mutexattr_t attr;
+
+   if (!lockinit)
+   {
+      pthread_mutexattr_init(&attr);
+      pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+      pthread_mutex_init(&memory_lock, &attr);
+      pthread_mutexattr_destroy(&attr);
+      lockinit = true;
+   }
+#endif
 
    hunk_base = (byte*)buf;
    hunk_size = size;
    hunk_low_used = 0;
    hunk_high_used = 0;
 
+   hunk_reserved = false;
+#ifdef HAVE_MMAP
+   if (hunk_base && hunk_base == hunk_reservation)
+   {
+      hunk_reserved = true;
+      hunk_pagesize = sysconf(_SC_PAGESIZE);
+      hunk_size = qmin(size, hunk_reservesize) & ~(hunk_pagesize - 1);
+      hunk_commit_low = 0;
+      hunk_commit_high = 0;
+   }
+#endif
+
    Cache_Init();
+   Memory_TracePhase("init");
+   if (COM_CheckParm("-memtrace"))
+      Memory_TraceStart();
+
    p = COM_CheckParm("-zone");
    if (p) {
       if (p < com_argc - 1)
@@ -1043,4 +2344,5 @@ void Memory_Init(void *buf, int size)
    Cmd_AddCommand("flush", Cache_Flush);
    Cmd_AddCommand("hunk", Hunk_f);
    Cmd_AddCommand("cache", Cache_f);
+   Cmd_AddCommand("memtrace", Memory_Trace_f);
 }
@@ -21,6 +21,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifndef ZONE_H
 #define ZONE_H
 
+#include "qtypes.h"
+
 /*
  memory allocation
 
@@ -89,6 +91,14 @@ Zone block
 
 void Memory_Init(void *buf, int size);
 
+// The buffer for Memory_Init. Where the platform allows it only address
+// space is reserved, and the hunk commits pages as it grows into them.
+void *Memory_Reserve(int size);
+void Memory_Release(void *buf);
+
+// Names the load phase the allocations traced from now on belong to
+void Memory_TracePhase(const char *phase);
+
 void Z_Free(const void *ptr);
 void *Z_Malloc(int size);	// returns 0 filled memory
 void *Z_Realloc(const void *ptr, int size);
@@ -109,9 +119,15 @@ void *Hunk_TempAllocExtend(int size);
 
 void Hunk_Check(void);
 
+// Scratch memory that's valid until the next Frame_Reset, which the host
+// does at the start of each frame. Not for use off the main thread.
+void *Frame_Alloc(int size);
+void Frame_Reset(void);
+
 typedef struct cache_user_s {
     void *data;
     int pad;
+    qboolean evicted;	// thrown out for room, so the next alloc is a reload
 } cache_user_t;
 
 void Cache_Flush(void);
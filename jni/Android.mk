@@ -9,6 +9,7 @@ include $(CORE_DIR)/Makefile.common
 
 COREFLAGS := -ffast-math -funroll-loops -DINLINE=inline -DNQ_HACK -DQBASEDIR=. -DTYR_VERSION=0.62 -D__LIBRETRO__ -DANDROID $(INCFLAGS)
 COREFLAGS += -DUSE_CODEC_WAVE -DUSE_CODEC_VORBIS -DUSE_CODEC_FLAC
+COREFLAGS += -DHAVE_MMAP -DHAVE_THREADS
 
 GIT_VERSION := " $(shell git rev-parse --short HEAD || echo unknown)"
 ifneq ($(GIT_VERSION)," unknown")